@@ -0,0 +1,176 @@
+#include "recorded_frames.hpp"
+
+#include "features/keypoints/keypoint_detection.hpp"
+#include "features/keypoints/keypoint_handler.hpp"
+#include "features/primitives/depth_map_transformation.hpp"
+#include "features/primitives/primitive_detection.hpp"
+#include "parameters.hpp"
+#include "types.hpp"
+
+#include <benchmark/benchmark.h>
+#include <vector>
+
+namespace rgbd_slam::benchmarks {
+
+using namespace features;
+
+/**
+ * \brief The organized clouds of the recorded frames, inputs of the primitive detection
+ */
+std::vector<matrixf> get_organized_clouds(const Recorded_Frames& frames)
+{
+    primitives::Depth_Map_Transformation depthOps(
+            frames.get_width(), frames.get_height(), parameters::detection::depthMapPatchSize_px);
+    std::vector<matrixf> clouds(frames.size());
+    for (size_t i = 0; i < frames.size(); ++i)
+        std::ignore = depthOps.get_organized_cloud_array(frames.get_depth_image(i), clouds[i]);
+    return clouds;
+}
+
+static void BM_get_organized_cloud_array(benchmark::State& state)
+{
+    const Recorded_Frames& frames = Recorded_Frames::get();
+    if (not frames.check(state))
+        return;
+
+    primitives::Depth_Map_Transformation depthOps(
+            frames.get_width(), frames.get_height(), parameters::detection::depthMapPatchSize_px);
+    matrixf organizedCloud;
+    size_t frameIndex = 0;
+    for (auto _: state)
+    {
+        const bool isValid = depthOps.get_organized_cloud_array(frames.get_depth_image(frameIndex++), organizedCloud);
+        benchmark::DoNotOptimize(isValid);
+        benchmark::DoNotOptimize(organizedCloud.data());
+    }
+    state.SetItemsProcessed(state.iterations() * frames.get_width() * frames.get_height());
+}
+BENCHMARK(BM_get_organized_cloud_array)->Unit(benchmark::kMillisecond);
+
+static void BM_rectify_and_organize(benchmark::State& state)
+{
+    const Recorded_Frames& frames = Recorded_Frames::get();
+    if (not frames.check(state))
+        return;
+
+    primitives::Depth_Map_Transformation depthOps(
+            frames.get_width(), frames.get_height(), parameters::detection::depthMapPatchSize_px);
+    cv::Mat_<float> rectifiedDepth;
+    matrixf organizedCloud;
+    size_t frameIndex = 0;
+    for (auto _: state)
+    {
+        const bool isValid =
+                depthOps.rectify_and_organize(frames.get_depth_image(frameIndex++), rectifiedDepth, organizedCloud);
+        benchmark::DoNotOptimize(isValid);
+        benchmark::DoNotOptimize(organizedCloud.data());
+    }
+    state.SetItemsProcessed(state.iterations() * frames.get_width() * frames.get_height());
+}
+BENCHMARK(BM_rectify_and_organize)->Unit(benchmark::kMillisecond);
+
+static void BM_find_primitives(benchmark::State& state)
+{
+    const Recorded_Frames& frames = Recorded_Frames::get();
+    if (not frames.check(state))
+        return;
+
+    const std::vector<matrixf>& clouds = get_organized_clouds(frames);
+    primitives::Primitive_Detection primitiveDetector(frames.get_width(), frames.get_height());
+    const primitives::tracked_plane_container trackedPlanes;
+    primitives::plane_container planes;
+    primitives::cylinder_container cylinders;
+    size_t frameIndex = 0;
+    for (auto _: state)
+    {
+        primitiveDetector.find_primitives(clouds[frameIndex % clouds.size()],
+                                          frames.get_depth_image(frameIndex),
+                                          trackedPlanes,
+                                          planes,
+                                          cylinders);
+        benchmark::DoNotOptimize(planes.data());
+        ++frameIndex;
+    }
+}
+BENCHMARK(BM_find_primitives)->Unit(benchmark::kMillisecond);
+
+/**
+ * \brief Keypoints of consecutive frames: with a forced detection in each frame (argument 1), or tracked by optical
+ * flow and detected at the refresh frequency (argument 0)
+ */
+static void BM_compute_keypoints(benchmark::State& state)
+{
+    const Recorded_Frames& frames = Recorded_Frames::get();
+    if (not frames.check(state))
+        return;
+
+    const bool forceKeypointDetection = state.range(0) != 0;
+    keypoints::Key_Point_Extraction pointDetector;
+    keypoints::KeypointsWithIdStruct trackedKeypoints;
+    size_t frameIndex = 0;
+    size_t keypointCount = 0;
+    for (auto _: state)
+    {
+        const keypoints::Keypoint_Handler& keypointObject =
+                pointDetector.compute_keypoints(frames.get_gray_image(frameIndex),
+                                                frames.get_depth_image(frameIndex),
+                                                trackedKeypoints,
+                                                forceKeypointDetection);
+        keypointCount += keypointObject.size();
+        ++frameIndex;
+
+        // track the keypoints of this frame in the next one
+        state.PauseTiming();
+        trackedKeypoints.clear();
+        trackedKeypoints.reserve(keypointObject.size());
+        for (size_t i = 0; i < keypointObject.size(); ++i)
+        {
+            const ScreenCoordinate& keypoint = keypointObject.get_keypoint(static_cast<uint>(i));
+            trackedKeypoints.add(i + 1, keypoint.x(), keypoint.y());
+        }
+        state.ResumeTiming();
+    }
+    state.counters["keypoints"] =
+            benchmark::Counter(static_cast<double>(keypointCount), benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_compute_keypoints)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+/**
+ * \brief Match the keypoints of a frame to themselves, as if they were map points projected at their own position
+ */
+static void BM_get_match_indexes(benchmark::State& state)
+{
+    const Recorded_Frames& frames = Recorded_Frames::get();
+    if (not frames.check(state))
+        return;
+
+    keypoints::Key_Point_Extraction pointDetector;
+    const keypoints::Keypoint_Handler& keypointObject = pointDetector.compute_keypoints(
+            frames.get_gray_image(0), frames.get_depth_image(0), keypoints::KeypointsWithIdStruct(), true);
+    if (keypointObject.size() == 0)
+    {
+        state.SkipWithError("No keypoints detected in the first recorded frame");
+        return;
+    }
+
+    const vectorb isKeyPointMatched = vectorb::Zero(static_cast<Eigen::Index>(keypointObject.size()));
+    const double searchRadius = keypointObject.get_search_radius();
+    for (auto _: state)
+    {
+        for (uint i = 0; i < keypointObject.size(); ++i)
+        {
+            if (not keypointObject.has_descriptor(i))
+                continue;
+            const keypoints::Keypoint_Handler::matchIndexSet& matches =
+                    keypointObject.get_match_indexes(keypointObject.get_keypoint(i).get_2D(),
+                                                     keypointObject.get_descriptor(i),
+                                                     isKeyPointMatched,
+                                                     searchRadius);
+            benchmark::DoNotOptimize(matches);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(keypointObject.size()));
+}
+BENCHMARK(BM_get_match_indexes)->Unit(benchmark::kMicrosecond);
+
+} // namespace rgbd_slam::benchmarks
@@ -0,0 +1,51 @@
+#include "tracking/kalman_filter.hpp"
+#include "types.hpp"
+
+#include <benchmark/benchmark.h>
+#include <random>
+#include <vector>
+
+namespace rgbd_slam::benchmarks {
+
+// measurements cycled through by the updates
+constexpr size_t measurementCount = 256;
+
+/**
+ * \brief Benchmark the state updates of a filter with no dynamics, as used by the map points (N = 3) and the map
+ * planes (N = 4)
+ */
+template<int N> static void BM_kalman_get_new_state(benchmark::State& state)
+{
+    using vectorN = Eigen::Vector<double, N>;
+    using matrixNN = Eigen::Matrix<double, N, N>;
+
+    const matrixNN identity = matrixNN::Identity();
+    const tracking::SharedKalmanFilter<N, N> kalmanFilter(identity, identity, matrixNN::Zero());
+
+    std::mt19937 randomEngine(1000);
+    std::normal_distribution<double> measurementNoise(0.0, 10.0);
+    std::vector<vectorN> measurements(measurementCount);
+    for (vectorN& measurement: measurements)
+        for (int i = 0; i < N; ++i)
+            measurement(i) = 1000.0 + measurementNoise(randomEngine);
+    const matrixNN measurementCovariance = identity * 100.0;
+
+    vectorN currentState = measurements.front();
+    matrixNN currentCovariance = identity * 400.0;
+    size_t measurementIndex = 0;
+    for (auto _: state)
+    {
+        const vectorN& measurement = measurements[measurementIndex++ % measurementCount];
+        const auto& [newState, newCovariance] =
+                kalmanFilter.get_new_state(currentState, currentCovariance, measurement, measurementCovariance);
+        // keep the covariance from collapsing, so all the iterations do the same work
+        currentState = newState;
+        currentCovariance = newCovariance + identity;
+        benchmark::DoNotOptimize(currentState.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_kalman_get_new_state<3>);
+BENCHMARK(BM_kalman_get_new_state<4>);
+
+} // namespace rgbd_slam::benchmarks
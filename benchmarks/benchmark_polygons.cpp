@@ -0,0 +1,102 @@
+#include "types.hpp"
+#include "utils/polygon.hpp"
+
+#include <benchmark/benchmark.h>
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace rgbd_slam::benchmarks {
+
+/**
+ * \brief The boundary points of a plane detection: a noisy disk of the z = 0 plane
+ * \param[in] pointCount The number of boundary points
+ * \param[in] center The center of the disk
+ */
+std::vector<vector3> get_boundary_points(const size_t pointCount, const vector3& center)
+{
+    std::mt19937 randomEngine(1000);
+    std::uniform_real_distribution<double> radiusDistribution(900.0, 1000.0);
+    std::vector<vector3> points;
+    points.reserve(pointCount);
+    for (size_t i = 0; i < pointCount; ++i)
+    {
+        const double angle = 2.0 * M_PI * static_cast<double>(i) / static_cast<double>(pointCount);
+        const double radius = radiusDistribution(randomEngine);
+        points.emplace_back(center + vector3(radius * cos(angle), radius * sin(angle), 0.0));
+    }
+    return points;
+}
+
+/**
+ * \brief Two overlapping polygons, of the argument boundary point count
+ */
+std::pair<utils::Polygon, utils::Polygon> get_overlapping_polygons(const benchmark::State& state)
+{
+    const size_t pointCount = static_cast<size_t>(state.range(0));
+    const vector3 normal = vector3::UnitZ();
+    const vector3 otherCenter(600.0, 200.0, 0.0);
+    return {utils::Polygon(get_boundary_points(pointCount, vector3::Zero()), normal, vector3::Zero()),
+            utils::Polygon(get_boundary_points(pointCount, otherCenter), normal, otherCenter)};
+}
+
+static void BM_polygon_fitting(benchmark::State& state)
+{
+    const std::vector<vector3>& points = get_boundary_points(static_cast<size_t>(state.range(0)), vector3::Zero());
+    for (auto _: state)
+    {
+        const utils::Polygon polygon(points, vector3::UnitZ(), vector3::Zero());
+        benchmark::DoNotOptimize(polygon.get_area());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_polygon_fitting)->RangeMultiplier(4)->Range(16, 1024);
+
+static void BM_polygon_inter_over_union(benchmark::State& state)
+{
+    const auto& [polygon, otherPolygon] = get_overlapping_polygons(state);
+    for (auto _: state)
+        benchmark::DoNotOptimize(polygon.inter_over_union(otherPolygon));
+}
+BENCHMARK(BM_polygon_inter_over_union)->RangeMultiplier(4)->Range(16, 1024);
+
+static void BM_polygon_union_area(benchmark::State& state)
+{
+    const auto& [polygon, otherPolygon] = get_overlapping_polygons(state);
+    for (auto _: state)
+        benchmark::DoNotOptimize(polygon.union_area(otherPolygon));
+}
+BENCHMARK(BM_polygon_union_area)->RangeMultiplier(4)->Range(16, 1024);
+
+static void BM_polygon_merge_union(benchmark::State& state)
+{
+    const auto& [polygon, otherPolygon] = get_overlapping_polygons(state);
+    for (auto _: state)
+    {
+        state.PauseTiming();
+        utils::Polygon mergedPolygon = polygon;
+        state.ResumeTiming();
+
+        mergedPolygon.merge_union(otherPolygon);
+        benchmark::DoNotOptimize(mergedPolygon.get_area());
+    }
+}
+BENCHMARK(BM_polygon_merge_union)->RangeMultiplier(4)->Range(16, 1024);
+
+static void BM_polygon_contains(benchmark::State& state)
+{
+    const utils::Polygon polygon = get_overlapping_polygons(state).first;
+    std::mt19937 randomEngine(1000);
+    std::uniform_real_distribution<double> coordinateDistribution(-1200.0, 1200.0);
+    std::vector<vector2> points(256);
+    for (vector2& point: points)
+        point = vector2(coordinateDistribution(randomEngine), coordinateDistribution(randomEngine));
+
+    for (auto _: state)
+        for (const vector2& point: points)
+            benchmark::DoNotOptimize(polygon.contains(point));
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(points.size()));
+}
+BENCHMARK(BM_polygon_contains)->RangeMultiplier(4)->Range(16, 1024);
+
+} // namespace rgbd_slam::benchmarks
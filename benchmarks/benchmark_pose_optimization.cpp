@@ -0,0 +1,127 @@
+#include "recorded_frames.hpp"
+
+#include "coordinates/point_coordinates.hpp"
+#include "map_management/map_features/map_point.hpp"
+#include "matches_containers.hpp"
+#include "pose_optimization/pose_optimization.hpp"
+#include "types.hpp"
+#include "utils/camera_transformation.hpp"
+#include "utils/pose.hpp"
+
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <random>
+
+namespace rgbd_slam::benchmarks {
+
+// proportion of the matches that are outliers
+constexpr double outlierProportion = 0.2;
+
+/**
+ * \brief Point matches of a camera seen from a known pose: the world points are back projected from random pixels and
+ * depths, and a part of their screen points is replaced by random pixels
+ * \param[in] matchCount The number of matches to create
+ * \param[in] cameraPose The pose of the camera that observes the points
+ */
+matches_containers::match_container get_point_matches(const size_t matchCount, const utils::PoseBase& cameraPose)
+{
+    std::mt19937 randomEngine(1000);
+    const auto& imageSize = Parameters::get_camera_1_image_size();
+    std::uniform_real_distribution<double> xDistribution(10.0, imageSize.x() - 10.0);
+    std::uniform_real_distribution<double> yDistribution(10.0, imageSize.y() - 10.0);
+    std::uniform_real_distribution<double> depthDistribution(800.0, 4000.0);
+    std::normal_distribution<double> pixelNoise(0.0, 0.5);
+    std::bernoulli_distribution isOutlier(outlierProportion);
+
+    const CameraToWorldMatrix& cameraToWorld = utils::compute_camera_to_world_transform(
+            cameraPose.get_orientation_quaternion(), cameraPose.get_position());
+
+    matches_containers::match_container matches;
+    for (size_t i = 0; i < matchCount; ++i)
+    {
+        const ScreenCoordinate screenPoint(
+                xDistribution(randomEngine), yDistribution(randomEngine), depthDistribution(randomEngine));
+        const WorldCoordinate& worldPoint = screenPoint.to_world_coordinates(cameraToWorld);
+
+        const ScreenCoordinate2D matchedPoint =
+                isOutlier(randomEngine)
+                        ? ScreenCoordinate2D(xDistribution(randomEngine), yDistribution(randomEngine))
+                        : ScreenCoordinate2D(screenPoint.x() + pixelNoise(randomEngine),
+                                             screenPoint.y() + pixelNoise(randomEngine));
+        matches.push_back(std::make_shared<map_management::PointOptimizationFeature>(
+                matchedPoint, worldPoint, vector3::Constant(5.0), i + 1, i));
+    }
+    return matches;
+}
+
+/**
+ * \return The pose to find, and the predicted pose the optimization starts from
+ */
+std::pair<utils::PoseBase, utils::Pose> get_poses()
+{
+    const utils::PoseBase endPose(vector3(50.0, -30.0, 20.0), quaternion(Eigen::AngleAxisd(0.1, vector3::UnitY())));
+    const utils::Pose predictedPose(vector3::Zero(), quaternion::Identity());
+    return {endPose, predictedPose};
+}
+
+/**
+ * \brief The full pose estimation of a frame: RANSAC on the matches, then refinement on the inliers
+ */
+static void BM_compute_optimized_pose(benchmark::State& state)
+{
+    std::ignore = Recorded_Frames::get(); // load the parameters
+
+    const auto& [endPose, predictedPose] = get_poses();
+    const matches_containers::match_container& matches =
+            get_point_matches(static_cast<size_t>(state.range(0)), endPose);
+    utils::Pose optimizedPose;
+    matches_containers::match_sets featureSets;
+    for (auto _: state)
+    {
+        const bool isPoseValid = pose_optimization::Pose_Optimization::compute_optimized_pose(
+                predictedPose, matches, optimizedPose, featureSets);
+        benchmark::DoNotOptimize(isPoseValid);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_compute_optimized_pose)->RangeMultiplier(4)->Range(32, 512)->Unit(benchmark::kMillisecond);
+
+static void BM_compute_pose_variance(benchmark::State& state)
+{
+    std::ignore = Recorded_Frames::get(); // load the parameters
+
+    const utils::PoseBase endPose = get_poses().first;
+    const matches_containers::match_container& matches =
+            get_point_matches(static_cast<size_t>(state.range(0)), endPose);
+    matrix66 poseCovariance;
+    for (auto _: state)
+    {
+        const bool isCovarianceValid =
+                pose_optimization::Pose_Optimization::compute_pose_variance(endPose, matches, poseCovariance);
+        benchmark::DoNotOptimize(isCovarianceValid);
+        benchmark::DoNotOptimize(poseCovariance.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_compute_pose_variance)->RangeMultiplier(4)->Range(32, 512)->Unit(benchmark::kMillisecond);
+
+static void BM_compute_pose_covariance(benchmark::State& state)
+{
+    std::ignore = Recorded_Frames::get(); // load the parameters
+
+    const utils::PoseBase endPose = get_poses().first;
+    const matches_containers::match_container& matches =
+            get_point_matches(static_cast<size_t>(state.range(0)), endPose);
+    matrix66 poseCovariance;
+    for (auto _: state)
+    {
+        const bool isCovarianceValid =
+                pose_optimization::Pose_Optimization::compute_pose_covariance(endPose, matches, poseCovariance);
+        benchmark::DoNotOptimize(isCovarianceValid);
+        benchmark::DoNotOptimize(poseCovariance.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_compute_pose_covariance)->RangeMultiplier(4)->Range(32, 512)->Unit(benchmark::kMicrosecond);
+
+} // namespace rgbd_slam::benchmarks
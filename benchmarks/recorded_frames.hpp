@@ -0,0 +1,104 @@
+#ifndef RGBDSLAM_BENCHMARKS_RECORDEDFRAMES_HPP
+#define RGBDSLAM_BENCHMARKS_RECORDEDFRAMES_HPP
+
+#include "packed_sequence.hpp"
+#include "parameters.hpp"
+#include "utils/task_scheduler.hpp"
+
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include <opencv2/imgproc.hpp>
+#include <string>
+#include <vector>
+
+namespace rgbd_slam::benchmarks {
+
+/**
+ * \brief The recorded frames used by the benchmarks, loaded once from the packed sequence of a dataset folder (see
+ * examples/packed_sequence.hpp, created by running slam_TUM with -k).
+ * The folder is given by the RGBDSLAM_BENCHMARK_DATA environment variable, ./data/TUM/fr1_xyz/ by default, and must
+ * contain the configuration.yaml of the dataset. Without recorded frames the default parameters are loaded, and the
+ * benchmarks on frames are skipped
+ */
+class Recorded_Frames
+{
+  public:
+    // frames kept in memory: enough to change of image between iterations, without measuring the page faults
+    static constexpr size_t maximumFrameCount = 30;
+
+    [[nodiscard]] static const Recorded_Frames& get()
+    {
+        static const Recorded_Frames frames;
+        return frames;
+    }
+
+    [[nodiscard]] bool empty() const noexcept { return _depthImages.empty(); }
+    [[nodiscard]] size_t size() const noexcept { return _depthImages.size(); }
+
+    [[nodiscard]] uint get_width() const noexcept { return _width; }
+    [[nodiscard]] uint get_height() const noexcept { return _height; }
+
+    [[nodiscard]] const cv::Mat& get_rgb_image(const size_t index) const noexcept
+    {
+        return _rgbImages[index % size()];
+    }
+    [[nodiscard]] const cv::Mat& get_gray_image(const size_t index) const noexcept
+    {
+        return _grayImages[index % size()];
+    }
+    [[nodiscard]] const cv::Mat_<float>& get_depth_image(const size_t index) const noexcept
+    {
+        return _depthImages[index % size()];
+    }
+
+    /**
+     * \brief Skip a benchmark when there is no recorded frames
+     * \return false if the benchmark was skipped
+     */
+    [[nodiscard]] bool check(benchmark::State& state) const
+    {
+        if (not empty())
+            return true;
+        state.SkipWithError("No recorded frames: pack a sequence in the RGBDSLAM_BENCHMARK_DATA folder");
+        return false;
+    }
+
+  private:
+    Recorded_Frames()
+    {
+        const char* const dataPathVariable = std::getenv("RGBDSLAM_BENCHMARK_DATA");
+        std::string dataPath = dataPathVariable != nullptr ? dataPathVariable : "./data/TUM/fr1_xyz/";
+        if (not dataPath.empty() and dataPath.back() != '/')
+            dataPath += '/';
+
+        if (not Parameters::parse_file(dataPath + "configuration.yaml"))
+        {
+            Parameters::load_defaut();
+        }
+        else
+        {
+            PackedSequenceReader reader(dataPath + "sequence.rgbdseq", 0, 0);
+            LoadedFrame frame;
+            while (reader.is_valid() and _depthImages.size() < maximumFrameCount and reader.pop(frame))
+            {
+                // the mapped images are released by the next pop: keep a copy
+                _rgbImages.emplace_back(frame.rgbImage.clone());
+                _depthImages.emplace_back(frame.depthImage.clone());
+                cv::cvtColor(_rgbImages.back(), _grayImages.emplace_back(), cv::COLOR_BGR2GRAY);
+            }
+            _width = reader.get_width();
+            _height = reader.get_height();
+        }
+        utils::Task_Scheduler::initialize(Parameters::get_core_number());
+    }
+
+    uint _width = 0;
+    uint _height = 0;
+    std::vector<cv::Mat> _rgbImages;
+    std::vector<cv::Mat> _grayImages;
+    std::vector<cv::Mat_<float>> _depthImages;
+};
+
+} // namespace rgbd_slam::benchmarks
+
+#endif
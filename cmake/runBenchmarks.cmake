@@ -0,0 +1,50 @@
+
+
+# Micro benchmarks of the hot kernels, built when Google Benchmark is installed
+find_package(benchmark QUIET)
+if(NOT benchmark_FOUND)
+    MESSAGE("Google Benchmark not found, the benchmarks are not built")
+    return()
+endif()
+
+set(BENCHMARKS benchmarks)
+
+add_executable(benchmarkFeatureDetection
+    ${BENCHMARKS}/benchmark_feature_detection.cpp
+    )
+add_executable(benchmarkPoseOptimization
+    ${BENCHMARKS}/benchmark_pose_optimization.cpp
+    )
+add_executable(benchmarkKalmanFiltering
+    ${BENCHMARKS}/benchmark_kalman_filtering.cpp
+    )
+add_executable(benchmarkPolygons
+    ${BENCHMARKS}/benchmark_polygons.cpp
+    )
+
+target_link_libraries(benchmarkFeatureDetection
+    benchmark::benchmark_main
+    ${PROJECT_NAME}
+    )
+target_link_libraries(benchmarkPoseOptimization
+    benchmark::benchmark_main
+    ${PROJECT_NAME}
+    )
+target_link_libraries(benchmarkKalmanFiltering
+    benchmark::benchmark_main
+    ${PROJECT_NAME}
+    )
+target_link_libraries(benchmarkPolygons
+    benchmark::benchmark_main
+    ${PROJECT_NAME}
+    )
+
+# run all the benchmarks with: make benchmarks
+add_custom_target(benchmarks
+    COMMAND benchmarkFeatureDetection
+    COMMAND benchmarkPoseOptimization
+    COMMAND benchmarkKalmanFiltering
+    COMMAND benchmarkPolygons
+    DEPENDS benchmarkFeatureDetection benchmarkPoseOptimization benchmarkKalmanFiltering benchmarkPolygons
+    WORKING_DIRECTORY ${CMAKE_BINARY_DIR}
+    )
@@ -16,6 +16,30 @@ add_executable(testPolygons
 add_executable(testMotionModel
     ${TESTS}/test_motion_model.cpp
     )
+add_executable(testIndexSet
+    ${TESTS}/test_index_set.cpp
+    )
+add_executable(testUnionFind
+    ${TESTS}/test_union_find.cpp
+    )
+add_executable(testMapState
+    ${TESTS}/test_map_state.cpp
+    )
+add_executable(testPlaneOrientationIndex
+    ${TESTS}/test_plane_orientation_index.cpp
+    )
+add_executable(testSpscQueue
+    ${TESTS}/test_spsc_queue.cpp
+    )
+add_executable(testMapDelta
+    ${TESTS}/test_map_delta.cpp
+    )
+add_executable(testCellMask
+    ${TESTS}/test_cell_mask.cpp
+    )
+add_executable(testMapTracking
+    ${TESTS}/test_map_tracking.cpp
+    )
 
 target_link_libraries(testCoordinateSystems
     gtest_main
@@ -37,6 +61,38 @@ target_link_libraries(testMotionModel
     gtest_main
     ${PROJECT_NAME}
     )
+target_link_libraries(testIndexSet
+    gtest_main
+    ${PROJECT_NAME}
+    )
+target_link_libraries(testUnionFind
+    gtest_main
+    ${PROJECT_NAME}
+    )
+target_link_libraries(testMapState
+    gtest_main
+    ${PROJECT_NAME}
+    )
+target_link_libraries(testPlaneOrientationIndex
+    gtest_main
+    ${PROJECT_NAME}
+    )
+target_link_libraries(testSpscQueue
+    gtest_main
+    ${PROJECT_NAME}
+    )
+target_link_libraries(testMapDelta
+    gtest_main
+    ${PROJECT_NAME}
+    )
+target_link_libraries(testCellMask
+    gtest_main
+    ${PROJECT_NAME}
+    )
+target_link_libraries(testMapTracking
+    gtest_main
+    ${PROJECT_NAME}
+    )
 
 include(GoogleTest)
 gtest_discover_tests(testCoordinateSystems)
@@ -44,3 +100,11 @@ gtest_discover_tests(testPoseOptimization)
 gtest_discover_tests(testKalmanFiltering)
 gtest_discover_tests(testPolygons)
 gtest_discover_tests(testMotionModel)
+gtest_discover_tests(testIndexSet)
+gtest_discover_tests(testUnionFind)
+gtest_discover_tests(testMapState)
+gtest_discover_tests(testPlaneOrientationIndex)
+gtest_discover_tests(testSpscQueue)
+gtest_discover_tests(testMapDelta)
+gtest_discover_tests(testCellMask)
+gtest_discover_tests(testMapTracking)
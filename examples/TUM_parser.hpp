@@ -1,3 +1,6 @@
+#ifndef RGBDSLAM_EXAMPLES_TUM_PARSER_HPP
+#define RGBDSLAM_EXAMPLES_TUM_PARSER_HPP
+
 
 
 #include <Eigen/src/Core/Matrix.h>
@@ -60,6 +63,34 @@ class DatasetParser
         return associate_data(rgbFile, depthFile, groundTruth);
     }
 
+    /**
+     * \brief Parse a dataset folder: from its association file if there is one, else from its image lists
+     * \param[in] dataPath The dataset folder, ending with a separator
+     */
+    static std::vector<Data> parse_dataset_folder(const std::string& dataPath)
+    {
+        const std::string groundTruthPath = dataPath + "groundtruth.txt";
+        std::ifstream associationFile(dataPath + "associations.txt");
+        if (associationFile.is_open())
+        {
+            // an association file already exists
+            std::cout << "Using association file" << std::endl;
+
+            return parse_association_file(dataPath, groundTruthPath);
+        }
+        else
+        {
+            // parse the folder myself...
+            std::cout << "Generate association data" << std::endl;
+
+            // Get file & folder names
+            const std::string rgbImageListPath = dataPath + "rgb.txt";
+            const std::string depthImageListPath = dataPath + "depth.txt";
+
+            return parse_dataset(rgbImageListPath, depthImageListPath, groundTruthPath);
+        }
+    }
+
     static std::vector<Data> parse_association_file(const std::string& dataPath, const std::string& groundTruthListPath)
     {
         std::vector<Data> data;
@@ -325,3 +356,5 @@ class DatasetParser
         return finalSorted;
     }
 };
+
+#endif
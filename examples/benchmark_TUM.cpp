@@ -0,0 +1,339 @@
+// Headless benchmark of the whole tracking on a TUM sequence: replays the frames from memory, and writes the
+// latencies, memory use and trajectory errors in a JSON report.
+// The dataset can be found here:
+// https://vision.in.tum.de/data/datasets/rgbd-dataset
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "frame_metrics.hpp"
+#include "parameters.hpp"
+#include "pose.hpp"
+#include "rgbd_slam.hpp"
+#include "types.hpp"
+#include "TUM_parser.hpp"
+#include "dataset_reader.hpp"
+#include "packed_sequence.hpp"
+
+/**
+ * Allocation counters: every allocation of the program that goes through the global operator new. The allocations of
+ * the libraries that call malloc directly (the OpenCV image buffers) are not counted
+ */
+namespace {
+std::atomic<uint64_t> allocationCount = 0;
+std::atomic<uint64_t> allocatedBytes = 0;
+
+void* counted_allocation(const size_t size, const size_t alignment)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    // the aligned size must be a multiple of the alignment
+    const size_t allocatedSize = (std::max<size_t>(size, 1) + alignment - 1) / alignment * alignment;
+    void* pointer = alignment <= alignof(std::max_align_t) ? std::malloc(allocatedSize)
+                                                           : std::aligned_alloc(alignment, allocatedSize);
+    if (pointer == nullptr)
+        throw std::bad_alloc();
+    return pointer;
+}
+} // namespace
+
+void* operator new(const size_t size) { return counted_allocation(size, alignof(std::max_align_t)); }
+void* operator new(const size_t size, const std::align_val_t alignment)
+{
+    return counted_allocation(size, static_cast<size_t>(alignment));
+}
+void operator delete(void* pointer) noexcept { std::free(pointer); }
+void operator delete(void* pointer, size_t) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::align_val_t) noexcept { std::free(pointer); }
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept { std::free(pointer); }
+
+bool parse_parameters(int argc,
+                      char** argv,
+                      std::string& dataset,
+                      int& startIndex,
+                      unsigned int& jumpImages,
+                      unsigned int& maximumFrameCount,
+                      std::string& reportPath)
+{
+    const cv::String keys =
+            "{help h usage ?  |      | print this message     }"
+            "{@dataset        | fr1_xyz | Dataset to process }"
+            "{i index         |  0   | First image to parse   }"
+            "{j jump          |  0   | Only take every j image into consideration   }"
+            "{n frames        |  0   | Maximum number of tracked frames (0 for all the sequence) }"
+            "{o output        |      | Path of the JSON report (benchmark_TUM_<dataset>.json by default) }";
+
+    cv::CommandLineParser parser(argc, argv, keys);
+    parser.about("RGBD Slam v0 benchmark");
+
+    if (parser.has("help"))
+    {
+        parser.printMessage();
+        return false;
+    }
+
+    dataset = parser.get<std::string>("@dataset");
+    startIndex = parser.get<int>("i");
+    jumpImages = parser.get<unsigned int>("j");
+    maximumFrameCount = parser.get<unsigned int>("n");
+    reportPath = parser.get<std::string>("o");
+    if (reportPath.empty())
+        reportPath = "benchmark_TUM_" + dataset + ".json";
+
+    if (not parser.check())
+    {
+        std::cout << "RGBD SLAM: Some parameters are missing: call with -h to get the list of parameters";
+        parser.printErrors();
+    }
+    return parser.check();
+}
+
+/**
+ * \return The peak resident memory of the process, in bytes
+ */
+size_t get_peak_resident_memory()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return static_cast<size_t>(usage.ru_maxrss) * 1024; // in kilobytes on Linux
+}
+
+/**
+ * \return The value under which this proportion of the sorted values fall
+ */
+double get_percentile(const std::vector<double>& sortedValues, const double quantile)
+{
+    if (sortedValues.empty())
+        return 0.0;
+    const size_t index = static_cast<size_t>(std::ceil(quantile * static_cast<double>(sortedValues.size()))) - 1;
+    return sortedValues[std::min(index, sortedValues.size() - 1)];
+}
+
+/**
+ * \brief A pose of the ground truth, in millimeters as the tracked poses (the TUM ground truth is in meters)
+ */
+rgbd_slam::utils::PoseBase get_ground_truth_pose(const GroundTruth& groundTruth)
+{
+    return rgbd_slam::utils::PoseBase(groundTruth.position * 1000.0, groundTruth.rotation);
+}
+
+Eigen::Isometry3d get_transform(const rgbd_slam::utils::PoseBase& pose)
+{
+    Eigen::Isometry3d transform = Eigen::Isometry3d::Identity();
+    transform.linear() = pose.get_orientation_quaternion().toRotationMatrix();
+    transform.translation() = pose.get_position();
+    return transform;
+}
+
+/**
+ * \brief Error of a tracked trajectory to its ground truth
+ */
+struct Trajectory_Errors
+{
+    size_t _poseCount = 0;      // tracked poses with a ground truth
+    double _ateRmse = 0.0;      // absolute trajectory error, root mean square of the position errors, in millimeters
+    double _ateMax = 0.0;       // in millimeters
+    size_t _motionCount = 0;    // consecutive tracked poses with a ground truth
+    double _rpeTransRmse = 0.0; // relative pose error between consecutive frames, in millimeters
+    double _rpeRotRmse = 0.0;   // in degrees
+};
+
+/**
+ * \brief Compute the trajectory errors. Both trajectories start at the same pose, so they are not aligned first
+ * \param[in] trackedPoses The tracked poses of each frame
+ * \param[in] groundTruths The ground truth of each frame (if valid)
+ */
+Trajectory_Errors compute_trajectory_errors(const std::vector<rgbd_slam::utils::PoseBase>& trackedPoses,
+                                            const std::vector<const GroundTruth*>& groundTruths)
+{
+    Trajectory_Errors errors;
+    double ateSquaredSum = 0.0;
+    double rpeTransSquaredSum = 0.0;
+    double rpeRotSquaredSum = 0.0;
+    for (size_t i = 0; i < trackedPoses.size(); ++i)
+    {
+        if (not groundTruths[i]->isValid)
+            continue;
+
+        const rgbd_slam::utils::PoseBase& groundTruthPose = get_ground_truth_pose(*groundTruths[i]);
+        const double positionError = trackedPoses[i].get_position_error(groundTruthPose);
+        ateSquaredSum += positionError * positionError;
+        errors._ateMax = std::max(errors._ateMax, positionError);
+        ++errors._poseCount;
+
+        if (i == 0 or not groundTruths[i - 1]->isValid)
+            continue;
+        // error of the motion since the last frame
+        const Eigen::Isometry3d& trackedMotion =
+                get_transform(trackedPoses[i - 1]).inverse() * get_transform(trackedPoses[i]);
+        const Eigen::Isometry3d& groundTruthMotion =
+                get_transform(get_ground_truth_pose(*groundTruths[i - 1])).inverse() * get_transform(groundTruthPose);
+        const Eigen::Isometry3d& motionError = groundTruthMotion.inverse() * trackedMotion;
+        rpeTransSquaredSum += motionError.translation().squaredNorm();
+        const double rotationError = Eigen::AngleAxisd(motionError.linear()).angle() / rgbd_slam::EulerToRadian;
+        rpeRotSquaredSum += rotationError * rotationError;
+        ++errors._motionCount;
+    }
+
+    if (errors._poseCount > 0)
+        errors._ateRmse = std::sqrt(ateSquaredSum / static_cast<double>(errors._poseCount));
+    if (errors._motionCount > 0)
+    {
+        errors._rpeTransRmse = std::sqrt(rpeTransSquaredSum / static_cast<double>(errors._motionCount));
+        errors._rpeRotRmse = std::sqrt(rpeRotSquaredSum / static_cast<double>(errors._motionCount));
+    }
+    return errors;
+}
+
+int main(int argc, char* argv[])
+{
+    std::string dataset;
+    int startIndex;
+    uint jumpFrames = 0;
+    uint maximumFrameCount = 0;
+    std::string reportPath;
+    if (not parse_parameters(argc, argv, dataset, startIndex, jumpFrames, maximumFrameCount, reportPath))
+    {
+        return 0; // could not parse parameters correctly
+    }
+    const std::string dataPath = "./data/TUM/" + dataset + "/";
+
+    const std::vector<Data>& datasetContainer = DatasetParser::parse_dataset_folder(dataPath);
+    if (datasetContainer.empty())
+    {
+        std::cout << "Could not load any dataset elements at " << dataPath << std::endl;
+        return -1;
+    }
+
+    if (not rgbd_slam::Parameters::parse_file(dataPath + "configuration.yaml"))
+    {
+        std::cout << "Could not parse the parameter file at  " << (dataPath + "configuration.yaml") << std::endl;
+        return -1;
+    }
+    const uint width = rgbd_slam::Parameters::get_camera_1_image_size().x();
+    const uint height = rgbd_slam::Parameters::get_camera_1_image_size().y();
+
+    // preload the frames, so the measures do not include any image decoding or disk access. The frame source owns
+    // the dataset entries of the frames
+    const std::unique_ptr<FrameSource>& frameSource =
+            open_dataset_frames(dataPath, datasetContainer, startIndex, jumpFrames, width, height);
+    std::vector<LoadedFrame> frames;
+    LoadedFrame frame;
+    while ((maximumFrameCount == 0 or frames.size() < maximumFrameCount) and frameSource->pop(frame))
+    {
+        // the images of a packed sequence point into its mapping, released by the next pop
+        frame.rgbImage = frame.rgbImage.clone();
+        frame.depthImage = frame.depthImage.clone();
+        frames.emplace_back(std::move(frame));
+    }
+    if (frames.empty())
+    {
+        std::cout << "No frames to track" << std::endl;
+        return -1;
+    }
+    std::cout << "Tracking " << frames.size() << " preloaded frames" << std::endl;
+    const size_t preloadedResidentMemory = get_peak_resident_memory();
+
+    rgbd_slam::utils::Pose pose;
+    if (const GroundTruth& initialGroundTruth = frames.front().data->groundTruth; initialGroundTruth.isValid)
+        pose.set_parameters(initialGroundTruth.position * 1000.0, initialGroundTruth.rotation);
+
+    std::vector<double> frameDurations;
+    std::vector<rgbd_slam::utils::PoseBase> trackedPoses;
+    std::vector<const GroundTruth*> groundTruths;
+    frameDurations.reserve(frames.size());
+    trackedPoses.reserve(frames.size());
+    groundTruths.reserve(frames.size());
+
+    uint64_t trackingAllocationCount = 0;
+    uint64_t trackingAllocatedBytes = 0;
+    double totalDuration = 0.0;
+    {
+        rgbd_slam::RGBD_SLAM RGBD_Slam(pose, width, height);
+
+        const uint64_t startAllocationCount = allocationCount.load();
+        const uint64_t startAllocatedBytes = allocatedBytes.load();
+        const auto startTime = std::chrono::steady_clock::now();
+        for (const LoadedFrame& frame: frames)
+        {
+            const auto frameStartTime = std::chrono::steady_clock::now();
+            pose = RGBD_Slam.track(frame.rgbImage, frame.depthImage);
+            const std::chrono::duration<double> frameDuration = std::chrono::steady_clock::now() - frameStartTime;
+
+            frameDurations.emplace_back(frameDuration.count());
+            trackedPoses.emplace_back(pose);
+            groundTruths.emplace_back(&frame.data->groundTruth);
+        }
+        const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - startTime;
+        totalDuration = duration.count();
+        // the bookkeeping of the loop allocates nothing: all its vectors are reserved
+        trackingAllocationCount = allocationCount.load() - startAllocationCount;
+        trackingAllocatedBytes = allocatedBytes.load() - startAllocatedBytes;
+
+        std::ofstream report(reportPath);
+        if (not report.is_open())
+        {
+            std::cout << "Could not open the report file " << reportPath << std::endl;
+            return -1;
+        }
+
+        std::vector<double> sortedDurations = frameDurations;
+        std::sort(sortedDurations.begin(), sortedDurations.end());
+        const double frameCount = static_cast<double>(frames.size());
+        const Trajectory_Errors& errors = compute_trajectory_errors(trackedPoses, groundTruths);
+
+        // durations in milliseconds, memory in bytes, position errors in millimeters, rotation errors in degrees
+        report << std::fixed;
+        report << "{\n";
+        report << "  \"dataset\": \"" << dataset << "\",\n";
+        report << "  \"frames\": " << frames.size() << ",\n";
+        report << "  \"total_duration_s\": " << totalDuration << ",\n";
+        report << "  \"fps\": " << frameCount / totalDuration << ",\n";
+        report << "  \"frame_latency_ms\": {";
+        report << "\"mean\": " << totalDuration / frameCount * 1e3;
+        report << ", \"p50\": " << get_percentile(sortedDurations, 0.5) * 1e3;
+        report << ", \"p90\": " << get_percentile(sortedDurations, 0.9) * 1e3;
+        report << ", \"p99\": " << get_percentile(sortedDurations, 0.99) * 1e3;
+        report << ", \"max\": " << sortedDurations.back() * 1e3 << "},\n";
+        report << "  \"stage_latency_ms\": {";
+        for (size_t i = 0; i < rgbd_slam::outputs::frameStageCount; ++i)
+        {
+            const auto stage = static_cast<rgbd_slam::outputs::Frame_Stage>(i);
+            const rgbd_slam::outputs::Stage_Latency& latency = RGBD_Slam.get_stage_latency(stage);
+            report << (i == 0 ? "\n" : ",\n") << "    \"" << rgbd_slam::outputs::get_stage_name(stage) << "\": {";
+            report << "\"mean\": " << latency._mean * 1e3 << ", \"p50\": " << latency._p50 * 1e3;
+            report << ", \"p99\": " << latency._p99 * 1e3 << ", \"max\": " << latency._max * 1e3 << "}";
+        }
+        report << "\n  },\n";
+        report << "  \"peak_rss_bytes\": " << get_peak_resident_memory() << ",\n";
+        report << "  \"preloaded_rss_bytes\": " << preloadedResidentMemory << ",\n";
+        report << "  \"allocations_per_frame\": " << static_cast<double>(trackingAllocationCount) / frameCount << ",\n";
+        report << "  \"allocated_bytes_per_frame\": " << static_cast<double>(trackingAllocatedBytes) / frameCount
+               << ",\n";
+        report << "  \"ate_mm\": {\"poses\": " << errors._poseCount << ", \"rmse\": " << errors._ateRmse
+               << ", \"max\": " << errors._ateMax << "},\n";
+        report << "  \"rpe\": {\"motions\": " << errors._motionCount << ", \"translation_rmse_mm\": "
+               << errors._rpeTransRmse << ", \"rotation_rmse_deg\": " << errors._rpeRotRmse << "}\n";
+        report << "}\n";
+
+        std::cout << frames.size() << " frames in " << totalDuration << " s (" << frameCount / totalDuration
+                  << " fps), latency p50 " << get_percentile(sortedDurations, 0.5) * 1e3 << " ms, p99 "
+                  << get_percentile(sortedDurations, 0.99) * 1e3 << " ms" << std::endl;
+        std::cout << "ATE " << errors._ateRmse << " mm, RPE " << errors._rpeTransRmse << " mm "
+                  << errors._rpeRotRmse << " deg" << std::endl;
+        std::cout << "Report written to " << reportPath << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,194 @@
+#ifndef RGBDSLAM_EXAMPLES_DATASET_READER_HPP
+#define RGBDSLAM_EXAMPLES_DATASET_READER_HPP
+
+#include "TUM_parser.hpp"
+#include "frame_source.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * \brief Reads the frames of a parsed dataset ahead of the tracking: worker threads decode the images of the next
+ * frames in parallel and convert the depth to millimeters, and the frames are returned in dataset order.
+ * At most prefetchCount decoded frames wait in memory
+ */
+class DatasetReader : public FrameSource
+{
+  public:
+    /**
+     * \param[in] dataPath The folder of the dataset, the image paths are relative to it
+     * \param[in] dataset The parsed dataset entries. Must outlive this reader
+     * \param[in] startIndex Offset of the frame indexes
+     * \param[in] jumpFrames Only read the frames with an index multiple of this (0 to read all the frames)
+     * \param[in] width The width of the images, used for the missing images
+     * \param[in] height The height of the images, used for the missing images
+     * \param[in] depthScale Division from the depth image values to millimeters (5 in the TUM datasets)
+     * \param[in] prefetchCount Maximum number of decoded frames waiting for the tracking
+     * \param[in] decoderCount Number of decoding threads
+     */
+    DatasetReader(const std::string& dataPath,
+                  const std::vector<Data>& dataset,
+                  const unsigned int startIndex,
+                  const unsigned int jumpFrames,
+                  const unsigned int width,
+                  const unsigned int height,
+                  const double depthScale = 5.0,
+                  const size_t prefetchCount = 8,
+                  const unsigned int decoderCount = 3) :
+        _dataPath(dataPath),
+        _dataset(dataset),
+        _width(width),
+        _height(height),
+        _depthScale(depthScale),
+        _prefetchCount(std::max<size_t>(prefetchCount, 1))
+    {
+        for (size_t i = 0; i < dataset.size(); ++i)
+        {
+            const unsigned int frameIndex = startIndex + static_cast<unsigned int>(i);
+            if (jumpFrames == 0 or frameIndex % jumpFrames == 0)
+                _selectedFrames.emplace_back(i, frameIndex);
+        }
+
+        for (unsigned int i = 0; i < std::max(decoderCount, 1u); ++i)
+            _decoders.emplace_back(&DatasetReader::decode_frames, this);
+    }
+
+    ~DatasetReader() override
+    {
+        {
+            std::scoped_lock lock(_mutex);
+            _shouldStop = true;
+        }
+        _canDecode.notify_all();
+        for (std::thread& decoder: _decoders)
+            decoder.join();
+    }
+
+    /**
+     * \brief Get the next frame of the dataset, waiting for its decoding if needed
+     * \param[out] frame The next frame
+     * \return false if all the frames were read
+     */
+    [[nodiscard]] bool pop(LoadedFrame& frame) override
+    {
+        std::unique_lock lock(_mutex);
+        if (_nextFrameToPop >= _selectedFrames.size())
+            return false;
+
+        _isDecoded.wait(lock, [this]() {
+            return _decodedFrames.contains(_nextFrameToPop);
+        });
+        auto decodedFrame = _decodedFrames.find(_nextFrameToPop);
+        frame = std::move(decodedFrame->second);
+        _decodedFrames.erase(decodedFrame);
+        ++_nextFrameToPop;
+        lock.unlock();
+
+        // a slot is free for one more frame
+        _canDecode.notify_one();
+        return true;
+    }
+
+    /**
+     * \return The number of frames that will be returned, skipped frames excluded
+     */
+    [[nodiscard]] size_t size() const noexcept { return _selectedFrames.size(); }
+
+  private:
+    /**
+     * \brief Decoding thread function: decode the next frame not taken by another decoder
+     */
+    void decode_frames()
+    {
+        while (true)
+        {
+            size_t selectedIndex = 0;
+            {
+                std::unique_lock lock(_mutex);
+                _canDecode.wait(lock, [this]() {
+                    return _shouldStop or _nextFrameToDecode >= _selectedFrames.size() or
+                           _nextFrameToDecode < _nextFrameToPop + _prefetchCount;
+                });
+                if (_shouldStop or _nextFrameToDecode >= _selectedFrames.size())
+                    return;
+                selectedIndex = _nextFrameToDecode++;
+            }
+
+            const auto& [dataIndex, frameIndex] = _selectedFrames[selectedIndex];
+            LoadedFrame frame = decode_frame(dataIndex, frameIndex);
+            {
+                std::scoped_lock lock(_mutex);
+                _decodedFrames.emplace(selectedIndex, std::move(frame));
+            }
+            _isDecoded.notify_all();
+        }
+    }
+
+    /**
+     * \brief Load the images of a dataset entry, replacing the missing images by empty images
+     */
+    [[nodiscard]] LoadedFrame decode_frame(const size_t dataIndex, const unsigned int frameIndex) const
+    {
+        const Data& imageData = _dataset[dataIndex];
+        const std::string rgbImagePath = _dataPath + imageData.rgbImage.imagePath;
+        const std::string depthImagePath = _dataPath + imageData.depthImage.imagePath;
+
+        LoadedFrame frame;
+        frame.frameIndex = frameIndex;
+        frame.data = &imageData;
+        frame.timeStamp = imageData.depthImage.imageTimeStamp;
+
+        frame.rgbImage = cv::imread(rgbImagePath, cv::IMREAD_COLOR);
+        if (frame.rgbImage.empty())
+        {
+            rgbd_slam::outputs::log("No color image input, use black image");
+            if (imageData.rgbImage.isValid)
+                std::cerr << "Cannot load rgb image " << rgbImagePath << std::endl;
+            frame.rgbImage = cv::Mat(_height, _width, CV_8UC3, cv::Scalar(0, 0, 0));
+        }
+
+        const cv::Mat depthImage = cv::imread(depthImagePath, cv::IMREAD_ANYDEPTH);
+        if (depthImage.empty())
+        {
+            rgbd_slam::outputs::log("No depth image input, use empty depth");
+            if (imageData.depthImage.isValid)
+                std::cerr << "Could not load depth image " << depthImagePath << std::endl;
+            frame.depthImage = cv::Mat_<float>(_height, _width, 0.0f);
+        }
+        else
+        {
+            // convert to mm & float 32
+            depthImage.convertTo(frame.depthImage, CV_32FC1, 1.0 / _depthScale);
+        }
+        return frame;
+    }
+
+    const std::string _dataPath;
+    const std::vector<Data>& _dataset;
+    const unsigned int _width;
+    const unsigned int _height;
+    const double _depthScale;
+    const size_t _prefetchCount;
+
+    std::vector<std::pair<size_t, unsigned int>> _selectedFrames; // dataset entry and frame index of the read frames
+
+    std::mutex _mutex;
+    std::condition_variable _canDecode;
+    std::condition_variable _isDecoded;
+    std::map<size_t, LoadedFrame> _decodedFrames; // by rank in the selected frames
+    size_t _nextFrameToDecode = 0;
+    size_t _nextFrameToPop = 0;
+    bool _shouldStop = false;
+    std::vector<std::thread> _decoders;
+};
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef RGBDSLAM_EXAMPLES_FRAME_SOURCE_HPP
+#define RGBDSLAM_EXAMPLES_FRAME_SOURCE_HPP
+
+#include "TUM_parser.hpp"
+#include "bounded_queue.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <opencv2/core.hpp>
+#include <vector>
+
+/**
+ * \brief A frame ready for the tracking
+ */
+struct LoadedFrame
+{
+    unsigned int frameIndex = 0; // index of the frame in the sequence, offset by the start index
+    const Data* data = nullptr;  // the parsed dataset entry of this frame, null for the live sources
+    double timeStamp = 0.0;      // capture time of the depth image, in seconds (clock of the sensor for live sources)
+    cv::Mat rgbImage;
+    cv::Mat_<float> depthImage; // in millimeters
+    // keeps the buffers the images point into alive (driver frame, pooled buffers), released with the frame
+    std::shared_ptr<const void> bufferOwner;
+};
+
+/**
+ * \brief Interface of the frame inputs of the examples: dataset readers, packed sequences and live sensors
+ */
+class FrameSource
+{
+  public:
+    virtual ~FrameSource() = default;
+
+    /**
+     * \brief Get the next frame, waiting for it if needed
+     * \param[out] frame The next frame
+     * \return false if the source has no more frames
+     */
+    [[nodiscard]] virtual bool pop(LoadedFrame& frame) = 0;
+};
+
+/**
+ * \brief Preallocated image buffers, recycled when the frames that use them are released: the capture of a live
+ * sensor converts its driver buffers straight into them, without any allocation per frame
+ */
+class FrameBufferPool
+{
+  public:
+    struct Buffers
+    {
+        cv::Mat rgbImage;
+        cv::Mat_<float> depthImage;
+    };
+
+    /**
+     * \param[in] width The width of the images
+     * \param[in] height The height of the images
+     * \param[in] capacity The number of buffers: frames waiting in the source queue, plus the frame being tracked
+     */
+    FrameBufferPool(const unsigned int width, const unsigned int height, const size_t capacity) :
+        _state(std::make_shared<State>())
+    {
+        for (size_t i = 0; i < capacity; ++i)
+        {
+            auto buffers = std::make_unique<Buffers>();
+            buffers->rgbImage = cv::Mat(static_cast<int>(height), static_cast<int>(width), CV_8UC3);
+            buffers->depthImage = cv::Mat_<float>(static_cast<int>(height), static_cast<int>(width));
+            _state->_freeBuffers.emplace_back(std::move(buffers));
+        }
+    }
+
+    /**
+     * \brief Take free buffers, given back to the pool when the last copy of the returned pointer is released (even
+     * after the pool destruction)
+     * \return The buffers, or null if they are all in use
+     */
+    [[nodiscard]] std::shared_ptr<Buffers> acquire()
+    {
+        std::unique_ptr<Buffers> buffers;
+        {
+            std::scoped_lock lock(_state->_mutex);
+            if (_state->_freeBuffers.empty())
+                return nullptr;
+            buffers = std::move(_state->_freeBuffers.back());
+            _state->_freeBuffers.pop_back();
+        }
+        return std::shared_ptr<Buffers>(buffers.release(), [weakState = std::weak_ptr<State>(_state)](Buffers* used) {
+            std::unique_ptr<Buffers> recycled(used);
+            if (const std::shared_ptr<State>& state = weakState.lock(); state != nullptr)
+            {
+                std::scoped_lock lock(state->_mutex);
+                state->_freeBuffers.emplace_back(std::move(recycled));
+            }
+        });
+    }
+
+  private:
+    struct State
+    {
+        std::mutex _mutex;
+        std::vector<std::unique_ptr<Buffers>> _freeBuffers;
+    };
+    std::shared_ptr<State> _state;
+};
+
+/**
+ * \brief What a live source does with a new frame when the tracking falls behind and its queue is full
+ */
+enum class FrameDropPolicy
+{
+    DropOldest, // replace the oldest waiting frame: the tracking always gets the most recent frames
+    DropNewest, // drop the new frame: the tracking gets consecutive frames, with gaps
+    Block       // wait for the tracking: no frame is dropped, the capture thread (and the driver) waits
+};
+
+/**
+ * \brief The frames pushed by a capture thread, waiting for the tracking in a bounded queue.
+ * The frames are moved, not copied: their images can point into the driver buffers, kept alive by their buffer owner
+ */
+class LiveFrameSource : public FrameSource
+{
+  public:
+    /**
+     * \param[in] queueCapacity Number of frames that can wait for the tracking (> 0)
+     * \param[in] dropPolicy What to do with a new frame when the queue is full
+     */
+    LiveFrameSource(const size_t queueCapacity, const FrameDropPolicy dropPolicy) :
+        _frames(queueCapacity),
+        _dropPolicy(dropPolicy)
+    {
+    }
+
+    /**
+     * \brief Called by the capture thread for each captured frame
+     * \param[in] frame The captured frame
+     * \return false if this frame or an older one was dropped, or if the source is closed
+     */
+    bool push(LoadedFrame&& frame) noexcept
+    {
+        frame.frameIndex = _capturedFrameCount++;
+        switch (_dropPolicy)
+        {
+            case FrameDropPolicy::Block:
+                return _frames.push(std::move(frame));
+            case FrameDropPolicy::DropNewest:
+                if (_frames.try_push(std::move(frame)))
+                    return true;
+                break;
+            case FrameDropPolicy::DropOldest:
+            default:
+                if (_frames.push_dropping_oldest(std::move(frame)))
+                    return true;
+                break;
+        }
+        ++_droppedFrameCount;
+        return false;
+    }
+
+    /**
+     * \brief End the stream: the frames already waiting can still be popped
+     */
+    void close() noexcept { _frames.close(); }
+
+    [[nodiscard]] bool pop(LoadedFrame& frame) override { return _frames.pop(frame); }
+
+    [[nodiscard]] unsigned int get_captured_frame_count() const noexcept { return _capturedFrameCount.load(); }
+    [[nodiscard]] uint64_t get_dropped_frame_count() const noexcept { return _droppedFrameCount.load(); }
+
+  private:
+    rgbd_slam::utils::Bounded_Queue<LoadedFrame> _frames;
+    const FrameDropPolicy _dropPolicy;
+    std::atomic<unsigned int> _capturedFrameCount = 0;
+    std::atomic<uint64_t> _droppedFrameCount = 0;
+};
+
+#endif
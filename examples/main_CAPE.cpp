@@ -45,7 +45,10 @@ inline bool is_file_valid(const std::string& fileName)
  *
  * \return true is load is successful, else return false
  */
-bool load_images(const std::stringstream& dataPath, const uint imageIndex, cv::Mat& rgbImage, cv::Mat& depthImage)
+bool load_images(const std::stringstream& dataPath,
+                 const uint imageIndex,
+                 cv::Mat& rgbImage,
+                 cv::Mat_<uint16_t>& depthImage)
 {
     std::stringstream depthImagePath;
     std::stringstream rgbImgPath;
@@ -55,8 +58,8 @@ bool load_images(const std::stringstream& dataPath, const uint imageIndex, cv::M
     if (is_file_valid(rgbImgPath.str()) and is_file_valid(depthImagePath.str()))
     {
         rgbImage = cv::imread(rgbImgPath.str(), cv::IMREAD_COLOR);
+        // keep the raw depth (in millimeters): the tracking scales it while creating the cloud
         depthImage = cv::imread(depthImagePath.str(), cv::IMREAD_ANYDEPTH);
-        depthImage.convertTo(depthImage, CV_32F);
 
         // check if images exists
         return depthImage.data and rgbImage.data;
@@ -176,18 +179,15 @@ int main(int argc, char* argv[])
 
         // read images
         cv::Mat rgbImage;
-        cv::Mat_<float> depthImage;
+        cv::Mat_<uint16_t> depthImage;
         if (not load_images(dataPath, frameIndex, rgbImage, depthImage))
             break;
         assert(static_cast<uint>(rgbImage.cols) == width and static_cast<uint>(rgbImage.rows) == height);
         assert(static_cast<uint>(depthImage.cols) == width and static_cast<uint>(depthImage.rows) == height);
 
-        // rectify the depth image before next step
-        RGBD_Slam.rectify_depth(depthImage);
-
-        // get optimized pose
+        // get optimized pose (rectify the depth image in the same pass as the cloud creation)
         const double trackingStartTime = static_cast<double>(cv::getTickCount());
-        pose = RGBD_Slam.track(rgbImage, depthImage);
+        pose = RGBD_Slam.track(rgbImage, depthImage, 1.0f, true);
         const double trackingDuration =
                 (static_cast<double>(cv::getTickCount()) - trackingStartTime) / cv::getTickFrequency();
         meanTreatmentDuration += trackingDuration;
@@ -13,14 +13,17 @@
 #include <opencv2/opencv.hpp>
 
 #include "logger.hpp"
+#include "trace_recorder.hpp"
 #include "rgbd_slam.hpp"
 #include "pose.hpp"
 #include "parameters.hpp"
 #include "angle_utils.hpp"
 #include "types.hpp"
 #include "TUM_parser.hpp"
+#include "dataset_reader.hpp"
+#include "packed_sequence.hpp"
 
-void check_user_inputs(bool& shouldStop)
+void check_user_inputs(bool& shouldStop, const std::string& traceFilePath)
 {
     switch (cv::waitKey(1))
     {
@@ -28,6 +31,10 @@ void check_user_inputs(bool& shouldStop)
         case 'p':            // pause button
             cv::waitKey(-1); // wait until any key is pressed
             break;
+        case 't': // write the recorded timeline
+            if (rgbd_slam::outputs::Trace_Recorder::is_recording())
+                std::ignore = rgbd_slam::outputs::Trace_Recorder::write_chrome_trace(traceFilePath);
+            break;
         case 'q': // quit button
             shouldStop = false;
         default:
@@ -52,7 +59,10 @@ bool parse_parameters(int argc,
                       int& startIndex,
                       unsigned int& jumpImages,
                       unsigned int& fpsTarget,
-                      bool& shouldSavePoses)
+                      bool& shouldSavePoses,
+                      bool& shouldRecordTrace,
+                      bool& shouldRenderInBackground,
+                      bool& shouldPackSequence)
 {
     const cv::String keys =
             "{help h usage ?  |      | print this message     }"
@@ -61,7 +71,10 @@ bool parse_parameters(int argc,
             "{i index         |  0   | First image to parse   }"
             "{j jump          |  0   | Only take every j image into consideration   }"
             "{r fps           |  30  | Used to slow down the treatment to correspond to a certain frame rate }"
-            "{s save          |  0   | Should save all the pose to a file }";
+            "{s save          |  0   | Should save all the pose to a file }"
+            "{t trace         |  0   | Record a timeline of the tracking stages, written on exit or by pressing t }"
+            "{v render        |  0   | Draw the map features on a background thread, at a fixed rate }"
+            "{k pack          |  0   | Convert the dataset to a packed sequence file, replayed by the next runs }";
 
     cv::CommandLineParser parser(argc, argv, keys);
     parser.about("RGBD Slam v0");
@@ -78,6 +91,9 @@ bool parse_parameters(int argc,
     jumpImages = parser.get<unsigned int>("j");
     fpsTarget = parser.get<unsigned int>("r");
     shouldSavePoses = parser.get<bool>("s");
+    shouldRecordTrace = parser.get<bool>("t");
+    shouldRenderInBackground = parser.get<bool>("v");
+    shouldPackSequence = parser.get<bool>("k");
 
     if (not parser.check())
     {
@@ -102,35 +118,14 @@ rgbd_slam::utils::Pose get_ground_truth(const std::string& groundTruthLine)
     return rgbd_slam::utils::Pose(groundTruthPosition * 1000.0, groundTruthRotation);
 }
 
-std::vector<Data> get_data_association(const std::string& dataPath)
-{
-    const std::string groundTruthPath = dataPath + "groundtruth.txt";
-    std::ifstream associationFile(dataPath + "associations.txt");
-    if (associationFile.is_open())
-    {
-        // an association file already exists
-        std::cout << "Using association file" << std::endl;
-
-        return DatasetParser::parse_association_file(dataPath, groundTruthPath);
-    }
-    else
-    {
-        // parse the folder myself...
-        std::cout << "Generate association data" << std::endl;
-
-        // Get file & folder names
-        const std::string rgbImageListPath = dataPath + "rgb.txt";
-        const std::string depthImageListPath = dataPath + "depth.txt";
-
-        return DatasetParser::parse_dataset(rgbImageListPath, depthImageListPath, groundTruthPath);
-    }
-}
-
 int main(int argc, char* argv[])
 {
     std::string dataset;
     bool shouldDisplayStagedFeatures;
     bool shouldSavePoses;
+    bool shouldRecordTrace;
+    bool shouldRenderInBackground;
+    bool shouldPackSequence;
     int startIndex;
     uint jumpFrames = 0;
     uint fpsTarget;
@@ -142,13 +137,16 @@ shouldDisplayStagedFeatures,
                              startIndex,
                              jumpFrames,
                              fpsTarget,
-                             shouldSavePoses))
+                             shouldSavePoses,
+                             shouldRecordTrace,
+                             shouldRenderInBackground,
+                             shouldPackSequence))
     {
         return 0; // could not parse parameters correctly
     }
     const std::stringstream dataPath("./data/TUM/" + dataset + "/");
 
-    const std::vector<Data>& datasetContainer = get_data_association(dataPath.str());
+    const std::vector<Data>& datasetContainer = DatasetParser::parse_dataset_folder(dataPath.str());
 
     if (datasetContainer.empty())
     {
@@ -175,6 +173,13 @@ shouldDisplayStagedFeatures,
 
     rgbd_slam::RGBD_SLAM RGBD_Slam(pose, width, height);
 
+    // Chrome trace of the tracking stages, readable by chrome://tracing or ui.perfetto.dev
+    const std::string traceFilePath = "trace_TUM_" + dataset + ".json";
+    if (shouldRecordTrace)
+        rgbd_slam::outputs::Trace_Recorder::start();
+    if (shouldRenderInBackground)
+        RGBD_Slam.start_debug_rendering();
+
     // frame counters
     unsigned int totalFrameTreated = 0;
     unsigned int frameIndex = startIndex; // current frame index count
@@ -197,50 +202,30 @@ shouldDisplayStagedFeatures,
     double positionError = 0;
     double rotationError = 0;
 
+    // pack the sequence if asked
+    const std::string packedSequencePath = dataPath.str() + "sequence.rgbdseq";
+    if (shouldPackSequence and
+        not packed_sequence::pack_sequence(packedSequencePath, dataPath.str(), datasetContainer, width, height))
+        return -1;
+
+    // replay the packed sequence if there is one, else decode the next images while the current one is tracked
+    const std::unique_ptr<FrameSource>& frameSource =
+            open_dataset_frames(dataPath.str(), datasetContainer, startIndex, jumpFrames, width, height);
+
     // stop condition
     bool shouldStop = true;
     bool isGroundTruthAvailable = false;
-    for (const Data& imageData: datasetContainer)
+    LoadedFrame loadedFrame;
+    while (shouldStop and frameSource->pop(loadedFrame))
     {
-        // out condition
-        if (not shouldStop)
-            break;
-
-        if (jumpFrames > 0 and frameIndex % jumpFrames != 0)
-        {
-            // do not treat this frame
-            ++frameIndex;
-            continue;
-        }
+        const Data& imageData = *loadedFrame.data;
+        frameIndex = loadedFrame.frameIndex;
+        cv::Mat& rgbImage = loadedFrame.rgbImage;
+        cv::Mat_<float>& depthImage = loadedFrame.depthImage;
 
-        const std::string rgbImagePath = dataPath.str() + imageData.rgbImage.imagePath;
-        const std::string depthImagePath = dataPath.str() + imageData.depthImage.imagePath;
-
-        // Load images
-        cv::Mat rgbImage = cv::imread(rgbImagePath, cv::IMREAD_COLOR);
-        cv::Mat depthImage = cv::imread(depthImagePath, cv::IMREAD_ANYDEPTH);
-
-        if (rgbImage.empty())
-        {
-            rgbd_slam::outputs::log("No color image input, use black image");
-            if (imageData.rgbImage.isValid)
-                std::cerr << "Cannot load rgb image " << rgbImagePath << std::endl;
-            rgbImage = cv::Mat(height, width, CV_8UC3, cv::Scalar(0, 0, 0));
-        }
-        if (depthImage.empty())
-        {
-            rgbd_slam::outputs::log("No depth image input, use empty depth");
-            if (imageData.depthImage.isValid)
-                std::cerr << "Could not load depth image " << depthImagePath << std::endl;
-
-            depthImage = cv::Mat(height, width, CV_16UC1, cv::Scalar(0.0));
-        }
         assert(static_cast<uint>(rgbImage.cols) == width and static_cast<uint>(rgbImage.rows) == height);
         assert(static_cast<uint>(depthImage.cols) == width and static_cast<uint>(depthImage.rows) == height);
 
-        // convert to mm & float 32
-        depthImage.convertTo(depthImage, CV_32FC1, 1.0 / 5.0);
-
         // clean warp artefacts
 #if 0
         cv::Mat kernel = cv::Mat::ones(3, 3, CV_8U);
@@ -269,15 +254,12 @@ shouldDisplayStagedFeatures,
             rotationError = pose.get_rotation_error(groundTruthPose);
         }
 
-        // display masks on image
-        const cv::Mat& segRgb = RGBD_Slam.get_debug_image(pose,
-                                                          rgbImage,
-                                                          trackingDuration,
-                                                          shouldDisplayStagedFeatures);
-        cv::imshow("RGBD-SLAM", segRgb);
+        // display masks on image, drawn over the rgb image that is not used anymore
+        RGBD_Slam.draw_debug_image(pose, rgbImage, trackingDuration, rgbImage, shouldDisplayStagedFeatures);
+        cv::imshow("RGBD-SLAM", rgbImage);
 
         // check user inputs
-        check_user_inputs(shouldStop);
+        check_user_inputs(shouldStop, traceFilePath);
 
         // counters
         ++totalFrameTreated;
@@ -310,6 +292,12 @@ shouldDisplayStagedFeatures,
     std::cout << std::endl;
     RGBD_Slam.show_statistics(meanTreatmentDuration / totalFrameTreated);
 
+    if (shouldRecordTrace)
+    {
+        rgbd_slam::outputs::Trace_Recorder::stop();
+        std::ignore = rgbd_slam::outputs::Trace_Recorder::write_chrome_trace(traceFilePath);
+    }
+
     cv::destroyAllWindows();
     return 0;
 }
@@ -0,0 +1,147 @@
+// Live tracking from an OpenNI2 RGB-D camera (Kinect, Xtion, Astra, ...)
+
+#include <format>
+#include <iostream>
+#include <string>
+
+#include <opencv2/opencv.hpp>
+
+#include "logger.hpp"
+#include "rgbd_slam.hpp"
+#include "pose.hpp"
+#include "parameters.hpp"
+#include "types.hpp"
+#include "frame_source.hpp"
+#include "openni2_source.hpp"
+
+void check_user_inputs(bool& shouldStop)
+{
+    switch (cv::waitKey(1))
+    {
+        // check pressed key
+        case 'p':            // pause button
+            cv::waitKey(-1); // wait until any key is pressed
+            break;
+        case 'q': // quit button
+            shouldStop = false;
+        default:
+            break;
+    }
+}
+
+bool parse_parameters(int argc,
+                      char** argv,
+                      std::string& configurationPath,
+                      bool& shouldDisplayStagedFeatures,
+                      FrameDropPolicy& dropPolicy,
+                      bool& shouldRenderInBackground)
+{
+    const cv::String keys =
+            "{help h usage ?  |      | print this message     }"
+            "{@configuration  | ./data/live/configuration.yaml | Parameters of the camera }"
+            "{d staged        |  0   | display features in staged container }"
+            "{k drop          | oldest | Frames dropped when the tracking falls behind: oldest, newest or none }"
+            "{v render        |  0   | Draw the map features on a background thread, at a fixed rate }";
+
+    cv::CommandLineParser parser(argc, argv, keys);
+    parser.about("RGBD Slam v0");
+
+    if (parser.has("help"))
+    {
+        parser.printMessage();
+        return false;
+    }
+
+    configurationPath = parser.get<std::string>("@configuration");
+    shouldDisplayStagedFeatures = parser.get<bool>("d");
+    shouldRenderInBackground = parser.get<bool>("v");
+    const std::string& dropPolicyName = parser.get<std::string>("k");
+    if (dropPolicyName == "oldest")
+        dropPolicy = FrameDropPolicy::DropOldest;
+    else if (dropPolicyName == "newest")
+        dropPolicy = FrameDropPolicy::DropNewest;
+    else if (dropPolicyName == "none")
+        dropPolicy = FrameDropPolicy::Block;
+    else
+    {
+        std::cout << "RGBD SLAM: Unknown drop policy " << dropPolicyName << ", use oldest, newest or none" << std::endl;
+        return false;
+    }
+
+    if (not parser.check())
+    {
+        std::cout << "RGBD SLAM: Some parameters are missing: call with -h to get the list of parameters";
+        parser.printErrors();
+    }
+    return parser.check();
+}
+
+int main(int argc, char* argv[])
+{
+    std::string configurationPath;
+    bool shouldDisplayStagedFeatures;
+    FrameDropPolicy dropPolicy;
+    bool shouldRenderInBackground;
+    if (not parse_parameters(
+                argc, argv, configurationPath, shouldDisplayStagedFeatures, dropPolicy, shouldRenderInBackground))
+    {
+        return 0; // could not parse parameters correctly
+    }
+
+    if (not rgbd_slam::Parameters::parse_file(configurationPath))
+    {
+        std::cout << "Could not parse the parameter file at  " << configurationPath << std::endl;
+        return -1;
+    }
+    const uint width = rgbd_slam::Parameters::get_camera_1_image_size().x();
+    const uint height = rgbd_slam::Parameters::get_camera_1_image_size().y();
+
+    OpenNI2Source camera(width, height, dropPolicy);
+    if (not camera.is_valid())
+        return -1;
+
+    rgbd_slam::utils::Pose pose;
+    rgbd_slam::RGBD_SLAM RGBD_Slam(pose, width, height);
+    // the first camera frame is tracked at the steady state latency
+    std::ignore = RGBD_Slam.warm_up();
+    if (shouldRenderInBackground)
+        RGBD_Slam.start_debug_rendering();
+
+    unsigned int totalFrameTreated = 0;
+    double meanTreatmentDuration = 0;
+    double lastTimeStamp = 0.0;
+
+    bool shouldStop = true;
+    LoadedFrame frame;
+    while (shouldStop and camera.pop(frame))
+    {
+        const double trackingStartTime = static_cast<double>(cv::getTickCount());
+        pose = RGBD_Slam.track(frame.rgbImage, frame.depthImage);
+        const double trackingDuration =
+                (static_cast<double>(cv::getTickCount()) - trackingStartTime) / (double)cv::getTickFrequency();
+        meanTreatmentDuration += trackingDuration;
+
+        if (lastTimeStamp > 0.0 and frame.timeStamp - lastTimeStamp > 0.1)
+            rgbd_slam::outputs::log_warning(std::format("{:.0f} ms since the last tracked frame",
+                                                        (frame.timeStamp - lastTimeStamp) * 1000.0));
+        lastTimeStamp = frame.timeStamp;
+
+        // display masks on image, drawn over the rgb image that is not used anymore
+        RGBD_Slam.draw_debug_image(pose, frame.rgbImage, trackingDuration, frame.rgbImage, shouldDisplayStagedFeatures);
+        cv::imshow("RGBD-SLAM", frame.rgbImage);
+
+        check_user_inputs(shouldStop);
+        ++totalFrameTreated;
+    }
+
+    std::cout << std::endl;
+    std::cout << "End pose : " << pose << std::endl;
+    std::cout << totalFrameTreated << " frames tracked, " << camera.get_dropped_frame_count() << " frames dropped"
+              << std::endl;
+    std::cout << std::endl;
+    if (totalFrameTreated > 0)
+        RGBD_Slam.show_statistics(meanTreatmentDuration / totalFrameTreated);
+
+    cv::destroyAllWindows();
+    return 0;
+}
@@ -0,0 +1,168 @@
+#ifndef RGBDSLAM_EXAMPLES_OPENNI2_SOURCE_HPP
+#define RGBDSLAM_EXAMPLES_OPENNI2_SOURCE_HPP
+
+#include "frame_source.hpp"
+
+#include <OpenNI.h>
+#include <atomic>
+#include <iostream>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <string>
+#include <thread>
+
+/**
+ * \brief Live frames of an OpenNI2 RGB-D camera (Kinect, Xtion, Astra, ...), captured on a background thread.
+ * The depth is registered to the color image by the device. Each driver frame is converted once, straight into pooled
+ * buffers (RGB to BGR, depth in 1 millimeter units to float millimeters): no allocation nor intermediate copy per
+ * frame. The frame time stamps are the device clock
+ */
+class OpenNI2Source : public FrameSource
+{
+  public:
+    /**
+     * \param[in] width The width of the images to capture
+     * \param[in] height The height of the images to capture
+     * \param[in] dropPolicy What to do with the new frames when the tracking falls behind
+     * \param[in] queueCapacity Number of frames that can wait for the tracking
+     */
+    OpenNI2Source(const unsigned int width,
+                  const unsigned int height,
+                  const FrameDropPolicy dropPolicy = FrameDropPolicy::DropOldest,
+                  const size_t queueCapacity = 2) :
+        _width(width),
+        _height(height),
+        // the waiting frames, the tracked frame, and the frame being captured
+        _bufferPool(width, height, queueCapacity + 2),
+        _frames(queueCapacity, dropPolicy)
+    {
+        if (openni::OpenNI::initialize() != openni::STATUS_OK or
+            _device.open(openni::ANY_DEVICE) != openni::STATUS_OK or
+            _depthStream.create(_device, openni::SENSOR_DEPTH) != openni::STATUS_OK or
+            _colorStream.create(_device, openni::SENSOR_COLOR) != openni::STATUS_OK)
+        {
+            std::cerr << "Could not open the OpenNI2 device: " << openni::OpenNI::getExtendedError() << std::endl;
+            return;
+        }
+
+        openni::VideoMode depthMode = _depthStream.getVideoMode();
+        depthMode.setResolution(static_cast<int>(width), static_cast<int>(height));
+        depthMode.setPixelFormat(openni::PIXEL_FORMAT_DEPTH_1_MM);
+        openni::VideoMode colorMode = _colorStream.getVideoMode();
+        colorMode.setResolution(static_cast<int>(width), static_cast<int>(height));
+        colorMode.setPixelFormat(openni::PIXEL_FORMAT_RGB888);
+        if (_depthStream.setVideoMode(depthMode) != openni::STATUS_OK or
+            _colorStream.setVideoMode(colorMode) != openni::STATUS_OK)
+        {
+            std::cerr << "The OpenNI2 device does not support " << width << "x" << height << " images" << std::endl;
+            return;
+        }
+        if (_device.isImageRegistrationModeSupported(openni::IMAGE_REGISTRATION_DEPTH_TO_COLOR))
+            _device.setImageRegistrationMode(openni::IMAGE_REGISTRATION_DEPTH_TO_COLOR);
+        _device.setDepthColorSyncEnabled(true);
+
+        if (_depthStream.start() != openni::STATUS_OK or _colorStream.start() != openni::STATUS_OK)
+        {
+            std::cerr << "Could not start the OpenNI2 streams: " << openni::OpenNI::getExtendedError() << std::endl;
+            return;
+        }
+        _isValid = true;
+        _captureThread = std::thread(&OpenNI2Source::capture, this);
+    }
+
+    ~OpenNI2Source() override
+    {
+        _shouldStop = true;
+        // wakes the capture thread if it waits for the tracking
+        _frames.close();
+        if (_captureThread.joinable())
+            _captureThread.join();
+        _depthStream.destroy();
+        _colorStream.destroy();
+        _device.close();
+        openni::OpenNI::shutdown();
+    }
+
+    OpenNI2Source(const OpenNI2Source&) = delete;
+    OpenNI2Source& operator=(const OpenNI2Source&) = delete;
+
+    [[nodiscard]] bool pop(LoadedFrame& frame) override { return _isValid and _frames.pop(frame); }
+
+    [[nodiscard]] bool is_valid() const noexcept { return _isValid; }
+    [[nodiscard]] uint64_t get_dropped_frame_count() const noexcept
+    {
+        return _frames.get_dropped_frame_count() + _poolExhaustedCount.load();
+    }
+
+  private:
+    /**
+     * \brief Capture thread function: read the synchronized depth and color frames until the source is destroyed
+     */
+    void capture()
+    {
+        constexpr int waitTimeout_ms = 100;
+        openni::VideoStream* depthStream = &_depthStream;
+        openni::VideoFrameRef depthFrame;
+        openni::VideoFrameRef colorFrame;
+        while (not _shouldStop)
+        {
+            int readyStream = -1;
+            if (openni::OpenNI::waitForAnyStream(&depthStream, 1, &readyStream, waitTimeout_ms) != openni::STATUS_OK)
+                continue;
+            if (_depthStream.readFrame(&depthFrame) != openni::STATUS_OK or
+                _colorStream.readFrame(&colorFrame) != openni::STATUS_OK)
+                continue;
+            const int width = static_cast<int>(_width);
+            const int height = static_cast<int>(_height);
+            if (depthFrame.getWidth() != width or depthFrame.getHeight() != height or colorFrame.getWidth() != width or
+                colorFrame.getHeight() != height)
+                continue;
+
+            const std::shared_ptr<FrameBufferPool::Buffers>& buffers = _bufferPool.acquire();
+            if (buffers == nullptr)
+            {
+                // all the buffers are waiting or tracked
+                ++_poolExhaustedCount;
+                continue;
+            }
+
+            // views of the driver buffers, converted once into the pooled buffers
+            const cv::Mat colorView(height,
+                                    width,
+                                    CV_8UC3,
+                                    const_cast<void*>(colorFrame.getData()),
+                                    static_cast<size_t>(colorFrame.getStrideInBytes()));
+            const cv::Mat depthView(height,
+                                    width,
+                                    CV_16UC1,
+                                    const_cast<void*>(depthFrame.getData()),
+                                    static_cast<size_t>(depthFrame.getStrideInBytes()));
+            cv::cvtColor(colorView, buffers->rgbImage, cv::COLOR_RGB2BGR);
+            depthView.convertTo(buffers->depthImage, CV_32F);
+
+            LoadedFrame frame;
+            frame.timeStamp = static_cast<double>(depthFrame.getTimestamp()) * 1e-6; // driver time stamps in us
+            frame.rgbImage = buffers->rgbImage;
+            frame.depthImage = buffers->depthImage;
+            frame.bufferOwner = buffers;
+            std::ignore = _frames.push(std::move(frame));
+        }
+        _frames.close();
+    }
+
+    const unsigned int _width;
+    const unsigned int _height;
+    FrameBufferPool _bufferPool;
+    LiveFrameSource _frames;
+    std::atomic<uint64_t> _poolExhaustedCount = 0;
+
+    openni::Device _device;
+    openni::VideoStream _depthStream;
+    openni::VideoStream _colorStream;
+
+    bool _isValid = false;
+    std::atomic<bool> _shouldStop = false;
+    std::thread _captureThread;
+};
+
+#endif
@@ -0,0 +1,357 @@
+#ifndef RGBDSLAM_EXAMPLES_PACKED_SEQUENCE_HPP
+#define RGBDSLAM_EXAMPLES_PACKED_SEQUENCE_HPP
+
+#include "TUM_parser.hpp"
+#include "dataset_reader.hpp"
+#include "frame_source.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <opencv2/core.hpp>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * Packed sequence file (.rgbdseq): the decoded frames of a dataset, stored raw so they can be replayed from a memory
+ * mapping without any image decoding or copy.
+ * - a header page: magic "RGBDSEQ\0", then the Packed_Sequence_Header fields
+ * - frameCount records of recordSize bytes, each starting on a page boundary: a Packed_Frame_Header, then the rgb
+ *   image (CV_8UC3) and the depth image (CV_32FC1, in millimeters), each starting on a 64 bytes boundary
+ * All values are stored in the native byte order
+ */
+namespace packed_sequence {
+
+inline constexpr std::array<char, 8> magic = {'R', 'G', 'B', 'D', 'S', 'E', 'Q', '\0'};
+inline constexpr uint32_t version = 1;
+inline constexpr size_t pageSize = 4096;
+inline constexpr size_t imageAlignment = 64;
+
+struct Packed_Sequence_Header
+{
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t frameCount;
+    uint64_t recordSize;
+};
+
+struct Packed_Frame_Header
+{
+    double rgbTimeStamp;
+    double depthTimeStamp;
+    double groundTruthTimeStamp;
+    std::array<double, 3> position;
+    std::array<double, 4> rotation; // x, y, z, w
+    uint32_t flags;
+    uint32_t padding;
+};
+
+// flags of a frame: the images and ground truth found in the original dataset
+inline constexpr uint32_t hasRgbImage = 1u << 0;
+inline constexpr uint32_t hasDepthImage = 1u << 1;
+inline constexpr uint32_t hasGroundTruth = 1u << 2;
+
+constexpr size_t align_to(const size_t size, const size_t alignment) noexcept
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+constexpr size_t get_rgb_offset() noexcept { return align_to(sizeof(Packed_Frame_Header), imageAlignment); }
+
+constexpr size_t get_depth_offset(const size_t width, const size_t height) noexcept
+{
+    return get_rgb_offset() + align_to(width * height * 3, imageAlignment);
+}
+
+constexpr size_t get_record_size(const size_t width, const size_t height) noexcept
+{
+    return align_to(get_depth_offset(width, height) + width * height * sizeof(float), pageSize);
+}
+
+static_assert(sizeof(Packed_Sequence_Header) <= pageSize);
+
+/**
+ * \brief Decode all the frames of a parsed dataset and write them to a packed sequence file
+ * \param[in] filePath The packed sequence file to write, truncated if it exists
+ * \param[in] dataPath The folder of the dataset, the image paths are relative to it
+ * \param[in] dataset The parsed dataset entries
+ * \param[in] width The width of the images
+ * \param[in] height The height of the images
+ * \param[in] depthScale Division from the depth image values to millimeters (5 in the TUM datasets)
+ * \return false if the file could not be written
+ */
+[[nodiscard]] inline bool pack_sequence(const std::string& filePath,
+                                        const std::string& dataPath,
+                                        const std::vector<Data>& dataset,
+                                        const unsigned int width,
+                                        const unsigned int height,
+                                        const double depthScale = 5.0)
+{
+    std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+    if (not file.is_open())
+    {
+        std::cerr << "Could not open the packed sequence file " << filePath << std::endl;
+        return false;
+    }
+
+    const size_t recordSize = get_record_size(width, height);
+    const Packed_Sequence_Header header {magic, version, width, height, 0, recordSize};
+    std::vector<char> record(std::max(recordSize, pageSize), 0);
+    std::memcpy(record.data(), &header, sizeof(header));
+    file.write(record.data(), static_cast<std::streamsize>(pageSize));
+
+    // the images are decoded ahead, by the dataset reader threads
+    DatasetReader datasetReader(dataPath, dataset, 0, 0, width, height, depthScale);
+    uint32_t frameCount = 0;
+    LoadedFrame frame;
+    while (datasetReader.pop(frame))
+    {
+        if (static_cast<unsigned int>(frame.rgbImage.cols) != width or
+            static_cast<unsigned int>(frame.rgbImage.rows) != height or
+            static_cast<unsigned int>(frame.depthImage.cols) != width or
+            static_cast<unsigned int>(frame.depthImage.rows) != height)
+        {
+            std::cerr << "Frame " << frame.frameIndex << " does not have the sequence image size" << std::endl;
+            return false;
+        }
+
+        const Data& data = *frame.data;
+        Packed_Frame_Header frameHeader {};
+        frameHeader.rgbTimeStamp = data.rgbImage.imageTimeStamp;
+        frameHeader.depthTimeStamp = data.depthImage.imageTimeStamp;
+        frameHeader.flags = (data.rgbImage.isValid ? hasRgbImage : 0u) | (data.depthImage.isValid ? hasDepthImage : 0u);
+        if (data.groundTruth.isValid)
+        {
+            frameHeader.flags |= hasGroundTruth;
+            frameHeader.groundTruthTimeStamp = data.groundTruth.timeStamp;
+            frameHeader.position = {data.groundTruth.position.x(),
+                                    data.groundTruth.position.y(),
+                                    data.groundTruth.position.z()};
+            frameHeader.rotation = {data.groundTruth.rotation.x(),
+                                    data.groundTruth.rotation.y(),
+                                    data.groundTruth.rotation.z(),
+                                    data.groundTruth.rotation.w()};
+        }
+
+        std::fill(record.begin(), record.end(), 0);
+        std::memcpy(record.data(), &frameHeader, sizeof(frameHeader));
+        // the decoded images may not be continuous: copy them line by line
+        for (unsigned int row = 0; row < height; ++row)
+        {
+            std::memcpy(record.data() + get_rgb_offset() + row * width * 3, frame.rgbImage.ptr(row), width * 3);
+            std::memcpy(record.data() + get_depth_offset(width, height) + row * width * sizeof(float),
+                        frame.depthImage.ptr(row),
+                        width * sizeof(float));
+        }
+        file.write(record.data(), static_cast<std::streamsize>(recordSize));
+        ++frameCount;
+    }
+
+    // rewrite the header with the final frame count
+    Packed_Sequence_Header finalHeader = header;
+    finalHeader.frameCount = frameCount;
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&finalHeader), sizeof(finalHeader));
+    file.close();
+    if (file.fail())
+    {
+        std::cerr << "Could not write the packed sequence file " << filePath << std::endl;
+        return false;
+    }
+    std::cout << "Packed " << frameCount << " frames in " << filePath << std::endl;
+    return true;
+}
+
+} // namespace packed_sequence
+
+/**
+ * \brief Replays a packed sequence file from a memory mapping: the returned images point inside the mapping,
+ * so reading a frame does not decode or copy anything. The system pages the frames in ahead of the replay, and the
+ * frames already replayed are released.
+ * The mapping is private: drawing on a returned image never modifies the file
+ */
+class PackedSequenceReader : public FrameSource
+{
+  public:
+    /**
+     * \param[in] filePath The packed sequence file
+     * \param[in] startIndex Offset of the frame indexes
+     * \param[in] jumpFrames Only read the frames with an index multiple of this (0 to read all the frames)
+     */
+    PackedSequenceReader(const std::string& filePath, const unsigned int startIndex, const unsigned int jumpFrames)
+    {
+        using namespace packed_sequence;
+
+        _fileDescriptor = ::open(filePath.c_str(), O_RDONLY);
+        if (_fileDescriptor < 0)
+            return;
+
+        struct stat fileStatus;
+        Packed_Sequence_Header header;
+        if (::fstat(_fileDescriptor, &fileStatus) != 0 or static_cast<size_t>(fileStatus.st_size) < pageSize or
+            ::pread(_fileDescriptor, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) or
+            header.magic != magic or header.version != version or
+            header.recordSize != get_record_size(header.width, header.height) or
+            static_cast<size_t>(fileStatus.st_size) < pageSize + header.frameCount * header.recordSize)
+        {
+            std::cerr << "The file " << filePath << " is not a valid packed sequence" << std::endl;
+            return;
+        }
+
+        _mappingSize = pageSize + header.frameCount * header.recordSize;
+        void* mapping = ::mmap(nullptr, _mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, _fileDescriptor, 0);
+        if (mapping == MAP_FAILED)
+        {
+            std::cerr << "Could not map the packed sequence " << filePath << std::endl;
+            return;
+        }
+        _mapping = static_cast<std::byte*>(mapping);
+        ::madvise(_mapping, _mappingSize, MADV_SEQUENTIAL);
+
+        _width = header.width;
+        _height = header.height;
+        _recordSize = header.recordSize;
+
+        _dataset.resize(header.frameCount);
+        for (uint32_t i = 0; i < header.frameCount; ++i)
+        {
+            const unsigned int frameIndex = startIndex + i;
+            if (jumpFrames == 0 or frameIndex % jumpFrames == 0)
+                _selectedFrames.emplace_back(i, frameIndex);
+
+            Packed_Frame_Header frameHeader;
+            std::memcpy(&frameHeader, get_record(i), sizeof(frameHeader));
+            Data& data = _dataset[i];
+            data.rgbImage.imageTimeStamp = frameHeader.rgbTimeStamp;
+            data.rgbImage.isValid = (frameHeader.flags & hasRgbImage) != 0;
+            data.depthImage.imageTimeStamp = frameHeader.depthTimeStamp;
+            data.depthImage.isValid = (frameHeader.flags & hasDepthImage) != 0;
+            data.groundTruth.isValid = (frameHeader.flags & hasGroundTruth) != 0;
+            data.groundTruth.timeStamp = frameHeader.groundTruthTimeStamp;
+            data.groundTruth.position =
+                    Eigen::Vector3d(frameHeader.position[0], frameHeader.position[1], frameHeader.position[2]);
+            data.groundTruth.rotation = Eigen::Quaterniond(
+                    frameHeader.rotation[3], frameHeader.rotation[0], frameHeader.rotation[1], frameHeader.rotation[2]);
+        }
+    }
+
+    ~PackedSequenceReader() override
+    {
+        if (_mapping != nullptr)
+            ::munmap(_mapping, _mappingSize);
+        if (_fileDescriptor >= 0)
+            ::close(_fileDescriptor);
+    }
+
+    PackedSequenceReader(const PackedSequenceReader&) = delete;
+    PackedSequenceReader& operator=(const PackedSequenceReader&) = delete;
+
+    /**
+     * \brief Get the next frame of the sequence. The pages of the previous frame are released: its images are paged
+     * back in from the file if they are used again, without the drawings made on them
+     * \param[out] frame The next frame, its images point inside the mapping
+     * \return false if all the frames were read
+     */
+    [[nodiscard]] bool pop(LoadedFrame& frame) override
+    {
+        if (not is_valid() or _nextFrameToPop >= _selectedFrames.size())
+            return false;
+
+        const auto& [dataIndex, frameIndex] = _selectedFrames[_nextFrameToPop];
+        if (_nextFrameToPop > 0)
+            // the previous frame is replaced: its pages can be dropped
+            ::madvise(get_record(_selectedFrames[_nextFrameToPop - 1].first), _recordSize, MADV_DONTNEED);
+        if (_nextFrameToPop + 1 < _selectedFrames.size())
+            ::madvise(get_record(_selectedFrames[_nextFrameToPop + 1].first), _recordSize, MADV_WILLNEED);
+        ++_nextFrameToPop;
+
+        std::byte* record = get_record(dataIndex);
+        frame.frameIndex = frameIndex;
+        frame.data = &_dataset[dataIndex];
+        frame.timeStamp = frame.data->depthImage.imageTimeStamp;
+        frame.rgbImage = cv::Mat(static_cast<int>(_height),
+                                 static_cast<int>(_width),
+                                 CV_8UC3,
+                                 record + packed_sequence::get_rgb_offset());
+        frame.depthImage = cv::Mat_<float>(static_cast<int>(_height),
+                                           static_cast<int>(_width),
+                                           reinterpret_cast<float*>(
+                                                   record + packed_sequence::get_depth_offset(_width, _height)));
+        return true;
+    }
+
+    [[nodiscard]] bool is_valid() const noexcept { return _mapping != nullptr; }
+
+    /**
+     * \return The number of frames that will be returned, skipped frames excluded
+     */
+    [[nodiscard]] size_t size() const noexcept { return _selectedFrames.size(); }
+
+    [[nodiscard]] unsigned int get_width() const noexcept { return _width; }
+    [[nodiscard]] unsigned int get_height() const noexcept { return _height; }
+
+    /**
+     * \return The frames of the sequence, without image paths
+     */
+    [[nodiscard]] const std::vector<Data>& get_dataset() const noexcept { return _dataset; }
+
+  private:
+    [[nodiscard]] std::byte* get_record(const size_t dataIndex) const noexcept
+    {
+        return _mapping + packed_sequence::pageSize + dataIndex * _recordSize;
+    }
+
+    int _fileDescriptor = -1;
+    std::byte* _mapping = nullptr;
+    size_t _mappingSize = 0;
+    size_t _recordSize = 0;
+    unsigned int _width = 0;
+    unsigned int _height = 0;
+
+    std::vector<Data> _dataset;
+    std::vector<std::pair<size_t, unsigned int>> _selectedFrames; // dataset entry and frame index of the read frames
+    size_t _nextFrameToPop = 0;
+};
+
+/**
+ * \brief Open the frames of a dataset: from its packed sequence (sequence.rgbdseq) if there is a valid one of the image
+ * size, else from its images, decoded ahead of the tracking
+ * \param[in] dataPath The folder of the dataset
+ * \param[in] dataset The parsed dataset entries. Must outlive the returned source
+ * \param[in] startIndex Offset of the frame indexes
+ * \param[in] jumpFrames Only read the frames with an index multiple of this (0 to read all the frames)
+ * \param[in] width The width of the images
+ * \param[in] height The height of the images
+ */
+[[nodiscard]] inline std::unique_ptr<FrameSource> open_dataset_frames(const std::string& dataPath,
+                                                                      const std::vector<Data>& dataset,
+                                                                      const unsigned int startIndex,
+                                                                      const unsigned int jumpFrames,
+                                                                      const unsigned int width,
+                                                                      const unsigned int height)
+{
+    const std::string packedSequencePath = dataPath + "sequence.rgbdseq";
+    if (struct stat fileStatus; ::stat(packedSequencePath.c_str(), &fileStatus) == 0)
+    {
+        auto packedSequenceReader = std::make_unique<PackedSequenceReader>(packedSequencePath, startIndex, jumpFrames);
+        if (packedSequenceReader->is_valid() and packedSequenceReader->get_width() == width and
+            packedSequenceReader->get_height() == height)
+        {
+            std::cout << "Replaying the packed sequence " << packedSequencePath << std::endl;
+            return packedSequenceReader;
+        }
+    }
+    return std::make_unique<DatasetReader>(dataPath, dataset, startIndex, jumpFrames, width, height);
+}
+
+#endif
@@ -67,6 +67,41 @@ vector2 InverseDepthWorldPoint::compute_signed_screen_distance(const ScreenCoord
     return vector2::Constant(std::numeric_limits<double>::max());
 }
 
+vector2 InverseDepthWorldPoint::compute_signed_screen_distance(const ScreenCoordinate2D& other,
+                                                               const double inverseDepthCovariance,
+                                                               const WorldToCameraMatrix& w2c,
+                                                               Eigen::Matrix<double, 2, 12>& jacobian) const
+{
+    const double depthStandardDev = sqrt(inverseDepthCovariance);
+    const WorldCoordinate& firstPoint = get_furthest_estimation(depthStandardDev);
+    const WorldCoordinate& endPoint = get_closest_estimation(depthStandardDev);
+
+    ScreenCoordinate2D startScreenPoint;
+    ScreenCoordinate2D endScreenPoint;
+    Eigen::Matrix<double, 2, 12> startJacobian;
+    Eigen::Matrix<double, 2, 12> endJacobian;
+    if (not firstPoint.to_screen_coordinates(w2c, startScreenPoint, startJacobian) or
+        not endPoint.to_screen_coordinates(w2c, endScreenPoint, endJacobian))
+    {
+        jacobian.setZero();
+        return vector2::Constant(std::numeric_limits<double>::max());
+    }
+
+    // distance is (I - n.n^T)(other - start), with n the normalized (end - start) vector
+    const vector2 startToOther(other - startScreenPoint);
+    const vector2 segment(endScreenPoint - startScreenPoint);
+    const double segmentLength = segment.norm();
+    const vector2 normal = segment / segmentLength;
+    const matrix22 orthogonalProjection = matrix22::Identity() - normal * normal.transpose();
+
+    // jacobian of the distance with respect to the end point, the start point jacobian also includes -(I - n.n^T)
+    const matrix22& endPointJacobian =
+            (normal.dot(startToOther) * matrix22::Identity() + normal * startToOther.transpose()) *
+            orthogonalProjection / segmentLength;
+    jacobian = (endPointJacobian - orthogonalProjection) * startJacobian - endPointJacobian * endJacobian;
+    return orthogonalProjection * startToOther;
+}
+
 InverseDepthWorldPoint InverseDepthWorldPoint::from_cartesian(const WorldCoordinate& point,
                                                               const WorldCoordinate& origin) noexcept
 {
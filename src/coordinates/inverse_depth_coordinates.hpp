@@ -46,6 +46,19 @@ struct InverseDepthWorldPoint
     [[nodiscard]] vector2 compute_signed_screen_distance(const ScreenCoordinate2D& other,
                                                          const double inverseDepthCovariance,
                                                          const WorldToCameraMatrix& w2c) const;
+    /**
+     * \brief compute distance of the screen projections, and its jacobian
+     * \param[in] other The 2d observation in the new image
+     * \param[in] inverseDepthCovariance The covariance of the inverse depth
+     * \param[in] w2c The matrix to go from world to camera space
+     * \param[out] jacobian The jacobian of the distance with respect to the 12 coefficients of the upper 3x4 block of
+     * w2c (column major). Set to zero if the point cannot be projected
+     * \return The distance between the two observations, in pixels
+     */
+    [[nodiscard]] vector2 compute_signed_screen_distance(const ScreenCoordinate2D& other,
+                                                         const double inverseDepthCovariance,
+                                                         const WorldToCameraMatrix& w2c,
+                                                         Eigen::Matrix<double, 2, 12>& jacobian) const;
 
     /**
      * \brief Set the parameters of this instance from a cartesian point
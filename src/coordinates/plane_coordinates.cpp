@@ -55,4 +55,26 @@ vector3 PlaneWorldCoordinates::get_reduced_signed_distance(const PlaneCameraCoor
            projectedWorldPlane.get_d() * projectedWorldPlane.get_normal();
 }
 
+vector3 PlaneWorldCoordinates::get_reduced_signed_distance(const PlaneCameraCoordinates& cameraPlane,
+                                                           const WorldToCameraMatrix& worldToCamera,
+                                                           Eigen::Matrix<double, 3, 12>& jacobian) const noexcept
+{
+    // the plane transformation is n' = R.n and d' = d - t.n', with [R | t] the world to camera transformation
+    const matrix33& rotation = worldToCamera.block<3, 3>(0, 0);
+    const vector3& translation = worldToCamera.block<3, 1>(0, 3);
+    const vector3& worldNormal = get_normal();
+    const vector3 projectedNormal = rotation * worldNormal;
+    const double projectedD = get_d() - translation.dot(projectedNormal);
+
+    // the distance is d.n - d'.n'
+    for (uint column = 0; column < 3; ++column)
+    {
+        jacobian.block<3, 3>(0, 3 * column) =
+                worldNormal(column) * (projectedNormal * translation.transpose() - projectedD * matrix33::Identity());
+    }
+    jacobian.block<3, 3>(0, 9) = projectedNormal * projectedNormal.transpose();
+
+    return cameraPlane.get_d() * cameraPlane.get_normal() - projectedD * projectedNormal;
+}
+
 } // namespace rgbd_slam
\ No newline at end of file
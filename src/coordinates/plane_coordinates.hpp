@@ -112,6 +112,18 @@ struct PlaneWorldCoordinates : public PlaneCoordinates
      */
     [[nodiscard]] vector3 get_reduced_signed_distance(const PlaneCameraCoordinates& cameraPlane,
                                                       const PlaneWorldToCameraMatrix& worldToCamera) const noexcept;
+    /**
+     * \brief Compute a reduced distance between two planes, by retroprojecting a world plane to camera space, and the
+     * jacobian of this distance
+     * \param[in] cameraPlane A plane in camera coordinates
+     * \param[in] worldToCamera A transformation matrix to convert a world point to camera space
+     * \param[out] jacobian The jacobian of the distance with respect to the 12 coefficients of the upper 3x4 block of
+     * worldToCamera (column major)
+     * \return A 3D vector of the error between the two planes, in millimeters
+     */
+    [[nodiscard]] vector3 get_reduced_signed_distance(const PlaneCameraCoordinates& cameraPlane,
+                                                      const WorldToCameraMatrix& worldToCamera,
+                                                      Eigen::Matrix<double, 3, 12>& jacobian) const noexcept;
 };
 
 } // namespace rgbd_slam
@@ -242,6 +242,51 @@ bool WorldCoordinate::to_screen_coordinates(const WorldToCameraMatrix& worldToCa
     return false;
 }
 
+bool WorldCoordinate::to_screen_coordinates(const WorldToCameraMatrix& worldToCamera,
+                                            ScreenCoordinate2D& screenPoint,
+                                            Eigen::Matrix<double, 2, 12>& jacobian) const noexcept
+{
+    const vector4& homogeneousPoint = this->homogeneous();
+    const vector3& cameraPoint = (worldToCamera * homogeneousPoint).head<3>();
+    if (not to_screen_coordinates(worldToCamera, screenPoint))
+    {
+        jacobian.setZero();
+        return false;
+    }
+
+    // the last row of the intrinsics is (0, 0, 1): the projection is the first two rows, divided by the depth
+    const static matrix33 cameraIntrinsics = Parameters::get_camera_1_intrinsics();
+    const Eigen::Matrix<double, 2, 3>& projectionJacobian =
+            (cameraIntrinsics.topRows<2>() - screenPoint * vector3::UnitZ().transpose()) / cameraPoint.z();
+
+    // the camera point depends on the column j of the transformation through the coordinate j of the world point
+    for (uint column = 0; column < 4; ++column)
+    {
+        jacobian.block<2, 3>(0, 3 * column) = homogeneousPoint(column) * projectionJacobian;
+    }
+    return true;
+}
+
+vector2 WorldCoordinate::get_signed_distance_2D_px(const ScreenCoordinate2D& screenPoint,
+                                                   const WorldToCameraMatrix& worldToCamera,
+                                                   Eigen::Matrix<double, 2, 12>& jacobian) const
+{
+    ScreenCoordinate2D projectedScreenPoint;
+    if (to_screen_coordinates(worldToCamera, projectedScreenPoint, jacobian))
+    {
+        vector2 distance = screenPoint - projectedScreenPoint;
+        if (distance.hasNaN())
+        {
+            throw std::invalid_argument("WorldCoordinate::get_signed_distance_2D_px: distance as some NaN");
+        }
+        // the distance decreases when the projection moves toward the screen point
+        jacobian = -jacobian;
+        return distance;
+    }
+    // high number
+    return vector2(std::numeric_limits<double>::max(), std::numeric_limits<double>::max());
+}
+
 vector2 WorldCoordinate::get_signed_distance_2D_px(const ScreenCoordinate2D& screenPoint,
                                                    const WorldToCameraMatrix& worldToCamera) const
 {
@@ -296,4 +341,35 @@ CameraCoordinate WorldCoordinate::to_camera_coordinates(const WorldToCameraMatri
     return CameraCoordinate(cameraHomogenousCoordinates);
 }
 
-} // namespace rgbd_slam
\ No newline at end of file
+/**
+ *      BATCH PROJECTION
+ */
+
+void project_to_screen(const WorldToCameraMatrix& worldToCamera,
+                       const matrix3X& worldPoints,
+                       ScreenCoordinateBatch& screenPoints) noexcept
+{
+    using matrix3Xh = Eigen::Matrix<hotScalar, 3, Eigen::Dynamic>;
+    const static matrix33 cameraIntrinsics = Parameters::get_camera_1_intrinsics();
+    static const hotScalar screenSizeX = static_cast<hotScalar>(Parameters::get_camera_1_image_size().x());
+    static const hotScalar screenSizeY = static_cast<hotScalar>(Parameters::get_camera_1_image_size().y());
+
+    // the projection matrix is composed in double, the points are projected at the hot path precision
+    const Eigen::Matrix<hotScalar, 3, 4> projection =
+            (cameraIntrinsics * worldToCamera.topRows<3>()).cast<hotScalar>();
+    // one matrix product for all the points, then coefficient wise passes: Eigen vectorizes both
+    const matrix3Xh projectedPoints =
+            (projection.leftCols<3>() * worldPoints.cast<hotScalar>()).colwise() + projection.col(3);
+
+    screenPoints._depth = projectedPoints.row(2).transpose().array();
+    screenPoints._x = projectedPoints.row(0).transpose().array() / screenPoints._depth;
+    screenPoints._y = projectedPoints.row(1).transpose().array() / screenPoints._depth;
+    // comparisons with NaN are false: the invalid projections are not visible
+    constexpr hotScalar zero = 0;
+    screenPoints._isVisible = (screenPoints._depth > zero and screenPoints._x >= zero and
+                               screenPoints._x <= screenSizeX and screenPoints._y >= zero and
+                               screenPoints._y <= screenSizeY)
+                                      .matrix();
+}
+
+} // namespace rgbd_slam
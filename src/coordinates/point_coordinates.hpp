@@ -167,6 +167,17 @@ struct WorldCoordinate : public vector3
                                              ScreenCoordinate& screenPoint) const noexcept;
     [[nodiscard]] bool to_screen_coordinates(const WorldToCameraMatrix& worldToCamera,
                                              ScreenCoordinate2D& screenPoint) const noexcept;
+    /**
+     * \brief Transform a point from world to screen coordinate system, and compute the jacobian of this projection
+     * \param[in] worldToCamera Matrix to transform the world to a local coordinate system
+     * \param[out] screenPoint The point screen coordinates, if the function returned true
+     * \param[out] jacobian The jacobian of the screen point with respect to the 12 coefficients of the upper 3x4 block
+     * of worldToCamera (column major)
+     * \return True if the screen position is valid
+     */
+    [[nodiscard]] bool to_screen_coordinates(const WorldToCameraMatrix& worldToCamera,
+                                             ScreenCoordinate2D& screenPoint,
+                                             Eigen::Matrix<double, 2, 12>& jacobian) const noexcept;
 
     /**
      * \brief Transform a vector in world space to a vector in camera space
@@ -184,6 +195,17 @@ struct WorldCoordinate : public vector3
      */
     [[nodiscard]] vector2 get_signed_distance_2D_px(const ScreenCoordinate2D& screenPoint,
                                                     const WorldToCameraMatrix& worldToCamera) const;
+    /**
+     * \brief Compute a signed 2D distance between this world point and a screen point, and its jacobian
+     * \param[in] screenPoint A point in screen space. Only the x and y components will be used
+     * \param[in] worldToCamera A transformation matrix to convert from world to camera space
+     * \param[out] jacobian The jacobian of the distance with respect to the 12 coefficients of the upper 3x4 block of
+     * worldToCamera (column major). Set to zero if the point cannot be projected
+     * \return a 2D signed distance in camera space (pixels)
+     */
+    [[nodiscard]] vector2 get_signed_distance_2D_px(const ScreenCoordinate2D& screenPoint,
+                                                    const WorldToCameraMatrix& worldToCamera,
+                                                    Eigen::Matrix<double, 2, 12>& jacobian) const;
     /**
      * \brief Compute a distance between this world point and a screen point, by retroprojecting the world point to
      * screen space.
@@ -224,6 +246,37 @@ struct WorldCoordinate : public vector3
     };
 };
 
+/**
+ * \brief The screen projections of a batch of points, in structure of arrays
+ */
+struct ScreenCoordinateBatch
+{
+    arrayxh _x;
+    arrayxh _y;
+    arrayxh _depth;     // depth in camera space
+    vectorb _isVisible; // in front of the camera and in the screen boundaries
+
+    [[nodiscard]] size_t size() const noexcept { return static_cast<size_t>(_x.size()); }
+
+    [[nodiscard]] ScreenCoordinate2D get_2D(const size_t index) const noexcept
+    {
+        const Eigen::Index i = static_cast<Eigen::Index>(index);
+        return ScreenCoordinate2D(static_cast<double>(_x(i)), static_cast<double>(_y(i)));
+    }
+};
+
+/**
+ * \brief Project a batch of world points to screen space with the same transformation, in vectorized passes over the
+ * points. Gives the same result as WorldCoordinate::to_screen_coordinates followed by is_in_screen_boundaries, at the
+ * precision of hotScalar
+ * \param[in] worldToCamera Matrix to transform the world to a local coordinate system
+ * \param[in] worldPoints The world points, by column
+ * \param[out] screenPoints The screen projection of each point
+ */
+void project_to_screen(const WorldToCameraMatrix& worldToCamera,
+                       const matrix3X& worldPoints,
+                       ScreenCoordinateBatch& screenPoints) noexcept;
+
 } // namespace rgbd_slam
 
 #endif
\ No newline at end of file
@@ -163,7 +163,8 @@ CameraPolygon WorldPolygon::to_camera_space(const WorldToCameraMatrix& worldToCa
 
 void WorldPolygon::merge(const WorldPolygon& other)
 {
-    Polygon::merge_union(other.Polygon::project(_xAxis, _yAxis, _center));
+    // merge_union projects the other polygon to this space
+    Polygon::merge_union(other);
     // no need to correct to polygon
 };
 
@@ -3,18 +3,40 @@
 #include "../../parameters.hpp"
 
 // circle
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cassert>
 #include <cmath>
-#include <mutex>
+#include <limits>
 #include <tbb/parallel_for.h>
 #include <opencv2/features2d.hpp>
 #include <opencv2/xfeatures2d.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/opencv.hpp>
+#ifdef USE_OPENCL_ACCELERATION
+#include <opencv2/core/ocl.hpp>
+#endif
 #include <vector>
 
 namespace rgbd_slam::features::keypoints {
 
+namespace {
+
+/**
+ * \return The optical flow window size at each pyramid level, also the border of the pyramid levels
+ */
+const cv::Size& get_pyramid_window_size() noexcept
+{
+    static const cv::Size pyramidSize(static_cast<int>(Parameters::get_camera_1_image_size().x() /
+                                                       parameters::detection::opticalFlowPyramidWindowSizeWidthCount),
+                                      static_cast<int>(Parameters::get_camera_1_image_size().y() /
+                                                       parameters::detection::opticalFlowPyramidWindowSizeHeightCount));
+    return pyramidSize;
+}
+
+} // namespace
+
 /*
  * Keypoint extraction
  */
@@ -30,10 +52,16 @@ Key_Point_Extraction::Key_Point_Extraction()
     static const size_t cellSizeY = imageHeight / numCellsY;
     static const size_t cellSizeX = imageWidth / numCellsX;
 
+#ifdef USE_OPENCL_ACCELERATION
+    cv::ocl::setUseOpenCL(true);
+    if (not cv::ocl::useOpenCL())
+        outputs::log_warning("No OpenCL device available, the optical flow will run on the CPU");
+#endif
+
     // Create feature extractor and matcher
 #ifdef USE_ORB_DETECTOR_AND_MATCHING
     const int detectorThreshold =
-            std::max(1, static_cast<int>(parameters::detection::maximumPointPerFrame / numberOfDetectionCells));
+            std::max(1, static_cast<int>(Parameters::get_maximum_point_per_frame() / numberOfDetectionCells));
     for (size_t i = 0; i < numberOfDetectionCells; ++i)
     {
         _featureDetectors[i] = cv::Ptr<cv::FeatureDetector>(cv::ORB::create(detectorThreshold));
@@ -42,7 +70,15 @@ Key_Point_Extraction::Key_Point_Extraction()
         assert(not _advancedFeatureDetectors[i].empty());
     }
 
-    _featureDescriptor = _featureDetectors[0];
+    // the ORB budget is a feature count: adapt the threshold of its FAST corners, starting at the OpenCV default
+    static constexpr int orbFastThreshold = 20;
+    _detectorThresholds.fill(orbFastThreshold);
+    _minimumDetectorThreshold = orbFastThreshold / 2;
+    _maximumDetectorThreshold = orbFastThreshold * 2;
+
+    // a dedicated instance: the detectors of the windows are used by the parallel detection
+    _featureDescriptor = cv::Ptr<cv::DescriptorExtractor>(cv::ORB::create());
+    assert(not _featureDescriptor.empty());
 #else
 
     // the parameters for this threshold is based on measurments on the FAST detector thresholds
@@ -51,10 +87,9 @@ Key_Point_Extraction::Key_Point_Extraction()
     };
 
     // put more points to detect in the threshold, not expensive at all, gives better results
-    static const int detectorThreshold =
-            static_cast<int>(ceil(get_fast_threshold(10.0 * (double)parameters::detection::maximumPointPerFrame)));
-    static const int advanceDetectorThreshold =
-            static_cast<int>(ceil(get_fast_threshold(30.0 * (double)parameters::detection::maximumPointPerFrame)));
+    const double maximumPointPerFrame = static_cast<double>(Parameters::get_maximum_point_per_frame());
+    const int detectorThreshold = static_cast<int>(ceil(get_fast_threshold(10.0 * maximumPointPerFrame)));
+    const int advanceDetectorThreshold = static_cast<int>(ceil(get_fast_threshold(30.0 * maximumPointPerFrame)));
 
     for (size_t i = 0; i < numberOfDetectionCells; ++i)
     {
@@ -64,6 +99,11 @@ Key_Point_Extraction::Key_Point_Extraction()
         assert(not _advancedFeatureDetectors[i].empty());
     }
 
+    // under the advanced detector threshold, the first detector would replace it
+    _detectorThresholds.fill(detectorThreshold);
+    _minimumDetectorThreshold = advanceDetectorThreshold;
+    _maximumDetectorThreshold = detectorThreshold * 2;
+
     _featureDescriptor = cv::Ptr<cv::DescriptorExtractor>(cv::xfeatures2d::BriefDescriptorExtractor::create());
     assert(not _featureDescriptor.empty());
 #endif
@@ -84,7 +124,7 @@ Key_Point_Extraction::Key_Point_Extraction()
 }
 
 std::vector<cv::Point2f> Key_Point_Extraction::detect_keypoints(
-        const cv::Mat& grayImage, const std::vector<cv::Point2f>& alreadyDetectedPoints) const noexcept
+        const cv::Mat& grayImage, const std::vector<cv::Point2f>& alreadyDetectedPoints) noexcept
 {
     // search keypoints, using an advanced detector if not enough features are found
     std::vector<cv::KeyPoint> frameKeypoints;
@@ -108,31 +148,39 @@ std::vector<cv::Point2f> Key_Point_Extraction::detect_keypoints(
     return framePoints;
 }
 
-cv::Mat_<uchar> Key_Point_Extraction::compute_key_point_mask(
+void Key_Point_Extraction::index_masking_points(
         const cv::Size imageSize,
         const std::vector<cv::Point2f>& keypointContainer,
         const double pointMaskRadius_px,
-        std::array<uint16_t, numberOfDetectionCells>& detectionWindowDetectionCount) const noexcept
+        std::array<uint16_t, numberOfDetectionCells>& detectionWindowDetectionCount) noexcept
 {
-    const int radiusOfAreaAroundPoint = static_cast<int>(pointMaskRadius_px); // in pixels
-    const static cv::Scalar fillColor(0);
+    // buckets of the mask radius: the points closer than the radius are in the same or the neighbour buckets
+    // is_masked and the bucket indexes divide by this radius
+    assert(pointMaskRadius_px > 0.0);
+    _maskRadius_px = static_cast<float>(std::max(pointMaskRadius_px, 1.0));
+    _maskingBucketColumns =
+            std::max(1, static_cast<int>(std::ceil(static_cast<float>(imageSize.width) / _maskRadius_px)));
+    _maskingBucketRows =
+            std::max(1, static_cast<int>(std::ceil(static_cast<float>(imageSize.height) / _maskRadius_px)));
+    const auto get_bucket_index = [this](const cv::Point2f& point) {
+        const int column = std::clamp(static_cast<int>(point.x / _maskRadius_px), 0, _maskingBucketColumns - 1);
+        const int row = std::clamp(static_cast<int>(point.y / _maskRadius_px), 0, _maskingBucketRows - 1);
+        return static_cast<size_t>(row * _maskingBucketColumns + column);
+    };
 
-    // this intance is a small optimisation with a static and a reset to white each time
-    static cv::Mat_<uchar> mask(imageSize);
-    mask.setTo(255); // set all to white (no mask)
+    // counting sort of the points by bucket
+    _maskingBucketOffsets.assign(static_cast<size_t>(_maskingBucketColumns * _maskingBucketRows) + 1, 0);
+    for (const cv::Point2f& point: keypointContainer)
+        ++_maskingBucketOffsets[get_bucket_index(point) + 1];
+    for (size_t i = 1; i < _maskingBucketOffsets.size(); ++i)
+        _maskingBucketOffsets[i] += _maskingBucketOffsets[i - 1];
 
+    _maskingPoints.resize(keypointContainer.size());
+    std::vector<uint32_t> insertionOffsets(_maskingBucketOffsets.begin(), _maskingBucketOffsets.end() - 1);
     detectionWindowDetectionCount.fill(0);
     for (const cv::Point2f& point: keypointContainer)
     {
-#if 1
-        cv::circle(mask, point, radiusOfAreaAroundPoint, fillColor, -1);
-#else
-        const int areaXmin = point.x - radiusOfAreaAroundPoint;
-        const int areaXmax = point.x + radiusOfAreaAroundPoint;
-        const int areaYmin = point.y - radiusOfAreaAroundPoint;
-        const int areaYmax = point.y + radiusOfAreaAroundPoint;
-        cv::rectangle(mask, cv::Point(areaXmin, areaYmin), cv::Point(areaXmax, areaYmax), fillColor, -1);
-#endif
+        _maskingPoints[insertionOffsets[get_bucket_index(point)]++] = point;
 
         // get the index of the associated detection window
         for (size_t i = 0; i < _detectionWindows.size(); ++i)
@@ -150,15 +198,96 @@ cv::Mat_<uchar> Key_Point_Extraction::compute_key_point_mask(
         // They can miss some pixels because the size of the camera is not divisible by the span of windows
         // It can causes a small band of non detections in the image, negligeable
     }
+}
 
-    // i'm not a fan of returning a local static variable, but hey it works...
-    return mask;
+bool Key_Point_Extraction::is_masked(const cv::Point2f& point) const noexcept
+{
+    const int column = std::clamp(static_cast<int>(point.x / _maskRadius_px), 0, _maskingBucketColumns - 1);
+    const int row = std::clamp(static_cast<int>(point.y / _maskRadius_px), 0, _maskingBucketRows - 1);
+    const float squaredRadius = _maskRadius_px * _maskRadius_px;
+    for (int bucketRow = std::max(0, row - 1); bucketRow <= std::min(_maskingBucketRows - 1, row + 1); ++bucketRow)
+    {
+        const size_t rowStart = static_cast<size_t>(bucketRow * _maskingBucketColumns);
+        const size_t firstBucket = rowStart + static_cast<size_t>(std::max(0, column - 1));
+        const size_t lastBucket = rowStart + static_cast<size_t>(std::min(_maskingBucketColumns - 1, column + 1));
+        // the buckets of a row are contiguous in the sorted points
+        for (uint32_t i = _maskingBucketOffsets[firstBucket]; i < _maskingBucketOffsets[lastBucket + 1]; ++i)
+        {
+            const cv::Point2f difference = _maskingPoints[i] - point;
+            if (difference.dot(difference) <= squaredRadius)
+                return true;
+        }
+    }
+    return false;
+}
+
+cv::Mat Key_Point_Extraction::prepare_image(const cv::Mat& rgbImage) noexcept
+{
+    const int64 preparationStartTime = cv::getTickCount();
+#ifdef USE_OPENCL_ACCELERATION
+    // the pyramids are built on the device by the optical flow
+    cv::Mat grayImage;
+    cv::cvtColor(rgbImage, grayImage, cv::COLOR_BGR2GRAY);
+#else
+    constexpr int pyramidDepth = static_cast<int>(parameters::detection::opticalFlowPyramidDepth);
+    const cv::Size& border = get_pyramid_window_size();
+
+    // the gray image is converted in the bordered first level of the pyramid: buildOpticalFlowPyramid uses it in
+    // place. A buffer still held by the on demand description of a past frame is replaced, not overwritten
+    std::vector<cv::Mat>& imagePyramide = _framePyramides[_currentPyramideIndex];
+    if (not imagePyramide.empty())
+        imagePyramide[0].release();
+    cv::Mat& borderedImage = _borderedGrayImages[_currentPyramideIndex];
+    const cv::Size borderedSize(rgbImage.cols + 2 * border.width, rgbImage.rows + 2 * border.height);
+    // Single owner assumption: only this thread takes references to the buffer (the keypoint handlers of the frame),
+    // but the on demand description can release them from any thread. Once this is the only reference, no other
+    // thread can take one. The count is read atomically, and the acquire load pairs with the atomic decrement of
+    // OpenCV: the reads of the released references happen before this thread overwrites the buffer
+    const auto is_shared = [](const cv::Mat& image) {
+        return image.u != nullptr and std::atomic_ref<int>(image.u->refcount).load(std::memory_order_acquire) > 1;
+    };
+    if (borderedImage.size() != borderedSize or is_shared(borderedImage))
+        borderedImage = cv::Mat(borderedSize, CV_8UC1);
+
+    cv::Mat grayImage = borderedImage(cv::Rect(border.width, border.height, rgbImage.cols, rgbImage.rows));
+    cv::cvtColor(rgbImage, grayImage, cv::COLOR_BGR2GRAY);
+    assert(grayImage.datastart == borderedImage.datastart);
+
+    // the border of the first level, as buildOpticalFlowPyramid would do it: reflected columns, then reflected rows
+    for (int row = 0; row < rgbImage.rows; ++row)
+    {
+        uchar* borderedRow = borderedImage.ptr<uchar>(row + border.height) + border.width;
+        for (int col = 1; col <= border.width; ++col)
+        {
+            borderedRow[-col] = borderedRow[cv::borderInterpolate(-col, rgbImage.cols, cv::BORDER_REFLECT_101)];
+            borderedRow[rgbImage.cols - 1 + col] = borderedRow[cv::borderInterpolate(
+                    rgbImage.cols - 1 + col, rgbImage.cols, cv::BORDER_REFLECT_101)];
+        }
+    }
+    for (int row = 1; row <= border.height; ++row)
+    {
+        borderedImage.row(border.height + cv::borderInterpolate(-row, rgbImage.rows, cv::BORDER_REFLECT_101))
+                .copyTo(borderedImage.row(border.height - row));
+        borderedImage
+                .row(border.height +
+                     cv::borderInterpolate(rgbImage.rows - 1 + row, rgbImage.rows, cv::BORDER_REFLECT_101))
+                .copyTo(borderedImage.row(border.height + rgbImage.rows - 1 + row));
+    }
+
+    cv::buildOpticalFlowPyramid(grayImage, imagePyramide, border, pyramidDepth);
+    assert(imagePyramide[0].data == grayImage.data);
+    _isPyramideBuilt = true;
+#endif
+    _meanPointExtractionDuration +=
+            static_cast<double>(cv::getTickCount() - preparationStartTime) / cv::getTickFrequency();
+    return grayImage;
 }
 
 Keypoint_Handler Key_Point_Extraction::compute_keypoints(const cv::Mat& grayImage,
                                                          const cv::Mat_<float>& depthImage,
                                                          const KeypointsWithIdStruct& lastKeypointsWithIds,
-                                                         const bool forceKeypointDetection) noexcept
+                                                         const bool forceKeypointDetection,
+                                                         const double predictionRadius_px) noexcept
 {
     KeypointsWithIdStruct newKeypointsObject;
 
@@ -174,31 +303,70 @@ Keypoint_Handler Key_Point_Extraction::compute_keypoints(const cv::Mat& grayImag
     constexpr double maxDistance = parameters::matching::matchSearchRadius_px;
     constexpr double maximumMatchDistance = parameters::matching::maximumMatchDistance;
 
-    static const cv::Size pyramidSize(static_cast<int>(Parameters::get_camera_1_image_size().x() /
-                                                       parameters::detection::opticalFlowPyramidWindowSizeWidthCount),
-                                      static_cast<int>(Parameters::get_camera_1_image_size().y() /
-                                                       parameters::detection::opticalFlowPyramidWindowSizeHeightCount));
+    const cv::Size& pyramidSize = get_pyramid_window_size();
 
-    // build pyramid
-    std::vector<cv::Mat> newImagePyramide;
-    cv::buildOpticalFlowPyramid(grayImage, newImagePyramide, pyramidSize, pyramidDepth);
+#ifdef USE_OPENCL_ACCELERATION
+    // upload in the buffer of the previous-previous frame: the device memory is reused
+    cv::UMat& newImagePyramide = _frameImages[_currentPyramideIndex];
+    const cv::UMat& lastFramePyramide = _frameImages[1 - _currentPyramideIndex];
+    grayImage.copyTo(newImagePyramide);
+#else
+    // build pyramid in the buffer of the previous-previous frame: once allocated, the levels keep their size (fixed
+    // sensor resolution), so buildOpticalFlowPyramid reuses their memory. Already built by prepare_image for this
+    // gray image
+    std::vector<cv::Mat>& newImagePyramide = _framePyramides[_currentPyramideIndex];
+    const std::vector<cv::Mat>& lastFramePyramide = _framePyramides[1 - _currentPyramideIndex];
+    if (not _isPyramideBuilt)
+    {
+        cv::buildOpticalFlowPyramid(grayImage,
+                                    newImagePyramide,
+                                    pyramidSize,
+                                    pyramidDepth,
+                                    true,
+                                    cv::BORDER_REFLECT_101,
+                                    cv::BORDER_CONSTANT,
+                                    false);
+    }
+    _isPyramideBuilt = false;
+#endif
     // TODO: when the optical flow will not show so much drift, maybe we could remove the tracked keypoint
     // redetection
-    if (not _lastFramePyramide.empty() and not lastKeypointsWithIds.empty())
+    if (_hasLastFramePyramide and not lastKeypointsWithIds.empty())
     {
+        // started from predicted positions, LK only has to correct the prediction error: a small window covers it on
+        // a few levels of the pyramid
+        int trackingDepth = pyramidDepth;
+        cv::Size trackingWindowSize = pyramidSize;
+        if (lastKeypointsWithIds.has_predicted_keypoints())
+        {
+            static constexpr int guidedWindowSize =
+                    static_cast<int>(parameters::detection::opticalFlowGuidedWindowSize_px);
+            trackingWindowSize = cv::Size(std::min(guidedWindowSize, pyramidSize.width),
+                                          std::min(guidedWindowSize, pyramidSize.height));
+
+            // a window of half size w follows a motion of about w * 2^n pixels at the level n
+            const double halfWindowSize = std::min(trackingWindowSize.width, trackingWindowSize.height) / 2.0;
+            trackingDepth = 0;
+            while (trackingDepth < pyramidDepth and halfWindowSize * (1 << trackingDepth) < predictionRadius_px)
+                ++trackingDepth;
+        }
+
         const auto opticalFlowStartTime = cv::getTickCount();
-        get_keypoints_from_optical_flow(_lastFramePyramide,
+        get_keypoints_from_optical_flow(lastFramePyramide,
                                         newImagePyramide,
+                                        grayImage.size(),
                                         lastKeypointsWithIds,
-                                        pyramidDepth,
-                                        pyramidSize,
+                                        static_cast<uint>(trackingDepth),
+                                        trackingWindowSize,
                                         maxDistance,
                                         newKeypointsObject);
         _meanPointOpticalFlowTrackingDuration +=
                 static_cast<double>(cv::getTickCount() - opticalFlowStartTime) / cv::getTickFrequency();
     }
     // else: No optical flow for the first frame or no optical flow for this frame
-    _lastFramePyramide = newImagePyramide;
+    // swap the buffers: this pyramid is the last frame one for the next call
+    _currentPyramideIndex = 1 - _currentPyramideIndex;
+    _hasLastFramePyramide = true;
 
     const size_t opticalFlowTrackedPointCount = newKeypointsObject.size();
 
@@ -209,58 +377,68 @@ Keypoint_Handler Key_Point_Extraction::compute_keypoints(const cv::Mat& grayImag
 
     // detect keypoint if: it is requested OR not enough points were detected
     std::vector<cv::Point2f> detectedKeypoints;
-    cv::Mat keypointDescriptors;
-    if (forceKeypointDetection or opticalFlowTrackedPointCount < parameters::detection::maximumPointPerFrame)
+    if (forceKeypointDetection or opticalFlowTrackedPointCount < get_point_budget())
     {
         const auto pointDetectionStartTime = cv::getTickCount();
 
         // get new keypoints
         detectedKeypoints = detect_keypoints(grayImage, newKeypointsObject.get_keypoints());
+
+        // remove the points that the descriptor could not describe: its patch must fit in the image
+#ifdef USE_ORB_DETECTOR_AND_MATCHING
+        static constexpr double descriptorBorder_px = 31.0;
+#else
+        static constexpr double descriptorBorder_px = 28.0;
+#endif
+        std::erase_if(detectedKeypoints, [&grayImage](const cv::Point2f& point) {
+            return not is_in_border(point, grayImage, descriptorBorder_px);
+        });
+        _detectedKeypointCount += detectedKeypoints.size();
+
         _meanPointDetectionDuration +=
                 static_cast<double>(cv::getTickCount() - pointDetectionStartTime) / cv::getTickFrequency();
-
-        if (not detectedKeypoints.empty())
-        {
-            const auto pointDescriptorsStartTime = cv::getTickCount();
-            /**
-             *  DESCRIPTORS
-             */
-            std::vector<cv::KeyPoint> frameKeypoints;
-            cv::KeyPoint::convert(detectedKeypoints, frameKeypoints);
-
-            // Compute descriptors
-            // Caution: the frameKeypoints list is mutable by this function
-            //          The bad points will be removed by the compute descriptor function
-            cv::Mat detectedKeypointDescriptors;
-            assert(_featureDescriptor != nullptr);
-            _featureDescriptor->compute(grayImage, frameKeypoints, detectedKeypointDescriptors);
-
-            // convert back to keypoint list
-            detectedKeypoints.clear();
-            cv::KeyPoint::convert(frameKeypoints, detectedKeypoints);
-
-            if (keypointDescriptors.rows > 0)
-                cv::vconcat(detectedKeypointDescriptors, keypointDescriptors, keypointDescriptors);
-            else
-                keypointDescriptors = detectedKeypointDescriptors;
-
-            _meanPointDescriptorDuration +=
-                    static_cast<double>(cv::getTickCount() - pointDescriptorsStartTime) / cv::getTickFrequency();
-        }
     }
 
-    // declare static
-    static Keypoint_Handler keypointHandler(depthImage.cols, depthImage.rows, maximumMatchDistance);
+    /**
+     *  DESCRIPTORS
+     *      Computed on demand by the keypoint handler, for the keypoints that a match or a new map point needs
+     */
+    const auto describe = [featureDescriptor = _featureDescriptor,
+                           grayImage,
+                           descriptionStatistics = _descriptionStatistics](std::vector<cv::KeyPoint>& keypoints,
+                                                                           cv::Mat& descriptors) {
+        const auto pointDescriptorsStartTime = cv::getTickCount();
+        describe_keypoints(featureDescriptor, grayImage, keypoints, descriptors);
+        descriptionStatistics->_describedKeypointCount += keypoints.size();
+        descriptionStatistics->_duration_ticks += static_cast<uint64_t>(cv::getTickCount() - pointDescriptorsStartTime);
+    };
+#ifdef USE_ORB_DETECTOR_AND_MATCHING
+    // the orientation of ORB needs a bigger patch: the whole frame is described by the first query
+    static constexpr bool shouldDescribeByCell = false;
+#else
+    static constexpr bool shouldDescribeByCell = true;
+#endif
+
+    // the handler of this extractor keeps its buffers between frames: only created for the first frame
+    if (not _keypointHandler.has_value())
+        _keypointHandler.emplace(depthImage.cols, depthImage.rows, maximumMatchDistance);
+    Keypoint_Handler& keypointHandler = *_keypointHandler;
 
     // Update last keypoint struct
-    keypointHandler.set(detectedKeypoints, keypointDescriptors, newKeypointsObject, depthImage);
+    keypointHandler.set(detectedKeypoints,
+                        newKeypointsObject,
+                        depthImage,
+                        describe,
+                        static_cast<size_t>(_featureDescriptor->descriptorSize()),
+                        shouldDescribeByCell);
     _meanPointExtractionDuration +=
             static_cast<double>(cv::getTickCount() - keypointDetectionStartTime) / cv::getTickFrequency();
     return keypointHandler;
 }
 
-void Key_Point_Extraction::get_keypoints_from_optical_flow(const std::vector<cv::Mat>& imagePreviousPyramide,
-                                                           const std::vector<cv::Mat>& imageCurrentPyramide,
+void Key_Point_Extraction::get_keypoints_from_optical_flow(cv::InputArray imagePreviousPyramide,
+                                                           cv::InputArray imageCurrentPyramide,
+                                                           const cv::Size& imageSize,
                                                            const KeypointsWithIdStruct& lastKeypointsWithIds,
                                                            const uint pyramidDepth,
                                                            const cv::Size& windowSizeObject,
@@ -275,38 +453,46 @@ void Key_Point_Extraction::get_keypoints_from_optical_flow(const std::vector<cv:
     }
 
     // Calculate optical flow
+    // The tracking error of LK is not used (the round trip check is a better one): do not request it, it spares its
+    // computation on each pyramid level of each point
     std::vector<uchar> statusContainer;
-    std::vector<float> errorContainer;
     std::vector<cv::Point2f> forwardPoints;
 
     const size_t previousKeyPointCount = lastKeypointsWithIds.size();
     const static cv::TermCriteria criteria =
             cv::TermCriteria(cv::TermCriteria::COUNT | cv::TermCriteria::EPS, 10, 0.03);
 
+    // the predicted positions are the initial guesses of the forward optical flow
+    const bool isFlowGuided = lastKeypointsWithIds.has_predicted_keypoints();
+    const int flowFlags = isFlowGuided ? cv::OPTFLOW_USE_INITIAL_FLOW : 0;
+    if (isFlowGuided)
+        forwardPoints = lastKeypointsWithIds.get_predicted_keypoints();
+
     // Get forward points: optical flow from previous to current image to extract new keypoints
     cv::calcOpticalFlowPyrLK(imagePreviousPyramide,
                              imageCurrentPyramide,
                              lastKeypointsWithIds.get_keypoints(),
                              forwardPoints,
                              statusContainer,
-                             errorContainer,
+                             cv::noArray(),
                              windowSizeObject,
                              static_cast<int>(pyramidDepth),
-                             criteria);
+                             criteria,
+                             flowFlags);
 
     std::vector<size_t> keypointIndexContainer; // Contains the ids of the good waypoints
     std::vector<cv::Point2f> newKeypoints;      // Set output structure
     keypointIndexContainer.reserve(previousKeyPointCount);
     newKeypoints.reserve(previousKeyPointCount);
 
-    // Remove outliers from current waypoint list by creating a new one
+    // Remove outliers from current waypoint list by creating a new one: only the forward inliers are tracked back
     for (size_t keypointIndex = 0; keypointIndex < previousKeyPointCount; ++keypointIndex)
     {
         if (statusContainer[keypointIndex] != 1)
         { // point was not associated or error is too great
             continue;
         }
-        if (not is_in_border(forwardPoints[keypointIndex], imageCurrentPyramide.at(0)))
+        if (not is_in_border(forwardPoints[keypointIndex], imageSize))
         {
             // point not in image borders
             continue;
@@ -324,19 +510,35 @@ void Key_Point_Extraction::get_keypoints_from_optical_flow(const std::vector<cv:
 
     // Contains the keypoints from this frame, without outliers
     std::vector<cv::Point2f> backwardKeypoints;
+    if (isFlowGuided)
+    {
+        // start from the inverse of the predicted motion, and not from the original point: the round trip check
+        // must not be biased toward its own answer
+        const std::vector<cv::Point2f>& lastKeypoints = lastKeypointsWithIds.get_keypoints();
+        const std::vector<cv::Point2f> predictedKeypoints = lastKeypointsWithIds.get_predicted_keypoints();
+        backwardKeypoints.reserve(newKeypoints.size());
+        for (size_t i = 0; i < newKeypoints.size(); ++i)
+        {
+            const size_t keypointIndex = keypointIndexContainer[i];
+            const cv::Point2f predictedMotion = predictedKeypoints[keypointIndex] - lastKeypoints[keypointIndex];
+            backwardKeypoints.push_back(newKeypoints[i] - predictedMotion);
+        }
+    }
 
-    // Backward tracking: go from this frame inliers to the last frame inliers
+    // Backward tracking: go from this frame inliers to the last frame inliers, in one batch on the same pyramids
     cv::calcOpticalFlowPyrLK(imageCurrentPyramide,
                              imagePreviousPyramide,
                              newKeypoints,
                              backwardKeypoints,
                              statusContainer,
-                             errorContainer,
+                             cv::noArray(),
                              windowSizeObject,
                              static_cast<int>(pyramidDepth),
-                             criteria);
+                             criteria,
+                             flowFlags);
 
     // mark outliers as false and visualize
+    const double squaredMaxDistanceThreshold = maxDistanceThreshold * maxDistanceThreshold;
     const size_t keypointSize = backwardKeypoints.size();
     keypointStruct.reserve(keypointSize);
     for (size_t i = 0; i < keypointSize; ++i)
@@ -349,7 +551,8 @@ void Key_Point_Extraction::get_keypoints_from_optical_flow(const std::vector<cv:
         const size_t keypointIndex = keypointIndexContainer[i];
         const KeypointsWithIdStruct::keypointWithId& lastKeypoint = lastKeypointsWithIds.at(keypointIndex);
         // check distance of the backpropagated point to the original point
-        if (cv::norm(lastKeypoint._point - backwardKeypoints[i]) > maxDistanceThreshold)
+        const cv::Point2f roundTripError = lastKeypoint._point - backwardKeypoints[i];
+        if (roundTripError.dot(roundTripError) > squaredMaxDistanceThreshold)
         {
             continue;
         }
@@ -360,6 +563,61 @@ void Key_Point_Extraction::get_keypoints_from_optical_flow(const std::vector<cv:
     }
 }
 
+size_t Key_Point_Extraction::get_pyramid_allocated_bytes() const noexcept
+{
+    size_t allocatedBytes = 0;
+#ifdef USE_OPENCL_ACCELERATION
+    // the OpenCL pyramids are built in the device memory, only the input images are kept
+    for (const cv::UMat& frameImage: _frameImages)
+        allocatedBytes += frameImage.total() * frameImage.elemSize();
+#else
+    for (const std::vector<cv::Mat>& framePyramide: _framePyramides)
+    {
+        // the levels are views in bordered buffers: count the whole buffers
+        for (const cv::Mat& level: framePyramide)
+            allocatedBytes += static_cast<size_t>(level.datalimit - level.datastart);
+    }
+#endif
+    return allocatedBytes;
+}
+
+void Key_Point_Extraction::warm_up(const cv::Mat& rgbImage, const cv::Mat_<float>& depthImage) noexcept
+{
+    // the detections adapt the detector thresholds: the synthetic frame must not change them
+    const std::array<int, numberOfDetectionCells> detectorThresholds = _detectorThresholds;
+
+    // first call: detection and description, allocates the first pyramid buffer and the keypoint handler
+    const Keypoint_Handler detectedKeypoints =
+            compute_keypoints(prepare_image(rgbImage), depthImage, KeypointsWithIdStruct(), true);
+    if (detectedKeypoints.get_keypoint_count() > 0)
+        std::ignore = detectedKeypoints.has_descriptor(0);
+
+    KeypointsWithIdStruct trackedKeypoints;
+    trackedKeypoints.reserve(detectedKeypoints.get_keypoint_count());
+    for (uint i = 0; i < detectedKeypoints.get_keypoint_count(); ++i)
+    {
+        const ScreenCoordinate keypoint = detectedKeypoints.get_keypoint(i);
+        trackedKeypoints.add(i + 1, keypoint.x(), keypoint.y());
+    }
+
+    // second call: optical flow tracking, allocates the second pyramid buffer
+    std::ignore = compute_keypoints(prepare_image(rgbImage), depthImage, trackedKeypoints, true);
+
+    // the buffers stay allocated, but the first real frame must not be tracked from the synthetic one
+    _hasLastFramePyramide = false;
+    _currentPyramideIndex = 0;
+    for (size_t i = 0; i < numberOfDetectionCells; ++i)
+        set_detector_threshold(i, detectorThresholds[i]);
+
+    // the warm up is not part of the statistics
+    _meanPointExtractionDuration = 0.0;
+    _meanPointOpticalFlowTrackingDuration = 0.0;
+    _meanPointDetectionDuration = 0.0;
+    _detectedKeypointCount = 0;
+    _descriptionStatistics->_describedKeypointCount.store(0);
+    _descriptionStatistics->_duration_ticks.store(0);
+}
+
 void Key_Point_Extraction::show_statistics(const double meanFrameTreatmentDuration,
                                            const uint frameCount,
                                            const bool shouldDisplayDetails) const noexcept
@@ -392,85 +650,223 @@ void Key_Point_Extraction::show_statistics(const double meanFrameTreatmentDurati
                                 meanPointDetectionDuration,
                                 get_percent_of_elapsed_time(meanPointDetectionDuration, meanPointExtractionDuration)));
 
-            const double meanPointDescriptorDuration = _meanPointDescriptorDuration / static_cast<double>(frameCount);
+            // the descriptors are computed on demand, outside of the point extraction
+            const double meanPointDescriptorDuration =
+                    static_cast<double>(_descriptionStatistics->_duration_ticks.load()) / cv::getTickFrequency() /
+                    static_cast<double>(frameCount);
             outputs::log(
-                    std::format("\t\tMean point descriptor time is {:.4f} seconds ({:.2f}%)",
+                    std::format("\t\tMean on demand point descriptor time is {:.4f} seconds ({:.2f}%)",
                                 meanPointDescriptorDuration,
-                                get_percent_of_elapsed_time(meanPointDescriptorDuration, meanPointExtractionDuration)));
+                                get_percent_of_elapsed_time(meanPointDescriptorDuration, meanFrameTreatmentDuration)));
+            const double describedPointRatio =
+                    _detectedKeypointCount > 0
+                            ? static_cast<double>(_descriptionStatistics->_describedKeypointCount.load()) /
+                                      static_cast<double>(_detectedKeypointCount)
+                            : 0.0;
+            outputs::log(std::format("\t\t{:.2f}% of the detected points were described", describedPointRatio * 100.0));
         }
     }
 }
 
 void Key_Point_Extraction::perform_keypoint_detection(const cv::Mat& grayImage,
                                                       const std::vector<cv::Point2f>& alreadyDetectedPoints,
-                                                      std::vector<cv::KeyPoint>& frameKeypoints) const noexcept
+                                                      std::vector<cv::KeyPoint>& frameKeypoints) noexcept
 {
     frameKeypoints.clear();
-    std::mutex mut;
 
-    // create a mask around already detected points location
+    // index the already detected points, to reject the new keypoints around them
     std::array<uint16_t, numberOfDetectionCells> detectionWindowDetectionCount;
-    const cv::Mat_<uchar>& keypointMask = compute_key_point_mask(grayImage.size(),
-                                                                 alreadyDetectedPoints,
-                                                                 parameters::detection::trackedMaskRadius_px,
-                                                                 detectionWindowDetectionCount);
-
-    constexpr size_t maxKeypointToDetectByCell =
-            parameters::detection::maximumPointPerFrame / (parameters::detection::keypointCellDetectionHeightCount *
-                                                           parameters::detection::keypointCellDetectionWidthCount);
-    frameKeypoints.reserve(parameters::detection::maximumPointPerFrame);
-
-#ifndef MAKE_DETERMINISTIC
-    tbb::parallel_for(size_t(0),
-                      static_cast<size_t>(numberOfDetectionCells),
-                      [this, &grayImage, &keypointMask, &detectionWindowDetectionCount, &frameKeypoints, &mut](size_t i)
-#else
+    index_masking_points(grayImage.size(),
+                         alreadyDetectedPoints,
+                         parameters::detection::trackedMaskRadius_px,
+                         detectionWindowDetectionCount);
+
+    const size_t maxKeypointToDetectByCell =
+            std::max<size_t>(1, get_point_budget() / static_cast<size_t>(numberOfDetectionCells));
+
+    // each cell detects in its own container, merged in cell order after the detection
+    std::array<std::vector<cv::KeyPoint>, numberOfDetectionCells> cellKeypoints;
+    // requested and first detector point counts, to adapt the detector thresholds
+    std::array<size_t, numberOfDetectionCells> requestedCounts {};
+    std::array<size_t, numberOfDetectionCells> firstDetectorCounts {};
+    const auto detect_cell = [this,
+                              &grayImage,
+                              &detectionWindowDetectionCount,
+                              &cellKeypoints,
+                              &requestedCounts,
+                              &firstDetectorCounts,
+                              maxKeypointToDetectByCell](const size_t i) {
+        const uint16_t alreadyDetectedCount = detectionWindowDetectionCount[i];
+        // already enough points, no need to redetect
+        if (alreadyDetectedCount >= maxKeypointToDetectByCell)
+            return;
+
+        // new max points to detect
+        const uint16_t maxKeyPointToDetectHere =
+                static_cast<uint16_t>(maxKeypointToDetectByCell - alreadyDetectedCount);
+        requestedCounts[i] = maxKeyPointToDetectHere;
+
+        const auto& detectionWindow = _detectionWindows[i];
+        assert(!detectionWindow.empty());
+
+        const cv::Mat& subImg = grayImage(detectionWindow);
+
+        std::vector<cv::KeyPoint>& keypoints = cellKeypoints[i];
+        keypoints.reserve(maxKeypointToDetectByCell);
+
+        // detect in the whole window, then reject the keypoints around the already detected points (to image space)
+        const cv::Point2f windowOrigin(static_cast<float>(detectionWindow.x), static_cast<float>(detectionWindow.y));
+        const auto remove_masked_keypoints = [this, &keypoints, &windowOrigin]() {
+            for (cv::KeyPoint& keypoint: keypoints)
+                keypoint.pt += windowOrigin;
+            std::erase_if(keypoints, [this](const cv::KeyPoint& keypoint) {
+                return is_masked(keypoint.pt);
+            });
+        };
+
+        assert(!_featureDetectors[i].empty());
+        _featureDetectors[i]->detect(subImg, keypoints);
+        remove_masked_keypoints();
+        firstDetectorCounts[i] = keypoints.size();
+
+        // Not enough keypoints detected: restart with a more precise detector
+        if (keypoints.size() < maxKeyPointToDetectHere)
+        {
+            keypoints.clear();
+            assert(!_advancedFeatureDetectors[i].empty());
+            _advancedFeatureDetectors[i]->detect(subImg, keypoints);
+            remove_masked_keypoints();
+        }
+
+        // filter the keypoints by score, if we have too much
+        cv::KeyPointsFilter::retainBest(keypoints, maxKeyPointToDetectHere);
+    };
+
+    tbb::parallel_for(size_t(0), static_cast<size_t>(numberOfDetectionCells), detect_cell);
+
+    // adapt the first detector thresholds: a cell that needed the advanced detector lowers its threshold, a cell that
+    // found a lot more points than needed raises it (cheaper detection and filtering)
+    static constexpr size_t excessDetectionFactor = 4;
     for (size_t i = 0; i < numberOfDetectionCells; ++i)
+    {
+        if (requestedCounts[i] == 0)
+            continue;
+        if (firstDetectorCounts[i] < requestedCounts[i])
+            set_detector_threshold(i, _detectorThresholds[i] - 1);
+        else if (firstDetectorCounts[i] > excessDetectionFactor * requestedCounts[i])
+            set_detector_threshold(i, _detectorThresholds[i] + 1);
+    }
+
+    // deterministic merge, whatever the order the cells finished in
+    frameKeypoints.reserve(get_point_budget());
+    for (const std::vector<cv::KeyPoint>& keypoints: cellKeypoints)
+    {
+        frameKeypoints.insert(frameKeypoints.end(), keypoints.begin(), keypoints.end());
+    }
+    cv::KeyPointsFilter::removeDuplicated(frameKeypoints);
+}
+
+void Key_Point_Extraction::set_detector_threshold(const size_t cellIndex, const int threshold) noexcept
+{
+    const int newThreshold = std::clamp(threshold, _minimumDetectorThreshold, _maximumDetectorThreshold);
+    if (newThreshold == _detectorThresholds[cellIndex])
+        return;
+    _detectorThresholds[cellIndex] = newThreshold;
+
+#ifdef USE_ORB_DETECTOR_AND_MATCHING
+    const cv::Ptr<cv::ORB>& detector = _featureDetectors[cellIndex].dynamicCast<cv::ORB>();
+    assert(not detector.empty());
+    detector->setFastThreshold(newThreshold);
+#else
+    const cv::Ptr<cv::FastFeatureDetector>& detector =
+            _featureDetectors[cellIndex].dynamicCast<cv::FastFeatureDetector>();
+    assert(not detector.empty());
+    detector->setThreshold(newThreshold);
 #endif
-                      {
-                          const uint16_t alreadyDetectedCount = detectionWindowDetectionCount[i];
-                          // already enough points, no need to redetect
-                          if (alreadyDetectedCount < maxKeypointToDetectByCell)
-                          {
-                              // new max points to detect
-                              const uint16_t maxKeyPointToDetectHere =
-                                      std::max(0, static_cast<int>(maxKeypointToDetectByCell) - alreadyDetectedCount);
-
-                              const auto& detectionWindow = _detectionWindows[i];
-                              assert(!detectionWindow.empty());
-
-                              const cv::Mat& subImg = grayImage(detectionWindow);
-                              const cv::Mat_<uchar>& subMask = keypointMask(detectionWindow);
-
-                              std::vector<cv::KeyPoint> keypoints;
-                              keypoints.reserve(maxKeypointToDetectByCell);
-
-                              assert(!_featureDetectors[i].empty());
-                              _featureDetectors[i]->detect(subImg, keypoints, subMask);
-
-                              // Not enough keypoints detected: restart with a more precise detector
-                              if (keypoints.size() < maxKeyPointToDetectHere)
-                              {
-                                  keypoints.clear();
-                                  assert(!_advancedFeatureDetectors[i].empty());
-                                  _advancedFeatureDetectors[i]->detect(subImg, keypoints, subMask);
-                              }
-
-                              // filter the keypoints by score, if we have too much
-                              cv::KeyPointsFilter::retainBest(keypoints, maxKeyPointToDetectHere);
-                              for (cv::KeyPoint& keypoint: keypoints)
-                              {
-                                  keypoint.pt.x += (float)detectionWindow.x;
-                                  keypoint.pt.y += (float)detectionWindow.y;
-                              }
-                              std::scoped_lock<std::mutex> lock(mut);
-                              frameKeypoints.insert(frameKeypoints.end(), keypoints.begin(), keypoints.end());
-                          }
-                      }
-#ifndef MAKE_DETERMINISTIC
-    );
+}
+
+void Key_Point_Extraction::update_detection_budget(const double frameDuration,
+                                                   const double trackingInlierRatio) noexcept
+{
+    // tunable at runtime: read them once for this update
+    const uint minimumBudget = Parameters::get_minimum_point_per_frame();
+    const uint maximumBudget = Parameters::get_maximum_point_per_frame();
+    const uint budgetStep = std::max(1u, maximumBudget / 20);
+    const uint minimumRefreshFrequency = Parameters::get_keypoint_refresh_frequency();
+    const uint maximumRefreshFrequency = minimumRefreshFrequency * 3;
+    const double targetFrameDuration = Parameters::get_target_frame_duration();
+
+    if (frameDuration <= 0)
+        return;
+
+    // smooth the frame duration, to not react to a single slow frame
+    static constexpr double smoothingFactor = 0.1;
+    if (_smoothedFrameDuration <= 0)
+        _smoothedFrameDuration = frameDuration;
+    else
+        _smoothedFrameDuration = (1.0 - smoothingFactor) * _smoothedFrameDuration + smoothingFactor * frameDuration;
+
+    // the limits may have been tuned since the last update
+    uint pointBudget = std::clamp(_pointBudget.load(), minimumBudget, maximumBudget);
+    uint refreshFrequency = std::clamp(_refreshFrequency.load(), minimumRefreshFrequency, maximumRefreshFrequency);
+    // dead band around the target, to not oscillate
+    if (trackingInlierRatio < parameters::detection::minimumTrackingInlierRatio or
+        _smoothedFrameDuration < targetFrameDuration * 0.8)
+    {
+        pointBudget = std::min(maximumBudget, pointBudget + budgetStep);
+        refreshFrequency = std::max(minimumRefreshFrequency, refreshFrequency - 1);
+    }
+    else if (_smoothedFrameDuration > targetFrameDuration * 1.1)
+    {
+        pointBudget = std::max(minimumBudget, pointBudget - std::min(pointBudget, budgetStep));
+        refreshFrequency = std::min(maximumRefreshFrequency, refreshFrequency + 1);
+    }
+    _pointBudget.store(pointBudget);
+    _refreshFrequency.store(refreshFrequency);
+}
+
+void Key_Point_Extraction::describe_keypoints(const cv::Ptr<cv::DescriptorExtractor>& featureDescriptor,
+                                              const cv::Mat& grayImage,
+                                              std::vector<cv::KeyPoint>& keypoints,
+                                              cv::Mat& descriptors) noexcept
+{
+    assert(not featureDescriptor.empty());
+    if (keypoints.empty())
+    {
+        descriptors.release();
+        return;
+    }
+#ifdef USE_ORB_DETECTOR_AND_MATCHING
+    // ORB patches grow with the pyramid level, describe on the whole image
+    featureDescriptor->compute(grayImage, keypoints, descriptors);
+#else
+    // a descriptor only depends on the neighborhood of its point: describe the bounding box of the batch, with a
+    // margin that contains the descriptor patch of all its points
+    static constexpr int descriptorMargin_px = 48;
+    float minX = std::numeric_limits<float>::max();
+    float minY = std::numeric_limits<float>::max();
+    float maxX = 0.0f;
+    float maxY = 0.0f;
+    for (const cv::KeyPoint& keypoint: keypoints)
+    {
+        minX = std::min(minX, keypoint.pt.x);
+        minY = std::min(minY, keypoint.pt.y);
+        maxX = std::max(maxX, keypoint.pt.x);
+        maxY = std::max(maxY, keypoint.pt.y);
+    }
+    const cv::Rect describedArea = cv::Rect(cv::Point(static_cast<int>(minX) - descriptorMargin_px,
+                                                      static_cast<int>(minY) - descriptorMargin_px),
+                                            cv::Point(static_cast<int>(maxX) + descriptorMargin_px + 1,
+                                                      static_cast<int>(maxY) + descriptorMargin_px + 1)) &
+                                   cv::Rect(0, 0, grayImage.cols, grayImage.rows);
+    const cv::Point2f offset(static_cast<float>(describedArea.x), static_cast<float>(describedArea.y));
+
+    for (cv::KeyPoint& keypoint: keypoints)
+        keypoint.pt -= offset;
+    featureDescriptor->compute(grayImage(describedArea), keypoints, descriptors);
+    for (cv::KeyPoint& keypoint: keypoints)
+        keypoint.pt += offset;
 #endif
-    cv::KeyPointsFilter::removeDuplicated(frameKeypoints);
 }
 
 } // namespace rgbd_slam::features::keypoints
@@ -3,7 +3,11 @@
 
 #include "keypoint_handler.hpp"
 #include "parameters.hpp"
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <memory>
+#include <optional>
 
 namespace rgbd_slam::features::keypoints {
 
@@ -17,6 +21,16 @@ class Key_Point_Extraction
   public:
     Key_Point_Extraction();
 
+    /**
+     * \brief Convert a color image to gray, and build its optical flow pyramid in the same stage: the gray image is
+     * written in the preallocated first level of the pyramid, there is no copy. Does not depend on the depth, so it
+     * can run in parallel with the depth transformations. The next call to compute_keypoints must use the returned
+     * image
+     * \param[in] rgbImage The BGR image of this frame
+     * \return The gray image, a view in the pyramid buffers
+     */
+    [[nodiscard]] cv::Mat prepare_image(const cv::Mat& rgbImage) noexcept;
+
     /**
      * \brief compute the keypoints in the gray image, using optical flow and/or generic feature detectors
      *
@@ -25,13 +39,17 @@ class Key_Point_Extraction
      * \param[in] lastKeypointsWithIds The keypoints of the previous detection step, that will be tracked with optical
      * flow
      * \param[in] forceKeypointDetection Force the detection of keypoints in the image
+     * \param[in] predictionRadius_px The uncertainty of the predicted keypoint positions, in pixels. Only used if
+     * lastKeypointsWithIds has predictions: smaller radiuses track the points on less pyramid levels
      *
      * \return An object that contains the detected keypoints
      */
-    [[nodiscard]] Keypoint_Handler compute_keypoints(const cv::Mat& grayImage,
-                                                     const cv::Mat_<float>& depthImage,
-                                                     const KeypointsWithIdStruct& lastKeypointsWithIds,
-                                                     const bool forceKeypointDetection = false) noexcept;
+    [[nodiscard]] Keypoint_Handler compute_keypoints(
+            const cv::Mat& grayImage,
+            const cv::Mat_<float>& depthImage,
+            const KeypointsWithIdStruct& lastKeypointsWithIds,
+            const bool forceKeypointDetection = false,
+            const double predictionRadius_px = parameters::matching::matchSearchRadius_px) noexcept;
 
     /**
      * \brief Show the time statistics for certain parts of the program. Kind of a basic profiler
@@ -43,6 +61,51 @@ class Key_Point_Extraction
                          const uint frameCount,
                          const bool shouldDisplayDetails = false) const noexcept;
 
+    /**
+     * \brief Adapt the keypoint budget and the refresh frequency to hold the target frame duration.
+     * The budget shrinks when frames are too slow, and grows when frames are fast or when the tracking is weak.
+     * Can be called from another thread than compute_keypoints
+     * \param[in] frameDuration The treatment duration of the last frame, in seconds
+     * \param[in] trackingInlierRatio The proportion of inliers in the matches of the last pose optimization
+     */
+    void update_detection_budget(const double frameDuration, const double trackingInlierRatio) noexcept;
+
+    /**
+     * \brief Cap the adaptive keypoint budget, for the frames that must hold a deadline. Can be called from another
+     * thread than compute_keypoints
+     * \param[in] pointBudgetLimit The maximum keypoint budget, 0 to remove the cap
+     */
+    void set_point_budget_limit(const uint pointBudgetLimit) noexcept { _pointBudgetLimit.store(pointBudgetLimit); }
+
+    /**
+     * \return The maximum number of keypoints to keep in a frame
+     */
+    [[nodiscard]] uint get_point_budget() const noexcept
+    {
+        const uint pointBudgetLimit = _pointBudgetLimit.load();
+        return pointBudgetLimit > 0 ? std::min(_pointBudget.load(), pointBudgetLimit) : _pointBudget.load();
+    }
+
+    /**
+     * \return The number of calls between two forced keypoint detections
+     */
+    [[nodiscard]] uint get_refresh_frequency() const noexcept { return _refreshFrequency.load(); }
+
+    /**
+     * \return The bytes allocated by the double buffered optical flow pyramids. Must be called from the thread that
+     * computes the keypoints
+     */
+    [[nodiscard]] size_t get_pyramid_allocated_bytes() const noexcept;
+
+    /**
+     * \brief Run a synthetic frame through the detection, the description and the optical flow, so the detectors,
+     * the pyramid buffers and the keypoint handler are allocated before the first real frame. The statistics and the
+     * tracking state are reset after, the adaptive thresholds are not modified
+     * \param[in] rgbImage A synthetic textured BGR image, with the size of the real frames
+     * \param[in] depthImage A synthetic depth image, with the size of the real frames
+     */
+    void warm_up(const cv::Mat& rgbImage, const cv::Mat_<float>& depthImage) noexcept;
+
   protected:
     static constexpr uint numberOfDetectionCells = parameters::detection::keypointCellDetectionHeightCount *
                                                    parameters::detection::keypointCellDetectionWidthCount;
@@ -51,16 +114,19 @@ class Key_Point_Extraction
      * \brief Compute the current frame keypoints from optical flow. There is need for matching with this
      * configuration
      *
-     * \param[in] imagePreviousPyramide The pyramid representation of the previous image
-     * \param[in] imageCurrentPyramide The pyramid representation of the current image to analyze
-     * \param[in] lastKeypointsWithIds The keypoints detected in imagePrevious
+     * \param[in] imagePreviousPyramide The pyramid representation of the previous image, or the previous image
+     * \param[in] imageCurrentPyramide The pyramid representation of the current image to analyze, or the current image
+     * \param[in] imageSize The size of the images
+     * \param[in] lastKeypointsWithIds The keypoints detected in imagePrevious. If they have predicted positions, the
+     * forward tracking starts from those, and the backward tracking from the inverse of the predicted motion
      * \param[in] pyramidDepth The chosen depth of the image pyramids
      * \param[in] windowSizeObject The chosen size of the optical flow window
      * \param[in] maxDistanceThreshold a distance threshold, in pixels
      * \param[out] keypointStruct The keypoints tracked by optical flow
      */
-    static void get_keypoints_from_optical_flow(const std::vector<cv::Mat>& imagePreviousPyramide,
-                                                const std::vector<cv::Mat>& imageCurrentPyramide,
+    static void get_keypoints_from_optical_flow(cv::InputArray imagePreviousPyramide,
+                                                cv::InputArray imageCurrentPyramide,
+                                                const cv::Size& imageSize,
                                                 const KeypointsWithIdStruct& lastKeypointsWithIds,
                                                 const uint pyramidDepth,
                                                 const cv::Size& windowSizeObject,
@@ -74,10 +140,11 @@ class Key_Point_Extraction
      * \return An array of points in the input image
      */
     [[nodiscard]] std::vector<cv::Point2f> detect_keypoints(
-            const cv::Mat& grayImage, const std::vector<cv::Point2f>& alreadyDetectedPoints) const noexcept;
+            const cv::Mat& grayImage, const std::vector<cv::Point2f>& alreadyDetectedPoints) noexcept;
 
     /**
      * \brief Perform keypoint detection on the image, divided in smaller patches.
+     * The detector threshold of each patch is adapted to the number of points it found
      * \param[in] grayImage Image in which to detect keypoints
      * \param[in] alreadyDetectedPoints A container for the pointd already detected in this image (wont detect again)
      * \param[out] frameKeypoints The keypoint detected in this process
@@ -85,37 +152,105 @@ class Key_Point_Extraction
      */
     void perform_keypoint_detection(const cv::Mat& grayImage,
                                     const std::vector<cv::Point2f>& alreadyDetectedPoints,
-                                    std::vector<cv::KeyPoint>& frameKeypoints) const noexcept;
+                                    std::vector<cv::KeyPoint>& frameKeypoints) noexcept;
+
+    /**
+     * \brief Set the threshold of the first detector of a detection window
+     * \param[in] cellIndex The index of the detection window
+     * \param[in] threshold The new detector threshold
+     */
+    void set_detector_threshold(const size_t cellIndex, const int threshold) noexcept;
 
     /**
-     * \brief Compute a mask image of size imageSize. A masked area will be put around each points in keypointContainer.
-     * \param[in] imageSize The size of the mask image to output
-     * \param[in] keypointContainer The container of points we need to compute a mask for
-     * \param[in] pointMaskRadius_px radius of the mask for each points
+     * \brief Compute the descriptors of a batch of keypoints. Called by the keypoint handler, when a query needs the
+     * descriptors of the batch. Serial: it runs under the lock of the handler, maybe from a parallel task
+     * \param[in] featureDescriptor The descriptor extractor
+     * \param[in] grayImage Image in which the keypoints were detected
+     * \param[in, out] keypoints The keypoints to describe. The keypoints that cannot be described are removed, the
+     * others keep their order and class id
+     * \param[out] descriptors The descriptors of the keypoints, one row per keypoint
+     */
+    static void describe_keypoints(const cv::Ptr<cv::DescriptorExtractor>& featureDescriptor,
+                                   const cv::Mat& grayImage,
+                                   std::vector<cv::KeyPoint>& keypoints,
+                                   cv::Mat& descriptors) noexcept;
+
+    /**
+     * \brief Index the already detected points in buckets of the mask radius, so the detection can reject the new
+     * keypoints too close to them without a mask image
+     * \param[in] imageSize The size of the detection image
+     * \param[in] keypointContainer The container of points that mask the detection
+     * \param[in] pointMaskRadius_px radius of the masked area around each point (> 0). It is also the bucket size, so
+     * the radius is at least one pixel
      * \param[out] detectionWindowDetectionCount a container that associates the detection window index to the number of
      * points already in keypointContainer
-     * \return A mask for all points
      */
-    [[nodiscard]] cv::Mat_<uchar> compute_key_point_mask(
-            const cv::Size imageSize,
-            const std::vector<cv::Point2f>& keypointContainer,
-            const double pointMaskRadius_px,
-            std::array<uint16_t, numberOfDetectionCells>& detectionWindowDetectionCount) const noexcept;
+    void index_masking_points(const cv::Size imageSize,
+                              const std::vector<cv::Point2f>& keypointContainer,
+                              const double pointMaskRadius_px,
+                              std::array<uint16_t, numberOfDetectionCells>& detectionWindowDetectionCount) noexcept;
+
+    /**
+     * \return true if a point indexed by index_masking_points is closer to this point than the mask radius
+     */
+    [[nodiscard]] bool is_masked(const cv::Point2f& point) const noexcept;
 
   private:
     std::array<cv::Ptr<cv::FeatureDetector>, numberOfDetectionCells> _featureDetectors;
     std::array<cv::Ptr<cv::FeatureDetector>, numberOfDetectionCells> _advancedFeatureDetectors;
     std::array<cv::Rect, numberOfDetectionCells> _detectionWindows;
 
+    // the points that mask the detection, sorted by buckets of the mask radius: the points of the bucket i are
+    // between _maskingBucketOffsets[i] (included) and _maskingBucketOffsets[i + 1] (excluded)
+    float _maskRadius_px = 1.0f;
+    int _maskingBucketColumns = 0;
+    int _maskingBucketRows = 0;
+    std::vector<uint32_t> _maskingBucketOffsets;
+    std::vector<cv::Point2f> _maskingPoints;
+
+    // only used by the on demand descriptor extraction, under the lock of the keypoint handler
     cv::Ptr<cv::DescriptorExtractor> _featureDescriptor;
 
-    std::vector<cv::Mat> _lastFramePyramide;
+    // the keypoints of the last frame, copied to the callers
+    std::optional<Keypoint_Handler> _keypointHandler;
+
+    /**
+     * \brief Statistics of the on demand descriptor extraction: shared with the extractors of the past frames
+     */
+    struct Description_Statistics
+    {
+        std::atomic<uint64_t> _describedKeypointCount = 0;
+        std::atomic<uint64_t> _duration_ticks = 0;
+    };
+    std::shared_ptr<Description_Statistics> _descriptionStatistics = std::make_shared<Description_Statistics>();
+    uint64_t _detectedKeypointCount = 0;
+
+    // adaptive detection budget
+    std::array<int, numberOfDetectionCells> _detectorThresholds;
+    int _minimumDetectorThreshold;
+    int _maximumDetectorThreshold;
+    std::atomic<uint> _pointBudget = Parameters::get_maximum_point_per_frame();
+    std::atomic<uint> _pointBudgetLimit = 0; // cap of the budget set by the load shedding, 0 for none
+    std::atomic<uint> _refreshFrequency = Parameters::get_keypoint_refresh_frequency();
+    double _smoothedFrameDuration = 0.0;
+
+#ifdef USE_OPENCL_ACCELERATION
+    // double buffered device images: the OpenCL optical flow builds its pyramids from them
+    std::array<cv::UMat, 2> _frameImages;
+#else
+    // double buffered optical flow pyramids: current frame and last frame, swapped at each call
+    std::array<std::vector<cv::Mat>, 2> _framePyramides;
+    // the whole buffers of the first pyramid levels, with their borders, written by prepare_image
+    std::array<cv::Mat, 2> _borderedGrayImages;
+    bool _isPyramideBuilt = false; // true if prepare_image built the current pyramid
+#endif
+    size_t _currentPyramideIndex = 0;
+    bool _hasLastFramePyramide = false;
 
     double _meanPointExtractionDuration = 0.0;
 
     double _meanPointOpticalFlowTrackingDuration = 0.0;
     double _meanPointDetectionDuration = 0.0;
-    double _meanPointDescriptorDuration = 0.0;
 };
 
 } // namespace rgbd_slam::features::keypoints
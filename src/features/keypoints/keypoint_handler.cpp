@@ -3,15 +3,26 @@
 #include "../../parameters.hpp"
 #include "../../types.hpp"
 #include "coordinates/point_coordinates.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cstddef>
+#include <cstring>
+#include <limits>
+#include <numeric>
 
 namespace rgbd_slam::features::keypoints {
 
 bool is_in_border(const cv::Point2f& pt, const cv::Mat& im, const double borderSize) noexcept
+{
+    return is_in_border(pt, im.size(), borderSize);
+}
+
+bool is_in_border(const cv::Point2f& pt, const cv::Size& imageSize, const double borderSize) noexcept
 {
     assert(borderSize >= 0);
-    return borderSize <= pt.x and borderSize <= pt.y and pt.x < static_cast<double>(im.cols) - borderSize and
-           pt.y < static_cast<double>(im.rows) - borderSize;
+    return borderSize <= pt.x and borderSize <= pt.y and pt.x < static_cast<double>(imageSize.width) - borderSize and
+           pt.y < static_cast<double>(imageSize.height) - borderSize;
 }
 
 double get_depth(const cv::Mat_<float>& depthImage, const cv::Point2f& depthCoordinates) noexcept
@@ -28,16 +39,14 @@ double get_depth(const cv::Mat_<float>& depthImage, const cv::Point2f& depthCoor
 Keypoint_Handler::Keypoint_Handler(const uint depthImageCols,
                                    const uint depthImageRows,
                                    const double maxMatchDistance) :
-    _maxMatchDistance(maxMatchDistance)
+    _maxMatchDistance(maxMatchDistance),
+    _searchRadius(parameters::matching::matchSearchRadius_px)
 {
     if (_maxMatchDistance <= 0)
     {
         outputs::log_error("Maximum matching distance must be > 0");
         exit(-1);
     }
-    // knn matcher
-    _featuresMatcher = cv::Ptr<cv::BFMatcher>(new cv::BFMatcher(cv::NORM_HAMMING, false));
-
     constexpr double cellSize = parameters::matching::matchSearchRadius_px + 1.0;
     static_assert(cellSize > 0);
 
@@ -45,11 +54,8 @@ Keypoint_Handler::Keypoint_Handler(const uint depthImageCols,
     _cellCountY = static_cast<uint>(std::ceil(depthImageRows / cellSize));
     assert(_cellCountX > 0 and _cellCountY > 0);
 
-    _searchSpaceIndexContainer.resize(static_cast<size_t>(_cellCountY) * _cellCountX);
-    for (index_container& indexContainer: _searchSpaceIndexContainer)
-    {
-        indexContainer.reserve(5);
-    }
+    _searchSpaceCellStart.assign(static_cast<size_t>(_cellCountY) * _cellCountX + 1, 0);
+    _searchSpaceIndexes.reserve(Parameters::get_maximum_point_per_frame());
 }
 
 void Keypoint_Handler::clear() noexcept
@@ -57,30 +63,32 @@ void Keypoint_Handler::clear() noexcept
     _keypoints.clear();
     _uniqueIdsToKeypointIndex.clear();
 
-    for (index_container& indexContainer: _searchSpaceIndexContainer)
-    {
-        indexContainer.clear();
-    }
+    std::ranges::fill(_searchSpaceCellStart, 0);
+    _searchSpaceIndexes.clear();
+    _indexedKeypoints.clear();
 
-    //_descriptors.release();
+    // the copies of this handler keep the descriptors of the last frame
+    _lazyDescriptors = nullptr;
+    _detectedKeypointCount = 0;
 }
 
-void Keypoint_Handler::set(std::vector<cv::Point2f>& inKeypoints,
-                           const cv::Mat& inDescriptors,
+void Keypoint_Handler::set(const std::vector<cv::Point2f>& inKeypoints,
                            const KeypointsWithIdStruct& lastKeypointsWithIds,
-                           const cv::Mat_<float>& depthImage) noexcept
+                           const cv::Mat_<float>& depthImage,
+                           const descriptor_extractor& descriptorExtractor,
+                           const size_t descriptorSize,
+                           const bool shouldDescribeByCell) noexcept
 {
     // clear last state
     clear();
 
-    _descriptors = inDescriptors;
-
     // Fill depth values, add points to image boxes
     const size_t allKeypointSize = inKeypoints.size() + lastKeypointsWithIds.size();
     _keypoints = std::vector<ScreenCoordinate>(allKeypointSize);
 
     // Add detected keypoints first
     const uint keypointIndexOffset = static_cast<uint>(inKeypoints.size());
+    _detectedKeypointCount = keypointIndexOffset;
     for (uint pointIndex = 0; pointIndex < keypointIndexOffset; ++pointIndex)
     {
         const cv::Point2f& pt = inKeypoints[pointIndex];
@@ -89,12 +97,44 @@ void Keypoint_Handler::set(std::vector<cv::Point2f>& inKeypoints,
 
         _keypoints[pointIndex] = vectorKeypoint;
 
+        // count the keypoints of each search space cell
         const uint searchSpaceIndex = get_search_space_index(get_search_space_coordinates(vectorKeypoint.get_2D()));
-        assert(searchSpaceIndex < _searchSpaceIndexContainer.size());
+        assert(searchSpaceIndex + 1 < _searchSpaceCellStart.size());
+        ++_searchSpaceCellStart[searchSpaceIndex + 1];
+    }
+
+    // build the spatial index: prefix sum of the cell counts, then place the keypoints in their cells, in index order
+    std::partial_sum(_searchSpaceCellStart.cbegin(), _searchSpaceCellStart.cend(), _searchSpaceCellStart.begin());
+    _searchSpaceIndexes.resize(keypointIndexOffset);
+    index_container cellInsertPosition(_searchSpaceCellStart.cbegin(), _searchSpaceCellStart.cend() - 1);
+    for (uint pointIndex = 0; pointIndex < keypointIndexOffset; ++pointIndex)
+    {
+        const uint searchSpaceIndex =
+                get_search_space_index(get_search_space_coordinates(_keypoints[pointIndex].get_2D()));
+        _searchSpaceIndexes[cellInsertPosition[searchSpaceIndex]++] = pointIndex;
+    }
 
-        _searchSpaceIndexContainer[searchSpaceIndex].push_back(pointIndex);
+    // copy the positions in the spatial index order: the candidates of a search row are contiguous
+    _indexedKeypoints.resize(keypointIndexOffset);
+    for (uint candidate = 0; candidate < keypointIndexOffset; ++candidate)
+    {
+        _indexedKeypoints[candidate] = _keypoints[_searchSpaceIndexes[candidate]].get_2D();
     }
 
+    // the descriptors are only allocated here, the queries extract them
+    assert(descriptorSize <= maximumDescriptorWordCount * sizeof(uint64_t));
+    _descriptorSize = descriptorSize;
+    _descriptorWordCount = (descriptorSize + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    _lazyDescriptors = std::make_shared<Lazy_Descriptors>();
+    _lazyDescriptors->_extractor = descriptorExtractor;
+    _lazyDescriptors->_shouldDescribeByCell = shouldDescribeByCell;
+    const size_t batchCount = shouldDescribeByCell ? _searchSpaceCellStart.size() - 1 : 1;
+    _lazyDescriptors->_isBatchDescribed = std::make_unique<std::atomic<bool>[]>(batchCount);
+    _lazyDescriptors->_descriptors =
+            cv::Mat::zeros(static_cast<int>(keypointIndexOffset), static_cast<int>(descriptorSize), CV_8U);
+    _lazyDescriptors->_hasDescriptor.assign(keypointIndexOffset, 0);
+    _lazyDescriptors->_indexedDescriptors.assign(keypointIndexOffset * _descriptorWordCount, 0);
+
     // Add optical flow keypoints then
     const size_t opticalPointSize = lastKeypointsWithIds.size();
     for (size_t pointIndex = 0; pointIndex < opticalPointSize; ++pointIndex)
@@ -121,71 +161,146 @@ void Keypoint_Handler::set(std::vector<cv::Point2f>& inKeypoints,
     }
 }
 
-uint Keypoint_Handler::get_search_space_index(const uint_pair& searchSpaceIndex) const noexcept
+int Keypoint_Handler::get_hamming_distance(const uint64_t* descriptorA,
+                                           const uint64_t* descriptorB,
+                                           const size_t wordCount) noexcept
 {
-    return get_search_space_index(searchSpaceIndex.second, searchSpaceIndex.first);
+    // compiles to a POPCNT per word on targets that support it
+    int distance = 0;
+    for (size_t i = 0; i < wordCount; ++i)
+    {
+        distance += std::popcount(descriptorA[i] ^ descriptorB[i]);
+    }
+    return distance;
 }
-uint Keypoint_Handler::get_search_space_index(const uint x, const uint y) const noexcept { return y * _cellCountY + x; }
 
-Keypoint_Handler::uint_pair Keypoint_Handler::get_search_space_coordinates(
-        const ScreenCoordinate2D& pointToPlace) const noexcept
+bool Keypoint_Handler::has_descriptor(const uint index) const noexcept
 {
-    constexpr double cellSize = parameters::matching::matchSearchRadius_px + 1.0;
-    const uint_pair cellCoordinates(std::clamp(floor(pointToPlace.y() / cellSize), 0.0, _cellCountY - 1.0),
-                                    std::clamp(floor(pointToPlace.x() / cellSize), 0.0, _cellCountX - 1.0));
-    return cellCoordinates;
+    if (index >= _detectedKeypointCount)
+        return false;
+
+    const auto [searchSpaceY, searchSpaceX] = get_search_space_coordinates(_keypoints[index].get_2D());
+    describe_cells(searchSpaceY, searchSpaceY + 1, searchSpaceX, searchSpaceX + 1);
+    return _lazyDescriptors->_hasDescriptor[index] != 0;
 }
 
-cv::Mat_<uchar> Keypoint_Handler::compute_key_point_mask(const ScreenCoordinate2D& pointToSearch,
-                                                         const vectorb& isKeyPointMatchedContainer,
-                                                         const uint searchSpaceCellRadius) const noexcept
+void Keypoint_Handler::describe_cells(const uint startY,
+                                      const uint endY,
+                                      const uint startX,
+                                      const uint endX) const noexcept
 {
-    const auto [searchSpaceCoordinatesY, searchSpaceCoordinatesX] = get_search_space_coordinates(pointToSearch);
-    // compute a search zone for the potential matches of this point
-    const uint startY = std::max(0U, searchSpaceCoordinatesY - searchSpaceCellRadius);
-    const uint startX = std::max(0U, searchSpaceCoordinatesX - searchSpaceCellRadius);
+    if (_detectedKeypointCount == 0)
+        return;
+    Lazy_Descriptors& lazyDescriptors = *_lazyDescriptors;
 
-    const uint endY = std::min(_cellCountY, searchSpaceCoordinatesY + searchSpaceCellRadius + 1);
-    const uint endX = std::min(_cellCountX, searchSpaceCoordinatesX + searchSpaceCellRadius + 1);
+    // the batches of these cells, and their range in the spatial index
+    const auto foreach_batch = [&](const auto& function) {
+        if (not lazyDescriptors._shouldDescribeByCell)
+        {
+            function(0u, 0u, _detectedKeypointCount);
+            return;
+        }
+        for (uint i = startY; i < endY; ++i)
+        {
+            for (uint j = startX; j < endX; ++j)
+            {
+                const uint cellIndex = get_search_space_index(j, i);
+                function(cellIndex, _searchSpaceCellStart[cellIndex], _searchSpaceCellStart[cellIndex + 1]);
+            }
+        }
+    };
+
+    // fast path, without lock: the batches are extracted once per frame, and then queried many times
+    bool areBatchesDescribed = true;
+    foreach_batch([&lazyDescriptors, &areBatchesDescribed](const uint batch, const uint, const uint) {
+        areBatchesDescribed = areBatchesDescribed and lazyDescriptors._isBatchDescribed[batch].load();
+    });
+    if (areBatchesDescribed)
+        return;
+
+    std::scoped_lock lock(lazyDescriptors._mutex);
+    std::vector<uint> describedBatches;
+    std::vector<cv::KeyPoint> keypoints;
+    foreach_batch([this, &lazyDescriptors, &describedBatches, &keypoints](
+                          const uint batch, const uint candidatesStart, const uint candidatesEnd) {
+        // extracted by another query since the check
+        if (lazyDescriptors._isBatchDescribed[batch].load())
+            return;
+        describedBatches.push_back(batch);
+        for (uint candidate = candidatesStart; candidate < candidatesEnd; ++candidate)
+        {
+            // the class id identifies the described keypoint, as the extractor can remove some
+            const ScreenCoordinate2D& point = _indexedKeypoints[candidate];
+            keypoints.emplace_back(static_cast<float>(point.x()),
+                                   static_cast<float>(point.y()),
+                                   1.0f,
+                                   -1.0f,
+                                   1.0f,
+                                   0,
+                                   static_cast<int>(candidate));
+        }
+    });
 
-    // set a mask of the size of the keypoints, with everything at zero (nothing can be matched)
-    cv::Mat_<uchar> keyPointMask = cv::Mat_<float>::zeros(1, _descriptors.rows);
-    for (uint i = startY; i < endY; ++i)
+    if (not keypoints.empty())
     {
-        for (uint j = startX; j < endX; ++j)
+        cv::Mat descriptors;
+        lazyDescriptors._extractor(keypoints, descriptors);
+        assert(static_cast<size_t>(descriptors.rows) == keypoints.size());
+        assert(descriptors.empty() or
+               (descriptors.type() == CV_8U and static_cast<size_t>(descriptors.cols) == _descriptorSize));
+        for (size_t i = 0; i < keypoints.size() and i < static_cast<size_t>(descriptors.rows); ++i)
         {
-            const size_t searchSpaceIndex = get_search_space_index(j, i);
-            assert(searchSpaceIndex < _searchSpaceIndexContainer.size());
-
-            // get all keypoints in this area
-            const index_container& keypointIndexContainer = _searchSpaceIndexContainer[searchSpaceIndex];
-            fill_keypoint_mask(pointToSearch, keypointIndexContainer, isKeyPointMatchedContainer, keyPointMask);
+            const uint candidate = static_cast<uint>(keypoints[i].class_id);
+            assert(candidate < _detectedKeypointCount);
+            const uint keypointIndex = _searchSpaceIndexes[candidate];
+            const uchar* descriptor = descriptors.ptr<uchar>(static_cast<int>(i));
+            std::memcpy(lazyDescriptors._descriptors.ptr<uchar>(static_cast<int>(keypointIndex)),
+                        descriptor,
+                        _descriptorSize);
+            std::memcpy(&lazyDescriptors._indexedDescriptors[candidate * _descriptorWordCount],
+                        descriptor,
+                        _descriptorSize);
+            lazyDescriptors._hasDescriptor[keypointIndex] = 1;
         }
     }
+    // publish the descriptors of these batches to the other queries
+    for (const uint batch: describedBatches)
+        lazyDescriptors._isBatchDescribed[batch].store(true);
+}
 
-    return keyPointMask;
+double Keypoint_Handler::get_descriptor_similarity(const uint index, const cv::Mat& mapPointDescriptor) const noexcept
+{
+    if (mapPointDescriptor.empty() or not has_descriptor(index))
+        return 0.0;
+
+    assert(static_cast<size_t>(mapPointDescriptor.cols) == _descriptorSize);
+    assert(mapPointDescriptor.type() == CV_8U);
+    assert(_descriptorWordCount <= maximumDescriptorWordCount);
+    std::array<uint64_t, maximumDescriptorWordCount> mapPointDescriptorWords {};
+    std::array<uint64_t, maximumDescriptorWordCount> keypointDescriptorWords {};
+    std::memcpy(mapPointDescriptorWords.data(), mapPointDescriptor.ptr<uchar>(0), _descriptorSize);
+    std::memcpy(keypointDescriptorWords.data(),
+                _lazyDescriptors->_descriptors.ptr<uchar>(static_cast<int>(index)),
+                _descriptorSize);
+
+    const int distance = get_hamming_distance(
+            mapPointDescriptorWords.data(), keypointDescriptorWords.data(), _descriptorWordCount);
+    return 1.0 - static_cast<double>(distance) / static_cast<double>(_descriptorSize * 8);
 }
 
-void Keypoint_Handler::fill_keypoint_mask(const ScreenCoordinate2D& pointToSearch,
-                                          const index_container& keypointIndexContainer,
-                                          const vectorb& isKeyPointMatchedContainer,
-                                          cv::Mat_<uchar>& keyPointMask) const noexcept
+uint Keypoint_Handler::get_search_space_index(const uint_pair& searchSpaceIndex) const noexcept
 {
-    // Squared search diameter, to compare distance without sqrt
-    constexpr float squaredSearchDiameter = static_cast<float>(SQR(parameters::matching::matchSearchRadius_px));
-    for (const uint keypointIndex: keypointIndexContainer)
-    {
-        // ignore this point if it is already matched (prevent multiple matches of one point)
-        if (not isKeyPointMatchedContainer[keypointIndex])
-        {
-            const ScreenCoordinate2D& keypoint = get_keypoint(keypointIndex).get_2D();
-            const double squarredDistance = (keypoint - pointToSearch).squaredNorm();
+    return get_search_space_index(searchSpaceIndex.second, searchSpaceIndex.first);
+}
+uint Keypoint_Handler::get_search_space_index(const uint x, const uint y) const noexcept { return y * _cellCountX + x; }
 
-            // keypoint is in a circle around the target keypoints, allow a potential match
-            if (squarredDistance <= squaredSearchDiameter)
-                keyPointMask(0, static_cast<int>(keypointIndex)) = 1;
-        }
-    }
+Keypoint_Handler::uint_pair Keypoint_Handler::get_search_space_coordinates(
+        const ScreenCoordinate2D& pointToPlace) const noexcept
+{
+    constexpr double cellSize = parameters::matching::matchSearchRadius_px + 1.0;
+    const uint_pair cellCoordinates(std::clamp(floor(pointToPlace.y() / cellSize), 0.0, _cellCountY - 1.0),
+                                    std::clamp(floor(pointToPlace.x() / cellSize), 0.0, _cellCountX - 1.0));
+    return cellCoordinates;
 }
 
 int Keypoint_Handler::get_tracking_match_index(const size_t mapPointId) const noexcept
@@ -236,13 +351,12 @@ Keypoint_Handler::matchIndexSet Keypoint_Handler::get_match_indexes(const Screen
                                                                     const vectorb& isKeyPointMatchedContainer,
                                                                     const double searchSpaceRadius) const noexcept
 {
-    assert(_featuresMatcher != nullptr);
     Keypoint_Handler::matchIndexSet matchSet;
 
     assert(static_cast<size_t>(isKeyPointMatchedContainer.size()) == _keypoints.size());
 
-    // cannot compute matches without a match or descriptors
-    if (_keypoints.empty() or _descriptors.empty())
+    // cannot compute matches without detected keypoints or descriptors
+    if (_detectedKeypointCount == 0 or _descriptorSize == 0)
         return matchSet;
 
     constexpr double cellSize = parameters::matching::matchSearchRadius_px + 1.0;
@@ -252,31 +366,76 @@ Keypoint_Handler::matchIndexSet Keypoint_Handler::get_match_indexes(const Screen
 
     // check descriptor dimensions
     assert(!mapPointDescriptor.empty());
-    assert(mapPointDescriptor.cols == _descriptors.cols);
+    assert(static_cast<size_t>(mapPointDescriptor.cols) == _descriptorSize);
+    assert(mapPointDescriptor.type() == CV_8U);
+
+    // compute a search zone for the potential matches of this point
+    const auto [searchSpaceCoordinatesY, searchSpaceCoordinatesX] = get_search_space_coordinates(projectedMapPoint);
+    const uint startY = searchSpaceCoordinatesY - std::min(searchSpaceCoordinatesY, searchSpaceCellRadius);
+    const uint startX = searchSpaceCoordinatesX - std::min(searchSpaceCoordinatesX, searchSpaceCellRadius);
+    const uint endY = std::min(_cellCountY, searchSpaceCoordinatesY + searchSpaceCellRadius + 1);
+    const uint endX = std::min(_cellCountX, searchSpaceCoordinatesX + searchSpaceCellRadius + 1);
 
-    const cv::Mat_<uchar>& keyPointMask =
-            compute_key_point_mask(projectedMapPoint, isKeyPointMatchedContainer, searchSpaceCellRadius);
+    // only the keypoints of the search zone need a descriptor
+    describe_cells(startY, endY, startX, endX);
+    const Lazy_Descriptors& lazyDescriptors = *_lazyDescriptors;
 
-    std::vector<std::vector<cv::DMatch>> knnMatches;
-    _featuresMatcher->knnMatch(mapPointDescriptor, _descriptors, knnMatches, 2, keyPointMask);
+    // Squared search radius, to compare distance without sqrt
+    const double squaredSearchRadius = SQR(searchSpaceRadius);
 
-    assert(knnMatches.size() > 0);
+    // pack the map point descriptor in words, like the indexed descriptors
+    assert(_descriptorWordCount <= maximumDescriptorWordCount);
+    std::array<uint64_t, maximumDescriptorWordCount> mapPointDescriptorWords {};
+    std::memcpy(mapPointDescriptorWords.data(), mapPointDescriptor.ptr<uchar>(0), _descriptorSize);
 
-    // check the farthest neighbors
-    const std::vector<cv::DMatch>& firstMatch = knnMatches[0];
-    if (firstMatch.size() > 1)
+    // keep the two best candidates in the search radius (same as a knn match with k = 2)
+    constexpr int noCandidate = std::numeric_limits<int>::max();
+    int bestDistance = noCandidate;
+    int secondBestDistance = noCandidate;
+    int bestIndex = INVALID_MATCH_INDEX;
+    for (uint i = startY; i < endY; ++i)
     {
-        // check if point is a good match by checking it's distance to the second best matched point
-        if (firstMatch[0].distance < _maxMatchDistance * firstMatch[1].distance)
+        const uint searchSpaceRowIndex = get_search_space_index(0, i);
+        // the cells of a row are contiguous in the spatial index: stream the candidates
+        const uint candidatesStart = _searchSpaceCellStart[searchSpaceRowIndex + startX];
+        const uint candidatesEnd = _searchSpaceCellStart[searchSpaceRowIndex + endX];
+        for (uint candidate = candidatesStart; candidate < candidatesEnd; ++candidate)
         {
-            int id = firstMatch[0].trainIdx;
-            matchSet.emplace(id);
+            // keypoint is not in a circle around the target keypoints
+            if ((_indexedKeypoints[candidate] - projectedMapPoint).squaredNorm() > squaredSearchRadius)
+                continue;
+            const uint keypointIndex = _searchSpaceIndexes[candidate];
+            // ignore this point if it is already matched (prevent multiple matches of one point)
+            if (isKeyPointMatchedContainer[keypointIndex])
+                continue;
+            // the extractor could not describe this keypoint
+            if (not lazyDescriptors._hasDescriptor[keypointIndex])
+                continue;
+
+            const uint64_t* candidateDescriptor =
+                    &lazyDescriptors._indexedDescriptors[candidate * _descriptorWordCount];
+            const int distance =
+                    get_hamming_distance(mapPointDescriptorWords.data(), candidateDescriptor, _descriptorWordCount);
+            if (distance < bestDistance)
+            {
+                secondBestDistance = bestDistance;
+                bestDistance = distance;
+                bestIndex = static_cast<int>(keypointIndex);
+            }
+            else if (distance < secondBestDistance)
+            {
+                secondBestDistance = distance;
+            }
         }
     }
-    else if (firstMatch.size() == 1)
+
+    if (bestIndex == INVALID_MATCH_INDEX)
+        return matchSet;
+
+    // check if point is a good match by checking it's distance to the second best matched point
+    if (secondBestDistance == noCandidate or bestDistance < _maxMatchDistance * secondBestDistance)
     {
-        int id = firstMatch[0].trainIdx;
-        matchSet.emplace(id);
+        matchSet.emplace(bestIndex);
     }
     return matchSet;
 }
@@ -2,9 +2,13 @@
 #define RGBDSLAM_FEATURES_KEYPOINTS_KEYPOINTS_HANDLER_HPP
 
 #include "coordinates/point_coordinates.hpp"
+#include "utils/index_set.hpp"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <opencv2/core/types.hpp>
 #include <opencv2/xfeatures2d.hpp>
-#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -24,6 +28,7 @@ struct DetectedKeyPoint
  * \brief checks if a point is in an image, a with border
  */
 [[nodiscard]] bool is_in_border(const cv::Point2f& pt, const cv::Mat& im, const double borderSize = 0) noexcept;
+[[nodiscard]] bool is_in_border(const cv::Point2f& pt, const cv::Size& imageSize, const double borderSize = 0) noexcept;
 
 /**
  * \brief Return the depth value in the depth image, or 0 if not depth info is found.
@@ -49,6 +54,7 @@ struct KeypointsWithIdStruct
     {
         _keypoints.clear();
         _ids.clear();
+        _predictedKeypoints.clear();
     }
 
     void reserve(const size_t numberOfNewKeypoints) noexcept
@@ -81,12 +87,41 @@ struct KeypointsWithIdStruct
         _ids.emplace_back(id);
     }
 
+    /**
+     * \brief Set the position of the last added keypoint in the next frame, predicted from the motion of the camera.
+     * The keypoints added without a prediction are predicted at their position
+     */
+    void set_last_predicted_keypoint(const cv::Point2f predictedPoint) noexcept
+    {
+        assert(not _keypoints.empty());
+        _predictedKeypoints.insert(_predictedKeypoints.end(),
+                                   _keypoints.begin() + static_cast<std::ptrdiff_t>(_predictedKeypoints.size()),
+                                   _keypoints.end() - 1);
+        _predictedKeypoints.push_back(predictedPoint);
+    }
+
+    [[nodiscard]] bool has_predicted_keypoints() const noexcept { return not _predictedKeypoints.empty(); }
+
+    /**
+     * \brief Return the predicted position of all keypoints, in the keypoint order
+     */
+    [[nodiscard]] std::vector<cv::Point2f> get_predicted_keypoints() const noexcept
+    {
+        std::vector<cv::Point2f> predictedKeypoints(_predictedKeypoints);
+        predictedKeypoints.insert(predictedKeypoints.end(),
+                                  _keypoints.begin() + static_cast<std::ptrdiff_t>(_predictedKeypoints.size()),
+                                  _keypoints.end());
+        return predictedKeypoints;
+    }
+
     const std::vector<cv::Point2f>& get_keypoints() const noexcept { return _keypoints; }
     const std::vector<size_t>& get_ids() const noexcept { return _ids; }
 
   private:
     std::vector<cv::Point2f> _keypoints;
     std::vector<size_t> _ids;
+    // only filled up to the last keypoint with a prediction
+    std::vector<cv::Point2f> _predictedKeypoints;
 };
 
 /**
@@ -97,7 +132,13 @@ class Keypoint_Handler
 {
   public:
     // type for matched index
-    typedef std::unordered_set<size_t> matchIndexSet;
+    typedef utils::Index_Set matchIndexSet;
+
+    /**
+     * \brief Describes a batch of keypoints in place: the keypoints that cannot be described are removed, the others
+     * keep their class_id. The descriptors have one row per remaining keypoint
+     */
+    using descriptor_extractor = std::function<void(std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors)>;
 
     /**
      * \param[in] depthImageCols The number of columns of the depth image
@@ -107,16 +148,22 @@ class Keypoint_Handler
     Keypoint_Handler(const uint depthImageCols, const uint depthImageRows, const double maxMatchDistance = 0.7);
 
     /**
-     * \brief Set the container properties
+     * \brief Set the container properties. The descriptors of the new keypoints are not computed here: they are
+     * extracted the first time a query needs them, with the other new keypoints of their search space cell
      * \param[in] inKeypoints New keypoints detected, no tracking informations
-     * \param[in] inDescriptors Descriptors of the new keypoints
      * \param[in] lastKeypointsWithIds Keypoints tracked with optical flow, and their matching ids
      * \param[in] depthImage The depth image in which those keypoints were detected
+     * \param[in] descriptorExtractor Describes the new keypoints. Called by the queries, from any thread (one call at a
+     * time), as long as a copy of this handler needs descriptors
+     * \param[in] descriptorSize The size of a descriptor, in bytes
+     * \param[in] shouldDescribeByCell If false, the first query describes all the new keypoints in a single batch
      */
-    void set(std::vector<cv::Point2f>& inKeypoints,
-             const cv::Mat& inDescriptors,
+    void set(const std::vector<cv::Point2f>& inKeypoints,
              const KeypointsWithIdStruct& lastKeypointsWithIds,
-             const cv::Mat_<float>& depthImage) noexcept;
+             const cv::Mat_<float>& depthImage,
+             const descriptor_extractor& descriptorExtractor,
+             const size_t descriptorSize,
+             const bool shouldDescribeByCell = true) noexcept;
 
     /**
      * \brief Get a tracking index if it exist, or -1.
@@ -129,7 +176,8 @@ class Keypoint_Handler
     [[nodiscard]] int get_tracking_match_index(const size_t mapPointId) const noexcept;
 
     /**
-     * \brief get an index corresponding to the index of the point matches.
+     * \brief get an index corresponding to the index of the point matches. Only the keypoints in the search radius
+     * are compared to the map point descriptor
      * \param[in] projectedMapPoint A 2D map point to match
      * \param[in] mapPointDescriptor The descriptor of this map point
      * \param[in] isKeyPointMatchedContainer A vector of size _keypoints, use to flag is a keypoint is already matched
@@ -141,6 +189,14 @@ class Keypoint_Handler
                                                   const vectorb& isKeyPointMatchedContainer,
                                                   const double searchSpaceRadius) const noexcept;
 
+    /**
+     * \brief Compare the descriptor of a keypoint to a map point descriptor
+     * \param[in] index The index of the keypoint
+     * \param[in] mapPointDescriptor The descriptor of a map point
+     * \return The fraction of identical bits of the two descriptors, 0 if the keypoint has no descriptor
+     */
+    [[nodiscard]] double get_descriptor_similarity(const uint index, const cv::Mat& mapPointDescriptor) const noexcept;
+
     /**
      * \brief return the keypoint associated with the index
      */
@@ -150,20 +206,37 @@ class Keypoint_Handler
         return _keypoints[index];
     }
 
-    [[nodiscard]] bool is_descriptor_computed(const uint index) const noexcept
-    {
-        return index < static_cast<uint>(_descriptors.rows);
-    }
+    /**
+     * \brief Check if a keypoint has a descriptor. Extracts it, with the other keypoints of its batch, on the first
+     * request. The keypoints tracked by optical flow have no descriptor
+     * \param[in] index The index of the keypoint
+     */
+    [[nodiscard]] bool has_descriptor(const uint index) const noexcept;
 
+    /**
+     * \return The descriptor of a keypoint, only valid if has_descriptor returned true for it
+     */
     [[nodiscard]] cv::Mat get_descriptor(const uint index) const noexcept
     {
-        assert(index < static_cast<uint>(_descriptors.rows));
+        assert(index < _detectedKeypointCount);
+        assert(_lazyDescriptors->_hasDescriptor[index]);
 
-        return _descriptors.row(static_cast<int>(index));
+        return _lazyDescriptors->_descriptors.row(static_cast<int>(index));
     }
 
     [[nodiscard]] size_t get_keypoint_count() const noexcept { return _keypoints.size(); }
 
+    /**
+     * \brief Set the radius of the search space of the point matches, from the uncertainty of the predicted pose
+     * \param[in] searchRadius The radius, in pixels, <= parameters::matching::matchSearchRadius_px
+     */
+    void set_search_radius(const double searchRadius) noexcept
+    {
+        assert(searchRadius > 0);
+        _searchRadius = searchRadius;
+    }
+    [[nodiscard]] double get_search_radius() const noexcept { return _searchRadius; }
+
     [[nodiscard]] size_t size() const noexcept { return _keypoints.size(); };
 
     [[nodiscard]] DetectedKeyPoint at(const size_t index) const noexcept
@@ -171,7 +244,7 @@ class Keypoint_Handler
         const uint i = static_cast<uint>(index);
         DetectedKeyPoint newKp;
         newKp._coordinates = get_keypoint(i);
-        if (is_descriptor_computed(i))
+        if (has_descriptor(i))
             newKp._descriptor = get_descriptor(i);
         else
             newKp._descriptor = cv::Mat();
@@ -179,31 +252,7 @@ class Keypoint_Handler
     }
 
   protected:
-    /**
-     * \brief Return a mask eliminating the keypoints to far from the point to match
-     *
-     * \param[in] pointToSearch The 2D screen coordinates of the point to match
-     * \param[in] isKeyPointMatchedContainer A vector of size _keypoints, use to flag is a keypoint is already matched
-     * \param[in] searchSpaceCellRadius Radius of the match search
-     *
-     * \return A Mat the same size as our keypoint array, with 0 where the index is not a candidate, and 1 where it is
-     */
-    [[nodiscard]] cv::Mat_<uchar> compute_key_point_mask(const ScreenCoordinate2D& pointToSearch,
-                                                         const vectorb& isKeyPointMatchedContainer,
-                                                         const uint searchSpaceCellRadius) const noexcept;
-
     using index_container = std::vector<uint>;
-    /**
-     * \brief Fill the keypoint mask with the an area around the given keypoints
-     * \param[in] pointToSearch The cooridnates of the point we want to match
-     * \param[in] keypointIndexContainer A container with all the keypoints to draw an area around
-     * \param[in] isKeyPointMatchedContainer If a keypoint is already matched, it's index will be true
-     * \param[in, out] keyPointMask The match mask for each keypoints
-     */
-    void fill_keypoint_mask(const ScreenCoordinate2D& pointToSearch,
-                            const index_container& keypointIndexContainer,
-                            const vectorb& isKeyPointMatchedContainer,
-                            cv::Mat_<uchar>& keyPointMask) const noexcept;
 
     using uint_pair = std::pair<uint, uint>;
     /**
@@ -220,25 +269,67 @@ class Keypoint_Handler
     [[nodiscard]] uint get_search_space_index(const uint_pair& searchSpaceIndex) const noexcept;
     [[nodiscard]] uint get_search_space_index(const uint x, const uint y) const noexcept;
 
+    /**
+     * \brief Compute the Hamming distance of two binary descriptors, packed in 64 bits words
+     * \param[in] descriptorA The first descriptor
+     * \param[in] descriptorB The second descriptor
+     * \param[in] wordCount The number of words of the descriptors
+     * \return The number of different bits
+     */
+    [[nodiscard]] static int get_hamming_distance(const uint64_t* descriptorA,
+                                                  const uint64_t* descriptorB,
+                                                  const size_t wordCount) noexcept;
+
     void clear() noexcept;
 
+    /**
+     * \brief Extract the descriptors of the new keypoints in the search space cells [startX, endX[ of the rows
+     * [startY, endY[, if they were not extracted yet
+     */
+    void describe_cells(const uint startY, const uint endY, const uint startX, const uint endX) const noexcept;
+
+    // 512 bits descriptors at most (32 bytes for BRIEF and ORB)
+    static constexpr size_t maximumDescriptorWordCount = 8;
+
   private:
-    cv::Ptr<cv::DescriptorMatcher> _featuresMatcher;
+    /**
+     * \brief The descriptors of the new keypoints of a frame, extracted on demand. Shared by the copies of a handler,
+     * and replaced at each set
+     */
+    struct Lazy_Descriptors
+    {
+        descriptor_extractor _extractor;
+        bool _shouldDescribeByCell = true;
+        std::mutex _mutex; // one extraction at a time
+        // extraction flag of each batch: a search space cell, or all the new keypoints
+        std::unique_ptr<std::atomic<bool>[]> _isBatchDescribed;
+        cv::Mat _descriptors;                      // one row per new keypoint, valid if _hasDescriptor is set
+        std::vector<uint8_t> _hasDescriptor;       // per new keypoint
+        std::vector<uint64_t> _indexedDescriptors; // packed descriptors, in the _searchSpaceIndexes order
+    };
 
     const double _maxMatchDistance;
+    double _searchRadius; // radius of the search space of the point matches, in pixels
 
     // store current frame keypoints
     std::vector<ScreenCoordinate> _keypoints;
     using uintToUintContainer = std::unordered_map<size_t, size_t>;
     uintToUintContainer _uniqueIdsToKeypointIndex;
-    cv::Mat _descriptors;
+    std::shared_ptr<Lazy_Descriptors> _lazyDescriptors = nullptr;
+    uint _detectedKeypointCount = 0; // the new keypoints come first in _keypoints, before the tracked ones
+    size_t _descriptorSize = 0;      // in bytes
 
     // Number of image divisions (cells)
     uint _cellCountX;
     uint _cellCountY;
 
-    // Corresponds to a 2D box containing index of key points in those boxes
-    std::vector<index_container> _searchSpaceIndexContainer;
+    // Spatial index of the detected keypoints: the indexes of the keypoints in the search space cell i are
+    // _searchSpaceIndexes[_searchSpaceCellStart[i], _searchSpaceCellStart[i + 1])
+    index_container _searchSpaceCellStart;
+    index_container _searchSpaceIndexes;
+    // positions of the detected keypoints, in the _searchSpaceIndexes order
+    std::vector<ScreenCoordinate2D> _indexedKeypoints;
+    size_t _descriptorWordCount = 0;
 };
 
 } // namespace rgbd_slam::features::keypoints
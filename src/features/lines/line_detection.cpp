@@ -1,5 +1,10 @@
 #include "line_detection.hpp"
 #include "../../outputs/logger.hpp"
+#include "../../parameters.hpp"
+#include "coordinates/point_coordinates.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <memory>
 
 namespace rgbd_slam::features::lines {
@@ -31,6 +36,230 @@ line_container Line_Detection::detect_lines(const cv::Mat& grayImage, const cv::
     return rawLines;
 }
 
+line_container Line_Detection::detect_lines(const cv::Mat& grayImage,
+                                            const cv::Mat_<float>& depthImage,
+                                            const primitives::plane_container& detectedPlanes) noexcept
+{
+    static constexpr int cellCountY = static_cast<int>(parameters::detection::lineCellDetectionHeightCount);
+    static constexpr int cellCountX = static_cast<int>(parameters::detection::lineCellDetectionWidthCount);
+    // keep some pixels around a searched area, for the gradient computation at its borders
+    static constexpr int searchMargin_px = 2;
+
+    assert(_lineDetector != nullptr);
+    if (detectedPlanes.empty())
+        return detect_lines(grayImage, depthImage);
+
+    // union of the plane cells (reuses the buffer of the last frame)
+    _planeCoverage = detectedPlanes.front().get_cell_mask();
+    for (size_t planeIndex = 1; planeIndex < detectedPlanes.size(); ++planeIndex)
+    {
+        _planeCoverage |= detectedPlanes[planeIndex].get_cell_mask();
+    }
+    const int planeCellSide_px = grayImage.cols / static_cast<int>(_planeCoverage.get_width());
+    assert(planeCellSide_px > 0);
+
+    const int cellHeight = grayImage.rows / cellCountY;
+    const int cellWidth = grayImage.cols / cellCountX;
+    const double maximumCoveredPixels =
+            parameters::detection::maximumPlaneCoverageForLineDetection * cellHeight * cellWidth;
+    const cv::Rect imageBounds(0, 0, grayImage.cols, grayImage.rows);
+
+    // pixels of an area covered by the plane cells. Along each axis, the cells of the area are split in the first, the
+    // middle and the last cells: all the cells of a block (pair of ranges) cover the same pixel count of the area, so
+    // the set cells of a block are counted at once
+    struct Cell_Range
+    {
+        int _firstCell;
+        int _cellCount;
+        int _coveredPixels; // pixels of each cell of the range that are in the area
+    };
+    const auto get_cell_ranges = [planeCellSide_px](const int start, const int end) {
+        const int firstCell = start / planeCellSide_px;
+        const int lastCell = (end - 1) / planeCellSide_px;
+        if (firstCell == lastCell)
+            return std::array<Cell_Range, 3> {{{firstCell, 1, end - start}, {0, 0, 0}, {0, 0, 0}}};
+        return std::array<Cell_Range, 3> {{{firstCell, 1, (firstCell + 1) * planeCellSide_px - start},
+                                           {firstCell + 1, lastCell - firstCell - 1, planeCellSide_px},
+                                           {lastCell, 1, end - lastCell * planeCellSide_px}}};
+    };
+    const auto get_covered_pixels = [this, &get_cell_ranges](const cv::Rect& area) {
+        int coveredPixels = 0;
+        for (const Cell_Range& rowRange: get_cell_ranges(area.y, area.y + area.height))
+        {
+            for (const Cell_Range& columnRange: get_cell_ranges(area.x, area.x + area.width))
+            {
+                // the cells outside of the mask are not counted
+                const cv::Rect cells(
+                        columnRange._firstCell, rowRange._firstCell, columnRange._cellCount, rowRange._cellCount);
+                coveredPixels += static_cast<int>(_planeCoverage.count(cells)) * columnRange._coveredPixels *
+                                 rowRange._coveredPixels;
+            }
+        }
+        return coveredPixels;
+    };
+
+    line_container lines;
+    line_container areaLines;
+    for (int cellY = 0; cellY < cellCountY; ++cellY)
+    {
+        // the last row and column take the remaining pixels
+        const int startY = cellY * cellHeight;
+        const int endY = (cellY == cellCountY - 1) ? grayImage.rows : startY + cellHeight;
+
+        // search the consecutive uncovered cells of this row at once, so lines are not cut at each cell border
+        int cellX = 0;
+        while (cellX < cellCountX)
+        {
+            const auto is_covered = [&](const int x) {
+                const cv::Rect cell(x * cellWidth, startY, cellWidth, endY - startY);
+                return get_covered_pixels(cell) > maximumCoveredPixels;
+            };
+            if (is_covered(cellX))
+            {
+                ++cellX;
+                continue;
+            }
+
+            const int runStartX = cellX;
+            while (cellX < cellCountX and not is_covered(cellX))
+                ++cellX;
+            const int startX = runStartX * cellWidth;
+            const int endX = (cellX == cellCountX) ? grayImage.cols : cellX * cellWidth;
+
+            const cv::Rect searchedArea = cv::Rect(startX - searchMargin_px,
+                                                   startY - searchMargin_px,
+                                                   endX - startX + 2 * searchMargin_px,
+                                                   endY - startY + 2 * searchMargin_px) &
+                                          imageBounds;
+            areaLines.clear();
+            _lineDetector->detect(grayImage(searchedArea), areaLines);
+
+            const cv::Vec4f offset(static_cast<float>(searchedArea.x),
+                                   static_cast<float>(searchedArea.y),
+                                   static_cast<float>(searchedArea.x),
+                                   static_cast<float>(searchedArea.y));
+            for (const cv::Vec4f& line: areaLines)
+            {
+                lines.emplace_back(line + offset);
+            }
+        }
+    }
+    return lines;
+}
+
+segment_container Line_Detection::lift_lines(const line_container& lines, const cv::Mat_<float>& depthImage) noexcept
+{
+    static constexpr double sampleStep = parameters::detection::lineDepthSampleStep_px;
+    static constexpr double minimumDepthProportion = parameters::detection::minimumLineDepthProportion;
+    static constexpr double maximumRelativeError = parameters::detection::maximumLineDepthRelativeError;
+    static constexpr uint refitCount = 2;
+
+    segment_container segments;
+    if (lines.empty())
+        return segments;
+
+    // list the sample positions of all the lines first, to gather all the depths in one pass
+    _samplePositions.clear();
+    _sampleParameters.clear();
+    _lineSampleStart.clear();
+    _lineSampleStart.reserve(lines.size() + 1);
+    const cv::Rect imageBounds(0, 0, depthImage.cols, depthImage.rows);
+    for (const cv::Vec4f& line: lines)
+    {
+        _lineSampleStart.push_back(_samplePositions.size());
+        const double length = std::hypot(line[2] - line[0], line[3] - line[1]);
+        const size_t sampleCount = std::max<size_t>(2, static_cast<size_t>(length / sampleStep) + 1);
+        for (size_t i = 0; i < sampleCount; ++i)
+        {
+            const float t = static_cast<float>(i) / static_cast<float>(sampleCount - 1);
+            const cv::Point position(static_cast<int>(std::round(line[0] + t * (line[2] - line[0]))),
+                                     static_cast<int>(std::round(line[1] + t * (line[3] - line[1]))));
+            if (not imageBounds.contains(position))
+                continue;
+            _samplePositions.push_back(position);
+            _sampleParameters.push_back(t);
+        }
+    }
+    _lineSampleStart.push_back(_samplePositions.size());
+
+    // gather the depths
+    const size_t totalSampleCount = _samplePositions.size();
+    _sampleDepths.resize(totalSampleCount);
+    for (size_t i = 0; i < totalSampleCount; ++i)
+    {
+        const cv::Point& position = _samplePositions[i];
+        _sampleDepths[i] = depthImage.ptr<float>(position.y)[position.x];
+    }
+
+    // fit the inverse depth of each line: 1/z = a + b * t
+    segments.reserve(lines.size());
+    for (size_t lineIndex = 0; lineIndex < lines.size(); ++lineIndex)
+    {
+        const size_t firstSample = _lineSampleStart[lineIndex];
+        const size_t endSample = _lineSampleStart[lineIndex + 1];
+        const size_t sampleCount = endSample - firstSample;
+        if (sampleCount < 2)
+            continue;
+
+        const auto is_depth_valid = [this](const size_t i) {
+            return _sampleDepths[i] > 0 and std::isfinite(_sampleDepths[i]);
+        };
+        const size_t minimumInlierCount = std::max<size_t>(
+                2, static_cast<size_t>(std::ceil(minimumDepthProportion * static_cast<double>(sampleCount))));
+
+        // least squares on the valid samples, then again on the inliers of the previous fit
+        double a = 0.0;
+        double b = 0.0;
+        bool isFitted = false;
+        for (uint iteration = 0; iteration <= refitCount; ++iteration)
+        {
+            double sumT = 0.0;
+            double sumTT = 0.0;
+            double sumW = 0.0;
+            double sumTW = 0.0;
+            size_t inlierCount = 0;
+            for (size_t i = firstSample; i < endSample; ++i)
+            {
+                if (not is_depth_valid(i))
+                    continue;
+                const double inverseDepth = 1.0 / _sampleDepths[i];
+                // relative depth error = inverse depth error * depth
+                if (isFitted and std::abs((a + b * _sampleParameters[i]) - inverseDepth) * _sampleDepths[i] >
+                                         maximumRelativeError)
+                    continue;
+
+                const double t = _sampleParameters[i];
+                sumT += t;
+                sumTT += t * t;
+                sumW += inverseDepth;
+                sumTW += t * inverseDepth;
+                ++inlierCount;
+            }
+
+            const double n = static_cast<double>(inlierCount);
+            const double determinant = n * sumTT - sumT * sumT;
+            if (inlierCount < minimumInlierCount or determinant <= 0)
+            {
+                isFitted = false;
+                break;
+            }
+            b = (n * sumTW - sumT * sumW) / determinant;
+            a = (sumW - b * sumT) / n;
+            isFitted = true;
+        }
+
+        // both ends must be in front of the camera
+        if (not isFitted or a <= 0 or a + b <= 0)
+            continue;
+
+        const cv::Vec4f& line = lines[lineIndex];
+        const ScreenCoordinate start(line[0], line[1], 1.0 / a);
+        const ScreenCoordinate end(line[2], line[3], 1.0 / (a + b));
+        segments.emplace_back(start.to_camera_coordinates(), end.to_camera_coordinates());
+    }
+    return segments;
+}
+
 void Line_Detection::get_image_with_lines(const line_container& linesToDisplay,
                                           const cv::Mat_<float>& depthImage,
                                           cv::Mat& outImage) const noexcept
@@ -41,7 +270,8 @@ void Line_Detection::get_image_with_lines(const line_container& linesToDisplay,
         return;
     }
     // binarize depth map, fill holes
-    const cv::Mat_<uchar> mask = depthImage > 0;
+    cv::Mat_<uchar>& mask = _depthMask;
+    cv::compare(depthImage, 0, mask, cv::CMP_GT);
     cv::morphologyEx(mask, mask, cv::MORPH_CLOSE, _kernel);
 
     for (const cv::Vec4f& pts: linesToDisplay)
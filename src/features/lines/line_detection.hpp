@@ -2,12 +2,16 @@
 #define RGBDSLAM_FEATURES_LINES_LINE_DETECTION_HPP
 
 #include "../../../third_party/line_segment_detector.hpp"
+#include "../primitives/shape_primitives.hpp"
+#include "utils/line.hpp"
 #include <memory>
 #include <opencv2/opencv.hpp>
 
 namespace rgbd_slam::features::lines {
 
 using line_container = std::vector<cv::Vec4f>;
+// 3D segments, in camera space
+using segment_container = std::vector<utils::Segment<3>>;
 
 /**
  * \brief A class to detect and store lines
@@ -27,6 +31,33 @@ class Line_Detection
      */
     [[nodiscard]] line_container detect_lines(const cv::Mat& grayImage, const cv::Mat_<float>& depthImage) noexcept;
 
+    /**
+     * \brief Search for lines in the parts of a gray image that are not covered by planes.
+     * The image is divided in detection windows, and the windows mostly covered by planes are not searched
+     *
+     * \param[in] grayImage The image in which to detect the lines
+     * \param[in] depthImage The depth dimention of the image
+     * \param[in] detectedPlanes The planes detected in this image
+     *
+     * \return A container with the detected lines (2D start and end point)
+     */
+    [[nodiscard]] line_container detect_lines(const cv::Mat& grayImage,
+                                              const cv::Mat_<float>& depthImage,
+                                              const primitives::plane_container& detectedPlanes) noexcept;
+
+    /**
+     * \brief Lift detected lines to 3D segments in camera space.
+     * The depth is sampled along each line, and the inverse depth (linear along the image of a 3D line) is robustly
+     * fitted on the samples. Lines without enough coherent depth samples are not lifted
+     *
+     * \param[in] lines The detected lines
+     * \param[in] depthImage The depth image in which the lines were detected
+     *
+     * \return A container with the lifted segments
+     */
+    [[nodiscard]] segment_container lift_lines(const line_container& lines,
+                                               const cv::Mat_<float>& depthImage) noexcept;
+
     /**
      * \brief display the given lines on an image
      *
@@ -49,6 +80,15 @@ class Line_Detection
     // kernel for morphological operations
     cv::Mat_<uchar> _kernel;
 
+    // reused buffers: depth map patches covered by the planes, and depth availability for display
+    primitives::Cell_Mask _planeCoverage;
+    mutable cv::Mat_<uchar> _depthMask;
+    // depth samples of all the lines of a frame, in line order
+    std::vector<cv::Point> _samplePositions;
+    std::vector<float> _sampleParameters;
+    std::vector<float> _sampleDepths;
+    std::vector<size_t> _lineSampleStart;
+
     // remove copy constructors as we have dynamically instantiated members
     Line_Detection(const Line_Detection& lineDetector) = delete;
     Line_Detection& operator=(const Line_Detection& lineDetector) = delete;
@@ -0,0 +1,183 @@
+#include "cell_mask.hpp"
+#include <algorithm>
+
+namespace rgbd_slam::features::primitives {
+
+Cell_Mask::Cell_Mask(const uint width, const uint height) :
+    _width(width),
+    _height(height),
+    _wordsPerRow((width + wordBits - 1) / wordBits),
+    _lastWordMask((width % wordBits == 0) ? ~uint64_t(0) : (uint64_t(1) << (width % wordBits)) - 1),
+    _words(static_cast<size_t>(_wordsPerRow) * height, 0)
+{
+}
+
+void Cell_Mask::clear() noexcept { std::ranges::fill(_words, 0); }
+
+uint Cell_Mask::count() const noexcept
+{
+    uint setCellCount = 0;
+    for (const uint64_t word: _words)
+        setCellCount += static_cast<uint>(std::popcount(word));
+    return setCellCount;
+}
+
+uint Cell_Mask::count(const cv::Rect& cells) const noexcept
+{
+    const uint startX = static_cast<uint>(std::max(cells.x, 0));
+    const uint startY = static_cast<uint>(std::max(cells.y, 0));
+    const uint endX = static_cast<uint>(std::clamp(cells.x + cells.width, 0, static_cast<int>(_width)));
+    const uint endY = static_cast<uint>(std::clamp(cells.y + cells.height, 0, static_cast<int>(_height)));
+    if (startX >= endX or startY >= endY)
+        return 0;
+
+    uint setCellCount = 0;
+    for (uint y = startY; y < endY; ++y)
+    {
+        const uint64_t* row = &_words[y * _wordsPerRow];
+        for (uint w = startX / wordBits; w <= (endX - 1) / wordBits; ++w)
+        {
+            // the cells of this word in [startX, endX[
+            const uint firstBit = (w == startX / wordBits) ? startX % wordBits : 0;
+            const uint endBit = (w == (endX - 1) / wordBits) ? (endX - 1) % wordBits + 1 : wordBits;
+            const uint64_t bitRange = (endBit == wordBits ? ~uint64_t(0) : (uint64_t(1) << endBit) - 1) &
+                                      ~((uint64_t(1) << firstBit) - 1);
+            setCellCount += static_cast<uint>(std::popcount(row[w] & bitRange));
+        }
+    }
+    return setCellCount;
+}
+
+bool Cell_Mask::empty() const noexcept
+{
+    return std::ranges::all_of(_words, [](const uint64_t word) {
+        return word == 0;
+    });
+}
+
+bool Cell_Mask::is_full() const noexcept { return count() == _width * _height; }
+
+Cell_Mask& Cell_Mask::operator|=(const Cell_Mask& other) noexcept
+{
+    assert(other._width == _width and other._height == _height);
+    for (size_t i = 0; i < _words.size(); ++i)
+        _words[i] |= other._words[i];
+    return *this;
+}
+
+Cell_Mask& Cell_Mask::operator&=(const Cell_Mask& other) noexcept
+{
+    assert(other._width == _width and other._height == _height);
+    for (size_t i = 0; i < _words.size(); ++i)
+        _words[i] &= other._words[i];
+    return *this;
+}
+
+Cell_Mask& Cell_Mask::operator-=(const Cell_Mask& other) noexcept
+{
+    assert(other._width == _width and other._height == _height);
+    for (size_t i = 0; i < _words.size(); ++i)
+        _words[i] &= ~other._words[i];
+    return *this;
+}
+
+void Cell_Mask::erode_cross(Cell_Mask& eroded, const bool isOutsideSet) const noexcept
+{
+    assert(&eroded != this);
+    match_size(eroded);
+    const uint64_t outsideRow = isOutsideSet ? ~uint64_t(0) : 0;
+    for (uint y = 0; y < _height; ++y)
+    {
+        const uint64_t* row = &_words[y * _wordsPerRow];
+        const uint64_t* upRow = (y > 0) ? row - _wordsPerRow : nullptr;
+        const uint64_t* downRow = (y + 1 < _height) ? row + _wordsPerRow : nullptr;
+        uint64_t* erodedRow = &eroded._words[y * _wordsPerRow];
+        for (uint w = 0; w < _wordsPerRow; ++w)
+        {
+            erodedRow[w] = row[w] & get_left_neighbours(row, w, isOutsideSet) &
+                           get_right_neighbours(row, w, isOutsideSet) & (upRow != nullptr ? upRow[w] : outsideRow) &
+                           (downRow != nullptr ? downRow[w] : outsideRow);
+        }
+    }
+}
+
+void Cell_Mask::dilate_cross(Cell_Mask& dilated) const noexcept
+{
+    assert(&dilated != this);
+    match_size(dilated);
+    for (uint y = 0; y < _height; ++y)
+    {
+        const uint64_t* row = &_words[y * _wordsPerRow];
+        const uint64_t* upRow = (y > 0) ? row - _wordsPerRow : nullptr;
+        const uint64_t* downRow = (y + 1 < _height) ? row + _wordsPerRow : nullptr;
+        uint64_t* dilatedRow = &dilated._words[y * _wordsPerRow];
+        for (uint w = 0; w < _wordsPerRow; ++w)
+        {
+            uint64_t word = row[w] | get_left_neighbours(row, w, false) | get_right_neighbours(row, w, false);
+            if (upRow != nullptr)
+                word |= upRow[w];
+            if (downRow != nullptr)
+                word |= downRow[w];
+            dilatedRow[w] = word;
+        }
+    }
+}
+
+void Cell_Mask::dilate_square(Cell_Mask& dilated) const noexcept
+{
+    assert(&dilated != this);
+    match_size(dilated);
+    // separable: dilate the rows in the output, then its columns in place, keeping the previous row aside
+    for (uint y = 0; y < _height; ++y)
+    {
+        const uint64_t* row = &_words[y * _wordsPerRow];
+        uint64_t* dilatedRow = &dilated._words[y * _wordsPerRow];
+        for (uint w = 0; w < _wordsPerRow; ++w)
+            dilatedRow[w] = row[w] | get_left_neighbours(row, w, false) | get_right_neighbours(row, w, false);
+    }
+    for (uint w = 0; w < _wordsPerRow; ++w)
+    {
+        uint64_t previousRowWord = 0;
+        for (uint y = 0; y < _height; ++y)
+        {
+            uint64_t& word = dilated._words[y * _wordsPerRow + w];
+            const uint64_t rowWord = word;
+            word |= previousRowWord;
+            if (y + 1 < _height)
+                word |= dilated._words[(y + 1) * _wordsPerRow + w];
+            previousRowWord = rowWord;
+        }
+    }
+}
+
+uint64_t Cell_Mask::get_left_neighbours(const uint64_t* row, const uint w, const bool isOutsideSet) const noexcept
+{
+    // the cell x receives the cell x - 1: the first cell receives the outside
+    const uint64_t carry = (w > 0) ? row[w - 1] >> (wordBits - 1) : static_cast<uint64_t>(isOutsideSet);
+    uint64_t word = (row[w] << 1) | carry;
+    if (w + 1 == _wordsPerRow)
+        word &= _lastWordMask;
+    return word;
+}
+
+uint64_t Cell_Mask::get_right_neighbours(const uint64_t* row, const uint w, const bool isOutsideSet) const noexcept
+{
+    // the cell x receives the cell x + 1: the last cell receives the outside (the bits over the width are 0)
+    if (w + 1 < _wordsPerRow)
+        return (row[w] >> 1) | (row[w + 1] << (wordBits - 1));
+    uint64_t word = row[w] >> 1;
+    if (isOutsideSet)
+        word |= uint64_t(1) << ((_width - 1) % wordBits);
+    return word;
+}
+
+void Cell_Mask::match_size(Cell_Mask& other) const noexcept
+{
+    other._width = _width;
+    other._height = _height;
+    other._wordsPerRow = _wordsPerRow;
+    other._lastWordMask = _lastWordMask;
+    other._words.resize(_words.size());
+}
+
+} // namespace rgbd_slam::features::primitives
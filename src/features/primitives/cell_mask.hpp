@@ -0,0 +1,141 @@
+#ifndef RGBDSLAM_FEATURES_PRIMITIVES_CELLMASK_HPP
+#define RGBDSLAM_FEATURES_PRIMITIVES_CELLMASK_HPP
+
+#include "../../types.hpp"
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <opencv2/core/types.hpp>
+#include <vector>
+
+namespace rgbd_slam::features::primitives {
+
+/**
+ * \brief A binary mask over the cells of the depth map patches, one bit per cell, packed in 64 bits words by rows.
+ * A mask of a 640x480 image with 20 pixels cells is 24 words: the morphology and the set operations process 64 cells in
+ * a few word operations, instead of an image of bytes.
+ * The bits over the width in the last word of each row are always 0
+ */
+class Cell_Mask
+{
+  public:
+    Cell_Mask() = default;
+
+    /**
+     * \brief Create an empty mask
+     * \param[in] width The number of cells in a row
+     * \param[in] height The number of cells in a column
+     */
+    Cell_Mask(const uint width, const uint height);
+
+    [[nodiscard]] uint get_width() const noexcept { return _width; }
+    [[nodiscard]] uint get_height() const noexcept { return _height; }
+
+    /**
+     * \brief Unset all the cells, keeping the size
+     */
+    void clear() noexcept;
+
+    void set(const uint x, const uint y) noexcept
+    {
+        assert(x < _width and y < _height);
+        _words[y * _wordsPerRow + x / wordBits] |= uint64_t(1) << (x % wordBits);
+    }
+
+    [[nodiscard]] bool is_set(const uint x, const uint y) const noexcept
+    {
+        assert(x < _width and y < _height);
+        return (_words[y * _wordsPerRow + x / wordBits] >> (x % wordBits)) & 1;
+    }
+
+    /**
+     * \return The number of set cells
+     */
+    [[nodiscard]] uint count() const noexcept;
+
+    /**
+     * \return The number of set cells in a rectangle of cells, clipped to the mask
+     */
+    [[nodiscard]] uint count(const cv::Rect& cells) const noexcept;
+
+    [[nodiscard]] bool empty() const noexcept;
+
+    /**
+     * \return True if all the cells are set
+     */
+    [[nodiscard]] bool is_full() const noexcept;
+
+    /**
+     * \brief Union, intersection and difference with a mask of the same size
+     */
+    Cell_Mask& operator|=(const Cell_Mask& other) noexcept;
+    Cell_Mask& operator&=(const Cell_Mask& other) noexcept;
+    Cell_Mask& operator-=(const Cell_Mask& other) noexcept;
+
+    /**
+     * \brief Erode by a 3x3 cross: a cell stays set if its 4 neighbours are set
+     * \param[out] eroded The eroded mask. Must not be this mask
+     * \param[in] isOutsideSet If true, the cells outside of the mask are considered set
+     */
+    void erode_cross(Cell_Mask& eroded, const bool isOutsideSet) const noexcept;
+
+    /**
+     * \brief Dilate by a 3x3 cross: a cell is set if it or one of its 4 neighbours is set
+     * \param[out] dilated The dilated mask. Must not be this mask
+     */
+    void dilate_cross(Cell_Mask& dilated) const noexcept;
+
+    /**
+     * \brief Dilate by a 3x3 square: a cell is set if it or one of its 8 neighbours is set
+     * \param[out] dilated The dilated mask. Must not be this mask
+     */
+    void dilate_square(Cell_Mask& dilated) const noexcept;
+
+    /**
+     * \brief Call a function with the coordinates (x, y) of each set cell, in row order
+     */
+    template<typename Function> void for_each_set_cell(Function&& function) const
+    {
+        for (uint y = 0; y < _height; ++y)
+        {
+            const uint64_t* row = &_words[y * _wordsPerRow];
+            for (uint w = 0; w < _wordsPerRow; ++w)
+            {
+                for (uint64_t word = row[w]; word != 0; word &= word - 1)
+                    function(w * wordBits + static_cast<uint>(std::countr_zero(word)), y);
+            }
+        }
+    }
+
+    [[nodiscard]] size_t get_allocated_bytes() const noexcept { return _words.capacity() * sizeof(uint64_t); }
+
+  private:
+    static constexpr uint wordBits = 64;
+
+    /**
+     * \brief Horizontal neighbours of a word of a row: a cell is set in the result if the cell on its left (or right)
+     * is set
+     */
+    [[nodiscard]] uint64_t get_left_neighbours(const uint64_t* row,
+                                               const uint w,
+                                               const bool isOutsideSet) const noexcept;
+    [[nodiscard]] uint64_t get_right_neighbours(const uint64_t* row,
+                                                const uint w,
+                                                const bool isOutsideSet) const noexcept;
+
+    /**
+     * \brief Resize another mask to the size of this one. Reallocates only if it has less capacity
+     */
+    void match_size(Cell_Mask& other) const noexcept;
+
+    uint _width = 0;
+    uint _height = 0;
+    uint _wordsPerRow = 0;
+    uint64_t _lastWordMask = 0; // valid bits of the last word of a row
+    std::vector<uint64_t> _words;
+};
+
+} // namespace rgbd_slam::features::primitives
+
+#endif
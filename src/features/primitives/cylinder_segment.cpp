@@ -1,6 +1,9 @@
 #include "cylinder_segment.hpp"
 #include "../../parameters.hpp"
 #include "../../utils/random.hpp"
+#include <array>
+#include <tbb/parallel_for.h>
+#include <tuple>
 
 namespace rgbd_slam::features::primitives {
 
@@ -224,6 +227,78 @@ Cylinder_Segment::Cylinder_Segment(const std::vector<Plane_Segment>& planeGrid,
     }
 }
 
+Cylinder_Segment::ransac_hypothesis Cylinder_Segment::compute_hypothesis(const uint id1,
+                                                                        const uint id2,
+                                                                        const uint id3,
+                                                                        const matrixd& planeNormals,
+                                                                        const matrixd& projectedCentroids) noexcept
+{
+    // normals of random planes
+    const vector3& normal1 = planeNormals.col(id1);
+    const vector3& normal2 = planeNormals.col(id2);
+    const vector3& normal3 = planeNormals.col(id3);
+    // centers of random planes
+    const vector3& centroid1 = projectedCentroids.col(id1);
+    const vector3& centroid2 = projectedCentroids.col(id2);
+    const vector3& centroid3 = projectedCentroids.col(id3);
+
+    // Sum of normals/centroids
+    const vector3 sumOfNormals = (normal1 + normal2 + normal3);
+    const vector3 sumOfCenters = (centroid1 + centroid2 + centroid3);
+
+    // LLS solution for triplets
+    const double a = 1.0 - sumOfNormals.squaredNorm() / 9.0;
+    const double b = ((normal1.array() * centroid1.array()) + (normal2.array() * centroid2.array()) +
+                      (normal3.array() * centroid3.array()))
+                                     .sum() /
+                             3.0 -
+                     (sumOfNormals.dot(sumOfCenters) / 9.0);
+    // compute cylinder center and radius
+    ransac_hypothesis hypothesis;
+    hypothesis.radius = b / a;
+    hypothesis.center = (sumOfCenters - hypothesis.radius * sumOfNormals) / 3.0;
+    return hypothesis;
+}
+
+double Cylinder_Segment::get_hypothesis_score(const ransac_hypothesis& hypothesis,
+                                              const matrixd& planeNormals,
+                                              const matrixd& projectedCentroids,
+                                              const Matrixb& idsLeftMask,
+                                              std::vector<uint>* inlierIndexes,
+                                              uint& inlierCount) const noexcept
+{
+    constexpr float maximumSqrtDistance = parameters::detection::cylinderRansacSqrtMaxDistance;
+    const double oneOverRadiusSquared = 1.0 / (hypothesis.radius * hypothesis.radius);
+
+    // MSAC truncated distance
+    inlierCount = 0;
+    double dist = 0.0;
+    for (uint i = 0; i < _cellActivatedCount; ++i)
+    {
+        if (not idsLeftMask(i))
+        {
+            continue;
+        }
+        // Normal dist
+        const double distance =
+                ((projectedCentroids.col(i) - hypothesis.radius * planeNormals.col(i)) - hypothesis.center)
+                        .squaredNorm() *
+                oneOverRadiusSquared;
+        if (distance < maximumSqrtDistance)
+        {
+            dist += distance;
+            ++inlierCount;
+            if (inlierIndexes != nullptr)
+                inlierIndexes->push_back(i);
+        }
+        else
+        {
+            dist += maximumSqrtDistance;
+        }
+    }
+    return dist;
+}
+
 size_t Cylinder_Segment::run_ransac_loop(const uint maximumIterations,
                                          const std::vector<uint>& idsLeft,
                                          const matrixd& planeNormals,
@@ -242,79 +317,62 @@ size_t Cylinder_Segment::run_ransac_loop(const uint maximumIterations,
     constexpr float maximumSqrtDistance = parameters::detection::cylinderRansacSqrtMaxDistance;
     // Score of the maximum inliers configuration
     double minHypothesisDist = maximumSqrtDistance * static_cast<float>(planeIdsLeft);
-    // Indexes of the inliers of the best configuration
-    std::vector<uint> finalInlierIndexes;
+    bool isHypothesisFound = false;
+    ransac_hypothesis bestHypothesis;
 
-    // Run ransac loop
-    for (uint iteration = 0; iteration < maximumIterations; ++iteration)
+    // Hypotheses are scored in parallel, by blocks. The triplets are drawn on this thread, and the best hypothesis
+    // is selected in iteration order, so the result does not depend on the thread scheduling
+    constexpr uint blockSize = 8;
+    std::array<ransac_hypothesis, blockSize> hypotheses;
+    std::array<double, blockSize> hypothesesDist;
+    std::array<uint, blockSize> hypothesesInlierCount;
+
+    for (uint blockStart = 0; blockStart < maximumIterations; blockStart += blockSize)
     {
-        // Random triplet
-        const uint id1 = idsLeft[utils::Random::get_random_uint(planeIdsLeft)];
-        const uint id2 = idsLeft[utils::Random::get_random_uint(planeIdsLeft)];
-        const uint id3 = idsLeft[utils::Random::get_random_uint(planeIdsLeft)];
-        // normals of random planes
-        const vector3& normal1 = planeNormals.col(id1);
-        const vector3& normal2 = planeNormals.col(id2);
-        const vector3& normal3 = planeNormals.col(id3);
-        // centers of random planes
-        const vector3& centroid1 = projectedCentroids.col(id1);
-        const vector3& centroid2 = projectedCentroids.col(id2);
-        const vector3& centroid3 = projectedCentroids.col(id3);
-
-        // Sum of normals/centroids
-        const vector3 sumOfNormals = (normal1 + normal2 + normal3);
-        const vector3 sumOfCenters = (centroid1 + centroid2 + centroid3);
-
-        // LLS solution for triplets
-        const double a = 1.0 - sumOfNormals.squaredNorm() / 9.0;
-        const double b = ((normal1.array() * centroid1.array()) + (normal2.array() * centroid2.array()) +
-                          (normal3.array() * centroid3.array()))
-                                         .sum() /
-                                 3.0 -
-                         (sumOfNormals.dot(sumOfCenters) / 9.0);
-        // compute cylinder center and radius
-        const double radius = b / a;
-        const double oneOverRadiusSquared = 1.0 / (radius * radius);
-        const vector3 center = (sumOfCenters - radius * sumOfNormals) / 3.0;
-
-        // MSAC truncated distance
-        std::vector<uint> inlierIndexes;
-        double dist = 0.0;
-        for (uint i = 0; i < _cellActivatedCount; ++i)
+        const uint hypothesesCount = std::min(blockSize, maximumIterations - blockStart);
+
+        // Random triplets
+        for (uint i = 0; i < hypothesesCount; ++i)
         {
-            if (not idsLeftMask(i))
-            {
-                continue;
-            }
-            // Normal dist
-            const double distance =
-                    ((projectedCentroids.col(i) - radius * planeNormals.col(i)) - center.col(0)).squaredNorm() *
-                    oneOverRadiusSquared;
-            if (distance < maximumSqrtDistance)
-            {
-                dist += distance;
-                inlierIndexes.push_back(i);
-            }
-            else
-            {
-                dist += maximumSqrtDistance;
-            }
+            const uint id1 = idsLeft[utils::Random::get_random_uint(planeIdsLeft)];
+            const uint id2 = idsLeft[utils::Random::get_random_uint(planeIdsLeft)];
+            const uint id3 = idsLeft[utils::Random::get_random_uint(planeIdsLeft)];
+            hypotheses[i] = compute_hypothesis(id1, id2, id3, planeNormals, projectedCentroids);
         }
 
-        if (dist < minHypothesisDist)
-        {
-            // Keep parameters of the best transformation
-            minHypothesisDist = dist;
-            finalInlierIndexes.swap(inlierIndexes);
+        tbb::parallel_for(uint(0), hypothesesCount, [&](const uint i) {
+            hypothesesDist[i] = get_hypothesis_score(
+                    hypotheses[i], planeNormals, projectedCentroids, idsLeftMask, nullptr, hypothesesInlierCount[i]);
+        });
 
-            // early stop
-            if (inlierIndexes.size() > inliersAcceptedCount)
-                break;
+        // Keep parameters of the best transformation
+        uint bestInlierCount = 0;
+        for (uint i = 0; i < hypothesesCount; ++i)
+        {
+            if (hypothesesDist[i] < minHypothesisDist)
+            {
+                minHypothesisDist = hypothesesDist[i];
+                bestHypothesis = hypotheses[i];
+                bestInlierCount = hypothesesInlierCount[i];
+                isHypothesisFound = true;
+            }
         }
+
+        // early stop: the best hypothesis explains nearly all the remaining planes
+        if (bestInlierCount > inliersAcceptedCount)
+            break;
     }
 
     // Compute the final inliers set
     isInlierFinal.setConstant(false);
+    if (not isHypothesisFound)
+        return 0;
+
+    std::vector<uint> finalInlierIndexes;
+    finalInlierIndexes.reserve(planeIdsLeft);
+    uint finalInlierCount = 0;
+    std::ignore = get_hypothesis_score(
+            bestHypothesis, planeNormals, projectedCentroids, idsLeftMask, &finalInlierIndexes, finalInlierCount);
     for (const uint inlierIndex: finalInlierIndexes)
         isInlierFinal(inlierIndex) = true;
 
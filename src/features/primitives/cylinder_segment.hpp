@@ -105,6 +105,46 @@ class Cylinder_Segment
     [[nodiscard]] vector3 get_normal() const noexcept;
 
   protected:
+    /**
+     * \brief A cylinder hypothesis, fitted on a random plane triplet
+     */
+    struct ransac_hypothesis
+    {
+        double radius = 0.0;
+        vector3 center = vector3::Zero();
+    };
+
+    /**
+     * \brief Fit a cylinder hypothesis on three plane segments
+     * \param[in] id1 First plane segment index
+     * \param[in] id2 Second plane segment index
+     * \param[in] id3 Third plane segment index
+     * \param[in] planeNormals Normals of the planes to fit
+     * \param[in] projectedCentroids Centroids of the planes, projected on a plane orthogonal to the axis
+     */
+    [[nodiscard]] static ransac_hypothesis compute_hypothesis(const uint id1,
+                                                              const uint id2,
+                                                              const uint id3,
+                                                              const matrixd& planeNormals,
+                                                              const matrixd& projectedCentroids) noexcept;
+
+    /**
+     * \brief Compute the MSAC score of a cylinder hypothesis
+     * \param[in] hypothesis The hypothesis to score
+     * \param[in] planeNormals Normals of the planes to fit
+     * \param[in] projectedCentroids Centroids of the planes, projected on a plane orthogonal to the axis
+     * \param[in] idsLeftMask Mask of the plane segments that are not fitted yet
+     * \param[out] inlierIndexes If not null, filled with the inlier indexes of this hypothesis
+     * \param[out] inlierCount The number of inliers of this hypothesis
+     * \return The truncated distance of this hypothesis: lower is better
+     */
+    [[nodiscard]] double get_hypothesis_score(const ransac_hypothesis& hypothesis,
+                                              const matrixd& planeNormals,
+                                              const matrixd& projectedCentroids,
+                                              const Matrixb& idsLeftMask,
+                                              std::vector<uint>* inlierIndexes,
+                                              uint& inlierCount) const noexcept;
+
     /**
      * \brief Run a RANSAC pose optimization with 6 points
      * \param[in] maximumIterations The maximum RANSAC loops that this function will run
@@ -1,18 +1,44 @@
 #include "depth_map_transformation.hpp"
+#include "../../outputs/trace_recorder.hpp"
 #include "../../parameters.hpp"
-#include "coordinates/point_coordinates.hpp"
+#include <atomic>
 #include <opencv2/core/eigen.hpp>
 #include <tbb/parallel_for.h>
 
 namespace rgbd_slam::features::primitives {
 
+namespace {
+
+/**
+ * \return A map on a row of the depth image, of row size
+ */
+Eigen::Map<const Eigen::ArrayXf> get_row(const cv::Mat_<float>& depthImage, const uint row) noexcept
+{
+    return {depthImage.ptr<float>(static_cast<int>(row)), depthImage.cols};
+}
+
+/**
+ * \return The depth of a row of the raw image, in millimeters: an expression evaluated by the kernel that uses it
+ */
+auto get_row(const cv::Mat_<uint16_t>& rawDepthImage, const uint row, const float depthScale) noexcept
+{
+    const Eigen::Map<const Eigen::Array<uint16_t, Eigen::Dynamic, 1>> rawDepth(
+            rawDepthImage.ptr<uint16_t>(static_cast<int>(row)), rawDepthImage.cols);
+    return rawDepth.cast<float>() * depthScale;
+}
+
+} // namespace
+
 Depth_Map_Transformation::Depth_Map_Transformation(const uint width, const uint height, const uint cellSize) :
     _width(width),
     _height(height),
     _cellSize(cellSize),
     _Xpre(static_cast<int>(height), static_cast<int>(width)),
     _Ypre(static_cast<int>(height), static_cast<int>(width)),
-    _cellMap(static_cast<int>(height), static_cast<int>(width))
+    _cellMap(static_cast<int>(height), static_cast<int>(width)),
+    _rectificationRayX(static_cast<int>(height), static_cast<int>(width)),
+    _rectificationRayY(static_cast<int>(height), static_cast<int>(width)),
+    _rectificationRayZ(static_cast<int>(height), static_cast<int>(width))
 {
     assert(height > 0 and width > 0);
 
@@ -23,65 +49,90 @@ Depth_Map_Transformation::Depth_Map_Transformation(const uint width, const uint
 bool Depth_Map_Transformation::rectify_depth(const cv::Mat_<float>& depthImage,
                                              cv::Mat_<float>& rectifiedDepth) noexcept
 {
-    // will contain the projected depth image to rgb space
-    rectifiedDepth = cv::Mat_<float>::zeros(static_cast<int>(_height), static_cast<int>(_width));
-
-#ifndef MAKE_DETERMINISTIC
-    // parallel loop to speed up the process
-    // USING THIS PARALLEL LOOP BREAKS THE RANDOM SEEDING
-    tbb::parallel_for(
-            uint(0),
-            _height,
-            [&](uint row) {
-#else
-    for (uint row = 0; row < _height; ++row)
-    {
-#endif
-                const float* depthRow = depthImage.ptr<float>(static_cast<int>(row));
-                const float* preXRow = _Xpre.ptr<float>(static_cast<int>(row));
-                const float* preYRow = _Ypre.ptr<float>(static_cast<int>(row));
-
-                for (uint column = 0; column < _width; ++column)
-                {
-                    const float originalZ = depthRow[column];
-                    if (originalZ <= 0)
-                    {
-                        continue;
-                    }
-                    // undistord the depth image
-                    const vector3 original(preXRow[column] * originalZ, preYRow[column] * originalZ, originalZ);
-
-                    // project to camera1 space
-                    const vector3 projected =
-                            (Parameters::get_camera_2_to_camera_1_transformation() * original.homogeneous()).head<3>();
-
-                    // distord to align with camera1 image
-                    ScreenCoordinate2D screenCoordinates;
-                    if (CameraCoordinate(projected).to_screen_coordinates(screenCoordinates))
-                    {
-                        const uint projCoordColumn = static_cast<uint>(floor(screenCoordinates.x()));
-                        const uint projCoordRow = static_cast<uint>(floor(screenCoordinates.y()));
-
-                        // keep projected coordinates that are in rgb image boundaries
-                        if (projCoordColumn > 0 and projCoordRow > 0 and projCoordColumn < _width and
-                            projCoordRow < _height)
-                        {
-                            // set transformed depth image
-                            rectifiedDepth.at<float>(static_cast<int>(projCoordRow),
-                                                     static_cast<int>(projCoordColumn)) =
-                                    static_cast<float>(projected.z());
-                        }
-                    }
-                    else
-                    {
-                        // impossible: we checked that z > 0 before
-                        exit(-1);
-                    }
-                }
-            }
-#ifndef MAKE_DETERMINISTIC
-    );
-#endif
+    const outputs::Scoped_Trace trace("rectify_depth");
+    assert(depthImage.rows == static_cast<int>(_height));
+    assert(depthImage.cols == static_cast<int>(_width));
+
+    // will contain the projected depth image to rgb space (new buffer, in case rectifiedDepth shares depthImage data)
+    rectifiedDepth = cv::Mat_<float>(static_cast<int>(_height), static_cast<int>(_width), 0.0f);
+
+    // the rows are scattered concurrently, the nearest depth wins whatever the order
+    tbb::parallel_for(uint(0), _height, [&](uint row) {
+        rectify_row(row, get_row(depthImage, row), rectifiedDepth);
+    });
+
+    return true;
+}
+
+bool Depth_Map_Transformation::rectify_and_organize(const cv::Mat_<float>& depthImage,
+                                                    cv::Mat_<float>& rectifiedDepth,
+                                                    matrixf& organizedCloudArray) noexcept
+{
+    const outputs::Scoped_Trace trace("rectify_and_organize");
+    assert(depthImage.rows == static_cast<int>(_height));
+    assert(depthImage.cols == static_cast<int>(_width));
+
+    // new buffer, in case rectifiedDepth shares depthImage data
+    rectifiedDepth = cv::Mat_<float>(static_cast<int>(_height), static_cast<int>(_width), 0.0f);
+    // all the points are set by the back projection pass
+    organizedCloudArray.resize(static_cast<long>(_width) * _height, 3);
+
+    // the rows are scattered concurrently, the nearest depth wins whatever the order. The points are back projected
+    // once all the rows are rectified: a pixel can receive the depth of several rows
+    tbb::parallel_for(uint(0), _height, [&](uint row) {
+        rectify_row(row, get_row(depthImage, row), rectifiedDepth);
+    });
+    tbb::parallel_for(uint(0), _height, [&](uint row) {
+        organize_row(row, rectifiedDepth, organizedCloudArray);
+    });
+
+    return true;
+}
+
+bool Depth_Map_Transformation::rectify_and_organize(const cv::Mat_<uint16_t>& rawDepthImage,
+                                                    const float depthScale,
+                                                    cv::Mat_<float>& rectifiedDepth,
+                                                    matrixf& organizedCloudArray) noexcept
+{
+    const outputs::Scoped_Trace trace("rectify_and_organize");
+    assert(rawDepthImage.rows == static_cast<int>(_height));
+    assert(rawDepthImage.cols == static_cast<int>(_width));
+    assert(depthScale > 0.0f);
+
+    rectifiedDepth = cv::Mat_<float>(static_cast<int>(_height), static_cast<int>(_width), 0.0f);
+    organizedCloudArray.resize(static_cast<long>(_width) * _height, 3);
+
+    tbb::parallel_for(uint(0), _height, [&](uint row) {
+        rectify_row(row, get_row(rawDepthImage, row, depthScale), rectifiedDepth);
+    });
+    tbb::parallel_for(uint(0), _height, [&](uint row) {
+        organize_row(row, rectifiedDepth, organizedCloudArray);
+    });
+
+    return true;
+}
+
+bool Depth_Map_Transformation::get_organized_cloud_array(const cv::Mat_<uint16_t>& rawDepthImage,
+                                                         const float depthScale,
+                                                         cv::Mat_<float>& depthImage,
+                                                         matrixf& organizedCloudArray) noexcept
+{
+    const outputs::Scoped_Trace trace("get_organized_cloud_array");
+    assert(rawDepthImage.rows == static_cast<int>(_height));
+    assert(rawDepthImage.cols == static_cast<int>(_width));
+    assert(depthScale > 0.0f);
+
+    depthImage = cv::Mat_<float>(static_cast<int>(_height), static_cast<int>(_width));
+    organizedCloudArray = matrixf::Zero(static_cast<long>(_width) * _height, 3);
+
+    // scale a row while it is in cache, then back project it
+    const auto organize_raw_row = [&](const uint row) {
+        Eigen::Map<Eigen::ArrayXf>(depthImage.ptr<float>(static_cast<int>(row)), _width) =
+                get_row(rawDepthImage, row, depthScale);
+        organize_row(row, depthImage, organizedCloudArray);
+    };
+
+    tbb::parallel_for(uint(0), _height, organize_raw_row);
 
     return true;
 }
@@ -89,56 +140,108 @@ bool Depth_Map_Transformation::rectify_depth(const cv::Mat_<float>& depthImage,
 bool Depth_Map_Transformation::get_organized_cloud_array(const cv::Mat_<float>& depthImage,
                                                          matrixf& organizedCloudArray) noexcept
 {
+    const outputs::Scoped_Trace trace("get_organized_cloud_array");
     assert(depthImage.rows == static_cast<int>(_height));
     assert(depthImage.cols == static_cast<int>(_width));
 
     // will contain the projected depth image to rgb space
     organizedCloudArray = matrixf::Zero(static_cast<long>(_width) * _height, 3);
 
-#ifndef MAKE_DETERMINISTIC
-    // parallel loop to speed up the process
-    // USING THIS PARALLEL LOOP BREAKS THE RANDOM SEEDING
     tbb::parallel_for(uint(0), _height, [&](uint row) {
-        const float* depthRow = depthImage.ptr<float>(static_cast<int>(row));
-        for (uint column = 0; column < _width; ++column)
-        {
-            const float z = depthRow[column];
-            if (z > 0)
-            {
-                // set convertion matrix
-                const int id = _cellMap.at<int>(static_cast<int>(row), static_cast<int>(column));
-                assert(id >= 0 and id < organizedCloudArray.rows());
+        organize_row(row, depthImage, organizedCloudArray);
+    });
 
-                const CameraCoordinate& cameraCoordinates = ScreenCoordinate(column, row, z).to_camera_coordinates();
+    return true;
+}
+
+template<typename DepthRow>
+void Depth_Map_Transformation::rectify_row(const uint row,
+                                           const Eigen::ArrayBase<DepthRow>& depth,
+                                           cv::Mat_<float>& rectifiedDepth) const noexcept
+{
+    const int rowIndex = static_cast<int>(row);
+    const long width = static_cast<long>(_width);
+    assert(depth.size() == width);
+    const row_map rayX(_rectificationRayX.ptr<float>(rowIndex), width);
+    const row_map rayY(_rectificationRayY.ptr<float>(rowIndex), width);
+    const row_map rayZ(_rectificationRayZ.ptr<float>(rowIndex), width);
+
+    // project to camera1 space and distord to align with camera1 image, with the precomputed rays
+    // (vectorized by Eigen for the whole row)
+    const Eigen::ArrayXf projectedZ = rayZ * depth + _rectificationOffset.z();
+    const Eigen::ArrayXf inverseZ = projectedZ.inverse();
+    const Eigen::ArrayXf screenX = (rayX * depth + _rectificationOffset.x()) * inverseZ;
+    const Eigen::ArrayXf screenY = (rayY * depth + _rectificationOffset.y()) * inverseZ;
+
+    // scatter the valid depth values
+    const float maxColumn = static_cast<float>(_width);
+    const float maxRow = static_cast<float>(_height);
+    for (long column = 0; column < width; ++column)
+    {
+        if (depth[column] <= 0)
+            continue;
 
-                // undistorded depth
-                organizedCloudArray(id, 0) = static_cast<float>(cameraCoordinates.x());
-                organizedCloudArray(id, 1) = static_cast<float>(cameraCoordinates.y());
-                organizedCloudArray(id, 2) = z;
+        // keep projected coordinates that are in rgb image boundaries (this also rejects NaN values)
+        const float x = screenX[column];
+        const float y = screenY[column];
+        if (x >= 1.0f and y >= 1.0f and x < maxColumn and y < maxRow)
+        {
+            const int projectedRow = static_cast<int>(y);
+            const int projectedColumn = static_cast<int>(x);
+            const float z = projectedZ[column];
+
+            // set transformed depth image: several rows can project to this pixel, keep the nearest depth (an empty
+            // pixel is 0)
+            std::atomic_ref<float> rectifiedPixel(rectifiedDepth(projectedRow, projectedColumn));
+            float currentDepth = rectifiedPixel.load(std::memory_order_relaxed);
+            while ((currentDepth <= 0.0f or z < currentDepth) and
+                   not rectifiedPixel.compare_exchange_weak(currentDepth, z, std::memory_order_relaxed))
+            {
             }
         }
-    });
-#else
-    // use opencv parallel foreach (TODO: maybe needs a mutex ? than not as efficient)
-    depthImage.forEach([this, &organizedCloudArray](const float z, const int position[]) {
-        if (z > 0)
-        {
-            // set convertion matrix
-            const int id = _cellMap(position[0], position[1]);
-            assert(id >= 0 and id < organizedCloudArray.rows());
+    }
+}
 
-            const CameraCoordinate& cameraCoordinates =
-                    ScreenCoordinate(position[1], position[0], z).to_camera_coordinates();
+void Depth_Map_Transformation::organize_row(const uint row,
+                                            const cv::Mat_<float>& depthImage,
+                                            matrixf& organizedCloudArray) const noexcept
+{
+    const int rowIndex = static_cast<int>(row);
+    const long width = static_cast<long>(_width);
+    const row_map depth(depthImage.ptr<float>(rowIndex), width);
+    const row_map preX(_Xpre.ptr<float>(rowIndex), width);
+    const row_map preY(_Ypre.ptr<float>(rowIndex), width);
 
-            // undistorded depth
-            organizedCloudArray(id, 0) = static_cast<float>(cameraCoordinates.x());
-            organizedCloudArray(id, 1) = static_cast<float>(cameraCoordinates.y());
-            organizedCloudArray(id, 2) = z;
-        }
-    });
-#endif
+    // invalid depth are set to zero, so the whole point is zero (as with the initialization)
+    const Eigen::ArrayXf validDepth = (depth > 0.0f).select(depth, 0.0f);
 
-    return true;
+    // Inside a cell row, the cloud points are contiguous: copy the cell segments at once.
+    // matrixf is column major, so each coordinate of a segment is contiguous too
+    const long cellSize = static_cast<long>(_cellSize);
+    const long fullCellColumns = (width / cellSize) * cellSize;
+    const int* cellRow = _cellMap.ptr<int>(rowIndex);
+    for (long column = 0; column < fullCellColumns; column += cellSize)
+    {
+        const long id = cellRow[column];
+        assert(id >= 0 and id + cellSize <= organizedCloudArray.rows());
+
+        const auto& depthSegment = validDepth.segment(column, cellSize);
+        organizedCloudArray.col(0).segment(id, cellSize).array() = preX.segment(column, cellSize) * depthSegment;
+        organizedCloudArray.col(1).segment(id, cellSize).array() = preY.segment(column, cellSize) * depthSegment;
+        organizedCloudArray.col(2).segment(id, cellSize).array() = depthSegment;
+    }
+
+    // remaining columns, out of a complete cell
+    for (long column = fullCellColumns; column < width; ++column)
+    {
+        const int id = cellRow[column];
+        assert(id >= 0 and id < organizedCloudArray.rows());
+
+        const float z = validDepth[column];
+        organizedCloudArray(id, 0) = preX[column] * z;
+        organizedCloudArray(id, 1) = preY[column] * z;
+        organizedCloudArray(id, 2) = z;
+    }
 }
 
 /*
@@ -170,6 +273,28 @@ void Depth_Map_Transformation::init_matrices() noexcept
                     floor((cellR * horizontalCellsCount + cellC) * SQR(_cellSize) + localR * _cellSize + localC));
         }
     }
+
+    // Rectification lookup table: a depth pixel (u, v, z) projects in camera1 image at K * (R * z * ray(u, v) + t).
+    // Store K * R * ray(u, v) for each pixel and the K * t offset, so rectification is z * ray + offset
+    const matrix44& camera2ToCamera1 = Parameters::get_camera_2_to_camera_1_transformation();
+    const matrix33& intrinsics = Parameters::get_camera_1_intrinsics();
+    const matrix33& rayTransformation = intrinsics * camera2ToCamera1.block<3, 3>(0, 0);
+    _rectificationOffset = (intrinsics * camera2ToCamera1.block<3, 1>(0, 3)).cast<float>();
+
+    for (uint row = 0; row < _height; ++row)
+    {
+        const int rowIndex = static_cast<int>(row);
+        for (uint colum = 0; colum < _width; ++colum)
+        {
+            const int columnIndex = static_cast<int>(colum);
+            const vector3 ray(_Xpre(rowIndex, columnIndex), _Ypre(rowIndex, columnIndex), 1.0);
+            const vector3& projectedRay = rayTransformation * ray;
+
+            _rectificationRayX(rowIndex, columnIndex) = static_cast<float>(projectedRay.x());
+            _rectificationRayY(rowIndex, columnIndex) = static_cast<float>(projectedRay.y());
+            _rectificationRayZ(rowIndex, columnIndex) = static_cast<float>(projectedRay.z());
+        }
+    }
 }
 
 } // namespace rgbd_slam::features::primitives
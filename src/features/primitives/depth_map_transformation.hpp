@@ -38,12 +38,88 @@ class Depth_Map_Transformation
     [[nodiscard]] bool get_organized_cloud_array(const cv::Mat_<float>& depthImage,
                                                  matrixf& organizedCloudArray) noexcept;
 
+    /**
+     * \brief Rectify the given depth image and create the organized point cloud of the rectified image, in a single
+     * pass over the depth image. Equivalent to rectify_depth followed by get_organized_cloud_array.
+     *
+     * \param[in] depthImage The unrectified depth image
+     * \param[out] rectifiedDepth The depth image, transformed to align with the rgb image
+     * \param[out] organizedCloudArray A cloud point of the rectified depth, divided in blocs of cellSize * cellSize
+     * \return True if the process succeeded
+     */
+    [[nodiscard]] bool rectify_and_organize(const cv::Mat_<float>& depthImage,
+                                            cv::Mat_<float>& rectifiedDepth,
+                                            matrixf& organizedCloudArray) noexcept;
+
+    /**
+     * \brief Create the organized point cloud of a raw sensor depth image, and its depth image in millimeters, in a
+     * single pass. The scale is applied row by row, there is no conversion pass over the raw image
+     *
+     * \param[in] rawDepthImage Input depth image, in sensor units
+     * \param[in] depthScale Millimeters by sensor unit (> 0)
+     * \param[out] depthImage The depth image, in millimeters
+     * \param[out] organizedCloudArray A cloud point divided in blocs of cellSize * cellSize
+     * \return True if the process succeeded
+     */
+    [[nodiscard]] bool get_organized_cloud_array(const cv::Mat_<uint16_t>& rawDepthImage,
+                                                 const float depthScale,
+                                                 cv::Mat_<float>& depthImage,
+                                                 matrixf& organizedCloudArray) noexcept;
+
+    /**
+     * \brief Rectify a raw sensor depth image and create the organized point cloud of the rectified image, in a single
+     * pass. The scale is folded in the rectification kernel, there is no conversion pass over the raw image
+     *
+     * \param[in] rawDepthImage The unrectified depth image, in sensor units
+     * \param[in] depthScale Millimeters by sensor unit (> 0)
+     * \param[out] rectifiedDepth The depth image in millimeters, transformed to align with the rgb image
+     * \param[out] organizedCloudArray A cloud point of the rectified depth, divided in blocs of cellSize * cellSize
+     * \return True if the process succeeded
+     */
+    [[nodiscard]] bool rectify_and_organize(const cv::Mat_<uint16_t>& rawDepthImage,
+                                            const float depthScale,
+                                            cv::Mat_<float>& rectifiedDepth,
+                                            matrixf& organizedCloudArray) noexcept;
+
+    /**
+     * \return The bytes allocated by the back projection and rectification tables
+     */
+    [[nodiscard]] size_t get_allocated_bytes() const noexcept
+    {
+        const size_t floatTableSize = _Xpre.total() + _Ypre.total() + _rectificationRayX.total() +
+                                      _rectificationRayY.total() + _rectificationRayZ.total();
+        return floatTableSize * sizeof(float) + _cellMap.total() * sizeof(int);
+    }
+
   protected:
     /**
-     * \brief Must be called after load_parameters. Fills the computation matrices
+     * \brief Must be called after load_parameters. Fills the computation matrices, and the rectification lookup table
      */
     void init_matrices() noexcept;
 
+    using row_map = Eigen::Map<const Eigen::ArrayXf>;
+
+    /**
+     * \brief Rectify a single row of the depth image
+     * \param[in] row The row to rectify
+     * \param[in] depth The depth values of this row of the unrectified depth image, in millimeters. Can be an
+     * expression over a raw row, evaluated by the kernel
+     * \param[in, out] rectifiedDepth The rectified depth image, where the depth of this row will be projected. Several
+     * rows can be rectified concurrently in the same image: a pixel keeps the nearest projected depth
+     */
+    template<typename DepthRow>
+    void rectify_row(const uint row,
+                     const Eigen::ArrayBase<DepthRow>& depth,
+                     cv::Mat_<float>& rectifiedDepth) const noexcept;
+
+    /**
+     * \brief Back project a single row of the depth image in the organized cloud
+     * \param[in] row The row to back project
+     * \param[in] depthImage The depth image
+     * \param[in, out] organizedCloudArray The organized cloud, where the points of this row will be set
+     */
+    void organize_row(const uint row, const cv::Mat_<float>& depthImage, matrixf& organizedCloudArray) const noexcept;
+
   private:
     uint _width;
     uint _height;
@@ -53,6 +129,13 @@ class Depth_Map_Transformation
     cv::Mat_<float> _Xpre;
     cv::Mat_<float> _Ypre;
     cv::Mat_<int> _cellMap;
+
+    // rectification lookup table: projection of each depth pixel ray in camera 1 image space, before the division by
+    // the depth. The offset is the projection of the camera 2 to camera 1 translation
+    cv::Mat_<float> _rectificationRayX;
+    cv::Mat_<float> _rectificationRayY;
+    cv::Mat_<float> _rectificationRayZ;
+    Eigen::Vector3f _rectificationOffset;
 };
 
 } // namespace rgbd_slam::features::primitives
@@ -3,7 +3,10 @@
 
 #include "../../types.hpp"
 #include "../../outputs/logger.hpp"
+#include <algorithm>
+#include <array>
 #include <format>
+#include <queue>
 #include <vector>
 
 namespace rgbd_slam::features::primitives {
@@ -15,16 +18,14 @@ constexpr double maxXminX = M_PI - minX;
 constexpr double maxYminY = M_PI - minY;
 
 /**
- * \brief Basic 2D Histogram class, handling an histogram of N x N
+ * \brief Basic 2D Histogram class, handling an histogram of N x N.
+ * Each bin keeps the list of its points, and the most frequent bin is tracked with a max heap, so seed extraction and
+ * point removal do not scan the whole histogram.
  */
 template<size_t Size> class Histogram
 {
   public:
-    Histogram()
-    {
-        _histogram.fill(0);
-        reset();
-    }
+    Histogram() { reset(); }
 
     /**
      * \brief Initialise the histogram
@@ -34,7 +35,7 @@ template<size_t Size> class Histogram
      */
     void init_histogram(const matrixd& points, const vectorb& isUnasignedMask) noexcept
     {
-        //_reset();
+        reset();
         _pointCount = static_cast<uint>(points.rows());
         _bins.assign(_pointCount, -1);
 
@@ -57,48 +58,43 @@ template<size_t Size> class Histogram
 
                 assert(bin < _histogram.size());
                 _histogram[bin] += 1;
+                // points are pushed by ascending ids
+                _binPoints[bin].push_back(i);
             }
         }
+
+        for (uint bin = 0; bin < _histogram.size(); ++bin)
+        {
+            if (_histogram[bin] > 0)
+                _mostFrequentBins.push(bin_count {_histogram[bin], bin});
+        }
     }
 
     /**
      * \brief Return the points in the bin containing the most points
      *
-     * \return Container storing the points in the biggest bin
+     * \return Container storing the points in the biggest bin, by ascending ids
      */
-    [[nodiscard]] std::vector<uint> get_points_from_most_frequent_bin() const noexcept
+    [[nodiscard]] std::vector<uint> get_points_from_most_frequent_bin() noexcept
     {
-        int mostFrequentBin = -1;
-        uint maxOccurencesCount = 0;
-
-        for (uint i = 0; i < _histogram.size(); ++i)
-        {
-            // get most frequent bin index
-            if (_histogram[i] > maxOccurencesCount)
-            {
-                mostFrequentBin = static_cast<int>(i);
-                maxOccurencesCount = _histogram[i];
-            }
-        }
-
         std::vector<uint> pointsIds;
+
+        const int mostFrequentBin = get_most_frequent_bin();
         if (mostFrequentBin >= 0)
         {
-            pointsIds.reserve(_pointCount);
-            // most frequent bin is not empty
-            for (uint i = 0; i < _pointCount; ++i)
-            {
-                if (_bins[i] == mostFrequentBin)
-                {
-                    pointsIds.push_back(i);
-                }
-            }
+            // most frequent bin is not empty: remove the points that left this bin since the last call
+            std::vector<uint>& binPoints = _binPoints[mostFrequentBin];
+            std::erase_if(binPoints, [this, mostFrequentBin](const uint pointId) {
+                return _bins[pointId] != mostFrequentBin;
+            });
+            assert(binPoints.size() == _histogram[mostFrequentBin]);
+            pointsIds = binPoints;
         }
         return pointsIds;
     }
 
     /**
-     * \brief Remove all points from a bin
+     * \brief Remove a point from its bin
      */
     void remove_point(const uint pointId) noexcept
     {
@@ -107,9 +103,15 @@ template<size_t Size> class Histogram
             outputs::log_error(std::format("Histogram: remove_point called on invalid ID {}", pointId));
             exit(-1);
         }
-        if (_histogram[_bins[pointId]] != 0)
-            _histogram[_bins[pointId]] -= 1;
-        _bins[pointId] = 1;
+        const int bin = _bins[pointId];
+        // point is not in the histogram, or was already removed
+        if (bin < 0)
+            return;
+
+        if (_histogram[bin] != 0)
+            _histogram[bin] -= 1;
+        // the bin lists and heap are updated lazily
+        _bins[pointId] = -1;
     }
 
     /**
@@ -118,12 +120,55 @@ template<size_t Size> class Histogram
     void reset() noexcept
     {
         _histogram.fill(0);
+        for (std::vector<uint>& binPoints: _binPoints)
+            binPoints.clear();
         _bins.clear();
+        _mostFrequentBins = bin_heap();
+        _pointCount = 0;
     }
 
   private:
+    /**
+     * \brief A bin and its count when it was pushed in the heap
+     */
+    struct bin_count
+    {
+        uint count;
+        uint bin;
+
+        // heap order: greatest count first, then smallest bin index
+        bool operator<(const bin_count& other) const noexcept
+        {
+            return count < other.count or (count == other.count and bin > other.bin);
+        }
+    };
+    using bin_heap = std::priority_queue<bin_count>;
+
+    /**
+     * \brief Get the index of the most frequent bin, updating the outdated heap entries
+     * \return The index of the most frequent bin, or -1 if all bins are empty
+     */
+    [[nodiscard]] int get_most_frequent_bin() noexcept
+    {
+        while (not _mostFrequentBins.empty())
+        {
+            const bin_count top = _mostFrequentBins.top();
+            const uint currentCount = _histogram[top.bin];
+            if (top.count == currentCount)
+                return static_cast<int>(top.bin);
+
+            // outdated entry: counts only decrease, so push the current count back
+            _mostFrequentBins.pop();
+            if (currentCount > 0)
+                _mostFrequentBins.push(bin_count {currentCount, top.bin});
+        }
+        return -1;
+    }
+
     std::array<uint, Size * Size> _histogram;
+    std::array<std::vector<uint>, Size * Size> _binPoints;
     std::vector<int> _bins;
+    bin_heap _mostFrequentBins;
 
     uint _pointCount;
 
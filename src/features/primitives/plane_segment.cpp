@@ -22,15 +22,7 @@ Plane_Segment::Plane_Segment(const Plane_Segment& seg) :
     _isPlanar(seg._isPlanar),
     _centroid(seg._centroid),
     _parametrization(seg._parametrization),
-    _Sx(seg._Sx),
-    _Sy(seg._Sy),
-    _Sz(seg._Sz),
-    _Sxs(seg._Sxs),
-    _Sys(seg._Sys),
-    _Szs(seg._Szs),
-    _Sxy(seg._Sxy),
-    _Syz(seg._Syz),
-    _Szx(seg._Szx)
+    _moments(seg._moments)
 {
     assert(_isStaticSet);
 }
@@ -59,7 +51,7 @@ bool is_continuous(const float pixelDepth, float& lastPixelDepth) noexcept
     return true;
 }
 
-bool Plane_Segment::is_cell_vertical_continuous(const matrixf& depthMatrix) const noexcept
+bool Plane_Segment::is_cell_vertical_continuous(const Cell_Depths& depthMatrix) const noexcept
 {
     const uint startValue = _cellWidth / 2;
     const uint endValue = _ptsPerCellCount - startValue;
@@ -79,7 +71,7 @@ bool Plane_Segment::is_cell_vertical_continuous(const matrixf& depthMatrix) cons
     return true;
 }
 
-bool Plane_Segment::is_cell_horizontal_continuous(const matrixf& depthMatrix) const noexcept
+bool Plane_Segment::is_cell_horizontal_continuous(const Cell_Depths& depthMatrix) const noexcept
 {
     const uint startValue = static_cast<uint>(_cellWidth * (_cellHeight / 2.0));
     const uint endValue = startValue + _cellWidth;
@@ -100,98 +92,124 @@ bool Plane_Segment::is_cell_horizontal_continuous(const matrixf& depthMatrix) co
 }
 
 void Plane_Segment::init_plane_segment(const matrixf& depthCloudArray, const uint cellId) noexcept
+{
+    if (compute_cell_moments(depthCloudArray, cellId))
+        fit_cell();
+}
+
+bool Plane_Segment::compute_cell_moments(const matrixf& depthCloudArray, const uint cellId) noexcept
 {
     clear_plane_parameters();
 
     const uint offset = cellId * _ptsPerCellCount;
 
-    // get z of depth points
-    const matrixf& zMatrix = depthCloudArray.block(offset, 2, _ptsPerCellCount, 1);
+    // The cell coordinates are only viewed in the organized cloud: no per cell buffer is allocated.
+    // cheap pre-count: remove cells with too much empty values before any continuity check
+    const Cell_Depths zColumn = depthCloudArray.col(2).segment(offset, _ptsPerCellCount);
+    const uint validPointCount = static_cast<uint>((zColumn.array() > 0).count());
+    if (validPointCount < _minZeroPointCount or validPointCount < _ptsPerCellCount / 2)
+    {
+        return false;
+    }
 
     // Check for discontinuities using cross search
     // Search discontinuities only in a vertical line passing through the center, than an horizontal line passing
     // through the center.
-    if (not is_cell_horizontal_continuous(zMatrix) or not is_cell_vertical_continuous(zMatrix))
+    if (not is_cell_horizontal_continuous(zColumn) or not is_cell_vertical_continuous(zColumn))
     {
         // this segment is not continuous
-        return;
-    }
-    // remove cells with too much empty values
-    if ((zMatrix.array() > 0).count() < _ptsPerCellCount / 2)
-    {
-        return;
+        return false;
     }
 
-    // get points x and y coords
-    const matrixf& xMatrix = depthCloudArray.block(offset, 0, _ptsPerCellCount, 1);
-    const matrixf& yMatrix = depthCloudArray.block(offset, 1, _ptsPerCellCount, 1);
-
-    _pointCount = 0;
-    const uint zSize = zMatrix.size();
-    for (uint i = 0; i < zSize; ++i)
+    const float meanDepth = zColumn.sum() / static_cast<float>(validPointCount);
+    if (meanDepth > parameters::detection::farRangeCellDepth_mm)
     {
-        const float z = zMatrix(i);
-        if (z > 0)
+        // far range: the depth quantization dominates, a subsample of the cell gives the same plane.
+        // The cell points are stored row by row, so a sampled view is a strided map of each coordinate
+        constexpr uint sampleStep = parameters::detection::farRangeCellSampleStep_px;
+        using Sampled_Cell = Eigen::Map<const Eigen::MatrixXf, 0, Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>>;
+        const Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic> sampleStride(sampleStep * _cellWidth, sampleStep);
+        const auto get_sampled_coordinates = [&depthCloudArray, offset, &sampleStride](const Eigen::Index coordinate) {
+            return Sampled_Cell(&depthCloudArray(offset, coordinate),
+                                _farRangeSampledWidth,
+                                _farRangeSampledHeight,
+                                sampleStride)
+                    .cast<double>()
+                    .array();
+        };
+        // lazy expressions over the sampled views, evaluated by the reductions
+        const auto x = get_sampled_coordinates(0);
+        const auto y = get_sampled_coordinates(1);
+        const auto z = get_sampled_coordinates(2);
+
+        _pointCount = static_cast<uint>((z > 0).count());
+        _moments << x.sum(), y.sum(), z.sum(), x.square().sum(), y.square().sum(), z.square().sum(), (x * y).sum(),
+                (y * z).sum(), (x * z).sum();
+
+        // Check number of missing depth points in the sample
+        if (_pointCount < _minFarRangeSampledPointCount or _pointCount == 0)
         {
-            ++_pointCount;
-
-            const float x = xMatrix(i);
-            const float y = yMatrix(i);
-
-            // set PCA components
-            _Sx += x;
-            _Sy += y;
-            _Sz += z;
-            _Sxs += SQR(x);
-            _Sys += SQR(y);
-            _Szs += SQR(z);
-            _Sxy += x * y;
-            _Szx += x * z;
-            _Syz += y * z;
+            return false;
         }
     }
-
-    // Check number of missing depth points
-    if (_pointCount < _minZeroPointCount)
+    else
     {
-        return;
+        // points coords, in double to prevent float errors in the Huygen covariance. Lazy expressions over the cloud
+        const auto x = depthCloudArray.col(0).segment(offset, _ptsPerCellCount).cast<double>();
+        const auto y = depthCloudArray.col(1).segment(offset, _ptsPerCellCount).cast<double>();
+        const auto z = zColumn.cast<double>();
+
+        // Points without depth are (0, 0, 0) in the organized cloud, so they do not contribute to the moments:
+        // accumulate the whole cell with vectorized reductions
+        _pointCount = validPointCount;
+        _moments << x.sum(), y.sum(), z.sum(), x.squaredNorm(), y.squaredNorm(), z.squaredNorm(), x.dot(y), y.dot(z),
+                x.dot(z);
     }
 
-    assert(_Sxs > 0);
-    assert(_Sys > 0);
-    assert(_Szs > 0);
+    assert(_moments[Sxs] > 0);
+    assert(_moments[Sys] > 0);
+    assert(_moments[Szs] > 0);
+    return true;
+}
 
+void Plane_Segment::fit_cell() noexcept
+{
     // fit a plane to those points
     fit_plane();
     // plane variance should be less than depth quantization, plus a tolerance factor
     _isPlanar = _MSE <= SQR(utils::get_depth_quantization(_centroid.z()));
 }
 
-void Plane_Segment::expand_segment(const Plane_Segment& planeSegment) noexcept
+void Plane_Segment::set_plane_from_coarse_segment(const Plane_Segment& coarseSegment) noexcept
 {
-    _Sx += planeSegment._Sx;
-    _Sy += planeSegment._Sy;
-    _Sz += planeSegment._Sz;
+    assert(_pointCount > 0);
+    assert(coarseSegment._isPlanar);
 
-    _Sxs += planeSegment._Sxs;
-    _Sys += planeSegment._Sys;
-    _Szs += planeSegment._Szs;
+    // keep the moments of this cell, so the region growing sums stay exact
+    _centroid << _moments.head<3>() / static_cast<double>(_pointCount);
+    _parametrization = coarseSegment._parametrization;
+    _MSE = coarseSegment._MSE;
+    _score = coarseSegment._score;
+    _isPlanar = true;
+}
 
-    _Sxy += planeSegment._Sxy;
-    _Syz += planeSegment._Syz;
-    _Szx += planeSegment._Szx;
+void Plane_Segment::expand_segment(const Plane_Segment& planeSegment) noexcept
+{
+    _moments += planeSegment._moments;
 
-    assert(_Sz > 0);
-    assert(_Sxs > 0);
-    assert(_Sys > 0);
-    assert(_Szs > 0);
+    assert(_moments[Sz] > 0);
+    assert(_moments[Sxs] > 0);
+    assert(_moments[Sys] > 0);
+    assert(_moments[Szs] > 0);
 
     _pointCount += planeSegment._pointCount;
 }
 
 matrix33 Plane_Segment::get_point_cloud_covariance() const
 {
-    const matrix33 pointCloudHessian({{_Sxs, _Sxy, _Szx}, {_Sxy, _Sys, _Syz}, {_Szx, _Syz, _Szs}});
+    const matrix33 pointCloudHessian({{_moments[Sxs], _moments[Sxy], _moments[Szx]},
+                                      {_moments[Sxy], _moments[Sys], _moments[Syz]},
+                                      {_moments[Szx], _moments[Syz], _moments[Szs]}});
 
     // 0 determinant cannot be inverted
     assert(not utils::double_equal(pointCloudHessian.determinant(), 0.0));
@@ -210,17 +228,17 @@ matrix33 Plane_Segment::get_point_cloud_Huygen_covariance() const noexcept
     // diagonal
     // The diagonal should always be >= 0 (Cauchy Schwarz)
     // Here it's not always the case because of floating point error accumulation
-    const double xxCovariance = std::max(0.0, _Sxs - SQR(_Sx) * oneOverCount);
-    const double yyCovariance = std::max(0.0, _Sys - SQR(_Sy) * oneOverCount);
-    const double zzCovariance = std::max(0.0, _Szs - SQR(_Sz) * oneOverCount);
+    const double xxCovariance = std::max(0.0, _moments[Sxs] - SQR(_moments[Sx]) * oneOverCount);
+    const double yyCovariance = std::max(0.0, _moments[Sys] - SQR(_moments[Sy]) * oneOverCount);
+    const double zzCovariance = std::max(0.0, _moments[Szs] - SQR(_moments[Sz]) * oneOverCount);
     assert(xxCovariance >= 0);
     assert(yyCovariance >= 0);
     assert(zzCovariance >= 0);
 
     // bottom/top half. As above, this too will have floating point error accumulation but nothing we can do about it
-    const double xyCovariance = _Sxy - _Sx * _Sy * oneOverCount;
-    const double xzCovariance = _Szx - _Sx * _Sz * oneOverCount;
-    const double yzCovariance = _Syz - _Sy * _Sz * oneOverCount;
+    const double xyCovariance = _moments[Sxy] - _moments[Sx] * _moments[Sy] * oneOverCount;
+    const double xzCovariance = _moments[Szx] - _moments[Sx] * _moments[Sz] * oneOverCount;
+    const double yzCovariance = _moments[Syz] - _moments[Sy] * _moments[Sz] * oneOverCount;
 
     // Expressing covariance as E[PP^t] + E[P]*E[P^T]: König-Huygen formula
     matrix33 covariance({{xxCovariance, xyCovariance, xzCovariance},
@@ -237,7 +255,7 @@ void Plane_Segment::fit_plane() noexcept
     const double oneOverCount = 1.0 / static_cast<double>(_pointCount);
 
     // get the centroid of the plane
-    _centroid << vector3(_Sx, _Sy, _Sz) * oneOverCount;
+    _centroid << _moments.head<3>() * oneOverCount;
 
     const matrix33 pointCloudCov = get_point_cloud_Huygen_covariance();
     // special case: degenerate covariance
@@ -256,7 +274,7 @@ void Plane_Segment::fit_plane() noexcept
 
     /** Alternative plane parameter computation
     const matrix33& pcc = get_point_cloud_covariance();
-    const vector3 e(-_Sx, -_Sy, -_Sz);
+    const vector3 e = -_moments.head<3>();
     const vector3 params = (pcc * e).transpose();
     const vector3 normal = params / params.norm();
     const double d = 1.0 / params.norm();
@@ -298,15 +316,7 @@ void Plane_Segment::clear_plane_parameters() noexcept
     _parametrization = PlaneCoordinates();
 
     // Clear saved plane parameters
-    _Sx = 0;
-    _Sy = 0;
-    _Sz = 0;
-    _Sxs = 0;
-    _Sys = 0;
-    _Szs = 0;
-    _Sxy = 0;
-    _Syz = 0;
-    _Szx = 0;
+    _moments.setZero();
 }
 
 double Plane_Segment::get_cos_angle(const Plane_Segment& p) const noexcept
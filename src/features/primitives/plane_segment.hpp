@@ -35,11 +35,46 @@ class Plane_Segment
         _cellWidth = cellWidth;
         _cellHeight = _ptsPerCellCount / _cellWidth;
 
+        // the far range cells are fitted on one pixel every sample step, in rows and columns
+        constexpr uint sampleStep = parameters::detection::farRangeCellSampleStep_px;
+        _farRangeSampledWidth = (_cellWidth + sampleStep - 1) / sampleStep;
+        _farRangeSampledHeight = (_cellHeight + sampleStep - 1) / sampleStep;
+        _minFarRangeSampledPointCount = static_cast<uint>(
+                std::floor(static_cast<float>(_farRangeSampledWidth * _farRangeSampledHeight) *
+                           parameters::detection::minimumZeroDepthProportion));
+
         _isStaticSet = true;
     }
 
+    /**
+     * \brief Compute the moments of a planar cell and fit a plane to it
+     * \param[in] depthCloudArray The organized cloud of points
+     * \param[in] cellId The index of this cell in the organized cloud
+     */
     void init_plane_segment(const matrixf& depthCloudArray, const uint cellId) noexcept;
 
+    /**
+     * \brief Compute the moments of a planar cell, without fitting a plane to it.
+     * Cells with too few valid depths are rejected before any other computation, and cells farther than
+     * farRangeCellDepth_mm only accumulate the moments of a subsample of their points
+     * \param[in] depthCloudArray The organized cloud of points
+     * \param[in] cellId The index of this cell in the organized cloud
+     * \return True if the cell is continuous and has enough valid points to be fitted
+     */
+    [[nodiscard]] bool compute_cell_moments(const matrixf& depthCloudArray, const uint cellId) noexcept;
+
+    /**
+     * \brief Fit a plane to the stored moments, and check that the fitting error is compatible with a plane
+     */
+    void fit_cell() noexcept;
+
+    /**
+     * \brief Use the plane fitted on a coarse segment that contains this cell, instead of fitting this cell.
+     * The moments of this cell are kept as is
+     * \param[in] coarseSegment A planar segment, made of this cell and its neighbors
+     */
+    void set_plane_from_coarse_segment(const Plane_Segment& coarseSegment) noexcept;
+
     /**
      * \brief Merge the PCA saved values in prevision of a plane fitting. This function do not make any new plane
      * calculations
@@ -95,17 +130,20 @@ class Plane_Segment
     [[nodiscard]] uint get_point_count() const noexcept { return _pointCount; };
 
   protected:
+    // view of the depths of a cell in the organized cloud, without copy
+    using Cell_Depths = Eigen::Ref<const Eigen::VectorXf>;
+
     /**
      * \brief Check that the point cloud for this plane patch is verticaly continuous
-     * \param[in] depthMatrix The depth representation of the image
+     * \param[in] depthMatrix The depths of the cell points, row by row
      */
-    [[nodiscard]] bool is_cell_vertical_continuous(const matrixf& depthMatrix) const noexcept;
+    [[nodiscard]] bool is_cell_vertical_continuous(const Cell_Depths& depthMatrix) const noexcept;
 
     /**
      * \brief Check that the point cloud for this plane patch is horizontaly continuous
-     * \param[in] depthMatrix The depth representation of the image
+     * \param[in] depthMatrix The depths of the cell points, row by row
      */
-    [[nodiscard]] bool is_cell_horizontal_continuous(const matrixf& depthMatrix) const noexcept;
+    [[nodiscard]] bool is_cell_horizontal_continuous(const Cell_Depths& depthMatrix) const noexcept;
 
     /**
      * \brief return the covariance of this point cloud computed from König-Huygen formula
@@ -117,6 +155,9 @@ class Plane_Segment
     static inline uint _minZeroPointCount; // min acceptable zero points in a node
     static inline uint _cellWidth;
     static inline uint _cellHeight;
+    static inline uint _farRangeSampledWidth;         // cell width, in sampled points, of the far range cells
+    static inline uint _farRangeSampledHeight;        // cell height, in sampled points, of the far range cells
+    static inline uint _minFarRangeSampledPointCount; // min acceptable sampled points in a far range node
     static inline bool _isStaticSet = false;
 
     uint _pointCount = 0;                             // point count
@@ -127,16 +168,22 @@ class Plane_Segment
     CameraCoordinate _centroid; // mean point of all points in node
     PlaneCoordinates _parametrization;
 
-    // PCA stored coeffs: efficient calculations of point cloud characteristics
-    double _Sx = 0.0;  // sum of x
-    double _Sy = 0.0;  // sum of y
-    double _Sz = 0.0;  // sum of z
-    double _Sxs = 0.0; // sum of x squared
-    double _Sys = 0.0; // sum of y squared
-    double _Szs = 0.0; // sum of z squared
-    double _Sxy = 0.0; // sum of x*y
-    double _Syz = 0.0; // sum of y*z
-    double _Szx = 0.0; // sum of z*x
+    // PCA stored coeffs: efficient calculations of point cloud characteristics.
+    // Stored contiguously so merging two segments is a single vector addition
+    enum Moment
+    {
+        Sx = 0,  // sum of x
+        Sy = 1,  // sum of y
+        Sz = 2,  // sum of z
+        Sxs = 3, // sum of x squared
+        Sys = 4, // sum of y squared
+        Szs = 5, // sum of z squared
+        Sxy = 6, // sum of x*y
+        Syz = 7, // sum of y*z
+        Szx = 8  // sum of z*x
+    };
+    using moment_vector = Eigen::Matrix<double, 9, 1>;
+    moment_vector _moments = moment_vector::Zero();
 
     // prevent backend copy
     Plane_Segment& operator=(const Plane_Segment& seg);
@@ -1,6 +1,7 @@
 #include "primitive_detection.hpp"
 #include "../../outputs/logger.hpp"
 #include "../../parameters.hpp"
+#include "../../utils/union_find.hpp"
 #include "cylinder_segment.hpp"
 #include "plane_segment.hpp"
 #include "shape_primitives.hpp"
@@ -10,23 +11,26 @@
 #include <bits/ranges_algo.h>
 #include <cstddef>
 #include <limits>
-#include <mutex>
 #include <opencv2/core.hpp>
 #include <opencv2/core/base.hpp>
 #include <opencv2/core/hal/interface.h>
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
+#include <tbb/parallel_for.h>
 
 namespace rgbd_slam::features::primitives {
 
 // namespace simplifcation
 constexpr uint blocSize = parameters::detection::depthMapPatchSize_px;
 constexpr uint pointsPerCellCount = SQR(blocSize);
+constexpr uint coarseBlocFactor = parameters::detection::depthMapCoarsePatchFactor;
 
 Primitive_Detection::Primitive_Detection(const uint width, const uint height) :
     _horizontalCellsCount(width / blocSize),
     _verticalCellsCount(height / blocSize),
-    _totalCellCount(_verticalCellsCount * _horizontalCellsCount)
+    _totalCellCount(_verticalCellsCount * _horizontalCellsCount),
+    _coarseHorizontalCellsCount((_horizontalCellsCount + coarseBlocFactor - 1) / coarseBlocFactor),
+    _coarseVerticalCellsCount((_verticalCellsCount + coarseBlocFactor - 1) / coarseBlocFactor)
 {
     assert(blocSize > 0);
     assert(width > 0);
@@ -35,23 +39,23 @@ Primitive_Detection::Primitive_Detection(const uint width, const uint height) :
     // Init variables
     _isUnassignedMask = vectorb::Zero(_totalCellCount);
     _cellDistanceTols.assign(_totalCellCount, 0.0f);
+    _hasCellMoments = vectorb::Zero(_totalCellCount);
+    // each activated cell pushes at most 4 neighbours
+    _regionGrowingStack.reserve(4 * static_cast<size_t>(_totalCellCount));
+    // each labelled cell records at most 4 neighbouring planes
+    _planeAdjacencies.reserve(4 * static_cast<size_t>(_totalCellCount));
 
     _gridPlaneSegmentMap =
             cv::Mat_<int>(static_cast<int>(_verticalCellsCount), static_cast<int>(_horizontalCellsCount), 0);
     _gridCylinderSegMap =
             cv::Mat_<int>(static_cast<int>(_verticalCellsCount), static_cast<int>(_horizontalCellsCount), 0);
 
-    _mask = cv::Mat_<uchar>(static_cast<int>(_verticalCellsCount), static_cast<int>(_horizontalCellsCount));
-    _maskEroded = cv::Mat_<uchar>(static_cast<int>(_verticalCellsCount), static_cast<int>(_horizontalCellsCount));
-    _maskDilated = cv::Mat_<uchar>(static_cast<int>(_verticalCellsCount), static_cast<int>(_horizontalCellsCount));
-
-    _maskCrossKernel = cv::Mat_<uchar>::ones(3, 3);
-    _maskCrossKernel.at<uchar>(0, 0) = 0;
-    _maskCrossKernel.at<uchar>(2, 2) = 0;
-    _maskCrossKernel.at<uchar>(0, 2) = 0;
-    _maskCrossKernel.at<uchar>(2, 0) = 0;
-
-    _maskSquareKernel = cv::Mat_<uchar>::ones(3, 3);
+    _mask = Cell_Mask(_horizontalCellsCount, _verticalCellsCount);
+    _maskEroded = Cell_Mask(_horizontalCellsCount, _verticalCellsCount);
+    _maskDilated = Cell_Mask(_horizontalCellsCount, _verticalCellsCount);
+    _maskBoundary = Cell_Mask(_horizontalCellsCount, _verticalCellsCount);
+    // at most one boundary point per cell
+    _boundaryPoints.reserve(_totalCellCount);
 
     // set before anything related to planar cells
     Plane_Segment::set_static_members(blocSize, pointsPerCellCount);
@@ -64,6 +68,12 @@ Primitive_Detection::Primitive_Detection(const uint width, const uint height) :
         // fill with empty nodes
         _planeGrid.push_back(defaultPlaneSegment);
     }
+    const size_t coarseCellCount = static_cast<size_t>(_coarseHorizontalCellsCount) * _coarseVerticalCellsCount;
+    _coarsePlaneGrid.reserve(coarseCellCount);
+    for (size_t i = 0; i < coarseCellCount; ++i)
+    {
+        _coarsePlaneGrid.push_back(defaultPlaneSegment);
+    }
 }
 
 void Primitive_Detection::show_statistics(const double meanFrameTreatmentDuration,
@@ -116,8 +126,24 @@ void Primitive_Detection::show_statistics(const double meanFrameTreatmentDuratio
     }
 }
 
+void Primitive_Detection::warm_up(const matrixf& depthMatrix, const cv::Mat_<float>& depthImage) noexcept
+{
+    plane_container planeContainer;
+    cylinder_container cylinderContainer;
+    find_primitives(depthMatrix, depthImage, tracked_plane_container(), planeContainer, cylinderContainer);
+
+    // the warm up is not part of the statistics
+    _resetTime = 0.0;
+    _initTime = 0.0;
+    _growTime = 0.0;
+    _mergeTime = 0.0;
+    _refineTime = 0.0;
+    _meanPrimitiveTreatmentDuration = 0.0;
+}
+
 void Primitive_Detection::find_primitives(const matrixf& depthMatrix,
                                           const cv::Mat_<float>& depthImage,
+                                          const tracked_plane_container& trackedPlanes,
                                           plane_container& planeContainer,
                                           cylinder_container& primitiveContainer) noexcept
 {
@@ -139,7 +165,7 @@ void Primitive_Detection::find_primitives(const matrixf& depthMatrix,
     _initTime += td;
 
     t1 = cv::getTickCount();
-    const intpair_vector& cylinder2regionMap = grow_planes_and_cylinders(remainingPlanarCells);
+    const intpair_vector& cylinder2regionMap = grow_planes_and_cylinders(trackedPlanes, remainingPlanarCells);
     td = static_cast<double>(cv::getTickCount() - t1) / cv::getTickFrequency();
     _growTime += td;
 
@@ -175,6 +201,7 @@ void Primitive_Detection::reset_data() noexcept
 
     _gridPlaneSegmentMap = 0;
     _gridCylinderSegMap = 0;
+    _planeAdjacencies.clear();
 
     // reset stacked distances
     // activation map do not need to be cleared
@@ -190,13 +217,53 @@ void Primitive_Detection::init_planar_cell_fitting(const matrixf& depthCloudArra
             sinf(static_cast<float>(parameters::detection::maximumPlaneAngleForMerge_d * M_PI / 180.0));
     constexpr float planeMergeDistanceThreshold = parameters::detection::maximumPlaneDistanceForMerge_mm;
 
-    // for each planeGrid cell
-    const size_t planeGridSize = _planeGrid.size();
-    for (size_t stackedCellId = 0; stackedCellId < planeGridSize; ++stackedCellId)
-    {
+    // fit planes on the coarse grid first: all the cell moments are computed here
+    const auto init_coarse_cell = [this, &depthCloudArray](const size_t coarseCellId) {
+        const uint coarseX = static_cast<uint>(coarseCellId % _coarseHorizontalCellsCount);
+        const uint coarseY = static_cast<uint>(coarseCellId / _coarseHorizontalCellsCount);
+
+        Plane_Segment& coarseSegment = _coarsePlaneGrid[coarseCellId];
+        coarseSegment.clear_plane_parameters();
+        bool isCoarseCellComplete = true;
+        const uint endY = std::min((coarseY + 1) * coarseBlocFactor, _verticalCellsCount);
+        const uint endX = std::min((coarseX + 1) * coarseBlocFactor, _horizontalCellsCount);
+        for (uint y = coarseY * coarseBlocFactor; y < endY; ++y)
+        {
+            for (uint x = coarseX * coarseBlocFactor; x < endX; ++x)
+            {
+                const uint cellId = y * _horizontalCellsCount + x;
+                _hasCellMoments[cellId] = _planeGrid[cellId].compute_cell_moments(depthCloudArray, cellId);
+                if (_hasCellMoments[cellId])
+                    coarseSegment.expand_segment(_planeGrid[cellId]);
+                else
+                    isCoarseCellComplete = false;
+            }
+        }
+        // a coarse cell with a missing or discontinuous cell cannot be planar
+        if (isCoarseCellComplete)
+            coarseSegment.fit_cell();
+    };
+
+    // for each planeGrid cell: cells are independent, and each one only writes to its own slot
+    const auto init_cell = [this, &depthCloudArray](const size_t stackedCellId) {
         // init the plane patch
         Plane_Segment& planeSegment = _planeGrid[stackedCellId];
-        planeSegment.init_plane_segment(depthCloudArray, static_cast<uint>(stackedCellId));
+        if constexpr (coarseBlocFactor > 1)
+        {
+            if (_hasCellMoments[stackedCellId])
+            {
+                // inside a coarse plane, the coarse fitting is as good as the cell one
+                const uint coarseCellId = get_coarse_cell_index(static_cast<uint>(stackedCellId));
+                if (is_coarse_cell_interior(coarseCellId))
+                    planeSegment.set_plane_from_coarse_segment(_coarsePlaneGrid[coarseCellId]);
+                else
+                    planeSegment.fit_cell();
+            }
+        }
+        else
+        {
+            planeSegment.init_plane_segment(depthCloudArray, static_cast<uint>(stackedCellId));
+        }
         // if this plane patch is planar, compute the diagonal distance
         if (planeSegment.is_planar())
         {
@@ -218,24 +285,62 @@ void Primitive_Detection::init_planar_cell_fitting(const matrixf& depthCloudArra
         {
             _cellDistanceTols[stackedCellId] = 0;
         }
+    };
+
+    if constexpr (coarseBlocFactor > 1)
+    {
+        const size_t coarsePlaneGridSize = _coarsePlaneGrid.size();
+        tbb::parallel_for(size_t(0), coarsePlaneGridSize, init_coarse_cell);
     }
+
+    const size_t planeGridSize = _planeGrid.size();
+    // parallel loop to speed up the process
+    tbb::parallel_for(size_t(0), planeGridSize, init_cell);
 #if 0
     // use this to debug the initial is_planar function
     // Resize with no interpolation
-    _mask = 0;
+    cv::Mat_<uchar> planarCells(static_cast<int>(_verticalCellsCount), static_cast<int>(_horizontalCellsCount));
     for (uint row = 0, activationIndex = 0; row < _verticalCellsCount; ++row)
     {
         for (uint col = 0; col < _horizontalCellsCount; ++col, ++activationIndex)
         {
-            _mask.at<uchar>(row, col) = _planeGrid[activationIndex].is_planar() * 255;
+            planarCells(static_cast<int>(row), static_cast<int>(col)) = _planeGrid[activationIndex].is_planar() * 255;
         }
     }
     cv::Mat_<uchar> planeMask;
-    cv::resize(_mask, planeMask, cv::Size(640, 480), 0, 0, cv::INTER_NEAREST);
+    cv::resize(planarCells, planeMask, cv::Size(640, 480), 0, 0, cv::INTER_NEAREST);
     cv::imshow("is_depth_continuous", planeMask);
 #endif
 }
 
+uint Primitive_Detection::get_coarse_cell_index(const uint cellId) const noexcept
+{
+    const uint x = cellId % _horizontalCellsCount;
+    const uint y = cellId / _horizontalCellsCount;
+    return (y / coarseBlocFactor) * _coarseHorizontalCellsCount + (x / coarseBlocFactor);
+}
+
+bool Primitive_Detection::is_coarse_cell_interior(const uint coarseCellId) const noexcept
+{
+    const Plane_Segment& coarseSegment = _coarsePlaneGrid[coarseCellId];
+    if (not coarseSegment.is_planar())
+        return false;
+
+    const uint coarseX = coarseCellId % _coarseHorizontalCellsCount;
+    const uint coarseY = coarseCellId / _coarseHorizontalCellsCount;
+    const auto is_same_plane = [this, &coarseSegment](const uint neighborId) {
+        const Plane_Segment& neighborSegment = _coarsePlaneGrid[neighborId];
+        return neighborSegment.is_planar() and
+               coarseSegment.can_be_merged(neighborSegment,
+                                           parameters::detection::maximumPlaneDistanceForMerge_mm);
+    };
+    // the image borders are not plane boundaries
+    return (coarseX == 0 or is_same_plane(coarseCellId - 1)) and
+           (coarseX + 1 >= _coarseHorizontalCellsCount or is_same_plane(coarseCellId + 1)) and
+           (coarseY == 0 or is_same_plane(coarseCellId - _coarseHorizontalCellsCount)) and
+           (coarseY + 1 >= _coarseVerticalCellsCount or is_same_plane(coarseCellId + _coarseHorizontalCellsCount));
+}
+
 uint Primitive_Detection::init_histogram() noexcept
 {
     uint remainingPlanarCells = 0;
@@ -265,11 +370,14 @@ uint Primitive_Detection::init_histogram() noexcept
 }
 
 Primitive_Detection::intpair_vector Primitive_Detection::grow_planes_and_cylinders(
-        const uint remainingPlanarCells) noexcept
+        const tracked_plane_container& trackedPlanes, const uint remainingPlanarCells) noexcept
 {
     intpair_vector cylinder2regionMap;
 
     uint untriedPlanarCellsCount = remainingPlanarCells;
+
+    // warm start: the planes already in the map explain most of the planar cells
+    grow_tracked_planes(trackedPlanes, untriedPlanarCellsCount, cylinder2regionMap);
     // find seed planes and make them grow
     while (untriedPlanarCellsCount > 0)
     {
@@ -309,6 +417,51 @@ Primitive_Detection::intpair_vector Primitive_Detection::grow_planes_and_cylinde
     return cylinder2regionMap;
 }
 
+void Primitive_Detection::grow_tracked_planes(const tracked_plane_container& trackedPlanes,
+                                              uint& untriedPlanarCellsCount,
+                                              intpair_vector& cylinder2regionMap) noexcept
+{
+    static const double minimumCosAngleForMerge =
+            cos(parameters::detection::maximumPlaneAngleForMerge_d * M_PI / 180.0);
+    const uint planeSeedCount = static_cast<uint>(parameters::detection::minimumPlaneSeedProportion * _totalCellCount);
+
+    for (const PlaneCameraCoordinates& trackedPlane: trackedPlanes)
+    {
+        if (untriedPlanarCellsCount == 0)
+            break;
+
+        // find the unassigned planar cells on this tracked plane, and the best seed among them
+        uint explainedCellCount = 0;
+        uint seedId = 0;
+        double minMSE = std::numeric_limits<double>::max();
+        for (uint cellId = 0; cellId < _totalCellCount; ++cellId)
+        {
+            if (not _isUnassignedMask[cellId])
+                continue;
+
+            const Plane_Segment& planeSegment = _planeGrid[cellId];
+            assert(planeSegment.is_planar());
+            if (abs(trackedPlane.get_normal().dot(planeSegment.get_normal())) <= minimumCosAngleForMerge or
+                abs(trackedPlane.get_point_distance(planeSegment.get_centroid())) >= _cellDistanceTols[cellId])
+                continue;
+
+            ++explainedCellCount;
+            const double cellMSE = planeSegment.get_MSE();
+            if (cellMSE < minMSE)
+            {
+                seedId = cellId;
+                minMSE = cellMSE;
+            }
+        }
+
+        // not enough evidence of this plane in this frame: let the histogram search handle those cells
+        if (explainedCellCount < planeSeedCount or explainedCellCount == 0)
+            continue;
+
+        grow_plane_segment_at_seed(seedId, untriedPlanarCellsCount, cylinder2regionMap);
+    }
+}
+
 void Primitive_Detection::grow_plane_segment_at_seed(const uint seedId,
                                                      uint& untriedPlanarCellsCount,
                                                      intpair_vector& cylinder2regionMap) noexcept
@@ -399,17 +552,39 @@ void Primitive_Detection::add_plane_segment_to_features(const Plane_Segment& new
     // mark cells that belong to this plane with a new id
     for (int row = 0, activationIndex = 0; row < static_cast<int>(_verticalCellsCount); ++row)
     {
-        int* rowPtr = _gridPlaneSegmentMap.ptr<int>(row);
         for (int col = 0; col < static_cast<int>(_horizontalCellsCount); ++col, ++activationIndex)
         {
             assert(activationIndex < static_cast<int>(activationMapSize));
 
             if (isActivatedMap[activationIndex])
-                rowPtr[col] = currentPlaneCount;
+                label_plane_cell(row, col, currentPlaneCount);
         }
     }
 }
 
+void Primitive_Detection::label_plane_cell(const int row, const int col, const int planeId) noexcept
+{
+    assert(planeId > 0);
+    _gridPlaneSegmentMap(row, col) = planeId;
+
+    // record the planes already labelled around this cell, lower id first
+    const auto record_adjacency = [this, planeId](const int neighbourId) {
+        if (neighbourId > 0 and neighbourId != planeId)
+        {
+            _planeAdjacencies.emplace_back(static_cast<uint>(std::min(planeId, neighbourId) - 1),
+                                           static_cast<uint>(std::max(planeId, neighbourId) - 1));
+        }
+    };
+    if (row > 0)
+        record_adjacency(_gridPlaneSegmentMap(row - 1, col));
+    if (row < _gridPlaneSegmentMap.rows - 1)
+        record_adjacency(_gridPlaneSegmentMap(row + 1, col));
+    if (col > 0)
+        record_adjacency(_gridPlaneSegmentMap(row, col - 1));
+    if (col < _gridPlaneSegmentMap.cols - 1)
+        record_adjacency(_gridPlaneSegmentMap(row, col + 1));
+}
+
 bool Primitive_Detection::find_plane_segment_in_cylinder(const Cylinder_Segment& cylinderSegment,
                                                          const uint cellActivatedCount,
                                                          const uint segId,
@@ -451,8 +626,9 @@ void Primitive_Detection::add_cylinder_to_features(const Cylinder_Segment& cylin
             if (cylinderSegment.is_inlier_at(segId, col))
             {
                 const int cellId = static_cast<int>(cylinderSegment.get_local_to_global_mapping(col));
-                _gridPlaneSegmentMap.at<int>(cellId / static_cast<int>(_horizontalCellsCount),
-                                             cellId % static_cast<int>(_horizontalCellsCount)) = currentPlaneCount;
+                label_plane_cell(cellId / static_cast<int>(_horizontalCellsCount),
+                                 cellId % static_cast<int>(_horizontalCellsCount),
+                                 currentPlaneCount);
             }
         }
     }
@@ -504,59 +680,27 @@ Primitive_Detection::uint_vector Primitive_Detection::merge_planes() noexcept
 {
     const uint planeCount = static_cast<uint>(_planeSegments.size());
 
-    Matrixb isPlanesConnectedMatrix = get_connected_components_matrix(_gridPlaneSegmentMap, planeCount);
-    assert(isPlanesConnectedMatrix.rows() == isPlanesConnectedMatrix.cols());
-
-    uint_vector planeMergeLabels;
-    planeMergeLabels.reserve(planeCount);
-    for (uint planeIndex = 0; planeIndex < planeCount; ++planeIndex)
-    {
-        // We use planes indexes as ids
-        planeMergeLabels.emplace_back(planeIndex);
-    }
-
-    const uint isPlanesConnectedMatrixRows = static_cast<uint>(isPlanesConnectedMatrix.rows());
-    const uint isPlanesConnectedMatrixCols = static_cast<uint>(isPlanesConnectedMatrix.cols());
-    for (uint row = 0; row < isPlanesConnectedMatrixRows; ++row)
-    {
-        bool wasPlaneExpanded = false;
-        const uint planeId = planeMergeLabels[row];
-        Plane_Segment& planeToExpand = _planeSegments[planeId];
+    // every adjacent pair was recorded once per touching cell border
+    std::sort(_planeAdjacencies.begin(), _planeAdjacencies.end());
+    _planeAdjacencies.erase(std::unique(_planeAdjacencies.begin(), _planeAdjacencies.end()), _planeAdjacencies.end());
+
+    // pairs are sorted by lower plane index, so a plane absorbs its neighbours in the same order as a row scan. The
+    // group with the lowest index absorbs the other one
+    return utils::merge_adjacent_groups(planeCount, _planeAdjacencies, [this](const uint rootId, const uint mergedId) {
+        Plane_Segment& planeToExpand = _planeSegments[rootId];
+        const Plane_Segment& mergePlane = _planeSegments[mergedId];
+        // normals are close enough, distance is small enough
+        if (not planeToExpand.is_planar() or not mergePlane.is_planar() or
+            not planeToExpand.can_be_merged(mergePlane, parameters::detection::maximumPlaneDistanceForMerge_mm))
+            return false;
+
+        // merge plane segments
+        planeToExpand.expand_segment(mergePlane);
+        planeToExpand.fit_plane();
         if (not planeToExpand.is_planar())
-            continue;
-
-        for (uint col = row + 1; col < isPlanesConnectedMatrixCols; ++col)
-        {
-            if (not isPlanesConnectedMatrix(row, col))
-                continue;
-
-            const Plane_Segment& mergePlane = _planeSegments[col];
-            if (not mergePlane.is_planar())
-                continue;
-
-            // normals are close enough, distance is small enough
-            if (planeToExpand.can_be_merged(mergePlane, parameters::detection::maximumPlaneDistanceForMerge_mm))
-            {
-                // merge plane segments
-                planeToExpand.expand_segment(mergePlane);
-                planeMergeLabels[col] = planeId;
-                wasPlaneExpanded = true;
-            }
-            else
-            {
-                isPlanesConnectedMatrix(row, col) = false;
-                isPlanesConnectedMatrix(col, row) = false;
-            }
-        }
-        if (wasPlaneExpanded) // plane was merged with other planes
-        {
-            planeToExpand.fit_plane();
-            if (not planeToExpand.is_planar())
-                outputs::log("Plane segment is not planar after merge");
-        }
-    }
-
-    return planeMergeLabels;
+            outputs::log("Plane segment is not planar after merge");
+        return true;
+    });
 }
 
 void Primitive_Detection::add_planes_to_primitives(const uint_vector& planeMergeLabels,
@@ -571,6 +715,24 @@ void Primitive_Detection::add_planes_to_primitives(const uint_vector& planeMerge
     cv::Mat debugImage(depthImage.size(), CV_8UC3, cv::Scalar(0, 0, 0));
 #endif
 
+    // the cells of each merged plane, in a single pass over the segment map
+    if (_planeMasks.size() < planeCount)
+        _planeMasks.resize(planeCount, Cell_Mask(_horizontalCellsCount, _verticalCellsCount));
+    for (uint planeIndex = 0; planeIndex < planeCount; ++planeIndex)
+    {
+        if (planeMergeLabels[planeIndex] == planeIndex)
+            _planeMasks[planeIndex].clear();
+    }
+    for (uint row = 0; row < _verticalCellsCount; ++row)
+    {
+        const int* segmentRow = _gridPlaneSegmentMap[static_cast<int>(row)];
+        for (uint col = 0; col < _horizontalCellsCount; ++col)
+        {
+            if (segmentRow[col] > 0)
+                _planeMasks[planeMergeLabels[static_cast<uint>(segmentRow[col] - 1)]].set(col, row);
+        }
+    }
+
     // refine the coarse planes boundaries to smoother versions
     for (uint planeIndex = 0; planeIndex < planeCount; ++planeIndex)
     {
@@ -583,36 +745,31 @@ void Primitive_Detection::add_planes_to_primitives(const uint_vector& planeMerge
         if (not planeSegment.is_planar())
             continue; // not planar segment: TODO: remove ?
 
-        _mask = 0;
-        // add all merged planes to the mask
-        for (uint j = planeIndex; j < planeCount; ++j)
-        {
-            if (planeMergeLabels[j] == planeMergeLabel)
-            {
-                _mask.setTo(1, _gridPlaneSegmentMap == (j + 1));
-            }
-        }
+        // all the cells of the merged planes
+        const Cell_Mask& planeMask = _planeMasks[planeIndex];
 #ifdef DEBUG_DETECTED_POLYGONS
-        cv::erode(_mask, _maskEroded, _maskCrossKernel, cv::Point(-1, -1), 1, cv::BORDER_CONSTANT, cv::Scalar(0));
+        planeMask.erode_cross(_maskEroded, false);
         // dilate to get boundaries
-        cv::dilate(_mask, _maskDilated, _maskSquareKernel);
-        const cv::Mat_<uchar>& maskBoundary = _maskDilated - _maskEroded;
+        planeMask.dilate_square(_maskDilated);
+        _maskDilated -= _maskEroded;
 
-        const uint pixelPerCellSide = static_cast<uint>(sqrtf(static_cast<float>(pointsPerCellCount)));
+        const int pixelPerCellSide = static_cast<int>(sqrtf(static_cast<float>(pointsPerCellCount)));
         cv::Scalar color(utils::Random::get_random_uint(256),
                          utils::Random::get_random_uint(256),
                          utils::Random::get_random_uint(256));
-        maskBoundary.forEach([&debugImage, &color, &pixelPerCellSide](const uchar value, const int position[]) {
-            if (value > 0)
-                cv::rectangle(debugImage,
-                              cv::Point(position[1] * pixelPerCellSide, position[0] * pixelPerCellSide),
-                              cv::Point((position[1] + 1) * pixelPerCellSide, (position[0] + 1) * pixelPerCellSide),
-                              color,
-                              -1);
+        _maskDilated.for_each_set_cell([&debugImage, &color, &pixelPerCellSide](const uint x, const uint y) {
+            const int col = static_cast<int>(x);
+            const int row = static_cast<int>(y);
+            cv::rectangle(debugImage,
+                          cv::Point(col * pixelPerCellSide, row * pixelPerCellSide),
+                          cv::Point((col + 1) * pixelPerCellSide, (row + 1) * pixelPerCellSide),
+                          color,
+                          -1);
         });
 #endif
         // get the ordered boundary points
-        const std::vector<vector3>& orderedBoundary = compute_plane_segment_boundary(planeSegment, depthImage, _mask);
+        const std::span<const vector3> orderedBoundary =
+                compute_plane_segment_boundary(planeSegment, depthImage, planeMask);
         if (orderedBoundary.size() < 3)
         {
             outputs::log_warning("Could not find a correct boundary polygon, rejecting plane segment");
@@ -624,7 +781,7 @@ void Primitive_Detection::add_planes_to_primitives(const uint_vector& planeMerge
         if (polygon.is_valid(debug) and polygon.boundary_length() >= 3)
         {
             // add new plane to final shapes
-            planeContainer.emplace_back(planeSegment, polygon);
+            planeContainer.emplace_back(planeSegment, polygon, planeMask);
         }
         else
         {
@@ -647,59 +804,52 @@ void Primitive_Detection::add_planes_to_primitives(const uint_vector& planeMerge
 #endif
 }
 
-std::vector<vector3> Primitive_Detection::compute_plane_segment_boundary(const Plane_Segment& planeSegment,
-                                                                         const cv::Mat_<float>& depthImage,
-                                                                         const cv::Mat_<uchar>& mask) const noexcept
+std::span<const vector3> Primitive_Detection::compute_plane_segment_boundary(const Plane_Segment& planeSegment,
+                                                                             const cv::Mat_<float>& depthImage,
+                                                                             const Cell_Mask& mask) noexcept
 {
-    std::vector<vector3> boundaryPoints;
-    std::mutex mut;
+    // reuse the buffer of the last call: no allocation once it reached its capacity
+    _boundaryPoints.clear();
 
     const double maxBoundaryDistance = 3 * sqrt(planeSegment.get_MSE());
     static const uint pixelPerCellSide = static_cast<uint>(sqrtf(static_cast<float>(pointsPerCellCount)));
 
-    auto add_point_if_in_plane =
-            [&planeSegment, &maxBoundaryDistance, &depthImage, &boundaryPoints, &mut](const int x, const int y) {
-                const double depth = depthImage(y, x);
-                if (depth > 0)
-                {
-                    const auto& cameraPoint = ScreenCoordinate(x, y, depth).to_camera_coordinates();
-                    // if distance of this point to the plane < threshold, this point is contained in the plane
-                    if (abs(planeSegment.get_point_distance(cameraPoint)) < maxBoundaryDistance)
-                    {
-                        std::scoped_lock<std::mutex> lock(mut);
-                        boundaryPoints.emplace_back(cameraPoint);
-                        return true;
-                    }
-                }
-                return false;
-            };
+    auto add_point_if_in_plane = [this, &planeSegment, &maxBoundaryDistance, &depthImage](const int x, const int y) {
+        const double depth = depthImage(y, x);
+        if (depth > 0)
+        {
+            const auto& cameraPoint = ScreenCoordinate(x, y, depth).to_camera_coordinates();
+            // if distance of this point to the plane < threshold, this point is contained in the plane
+            if (abs(planeSegment.get_point_distance(cameraPoint)) < maxBoundaryDistance)
+            {
+                _boundaryPoints.emplace_back(cameraPoint);
+                return true;
+            }
+        }
+        return false;
+    };
 
     // erode, considering that the border is empty space
-    cv::erode(mask, _maskEroded, _maskCrossKernel, cv::Point(-1, -1), 1, cv::BORDER_CONSTANT, cv::Scalar(0));
+    mask.erode_cross(_maskEroded, false);
     // dilate the original mask
-    cv::dilate(mask, _maskDilated, _maskSquareKernel);
+    mask.dilate_square(_maskBoundary);
     // result boundary is in the difference of both
-    const cv::Mat_<uchar>& resultBoundary = _maskDilated - _maskEroded;
-
-    boundaryPoints.reserve(cv::countNonZero(resultBoundary));
+    _maskBoundary -= _maskEroded;
 
     // here we just take the center point of the cell and add it if it is inside the plane.
     // simplified contour can produce misses and eliminate planes with just no luck, but it's fast !
     // The boundaries are not as good as the other method, but the merging step can conpensate a bit
 
-    // Cell refinement
-    resultBoundary.forEach([&add_point_if_in_plane](const uchar value, const int position[]) {
-        // cell is not in boundary, pass
-        if (value <= 0)
-            return;
-
+    // Cell refinement: a few hundred cells at most, a serial scan is cheaper than a parallel one, and keeps the
+    // boundary order stable
+    _maskBoundary.for_each_set_cell([&add_point_if_in_plane](const uint col, const uint row) {
         // only check and add the center cell of this plane (can fail due to noise sometime...)
-        const int centerX = static_cast<int>(position[1] * pixelPerCellSide + pixelPerCellSide / 2);
-        const int centerY = static_cast<int>(position[0] * pixelPerCellSide + pixelPerCellSide / 2);
+        const int centerX = static_cast<int>(col * pixelPerCellSide + pixelPerCellSide / 2);
+        const int centerY = static_cast<int>(row * pixelPerCellSide + pixelPerCellSide / 2);
         add_point_if_in_plane(centerX, centerY);
     });
 
-    return boundaryPoints;
+    return _boundaryPoints;
 }
 
 void Primitive_Detection::add_cylinders_to_primitives(const intpair_vector& cylinderToRegionMap,
@@ -712,18 +862,24 @@ void Primitive_Detection::add_cylinders_to_primitives(const intpair_vector& cyli
     for (uint cylinderIndex = 0; cylinderIndex < numberOfCylinder; ++cylinderIndex)
     {
         // Build mask
-        _mask = 0;
-        _mask.setTo(1, _gridCylinderSegMap == (cylinderIndex + 1));
-
-        // Opening
-        cv::dilate(_mask, _mask, _maskCrossKernel);
-        cv::erode(_mask, _mask, _maskCrossKernel);
-        cv::erode(_mask, _maskEroded, _maskCrossKernel);
-        double min;
-        double max;
-        cv::minMaxLoc(_maskEroded, &min, &max);
-
-        if (max <= 0 or min >= max) // completely eroded: irrelevant cylinder
+        _mask.clear();
+        const int cylinderLabel = static_cast<int>(cylinderIndex + 1);
+        for (uint row = 0; row < _verticalCellsCount; ++row)
+        {
+            const int* segmentRow = _gridCylinderSegMap[static_cast<int>(row)];
+            for (uint col = 0; col < _horizontalCellsCount; ++col)
+            {
+                if (segmentRow[col] == cylinderLabel)
+                    _mask.set(col, row);
+            }
+        }
+
+        // Closing, then erosion (the outside does not erode)
+        _mask.dilate_cross(_maskDilated);
+        _maskDilated.erode_cross(_mask, true);
+        _mask.erode_cross(_maskEroded, true);
+
+        if (_maskEroded.empty() or _maskEroded.is_full()) // completely eroded: irrelevant cylinder
             continue;
 
         const uint regId = cylinderToRegionMap[cylinderIndex].first;
@@ -733,48 +889,6 @@ void Primitive_Detection::add_cylinders_to_primitives(const intpair_vector& cyli
     }
 }
 
-Matrixb Primitive_Detection::get_connected_components_matrix(const cv::Mat_<int>& segmentMap,
-                                                             const size_t numberOfPlanes) const noexcept
-{
-    assert(segmentMap.rows > 0);
-    assert(segmentMap.cols > 0);
-
-    Matrixb isPlanesConnectedMatrix =
-            Matrixb::Constant(static_cast<int>(numberOfPlanes), static_cast<int>(numberOfPlanes), false);
-    if (numberOfPlanes == 0)
-        return isPlanesConnectedMatrix;
-
-    const int rows2scanCount = segmentMap.rows - 1;
-    const int cols2scanCount = segmentMap.cols - 1;
-    for (int row = 0; row < rows2scanCount; ++row)
-    {
-        const int* rowPtr = segmentMap.ptr<int>(row);
-        const int* rowBelowPtr = segmentMap.ptr<int>(row + 1);
-        for (int col = 0; col < cols2scanCount; ++col)
-        {
-            // value of the pixel at this coordinates. Represents a plane segment
-            const int planeId = rowPtr[col];
-            if (planeId <= 0)
-                continue;
-
-            const int nextPlaneId = rowPtr[col + 1];
-            const int belowPlaneId = rowBelowPtr[col];
-            if (nextPlaneId > 0 and planeId != nextPlaneId)
-            {
-                isPlanesConnectedMatrix(planeId - 1, nextPlaneId - 1) = true;
-                isPlanesConnectedMatrix(nextPlaneId - 1, planeId - 1) = true;
-            }
-            if (belowPlaneId > 0 and planeId != belowPlaneId)
-            {
-                isPlanesConnectedMatrix(planeId - 1, belowPlaneId - 1) = true;
-                isPlanesConnectedMatrix(belowPlaneId - 1, planeId - 1) = true;
-            }
-        }
-    }
-
-    return isPlanesConnectedMatrix;
-}
-
 void Primitive_Detection::region_growing(const uint x,
                                          const uint y,
                                          const Plane_Segment& planeToExpand,
@@ -783,38 +897,61 @@ void Primitive_Detection::region_growing(const uint x,
     assert(isActivatedMap.size() == _isUnassignedMask.size());
     assert(_horizontalCellsCount > 0);
 
-    const int index = static_cast<int>(x + _horizontalCellsCount * y);
-    if (static_cast<size_t>(index) >= _totalCellCount)
+    const uint seedIndex = x + _horizontalCellsCount * y;
+    if (seedIndex >= _totalCellCount)
     {
         outputs::log_error("Reached onvalid index while parsingf neigthbors");
         return;
     }
 
-    assert(index < isActivatedMap.size());
-    assert(index < _isUnassignedMask.size());
-    if ((not _isUnassignedMask[index]) or isActivatedMap[index])
-        // pixel is not part of a component or already labelled, or not a plane (_isUnassignedMask is always false
-        // for non planar patches)
+    // pixel is not part of a component or already labelled, or not a plane (_isUnassignedMask is always false
+    // for non planar patches)
+    const auto can_be_activated = [this, &isActivatedMap](const uint index) {
+        assert(index < isActivatedMap.size());
+        assert(index < _isUnassignedMask.size());
+        return _isUnassignedMask[index] and not isActivatedMap[index];
+    };
+
+    if (not can_be_activated(seedIndex) or
+        not planeToExpand.can_be_merged(_planeGrid[seedIndex], _cellDistanceTols[seedIndex]))
         return;
 
-    assert(static_cast<size_t>(index) < _planeGrid.size());
-    const Plane_Segment& planePatch = _planeGrid[index];
-    if (planeToExpand.can_be_merged(planePatch, _cellDistanceTols[index]))
-    {
+    // Explicit stack of (cell to test, neighbour cell that reached it): the merge test is done against the neighbour.
+    // The grown region is the same as with recursive calls, but the depth of the stack is bounded by the cell count
+    _regionGrowingStack.clear();
+    const auto activate = [this, &isActivatedMap](const uint index) {
         // mark this plane as merged
         isActivatedMap[index] = true;
 
-        // Now label the 4 neighbours:
-        if (x > 0)
-            region_growing(x - 1, y, planePatch, isActivatedMap); // left  pixel
-        if (x < _horizontalCellsCount - 1)
-            region_growing(x + 1, y, planePatch, isActivatedMap); // right pixel
-        if (y > 0)
-            region_growing(x, y - 1, planePatch, isActivatedMap); // upper pixel
-        if (y < _verticalCellsCount - 1)
-            region_growing(x, y + 1, planePatch, isActivatedMap); // lower pixel
+        // Now push the 4 neighbours
+        const uint cellX = index % _horizontalCellsCount;
+        const uint cellY = index / _horizontalCellsCount;
+        if (cellX > 0)
+            _regionGrowingStack.emplace_back(index - 1, index); // left  pixel
+        if (cellX < _horizontalCellsCount - 1)
+            _regionGrowingStack.emplace_back(index + 1, index); // right pixel
+        if (cellY > 0)
+            _regionGrowingStack.emplace_back(index - _horizontalCellsCount, index); // upper pixel
+        if (cellY < _verticalCellsCount - 1)
+            _regionGrowingStack.emplace_back(index + _horizontalCellsCount, index); // lower pixel
+    };
+
+    activate(seedIndex);
+    while (not _regionGrowingStack.empty())
+    {
+        const auto [index, neighbourIndex] = _regionGrowingStack.back();
+        _regionGrowingStack.pop_back();
+
+        if (not can_be_activated(index))
+            continue;
+
+        assert(index < _planeGrid.size());
+        if (_planeGrid[neighbourIndex].can_be_merged(_planeGrid[index], _cellDistanceTols[index]))
+        {
+            activate(index);
+        }
+        // else: do not merge this plane segment
     }
-    // else: do not merge this plane segment
 }
 
 } // namespace rgbd_slam::features::primitives
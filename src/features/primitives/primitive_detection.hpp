@@ -2,11 +2,13 @@
 #define RGBDSLAM_FEATURES_PRIMITIVES_PRIMITIVEDETECTION_HPP
 
 #include "../../types.hpp"
+#include "cell_mask.hpp"
 #include "cylinder_segment.hpp"
 #include "histogram.hpp"
 #include "plane_segment.hpp"
 #include "shape_primitives.hpp"
 #include <opencv2/opencv.hpp>
+#include <span>
 #include <vector>
 
 namespace rgbd_slam::features::primitives {
@@ -36,14 +38,25 @@ class Primitive_Detection
      * \brief Main compute function: computes the primitives in the depth imahe
      * \param[in] depthMatrix Organized cloud of points, constructed from depth map
      * \param[in] depthImage The depth map used to construct depthMatrix
+     * \param[in] trackedPlanes Map planes in the predicted camera space. Their planar cells are grown first, before
+     * the histogram seed search of the remaining cells
      * \param[out] planeContainer Container of detected planes in depth image
      * \param[out] primitiveContainer Container of detected cylinders in depth image
      */
     void find_primitives(const matrixf& depthMatrix,
                          const cv::Mat_<float>& depthImage,
+                         const tracked_plane_container& trackedPlanes,
                          plane_container& planeContainer,
                          cylinder_container& primitiveContainer) noexcept;
 
+    /**
+     * \brief Run a synthetic frame through the detection, so the cell and mask buffers are allocated and touched before
+     * the first real frame. The statistics are reset after
+     * \param[in] depthMatrix Organized cloud of points of a synthetic depth map, with the size of the real frames
+     * \param[in] depthImage The synthetic depth map used to construct depthMatrix
+     */
+    void warm_up(const matrixf& depthMatrix, const cv::Mat_<float>& depthImage) noexcept;
+
     void show_statistics(const double meanFrameTreatmentDuration,
                          const uint frameCount,
                          const bool shouldDisplayDetails = false) const noexcept;
@@ -55,11 +68,25 @@ class Primitive_Detection
     void reset_data() noexcept;
 
     /**
-     * \brief Init planeGrid and cellDistanceTols
+     * \brief Init planeGrid and cellDistanceTols. Planes are fitted on the coarse grid first, and the cells are only
+     * fitted on their own near the coarse plane boundaries
      * \param[in] depthCloudArray Organized point cloud extracted from depth images
      */
     void init_planar_cell_fitting(const matrixf& depthCloudArray) noexcept;
 
+    /**
+     * \param[in] cellId Index of a cell of the plane grid
+     * \return The index of the coarse cell containing this cell
+     */
+    [[nodiscard]] uint get_coarse_cell_index(const uint cellId) const noexcept;
+
+    /**
+     * \brief A coarse cell is interior if it is planar, and all its neighbors are planar and mergeable with it
+     * \param[in] coarseCellId Index of a cell of the coarse plane grid
+     * \return True if the cells of this coarse cell can use the coarse plane fitting
+     */
+    [[nodiscard]] bool is_coarse_cell_interior(const uint coarseCellId) const noexcept;
+
     /**
      * \brief Initialize and fill the histogram bins
      * \return  Number of initial planar surfaces
@@ -68,10 +95,23 @@ class Primitive_Detection
 
     /**
      * \brief grow planes and find cylinders from those planes
+     * \param[in] trackedPlanes Map planes in camera space, used as first seeds
      * \param[in] remainingPlanarCells Unmatched plane count
      * \return A container that associates a cylinder ID with all the planes IDs that composes it
      */
-    [[nodiscard]] intpair_vector grow_planes_and_cylinders(const uint remainingPlanarCells) noexcept;
+    [[nodiscard]] intpair_vector grow_planes_and_cylinders(const tracked_plane_container& trackedPlanes,
+                                                           const uint remainingPlanarCells) noexcept;
+
+    /**
+     * \brief Grow the planar cells explained by the tracked planes, seeding from the best cell on each tracked plane
+     * \param[in] trackedPlanes Map planes in camera space
+     * \param[in, out] untriedPlanarCellsCount Count of planar cells that have not been tested for merge yet
+     * \param[in, out] cylinder2regionMap A container that associates a cylinder ID with all the planes IDs that
+     * composes it
+     */
+    void grow_tracked_planes(const tracked_plane_container& trackedPlanes,
+                             uint& untriedPlanarCellsCount,
+                             intpair_vector& cylinder2regionMap) noexcept;
 
     /**
      * \brief When given a plan seed, try to make it grow with it's neighboring cells. Try to fit a cylinder to those
@@ -97,12 +137,12 @@ class Primitive_Detection
      * \brief Compute the plane hull in plane coordinates
      * \param[in] planeSegment The plane segment to compute a boundary for
      * \param[in] depthImage The depth image used to create depthMatrix
-     * \param[in] mask The mask of this plane segment in image space
-     * \return The boundary point of the polygon
+     * \param[in] mask The cells of this plane segment
+     * \return The boundary point of the polygon. It is a view of an internal buffer, valid until the next call
      */
-    [[nodiscard]] std::vector<vector3> compute_plane_segment_boundary(const Plane_Segment& planeSegment,
-                                                                      const cv::Mat_<float>& depthImage,
-                                                                      const cv::Mat_<uchar>& mask) const noexcept;
+    [[nodiscard]] std::span<const vector3> compute_plane_segment_boundary(const Plane_Segment& planeSegment,
+                                                                          const cv::Mat_<float>& depthImage,
+                                                                          const Cell_Mask& mask) noexcept;
 
     /**
      * \brief Try to fit a plane to a cylinder
@@ -145,7 +185,8 @@ class Primitive_Detection
                           intpair_vector& cylinder2regionMap) noexcept;
 
     /**
-     * \brief Merge close planes by comparing normals and MSE
+     * \brief Merge close planes by comparing normals and MSE. Only the adjacent plane pairs recorded while labelling
+     * the cells are tested, and merged with a union-find
      *
      * \return Container of merged indexes: associates plane index to other plane index
      */
@@ -172,7 +213,7 @@ class Primitive_Detection
                                      cylinder_container& cylinderContainer) noexcept;
 
     /**
-     * \brief Recursively Grow a plane seed and merge it with it's neighbors
+     * \brief Grow a plane seed and merge it with it's neighbors, with an explicit stack
      *
      * \param[in] x Start X coordinates
      * \param[in] y Start Y coordinates
@@ -185,15 +226,13 @@ class Primitive_Detection
                         vectorb& isActivatedMap) noexcept;
 
     /**
-     * \brief Fill an association matrix that links connected plane components
+     * \brief Label a cell of the plane segment map, and record the planes already labelled around it as adjacent
      *
-     * \param[in] segmentMap
-     * \param[in] numberOfPlanes Number of plane segments in segment map
-     *
-     * \return A symmetrical boolean matrix, indicating if a plane segment is connected to another plane segment
+     * \param[in] row Row of the cell in the segment map
+     * \param[in] col Column of the cell in the segment map
+     * \param[in] planeId Id of the plane (> 0) this cell belongs to
      */
-    [[nodiscard]] Matrixb get_connected_components_matrix(const cv::Mat_<int>& segmentMap,
-                                                          const size_t numberOfPlanes) const noexcept;
+    void label_plane_cell(const int row, const int col, const int planeId) noexcept;
 
   private:
     Histogram<parameters::detection::depthMapPatchSize_px> _histogram;
@@ -201,8 +240,12 @@ class Primitive_Detection
     const uint _horizontalCellsCount;
     const uint _verticalCellsCount;
     const uint _totalCellCount;
+    // grid of depthMapCoarsePatchFactor x depthMapCoarsePatchFactor cells
+    const uint _coarseHorizontalCellsCount;
+    const uint _coarseVerticalCellsCount;
 
     plane_segments_container _planeGrid;
+    plane_segments_container _coarsePlaneGrid;
     plane_segments_container _planeSegments;
     cylinder_segments_container _cylinderSegments;
 
@@ -212,18 +255,26 @@ class Primitive_Detection
     cv::Mat_<int> _gridPlaneSegmentMap;
     // Same, for the cylinders
     cv::Mat_<int> _gridCylinderSegMap;
+    // pairs of adjacent plane indexes (lower first, may contain duplicates), recorded by label_plane_cell
+    std::vector<std::pair<uint, uint>> _planeAdjacencies;
 
     // arrays
     vectorb _isUnassignedMask;
     std::vector<float> _cellDistanceTols;
-
-    // primitive cell mask (preallocated)
-    cv::Mat_<uchar> _mask;
-    cv::Mat_<uchar> _maskEroded;
-    cv::Mat_<uchar> _maskDilated;
-    // kernel
-    cv::Mat_<uchar> _maskCrossKernel;
-    cv::Mat_<uchar> _maskSquareKernel;
+    // true if the cell moments are valid for a plane fitting
+    vectorb _hasCellMoments;
+    // pending (cell, neighbour) pairs of region_growing, preallocated
+    std::vector<std::pair<uint, uint>> _regionGrowingStack;
+
+    // primitive cell masks (preallocated)
+    Cell_Mask _mask;
+    Cell_Mask _maskEroded;
+    Cell_Mask _maskDilated;
+    Cell_Mask _maskBoundary;
+    // cells of each merged plane, filled in a single pass over the segment map (reused between frames)
+    std::vector<Cell_Mask> _planeMasks;
+    // boundary points of the current plane segment (preallocated)
+    std::vector<vector3> _boundaryPoints;
 
     // prevent backend copy
     Primitive_Detection(const Primitive_Detection&);
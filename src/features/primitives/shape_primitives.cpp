@@ -6,6 +6,7 @@
 #include "distance_utils.hpp"
 #include <Eigen/src/Core/Matrix.h>
 #include <Eigen/src/Core/VectorBlock.h>
+#include <algorithm>
 
 namespace rgbd_slam::features::primitives {
 
@@ -45,10 +46,11 @@ double Cylinder::get_distance(const vector3& point) const noexcept
  *        PLANE
  *
  */
-Plane::Plane(const Plane_Segment& planeSeg, const CameraPolygon& boundaryPolygon) :
+Plane::Plane(const Plane_Segment& planeSeg, const CameraPolygon& boundaryPolygon, const Cell_Mask& cellMask) :
     _parametrization(planeSeg.get_normal(), planeSeg.get_plane_d()),
     _pointCloudCovariance(planeSeg.get_point_cloud_covariance()),
-    _boundaryPolygon(boundaryPolygon)
+    _boundaryPolygon(boundaryPolygon),
+    _cellMask(cellMask)
 {
     assert(utils::double_equal(get_normal().norm(), 1.0));
     assert(utils::is_covariance_valid(_pointCloudCovariance));
@@ -58,7 +60,8 @@ Plane::Plane(const Plane_Segment& planeSeg, const CameraPolygon& boundaryPolygon
 Plane::Plane(const Plane& plane) :
     _parametrization(plane._parametrization),
     _pointCloudCovariance(plane._pointCloudCovariance),
-    _boundaryPolygon(plane._boundaryPolygon)
+    _boundaryPolygon(plane._boundaryPolygon),
+    _cellMask(plane._cellMask)
 {
     assert(utils::double_equal(get_normal().norm(), 1.0));
     assert(utils::is_covariance_valid(_pointCloudCovariance));
@@ -97,4 +100,74 @@ double Plane::get_distance(const vector3& point) const noexcept
     return get_parametrization().get_point_distance(point);
 }
 
+/*
+ *
+ *      PLANE ORIENTATION INDEX
+ *
+ */
+Plane_Orientation_Index::Plane_Orientation_Index(const plane_container& planes)
+{
+    for (size_t planeIndex = 0; planeIndex < planes.size(); ++planeIndex)
+    {
+        const Plane& plane = planes[planeIndex];
+        _axisBins[get_axis_bin(plane.get_normal())].emplace_back(plane.get_d(), planeIndex);
+    }
+    sort_axis_bins();
+}
+
+Plane_Orientation_Index::Plane_Orientation_Index(const tracked_plane_container& planeParametrizations)
+{
+    for (size_t planeIndex = 0; planeIndex < planeParametrizations.size(); ++planeIndex)
+    {
+        const PlaneCameraCoordinates& planeParametrization = planeParametrizations[planeIndex];
+        _axisBins[get_axis_bin(planeParametrization.get_normal())].emplace_back(planeParametrization.get_d(),
+                                                                                planeIndex);
+    }
+    sort_axis_bins();
+}
+
+void Plane_Orientation_Index::sort_axis_bins() noexcept
+{
+    for (auto& axisBin: _axisBins)
+        std::ranges::sort(axisBin);
+}
+
+uint Plane_Orientation_Index::get_axis_bin(const vector3& normal) noexcept
+{
+    Eigen::Index axis = 0;
+    normal.cwiseAbs().maxCoeff(&axis);
+    return static_cast<uint>(axis);
+}
+
+void Plane_Orientation_Index::get_candidates(const PlaneCameraCoordinates& planeParametrization,
+                                             std::vector<size_t>& candidates) const noexcept
+{
+    candidates.clear();
+
+    // the normals in the match angle of n (or -n) are at a distance of at most 2 * sin(angle / 2) of it (or of -n):
+    // their greatest absolute component can be the one of an axis a only if |n_a| + 2 * distance >= max |n_b|
+    static const double maximumNormalDistance =
+            2.0 * sin(parameters::matching::maximumAngleForPlaneMatch_d * M_PI / 360.0);
+    constexpr double maximumPlaneMatchDistance = parameters::matching::maximumDistanceForPlaneMatch_mm;
+
+    const vector3 absoluteNormal = planeParametrization.get_normal().cwiseAbs();
+    const double greatestComponent = absoluteNormal.maxCoeff();
+    const double d = planeParametrization.get_d();
+    for (uint axis = 0; axis < axisBinCount; ++axis)
+    {
+        if (absoluteNormal[axis] + 2.0 * maximumNormalDistance < greatestComponent)
+            continue;
+
+        // planes of this bin in the offset range
+        const auto& axisBin = _axisBins[axis];
+        auto planeIterator = std::ranges::lower_bound(
+                axisBin, d - maximumPlaneMatchDistance, std::less {}, &std::pair<double, size_t>::first);
+        for (; planeIterator != axisBin.cend() and planeIterator->first <= d + maximumPlaneMatchDistance;
+             ++planeIterator)
+            candidates.push_back(planeIterator->second);
+    }
+    // same order as a search of all the planes
+    std::ranges::sort(candidates);
+}
+
 } // namespace rgbd_slam::features::primitives
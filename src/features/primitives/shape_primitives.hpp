@@ -3,11 +3,15 @@
 
 // cv:Mat
 #include "../../types.hpp"
+#include "cell_mask.hpp"
 #include "coordinates/point_coordinates.hpp"
 #include "cylinder_segment.hpp"
 #include "plane_segment.hpp"
 #include "coordinates/polygon_coordinates.hpp"
+#include <array>
 #include <opencv2/opencv.hpp>
+#include <utility>
+#include <vector>
 
 namespace rgbd_slam::features::primitives {
 
@@ -78,8 +82,9 @@ class Plane : public IPrimitive
      *
      * \param[in] planeSeg Plane to copy
      * \param[in] boundaryPolygon Polygon describing the boundary of the plane, in plane coordiates
+     * \param[in] cellMask The depth map patches of this plane
      */
-    Plane(const Plane_Segment& planeSeg, const CameraPolygon& boundaryPolygon);
+    Plane(const Plane_Segment& planeSeg, const CameraPolygon& boundaryPolygon, const Cell_Mask& cellMask);
 
     Plane(const Plane& plane);
 
@@ -108,6 +113,11 @@ class Plane : public IPrimitive
 
     [[nodiscard]] CameraPolygon get_boundary_polygon() const noexcept { return _boundaryPolygon; };
 
+    /**
+     * \return The depth map patches of this plane, one bit per patch
+     */
+    [[nodiscard]] const Cell_Mask& get_cell_mask() const noexcept { return _cellMask; };
+
     ~Plane() = default;
 
   private:
@@ -119,6 +129,7 @@ class Plane : public IPrimitive
     PlaneCameraCoordinates _parametrization; // infinite plane representation
     matrix33 _pointCloudCovariance;          // the covariance of point cloud that this plane is fitted from
     const CameraPolygon _boundaryPolygon;
+    const Cell_Mask _cellMask;
 
     // remove copy functions
     Plane() = delete;
@@ -128,6 +139,77 @@ class Plane : public IPrimitive
 // types for detected primitives
 using cylinder_container = std::vector<Cylinder>;
 using plane_container = std::vector<Plane>;
+// map planes, projected in the camera space of the predicted pose. Used as priors by the plane detection
+using tracked_plane_container = std::vector<PlaneCameraCoordinates>;
+
+/**
+ * \brief Detected planes, indexed by the dominant axis of their normal (a cube map folded on its opposite faces, as the
+ * plane matches ignore the normal sign) and sorted by offset in each axis bin.
+ * A candidate search only reads the axis bins that a normal in the match angle can reach, on the offset range of
+ * the match distance: its cost scales with the similar planes, not with the detected plane count
+ */
+class Plane_Orientation_Index
+{
+  public:
+    Plane_Orientation_Index() = default;
+
+    /**
+     * \param[in] planes The planes to index. The index does not keep a reference to them
+     */
+    explicit Plane_Orientation_Index(const plane_container& planes);
+
+    /**
+     * \param[in] planeParametrizations The plane parametrizations to index, in camera space
+     */
+    explicit Plane_Orientation_Index(const tracked_plane_container& planeParametrizations);
+
+    /**
+     * \brief Find the planes that can pass Plane::is_normal_similar and Plane::is_distance_similar with a plane
+     * \param[in] planeParametrization The plane to compare, in camera space
+     * \param[out] candidates The indexes of the candidate planes, in increasing order (superset)
+     */
+    void get_candidates(const PlaneCameraCoordinates& planeParametrization,
+                        std::vector<size_t>& candidates) const noexcept;
+
+    /**
+     * \brief Compute the bin of a plane normal: its axis of greatest absolute component
+     */
+    [[nodiscard]] static uint get_axis_bin(const vector3& normal) noexcept;
+
+  private:
+    /**
+     * \brief Sort the planes of each axis bin by offset, once all the planes are added
+     */
+    void sort_axis_bins() noexcept;
+
+    static constexpr uint axisBinCount = 3;
+    // for each axis bin, the offset and index of its planes, sorted by offset
+    std::array<std::vector<std::pair<double, size_t>>, axisBinCount> _axisBins;
+};
+
+/**
+ * \brief Detected planes, with their orientation index
+ */
+class Indexed_Plane_Container
+{
+  public:
+    Indexed_Plane_Container() = default;
+    explicit Indexed_Plane_Container(const plane_container& planes) : _planes(planes), _index(_planes) {}
+
+    [[nodiscard]] size_t size() const noexcept { return _planes.size(); }
+    [[nodiscard]] bool empty() const noexcept { return _planes.empty(); }
+    [[nodiscard]] const Plane& at(const size_t index) const { return _planes.at(index); }
+    [[nodiscard]] const Plane& operator[](const size_t index) const noexcept { return _planes[index]; }
+    [[nodiscard]] plane_container::const_iterator begin() const noexcept { return _planes.cbegin(); }
+    [[nodiscard]] plane_container::const_iterator end() const noexcept { return _planes.cend(); }
+
+    [[nodiscard]] const plane_container& get_planes() const noexcept { return _planes; }
+    [[nodiscard]] const Plane_Orientation_Index& get_index() const noexcept { return _index; }
+
+  private:
+    plane_container _planes;
+    Plane_Orientation_Index _index;
+};
 
 } // namespace rgbd_slam::features::primitives
 
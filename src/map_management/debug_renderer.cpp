@@ -0,0 +1,156 @@
+#include "debug_renderer.hpp"
+#include "coordinates/point_coordinates.hpp"
+#include "outputs/logger.hpp"
+#include "utils/camera_transformation.hpp"
+#include <chrono>
+#include <opencv2/imgproc.hpp>
+#include <vector>
+
+namespace rgbd_slam::map_management {
+
+Debug_Renderer::Debug_Renderer(const uint width, const uint height, snapshot_getter getSnapshot) noexcept :
+    _width(width),
+    _height(height),
+    _getSnapshot(std::move(getSnapshot))
+{
+}
+
+Debug_Renderer::~Debug_Renderer() { stop(); }
+
+void Debug_Renderer::start(const double refreshRate_Hz) noexcept
+{
+    if (is_running())
+    {
+        outputs::log_warning("The debug renderer is already running");
+        return;
+    }
+    if (refreshRate_Hz <= 0.0)
+    {
+        outputs::log_error("The debug overlay refresh rate should be > 0");
+        return;
+    }
+
+    _shouldStop = false;
+    _thread = std::thread(&Debug_Renderer::run, this, refreshRate_Hz);
+}
+
+void Debug_Renderer::stop() noexcept
+{
+    if (not is_running())
+        return;
+
+    {
+        std::scoped_lock lock(_stopMutex);
+        _shouldStop = true;
+    }
+    _stopCondition.notify_all();
+    _thread.join();
+}
+
+void Debug_Renderer::set_pose(const utils::PoseBase& camPose) noexcept
+{
+    std::scoped_lock lock(_poseMutex);
+    _camPose = camPose;
+    ++_poseVersion;
+}
+
+bool Debug_Renderer::compose(cv::Mat& debugImage) const noexcept
+{
+    const std::shared_ptr<const Overlay>& overlay = _overlay.load();
+    if (overlay == nullptr)
+        return false;
+
+    if (debugImage.size() != overlay->_image.size() or debugImage.type() != overlay->_image.type())
+    {
+        outputs::log_error("The debug image does not have the size of the debug renderer");
+        return false;
+    }
+    overlay->_image.copyTo(debugImage, overlay->_mask);
+    return true;
+}
+
+void Debug_Renderer::run(const double refreshRate_Hz) noexcept
+{
+    const auto renderPeriod = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(1.0 / refreshRate_Hz));
+
+    std::shared_ptr<const Map_Snapshot> lastSnapshot = nullptr;
+    size_t lastPoseVersion = 0;
+    auto nextRenderTime = std::chrono::steady_clock::now();
+    while (true)
+    {
+        {
+            std::unique_lock lock(_stopMutex);
+            if (_stopCondition.wait_until(lock, nextRenderTime, [this]() {
+                    return _shouldStop;
+                }))
+                return;
+        }
+        nextRenderTime += renderPeriod;
+
+        utils::PoseBase camPose;
+        size_t poseVersion = 0;
+        {
+            std::scoped_lock lock(_poseMutex);
+            camPose = _camPose;
+            poseVersion = _poseVersion;
+        }
+        const std::shared_ptr<const Map_Snapshot>& snapshot = _getSnapshot();
+
+        // no pose yet, or nothing moved since the last render
+        if (snapshot == nullptr or poseVersion == 0 or (snapshot == lastSnapshot and poseVersion == lastPoseVersion))
+            continue;
+
+        _overlay.store(render(*snapshot, camPose));
+        lastSnapshot = snapshot;
+        lastPoseVersion = poseVersion;
+    }
+}
+
+std::shared_ptr<const Debug_Renderer::Overlay> Debug_Renderer::render(const Map_Snapshot& snapshot,
+                                                                        const utils::PoseBase& camPose) const noexcept
+{
+    auto overlay = std::make_shared<Overlay>();
+    overlay->_image = cv::Mat::zeros(static_cast<int>(_height), static_cast<int>(_width), CV_8UC3);
+    overlay->_mask = cv::Mat::zeros(static_cast<int>(_height), static_cast<int>(_width), CV_8UC1);
+
+    const WorldToCameraMatrix& worldToCamera =
+            utils::compute_world_to_camera_transform(camPose.get_orientation_quaternion(), camPose.get_position());
+
+    // points: green, blue if they have no depth measure yet
+    for (const Map_Snapshot::Point& point: snapshot._points)
+    {
+        ScreenCoordinate screenPoint;
+        if (not WorldCoordinate(point._coordinates).to_screen_coordinates(worldToCamera, screenPoint) or
+            screenPoint.z() <= 0 or not screenPoint.is_in_screen_boundaries())
+            continue;
+
+        const cv::Point center(static_cast<int>(screenPoint.x()), static_cast<int>(screenPoint.y()));
+        const cv::Scalar color = point._isInverseDepth ? cv::Scalar(255, 128, 0) : cv::Scalar(0, 255, 0);
+        cv::circle(overlay->_image, center, 3, color, -1);
+        cv::circle(overlay->_mask, center, 3, cv::Scalar(255), -1);
+    }
+
+    // planes: yellow boundary, not drawn if a part of it is behind the camera
+    std::vector<cv::Point> boundary;
+    for (const Map_Snapshot::Plane& plane: snapshot._planes)
+    {
+        boundary.clear();
+        for (const vector3& boundaryPoint: plane._boundary)
+        {
+            ScreenCoordinate screenPoint;
+            if (not WorldCoordinate(boundaryPoint).to_screen_coordinates(worldToCamera, screenPoint) or
+                screenPoint.z() <= 0)
+                break;
+            boundary.emplace_back(static_cast<int>(screenPoint.x()), static_cast<int>(screenPoint.y()));
+        }
+        if (boundary.size() != plane._boundary.size() or boundary.size() < 3)
+            continue;
+
+        cv::polylines(overlay->_image, boundary, true, cv::Scalar(0, 255, 255), 2);
+        cv::polylines(overlay->_mask, boundary, true, cv::Scalar(255), 2);
+    }
+    return overlay;
+}
+
+} // namespace rgbd_slam::map_management
@@ -0,0 +1,103 @@
+#ifndef RGBDSLAM_MAPMANAGEMENT_DEBUGRENDERER_HPP
+#define RGBDSLAM_MAPMANAGEMENT_DEBUGRENDERER_HPP
+
+#include "map_snapshot.hpp"
+#include "utils/pose.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <opencv2/core.hpp>
+#include <thread>
+
+namespace rgbd_slam::map_management {
+
+/**
+ * \brief Draws the map features over the camera images on a background thread, from the published map snapshots.
+ * The feature overlay is redrawn at a fixed rate, independent of the tracking: composing a debug image only copies
+ * the last overlay over the camera image
+ */
+class Debug_Renderer
+{
+  public:
+    using snapshot_getter = std::function<std::shared_ptr<const Map_Snapshot>()>;
+
+    /**
+     * \param[in] width The width of the debug images
+     * \param[in] height The height of the debug images
+     * \param[in] getSnapshot Returns the last published map snapshot. Called from the rendering thread
+     */
+    Debug_Renderer(const uint width, const uint height, snapshot_getter getSnapshot) noexcept;
+    ~Debug_Renderer();
+
+    /**
+     * \brief Start the rendering thread
+     * \param[in] refreshRate_Hz Number of overlay renders per second (> 0)
+     */
+    void start(const double refreshRate_Hz) noexcept;
+
+    /**
+     * \brief Stop the rendering thread. The last overlay is kept
+     */
+    void stop() noexcept;
+
+    [[nodiscard]] bool is_running() const noexcept { return _thread.joinable(); }
+
+    /**
+     * \brief Set the camera pose of the next overlay renders
+     */
+    void set_pose(const utils::PoseBase& camPose) noexcept;
+
+    /**
+     * \brief Copy the last rendered overlay over a camera image
+     * \param[in, out] debugImage The image to draw on, of the renderer size
+     * \return false if no overlay was rendered yet
+     */
+    bool compose(cv::Mat& debugImage) const noexcept;
+
+  private:
+    /**
+     * \brief The map features drawn for a pose, and the mask of the drawn pixels
+     */
+    struct Overlay
+    {
+        cv::Mat _image;
+        cv::Mat _mask;
+    };
+
+    /**
+     * \brief Thread function: renders the overlay of the last snapshot and pose, at the refresh rate
+     */
+    void run(const double refreshRate_Hz) noexcept;
+
+    /**
+     * \brief Draw the features of a map snapshot seen from a pose
+     */
+    [[nodiscard]] std::shared_ptr<const Overlay> render(const Map_Snapshot& snapshot,
+                                                        const utils::PoseBase& camPose) const noexcept;
+
+    const uint _width;
+    const uint _height;
+    const snapshot_getter _getSnapshot;
+
+    mutable std::mutex _poseMutex;
+    utils::PoseBase _camPose;
+    size_t _poseVersion = 0; // incremented by each set_pose
+
+    std::atomic<std::shared_ptr<const Overlay>> _overlay;
+
+    std::mutex _stopMutex;
+    std::condition_variable _stopCondition;
+    bool _shouldStop = false;
+    std::thread _thread;
+
+    // Remove copy operators
+    Debug_Renderer(const Debug_Renderer& other) = delete;
+    void operator=(const Debug_Renderer& other) = delete;
+};
+
+} // namespace rgbd_slam::map_management
+
+#endif
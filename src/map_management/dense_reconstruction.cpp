@@ -0,0 +1,411 @@
+#include "dense_reconstruction.hpp"
+#include "outputs/logger.hpp"
+#include "parameters.hpp"
+#include <algorithm>
+#include <cmath>
+#include <format>
+
+namespace rgbd_slam::map_management {
+
+namespace {
+
+namespace dense = parameters::mapping::denseReconstruction;
+
+constexpr int blockKeyBits = 21; // bits of each block coordinate in a block key
+constexpr int blockKeyOffset = 1 << (blockKeyBits - 1);
+constexpr uint64_t blockKeyMask = (uint64_t(1) << blockKeyBits) - 1;
+
+// corners of a cube of voxels, and its decomposition in 6 tetrahedra around the (0, 6) diagonal
+const std::array<Eigen::Vector3i, 8> cubeCorners = {Eigen::Vector3i(0, 0, 0),
+                                                    Eigen::Vector3i(1, 0, 0),
+                                                    Eigen::Vector3i(1, 1, 0),
+                                                    Eigen::Vector3i(0, 1, 0),
+                                                    Eigen::Vector3i(0, 0, 1),
+                                                    Eigen::Vector3i(1, 0, 1),
+                                                    Eigen::Vector3i(1, 1, 1),
+                                                    Eigen::Vector3i(0, 1, 1)};
+constexpr std::array<std::array<size_t, 4>, 6> cubeTetrahedra = {{{0, 5, 1, 6},
+                                                                  {0, 1, 2, 6},
+                                                                  {0, 2, 3, 6},
+                                                                  {0, 3, 7, 6},
+                                                                  {0, 7, 4, 6},
+                                                                  {0, 4, 5, 6}}};
+
+[[nodiscard]] int floor_divide(const int value, const int divisor) noexcept
+{
+    return (value >= 0 ? value : value - divisor + 1) / divisor;
+}
+
+/**
+ * \brief Add the triangles of the zero crossing surface of the distance field in a tetrahedron. The triangles face the
+ * positive distances (the observed free space)
+ * \param[in] positions The positions of the corners
+ * \param[in] distances The signed distances at the corners
+ * \param[in, out] triangles The triangles, as 3 consecutive vertices
+ */
+void add_tetrahedron_triangles(const std::array<vector3, 4>& positions,
+                               const std::array<float, 4>& distances,
+                               std::vector<vector3>& triangles) noexcept
+{
+    std::array<size_t, 4> insideCorners;
+    std::array<size_t, 4> outsideCorners;
+    size_t insideCount = 0;
+    size_t outsideCount = 0;
+    for (size_t i = 0; i < 4; ++i)
+    {
+        if (distances[i] < 0.0f)
+            insideCorners[insideCount++] = i;
+        else
+            outsideCorners[outsideCount++] = i;
+    }
+    if (insideCount == 0 or outsideCount == 0)
+        return;
+
+    const auto get_crossing = [&positions, &distances](const size_t from, const size_t to) -> vector3 {
+        const double ratio = distances[from] / (distances[from] - distances[to]);
+        return positions[from] + ratio * (positions[to] - positions[from]);
+    };
+    // from the inside to the outside of the surface
+    vector3 outsideDirection = vector3::Zero();
+    for (size_t i = 0; i < outsideCount; ++i)
+        outsideDirection += positions[outsideCorners[i]] / static_cast<double>(outsideCount);
+    for (size_t i = 0; i < insideCount; ++i)
+        outsideDirection -= positions[insideCorners[i]] / static_cast<double>(insideCount);
+
+    const auto add_triangle = [&triangles, &outsideDirection](const vector3& a, const vector3& b, const vector3& c) {
+        const bool isFacingOutside = (b - a).cross(c - a).dot(outsideDirection) >= 0.0;
+        triangles.emplace_back(a);
+        triangles.emplace_back(isFacingOutside ? b : c);
+        triangles.emplace_back(isFacingOutside ? c : b);
+    };
+
+    if (insideCount == 2)
+    {
+        // the surface is a quad, on the edges between the two inside and the two outside corners
+        const vector3& ac = get_crossing(insideCorners[0], outsideCorners[0]);
+        const vector3& ad = get_crossing(insideCorners[0], outsideCorners[1]);
+        const vector3& bd = get_crossing(insideCorners[1], outsideCorners[1]);
+        const vector3& bc = get_crossing(insideCorners[1], outsideCorners[0]);
+        add_triangle(ac, ad, bd);
+        add_triangle(ac, bd, bc);
+        return;
+    }
+
+    // a lone corner on one side: one triangle on its three edges
+    const bool isLoneCornerInside = insideCount == 1;
+    const size_t loneCorner = isLoneCornerInside ? insideCorners[0] : outsideCorners[0];
+    const std::array<size_t, 4>& otherCorners = isLoneCornerInside ? outsideCorners : insideCorners;
+    add_triangle(get_crossing(loneCorner, otherCorners[0]),
+                 get_crossing(loneCorner, otherCorners[1]),
+                 get_crossing(loneCorner, otherCorners[2]));
+}
+
+} // namespace
+
+Dense_Reconstruction::Dense_Reconstruction(const std::string& meshPath) :
+    _meshFile(meshPath, std::ios_base::trunc | std::ios_base::out),
+    _frames(dense::frameQueueCapacity)
+{
+    if (not _meshFile.is_open())
+    {
+        outputs::log_error("Could not open the dense mesh file " + meshPath);
+        return;
+    }
+    _meshFile << "# dense reconstruction, in millimeters\n";
+    _thread = std::thread(&Dense_Reconstruction::run, this);
+}
+
+Dense_Reconstruction::~Dense_Reconstruction() { stop(); }
+
+void Dense_Reconstruction::stop() noexcept
+{
+    if (not is_running())
+        return;
+
+    _frames.close();
+    _thread.join();
+}
+
+bool Dense_Reconstruction::add_frame(const CameraToWorldMatrix& cameraToWorld, cv::Mat_<float> depthImage) noexcept
+{
+    if (is_running() and _frames.try_push(Frame {cameraToWorld, std::move(depthImage)}))
+        return true;
+
+    ++_droppedFrameCount;
+    return false;
+}
+
+size_t Dense_Reconstruction::get_allocated_bytes() const noexcept
+{
+    const vector2_uint& imageSize = Parameters::get_camera_1_image_size();
+    const size_t depthImageBytes = (imageSize.x() / dense::pixelStride) * (imageSize.y() / dense::pixelStride) *
+                                   sizeof(float);
+    // a block is allocated with a hash table node
+    return _blockCount.load() * (sizeof(Block) + sizeof(std::unique_ptr<Block>) + 2 * sizeof(void*) +
+                                 sizeof(uint64_t)) +
+           _frames.size() * depthImageBytes;
+}
+
+void Dense_Reconstruction::show_statistics() const noexcept
+{
+    outputs::log(std::format("Dense reconstruction: integrated {} frames ({} dropped), meshed {} triangles",
+                             get_integrated_frame_count(),
+                             get_dropped_frame_count(),
+                             _meshTriangleCount.load()));
+}
+
+void Dense_Reconstruction::run() noexcept
+{
+    Frame frame;
+    while (_frames.pop(frame))
+    {
+        integrate(frame);
+        finish_blocks(frame._cameraToWorld.translation());
+        ++_integratedFrameCount;
+        frame._depthImage.release();
+    }
+
+    // the remaining blocks are all finished: extract all of them before freeing them, for their neighbours
+    for (const auto& [blockKey, block]: _blocks)
+        extract_mesh(get_block_index(blockKey), *block);
+    _blocks.clear();
+    _blockCount = 0;
+    _meshFile.flush();
+}
+
+void Dense_Reconstruction::integrate(const Frame& frame) noexcept
+{
+    ++_frameIndex;
+    const cv::Mat_<float>& depthImage = frame._depthImage;
+    const double blockSize = dense::voxelSize_mm * blockSide;
+    const vector2& focal = Parameters::get_camera_1_focal() / static_cast<double>(dense::pixelStride);
+    const vector2& center = Parameters::get_camera_1_center() / static_cast<double>(dense::pixelStride);
+    const matrix33& rotation = frame._cameraToWorld.rotation();
+    const vector3& position = frame._cameraToWorld.translation();
+
+    // the blocks around the observed surface: along each pixel ray, sampled by half blocks in the truncation band
+    const int bandSampleCount = static_cast<int>(std::ceil(4.0 * dense::truncationDistance_mm / blockSize));
+    const double bandSampleStep = 2.0 * dense::truncationDistance_mm / bandSampleCount;
+    _observedBlockKeys.clear();
+    for (int row = 0; row < depthImage.rows; ++row)
+    {
+        const float* depthRow = depthImage[row];
+        for (int column = 0; column < depthImage.cols; ++column)
+        {
+            const double depth = depthRow[column];
+            // also rejects the invalid (NaN) depths
+            if (not(depth > 0.0 and depth <= dense::maximumDepth_mm))
+                continue;
+
+            const vector3 ray((column - center.x()) / focal.x(), (row - center.y()) / focal.y(), 1.0);
+            uint64_t lastBlockKey = UINT64_MAX;
+            for (int sampleIndex = 0; sampleIndex <= bandSampleCount; ++sampleIndex)
+            {
+                const double sampleDepth = depth - dense::truncationDistance_mm + sampleIndex * bandSampleStep;
+                if (sampleDepth <= 0.0)
+                    continue;
+                const vector3& worldPoint = rotation * (ray * sampleDepth) + position;
+                const uint64_t blockKey =
+                        get_block_key((worldPoint / blockSize).array().floor().cast<int>().matrix());
+                if (blockKey != lastBlockKey)
+                    _observedBlockKeys.emplace_back(blockKey);
+                lastBlockKey = blockKey;
+            }
+        }
+    }
+    std::ranges::sort(_observedBlockKeys);
+    const auto [duplicateStart, duplicateEnd] = std::ranges::unique(_observedBlockKeys);
+    _observedBlockKeys.erase(duplicateStart, duplicateEnd);
+
+    // projective signed distance of the voxels of the observed blocks
+    const matrix33& worldToCameraRotation = rotation.transpose();
+    const vector3& worldToCameraTranslation = -worldToCameraRotation * position;
+    for (const uint64_t blockKey: _observedBlockKeys)
+    {
+        std::unique_ptr<Block>& block = _blocks[blockKey];
+        if (block == nullptr)
+            block = std::make_unique<Block>();
+
+        const vector3& blockOrigin = get_block_index(blockKey).cast<double>() * blockSize;
+        for (int voxelIndex = 0; voxelIndex < voxelsPerBlock; ++voxelIndex)
+        {
+            const vector3 voxelOffset(
+                    voxelIndex % blockSide, (voxelIndex / blockSide) % blockSide, voxelIndex / (blockSide * blockSide));
+            const vector3& voxelCenter = blockOrigin + (voxelOffset.array() + 0.5).matrix() * dense::voxelSize_mm;
+            const vector3& cameraPoint = worldToCameraRotation * voxelCenter + worldToCameraTranslation;
+            if (cameraPoint.z() <= 0.0)
+                continue;
+
+            const int column =
+                    static_cast<int>(std::lround(focal.x() * cameraPoint.x() / cameraPoint.z() + center.x()));
+            const int row = static_cast<int>(std::lround(focal.y() * cameraPoint.y() / cameraPoint.z() + center.y()));
+            if (column < 0 or row < 0 or column >= depthImage.cols or row >= depthImage.rows)
+                continue;
+            const double depth = depthImage(row, column);
+            if (not(depth > 0.0 and depth <= dense::maximumDepth_mm))
+                continue;
+
+            // behind the surface, the voxel is not observed
+            const double signedDistance = depth - cameraPoint.z();
+            if (signedDistance < -dense::truncationDistance_mm)
+                continue;
+
+            Voxel& voxel = block->_voxels[static_cast<size_t>(voxelIndex)];
+            const float distance = static_cast<float>(std::min(1.0, signedDistance / dense::truncationDistance_mm));
+            voxel._distance = (voxel._distance * voxel._weight + distance) / (voxel._weight + 1.0f);
+            voxel._weight = std::min(voxel._weight + 1.0f, dense::maximumVoxelWeight);
+        }
+        block->_lastIntegratedFrame = _frameIndex;
+    }
+    _blockCount = _blocks.size();
+}
+
+void Dense_Reconstruction::finish_blocks(const vector3& cameraPosition) noexcept
+{
+    std::vector<uint64_t> finishedBlockKeys;
+    std::vector<std::pair<double, uint64_t>> activeBlocks; // squared distance to the camera, and key
+    activeBlocks.reserve(_blocks.size());
+    const double blockSize = dense::voxelSize_mm * blockSide;
+    for (const auto& [blockKey, block]: _blocks)
+    {
+        if (_frameIndex - block->_lastIntegratedFrame >= dense::finishedBlockFrameCount)
+            finishedBlockKeys.emplace_back(blockKey);
+        else
+        {
+            const vector3& blockCenter =
+                    (get_block_index(blockKey).cast<double>().array() + 0.5).matrix() * blockSize;
+            activeBlocks.emplace_back((blockCenter - cameraPosition).squaredNorm(), blockKey);
+        }
+    }
+
+    // bounded memory: the farthest blocks are finished
+    if (activeBlocks.size() > dense::maximumBlockCount)
+    {
+        const auto farthestBlocksStart = activeBlocks.begin() + static_cast<std::ptrdiff_t>(dense::maximumBlockCount);
+        std::ranges::nth_element(activeBlocks, farthestBlocksStart);
+        for (auto blockIterator = farthestBlocksStart; blockIterator != activeBlocks.end(); ++blockIterator)
+            finishedBlockKeys.emplace_back(blockIterator->second);
+    }
+    if (finishedBlockKeys.empty())
+        return;
+
+    // extract all the finished blocks before freeing them, for their neighbours
+    for (const uint64_t blockKey: finishedBlockKeys)
+        extract_mesh(get_block_index(blockKey), *_blocks.at(blockKey));
+    for (const uint64_t blockKey: finishedBlockKeys)
+        _blocks.erase(blockKey);
+    _blockCount = _blocks.size();
+}
+
+void Dense_Reconstruction::extract_mesh(const BlockIndex& blockIndex, const Block& block) noexcept
+{
+    const Eigen::Vector3i& blockVoxelOrigin = blockIndex * blockSide;
+    const auto get_block_voxel = [this, &block, &blockVoxelOrigin](const Eigen::Vector3i& localIndex) -> const Voxel* {
+        // the last voxels of the cubes at the border are in the next blocks
+        if ((localIndex.array() < blockSide).all())
+        {
+            const Voxel& voxel = block._voxels[get_voxel_offset(localIndex)];
+            return voxel._weight > 0.0f ? &voxel : nullptr;
+        }
+        return get_voxel(blockVoxelOrigin + localIndex);
+    };
+
+    std::vector<vector3> triangles;
+    for (int z = 0; z < blockSide; ++z)
+    {
+        for (int y = 0; y < blockSide; ++y)
+        {
+            for (int x = 0; x < blockSide; ++x)
+            {
+                const Eigen::Vector3i cubeOrigin(x, y, z);
+                std::array<float, 8> cornerDistances;
+                bool isCubeValid = true;
+                bool hasInside = false;
+                bool hasOutside = false;
+                for (size_t corner = 0; corner < cubeCorners.size(); ++corner)
+                {
+                    const Voxel* voxel = get_block_voxel(cubeOrigin + cubeCorners[corner]);
+                    // the truncated distances do not locate the surface
+                    isCubeValid = voxel != nullptr and std::abs(voxel->_distance) < 1.0f;
+                    if (not isCubeValid)
+                        break;
+                    cornerDistances[corner] = voxel->_distance;
+                    hasInside |= voxel->_distance < 0.0f;
+                    hasOutside |= voxel->_distance >= 0.0f;
+                }
+                if (not isCubeValid or not hasInside or not hasOutside)
+                    continue;
+
+                for (const std::array<size_t, 4>& tetrahedron: cubeTetrahedra)
+                {
+                    std::array<vector3, 4> positions;
+                    std::array<float, 4> distances;
+                    for (size_t i = 0; i < 4; ++i)
+                    {
+                        const Eigen::Vector3i& voxelIndex =
+                                blockVoxelOrigin + cubeOrigin + cubeCorners[tetrahedron[i]];
+                        positions[i] = (voxelIndex.cast<double>().array() + 0.5).matrix() * dense::voxelSize_mm;
+                        distances[i] = cornerDistances[tetrahedron[i]];
+                    }
+                    add_tetrahedron_triangles(positions, distances, triangles);
+                }
+            }
+        }
+    }
+    if (triangles.empty())
+        return;
+
+    _meshBuffer.clear();
+    for (const vector3& vertex: triangles)
+        _meshBuffer += std::format("v {:.1f} {:.1f} {:.1f}\n", vertex.x(), vertex.y(), vertex.z());
+    for (size_t triangleIndex = 0; triangleIndex < triangles.size() / 3; ++triangleIndex)
+    {
+        // the obj vertex indices start at 1
+        const size_t firstVertex = _meshVertexCount + triangleIndex * 3 + 1;
+        _meshBuffer += std::format("f {} {} {}\n", firstVertex, firstVertex + 1, firstVertex + 2);
+    }
+    _meshFile.write(_meshBuffer.data(), static_cast<std::streamsize>(_meshBuffer.size()));
+    _meshVertexCount += triangles.size();
+    _meshTriangleCount += triangles.size() / 3;
+}
+
+const Dense_Reconstruction::Voxel* Dense_Reconstruction::get_voxel(const Eigen::Vector3i& voxelIndex) const noexcept
+{
+    const BlockIndex blockIndex(floor_divide(voxelIndex.x(), blockSide),
+                                floor_divide(voxelIndex.y(), blockSide),
+                                floor_divide(voxelIndex.z(), blockSide));
+    const auto blockIterator = _blocks.find(get_block_key(blockIndex));
+    if (blockIterator == _blocks.cend())
+        return nullptr;
+
+    const Eigen::Vector3i& localIndex = voxelIndex - blockIndex * blockSide;
+    const Voxel& voxel = blockIterator->second->_voxels[get_voxel_offset(localIndex)];
+    return voxel._weight > 0.0f ? &voxel : nullptr;
+}
+
+size_t Dense_Reconstruction::get_voxel_offset(const Eigen::Vector3i& localIndex) noexcept
+{
+    return static_cast<size_t>(localIndex.x() + blockSide * (localIndex.y() + blockSide * localIndex.z()));
+}
+
+uint64_t Dense_Reconstruction::get_block_key(const BlockIndex& blockIndex) noexcept
+{
+    // the block coordinates are wrapped on blockKeyBits: far enough for any sensor range
+    const auto get_key_part = [](const int coordinate) {
+        return static_cast<uint64_t>(coordinate + blockKeyOffset) & blockKeyMask;
+    };
+    return get_key_part(blockIndex.x()) | (get_key_part(blockIndex.y()) << blockKeyBits) |
+           (get_key_part(blockIndex.z()) << (2 * blockKeyBits));
+}
+
+Dense_Reconstruction::BlockIndex Dense_Reconstruction::get_block_index(const uint64_t blockKey) noexcept
+{
+    const auto get_coordinate = [](const uint64_t keyPart) {
+        return static_cast<int>(keyPart & blockKeyMask) - blockKeyOffset;
+    };
+    return BlockIndex(get_coordinate(blockKey),
+                      get_coordinate(blockKey >> blockKeyBits),
+                      get_coordinate(blockKey >> (2 * blockKeyBits)));
+}
+
+} // namespace rgbd_slam::map_management
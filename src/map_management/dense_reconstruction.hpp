@@ -0,0 +1,153 @@
+#ifndef RGBDSLAM_MAPMANAGEMENT_DENSERECONSTRUCTION_HPP
+#define RGBDSLAM_MAPMANAGEMENT_DENSERECONSTRUCTION_HPP
+
+#include "types.hpp"
+#include "utils/spsc_queue.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <opencv2/core.hpp>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace rgbd_slam::map_management {
+
+/**
+ * \brief Dense reconstruction of the tracked depth frames in a truncated signed distance field (TSDF), integrated on a
+ * background thread. The voxels are allocated by blocks in a hash table, around the observed surfaces only.
+ * The blocks not observed for some frames are finished: the mesh of their surface is extracted (marching tetrahedra),
+ * appended to an OBJ file, and they are freed. The block count is bounded: over it, the farthest blocks from the camera
+ * are finished early. An area observed again after its blocks were finished is meshed again.
+ * The frames are given through a lock free queue: the tracking never waits for the integration, the frames that
+ * arrive when the queue is full are dropped
+ */
+class Dense_Reconstruction
+{
+  public:
+    /**
+     * \brief Open the mesh file and start the integration thread
+     * \param[in] meshPath The OBJ file where the meshes of the finished blocks are streamed, created or truncated
+     */
+    explicit Dense_Reconstruction(const std::string& meshPath);
+    ~Dense_Reconstruction();
+
+    /**
+     * \brief Integrate the queued frames, write the meshes of all the remaining blocks and stop the integration
+     * thread. The frames added after are dropped
+     */
+    void stop() noexcept;
+
+    [[nodiscard]] bool is_running() const noexcept { return _thread.joinable(); }
+
+    /**
+     * \brief Queue a tracked frame for the integration, without waiting. Must always be called from the same thread
+     * \param[in] cameraToWorld The optimized pose of this frame
+     * \param[in] depthImage The depth image of this frame in millimeters, aligned with the camera 1 image and
+     * subsampled by parameters::mapping::denseReconstruction::pixelStride. Must not be modified after this call
+     * \return false if the frame was dropped
+     */
+    bool add_frame(const CameraToWorldMatrix& cameraToWorld, cv::Mat_<float> depthImage) noexcept;
+
+    [[nodiscard]] size_t get_integrated_frame_count() const noexcept { return _integratedFrameCount.load(); }
+    [[nodiscard]] size_t get_dropped_frame_count() const noexcept { return _droppedFrameCount.load(); }
+
+    /**
+     * \return The bytes of the allocated blocks and of the queued depth images. Can be called from any thread
+     */
+    [[nodiscard]] size_t get_allocated_bytes() const noexcept;
+
+    /**
+     * \brief Log the integrated and dropped frames, and the meshed surface
+     */
+    void show_statistics() const noexcept;
+
+  private:
+    static constexpr int blockSide = 8; // voxels in each direction of a block
+    static constexpr int voxelsPerBlock = blockSide * blockSide * blockSide;
+
+    /**
+     * \brief A voxel of the distance field. The distance is divided by the truncation distance: in [-1, 1]
+     */
+    struct Voxel
+    {
+        float _distance = 1.0f;
+        float _weight = 0.0f; // 0 if the voxel was never observed
+    };
+
+    struct Block
+    {
+        std::array<Voxel, voxelsPerBlock> _voxels;
+        size_t _lastIntegratedFrame = 0;
+    };
+
+    struct Frame
+    {
+        CameraToWorldMatrix _cameraToWorld;
+        cv::Mat_<float> _depthImage;
+    };
+
+    using BlockIndex = Eigen::Vector3i;
+
+    /**
+     * \brief Thread function: integrates the queued frames until the queue is closed
+     */
+    void run() noexcept;
+
+    /**
+     * \brief Allocate the blocks around the observed surface of a frame, and update the distances of their voxels
+     */
+    void integrate(const Frame& frame) noexcept;
+
+    /**
+     * \brief Extract and free the blocks that were not observed for some frames, then the farthest blocks from the
+     * camera if there are too many
+     * \param[in] cameraPosition The world position of the last integrated frame
+     */
+    void finish_blocks(const vector3& cameraPosition) noexcept;
+
+    /**
+     * \brief Append the triangles of the surface crossing a block to the mesh file
+     */
+    void extract_mesh(const BlockIndex& blockIndex, const Block& block) noexcept;
+
+    /**
+     * \brief Get a voxel from its index in the whole grid
+     * \return The voxel, or nullptr if its block is not allocated or it was never observed
+     */
+    [[nodiscard]] const Voxel* get_voxel(const Eigen::Vector3i& voxelIndex) const noexcept;
+
+    /**
+     * \return The offset of a voxel in its block, from its index in the block
+     */
+    [[nodiscard]] static size_t get_voxel_offset(const Eigen::Vector3i& localIndex) noexcept;
+    [[nodiscard]] static uint64_t get_block_key(const BlockIndex& blockIndex) noexcept;
+    [[nodiscard]] static BlockIndex get_block_index(const uint64_t blockKey) noexcept;
+
+    // accessed by the integration thread only
+    std::unordered_map<uint64_t, std::unique_ptr<Block>> _blocks;
+    std::vector<uint64_t> _observedBlockKeys; // buffer of the blocks observed by a frame
+    size_t _frameIndex = 0;
+    std::ofstream _meshFile;
+    size_t _meshVertexCount = 0;
+    std::string _meshBuffer; // triangles of a block, written at once
+
+    utils::Spsc_Queue<Frame> _frames;
+    std::atomic<size_t> _blockCount = 0;
+    std::atomic<size_t> _integratedFrameCount = 0;
+    std::atomic<size_t> _droppedFrameCount = 0;
+    std::atomic<size_t> _meshTriangleCount = 0;
+    std::thread _thread;
+
+    // Remove copy operators
+    Dense_Reconstruction(const Dense_Reconstruction& other) = delete;
+    void operator=(const Dense_Reconstruction& other) = delete;
+};
+
+} // namespace rgbd_slam::map_management
+
+#endif
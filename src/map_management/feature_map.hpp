@@ -1,47 +1,163 @@
 #ifndef RGBDSLAM_MAPMANAGEMENT_FEATUREMAP_HPP
 #define RGBDSLAM_MAPMANAGEMENT_FEATUREMAP_HPP
 
+#include "coordinates/point_coordinates.hpp"
 #include "covariances.hpp"
+#include "outputs/frame_metrics.hpp"
 #include "outputs/map_writer.hpp"
 #include "outputs/logger.hpp"
 
+#include "map_snapshot.hpp"
+#include "map_state_file.hpp"
 #include "matches_containers.hpp"
+#include "parameters.hpp"
+#include "slot_map.hpp"
+#include "spatial_hash.hpp"
 #include "utils/random.hpp"
 
 #include "types.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
 #include <memory>
+#include <optional>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <tbb/parallel_for.h>
 
 #include <opencv2/core/matx.hpp>
 #include <opencv2/core/types.hpp>
 #include <stdexcept>
 
+namespace rgbd_slam::pose_optimization {
+struct Bundle_Adjustment_Corrections;
+struct Pose_Graph_Corrections;
+}
+
 namespace rgbd_slam::map_management {
 
 /**
- * This class manages the map feature ids
+ * This class manages the map feature ids of a map. Thread safe.
+ * Each map owns its allocator, so several maps in one process do not share their ids. The map features get their
+ * ids from the allocator in scope on their thread (see Scoped_Id_Block), or from a process wide allocator when no map
+ * is in scope (features created outside of a map).
+ * Concurrent map updates reserve blocks of ids, so the ids do not depend on the scheduling
  */
 class MapIdAllocator
 {
   public:
     static constexpr size_t invalidId = 0;
 
+    MapIdAllocator() = default;
+    MapIdAllocator(const MapIdAllocator&) = delete;
+    MapIdAllocator& operator=(const MapIdAllocator&) = delete;
+
+  private:
+    // the allocator in scope on a thread, and a block of ids reserved from it, from _next (included) to _end
+    // (excluded)
+    struct IdContext
+    {
+        MapIdAllocator* _allocator = nullptr;
+        size_t _next = invalidId;
+        size_t _end = invalidId;
+    };
+
+  public:
+
+    /**
+     * \return A new id from the allocator in scope on this thread
+     */
     static size_t get_new_id()
     {
-        _idAllocator = std::max(_idAllocator + 1, 1uL);
-        return _idAllocator;
+        // use the block reserved for this thread first
+        IdContext& context = get_thread_context();
+        if (context._next < context._end)
+            return context._next++;
+
+        MapIdAllocator& allocator = context._allocator != nullptr ? *context._allocator : get_default_allocator();
+        return allocator._idAllocator.fetch_add(1) + 1;
     }
 
+    /**
+     * \brief Reserve consecutive ids
+     * \param[in] count The number of ids to reserve
+     * \return The first reserved id
+     */
+    size_t reserve_ids(const size_t count) noexcept { return _idAllocator.fetch_add(count) + 1; }
+
+    /**
+     * \return The last allocated id
+     */
+    [[nodiscard]] size_t get_last_id() const noexcept { return _idAllocator.load(); }
+
+    /**
+     * \brief Make sure that the next ids are greater than an id restored from a map state file
+     * \param[in] lastId The last id allocated by the session that saved the map
+     */
+    void skip_ids_until(const size_t lastId) noexcept
+    {
+        size_t currentId = _idAllocator.load();
+        while (currentId < lastId and not _idAllocator.compare_exchange_weak(currentId, lastId))
+        {
+        }
+    }
+
+    /**
+     * \brief While in scope, get_new_id returns the ids of a reserved block on this thread (if any), then new ids of
+     * the given allocator when the block is used up
+     */
+    class Scoped_Id_Block
+    {
+      public:
+        explicit Scoped_Id_Block(MapIdAllocator& allocator) : Scoped_Id_Block(allocator, invalidId, 0) {}
+        Scoped_Id_Block(MapIdAllocator& allocator, const size_t firstId, const size_t count) :
+            _previousContext(get_thread_context())
+        {
+            get_thread_context() = {&allocator, firstId, firstId + count};
+        }
+        ~Scoped_Id_Block() { get_thread_context() = _previousContext; }
+
+        Scoped_Id_Block(const Scoped_Id_Block&) = delete;
+        Scoped_Id_Block& operator=(const Scoped_Id_Block&) = delete;
+
+      private:
+        const IdContext _previousContext;
+    };
+
   private:
-    inline static size_t _idAllocator = invalidId;
+    [[nodiscard]] static IdContext& get_thread_context() noexcept
+    {
+        static thread_local IdContext context;
+        return context;
+    }
+
+    [[nodiscard]] static MapIdAllocator& get_default_allocator() noexcept
+    {
+        static MapIdAllocator allocator;
+        return allocator;
+    }
+
+    std::atomic<size_t> _idAllocator = invalidId;
 };
 
 /**
  * \brief Interface for a map feature. All map features should inherit this
+ * \tparam UpgradedFeatureType The feature that this feature is upgraded to, No_Upgrade if it is never upgraded
  */
-template<class DetectedFeaturesObject, class DetectedFeatureType, class TrackedFeaturesObject> class IMapFeature
+template<class DetectedFeaturesObject,
+         class DetectedFeatureType,
+         class TrackedFeaturesObject,
+         class UpgradedFeatureType = No_Upgrade>
+class IMapFeature
 {
   public:
+    using upgraded_feature_type = UpgradedFeatureType;
+
     IMapFeature() : _id(MapIdAllocator::get_new_id()) {};
     explicit IMapFeature(const size_t id) : _id(id) {};
 
@@ -67,12 +183,45 @@ template<class DetectedFeaturesObject, class DetectedFeatureType, class TrackedF
                                                      const bool useAdvancedSearch = false) const noexcept = 0;
 
     /**
-     * \brief Return true if this feature can be upgraded to UpgradedFeature_ptr
+     * \brief Searches for a match in the detectedFeatures object, from the screen projection of this feature computed
+     * by the batch projection of the map. Only called for the features that gave a point to project
+     * \param[in] projectedPoint The screen projection of the point given by get_projected_point
+     * \return the indexes of the matches if found
+     */
+    [[nodiscard]] virtual matchIndexSet find_matches_from_projection(
+            const ScreenCoordinate2D& projectedPoint,
+            const DetectedFeaturesObject& detectedFeatures,
+            const WorldToCameraMatrix& worldToCamera,
+            const vectorb& isDetectedFeatureMatched,
+            matches_containers::match_container& matches,
+            const bool shouldAddToMatches = true,
+            const bool useAdvancedSearch = false) const noexcept
+    {
+        std::ignore = projectedPoint;
+        return find_matches(
+                detectedFeatures, worldToCamera, isDetectedFeatureMatched, matches, shouldAddToMatches, useAdvancedSearch);
+    }
+
+    /**
+     * \brief Compute the quality of a match of this feature, to decide between map features that found the same
+     * detected feature
+     * \param[in] detectedFeatures The object that contains the detected features for this frame
+     * \param[in] worldToCamera The matrix to convert from map space to camera space
+     * \param[in] matchIndex The index of the matched detected feature
+     * \return A score between 0 and 1, greater for better matches
+     */
+    [[nodiscard]] virtual double get_match_score(const DetectedFeaturesObject& detectedFeatures,
+                                                 const WorldToCameraMatrix& worldToCamera,
+                                                 const size_t matchIndex) const noexcept = 0;
+
+    /**
+     * \brief Return true if this feature can be upgraded to another feature type. The upgraded feature takes the
+     * descriptor and the matches of this feature, that must then be removed from its map
      * \param[in] cameraToWorld The optimized pose
      * \param[out] upgradeFeature The upgraded feature, valid if this function returned true
      */
     [[nodiscard]] virtual bool compute_upgraded(const CameraToWorldMatrix& cameraToWorld,
-                                                UpgradedFeature_ptr& upgradeFeature) const noexcept = 0;
+                                                UpgradedFeatureType& upgradeFeature) noexcept = 0;
 
     /**
      * \brief Should return true if the feature is detected as moving
@@ -94,19 +243,17 @@ template<class DetectedFeaturesObject, class DetectedFeatureType, class TrackedF
      * \brief mark this map feature as having a match at the given index
      * \param[in] matchIndexes The container of indexes of the match in the detected features
      */
-    void mark_matched(const matchIndexSet matchIndexes) noexcept { _matchIndexes = matchIndexes; };
+    void mark_matched(const matchIndexSet& matchIndexes) noexcept { _matchIndexes = matchIndexes; };
 
     /**
      * \brief Update the feature, with the corresponding match
      * \param[in] matchedFeature The detected feature matched with this map feature
-     * \param[in] poseCovariance The covariance of the pose where the matchedFeature was detected
-     * \param[in] cameraToWorld The matrix to transform from the camera pose where matchedFeature was detected to world
-     * coordinates
+     * \param[in] frameTransform The pose where the matchedFeature was detected and its covariance, shared by all the
+     * features updated with this frame
      * \return True if this update succeeded.
      */
     [[nodiscard]] virtual bool update_with_match(const DetectedFeatureType& matchedFeature,
-                                                 const matrix33& poseCovariance,
-                                                 const CameraToWorldMatrix& cameraToWorld) noexcept = 0;
+                                                 const utils::Frame_Transform_Context& frameTransform) noexcept = 0;
 
     // signal the system that this feature was matched
     void update_matched()
@@ -128,11 +275,33 @@ template<class DetectedFeaturesObject, class DetectedFeatureType, class TrackedF
         _successivMatchedCount -= 1;
     };
 
+    /**
+     * \brief Move this feature with the displacement computed for it by a local bundle adjustment
+     * \param[in] corrections The corrections of a local bundle adjustment
+     * \return True if this feature was moved
+     */
+    [[nodiscard]] virtual bool apply_correction(
+            const pose_optimization::Bundle_Adjustment_Corrections& corrections) noexcept = 0;
+
+    /**
+     * \brief Move this feature with the rigid map correction computed by a pose graph optimization
+     * \param[in] corrections The corrections of a loop closure
+     * \return True if this feature was moved
+     */
+    [[nodiscard]] virtual bool apply_correction(
+            const pose_optimization::Pose_Graph_Corrections& corrections) noexcept = 0;
+
     /**
      * \brief should write this feature to a file, using the provided mapWriter
      */
     virtual void write_to_file(std::shared_ptr<outputs::IMap_Writer> mapWriter) const noexcept = 0;
 
+    /**
+     * \brief Copy this feature to a map snapshot
+     * \param[out] snapshot The snapshot in construction
+     */
+    virtual void add_to_snapshot(Map_Snapshot& snapshot) const noexcept = 0;
+
     /**
      * \brief Add the current feature to the trackedFeatures object
      * \param[in] worldToCamera A matrix to change from world to camera space
@@ -144,6 +313,21 @@ template<class DetectedFeaturesObject, class DetectedFeatureType, class TrackedF
                                               TrackedFeaturesObject& trackedFeatures,
                                               const uint dropChance = 1000) const noexcept = 0;
 
+    /**
+     * \brief Add the current feature to the trackedFeatures object, from the screen projection of this feature computed
+     * by the batch projection of the map. Only called for the features that gave a point to project
+     * \param[in] projectedPoint The screen projection of the point given by get_projected_point
+     * \return True if this was added to trackedFeatures object
+     */
+    [[nodiscard]] virtual bool add_to_tracked_from_projection(const ScreenCoordinate2D& projectedPoint,
+                                                              const WorldToCameraMatrix& worldToCamera,
+                                                              TrackedFeaturesObject& trackedFeatures,
+                                                              const uint dropChance = 1000) const noexcept
+    {
+        std::ignore = projectedPoint;
+        return add_to_tracked(worldToCamera, trackedFeatures, dropChance);
+    }
+
     /**
      * \brief Draw this feature on the given image
      * \param[in] worldToCamMatrix A matrix to change from world to camera space
@@ -161,14 +345,41 @@ template<class DetectedFeaturesObject, class DetectedFeatureType, class TrackedF
      */
     [[nodiscard]] virtual bool is_visible(const WorldToCameraMatrix& worldToCamMatrix) const noexcept = 0;
 
+    /**
+     * \brief Get the world point of this feature to project in the batch screen projection of its map. The projection
+     * replaces is_visible, and is given to find_matches_from_projection and add_to_tracked_from_projection
+     * \param[out] worldPoint The world point to project
+     * \return false if this feature is not projected as a single point: it is tested with is_visible
+     */
+    [[nodiscard]] virtual bool get_projected_point(vector3& worldPoint) const noexcept
+    {
+        std::ignore = worldPoint;
+        return false;
+    }
+
+    /**
+     * \brief Get the position of this feature in the spatial index of its map
+     * \param[out] position The world position of this feature
+     * \return false if this feature has no bounded position: it is a visibility candidate from any pose
+     */
+    [[nodiscard]] virtual bool get_spatial_position(vector3& position) const noexcept = 0;
+
+    /**
+     * \brief Add the memory allocated by this feature outside of its map storage (polygons, ...) to the metrics
+     * \param[in, out] metrics The metrics of the current frame
+     */
+    virtual void add_memory_usage(outputs::Frame_Metrics& metrics) const noexcept { std::ignore = metrics; }
+
     /**
      *  Members
      */
 
     size_t _failedTrackingCount = 0;
     int _successivMatchedCount = 0;
-    const size_t _id;            // uniq id of this feature in the program
+    size_t _id;                  // uniq id of this feature in the program. Not const: the map storage moves features
     matchIndexSet _matchIndexes; // indexes of the last matched feature id
+    // set by a match update when this feature may be upgraded, reset by the map after the upgrade test
+    bool _isUpgradeCandidate = false;
 
   protected:
     virtual void update_no_match() noexcept = 0;
@@ -197,6 +408,45 @@ template<class DetectedFeatureType> class IStagedMapFeature
         outputs::log_error("Called default can_add_to_map function");
         return false;
     }
+
+    /**
+     * \brief Quality of a detected feature for its admission in the staged map: the best features of a frame are
+     * admitted first
+     */
+    [[nodiscard]] static double get_admission_score(const DetectedFeatureType& detectedFeature) noexcept
+    {
+        (void)detectedFeature;
+        return 0.0;
+    }
+
+    /**
+     * \brief Coverage cell of a detected feature: the admission takes the best feature of each cell before the second
+     * best of any cell, so the admitted features cover the image
+     */
+    [[nodiscard]] static uint get_admission_cell(const DetectedFeatureType& detectedFeature) noexcept
+    {
+        (void)detectedFeature;
+        return 0;
+    }
+
+    /**
+     * \brief Value of keeping this staged feature when the staged map is full: the lowest are evicted first
+     */
+    [[nodiscard]] virtual double get_retention_score() const noexcept = 0;
+
+  protected:
+    /**
+     * \brief The admission cell of a screen position, in a grid of parameters::mapping::admissionCoverageCellCount
+     * cells in each image direction
+     */
+    [[nodiscard]] static uint get_screen_admission_cell(const double screenX, const double screenY) noexcept
+    {
+        constexpr uint cellCount = parameters::mapping::admissionCoverageCellCount;
+        static const vector2 cellSize = Parameters::get_camera_1_image_size().cast<double>() / cellCount;
+        const uint cellX = std::min(static_cast<uint>(std::max(screenX / cellSize.x(), 0.0)), cellCount - 1);
+        const uint cellY = std::min(static_cast<uint>(std::max(screenY / cellSize.y(), 0.0)), cellCount - 1);
+        return cellY * cellCount + cellX;
+    }
 };
 
 /**
@@ -235,11 +485,22 @@ template<class MapFeatureType,
 class Feature_Map
 {
   private:
-    using localMapType = std::unordered_map<size_t, MapFeatureType>;
-    using stagedMapType = std::unordered_map<size_t, StagedFeatureType>;
+    // contiguous storage of the features, by id
+    using localMapType = Slot_Map<MapFeatureType>;
+    using stagedMapType = Slot_Map<StagedFeatureType>;
 
   public:
-    Feature_Map() : _isActivated(true) {}
+    // the features upgraded by this map, moved to the map of their type
+    using upgraded_feature_type = typename MapFeatureType::upgraded_feature_type;
+    static_assert(std::is_same_v<upgraded_feature_type, typename StagedFeatureType::upgraded_feature_type>,
+                  "The local and staged features must be upgraded to the same type");
+
+    Feature_Map() :
+        _isActivated(true),
+        _localIndex(parameters::mapping::spatialIndexVoxelSize_mm),
+        _stagedIndex(parameters::mapping::spatialIndexVoxelSize_mm)
+    {
+    }
 
     virtual ~Feature_Map() = default;
 
@@ -253,6 +514,12 @@ class Feature_Map
      */
     virtual std::string get_display_name() const = 0;
 
+    /**
+     * \brief Return the memory consumers of the local and staged maps, in the frame metrics
+     */
+    virtual outputs::Memory_Consumer get_local_memory_consumer() const = 0;
+    virtual outputs::Memory_Consumer get_staged_memory_consumer() const = 0;
+
     /**
      * \brief From the given feature container return the type handled by this class
      */
@@ -270,6 +537,16 @@ class Feature_Map
      */
     virtual size_t minimum_features_for_opti() const = 0;
 
+    /**
+     * \brief Return the maximum number of features staged by a frame, or 0 to stage all the unmatched features
+     */
+    virtual size_t get_staged_admission_budget() const noexcept { return 0; }
+
+    /**
+     * \brief Return the maximum number of staged features, or 0 for an unbounded staged map
+     */
+    virtual size_t get_staged_capacity() const noexcept { return 0; }
+
     /**
      * \brief Reset the content of this map, empty all local maps
      */
@@ -280,6 +557,61 @@ class Feature_Map
 
         _localMap.clear();
         _stagedMap.clear();
+        _localIndex.clear();
+        _stagedIndex.clear();
+        _matchedIds.clear();
+        _trackedIds.clear();
+        _localUpgradeCandidates.clear();
+        _stagedUpgradeCandidates.clear();
+        clear_stored_features();
+    }
+
+    /**
+     * \brief Load back in the local map the lost features of the areas visible from a camera pose
+     * \param[in] worldToCamera A matrix to convert from world to camera space
+     * \return The number of features added to the local map
+     */
+    size_t load_visible_stored_features(const WorldToCameraMatrix& worldToCamera) noexcept
+    {
+        if (not _isActivated)
+            return 0;
+        return load_stored_features(worldToCamera);
+    }
+
+    /**
+     * \brief Write the local and staged features of this map to a map state file
+     * \param[in, out] writer The map state file in construction
+     */
+    void write_state(Map_State_Writer& writer) const noexcept
+    {
+        if (not _isActivated)
+            return;
+        write_features(writer);
+    }
+
+    /**
+     * \brief Add the local and staged features of a map state file to this map
+     * \param[in] reader The map state file
+     * \return The number of restored features
+     */
+    size_t read_state(const Map_State_Reader& reader) noexcept
+    {
+        if (not _isActivated)
+            return 0;
+        return read_features(reader);
+    }
+
+    /**
+     * \brief Find matches for the detected features from their descriptors only, with no pose prior
+     * \param[in] detectedFeatures The detected features
+     * \param[in, out] matches The container of the matches, with the relocalization matches of this map added
+     */
+    void get_relocalization_matches(const DetectedFeatureContainer& detectedFeatures,
+                                    matches_containers::match_container& matches) noexcept
+    {
+        if (not _isActivated)
+            return;
+        find_relocalization_matches(get_detected_feature(detectedFeatures), matches);
     }
 
     /**
@@ -297,6 +629,21 @@ class Feature_Map
         }
     }
 
+    /**
+     * \brief Copy the local map features to a map snapshot. The staged features are not copied
+     * \param[out] snapshot The snapshot in construction
+     */
+    void add_to_snapshot(Map_Snapshot& snapshot) const noexcept
+    {
+        if (not _isActivated)
+            return;
+
+        for (const auto& [mapId, mapFeature]: _localMap)
+        {
+            mapFeature.add_to_snapshot(snapshot);
+        }
+    }
+
     /**
      * \brief return the object thta contains the matches between detected and map feature. Set the
      * _isDetectedFeatureMatched flags. Will relaunch the proces if not enough matches were found
@@ -328,10 +675,13 @@ class Feature_Map
     /**
      * \brief Get the feature that were tracked for the last tracking step
      * \param[in] worldToCamera A matrix to convert from world to camera space
+     * \param[in] predictedWorldToCamera If set, a matrix to convert from world to the predicted camera space of the
+     * next frame: the tracked points are also projected with it, to start the optical flow from those positions
      * \param[out] trackedFeatures The object thta will contain the tracked features
      * \param[in] localMapDropChance Chance to randomly drop a local map feature and not return it
      */
     void get_tracked_features(const WorldToCameraMatrix& worldToCamera,
+                              const std::optional<WorldToCameraMatrix>& predictedWorldToCamera,
                               TrackedFeaturesContainer& trackedFeatures,
                               const uint localMapDropChance = 1000) const noexcept
     {
@@ -343,12 +693,57 @@ class Feature_Map
         if (tracked == nullptr)
             return;
 
-        // local Map features
-        for (const auto& [id, mapFeature]: _localMap)
+        // local Map features matched at the last update: only their positions are projected, in one batch
+        vectorb isProjected;
+        ScreenCoordinateBatch projections;
+        project_features(_localMap, _trackedIds, worldToCamera, isProjected, projections);
+
+        // only the tracked keypoints use a predicted position
+        constexpr bool canPredict =
+                std::is_same_v<TrackedFeaturesObject, features::keypoints::KeypointsWithIdStruct>;
+        const bool shouldPredict = canPredict and predictedWorldToCamera.has_value();
+        ScreenCoordinateBatch predictedProjections;
+        if (shouldPredict)
         {
+            vectorb isPredictionProjected;
+            project_features(
+                    _localMap, _trackedIds, *predictedWorldToCamera, isPredictionProjected, predictedProjections);
+        }
+
+        Eigen::Index nextFeatureIndex = 0;
+        for (const size_t id: _trackedIds)
+        {
+            const Eigen::Index featureIndex = nextFeatureIndex++;
+            // removed since the last update (upgraded)
+            const auto mapFeatureIterator = _localMap.find(id);
+            if (mapFeatureIterator == _localMap.cend())
+                continue;
+
+            const MapFeatureType& mapFeature = mapFeatureIterator->second;
             assert(id == mapFeature._id);
-            // feature was matched at the last iteration, and is visible
-            if (mapFeature.is_matched() and mapFeature.is_visible(worldToCamera))
+
+            // feature was matched, and is visible
+            if (isProjected[featureIndex])
+            {
+                if (not projections._isVisible[featureIndex])
+                    continue;
+
+                const ScreenCoordinate2D& projectedPoint = projections.get_2D(static_cast<size_t>(featureIndex));
+                const bool isTracked = mapFeature.add_to_tracked_from_projection(
+                        projectedPoint, worldToCamera, *tracked, localMapDropChance);
+                if constexpr (canPredict)
+                {
+                    // a prediction out of the image is a bad guess: start from the last position
+                    if (isTracked and shouldPredict and predictedProjections._isVisible[featureIndex])
+                    {
+                        const ScreenCoordinate2D& predictedPoint =
+                                predictedProjections.get_2D(static_cast<size_t>(featureIndex));
+                        tracked->set_last_predicted_keypoint(cv::Point2f(static_cast<float>(predictedPoint.x()),
+                                                                         static_cast<float>(predictedPoint.y())));
+                    }
+                }
+            }
+            else if (mapFeature.is_visible(worldToCamera))
             {
                 mapFeature.add_to_tracked(worldToCamera, *tracked, localMapDropChance);
             }
@@ -398,6 +793,56 @@ class Feature_Map
         update_staged_map_with_no_tracking();
     }
 
+    /**
+     * \brief Move the local map features with the corrections of a local bundle adjustment. The staged features are
+     * not refined
+     * \param[in] corrections The corrections of a local bundle adjustment
+     * \return The number of moved features
+     */
+    size_t apply_corrections(const pose_optimization::Bundle_Adjustment_Corrections& corrections) noexcept
+    {
+        size_t correctedCount = 0;
+        if (not _isActivated)
+            return correctedCount;
+
+        for (auto& [mapId, mapFeature]: _localMap)
+        {
+            assert(mapId == mapFeature._id);
+            if (mapFeature.apply_correction(corrections))
+            {
+                update_spatial_index(_localIndex, mapFeature);
+                ++correctedCount;
+            }
+        }
+        return correctedCount;
+    }
+
+    /**
+     * \brief Move the local map features with the corrections of a loop closure. The staged features are dropped
+     * \param[in] corrections The corrections of a pose graph optimization
+     * \return The number of moved features
+     */
+    size_t apply_corrections(const pose_optimization::Pose_Graph_Corrections& corrections) noexcept
+    {
+        size_t correctedCount = 0;
+        if (not _isActivated)
+            return correctedCount;
+
+        for (auto& [mapId, mapFeature]: _localMap)
+        {
+            assert(mapId == mapFeature._id);
+            if (mapFeature.apply_correction(corrections))
+            {
+                update_spatial_index(_localIndex, mapFeature);
+                ++correctedCount;
+            }
+        }
+        // the staged features were measured in the uncorrected world, and are not validated yet
+        _stagedMap.clear();
+        _stagedIndex.clear();
+        return correctedCount;
+    }
+
     /**
      * \brief add a single detected feature to the staged map
      * \param[in] poseCovariance Covariance of the pose where those features were detected
@@ -418,6 +863,7 @@ class Feature_Map
 
                 // add to staged map
                 _stagedMap.emplace(newStagedFeature._id, newStagedFeature);
+                update_spatial_index(_stagedIndex, newStagedFeature);
             }
             catch (const std::exception& ex)
             {
@@ -433,11 +879,14 @@ class Feature_Map
      * \param[in] cameraToWorld A matrix to convert from camera to world space
      * \param[in] detectedFeatures The object that contains the detected features to add
      * \param[in] usedIndices All indices matched and used in update step
+     * \param[in] shouldApplyAdmissionBudget If false, all the features are admitted in the room of the staged map.
+     * Used when the map is (re)started: the frame is its only source of new features
      */
     void add_features_to_staged_map(const matrix33& poseCovariance,
                                     const CameraToWorldMatrix& cameraToWorld,
                                     const DetectedFeatureContainer& detectedFeatures,
-                                    const matchIndexSet& usedIndices)
+                                    const matchIndexSet& usedIndices,
+                                    const bool shouldApplyAdmissionBudget = true)
     {
         if (not _isActivated)
             return;
@@ -448,23 +897,46 @@ class Feature_Map
 
         const auto& detected = get_detected_feature(detectedFeatures);
 
-        // Add all unmatched features to staged feature container
+        // the unmatched features that can be staged
         const size_t featureVectorSize = detected.size();
         assert(featureVectorSize == static_cast<size_t>(_isDetectedFeatureMatched.size()));
+        _admissionCandidates.clear();
         for (unsigned int i = 0; i < featureVectorSize; ++i)
         {
             // index already used, pass
             if (usedIndices.contains(i))
                 continue;
 
-            assert(i < featureVectorSize);
             const DetectedFeatureType& detectedfeature = detected.at(i);
-            add_detected_feature_to_staged_map(poseCovariance, cameraToWorld, detectedfeature);
+            if (not StagedFeatureType::can_add_to_map(detectedfeature))
+                continue;
+            _admissionCandidates.emplace_back(i,
+                                              StagedFeatureType::get_admission_cell(detectedfeature),
+                                              StagedFeatureType::get_admission_score(detectedfeature));
+        }
+
+        // admit the best candidates of the frame, in the room left in the staged map: the selection is made once the
+        // room is known, so a staged map that stays full still admits the best spread candidates
+        size_t admittedCount = _admissionCandidates.size();
+        const size_t admissionBudget = shouldApplyAdmissionBudget ? get_staged_admission_budget() : 0;
+        if (admissionBudget > 0)
+            admittedCount = std::min(admittedCount, admissionBudget);
+        const size_t stagedCapacity = get_staged_capacity();
+        if (stagedCapacity > 0)
+            admittedCount = make_staged_room(stagedCapacity, admittedCount);
+        if (admittedCount < _admissionCandidates.size())
+            select_admitted_candidates(admittedCount);
+
+        for (size_t i = 0; i < admittedCount; ++i)
+        {
+            add_detected_feature_to_staged_map(
+                    poseCovariance, cameraToWorld, detected.at(_admissionCandidates[i]._detectedIndex));
         }
     }
 
     /**
-     * \brief Add all detected features to the staged features
+     * \brief Add all detected features to the staged features, without the admission budget of a frame. They are
+     * still bounded by the staged map capacity
      * \param[in] poseCovariance Covariance of the pose where those features were detected
      * \param[in] cameraToWorld A matrix to convert from camera to world space
      * \param[in] detectedFeatures The object that contains the detected features to add
@@ -474,7 +946,7 @@ class Feature_Map
                                         const DetectedFeatureContainer& detectedFeatures)
     {
         const matchIndexSet usedIndices; // no used indices, all feature will be added
-        add_features_to_staged_map(poseCovariance, cameraToWorld, detectedFeatures, usedIndices);
+        add_features_to_staged_map(poseCovariance, cameraToWorld, detectedFeatures, usedIndices, false);
     }
 
     /**
@@ -500,6 +972,30 @@ class Feature_Map
         }
     }
 
+    /**
+     * \brief Update this map with a tracked frame that is not a keyframe: unmatch the outliers, and track the local
+     * features that are still matched
+     * \param[in] outlierMatched A container of the wrong matches detected after the optimization process
+     */
+    void update_tracking_only(const matches_containers::match_container& outlierMatched) noexcept
+    {
+        if (not _isActivated)
+            return;
+
+        mark_outliers_as_unmatched(outlierMatched);
+
+        // the outliers are not tracked anymore, and the features matched since the last keyframe are
+        _trackedIds.clear();
+        for (const size_t id: _matchedIds)
+        {
+            const auto featureIterator = _localMap.find(id);
+            if (featureIterator != _localMap.end() and featureIterator->second.is_matched())
+                _trackedIds.push_back(id);
+        }
+        // the matched ids are not ordered: keep the tracking order deterministic
+        std::ranges::sort(_trackedIds);
+    }
+
     /**
      * \brief Mark the map feature with the given id as unmatched
      * \param[in] featureId The id of the feature to mark as unmatched
@@ -586,44 +1082,120 @@ class Feature_Map
      */
     void deactivate() noexcept { _isActivated = false; }
 
+    /**
+     * \brief An upper bound of the number of features that the next update will create: one per detected feature
+     */
+    [[nodiscard]] size_t get_maximum_new_feature_count() const noexcept
+    {
+        return static_cast<size_t>(_isDetectedFeatureMatched.size());
+    }
+
     [[nodiscard]] size_t get_local_map_size() const noexcept { return _localMap.size(); };
+    [[nodiscard]] size_t get_tracked_count() const noexcept { return _trackedIds.size(); };
     [[nodiscard]] size_t get_staged_map_size() const noexcept { return _stagedMap.size(); };
     [[nodiscard]] size_t size() const noexcept { return get_local_map_size() + get_staged_map_size(); };
 
     /**
-     * \brief compute the upgraded features and remove them from the map
+     * \brief Add the estimated memory of the local and staged maps (storage, spatial indexes and buffers) to the
+     * metrics. The features add the memory they allocate outside of the storage.
+     * The descriptor pool is shared by all the maps of the process: only the rows used by the features of this map
+     * are counted, so that several maps do not count the whole pool
+     * \param[in, out] metrics The metrics to fill
      */
-    [[nodiscard]] std::vector<UpgradedFeature_ptr> get_upgraded_features(const CameraToWorldMatrix& cameraToWorld)
+    void add_memory_usage(outputs::Frame_Metrics& metrics) const noexcept
     {
-        auto upgradedMapFeatures = get_upgraded_map_features(cameraToWorld);
-        auto upgradedStagedFeatures = get_upgraded_staged_features(cameraToWorld);
-        upgradedMapFeatures.insert(
-                upgradedMapFeatures.end(), upgradedStagedFeatures.begin(), upgradedStagedFeatures.end());
-        return upgradedMapFeatures;
+        if constexpr (requires { requires std::is_same_v<decltype(MapFeatureType::_descriptor),
+                                                          tracking::Pooled_Descriptor>; })
+        {
+            metrics.add_memory_usage(outputs::Memory_Consumer::Descriptors,
+                                     size() * static_cast<size_t>(tracking::Descriptor_Pool::descriptorSize));
+        }
+
+        const size_t localBytes =
+                _localMap.get_allocated_bytes() + _localIndex.get_allocated_bytes() +
+                outputs::get_allocated_bytes(_visibleCandidates) +
+                outputs::get_allocated_bytes(_localUpgradeCandidates) + outputs::get_allocated_bytes(_matchedIds) +
+                outputs::get_allocated_bytes(_trackedIds) +
+                static_cast<size_t>(_isDetectedFeatureMatched.size() + _isCandidateProjected.size()) * sizeof(bool);
+        metrics.add_memory_usage(get_local_memory_consumer(), localBytes);
+        for (const auto& [id, mapFeature]: _localMap)
+            mapFeature.add_memory_usage(metrics);
+
+        const size_t stagedBytes = _stagedMap.get_allocated_bytes() + _stagedIndex.get_allocated_bytes() +
+                                   outputs::get_allocated_bytes(_stagedUpgradeCandidates);
+        metrics.add_memory_usage(get_staged_memory_consumer(), stagedBytes);
+        for (const auto& [id, stagedFeature]: _stagedMap)
+            stagedFeature.add_memory_usage(metrics);
     }
 
     /**
-     * \brief Add the new features of correct type to the local map
-     * \return the number of feature added to the map ( <= upgradedFeatures.size())
+     * \brief compute the upgraded features and remove them from the map
+     * \param[in] cameraToWorld A matrix to convert from camera to world space
+     * \param[out] upgradedFeatures The upgraded features. Keeps its capacity between the frames
      */
-    size_t add_upgraded_features(const std::vector<UpgradedFeature_ptr>& upgradedFeatures)
+    void compute_upgraded_features(const CameraToWorldMatrix& cameraToWorld,
+                                   std::vector<upgraded_feature_type>& upgradedFeatures) noexcept
     {
-        size_t addedFeatures = 0;
-        for (const auto& upgraded: upgradedFeatures)
-        {
-            // if they are the same type, add this new feature
-            if (upgraded->get_type() == get_feature_type())
-            {
-                add_upgraded_to_local_map(upgraded);
-                addedFeatures += 1;
-            }
-        }
-        return addedFeatures;
+        // only the features flagged by the last update are tested, most frames have none
+        upgradedFeatures.clear();
+        upgrade_candidates(_localMap, _localIndex, _localUpgradeCandidates, cameraToWorld, upgradedFeatures);
+        upgrade_candidates(_stagedMap, _stagedIndex, _stagedUpgradeCandidates, cameraToWorld, upgradedFeatures);
     }
 
   protected:
-    // shortcut to add map features
-    virtual void add_upgraded_to_local_map(const UpgradedFeature_ptr upgradedfeature) = 0;
+    /**
+     * \brief Move a lost local feature to the out of core storage of this map. Does nothing if this map type has none
+     */
+    virtual void store_lost_feature(const MapFeatureType& lostFeature) noexcept { std::ignore = lostFeature; }
+
+    /**
+     * \brief Add the stored features visible from a camera pose to the local map, and remove them from the storage
+     * \param[in] worldToCamera A matrix to convert from world to camera space
+     * \return The number of features added to the local map
+     */
+    virtual size_t load_stored_features(const WorldToCameraMatrix& worldToCamera) noexcept
+    {
+        std::ignore = worldToCamera;
+        return 0;
+    }
+
+    /**
+     * \brief Remove all the features of the out of core storage
+     */
+    virtual void clear_stored_features() noexcept {}
+
+    /**
+     * \brief Match the detected features to the local map features by descriptor only. Does nothing if this map type
+     * cannot relocalize
+     * \param[in] detectedFeatures The detected features
+     * \param[in, out] matches The container in which to add the matches
+     */
+    virtual void find_relocalization_matches(const DetectedFeaturesObject& detectedFeatures,
+                                             matches_containers::match_container& matches) noexcept
+    {
+        std::ignore = detectedFeatures;
+        std::ignore = matches;
+    }
+
+    /**
+     * \brief Write the sections of this map type to a map state file. Does nothing if this map type cannot be saved
+     * \param[in, out] writer The map state file in construction
+     */
+    virtual void write_features(Map_State_Writer& writer) const noexcept { std::ignore = writer; }
+
+    /**
+     * \brief Restore the features of the sections of this map type from a map state file
+     * \param[in] reader The map state file
+     * \return The number of restored features
+     */
+    virtual size_t read_features(const Map_State_Reader& reader) noexcept
+    {
+        std::ignore = reader;
+        return 0;
+    }
+
+    [[nodiscard]] const localMapType& get_local_map() const noexcept { return _localMap; }
+    [[nodiscard]] const stagedMapType& get_staged_map() const noexcept { return _stagedMap; }
 
     /**
      * \brief return the object thta contains the matches between detected and map feature. Set the
@@ -647,26 +1219,11 @@ class Feature_Map
         // reset match status
         _isDetectedFeatureMatched = vectorb::Zero(detectedFeatures.size());
         matches.clear();
+        reset_matched_features();
 
-        // search matches in local map first
-        for (auto& [mapId, mapFeature]: _localMap)
-        {
-            assert(mapId == mapFeature._id);
-            // start by reseting this feature
-            mapFeature.mark_unmatched();
-
-            if (mapFeature.is_moving() or not mapFeature.is_visible(worldToCamera))
-                continue;
-
-            const matchIndexSet& matchIndexes = mapFeature.find_matches(
-                    detectedFeatures, worldToCamera, _isDetectedFeatureMatched, matches, true, useAdvancedMatch);
-            if (not matchIndexes.empty())
-            {
-                mapFeature.mark_matched(matchIndexes);
-                for (const auto matchIndex: matchIndexes)
-                    _isDetectedFeatureMatched[matchIndex] = true;
-            }
-        }
+        // search matches in local map first, in the features that can be visible
+        _localIndex.get_visible_candidates(worldToCamera, _visibleCandidates);
+        match_features(_localMap, detectedFeatures, worldToCamera, true, useAdvancedMatch, matches);
 
         // if we have enough features from local map to run the optimization, no need to add the staged features
         // Still, we need to try and match them to insure tracking and new map features
@@ -674,28 +1231,239 @@ class Feature_Map
         const bool shouldUseStagedFeatures = matches.size() < minimumFeaturesForOptimization * 3;
 
         // search matches in staged map second
-        for (auto& [mapId, mapFeature]: _stagedMap)
+        _stagedIndex.get_visible_candidates(worldToCamera, _visibleCandidates);
+        match_features(_stagedMap, detectedFeatures, worldToCamera, shouldUseStagedFeatures, useAdvancedMatch, matches);
+    }
+
+    /**
+     * \brief Match the map features of _visibleCandidates, and set the _isDetectedFeatureMatched flags.
+     * The candidate matches of all features are searched in parallel, without modifying the map. Then the detected
+     * features found by several map features go to the one with the best match score (the first in search order on
+     * ties), and the features that lost a match search again, in order, in the remaining detected features. The
+     * result does not depend on the scheduling.
+     * \param[in, out] map The local or staged map, containing the features of _visibleCandidates
+     * \param[in] detectedFeatures The object of detected features to match
+     * \param[in] worldToCamera A matrix to convert from world to camera space
+     * \param[in] shouldAddToMatches If false, the features are marked as matched but not added to matches
+     * \param[in] useAdvancedMatch If true, search the matches further, with a lesser accuracy
+     * \param[in, out] matches The matches between map objects and detected features
+     */
+    template<class MapType>
+    void match_features(MapType& map,
+                        const DetectedFeaturesObject& detectedFeatures,
+                        const WorldToCameraMatrix& worldToCamera,
+                        const bool shouldAddToMatches,
+                        const bool useAdvancedMatch,
+                        matches_containers::match_container& matches) noexcept
+    {
+        struct Match_Proposal
         {
-            assert(mapId == mapFeature._id);
-            // start by reseting this feature
-            mapFeature.mark_unmatched();
+            typename MapType::iterator _feature;
+            matchIndexSet _matchIndexes;
+            matches_containers::match_container _matches;
+        };
+
+        // the candidates that are points are projected to screen space once, in a vectorized batch
+        project_features(map, _visibleCandidates, worldToCamera, _isCandidateProjected, _candidateProjections);
+        const auto find_candidate_matches = [&](const size_t i,
+                                                const auto& mapFeature,
+                                                matches_containers::match_container& candidateMatches) {
+            const Eigen::Index candidateIndex = static_cast<Eigen::Index>(i);
+            if (_isCandidateProjected[candidateIndex])
+            {
+                return mapFeature.find_matches_from_projection(_candidateProjections.get_2D(i),
+                                                               detectedFeatures,
+                                                               worldToCamera,
+                                                               _isDetectedFeatureMatched,
+                                                               candidateMatches,
+                                                               shouldAddToMatches,
+                                                               useAdvancedMatch);
+            }
+            return mapFeature.find_matches(detectedFeatures,
+                                           worldToCamera,
+                                           _isDetectedFeatureMatched,
+                                           candidateMatches,
+                                           shouldAddToMatches,
+                                           useAdvancedMatch);
+        };
+
+        // phase one: read only search of the candidate matches, in parallel
+        const size_t candidateCount = _visibleCandidates.size();
+        std::vector<Match_Proposal> proposals(candidateCount, Match_Proposal {map.end(), {}, {}});
+        tbb::parallel_for(size_t(0), candidateCount, [&](const size_t i) {
+            const auto mapFeatureIterator = map.find(_visibleCandidates[i]);
+            assert(mapFeatureIterator != map.end());
+            if (mapFeatureIterator == map.end())
+                return;
+
+            const auto& mapFeature = mapFeatureIterator->second;
+            assert(_visibleCandidates[i] == mapFeature._id);
+            const Eigen::Index candidateIndex = static_cast<Eigen::Index>(i);
+            const bool isVisible = _isCandidateProjected[candidateIndex]
+                                         ? _candidateProjections._isVisible[candidateIndex]
+                                         : mapFeature.is_visible(worldToCamera);
+            if (mapFeature.is_moving() or not isVisible)
+                return;
+
+            Match_Proposal& proposal = proposals[i];
+            proposal._feature = mapFeatureIterator;
+            proposal._matchIndexes = find_candidate_matches(i, mapFeature, proposal._matches);
+        });
+
+        // phase two: give each detected feature to the proposal with the best score, in search order
+        static constexpr size_t noOwner = std::numeric_limits<size_t>::max();
+        std::vector<size_t> owners(static_cast<size_t>(_isDetectedFeatureMatched.size()), noOwner);
+        std::vector<double> ownerScores(owners.size(), std::numeric_limits<double>::quiet_NaN());
+        for (size_t i = 0; i < candidateCount; ++i)
+        {
+            const Match_Proposal& proposal = proposals[i];
+            for (const size_t matchIndex: proposal._matchIndexes)
+            {
+                assert(matchIndex < owners.size());
+                size_t& owner = owners[matchIndex];
+                if (owner == noOwner)
+                {
+                    owner = i;
+                    continue;
+                }
+
+                // contested match: scores are only computed for those, they are rare
+                const auto get_score = [&](const Match_Proposal& contester) {
+                    return contester._feature->second.get_match_score(detectedFeatures, worldToCamera, matchIndex);
+                };
+                double& ownerScore = ownerScores[matchIndex];
+                if (std::isnan(ownerScore))
+                    ownerScore = get_score(proposals[owner]);
+                const double score = get_score(proposal);
+                if (score > ownerScore)
+                {
+                    owner = i;
+                    ownerScore = score;
+                }
+            }
+        }
+
+        const auto accept_matches = [this](typename MapType::iterator mapFeatureIterator,
+                                           const matchIndexSet& matchIndexes) {
+            mapFeatureIterator->second.mark_matched(matchIndexes);
+            _matchedIds.emplace(mapFeatureIterator->first);
+            for (const auto matchIndex: matchIndexes)
+                _isDetectedFeatureMatched[matchIndex] = true;
+        };
 
-            if (mapFeature.is_moving() or not mapFeature.is_visible(worldToCamera))
+        std::vector<size_t> rejectedProposals;
+        for (size_t i = 0; i < candidateCount; ++i)
+        {
+            Match_Proposal& proposal = proposals[i];
+            if (proposal._matchIndexes.empty())
                 continue;
 
-            const matchIndexSet& matchIndexes = mapFeature.find_matches(detectedFeatures,
-                                                                        worldToCamera,
-                                                                        _isDetectedFeatureMatched,
-                                                                        matches,
-                                                                        shouldUseStagedFeatures,
-                                                                        useAdvancedMatch);
-            if (not matchIndexes.empty())
+            const bool isOwner = std::ranges::all_of(proposal._matchIndexes, [&](const size_t matchIndex) {
+                return owners[matchIndex] == i;
+            });
+            if (isOwner)
+            {
+                accept_matches(proposal._feature, proposal._matchIndexes);
+                matches.splice(matches.end(), proposal._matches);
+            }
+            else
+                rejectedProposals.emplace_back(i);
+        }
+
+        // the features that lost a match search again, in the detected features that are left
+        for (const size_t i: rejectedProposals)
+        {
+            const typename MapType::iterator mapFeatureIterator = proposals[i]._feature;
+            matches_containers::match_container newMatches;
+            const matchIndexSet& matchIndexes = find_candidate_matches(i, mapFeatureIterator->second, newMatches);
+            // tracking matches ignore the flags
+            const bool isAlreadyMatched = std::ranges::any_of(matchIndexes, [this](const size_t matchIndex) {
+                return _isDetectedFeatureMatched[matchIndex];
+            });
+            if (matchIndexes.empty() or isAlreadyMatched)
+                continue;
+
+            accept_matches(mapFeatureIterator, matchIndexes);
+            matches.splice(matches.end(), newMatches);
+        }
+    }
+
+    /**
+     * \brief Project the features of a map that give a projected point to screen space, in one vectorized batch
+     * \param[in] map The local or staged map
+     * \param[in] ids The ids of the features to project, in iteration order
+     * \param[in] worldToCamera A matrix to convert from world to camera space
+     * \param[out] isProjected For each id, true if that feature was projected in the batch
+     * \param[out] projections The screen projection of each id, only valid where isProjected is set
+     */
+    template<class MapType, class IdContainer>
+    static void project_features(const MapType& map,
+                                 const IdContainer& ids,
+                                 const WorldToCameraMatrix& worldToCamera,
+                                 vectorb& isProjected,
+                                 ScreenCoordinateBatch& projections) noexcept
+    {
+        const Eigen::Index featureCount = static_cast<Eigen::Index>(ids.size());
+        matrix3X worldPoints = matrix3X::Zero(3, featureCount);
+        isProjected = vectorb::Zero(featureCount);
+
+        Eigen::Index featureIndex = 0;
+        for (const size_t id: ids)
+        {
+            const auto mapFeatureIterator = map.find(id);
+            if (vector3 worldPoint;
+                mapFeatureIterator != map.cend() and mapFeatureIterator->second.get_projected_point(worldPoint))
             {
-                mapFeature.mark_matched(matchIndexes);
-                for (const auto matchIndex: matchIndexes)
-                    _isDetectedFeatureMatched[matchIndex] = true;
+                worldPoints.col(featureIndex) = worldPoint;
+                isProjected[featureIndex] = true;
             }
+            ++featureIndex;
         }
+        project_to_screen(worldToCamera, worldPoints, projections);
+    }
+
+    /**
+     * \brief Update all the features of a map with their matches, in parallel. A match update only modifies the
+     * updated feature
+     * \param[in, out] map The local or staged map
+     * \param[in] cameraToWorld A matrix to convert from camera to world space
+     * \param[in] poseCovariance The covariance of the pose where the detected features were observed
+     * \param[in] detectedFeatureObject The object of detected features
+     * \return For each feature, in storage order, the indexes of the matches that updated it
+     */
+    template<class MapType>
+    [[nodiscard]] static std::vector<matchIndexSet> update_with_matches(
+            MapType& map,
+            const CameraToWorldMatrix& cameraToWorld,
+            const matrix33& poseCovariance,
+            const DetectedFeaturesObject& detectedFeatureObject) noexcept
+    {
+        // the transformations of this pose are computed once, for all the features
+        const utils::Frame_Transform_Context frameTransform(cameraToWorld, poseCovariance);
+
+        std::vector<matchIndexSet> updatedMatchIndexes(map.size());
+        tbb::parallel_for(size_t(0), map.size(), [&](const size_t featureIndex) {
+            auto& mapFeature = (map.begin() + static_cast<std::ptrdiff_t>(featureIndex))->second;
+            for (const auto i: mapFeature._matchIndexes)
+            {
+                assert(i < detectedFeatureObject.size());
+                if (mapFeature.update_with_match(detectedFeatureObject.at(i), frameTransform))
+                    updatedMatchIndexes[featureIndex].emplace(i);
+            }
+        });
+        return updatedMatchIndexes;
+    }
+
+    /**
+     * \brief Erase the update result of an erased feature, the same way the map storage erases the feature: the
+     * results stay in the storage order of the features
+     */
+    static void erase_update_result(std::vector<matchIndexSet>& updatedMatchIndexes, const size_t featureIndex) noexcept
+    {
+        assert(featureIndex < updatedMatchIndexes.size());
+        if (featureIndex + 1 != updatedMatchIndexes.size())
+            updatedMatchIndexes[featureIndex] = std::move(updatedMatchIndexes.back());
+        updatedMatchIndexes.pop_back();
     }
 
     matchIndexSet update_local_map(const CameraToWorldMatrix& cameraToWorld,
@@ -708,6 +1476,11 @@ class Feature_Map
 
         matchIndexSet usedIndices;
         std::map<size_t, std::vector<size_t>> detectedIdToMapId;
+        // the tracked set is refreshed with this traversal: the features leave it when unmatched or lost
+        _trackedIds.clear();
+
+        std::vector<matchIndexSet> updatedMatchIndexes =
+                update_with_matches(_localMap, cameraToWorld, poseCovariance, detectedFeatureObject);
 
         typename localMapType::iterator featureMapIterator = _localMap.begin();
         while (featureMapIterator != _localMap.end())
@@ -716,32 +1489,29 @@ class Feature_Map
             MapFeatureType& mapFeature = featureMapIterator->second;
             assert(featureMapIterator->first == mapFeature._id);
 
-            bool hasSuccess = false;
-            for (const auto i: mapFeature._matchIndexes)
+            const size_t featureIndex = static_cast<size_t>(featureMapIterator - _localMap.begin());
+            const bool hasSuccess = not updatedMatchIndexes[featureIndex].empty();
+            for (const auto i: updatedMatchIndexes[featureIndex])
             {
-                assert(i < detectedFeatureObject.size());
+                usedIndices.emplace(i);
 
-                const DetectedFeatureType& detectedFeature = detectedFeatureObject.at(i);
-                const bool res = mapFeature.update_with_match(detectedFeature, poseCovariance, cameraToWorld);
-                if (res)
+                if (detectedIdToMapId.contains(i))
                 {
-                    hasSuccess = true;
-                    usedIndices.emplace(i);
-
-                    if (detectedIdToMapId.contains(i))
-                    {
-                        detectedIdToMapId[i].push_back(mapFeature._id);
-                    }
-                    else
-                    {
-                        detectedIdToMapId.emplace(i, std::vector<size_t>());
-                        detectedIdToMapId[i].push_back(mapFeature._id);
-                    }
+                    detectedIdToMapId[i].push_back(mapFeature._id);
+                }
+                else
+                {
+                    detectedIdToMapId.emplace(i, std::vector<size_t>());
+                    detectedIdToMapId[i].push_back(mapFeature._id);
                 }
             }
 
             if (hasSuccess)
+            {
                 mapFeature.update_matched();
+                // the match update moved this feature
+                update_spatial_index(_localIndex, mapFeature);
+            }
             else
                 mapFeature.update_unmatched();
 
@@ -751,13 +1521,21 @@ class Feature_Map
                 {
                     // write to file
                     mapFeature.write_to_file(mapWriter);
+                    // it can be matched again when its area is visible
+                    store_lost_feature(mapFeature);
                 }
 
                 // Remove useless feature
+                _localIndex.remove(mapFeature._id);
                 featureMapIterator = _localMap.erase(featureMapIterator);
+                erase_update_result(updatedMatchIndexes, featureIndex);
             }
             else
             {
+                if (mapFeature._isUpgradeCandidate)
+                    _localUpgradeCandidates.emplace_back(mapFeature._id);
+                if (mapFeature.is_matched())
+                    _trackedIds.push_back(mapFeature._id);
                 ++featureMapIterator;
             }
         }
@@ -773,6 +1551,9 @@ class Feature_Map
 
         matchIndexSet usedIndices;
 
+        std::vector<matchIndexSet> updatedMatchIndexes =
+                update_with_matches(_stagedMap, cameraToWorld, poseCovariance, detectedFeatureObject);
+
         // Add correct staged features to local map
         typename stagedMapType::iterator stagedFeatureIterator = _stagedMap.begin();
         while (stagedFeatureIterator != _stagedMap.end())
@@ -780,25 +1561,18 @@ class Feature_Map
             StagedFeatureType& stagedFeature = stagedFeatureIterator->second;
             assert(stagedFeatureIterator->first == stagedFeature._id);
 
-            bool hasSuccess = false;
-            for (const auto i: stagedFeature._matchIndexes)
-            {
-                assert(i < detectedFeatureObject.size());
-
-                const DetectedFeatureType& detectedFeature = detectedFeatureObject.at(i);
+            // the matched detected features are used, even if the update failed
+            usedIndices.insert(stagedFeature._matchIndexes.cbegin(), stagedFeature._matchIndexes.cend());
 
-                const bool res = stagedFeature.update_with_match(detectedFeature, poseCovariance, cameraToWorld);
-                if (res)
-                {
-                    hasSuccess = true;
-                    usedIndices.emplace(i);
-                }
-
-                usedIndices.emplace(i);
-            }
+            const size_t featureIndex = static_cast<size_t>(stagedFeatureIterator - _stagedMap.begin());
+            const bool hasSuccess = not updatedMatchIndexes[featureIndex].empty();
 
             if (hasSuccess)
+            {
                 stagedFeature.update_matched();
+                // the match update moved this feature
+                update_spatial_index(_stagedIndex, stagedFeature);
+            }
             else
                 stagedFeature.update_unmatched();
 
@@ -807,9 +1581,17 @@ class Feature_Map
                 try
                 {
                     // Add to local map, remove from staged features, with a copy of the id affected to the local map
-                    _localMap.emplace(stagedFeature._id, MapFeatureType(stagedFeature));
-                    assert(_localMap.at(stagedFeature._id)._id == stagedFeature._id);
+                    const auto& [newFeatureIterator, isInserted] =
+                            _localMap.emplace(stagedFeature._id, MapFeatureType(stagedFeature));
+                    assert(isInserted and newFeatureIterator->second._id == stagedFeature._id);
+                    update_spatial_index(_localIndex, newFeatureIterator->second);
+                    if (newFeatureIterator->second._isUpgradeCandidate)
+                        _localUpgradeCandidates.emplace_back(stagedFeature._id);
+                    if (newFeatureIterator->second.is_matched())
+                        _trackedIds.push_back(stagedFeature._id);
+                    _stagedIndex.remove(stagedFeature._id);
                     stagedFeatureIterator = _stagedMap.erase(stagedFeatureIterator);
+                    erase_update_result(updatedMatchIndexes, featureIndex);
                 }
                 catch (const std::exception& ex)
                 {
@@ -821,10 +1603,14 @@ class Feature_Map
             else if (stagedFeature.should_remove_from_staged())
             {
                 // Remove from staged features
+                _stagedIndex.remove(stagedFeature._id);
                 stagedFeatureIterator = _stagedMap.erase(stagedFeatureIterator);
+                erase_update_result(updatedMatchIndexes, featureIndex);
             }
             else
             {
+                if (stagedFeature._isUpgradeCandidate)
+                    _stagedUpgradeCandidates.emplace_back(stagedFeature._id);
                 // Increment
                 ++stagedFeatureIterator;
             }
@@ -834,7 +1620,8 @@ class Feature_Map
 
     void update_local_map_with_no_tracking(std::shared_ptr<outputs::IMap_Writer> mapWriter) noexcept
     {
-        // update the local map with no matchs
+        // update the local map with no matchs: no feature is tracked in the next frame
+        _trackedIds.clear();
         typename localMapType::iterator featureMapIterator = _localMap.begin();
         while (featureMapIterator != _localMap.end())
         {
@@ -847,8 +1634,11 @@ class Feature_Map
             {
                 // write to file
                 mapFeature.write_to_file(mapWriter);
+                if (not mapFeature.is_moving())
+                    store_lost_feature(mapFeature);
 
                 // Remove useless feature
+                _localIndex.remove(mapFeature._id);
                 featureMapIterator = _localMap.erase(featureMapIterator);
             }
             else
@@ -871,6 +1661,7 @@ class Feature_Map
             if (stagedFeature.should_remove_from_staged())
             {
                 // Remove useless feature
+                _stagedIndex.remove(stagedFeature._id);
                 stagedFeatureIterator = _stagedMap.erase(stagedFeatureIterator);
             }
             else
@@ -880,89 +1671,220 @@ class Feature_Map
         }
     }
 
-    [[nodiscard]] std::vector<UpgradedFeature_ptr> get_upgraded_map_features(
-            const CameraToWorldMatrix& cameraToWorld) noexcept
+    /**
+     * \brief Test the upgrade candidates of a map, flagged by the last update, and remove the upgraded features.
+     * The flags of the candidates that are not upgraded are reset
+     * \param[in, out] map The local or staged map
+     * \param[in, out] index The spatial index of the map
+     * \param[in, out] candidateIds The ids of the upgrade candidates of this map. Cleared by this function
+     * \param[in] cameraToWorld A matrix to convert from camera to world space
+     * \param[in, out] upgradedFeatures The upgraded features, to which the new ones are added
+     */
+    template<class MapType>
+    void upgrade_candidates(MapType& map,
+                            Spatial_Hash& index,
+                            std::vector<size_t>& candidateIds,
+                            const CameraToWorldMatrix& cameraToWorld,
+                            std::vector<upgraded_feature_type>& upgradedFeatures) noexcept
     {
-        std::vector<UpgradedFeature_ptr> upgradedFeatures;
-
-        typename localMapType::iterator mapFeatureIterator = _localMap.begin();
-        while (mapFeatureIterator != _localMap.end())
+        for (const size_t id: candidateIds)
         {
-            MapFeatureType& mapFeature = mapFeatureIterator->second;
-            assert(mapFeatureIterator->first == mapFeature._id);
+            const auto featureIterator = map.find(id);
+            if (featureIterator == map.end())
+                continue;
+
+            auto& feature = featureIterator->second;
+            assert(featureIterator->first == feature._id);
+            feature._isUpgradeCandidate = false;
 
-            UpgradedFeature_ptr upgraded;
-            if (mapFeature.compute_upgraded(cameraToWorld, upgraded))
+            if (upgraded_feature_type upgraded; feature.compute_upgraded(cameraToWorld, upgraded))
             {
-                if (upgraded == nullptr)
-                {
-                    outputs::log_error(get_display_name() + ": compute_upgraded returned null");
-                    ++mapFeatureIterator;
-                    continue;
-                }
-                upgradedFeatures.push_back(upgraded);
+                upgradedFeatures.push_back(std::move(upgraded));
                 // Remove the upgraded feature
-                mapFeatureIterator = _localMap.erase(mapFeatureIterator);
-            }
-            else
-            {
-                ++mapFeatureIterator;
+                index.remove(feature._id);
+                map.erase(featureIterator);
             }
         }
-        return upgradedFeatures;
+        candidateIds.clear();
     }
 
-    [[nodiscard]] std::vector<UpgradedFeature_ptr> get_upgraded_staged_features(
-            const CameraToWorldMatrix& cameraToWorld) noexcept
+    void add_to_staged_map(const StagedFeatureType& newFeature)
     {
-        std::vector<UpgradedFeature_ptr> upgradedFeatures;
-
-        typename stagedMapType::iterator stagedFeatureIterator = _stagedMap.begin();
-        while (stagedFeatureIterator != _stagedMap.end())
+        // check that no feature with the same id exists
+        if (not _stagedMap.contains(newFeature._id))
         {
-            StagedFeatureType& stagedFeature = stagedFeatureIterator->second;
-            assert(stagedFeatureIterator->first == stagedFeature._id);
-
-            UpgradedFeature_ptr upgraded;
-            if (stagedFeature.compute_upgraded(cameraToWorld, upgraded))
-            {
-                if (upgraded == nullptr)
-                {
-                    outputs::log_error(get_display_name() + ": compute_upgraded returned null");
-                    ++stagedFeatureIterator;
-                    continue;
-                }
-
-                upgradedFeatures.push_back(upgraded);
-                // Remove the upgraded feature
-                stagedFeatureIterator = _stagedMap.erase(stagedFeatureIterator);
-            }
-            else
-            {
-                ++stagedFeatureIterator;
-            }
+            _stagedMap.emplace(newFeature._id, newFeature);
+            update_spatial_index(_stagedIndex, newFeature);
+        }
+        else
+        {
+            outputs::log_error(get_display_name() + ": a staged feature with this id already exists");
         }
-        return upgradedFeatures;
     }
 
     void add_to_local_map(const MapFeatureType& newFeature)
+    {
+        std::ignore = emplace_in_local_map(newFeature._id, newFeature);
+    }
+
+    /**
+     * \brief Construct a feature in the local map storage
+     * \param[in] id The id of the new feature
+     * \param[in] args The arguments of the feature constructor. The constructed feature must have this id
+     * \return false if a feature with this id already exists
+     */
+    template<class... Args> bool emplace_in_local_map(const size_t id, Args&&... args)
     {
         // check that no feature with the same id exists
-        if (not _localMap.contains(newFeature._id))
+        if (_localMap.contains(id))
         {
-            _localMap.emplace(newFeature._id, newFeature);
+            outputs::log_error(get_display_name() + ": a feature with this id already exists");
+            return false;
         }
-        else
+
+        const MapFeatureType& newFeature = _localMap.emplace(id, std::forward<Args>(args)...).first->second;
+        assert(newFeature._id == id);
+        update_spatial_index(_localIndex, newFeature);
+        // upgraded features can keep the matches of the features they come from
+        if (newFeature.is_matched())
         {
-            outputs::log_error(get_display_name() + ": a feature with this id already exists");
+            _matchedIds.emplace(id);
+            _trackedIds.push_back(id);
         }
+        return true;
     }
 
   private:
+    /**
+     * \brief Place a feature in a spatial index, at its current position
+     * \param[in, out] index The spatial index of the map containing this feature
+     * \param[in] feature The feature to place
+     */
+    template<class FeatureType>
+    static void update_spatial_index(Spatial_Hash& index, const FeatureType& feature) noexcept
+    {
+        if (vector3 position; feature.get_spatial_position(position))
+            index.insert_or_update(feature._id, position);
+        else
+            index.insert_unbounded(feature._id);
+    }
+
+    /**
+     * \brief Keep the admitted candidates at the start of the admission candidates: the best candidate of each
+     * coverage cell, then the second best of each cell, and so on, the highest scores first in a rank
+     * \param[in] admittedCount The number of candidates to admit, lower than the candidate count (can be 0)
+     */
+    void select_admitted_candidates(const size_t admittedCount) noexcept
+    {
+        assert(admittedCount < _admissionCandidates.size());
+        std::ranges::sort(_admissionCandidates, [](const Admission_Candidate& a, const Admission_Candidate& b) {
+            return (a._cell != b._cell) ? a._cell < b._cell : a._score > b._score;
+        });
+        for (size_t i = 1; i < _admissionCandidates.size(); ++i)
+        {
+            if (_admissionCandidates[i]._cell == _admissionCandidates[i - 1]._cell)
+                _admissionCandidates[i]._rankInCell = _admissionCandidates[i - 1]._rankInCell + 1;
+        }
+
+        const auto admittedEnd = _admissionCandidates.begin() + static_cast<std::ptrdiff_t>(admittedCount);
+        std::nth_element(_admissionCandidates.begin(),
+                         admittedEnd,
+                         _admissionCandidates.end(),
+                         [](const Admission_Candidate& a, const Admission_Candidate& b) {
+                             return (a._rankInCell != b._rankInCell) ? a._rankInCell < b._rankInCell
+                                                                     : a._score > b._score;
+                         });
+        // stage in the detection order, so the staged ids do not depend on the selection
+        std::sort(_admissionCandidates.begin(),
+                  admittedEnd,
+                  [](const Admission_Candidate& a, const Admission_Candidate& b) {
+                      return a._detectedIndex < b._detectedIndex;
+                  });
+    }
+
+    /**
+     * \brief Evict the staged features with the lowest retention scores, until the admitted features fit in the
+     * staged map. Only the features not matched by this frame are evicted: they are already losing confidence
+     * \param[in] stagedCapacity The maximum number of staged features
+     * \param[in] admittedCount The number of features to stage
+     * \return The number of features that can be staged, lower than admittedCount if the staged map stays full
+     */
+    size_t make_staged_room(const size_t stagedCapacity, const size_t admittedCount) noexcept
+    {
+        if (_stagedMap.size() + admittedCount <= stagedCapacity)
+            return admittedCount;
+        const size_t excessCount = _stagedMap.size() + admittedCount - stagedCapacity;
+
+        _evictionCandidates.clear();
+        for (const auto& [id, stagedFeature]: _stagedMap)
+        {
+            if (not stagedFeature.is_matched())
+                _evictionCandidates.emplace_back(stagedFeature.get_retention_score(), id);
+        }
+        // ties broken by id: the oldest features are evicted first
+        const size_t evictedCount = std::min(excessCount, _evictionCandidates.size());
+        const auto evictedEnd = _evictionCandidates.begin() + static_cast<std::ptrdiff_t>(evictedCount);
+        std::nth_element(_evictionCandidates.begin(), evictedEnd, _evictionCandidates.end());
+        for (auto evicted = _evictionCandidates.begin(); evicted != evictedEnd; ++evicted)
+        {
+            _stagedIndex.remove(evicted->second);
+            _stagedMap.erase(evicted->second);
+        }
+
+        return (_stagedMap.size() < stagedCapacity) ? std::min(admittedCount, stagedCapacity - _stagedMap.size()) : 0;
+    }
+
+    /**
+     * \brief Mark as unmatched the features matched by the last match search
+     */
+    void reset_matched_features() noexcept
+    {
+        for (const size_t id: _matchedIds)
+        {
+            if (const auto mapFeatureIterator = _localMap.find(id); mapFeatureIterator != _localMap.end())
+                mapFeatureIterator->second.mark_unmatched();
+            else if (const auto stagedFeatureIterator = _stagedMap.find(id); stagedFeatureIterator != _stagedMap.end())
+                stagedFeatureIterator->second.mark_unmatched();
+        }
+        _matchedIds.clear();
+    }
+
     bool _isActivated; // if false, no updates will occur on this map object (no matches, no tracking, ...)
     localMapType _localMap;
     stagedMapType _stagedMap;
     vectorb _isDetectedFeatureMatched; // indicates if a detected feature is macthed to a local map feature
+
+    // visibility culling: the features are only matched if their voxel intersects the camera frustum
+    Spatial_Hash _localIndex;
+    Spatial_Hash _stagedIndex;
+    std::vector<size_t> _visibleCandidates; // buffer of the frustum queries
+    // ids of the features flagged for an upgrade test by the last update
+    std::vector<size_t> _localUpgradeCandidates;
+    std::vector<size_t> _stagedUpgradeCandidates;
+    // batch screen projection of the visible candidates, and flags of the candidates that are in the batch
+    ScreenCoordinateBatch _candidateProjections;
+    vectorb _isCandidateProjected;
+    std::unordered_set<size_t> _matchedIds; // ids of the features matched by the last match search (superset)
+    // staged map admission buffers, kept between the frames
+    struct Admission_Candidate
+    {
+        Admission_Candidate(const uint detectedIndex, const uint cell, const double score) :
+            _detectedIndex(detectedIndex),
+            _cell(cell),
+            _score(score)
+        {
+        }
+
+        uint _detectedIndex;
+        uint _cell;
+        uint _rankInCell = 0; // rank of the score in its coverage cell, 0 for the best
+        double _score;
+    };
+    std::vector<Admission_Candidate> _admissionCandidates;
+    std::vector<std::pair<double, size_t>> _evictionCandidates; // retention score and id of the unmatched staged
+    // ids of the local features matched at the last update, tracked in the next frame. Maintained by the updates,
+    // so the tracking does not go through the matches
+    std::vector<size_t> _trackedIds;
 };
 
 } // namespace rgbd_slam::map_management
@@ -2,14 +2,27 @@
 #define RGBDSLAM_MAPMANAGEMENT_LOCALMAP_HPP
 
 #include "covariances.hpp"
+#include "map_delta.hpp"
+#include "map_state_file.hpp"
 #include "outputs/map_writer.hpp"
 #include "matches_containers.hpp"
 #include "utils/pose.hpp"
+#include "utils/random.hpp"
 
 #include "camera_transformation.hpp"
 #include "outputs/logger.hpp"
+#include "outputs/trace_recorder.hpp"
 #include "parameters.hpp"
 
+#include <array>
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#include <tbb/task_group.h>
+
 namespace rgbd_slam::map_management {
 
 /**
@@ -22,7 +35,13 @@ template<class... Maps> class Local_Map
   public:
     Local_Map()
     {
+#ifdef USE_BINARY_MAP_WRITER
+        _mapWriter = std::make_unique<outputs::Binary_Map_Writer>("out");
+#else
         _mapWriter = std::make_unique<outputs::OBJ_Map_Writer>("out");
+#endif
+        for (auto& mapWriterBuffer: _mapWriterBuffers)
+            mapWriterBuffer = std::make_shared<outputs::Buffered_Map_Writer>();
 
         // For testing purposes, one can deactivate those maps
         /*
@@ -40,34 +59,46 @@ template<class... Maps> class Local_Map
     }
 
     /**
-     * \brief Return an object containing the tracked features in screen space (2D), with the associated global ids
+     * \brief Return an object containing the tracked features in screen space (2D), with the associated global ids.
+     * The maps keep their tracked sets with the updates: only the positions of the tracked features are computed here.
+     * The returned buffers are reused by the next call, once the caller released them
      * \param[in] lastPose The last known pose of the observer
+     * \param[in] predictedPose If set, the predicted pose of the observer in the next frame: the tracked points also
+     * get their predicted screen position, where the optical flow will start
      */
-    [[nodiscard]] TrackedFeaturesContainer get_tracked_features(const utils::Pose& lastPose) const noexcept
+    [[nodiscard]] TrackedFeaturesContainer get_tracked_features(
+            const utils::Pose& lastPose, const std::optional<utils::Pose>& predictedPose = std::nullopt) noexcept
     {
+        // a caller that still uses the last buffers keeps them
+        if (_trackedFeatures.trackedPoints.use_count() > 1 or _trackedFeatures.trackedPlanes.use_count() > 1)
+            _trackedFeatures = TrackedFeaturesContainer();
+        else
+            _trackedFeatures.clear();
+
         size_t numberOfFeaturesToTrack = 0;
         foreach_map([&numberOfFeaturesToTrack](const auto& map) {
-            numberOfFeaturesToTrack += map.get_local_map_size();
+            numberOfFeaturesToTrack += map.get_tracked_count();
         });
-
-        // initialize output structure
-        TrackedFeaturesContainer trackedFeatures;
-
         if (numberOfFeaturesToTrack == 0)
-            return trackedFeatures;
+            return _trackedFeatures;
 
-        // TODO: check the efficiency gain of those reserve calls
-        trackedFeatures.trackedPoints->reserve(numberOfFeaturesToTrack);
+        // keeps its capacity between calls
+        _trackedFeatures.trackedPoints->reserve(numberOfFeaturesToTrack);
 
         const WorldToCameraMatrix& worldToCamera = utils::compute_world_to_camera_transform(
                 lastPose.get_orientation_quaternion(), lastPose.get_position());
 
-        foreach_map([&worldToCamera, &trackedFeatures](const auto& map) {
-            constexpr uint refreshFrequency = parameters::detection::keypointRefreshFrequency * 2;
-            map.get_tracked_features(worldToCamera, trackedFeatures, refreshFrequency);
+        std::optional<WorldToCameraMatrix> predictedWorldToCamera;
+        if (predictedPose.has_value())
+            predictedWorldToCamera = utils::compute_world_to_camera_transform(
+                    predictedPose->get_orientation_quaternion(), predictedPose->get_position());
+
+        const uint refreshFrequency = Parameters::get_keypoint_refresh_frequency() * 2;
+        foreach_map([this, &worldToCamera, &predictedWorldToCamera, refreshFrequency](const auto& map) {
+            map.get_tracked_features(worldToCamera, predictedWorldToCamera, _trackedFeatures, refreshFrequency);
         });
 
-        return trackedFeatures;
+        return _trackedFeatures;
     }
 
     /**
@@ -91,6 +122,7 @@ template<class... Maps> class Local_Map
         const double findMatchesStartTime = static_cast<double>(cv::getTickCount());
 
         foreach_map([&detectedFeatures, &worldToCamera, &matchSets](auto& map) {
+            const outputs::Scoped_Trace trace("find_matches", map.get_display_name());
             map.get_matches(detectedFeatures, worldToCamera, map.minimum_features_for_opti(), matchSets);
         });
 
@@ -99,6 +131,26 @@ template<class... Maps> class Local_Map
         return matchSets;
     }
 
+    /**
+     * \brief Find matches for the given detected features from their descriptors only, with no pose prior. Used to
+     * relocalize the observer in the local map when the tracking is lost
+     * \param[in] detectedFeatures An object that contains the detected features
+     */
+    [[nodiscard]] matches_containers::match_container find_relocalization_matches(
+            const DetectedFeatureContainer& detectedFeatures) noexcept
+    {
+        const double findMatchesStartTime = static_cast<double>(cv::getTickCount());
+
+        matches_containers::match_container matchSets;
+        foreach_map([&detectedFeatures, &matchSets](auto& map) {
+            const outputs::Scoped_Trace trace("find_relocalization_matches", map.get_display_name());
+            map.get_relocalization_matches(detectedFeatures, matchSets);
+        });
+
+        findMatchDuration += (static_cast<double>(cv::getTickCount()) - findMatchesStartTime) / cv::getTickFrequency();
+        return matchSets;
+    }
+
     /**
      * \brief Update the local and global map. Add new points to staged and map container
      *
@@ -111,6 +163,9 @@ template<class... Maps> class Local_Map
                 const DetectedFeatureContainer& detectedFeatures,
                 const matches_containers::match_container& outlierMatched)
     {
+        const outputs::Scoped_Trace trace("map_update");
+        // the upgraded features get their ids from this map
+        const MapIdAllocator::Scoped_Id_Block idScope(_idAllocator);
         const double updateMapStartTime = static_cast<double>(cv::getTickCount());
         assert(_detectedFeatureId == detectedFeatures.id);
 
@@ -124,43 +179,74 @@ template<class... Maps> class Local_Map
         const CameraToWorldMatrix& cameraToWorld = utils::compute_camera_to_world_transform(
                 optimizedPose.get_orientation_quaternion(), optimizedPose.get_position());
 
-        // update all local maps
-        foreach_map([this, &cameraToWorld, &poseCovariance, &detectedFeatures](auto& map) {
+        // update all local maps concurrently. Each map writes in its own buffer, creates its features with a block of
+        // ids reserved in map order, and computes its upgraded features: the results do not depend on the scheduling
+        std::array<size_t, mapCount> firstNewIds;
+        foreach_map_with_index([this, &firstNewIds](const auto& map, const size_t mapIndex) {
+            firstNewIds[mapIndex] = _idAllocator.reserve_ids(map.get_maximum_new_feature_count());
+        });
+        parallel_foreach_map([&](auto& map, const auto mapIndex) {
+            const outputs::Scoped_Trace mapTrace("update_map", map.get_display_name());
+            const MapIdAllocator::Scoped_Id_Block idBlock(
+                    _idAllocator, firstNewIds[mapIndex], map.get_maximum_new_feature_count());
+
             // update matches and unmatched map features (and merge map features)
             const auto& detectedUsedIndexSet =
-                    map.update_map(cameraToWorld, poseCovariance, detectedFeatures, _mapWriter);
+                    map.update_map(cameraToWorld, poseCovariance, detectedFeatures, _mapWriterBuffers[mapIndex]);
 
             // TODO: find a way to flag detected points & point 2D to avoid reinserting them
 
             // Add unmatched features to the staged map, to unsure tracking of detected features
             map.add_features_to_staged_map(poseCovariance, cameraToWorld, detectedFeatures, detectedUsedIndexSet);
-        });
 
-        // try to upgrade to new features (AFTER all map updates)
-        foreach_map([this, &cameraToWorld](auto& featureMap) {
-            const auto& upgradedFeatures = featureMap.get_upgraded_features(cameraToWorld);
+            // upgrades only remove features from this map
+            map.compute_upgraded_features(cameraToWorld, std::get<mapIndex>(_upgradedFeatures));
+        });
 
-            // try to add those features to each other maps
-            size_t addedFeatures = 0;
-            foreach_map([&upgradedFeatures, &addedFeatures](auto& map) {
-                // TODO: find a way to use this optimization
-                // if (featureMap != map)
-                addedFeatures += map.add_upgraded_features(upgradedFeatures);
-            });
+        // merge step, in map order
+        for (const auto& mapWriterBuffer: _mapWriterBuffers)
+            mapWriterBuffer->flush(*_mapWriter);
 
-            if (addedFeatures < upgradedFeatures.size())
-            {
-                outputs::log_warning(
-                        "Not all upgraded features could be added to the feature maps, some features have been lost");
-            }
-        });
+        // move the upgraded features to the maps of their type (AFTER all map updates)
+        std::vector<Map_Delta::Upgrade> upgrades;
+        std::apply(
+                [this, &upgrades](auto&... mapUpgradedFeatures) {
+                    (move_upgraded_features(mapUpgradedFeatures, upgrades), ...);
+                },
+                _upgradedFeatures);
 
         // add local map points to global map
-        update_local_to_global();
+        update_local_to_global(utils::compute_world_to_camera_transform(cameraToWorld));
+
+        publish_snapshot(std::move(upgrades));
 
         mapUpdateDuration += (static_cast<double>(cv::getTickCount()) - updateMapStartTime) / cv::getTickFrequency();
     }
 
+    /**
+     * \brief Get the last published copy of the local map. Can be called from any thread, without locks
+     * \return The snapshot of the last map update, or nullptr if the map was never updated
+     */
+    [[nodiscard]] std::shared_ptr<const Map_Snapshot> get_snapshot() const noexcept { return _snapshot.load(); }
+
+    /**
+     * \brief Get the publisher of the changes of each map update, to subscribe to them
+     */
+    [[nodiscard]] Map_Delta_Publisher& get_delta_publisher() noexcept { return _deltaPublisher; }
+
+    /**
+     * \brief Update the local map with a tracked frame that is not a keyframe. The map features are not updated and no
+     * features are added: only the outliers are unmatched, so the next frame tracks the matched inliers
+     * \param[in] outlierMatched A container for all the wrongly associated features detected in the pose
+     * optimization process. They should be marked as invalid matches
+     */
+    void update_tracking_only(const matches_containers::match_container& outlierMatched) noexcept
+    {
+        foreach_map([&outlierMatched](auto& map) {
+            map.update_tracking_only(outlierMatched);
+        });
+    }
+
     /**
      * \brief Update the local map when no pose could be estimated. Consider all features as unmatched
      */
@@ -173,7 +259,36 @@ template<class... Maps> class Local_Map
     }
 
     /**
-     * \brief Add all detected features to staged map
+     * \brief Move the local map features with the corrections of a local bundle adjustment
+     * \param[in] corrections The corrections computed by the bundle adjustment
+     * \return The number of moved map features
+     */
+    size_t apply_corrections(const pose_optimization::Bundle_Adjustment_Corrections& corrections) noexcept
+    {
+        size_t correctedCount = 0;
+        foreach_map([&corrections, &correctedCount](auto& map) {
+            correctedCount += map.apply_corrections(corrections);
+        });
+        return correctedCount;
+    }
+
+    /**
+     * \brief Move the local map features with the corrections of a loop closure
+     * \param[in] corrections The corrections computed by the pose graph optimization
+     * \return The number of moved map features
+     */
+    size_t apply_corrections(const pose_optimization::Pose_Graph_Corrections& corrections) noexcept
+    {
+        size_t correctedCount = 0;
+        foreach_map([&corrections, &correctedCount](auto& map) {
+            correctedCount += map.apply_corrections(corrections);
+        });
+        return correctedCount;
+    }
+
+    /**
+     * \brief Add all detected features to staged map, when the map is (re)started. The admission budget of a frame
+     * does not apply, only the staged map capacity
      * \param[in] poseCovariance The pose covariance of the observer, after optimization
      * \param[in] cameraToWorld The matrix to go from camera to world space
      * \param[in] detectedFeatures Contains the detected features
@@ -189,6 +304,7 @@ template<class... Maps> class Local_Map
 
         assert(_detectedFeatureId == detectedFeatures.id);
 
+        const MapIdAllocator::Scoped_Id_Block idScope(_idAllocator);
         // Add unmatched features to the staged map, to unsure tracking of new features
         foreach_map([&poseCovariance, &cameraToWorld, &detectedFeatures](auto& map) {
             map.add_all_features_to_staged_map(poseCovariance, cameraToWorld, detectedFeatures);
@@ -198,6 +314,12 @@ template<class... Maps> class Local_Map
                 (static_cast<double>(cv::getTickCount()) - addfeaturesStartTime) / cv::getTickFrequency();
     }
 
+    /**
+     * \brief Get the allocator of the ids of the features of this map
+     */
+    [[nodiscard]] MapIdAllocator& get_id_allocator() noexcept { return _idAllocator; }
+    [[nodiscard]] const MapIdAllocator& get_id_allocator() const noexcept { return _idAllocator; }
+
     /**
      * \brief Hard clean the local and staged map
      */
@@ -208,6 +330,35 @@ template<class... Maps> class Local_Map
         });
     }
 
+    /**
+     * \brief Write the local and staged features of all the maps to a map state file
+     * \param[in, out] writer The map state file in construction
+     */
+    void write_state(Map_State_Writer& writer) const noexcept
+    {
+        foreach_map([&writer](const auto& map) {
+            map.write_state(writer);
+        });
+    }
+
+    /**
+     * \brief Replace the content of all the maps by the features of a map state file
+     * \param[in] reader The map state file
+     * \return The number of restored features
+     */
+    size_t read_state(const Map_State_Reader& reader) noexcept
+    {
+        reset();
+        const MapIdAllocator::Scoped_Id_Block idScope(_idAllocator);
+
+        size_t restoredCount = 0;
+        foreach_map([&reader, &restoredCount](auto& map) {
+            restoredCount += map.read_state(reader);
+        });
+        publish_snapshot();
+        return restoredCount;
+    }
+
     /**
      * \brief Compute a debug image to display the features
      *
@@ -228,6 +379,17 @@ template<class... Maps> class Local_Map
         });
     }
 
+    /**
+     * \brief Add the estimated memory of the feature maps to the metrics. Reads all the map features
+     * \param[in, out] metrics The metrics to fill
+     */
+    void add_memory_usage(outputs::Frame_Metrics& metrics) const noexcept
+    {
+        foreach_map([&metrics](const auto& map) {
+            map.add_memory_usage(metrics);
+        });
+    }
+
     void show_statistics(const double meanFrameTreatmentDuration, const uint frameCount) const noexcept
     {
         static auto get_percent_of_elapsed_time = [](double treatmentTime, double totalTimeElapsed) {
@@ -258,11 +420,15 @@ template<class... Maps> class Local_Map
 
   protected:
     /**
-     * \brief Clean the local map so it stays local, and update the global map with the good features
+     * \brief Clean the local map so it stays local, and update the global map with the good features.
+     * The lost features are stored out of core by each map: load back the ones that are visible again
+     * \param[in] worldToCamera A matrix to convert from world to camera space, for the optimized pose
      */
-    void update_local_to_global() noexcept
+    void update_local_to_global(const WorldToCameraMatrix& worldToCamera) noexcept
     {
-        // TODO when we have a global map
+        foreach_map([&worldToCamera](auto& map) {
+            map.load_visible_stored_features(worldToCamera);
+        });
     }
 
     /**
@@ -307,9 +473,75 @@ template<class... Maps> class Local_Map
     }
 
   private:
+    static constexpr size_t mapCount = sizeof...(Maps);
+
     size_t _detectedFeatureId; // store the if of the detected feature object
 
+    // the ids of the features of this map, not shared with the other maps of the process
+    MapIdAllocator _idAllocator;
+    TrackedFeaturesContainer _trackedFeatures; // buffers of the tracked features, reused between frames
+
     std::tuple<Maps...> _featureMaps;
+    // the features upgraded by each map at the last update, kept between the updates
+    std::tuple<std::vector<typename Maps::upgraded_feature_type>...> _upgradedFeatures;
+
+    // last published copy of the local map, read by the other threads
+    std::atomic<std::shared_ptr<const Map_Snapshot>> _snapshot;
+    // sends the changes between the published snapshots to the subscribers
+    Map_Delta_Publisher _deltaPublisher;
+
+    /**
+     * \brief Copy the local map features to a new snapshot, and publish it. The previous snapshot stays valid for
+     * the threads that still hold it. The changes since the previous snapshot are sent to the delta subscribers
+     * \param[in] upgrades The features upgraded by this map update
+     */
+    void publish_snapshot(std::vector<Map_Delta::Upgrade>&& upgrades = {}) noexcept
+    {
+        auto snapshot = std::make_shared<Map_Snapshot>();
+        snapshot->_detectedFeatureId = _detectedFeatureId;
+        foreach_map([&snapshot](const auto& map) {
+            map.add_to_snapshot(*snapshot);
+        });
+        const std::shared_ptr<const Map_Snapshot> previousSnapshot = _snapshot.exchange(snapshot);
+
+        if (_deltaPublisher.has_subscribers())
+            _deltaPublisher.publish(previousSnapshot.get(), *snapshot, std::move(upgrades));
+    }
+
+    /**
+     * \brief Move the features upgraded by a map to the maps that store their type, then clear them
+     * \param[in, out] upgradedFeatures The features upgraded by a map
+     * \param[in, out] upgrades The ids of the source and new features, to which the added features are appended
+     */
+    template<class UpgradedFeatureType>
+    void move_upgraded_features(std::vector<UpgradedFeatureType>& upgradedFeatures,
+                                std::vector<Map_Delta::Upgrade>& upgrades) noexcept
+    {
+        if constexpr (not std::is_same_v<UpgradedFeatureType, No_Upgrade>)
+        {
+            if (upgradedFeatures.empty())
+                return;
+
+            size_t addedFeatures = 0;
+            foreach_map([&upgradedFeatures, &addedFeatures](auto& map) {
+                // resolved at compile time: only the maps of this type have an overload for it
+                if constexpr (requires { map.add_upgraded_features(upgradedFeatures); })
+                    addedFeatures += map.add_upgraded_features(upgradedFeatures);
+            });
+
+            if (addedFeatures < upgradedFeatures.size())
+            {
+                outputs::log_warning(
+                        "Not all upgraded features could be added to the feature maps, some features have been lost");
+            }
+            for (const auto& upgraded: upgradedFeatures)
+            {
+                if (upgraded._upgradedId != MapIdAllocator::invalidId)
+                    upgrades.emplace_back(Map_Delta::Upgrade {upgraded._sourceId, upgraded._upgradedId});
+            }
+        }
+        upgradedFeatures.clear();
+    }
 
     /**
      * \brief Apply a function on all map objects
@@ -349,7 +581,39 @@ template<class... Maps> class Local_Map
         unfold(std::make_index_sequence<std::tuple_size_v<decltype(_featureMaps)>>());
     }
 
+    /**
+     * \brief Apply a function on all map objects, with the index of the map
+     */
+    template<typename F> constexpr void foreach_map_with_index(F&& function)
+    {
+        auto unfold = [&]<size_t... Ints>(std::index_sequence<Ints...>) {
+            (std::forward<F>(function)(std::get<Ints>(_featureMaps), Ints), ...);
+        };
+        unfold(std::make_index_sequence<mapCount>());
+    }
+
+    /**
+     * \brief Apply a function on all map objects concurrently, with the index of the map as a
+     * std::integral_constant. The exceptions of the function are rethrown after all calls finished. Each call draws
+     * its random numbers from a stream of this map and frame, whatever the thread that runs it
+     */
+    template<typename F> void parallel_foreach_map(F&& function)
+    {
+        tbb::task_group tasks;
+        auto unfold = [&]<size_t... Ints>(std::index_sequence<Ints...>) {
+            (tasks.run([this, &function]() {
+                const utils::Random::Scoped_Stream randomStream(_detectedFeatureId, Ints);
+                function(std::get<Ints>(_featureMaps), std::integral_constant<size_t, Ints> {});
+            }),
+             ...);
+        };
+        unfold(std::make_index_sequence<mapCount>());
+        tasks.wait();
+    }
+
     std::shared_ptr<outputs::IMap_Writer> _mapWriter = nullptr;
+    // the map writers of the concurrent map updates, flushed in _mapWriter in map order
+    std::array<std::shared_ptr<outputs::Buffered_Map_Writer>, mapCount> _mapWriterBuffers;
 
     // Remove copy operators
     Local_Map(const Local_Map& map) = delete;
@@ -0,0 +1,398 @@
+#include "map_delta.hpp"
+#include "outputs/logger.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+
+namespace rgbd_slam::map_management {
+
+namespace {
+
+/**
+ * \brief Append the raw bytes of a value to a message
+ */
+template<typename T> void append(const T& value, std::vector<std::byte>& message) noexcept
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+    const std::byte* bytes = reinterpret_cast<const std::byte*>(&value);
+    message.insert(message.end(), bytes, bytes + sizeof(T));
+}
+
+/**
+ * \brief Append the upper triangle of a symmetric matrix, as floats
+ */
+template<typename Matrix> void append_upper_triangle(const Matrix& matrix, std::vector<std::byte>& message) noexcept
+{
+    for (Eigen::Index row = 0; row < matrix.rows(); ++row)
+        for (Eigen::Index column = row; column < matrix.cols(); ++column)
+            append(static_cast<float>(matrix(row, column)), message);
+}
+
+template<typename Vector> void append_vector(const Vector& vector, std::vector<std::byte>& message) noexcept
+{
+    for (Eigen::Index i = 0; i < vector.size(); ++i)
+        append(static_cast<float>(vector(i)), message);
+}
+
+void append_point(const Map_Snapshot::Point& point, std::vector<std::byte>& message) noexcept
+{
+    append(static_cast<uint64_t>(point._id), message);
+    append_vector(point._coordinates, message);
+    append_upper_triangle(point._covariance, message);
+    append(static_cast<uint8_t>(point._isInverseDepth), message);
+}
+
+void append_plane(const Map_Snapshot::Plane& plane, std::vector<std::byte>& message) noexcept
+{
+    append(static_cast<uint64_t>(plane._id), message);
+    append_vector(plane._parametrization, message);
+    append_upper_triangle(plane._covariance, message);
+    append(static_cast<uint32_t>(plane._boundary.size()), message);
+    for (const vector3& vertex: plane._boundary)
+        append_vector(vertex, message);
+}
+
+/**
+ * \brief Sequential reader of an encoded message
+ */
+class Message_Cursor
+{
+  public:
+    explicit Message_Cursor(std::span<const std::byte> message) : _message(message) {}
+
+    /**
+     * \brief Read the next value of the message
+     * \return false if the message is too short: the value is not read
+     */
+    template<typename T> [[nodiscard]] bool read(T& value) noexcept
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if (_message.size() - _position < sizeof(T))
+            return false;
+        std::memcpy(&value, _message.data() + _position, sizeof(T));
+        _position += sizeof(T);
+        return true;
+    }
+
+    template<typename Vector> [[nodiscard]] bool read_vector(Vector& vector) noexcept
+    {
+        for (Eigen::Index i = 0; i < vector.size(); ++i)
+        {
+            float value;
+            if (not read(value))
+                return false;
+            vector(i) = value;
+        }
+        return true;
+    }
+
+    template<typename Matrix> [[nodiscard]] bool read_upper_triangle(Matrix& matrix) noexcept
+    {
+        for (Eigen::Index row = 0; row < matrix.rows(); ++row)
+            for (Eigen::Index column = row; column < matrix.cols(); ++column)
+            {
+                float value;
+                if (not read(value))
+                    return false;
+                matrix(row, column) = value;
+                matrix(column, row) = value;
+            }
+        return true;
+    }
+
+    [[nodiscard]] bool read_point(Map_Snapshot::Point& point) noexcept
+    {
+        uint64_t id;
+        uint8_t isInverseDepth;
+        if (not read(id) or not read_vector(point._coordinates) or not read_upper_triangle(point._covariance) or
+            not read(isInverseDepth))
+            return false;
+        point._id = static_cast<size_t>(id);
+        point._isInverseDepth = isInverseDepth != 0;
+        return true;
+    }
+
+    [[nodiscard]] bool read_plane(Map_Snapshot::Plane& plane) noexcept
+    {
+        uint64_t id;
+        uint32_t boundarySize;
+        if (not read(id) or not read_vector(plane._parametrization) or not read_upper_triangle(plane._covariance) or
+            not read(boundarySize))
+            return false;
+        // do not trust the size for the allocation: each vertex needs 3 floats
+        if (boundarySize > (_message.size() - _position) / (3 * sizeof(float)))
+            return false;
+        plane._id = static_cast<size_t>(id);
+        plane._boundary.resize(boundarySize);
+        for (vector3& vertex: plane._boundary)
+            if (not read_vector(vertex))
+                return false;
+        return true;
+    }
+
+    [[nodiscard]] bool is_at_end() const noexcept { return _position == _message.size(); }
+
+  private:
+    std::span<const std::byte> _message;
+    size_t _position = 0;
+};
+
+/**
+ * \brief Read records of a message in a container
+ */
+template<typename Record, typename ReadRecord>
+[[nodiscard]] bool read_records(const uint32_t count, std::vector<Record>& records, ReadRecord&& readRecord) noexcept
+{
+    records.clear();
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        Record record;
+        if (not readRecord(record))
+            return false;
+        records.emplace_back(std::move(record));
+    }
+    return true;
+}
+
+} // namespace
+
+void compute_map_delta(const Map_Snapshot* previous, const Map_Snapshot& current, Map_Delta& delta) noexcept
+{
+    delta._addedPoints.clear();
+    delta._updatedPoints.clear();
+    delta._addedPlanes.clear();
+    delta._updatedPlanes.clear();
+    delta._removedIds.clear();
+    delta._isFullState = previous == nullptr;
+
+    if (previous == nullptr)
+    {
+        delta._addedPoints = current._points;
+        delta._addedPlanes = current._planes;
+        return;
+    }
+
+    // index of the previous features by id. The ids are shared by the points and planes
+    std::unordered_map<size_t, size_t> previousPoints;
+    std::unordered_map<size_t, size_t> previousPlanes;
+    previousPoints.reserve(previous->_points.size());
+    previousPlanes.reserve(previous->_planes.size());
+    for (size_t i = 0; i < previous->_points.size(); ++i)
+        previousPoints.emplace(previous->_points[i]._id, i);
+    for (size_t i = 0; i < previous->_planes.size(); ++i)
+        previousPlanes.emplace(previous->_planes[i]._id, i);
+
+    for (const Map_Snapshot::Point& point: current._points)
+    {
+        const auto previousIterator = previousPoints.find(point._id);
+        if (previousIterator == previousPoints.end())
+        {
+            delta._addedPoints.push_back(point);
+            continue;
+        }
+        const Map_Snapshot::Point& previousPoint = previous->_points[previousIterator->second];
+        if (not(point._coordinates - previousPoint._coordinates).isZero(0.0) or
+            not(point._covariance - previousPoint._covariance).isZero(0.0) or
+            point._isInverseDepth != previousPoint._isInverseDepth)
+            delta._updatedPoints.push_back(point);
+        // the remaining features were removed
+        previousPoints.erase(previousIterator);
+    }
+
+    for (const Map_Snapshot::Plane& plane: current._planes)
+    {
+        const auto previousIterator = previousPlanes.find(plane._id);
+        if (previousIterator == previousPlanes.end())
+        {
+            delta._addedPlanes.push_back(plane);
+            continue;
+        }
+        const Map_Snapshot::Plane& previousPlane = previous->_planes[previousIterator->second];
+        const bool isBoundaryChanged =
+                plane._boundary.size() != previousPlane._boundary.size() or
+                not std::equal(plane._boundary.cbegin(),
+                               plane._boundary.cend(),
+                               previousPlane._boundary.cbegin(),
+                               [](const vector3& a, const vector3& b) {
+                                   return (a - b).isZero(0.0);
+                               });
+        if (isBoundaryChanged or not(plane._parametrization - previousPlane._parametrization).isZero(0.0) or
+            not(plane._covariance - previousPlane._covariance).isZero(0.0))
+            delta._updatedPlanes.push_back(plane);
+        previousPlanes.erase(previousIterator);
+    }
+
+    delta._removedIds.reserve(previousPoints.size() + previousPlanes.size());
+    for (const auto& [id, index]: previousPoints)
+        delta._removedIds.push_back(id);
+    for (const auto& [id, index]: previousPlanes)
+        delta._removedIds.push_back(id);
+    // independent of the hash table order
+    std::ranges::sort(delta._removedIds);
+}
+
+void encode_map_delta(const Map_Delta& delta, std::vector<std::byte>& message) noexcept
+{
+    message.clear();
+    append(mapDeltaFormatVersion, message);
+    append(static_cast<uint64_t>(delta._sequenceIndex), message);
+    append(static_cast<uint64_t>(delta._detectedFeatureId), message);
+    append(static_cast<uint8_t>(delta._isFullState), message);
+
+    append(static_cast<uint32_t>(delta._addedPoints.size()), message);
+    append(static_cast<uint32_t>(delta._updatedPoints.size()), message);
+    append(static_cast<uint32_t>(delta._addedPlanes.size()), message);
+    append(static_cast<uint32_t>(delta._updatedPlanes.size()), message);
+    append(static_cast<uint32_t>(delta._removedIds.size()), message);
+    append(static_cast<uint32_t>(delta._upgrades.size()), message);
+
+    for (const Map_Snapshot::Point& point: delta._addedPoints)
+        append_point(point, message);
+    for (const Map_Snapshot::Point& point: delta._updatedPoints)
+        append_point(point, message);
+    for (const Map_Snapshot::Plane& plane: delta._addedPlanes)
+        append_plane(plane, message);
+    for (const Map_Snapshot::Plane& plane: delta._updatedPlanes)
+        append_plane(plane, message);
+    for (const size_t id: delta._removedIds)
+        append(static_cast<uint64_t>(id), message);
+    for (const Map_Delta::Upgrade& upgrade: delta._upgrades)
+    {
+        append(static_cast<uint64_t>(upgrade._sourceId), message);
+        append(static_cast<uint64_t>(upgrade._upgradedId), message);
+    }
+}
+
+bool decode_map_delta(std::span<const std::byte> message, Map_Delta& delta) noexcept
+{
+    Message_Cursor cursor(message);
+
+    uint32_t version;
+    if (not cursor.read(version) or version != mapDeltaFormatVersion)
+        return false;
+
+    uint64_t sequenceIndex;
+    uint64_t detectedFeatureId;
+    uint8_t isFullState;
+    std::array<uint32_t, 6> counts;
+    if (not cursor.read(sequenceIndex) or not cursor.read(detectedFeatureId) or not cursor.read(isFullState) or
+        not cursor.read(counts))
+        return false;
+    delta._sequenceIndex = static_cast<size_t>(sequenceIndex);
+    delta._detectedFeatureId = static_cast<size_t>(detectedFeatureId);
+    delta._isFullState = isFullState != 0;
+
+    const auto readPoint = [&cursor](Map_Snapshot::Point& point) {
+        return cursor.read_point(point);
+    };
+    const auto readPlane = [&cursor](Map_Snapshot::Plane& plane) {
+        return cursor.read_plane(plane);
+    };
+    const auto readId = [&cursor](size_t& id) {
+        uint64_t readId;
+        if (not cursor.read(readId))
+            return false;
+        id = static_cast<size_t>(readId);
+        return true;
+    };
+    const auto readUpgrade = [&readId](Map_Delta::Upgrade& upgrade) {
+        return readId(upgrade._sourceId) and readId(upgrade._upgradedId);
+    };
+
+    try
+    {
+        return read_records(counts[0], delta._addedPoints, readPoint) and
+               read_records(counts[1], delta._updatedPoints, readPoint) and
+               read_records(counts[2], delta._addedPlanes, readPlane) and
+               read_records(counts[3], delta._updatedPlanes, readPlane) and
+               read_records(counts[4], delta._removedIds, readId) and
+               read_records(counts[5], delta._upgrades, readUpgrade) and cursor.is_at_end();
+    }
+    catch (const std::exception& ex)
+    {
+        outputs::log_error("Could not decode a map delta: " + std::string(ex.what()));
+        return false;
+    }
+}
+
+/**
+ * Map_Delta_Publisher
+ */
+
+size_t Map_Delta_Publisher::subscribe(subscriber callback) noexcept
+{
+    std::scoped_lock lock(_mutex);
+    const size_t subscriptionId = _nextSubscriptionId++;
+    _subscriptions.emplace_back(Subscription {subscriptionId, std::move(callback), false});
+    return subscriptionId;
+}
+
+void Map_Delta_Publisher::unsubscribe(const size_t subscriptionId) noexcept
+{
+    std::scoped_lock lock(_mutex);
+    std::erase_if(_subscriptions, [subscriptionId](const Subscription& subscription) {
+        return subscription._id == subscriptionId;
+    });
+}
+
+bool Map_Delta_Publisher::has_subscribers() const noexcept
+{
+    std::scoped_lock lock(_mutex);
+    return not _subscriptions.empty();
+}
+
+void Map_Delta_Publisher::publish(const Map_Snapshot* previous,
+                                  const Map_Snapshot& current,
+                                  std::vector<Map_Delta::Upgrade>&& upgrades) noexcept
+{
+    // the callbacks are called out of the lock: they can subscribe or unsubscribe
+    std::vector<subscriber> deltaSubscribers;
+    std::vector<subscriber> fullStateSubscribers;
+    size_t sequenceIndex;
+    {
+        std::scoped_lock lock(_mutex);
+        sequenceIndex = _sequenceIndex++;
+        for (Subscription& subscription: _subscriptions)
+        {
+            if (subscription._hasReceivedState and previous != nullptr)
+                deltaSubscribers.push_back(subscription._callback);
+            else
+                fullStateSubscribers.push_back(subscription._callback);
+            subscription._hasReceivedState = true;
+        }
+    }
+
+    const auto send = [&current, sequenceIndex](const Map_Snapshot* from,
+                                                std::vector<Map_Delta::Upgrade>&& deltaUpgrades,
+                                                const std::vector<subscriber>& subscribers) {
+        if (subscribers.empty())
+            return;
+        auto delta = std::make_shared<Map_Delta>();
+        delta->_sequenceIndex = sequenceIndex;
+        delta->_detectedFeatureId = current._detectedFeatureId;
+        compute_map_delta(from, current, *delta);
+        delta->_upgrades = std::move(deltaUpgrades);
+
+        const std::shared_ptr<const Map_Delta> publishedDelta = std::move(delta);
+        for (const subscriber& callback: subscribers)
+        {
+            try
+            {
+                callback(publishedDelta);
+            }
+            catch (const std::exception& ex)
+            {
+                outputs::log_error("Caught exception in a map delta subscriber: " + std::string(ex.what()));
+            }
+        }
+    };
+    send(previous, std::move(upgrades), deltaSubscribers);
+    // the full state has no upgrades: the source features are not in it
+    send(nullptr, {}, fullStateSubscribers);
+}
+
+} // namespace rgbd_slam::map_management
@@ -0,0 +1,126 @@
+#ifndef RGBDSLAM_MAPMANAGEMENT_MAPDELTA_HPP
+#define RGBDSLAM_MAPMANAGEMENT_MAPDELTA_HPP
+
+#include "map_snapshot.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
+namespace rgbd_slam::map_management {
+
+// version of the encoded map deltas, changed with any change of the encoding
+constexpr uint32_t mapDeltaFormatVersion = 1;
+
+/**
+ * \brief The changes of the local map between two published snapshots. The features are identified by their map ids.
+ * An upgraded feature is removed under its old id and added under its new id: the upgrades link the two ids
+ */
+struct Map_Delta
+{
+    struct Upgrade
+    {
+        size_t _sourceId;   // id of the removed feature (inverse depth point)
+        size_t _upgradedId; // id of the added feature (point)
+    };
+
+    size_t _sequenceIndex = 0;     // index of the published delta, consecutive for a subscriber
+    size_t _detectedFeatureId = 0; // id of the detected features of the map update
+    bool _isFullState = false;     // true if this delta starts from an empty map: the first delta of a subscriber
+
+    std::vector<Map_Snapshot::Point> _addedPoints;
+    std::vector<Map_Snapshot::Point> _updatedPoints; // points that moved, or with a new covariance
+    std::vector<Map_Snapshot::Plane> _addedPlanes;
+    std::vector<Map_Snapshot::Plane> _updatedPlanes;
+    std::vector<size_t> _removedIds; // points and planes removed from the local map (lost, merged or upgraded)
+    std::vector<Upgrade> _upgrades;
+
+    [[nodiscard]] bool empty() const noexcept
+    {
+        return _addedPoints.empty() and _updatedPoints.empty() and _addedPlanes.empty() and
+               _updatedPlanes.empty() and _removedIds.empty();
+    }
+};
+
+/**
+ * \brief Compute the changes between two snapshots of the local map
+ * \param[in] previous The older snapshot, or nullptr to start from an empty map
+ * \param[in] current The newer snapshot
+ * \param[out] delta The added, updated and removed features. The upgrades and the indexes are not set
+ */
+void compute_map_delta(const Map_Snapshot* previous, const Map_Snapshot& current, Map_Delta& delta) noexcept;
+
+/**
+ * \brief Encode a map delta in a compact binary message, for a shared memory or network transport.
+ * The message is a uint32 format version, the indexes and the record counts, followed by the records. The values are
+ * stored as floats, in the endianness of the writer, with no padding. Covariances only store their upper triangle
+ * \param[in] delta The delta to encode
+ * \param[out] message The encoded message. Keeps its capacity between calls
+ */
+void encode_map_delta(const Map_Delta& delta, std::vector<std::byte>& message) noexcept;
+
+/**
+ * \brief Decode a message written by encode_map_delta
+ * \param[in] message The encoded message
+ * \param[out] delta The decoded delta
+ * \return false if the message is truncated or of another format version: delta is not valid
+ */
+[[nodiscard]] bool decode_map_delta(std::span<const std::byte> message, Map_Delta& delta) noexcept;
+
+/**
+ * \brief Publish the changes of each local map update to the subscribed consumers (planners, remote visualizers).
+ * A new subscriber first receives the whole map as a full state delta, then only the changes
+ */
+class Map_Delta_Publisher
+{
+  public:
+    /**
+     * \brief Called on the map update thread with each published delta: should only queue it. The delta is
+     * immutable, and stays valid while it is held
+     */
+    using subscriber = std::function<void(const std::shared_ptr<const Map_Delta>&)>;
+
+    /**
+     * \brief Receive the deltas of the next map updates. Can be called from any thread
+     * \return The id of this subscription, to unsubscribe
+     */
+    [[nodiscard]] size_t subscribe(subscriber callback) noexcept;
+
+    /**
+     * \brief Stop receiving the deltas. Can be called from any thread, including from the subscriber
+     */
+    void unsubscribe(const size_t subscriptionId) noexcept;
+
+    [[nodiscard]] bool has_subscribers() const noexcept;
+
+    /**
+     * \brief Compute the delta between two snapshots, and call the subscribers with it
+     * \param[in] previous The previously published snapshot, or nullptr if this is the first one
+     * \param[in] current The snapshot that was just published
+     * \param[in] upgrades The features upgraded by this map update
+     */
+    void publish(const Map_Snapshot* previous,
+                 const Map_Snapshot& current,
+                 std::vector<Map_Delta::Upgrade>&& upgrades) noexcept;
+
+  private:
+    struct Subscription
+    {
+        size_t _id;
+        subscriber _callback;
+        bool _hasReceivedState; // false until the full state was sent
+    };
+
+    mutable std::mutex _mutex;
+    std::vector<Subscription> _subscriptions;
+    size_t _nextSubscriptionId = 1;
+    size_t _sequenceIndex = 0;
+};
+
+} // namespace rgbd_slam::map_management
+
+#endif
@@ -4,8 +4,15 @@
 #include "logger.hpp"
 #include "matches_containers.hpp"
 #include "parameters.hpp"
+#include "pose_optimization/local_bundle_adjustment.hpp"
+#include "pose_optimization/match_blocks.hpp"
+#include "pose_optimization/pose_graph.hpp"
 #include "inverse_depth_with_tracking.hpp"
+#include <cstring>
+#include <map>
 #include <memory>
+#include <stdexcept>
+#include <tuple>
 
 namespace rgbd_slam::map_management {
 
@@ -31,6 +38,11 @@ double PointOptimizationFeature::get_score() const noexcept
     return optiScore;
 }
 
+double PointOptimizationFeature::get_quality() const noexcept
+{
+    return 1.0 / (1.0 + _mapPointStandardDev.norm() / parameters::optimization::ransac::matchQualityUncertainty_mm);
+}
+
 bool PointOptimizationFeature::is_inlier(const WorldToCameraMatrix& worldToCamera) const noexcept
 {
     const double distance = _mapPoint.get_distance_px(_matchedPoint, worldToCamera);
@@ -44,6 +56,19 @@ vectorxd PointOptimizationFeature::get_distance(const WorldToCameraMatrix& world
     return distance;
 }
 
+void PointOptimizationFeature::add_to_blocks(pose_optimization::Match_Blocks& blocks,
+                                             const size_t matchIndex) const noexcept
+{
+    blocks.add_point(
+            matchIndex, _mapPoint, _mapPointStandardDev, _matchedPoint, get_score(), get_alpha_reduction());
+}
+
+void PointOptimizationFeature::add_to_bundle_adjustment(
+        pose_optimization::Bundle_Adjustment_Keyframe& keyframe) const noexcept
+{
+    keyframe._points.emplace_back(_idInMap, _matchedPoint, _mapPoint, _mapPointStandardDev);
+}
+
 double PointOptimizationFeature::get_alpha_reduction() const noexcept { return 1.0; }
 
 matches_containers::feat_ptr PointOptimizationFeature::compute_random_variation() const noexcept
@@ -52,7 +77,7 @@ matches_containers::feat_ptr PointOptimizationFeature::compute_random_variation(
     WorldCoordinate variatedCoordinates = _mapPoint;
     variatedCoordinates += utils::Random::get_normal_doubles<3>().cwiseProduct(_mapPointStandardDev);
 
-    return std::make_shared<PointOptimizationFeature>(
+    return matches_containers::make_feature<PointOptimizationFeature>(
             _matchedPoint, variatedCoordinates, _mapPointStandardDev, _idInMap, _detectedFeatureId);
 }
 
@@ -75,7 +100,34 @@ matchIndexSet MapPoint::find_matches(const DetectedKeypointsObject& detectedFeat
                                      const bool shouldAddToMatches,
                                      const bool useAdvancedSearch) const noexcept
 {
-    constexpr double searchSpaceRadius = parameters::matching::matchSearchRadius_px;
+    // a tracking match does not need the projection of the point
+    ScreenCoordinate2D projectedMapPoint(0.0, 0.0);
+    if (detectedFeatures.get_tracking_match_index(_id) == features::keypoints::INVALID_MATCH_INDEX and
+        not _coordinates.to_screen_coordinates(worldToCamera, projectedMapPoint))
+    {
+        return matchIndexSet();
+    }
+    return find_matches_from_projection(projectedMapPoint,
+                                        detectedFeatures,
+                                        worldToCamera,
+                                        isDetectedFeatureMatched,
+                                        matches,
+                                        shouldAddToMatches,
+                                        useAdvancedSearch);
+}
+
+matchIndexSet MapPoint::find_matches_from_projection(const ScreenCoordinate2D& projectedPoint,
+                                                     const DetectedKeypointsObject& detectedFeatures,
+                                                     const WorldToCameraMatrix& worldToCamera,
+                                                     const vectorb& isDetectedFeatureMatched,
+                                                     matches_containers::match_container& matches,
+                                                     const bool shouldAddToMatches,
+                                                     const bool useAdvancedSearch) const noexcept
+{
+    std::ignore = worldToCamera;
+
+    // the advanced search is a fallback of the failed trackings: it does not trust the prediction uncertainty
+    const double searchSpaceRadius = detectedFeatures.get_search_radius();
     constexpr double advancedSearchSpaceRadius = parameters::matching::matchSearchRadius_px * 2;
     const double searchRadius = useAdvancedSearch ? advancedSearchSpaceRadius : searchSpaceRadius;
 
@@ -89,47 +141,65 @@ matchIndexSet MapPoint::find_matches(const DetectedKeypointsObject& detectedFeat
     else
     {
         // No match: try to find match in a window around the point
-        ScreenCoordinate2D projectedMapPoint;
-        const bool isScreenCoordinatesValid = _coordinates.to_screen_coordinates(worldToCamera, projectedMapPoint);
-        if (isScreenCoordinatesValid)
-        {
-            // TODO: add multiple match support
-            matchIndexRes = detectedFeatures.get_match_indexes(
-                    projectedMapPoint, _descriptor, isDetectedFeatureMatched, searchRadius);
-        }
+        // TODO: add multiple match support
+        matchIndexRes = detectedFeatures.get_match_indexes(
+                projectedPoint, _descriptor.get(), isDetectedFeatureMatched, searchRadius);
     }
 
     if (shouldAddToMatches)
     {
         for (const auto i: matchIndexRes)
         {
-            matches.push_back(std::make_shared<PointOptimizationFeature>(detectedFeatures.get_keypoint(i).get_2D(),
-                                                                         _coordinates,
-                                                                         _covariance.diagonal().cwiseSqrt(),
-                                                                         _id,
-                                                                         i));
+            matches.push_back(matches_containers::make_feature<PointOptimizationFeature>(
+                    detectedFeatures.get_keypoint(i).get_2D(),
+                    _coordinates,
+                    _covariance.diagonal().cwiseSqrt(),
+                    _id,
+                    i));
         }
     }
     return matchIndexRes;
 }
 
+double MapPoint::get_match_score(const DetectedKeypointsObject& detectedFeatures,
+                                 const WorldToCameraMatrix& worldToCamera,
+                                 const size_t matchIndex) const noexcept
+{
+    std::ignore = worldToCamera;
+
+    // the keypoint tracked from this point is its best possible match
+    if (detectedFeatures.get_tracking_match_index(_id) == static_cast<int>(matchIndex))
+        return 1.0;
+    return detectedFeatures.get_descriptor_similarity(static_cast<uint>(matchIndex), _descriptor.get());
+}
+
 bool MapPoint::add_to_tracked(const WorldToCameraMatrix& worldToCamera,
                               TrackedPointsObject& trackedFeatures,
                               const uint dropChance) const noexcept
 {
-    const bool shouldNotDropPoint = (dropChance == 0) or (utils::Random::get_random_uint(dropChance) != 0);
-
     assert(not _coordinates.hasNaN());
-    if (shouldNotDropPoint)
+    ScreenCoordinate2D screenCoordinates;
+    if (_coordinates.to_screen_coordinates(worldToCamera, screenCoordinates))
     {
-        ScreenCoordinate2D screenCoordinates;
-        if (_coordinates.to_screen_coordinates(worldToCamera, screenCoordinates))
-        {
-            // use previously known screen coordinates
-            trackedFeatures.add(_id, screenCoordinates.x(), screenCoordinates.y());
+        return add_to_tracked_from_projection(screenCoordinates, worldToCamera, trackedFeatures, dropChance);
+    }
+    // point was not added
+    return false;
+}
 
-            return true;
-        }
+bool MapPoint::add_to_tracked_from_projection(const ScreenCoordinate2D& projectedPoint,
+                                              const WorldToCameraMatrix& worldToCamera,
+                                              TrackedPointsObject& trackedFeatures,
+                                              const uint dropChance) const noexcept
+{
+    std::ignore = worldToCamera;
+
+    const bool shouldNotDropPoint = (dropChance == 0) or (utils::Random::get_random_uint(dropChance) != 0);
+    if (shouldNotDropPoint)
+    {
+        // use previously known screen coordinates
+        trackedFeatures.add(_id, projectedPoint.x(), projectedPoint.y());
+        return true;
     }
     // point was not added
     return false;
@@ -173,11 +243,23 @@ bool MapPoint::is_visible(const WorldToCameraMatrix& worldToCamMatrix) const noe
     return false;
 }
 
+bool MapPoint::get_projected_point(vector3& worldPoint) const noexcept
+{
+    worldPoint = _coordinates;
+    return true;
+}
+
+bool MapPoint::get_spatial_position(vector3& position) const noexcept
+{
+    position = _coordinates;
+    return true;
+}
+
 void MapPoint::write_to_file(std::shared_ptr<outputs::IMap_Writer> mapWriter) const noexcept
 {
     if (mapWriter != nullptr)
     {
-        mapWriter->add_point(_coordinates);
+        mapWriter->add_map_point(_id, _coordinates, _covariance);
     }
     else
     {
@@ -185,9 +267,31 @@ void MapPoint::write_to_file(std::shared_ptr<outputs::IMap_Writer> mapWriter) co
     }
 }
 
+void MapPoint::add_to_snapshot(Map_Snapshot& snapshot) const noexcept
+{
+    snapshot._points.emplace_back(Map_Snapshot::Point {_id, _coordinates, _covariance, false});
+}
+
+bool MapPoint::apply_correction(const pose_optimization::Bundle_Adjustment_Corrections& corrections) noexcept
+{
+    const auto displacementIterator = corrections._pointDisplacements.find(_id);
+    if (displacementIterator == corrections._pointDisplacements.cend())
+        return false;
+
+    _coordinates += displacementIterator->second;
+    return true;
+}
+
+bool MapPoint::apply_correction(const pose_optimization::Pose_Graph_Corrections& corrections) noexcept
+{
+    const matrix33& rotation = corrections._mapCorrection.rotation();
+    _coordinates = WorldCoordinate(rotation * _coordinates + corrections._mapCorrection.translation());
+    _covariance << rotation * _covariance * rotation.transpose();
+    return true;
+}
+
 bool MapPoint::update_with_match(const DetectedPointType& matchedFeature,
-                                 const matrix33& poseCovariance,
-                                 const CameraToWorldMatrix& cameraToWorld) noexcept
+                                 const utils::Frame_Transform_Context& frameTransform) noexcept
 {
     if (_matchIndexes.empty())
     {
@@ -199,10 +303,10 @@ bool MapPoint::update_with_match(const DetectedPointType& matchedFeature,
     if (is_depth_valid(matchedScreenPoint.z()))
     {
         // transform screen point to world point
-        const WorldCoordinate& worldPointCoordinates = matchedScreenPoint.to_world_coordinates(cameraToWorld);
+        const WorldCoordinate& worldPointCoordinates =
+                matchedScreenPoint.to_world_coordinates(frameTransform._cameraToWorld);
         // get a measure of the estimated variance of the new world point
-        const matrix33& worldCovariance =
-                utils::get_world_point_covariance(matchedScreenPoint, cameraToWorld, poseCovariance);
+        const matrix33& worldCovariance = frameTransform.get_world_point_covariance(matchedScreenPoint);
 
         // update this map point errors & position
         const double mergeScore = track(worldPointCoordinates, worldCovariance);
@@ -211,15 +315,16 @@ bool MapPoint::update_with_match(const DetectedPointType& matchedFeature,
 
         // If a new descriptor is available, update it
         if (const cv::Mat& descriptor = matchedFeature._descriptor; not descriptor.empty())
-            _descriptor = descriptor;
+            _descriptor.set(descriptor);
 
         return true;
     }
     else
     {
         // Point is 2D, compute projection
-        tracking::PointInverseDepth observation(
-                ScreenCoordinate2D(matchedScreenPoint.head<2>()), cameraToWorld, poseCovariance);
+        tracking::PointInverseDepth observation(ScreenCoordinate2D(matchedScreenPoint.head<2>()),
+                                                frameTransform._cameraToWorld,
+                                                frameTransform._poseCovariance);
         Eigen::Matrix<double, 3, 6> inverseToWorldJacobian;
         const auto projectedObservation = observation._coordinates.to_world_coordinates(inverseToWorldJacobian);
         const auto observationCovariance = tracking::PointInverseDepth::compute_cartesian_covariance(
@@ -232,7 +337,7 @@ bool MapPoint::update_with_match(const DetectedPointType& matchedFeature,
 
         // If a new descriptor is available, update it
         if (const cv::Mat& descriptor = matchedFeature._descriptor; not descriptor.empty())
-            _descriptor = descriptor;
+            _descriptor.set(descriptor);
 
         return true;
     }
@@ -257,6 +362,14 @@ StagedMapPoint::StagedMapPoint(const matrix33& poseCovariance,
 {
 }
 
+StagedMapPoint::StagedMapPoint(const WorldCoordinate& coordinates,
+                               const WorldCoordinateCovariance& covariance,
+                               const cv::Mat& descriptor,
+                               const size_t id) :
+    MapPoint(coordinates, covariance, descriptor, id)
+{
+}
+
 bool StagedMapPoint::should_remove_from_staged() const noexcept { return get_confidence() <= 0; }
 
 bool StagedMapPoint::should_add_to_local_map() const noexcept
@@ -278,7 +391,7 @@ double StagedMapPoint::get_confidence() const noexcept
  */
 
 LocalMapPoint::LocalMapPoint(const StagedMapPoint& stagedPoint) :
-    MapPoint(stagedPoint._coordinates, stagedPoint._covariance, stagedPoint._descriptor, stagedPoint._id)
+    MapPoint(stagedPoint._coordinates, stagedPoint._covariance, stagedPoint._descriptor.get(), stagedPoint._id)
 {
     // new map point, new color
     set_color();
@@ -287,17 +400,24 @@ LocalMapPoint::LocalMapPoint(const StagedMapPoint& stagedPoint) :
     _successivMatchedCount = stagedPoint._successivMatchedCount;
 }
 
+LocalMapPoint::LocalMapPoint(UpgradedPoint2D&& upgraded, const size_t id) :
+    MapPoint(upgraded._coordinates, upgraded._covariance, std::move(upgraded._descriptor), id)
+{
+    // new map point, new color
+    set_color();
+
+    _matchIndexes = std::move(upgraded._matchIndexes);
+    _successivMatchedCount = 1;
+}
+
 LocalMapPoint::LocalMapPoint(const WorldCoordinate& coordinates,
                              const WorldCoordinateCovariance& covariance,
                              const cv::Mat& descriptor,
-                             const matchIndexSet& matchIndexes) :
-    MapPoint(coordinates, covariance, descriptor)
+                             const size_t id) :
+    MapPoint(coordinates, covariance, descriptor, id)
 {
     // new map point, new color
     set_color();
-
-    _matchIndexes = matchIndexes;
-    _successivMatchedCount = 1;
 }
 
 bool LocalMapPoint::is_lost() const noexcept
@@ -305,4 +425,220 @@ bool LocalMapPoint::is_lost() const noexcept
     return (_failedTrackingCount > parameters::mapping::pointUnmatchedCountToLoose);
 }
 
-} // namespace rgbd_slam::map_management
\ No newline at end of file
+/**
+ * localPointMap
+ */
+
+localPointMap::StoredPoint localPointMap::get_stored_point(const MapPoint& point) noexcept
+{
+    assert(not point._descriptor.empty());
+
+    StoredPoint storedPoint;
+    storedPoint._id = point._id;
+    Eigen::Map<vector3>(storedPoint._coordinates.data()) = point._coordinates;
+    Eigen::Map<matrix33>(storedPoint._covariance.data()) = point._covariance;
+
+    const cv::Mat& descriptor = point._descriptor.get();
+    std::memcpy(storedPoint._descriptor.data(), descriptor.ptr<uchar>(0), storedPoint._descriptor.size());
+    return storedPoint;
+}
+
+size_t localPointMap::add_upgraded_features(std::vector<UpgradedPoint2D>& upgradedPoints) noexcept
+{
+    size_t addedCount = 0;
+    for (UpgradedPoint2D& upgraded: upgradedPoints)
+    {
+        try
+        {
+            // built in place in the map storage, with the descriptor row of the upgraded point
+            const size_t id = MapIdAllocator::get_new_id();
+            if (emplace_in_local_map(id, std::move(upgraded), id))
+            {
+                upgraded._upgradedId = id;
+                ++addedCount;
+            }
+        }
+        catch (const std::exception& ex)
+        {
+            outputs::log_error("Could not add an upgraded map point: " + std::string(ex.what()));
+        }
+    }
+    return addedCount;
+}
+
+void localPointMap::store_lost_feature(const LocalMapPoint& lostFeature) noexcept
+{
+    if (lostFeature._descriptor.empty())
+        return;
+
+    const StoredPoint& storedPoint = get_stored_point(lostFeature);
+    // a store that failed to grow has logged the error
+    std::ignore = _tileStore.store(lostFeature._coordinates, &storedPoint);
+}
+
+size_t localPointMap::load_stored_features(const WorldToCameraMatrix& worldToCamera) noexcept
+{
+    const size_t loadedCount = _tileStore.load_visible_tiles(
+            worldToCamera, parameters::mapping::globalMap::pageInDistance_mm, _loadedRecords);
+
+    size_t addedCount = 0;
+    for (size_t i = 0; i < loadedCount; ++i)
+    {
+        StoredPoint storedPoint;
+        std::memcpy(&storedPoint, &_loadedRecords[i * sizeof(StoredPoint)], sizeof(StoredPoint));
+        try
+        {
+            add_to_local_map(LocalMapPoint(WorldCoordinate(Eigen::Map<const vector3>(storedPoint._coordinates.data())),
+                                           WorldCoordinateCovariance(
+                                                   Eigen::Map<const matrix33>(storedPoint._covariance.data())),
+                                           cv::Mat(1,
+                                                   static_cast<int>(storedPoint._descriptor.size()),
+                                                   CV_8U,
+                                                   storedPoint._descriptor.data()),
+                                           storedPoint._id));
+            ++addedCount;
+        }
+        catch (const std::exception& ex)
+        {
+            outputs::log_error("Could not load a stored map point: " + std::string(ex.what()));
+        }
+    }
+    return addedCount;
+}
+
+void localPointMap::write_features(Map_State_Writer& writer) const noexcept
+{
+    const auto write_points = [&writer](const auto& map, const Map_State_Section section) {
+        writer.begin_section(section);
+        for (const auto& [id, mapPoint]: map)
+        {
+            // a point with no descriptor could not be matched after the restart
+            if (mapPoint._descriptor.empty())
+                continue;
+            writer.append_record(SavedPoint {get_stored_point(mapPoint),
+                                             static_cast<int64_t>(mapPoint._successivMatchedCount),
+                                             static_cast<uint64_t>(mapPoint._failedTrackingCount)});
+        }
+    };
+    write_points(get_local_map(), Map_State_Section::LocalPoints);
+    write_points(get_staged_map(), Map_State_Section::StagedPoints);
+
+    // the lost points stay in the tile store of the next session
+    writer.begin_section(Map_State_Section::StoredPoints);
+    std::vector<std::byte> storedRecords;
+    const size_t storedCount = _tileStore.get_all_records(storedRecords);
+    for (size_t i = 0; i < storedCount; ++i)
+    {
+        StoredPoint storedPoint;
+        std::memcpy(&storedPoint, &storedRecords[i * sizeof(StoredPoint)], sizeof(StoredPoint));
+        writer.append_record(storedPoint);
+    }
+}
+
+size_t localPointMap::read_features(const Map_State_Reader& reader) noexcept
+{
+    // the descriptor matrix only views the record: the map point copies it
+    const auto get_descriptor = [](StoredPoint& point) {
+        return cv::Mat(1, static_cast<int>(point._descriptor.size()), CV_8U, point._descriptor.data());
+    };
+    const auto get_coordinates = [](const StoredPoint& point) {
+        return WorldCoordinate(Eigen::Map<const vector3>(point._coordinates.data()));
+    };
+    const auto get_covariance = [](const StoredPoint& point) {
+        return WorldCoordinateCovariance(Eigen::Map<const matrix33>(point._covariance.data()));
+    };
+
+    size_t restoredCount = reader.read_records<SavedPoint>(Map_State_Section::LocalPoints, [&](SavedPoint& saved) {
+        LocalMapPoint mapPoint(get_coordinates(saved._point),
+                               get_covariance(saved._point),
+                               get_descriptor(saved._point),
+                               saved._point._id);
+        mapPoint._successivMatchedCount = static_cast<int>(saved._successivMatchedCount);
+        mapPoint._failedTrackingCount = static_cast<size_t>(saved._failedTrackingCount);
+        add_to_local_map(mapPoint);
+    });
+    restoredCount += reader.read_records<SavedPoint>(Map_State_Section::StagedPoints, [&](SavedPoint& saved) {
+        StagedMapPoint stagedPoint(get_coordinates(saved._point),
+                                   get_covariance(saved._point),
+                                   get_descriptor(saved._point),
+                                   saved._point._id);
+        stagedPoint._successivMatchedCount = static_cast<int>(saved._successivMatchedCount);
+        stagedPoint._failedTrackingCount = static_cast<size_t>(saved._failedTrackingCount);
+        add_to_staged_map(stagedPoint);
+    });
+    restoredCount += reader.read_records<StoredPoint>(Map_State_Section::StoredPoints, [&](StoredPoint& stored) {
+        if (not _tileStore.store(get_coordinates(stored), &stored))
+            throw std::runtime_error("the tile store could not grow");
+    });
+    return restoredCount;
+}
+
+void localPointMap::find_relocalization_matches(const DetectedKeypointsObject& detectedFeatures,
+                                                matches_containers::match_container& matches) noexcept
+{
+    // update the index: only the points with new descriptors change their entries
+    const auto& localMap = get_local_map();
+    for (const auto& [id, mapPoint]: localMap)
+        _relocalizationIndex.insert_or_update(id, mapPoint._descriptor.get());
+    _relocalizationIndex.remove_stale_features();
+
+    struct RelocalizationMatch
+    {
+        uint _detectedIndex;
+        double _similarity;
+    };
+    // best detected keypoint of each map point, ordered by id to stay deterministic
+    std::map<size_t, RelocalizationMatch> bestMatches;
+
+    const uint keypointCount = static_cast<uint>(detectedFeatures.size());
+    for (uint keypointIndex = 0; keypointIndex < keypointCount; ++keypointIndex)
+    {
+        if (not detectedFeatures.has_descriptor(keypointIndex))
+            continue;
+
+        _relocalizationIndex.query(detectedFeatures.get_descriptor(keypointIndex), _relocalizationCandidates);
+
+        size_t bestId = 0;
+        double bestSimilarity = 0.0;
+        double secondSimilarity = 0.0;
+        for (const size_t id: _relocalizationCandidates)
+        {
+            const auto mapPointIterator = localMap.find(id);
+            assert(mapPointIterator != localMap.cend());
+            const double similarity = detectedFeatures.get_descriptor_similarity(
+                    keypointIndex, mapPointIterator->second._descriptor.get());
+            if (similarity > bestSimilarity)
+            {
+                secondSimilarity = bestSimilarity;
+                bestSimilarity = similarity;
+                bestId = id;
+            }
+            else if (similarity > secondSimilarity)
+                secondSimilarity = similarity;
+        }
+
+        // reject the weak and ambiguous matches
+        static constexpr double maximumDistanceRatio = parameters::matching::relocalization::maximumDistanceRatio;
+        if (bestSimilarity < parameters::matching::relocalization::minimumDescriptorSimilarity or
+            (1.0 - bestSimilarity) > maximumDistanceRatio * (1.0 - secondSimilarity))
+            continue;
+
+        const auto& [matchIterator, isInserted] =
+                bestMatches.try_emplace(bestId, RelocalizationMatch {keypointIndex, bestSimilarity});
+        if (not isInserted and matchIterator->second._similarity < bestSimilarity)
+            matchIterator->second = RelocalizationMatch {keypointIndex, bestSimilarity};
+    }
+
+    for (const auto& [id, match]: bestMatches)
+    {
+        const LocalMapPoint& mapPoint = localMap.at(id);
+        matches.push_back(matches_containers::make_feature<PointOptimizationFeature>(
+                detectedFeatures.get_keypoint(match._detectedIndex).get_2D(),
+                mapPoint._coordinates,
+                mapPoint._covariance.diagonal().cwiseSqrt(),
+                id,
+                match._detectedIndex));
+    }
+}
+
+} // namespace rgbd_slam::map_management
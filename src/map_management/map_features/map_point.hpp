@@ -3,8 +3,14 @@
 
 #include "feature_map.hpp"
 #include "features/keypoints/keypoint_handler.hpp"
+#include "map_tile_store.hpp"
+#include "relocalization_index.hpp"
 #include "tracking/point_with_tracking.hpp"
 #include "matches_containers.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
 
 namespace rgbd_slam::map_management {
 
@@ -25,10 +31,16 @@ struct PointOptimizationFeature : public matches_containers::IOptimizationFeatur
 
     double get_score() const noexcept override;
 
+    double get_quality() const noexcept override;
+
     bool is_inlier(const WorldToCameraMatrix& worldToCamera) const noexcept override;
 
     vectorxd get_distance(const WorldToCameraMatrix& worldToCamera) const noexcept override;
 
+    void add_to_blocks(pose_optimization::Match_Blocks& blocks, const size_t matchIndex) const noexcept override;
+
+    void add_to_bundle_adjustment(pose_optimization::Bundle_Adjustment_Keyframe& keyframe) const noexcept override;
+
     double get_alpha_reduction() const noexcept override;
 
     matches_containers::feat_ptr compute_random_variation() const noexcept override;
@@ -74,6 +86,16 @@ class MapPoint :
         assert(_id > 0);
     }
 
+    MapPoint(const WorldCoordinate& coordinates,
+             const WorldCoordinateCovariance& covariance,
+             tracking::Pooled_Descriptor&& descriptor,
+             const size_t id) :
+        tracking::Point(coordinates, covariance, std::move(descriptor)),
+        IMapFeature<DetectedKeypointsObject, DetectedPointType, TrackedPointsObject>(id)
+    {
+        assert(_id > 0);
+    }
+
     ~MapPoint() override = default;
 
     [[nodiscard]] matchIndexSet find_matches(const DetectedKeypointsObject& detectedFeatures,
@@ -83,20 +105,50 @@ class MapPoint :
                                              const bool shouldAddToMatches = true,
                                              const bool useAdvancedSearch = false) const noexcept override;
 
+    [[nodiscard]] matchIndexSet find_matches_from_projection(
+            const ScreenCoordinate2D& projectedPoint,
+            const DetectedKeypointsObject& detectedFeatures,
+            const WorldToCameraMatrix& worldToCamera,
+            const vectorb& isDetectedFeatureMatched,
+            matches_containers::match_container& matches,
+            const bool shouldAddToMatches = true,
+            const bool useAdvancedSearch = false) const noexcept override;
+
+    [[nodiscard]] double get_match_score(const DetectedKeypointsObject& detectedFeatures,
+                                         const WorldToCameraMatrix& worldToCamera,
+                                         const size_t matchIndex) const noexcept override;
+
     [[nodiscard]] bool add_to_tracked(const WorldToCameraMatrix& worldToCamera,
                                       TrackedPointsObject& trackedFeatures,
                                       const uint dropChance = 1000) const noexcept override;
 
+    [[nodiscard]] bool add_to_tracked_from_projection(const ScreenCoordinate2D& projectedPoint,
+                                                      const WorldToCameraMatrix& worldToCamera,
+                                                      TrackedPointsObject& trackedFeatures,
+                                                      const uint dropChance = 1000) const noexcept override;
+
     void draw(const WorldToCameraMatrix& worldToCamMatrix,
               cv::Mat& debugImage,
               const cv::Scalar& color) const noexcept override;
 
     [[nodiscard]] bool is_visible(const WorldToCameraMatrix& worldToCamMatrix) const noexcept override;
 
+    [[nodiscard]] bool get_projected_point(vector3& worldPoint) const noexcept override;
+
+    [[nodiscard]] bool get_spatial_position(vector3& position) const noexcept override;
+
     void write_to_file(std::shared_ptr<outputs::IMap_Writer> mapWriter) const noexcept override;
 
+    void add_to_snapshot(Map_Snapshot& snapshot) const noexcept override;
+
+    [[nodiscard]] bool apply_correction(
+            const pose_optimization::Bundle_Adjustment_Corrections& corrections) noexcept override;
+
+    [[nodiscard]] bool apply_correction(
+            const pose_optimization::Pose_Graph_Corrections& corrections) noexcept override;
+
     [[nodiscard]] bool compute_upgraded(const CameraToWorldMatrix& cameraToWorld,
-                                        UpgradedFeature_ptr& upgradeFeature) const noexcept override
+                                        No_Upgrade& upgradeFeature) noexcept override
     {
         std::ignore = cameraToWorld;
         std::ignore = upgradeFeature;
@@ -106,8 +158,7 @@ class MapPoint :
     [[nodiscard]] bool is_moving() const noexcept override { return tracking::Point::is_moving(); }
 
     [[nodiscard]] bool update_with_match(const DetectedPointType& matchedFeature,
-                                         const matrix33& poseCovariance,
-                                         const CameraToWorldMatrix& cameraToWorld) noexcept override;
+                                         const utils::Frame_Transform_Context& frameTransform) noexcept override;
 
   protected:
     void update_no_match() noexcept override;
@@ -123,6 +174,12 @@ class StagedMapPoint : public MapPoint, public IStagedMapFeature<DetectedPointTy
                    const CameraToWorldMatrix& cameraToWorld,
                    const DetectedPointType& detectedFeature);
 
+    // constructor for the points restored from a map state file
+    StagedMapPoint(const WorldCoordinate& coordinates,
+                   const WorldCoordinateCovariance& covariance,
+                   const cv::Mat& descriptor,
+                   const size_t id);
+
     [[nodiscard]] bool should_remove_from_staged() const noexcept override;
 
     [[nodiscard]] bool should_add_to_local_map() const noexcept override;
@@ -132,6 +189,21 @@ class StagedMapPoint : public MapPoint, public IStagedMapFeature<DetectedPointTy
         return not detectedPoint._descriptor.empty() and is_depth_valid(detectedPoint._coordinates.z());
     }
 
+    /**
+     * \brief The closest points are admitted first: their depth, and so their position, is the most precise
+     */
+    [[nodiscard]] static double get_admission_score(const DetectedPointType& detectedPoint) noexcept
+    {
+        return 1.0 / detectedPoint._coordinates.z();
+    }
+
+    [[nodiscard]] static uint get_admission_cell(const DetectedPointType& detectedPoint) noexcept
+    {
+        return get_screen_admission_cell(detectedPoint._coordinates.x(), detectedPoint._coordinates.y());
+    }
+
+    [[nodiscard]] double get_retention_score() const noexcept override { return get_confidence(); }
+
   protected:
     double get_confidence() const noexcept;
 };
@@ -144,11 +216,14 @@ class LocalMapPoint : public MapPoint, public ILocalMapFeature<StagedMapPoint>
   public:
     explicit LocalMapPoint(const StagedMapPoint& stagedPoint);
 
-    // constructor for upgraded features
+    // constructor for upgraded features: takes their descriptor and matches
+    LocalMapPoint(UpgradedPoint2D&& upgraded, const size_t id);
+
+    // constructor for the points loaded back from the tile store or restored from a map state file
     LocalMapPoint(const WorldCoordinate& coordinates,
                   const WorldCoordinateCovariance& covariance,
                   const cv::Mat& descriptor,
-                  const matchIndexSet& matchIndexes);
+                  const size_t id);
 
     [[nodiscard]] bool is_lost() const noexcept override;
 };
@@ -161,6 +236,15 @@ class localPointMap :
 
     std::string get_display_name() const override { return "Points"; }
 
+    outputs::Memory_Consumer get_local_memory_consumer() const override
+    {
+        return outputs::Memory_Consumer::LocalPoints;
+    }
+    outputs::Memory_Consumer get_staged_memory_consumer() const override
+    {
+        return outputs::Memory_Consumer::StagedPoints;
+    }
+
     DetectedKeypointsObject get_detected_feature(const DetectedFeatureContainer& features) const override
     {
         return features.keypointObject;
@@ -174,21 +258,62 @@ class localPointMap :
 
     size_t minimum_features_for_opti() const override { return parameters::optimization::minimumPointForOptimization; }
 
-  protected:
-    void add_upgraded_to_local_map(const UpgradedFeature_ptr upgradedfeature) override
+    size_t get_staged_admission_budget() const noexcept override
     {
-        if (upgradedfeature->get_type() == get_feature_type())
-        {
-            const auto upgraded = dynamic_cast<UpgradedPoint2D&>(*upgradedfeature);
-
-            add_to_local_map(LocalMapPoint(
-                    upgraded._coordinates, upgraded._covariance, upgraded._descriptor, upgraded._matchIndexes));
-        }
-        else
-        {
-            outputs::log_error("Cannot add this feature to the point map");
-        }
+        return parameters::mapping::stagedPointAdmissionBudget;
     }
+
+    size_t get_staged_capacity() const noexcept override { return parameters::mapping::maximumStagedPointCount; }
+
+    /**
+     * \brief Move the points upgraded by the 2D point map to the local map storage
+     * \param[in, out] upgradedPoints The upgraded points. The added points are moved from, and get their new id
+     * \return the number of points added to the map
+     */
+    size_t add_upgraded_features(std::vector<UpgradedPoint2D>& upgradedPoints) noexcept;
+
+  protected:
+    void store_lost_feature(const LocalMapPoint& lostFeature) noexcept override;
+
+    size_t load_stored_features(const WorldToCameraMatrix& worldToCamera) noexcept override;
+
+    void clear_stored_features() noexcept override { _tileStore.clear(); }
+
+    void find_relocalization_matches(const DetectedKeypointsObject& detectedFeatures,
+                                     matches_containers::match_container& matches) noexcept override;
+
+    void write_features(Map_State_Writer& writer) const noexcept override;
+
+    size_t read_features(const Map_State_Reader& reader) noexcept override;
+
+  private:
+    // a lost map point, in the tile store
+    struct StoredPoint
+    {
+        size_t _id;
+        std::array<double, 3> _coordinates;
+        std::array<double, 9> _covariance;
+        std::array<uchar, tracking::Descriptor_Pool::descriptorSize> _descriptor;
+    };
+
+    // a map point in a map state file: a stored point and its tracking counters
+    struct SavedPoint
+    {
+        StoredPoint _point;
+        int64_t _successivMatchedCount;
+        uint64_t _failedTrackingCount;
+    };
+
+    /**
+     * \brief Copy the coordinates, covariance and descriptor of a point with a descriptor to a record
+     */
+    [[nodiscard]] static StoredPoint get_stored_point(const MapPoint& point) noexcept;
+
+    Map_Tile_Store _tileStore {"out_points.tiles", sizeof(StoredPoint), parameters::mapping::globalMap::tileSize_mm};
+    std::vector<std::byte> _loadedRecords; // buffer of the records loaded from the tile store
+
+    Relocalization_Index _relocalizationIndex; // updated from the local map on each relocalization
+    std::vector<size_t> _relocalizationCandidates; // buffer of the relocalization index queries
 };
 
 } // namespace rgbd_slam::map_management
@@ -4,7 +4,10 @@
 #include "line.hpp"
 #include "logger.hpp"
 #include "parameters.hpp"
+#include "pose_optimization/match_blocks.hpp"
+#include "pose_optimization/pose_graph.hpp"
 #include "types.hpp"
+#include <cstring>
 
 namespace rgbd_slam::map_management {
 
@@ -30,6 +33,13 @@ double Point2dOptimizationFeature::get_score() const noexcept
     return optiScore;
 }
 
+double Point2dOptimizationFeature::get_quality() const noexcept
+{
+    // the depth of those points is barely known: they come after most of the 3D points
+    return get_alpha_reduction() /
+           (1.0 + _mapPointStandardDev.head<3>().norm() / parameters::optimization::ransac::matchQualityUncertainty_mm);
+}
+
 bool Point2dOptimizationFeature::is_inlier(const WorldToCameraMatrix& worldToCamera) const noexcept
 {
     return (get_distance(worldToCamera).array() <=
@@ -44,6 +54,24 @@ vectorxd Point2dOptimizationFeature::get_distance(const WorldToCameraMatrix& wor
     return distance;
 }
 
+void Point2dOptimizationFeature::add_to_blocks(pose_optimization::Match_Blocks& blocks,
+                                               const size_t matchIndex) const noexcept
+{
+    blocks.add_point2d(matchIndex,
+                       _mapPoint,
+                       _mapPointStandardDev(InverseDepthWorldPoint::inverseDepthIndex),
+                       _matchedPoint,
+                       get_score(),
+                       get_alpha_reduction());
+}
+
+void Point2dOptimizationFeature::add_to_bundle_adjustment(
+        pose_optimization::Bundle_Adjustment_Keyframe& keyframe) const noexcept
+{
+    // the inverse depth points are only refined by their tracking
+    std::ignore = keyframe;
+}
+
 double Point2dOptimizationFeature::get_alpha_reduction() const noexcept { return 0.3; }
 
 matches_containers::feat_ptr Point2dOptimizationFeature::compute_random_variation() const noexcept
@@ -64,7 +92,7 @@ matches_containers::feat_ptr Point2dOptimizationFeature::compute_random_variatio
                        -M_PI,
                        M_PI);
 
-    return std::make_shared<Point2dOptimizationFeature>(
+    return matches_containers::make_feature<Point2dOptimizationFeature>(
             _matchedPoint,
             InverseDepthWorldPoint(variatedObservationPoint, variatedInverseDepth, variatedTheta, variatedPhi),
             _mapPointStandardDev,
@@ -94,7 +122,8 @@ matchIndexSet MapPoint2D::find_matches(const DetectedKeypointsObject& detectedFe
     matchIndexSet matchIndexRes;
 
     assert(not _descriptor.empty());
-    constexpr double searchSpaceRadius = parameters::matching::matchSearchRadius_px;
+    // the advanced search is a fallback of the failed trackings: it does not trust the prediction uncertainty
+    const double searchSpaceRadius = detectedFeatures.get_search_radius();
     constexpr double advancedSearchSpaceRadius = parameters::matching::matchSearchRadius_px * 2;
     const double searchRadius = useAdvancedSearch ? advancedSearchSpaceRadius : searchSpaceRadius;
 
@@ -108,7 +137,7 @@ matchIndexSet MapPoint2D::find_matches(const DetectedKeypointsObject& detectedFe
         {
             // TODO use a real match to 2D function, this one will fail for 2D points
             matchIndexRes = detectedFeatures.get_match_indexes(
-                    screenCoordinates, _descriptor, isDetectedFeatureMatched, searchRadius);
+                    screenCoordinates, _descriptor.get(), isDetectedFeatureMatched, searchRadius);
         }
     }
 
@@ -130,16 +159,29 @@ matchIndexSet MapPoint2D::find_matches(const DetectedKeypointsObject& detectedFe
     {
         for (const auto i: matchIndexRes)
         {
-            matches.push_back(std::make_shared<Point2dOptimizationFeature>(detectedFeatures.get_keypoint(i).get_2D(),
-                                                                           _coordinates,
-                                                                           _covariance.diagonal().cwiseSqrt(),
-                                                                           _id,
-                                                                           i));
+            matches.push_back(matches_containers::make_feature<Point2dOptimizationFeature>(
+                    detectedFeatures.get_keypoint(i).get_2D(),
+                    _coordinates,
+                    _covariance.diagonal().cwiseSqrt(),
+                    _id,
+                    i));
         }
     }
     return matchIndexRes;
 }
 
+double MapPoint2D::get_match_score(const DetectedKeypointsObject& detectedFeatures,
+                                   const WorldToCameraMatrix& worldToCamera,
+                                   const size_t matchIndex) const noexcept
+{
+    std::ignore = worldToCamera;
+
+    // the keypoint tracked from this point is its best possible match
+    if (detectedFeatures.get_tracking_match_index(_id) == static_cast<int>(matchIndex))
+        return 1.0;
+    return detectedFeatures.get_descriptor_similarity(static_cast<uint>(matchIndex), _descriptor.get());
+}
+
 bool MapPoint2D::add_to_tracked(const WorldToCameraMatrix& worldToCamera,
                                 TrackedPointsObject& trackedFeatures,
                                 const uint dropChance) const noexcept
@@ -199,6 +241,13 @@ bool MapPoint2D::is_visible(const WorldToCameraMatrix& worldToCamMatrix) const n
     return false;
 }
 
+bool MapPoint2D::get_spatial_position(vector3& position) const noexcept
+{
+    // the depth of an inverse depth point is unbounded along its observation ray
+    std::ignore = position;
+    return false;
+}
+
 void MapPoint2D::write_to_file(std::shared_ptr<outputs::IMap_Writer> mapWriter) const noexcept
 {
     const double inverseDepthStandardDev = sqrt(_covariance.get_inverse_depth_variance());
@@ -217,18 +266,42 @@ void MapPoint2D::write_to_file(std::shared_ptr<outputs::IMap_Writer> mapWriter)
     }
 }
 
+void MapPoint2D::add_to_snapshot(Map_Snapshot& snapshot) const noexcept
+{
+    snapshot._points.emplace_back(Map_Snapshot::Point {_id,
+                                                       _coordinates.to_world_coordinates(),
+                                                       compute_cartesian_covariance(_coordinates, _covariance),
+                                                       true});
+}
+
+bool MapPoint2D::apply_correction(const pose_optimization::Bundle_Adjustment_Corrections& corrections) noexcept
+{
+    // the inverse depth points are not refined by the bundle adjustment
+    std::ignore = corrections;
+    return false;
+}
+
+bool MapPoint2D::apply_correction(const pose_optimization::Pose_Graph_Corrections& corrections) noexcept
+{
+    // the inverse depth points are not moved by the loop closures: they are upgraded, or dropped, quickly
+    std::ignore = corrections;
+    return false;
+}
+
 bool MapPoint2D::compute_upgraded(const CameraToWorldMatrix& cameraToWorld,
-                                  UpgradedFeature_ptr& upgradedFeature) const noexcept
+                                  UpgradedPoint2D& upgradedFeature) noexcept
 {
     try
     {
-        if (compute_linearity_score(cameraToWorld) < 0.1) // linearity index (percentage) (TODO: add to parameters)
+        if (compute_linearity_score(cameraToWorld) < parameters::detection::inverseDepthUpgradeLinearity)
         {
             Eigen::Matrix<double, 3, 6> jacobian;
-            const auto& worldCoords = _coordinates.to_world_coordinates(jacobian);
-
-            upgradedFeature = std::make_shared<UpgradedPoint2D>(
-                    worldCoords, compute_cartesian_covariance(_covariance, jacobian), _descriptor, _matchIndexes);
+            upgradedFeature._coordinates = _coordinates.to_world_coordinates(jacobian);
+            upgradedFeature._covariance = compute_cartesian_covariance(_covariance, jacobian);
+            upgradedFeature._sourceId = _id;
+            // this feature is removed after its upgrade: its descriptor row and matches are moved
+            upgradedFeature._descriptor = std::move(_descriptor);
+            upgradedFeature._matchIndexes = std::move(_matchIndexes);
             return true;
         }
     }
@@ -241,22 +314,35 @@ bool MapPoint2D::compute_upgraded(const CameraToWorldMatrix& cameraToWorld,
 }
 
 bool MapPoint2D::update_with_match(const DetectedPoint2DType& matchedFeature,
-                                   const matrix33& poseCovariance,
-                                   const CameraToWorldMatrix& cameraToWorld) noexcept
+                                   const utils::Frame_Transform_Context& frameTransform) noexcept
 {
+    const CameraToWorldMatrix& cameraToWorld = frameTransform._cameraToWorld;
+    const matrix33& poseCovariance = frameTransform._poseCovariance;
+
     if (_matchIndexes.empty())
     {
         outputs::log_error("Tries to call the function update_with_match with no associated match");
         return false;
     }
 
+    bool isTracked = false;
     if (is_depth_valid(matchedFeature._coordinates.z()))
     {
         // use the real observation, it will most likely overide the covariance inside the inverse depth point
-        return track(matchedFeature._coordinates, cameraToWorld, poseCovariance, matchedFeature._descriptor);
+        isTracked = track(matchedFeature._coordinates, cameraToWorld, poseCovariance, matchedFeature._descriptor);
+    }
+    else
+    {
+        // use a 2D observation, that will be merged with the current one
+        isTracked =
+                track(matchedFeature._coordinates.get_2D(), cameraToWorld, poseCovariance, matchedFeature._descriptor);
     }
-    // use a 2D observation, that will be merged with the current one
-    return track(matchedFeature._coordinates.get_2D(), cameraToWorld, poseCovariance, matchedFeature._descriptor);
+
+    // the linearity index mostly changes with the observations: flag the upgrade here, and only test the flagged
+    // points for an upgrade
+    if (isTracked and compute_linearity_score(cameraToWorld) < parameters::detection::inverseDepthUpgradeLinearity)
+        _isUpgradeCandidate = true;
+    return isTracked;
 }
 
 void MapPoint2D::update_no_match() noexcept
@@ -275,6 +361,10 @@ StagedMapPoint2D::StagedMapPoint2D(const matrix33& poseCovariance,
 {
 }
 
+StagedMapPoint2D::StagedMapPoint2D(const tracking::PointInverseDepth& point, const size_t id) : MapPoint2D(point, id)
+{
+}
+
 bool StagedMapPoint2D::should_remove_from_staged() const noexcept { return get_confidence() <= 0; }
 
 bool StagedMapPoint2D::should_add_to_local_map() const noexcept
@@ -295,6 +385,12 @@ double StagedMapPoint2D::get_confidence() const noexcept
  * LocalMapPoint
  */
 
+LocalMapPoint2D::LocalMapPoint2D(const tracking::PointInverseDepth& point, const size_t id) : MapPoint2D(point, id)
+{
+    // new map point, new color
+    set_color();
+}
+
 LocalMapPoint2D::LocalMapPoint2D(const StagedMapPoint2D& stagedPoint) : MapPoint2D(stagedPoint, stagedPoint._id)
 {
     // new map point, new color
@@ -309,4 +405,71 @@ bool LocalMapPoint2D::is_lost() const noexcept
     return (_failedTrackingCount > parameters::mapping::pointUnmatchedCountToLoose);
 }
 
+/**
+ * localPoint2DMap
+ */
+
+void localPoint2DMap::write_features(Map_State_Writer& writer) const noexcept
+{
+    const auto write_points = [&writer](const auto& map, const Map_State_Section section) {
+        writer.begin_section(section);
+        for (const auto& [id, mapPoint]: map)
+        {
+            // a point with no descriptor could not be matched after the restart
+            if (mapPoint._descriptor.empty())
+                continue;
+
+            const InverseDepthWorldPoint& coordinates = mapPoint._coordinates;
+            SavedPoint2D savedPoint;
+            savedPoint._id = mapPoint._id;
+            Eigen::Map<vector3>(savedPoint._firstObservation.data()) = coordinates.get_first_observation();
+            savedPoint._inverseDepth = coordinates.get_inverse_depth();
+            savedPoint._theta = coordinates.get_theta();
+            savedPoint._phi = coordinates.get_phi();
+            Eigen::Map<matrix33>(savedPoint._firstPoseCovariance.data()) = mapPoint._covariance._firstPoseCovariance;
+            Eigen::Map<matrix33>(savedPoint._sphericalCovariance.data()) = mapPoint._covariance._sphericalCovariance;
+            std::memcpy(savedPoint._descriptor.data(),
+                        mapPoint._descriptor.get().template ptr<uchar>(0),
+                        savedPoint._descriptor.size());
+            savedPoint._successivMatchedCount = static_cast<int64_t>(mapPoint._successivMatchedCount);
+            savedPoint._failedTrackingCount = static_cast<uint64_t>(mapPoint._failedTrackingCount);
+            writer.append_record(savedPoint);
+        }
+    };
+    write_points(get_local_map(), Map_State_Section::LocalPoints2D);
+    write_points(get_staged_map(), Map_State_Section::StagedPoints2D);
+}
+
+size_t localPoint2DMap::read_features(const Map_State_Reader& reader) noexcept
+{
+    const auto get_point = [](SavedPoint2D& saved) {
+        tracking::PointInverseDepth::Covariance covariance;
+        covariance._firstPoseCovariance = Eigen::Map<const matrix33>(saved._firstPoseCovariance.data());
+        covariance._sphericalCovariance = Eigen::Map<const matrix33>(saved._sphericalCovariance.data());
+        // the descriptor matrix only views the record: the point copies it
+        return tracking::PointInverseDepth(
+                InverseDepthWorldPoint(WorldCoordinate(Eigen::Map<const vector3>(saved._firstObservation.data())),
+                                       saved._inverseDepth,
+                                       saved._theta,
+                                       saved._phi),
+                covariance,
+                cv::Mat(1, static_cast<int>(saved._descriptor.size()), CV_8U, saved._descriptor.data()));
+    };
+
+    size_t restoredCount =
+            reader.read_records<SavedPoint2D>(Map_State_Section::LocalPoints2D, [&](SavedPoint2D& saved) {
+                LocalMapPoint2D mapPoint(get_point(saved), saved._id);
+                mapPoint._successivMatchedCount = static_cast<int>(saved._successivMatchedCount);
+                mapPoint._failedTrackingCount = static_cast<size_t>(saved._failedTrackingCount);
+                add_to_local_map(mapPoint);
+            });
+    restoredCount += reader.read_records<SavedPoint2D>(Map_State_Section::StagedPoints2D, [&](SavedPoint2D& saved) {
+        StagedMapPoint2D stagedPoint(get_point(saved), saved._id);
+        stagedPoint._successivMatchedCount = static_cast<int>(saved._successivMatchedCount);
+        stagedPoint._failedTrackingCount = static_cast<size_t>(saved._failedTrackingCount);
+        add_to_staged_map(stagedPoint);
+    });
+    return restoredCount;
+}
+
 } // namespace rgbd_slam::map_management
\ No newline at end of file
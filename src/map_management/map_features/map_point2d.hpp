@@ -6,6 +6,8 @@
 #include "features/keypoints/keypoint_handler.hpp"
 #include "tracking/inverse_depth_with_tracking.hpp"
 #include "matches_containers.hpp"
+#include <array>
+#include <cstdint>
 
 namespace rgbd_slam::map_management {
 
@@ -24,10 +26,16 @@ struct Point2dOptimizationFeature : public matches_containers::IOptimizationFeat
 
     double get_score() const noexcept override;
 
+    double get_quality() const noexcept override;
+
     bool is_inlier(const WorldToCameraMatrix& worldToCamera) const noexcept override;
 
     vectorxd get_distance(const WorldToCameraMatrix& worldToCamera) const noexcept override;
 
+    void add_to_blocks(pose_optimization::Match_Blocks& blocks, const size_t matchIndex) const noexcept override;
+
+    void add_to_bundle_adjustment(pose_optimization::Bundle_Adjustment_Keyframe& keyframe) const noexcept override;
+
     double get_alpha_reduction() const noexcept override;
 
     matches_containers::feat_ptr compute_random_variation() const noexcept override;
@@ -52,7 +60,7 @@ using TrackedPointsObject = features::keypoints::KeypointsWithIdStruct;
  */
 class MapPoint2D :
     public tracking::PointInverseDepth,
-    public IMapFeature<DetectedKeypointsObject, DetectedPoint2DType, TrackedPointsObject>
+    public IMapFeature<DetectedKeypointsObject, DetectedPoint2DType, TrackedPointsObject, UpgradedPoint2D>
 {
   public:
     MapPoint2D(const ScreenCoordinate2D& coordinates,
@@ -60,7 +68,7 @@ class MapPoint2D :
                const matrix33& stateCovariance,
                const cv::Mat& descriptor) :
         PointInverseDepth(coordinates, c2w, stateCovariance, descriptor),
-        IMapFeature<DetectedKeypointsObject, DetectedPoint2DType, TrackedPointsObject>()
+        IMapFeature<DetectedKeypointsObject, DetectedPoint2DType, TrackedPointsObject, UpgradedPoint2D>()
     {
         assert(_id > 0);
         assert(not _descriptor.empty());
@@ -68,7 +76,7 @@ class MapPoint2D :
 
     MapPoint2D(const tracking::PointInverseDepth& coordinates, const size_t id) :
         tracking::PointInverseDepth(coordinates),
-        IMapFeature<DetectedKeypointsObject, DetectedPoint2DType, TrackedPointsObject>(id)
+        IMapFeature<DetectedKeypointsObject, DetectedPoint2DType, TrackedPointsObject, UpgradedPoint2D>(id)
     {
         assert(_id > 0);
         assert(not _descriptor.empty());
@@ -83,6 +91,10 @@ class MapPoint2D :
                                              const bool shouldAddToMatches = true,
                                              const bool useAdvancedSearch = false) const noexcept override;
 
+    [[nodiscard]] double get_match_score(const DetectedKeypointsObject& detectedFeatures,
+                                         const WorldToCameraMatrix& worldToCamera,
+                                         const size_t matchIndex) const noexcept override;
+
     [[nodiscard]] bool add_to_tracked(const WorldToCameraMatrix& worldToCamera,
                                       TrackedPointsObject& trackedFeatures,
                                       const uint dropChance = 1000) const noexcept override;
@@ -93,16 +105,25 @@ class MapPoint2D :
 
     [[nodiscard]] bool is_visible(const WorldToCameraMatrix& worldToCamMatrix) const noexcept override;
 
+    [[nodiscard]] bool get_spatial_position(vector3& position) const noexcept override;
+
     void write_to_file(std::shared_ptr<outputs::IMap_Writer> mapWriter) const noexcept override;
 
+    void add_to_snapshot(Map_Snapshot& snapshot) const noexcept override;
+
+    [[nodiscard]] bool apply_correction(
+            const pose_optimization::Bundle_Adjustment_Corrections& corrections) noexcept override;
+
+    [[nodiscard]] bool apply_correction(
+            const pose_optimization::Pose_Graph_Corrections& corrections) noexcept override;
+
     [[nodiscard]] bool compute_upgraded(const CameraToWorldMatrix& cameraToWorld,
-                                        UpgradedFeature_ptr& upgradeFeature) const noexcept override;
+                                        UpgradedPoint2D& upgradeFeature) noexcept override;
 
     [[nodiscard]] bool is_moving() const noexcept override { return tracking::PointInverseDepth::is_moving(); }
 
     [[nodiscard]] bool update_with_match(const DetectedPoint2DType& matchedFeature,
-                                         const matrix33& poseCovariance,
-                                         const CameraToWorldMatrix& cameraToWorld) noexcept override;
+                                         const utils::Frame_Transform_Context& frameTransform) noexcept override;
 
   protected:
     void update_no_match() noexcept override;
@@ -118,6 +139,9 @@ class StagedMapPoint2D : public MapPoint2D, public IStagedMapFeature<DetectedPoi
                      const CameraToWorldMatrix& cameraToWorld,
                      const DetectedPoint2DType& detectedFeature);
 
+    // constructor for the points restored from a map state file
+    StagedMapPoint2D(const tracking::PointInverseDepth& point, const size_t id);
+
     [[nodiscard]] bool should_remove_from_staged() const noexcept override;
 
     [[nodiscard]] bool should_add_to_local_map() const noexcept override;
@@ -127,6 +151,14 @@ class StagedMapPoint2D : public MapPoint2D, public IStagedMapFeature<DetectedPoi
         return not detectedPoint._descriptor.empty() and not is_depth_valid(detectedPoint._coordinates.z());
     }
 
+    // no depth to grade those points: they are only spread over the image
+    [[nodiscard]] static uint get_admission_cell(const DetectedPoint2DType& detectedPoint) noexcept
+    {
+        return get_screen_admission_cell(detectedPoint._coordinates.x(), detectedPoint._coordinates.y());
+    }
+
+    [[nodiscard]] double get_retention_score() const noexcept override { return get_confidence(); }
+
   protected:
     double get_confidence() const noexcept;
 };
@@ -139,6 +171,9 @@ class LocalMapPoint2D : public MapPoint2D, public ILocalMapFeature<StagedMapPoin
   public:
     explicit LocalMapPoint2D(const StagedMapPoint2D& stagedPoint);
 
+    // constructor for the points restored from a map state file
+    LocalMapPoint2D(const tracking::PointInverseDepth& point, const size_t id);
+
     [[nodiscard]] bool is_lost() const noexcept override;
 };
 
@@ -154,6 +189,15 @@ class localPoint2DMap :
 
     std::string get_display_name() const override { return "P2D"; }
 
+    outputs::Memory_Consumer get_local_memory_consumer() const override
+    {
+        return outputs::Memory_Consumer::LocalPoints2D;
+    }
+    outputs::Memory_Consumer get_staged_memory_consumer() const override
+    {
+        return outputs::Memory_Consumer::StagedPoints2D;
+    }
+
     DetectedKeypointsObject get_detected_feature(const DetectedFeatureContainer& features) const override
     {
         return features.keypointObject;
@@ -170,18 +214,33 @@ class localPoint2DMap :
         return parameters::optimization::minimumPoint2dForOptimization;
     }
 
-  protected:
-    void add_upgraded_to_local_map(const UpgradedFeature_ptr upgradedfeature) override
+    size_t get_staged_admission_budget() const noexcept override
     {
-        if (upgradedfeature->get_type() == get_feature_type())
-        {
-            outputs::log_error("Upgraded 2D points is not supported");
-        }
-        else
-        {
-            outputs::log_error("Cannot add this feature to the 2D point map");
-        }
+        return parameters::mapping::stagedPointAdmissionBudget;
     }
+
+    size_t get_staged_capacity() const noexcept override { return parameters::mapping::maximumStagedPointCount; }
+
+  protected:
+    void write_features(Map_State_Writer& writer) const noexcept override;
+
+    size_t read_features(const Map_State_Reader& reader) noexcept override;
+
+  private:
+    // an inverse depth point in a map state file
+    struct SavedPoint2D
+    {
+        uint64_t _id;
+        std::array<double, 3> _firstObservation;
+        double _inverseDepth;
+        double _theta;
+        double _phi;
+        std::array<double, 9> _firstPoseCovariance;
+        std::array<double, 9> _sphericalCovariance;
+        std::array<uchar, tracking::Descriptor_Pool::descriptorSize> _descriptor;
+        int64_t _successivMatchedCount;
+        uint64_t _failedTrackingCount;
+    };
 };
 
 } // namespace rgbd_slam::map_management
@@ -4,7 +4,12 @@
 #include "logger.hpp"
 #include "matches_containers.hpp"
 #include "parameters.hpp"
+#include "pose_optimization/local_bundle_adjustment.hpp"
+#include "pose_optimization/match_blocks.hpp"
+#include "pose_optimization/pose_graph.hpp"
 #include "distance_utils.hpp"
+#include <algorithm>
+#include <exception>
 
 namespace rgbd_slam::map_management {
 
@@ -30,6 +35,11 @@ double PlaneOptimizationFeature::get_score() const noexcept
     return optiScore;
 }
 
+double PlaneOptimizationFeature::get_quality() const noexcept
+{
+    return 1.0 / (1.0 + _mapPlaneStandardDev(3) / parameters::optimization::ransac::matchQualityUncertainty_mm);
+}
+
 bool PlaneOptimizationFeature::is_inlier(const WorldToCameraMatrix& worldToCamera) const noexcept
 {
     // This is acceptable to recompute:
@@ -61,6 +71,19 @@ vectorxd PlaneOptimizationFeature::get_distance(const WorldToCameraMatrix& world
     return planeProjectionError;
 }
 
+void PlaneOptimizationFeature::add_to_blocks(pose_optimization::Match_Blocks& blocks,
+                                             const size_t matchIndex) const noexcept
+{
+    blocks.add_plane(
+            matchIndex, _mapPlane, _mapPlaneStandardDev, _matchedPlane, get_score(), get_alpha_reduction());
+}
+
+void PlaneOptimizationFeature::add_to_bundle_adjustment(
+        pose_optimization::Bundle_Adjustment_Keyframe& keyframe) const noexcept
+{
+    keyframe._planes.emplace_back(_idInMap, _matchedPlane, _mapPlane, _mapPlaneStandardDev);
+}
+
 double PlaneOptimizationFeature::get_alpha_reduction() const noexcept { return 1.0; }
 
 matches_containers::feat_ptr PlaneOptimizationFeature::compute_random_variation() const noexcept
@@ -72,7 +95,7 @@ matches_containers::feat_ptr PlaneOptimizationFeature::compute_random_variation(
 
     variatedCoordinates.d() += utils::Random::get_normal_double() * _mapPlaneStandardDev(3);
 
-    return std::make_shared<PlaneOptimizationFeature>(
+    return matches_containers::make_feature<PlaneOptimizationFeature>(
             _matchedPlane, variatedCoordinates, _mapPlaneStandardDev, _idInMap, _detectedFeatureId);
 }
 
@@ -101,7 +124,7 @@ matchIndexSet MapPlane::find_matches(const DetectedPlaneObject& detectedFeatures
     // project plane in camera space
     const PlaneCameraCoordinates& projectedPlane = get_parametrization().to_camera_coordinates(planeCameraToWorld);
 
-    const CameraPolygon& projectedPolygon = _boundaryPolygon.to_camera_space(worldToCamera);
+    const CameraPolygon& projectedPolygon = get_projected_boundary_polygon(worldToCamera);
     const double projectedArea = projectedPolygon.get_area();
 
     // minimum plane overlap
@@ -114,10 +137,12 @@ matchIndexSet MapPlane::find_matches(const DetectedPlaneObject& detectedFeatures
         return matchIndexes;
 
     int selectedIndex = -1;
-    // search best match score
-    const int detectedPlaneSize = static_cast<int>(detectedFeatures.size());
-    for (int planeIndex = 0; planeIndex < detectedPlaneSize; ++planeIndex)
+    // search best match score, in the detected planes of similar orientation and offset
+    std::vector<size_t> candidateIndexes;
+    detectedFeatures.get_index().get_candidates(projectedPlane, candidateIndexes);
+    for (const size_t candidateIndex: candidateIndexes)
     {
+        const int planeIndex = static_cast<int>(candidateIndex);
         if (isDetectedFeatureMatched[planeIndex])
             // Does not allow multiple removal of a single match
             // TODO: change this
@@ -134,7 +159,9 @@ matchIndexSet MapPlane::find_matches(const DetectedPlaneObject& detectedFeatures
         const CameraPolygon& detectedPolygon = shapePlane.get_boundary_polygon();
         // TODO: this metric fails as the plane becomes bigger
         const double newPlaneArea = detectedPolygon.get_area(); // max area of the two potential planes
-        const double interArea = detectedPolygon.inter_area(projectedPolygon);
+        // candidates that cannot beat the current best, or reach the overlap threshold, are rejected on their bounds
+        const double minimumInterArea = std::max(greatestSimilarity, newPlaneArea * areaSimilarityThreshold);
+        const double interArea = detectedPolygon.inter_area(projectedPolygon, minimumInterArea);
         // similarity is greater than the greatest similarity, and overlap is greater than threshold
         if (interArea > greatestSimilarity and interArea / newPlaneArea >= areaSimilarityThreshold)
         {
@@ -148,28 +175,47 @@ matchIndexSet MapPlane::find_matches(const DetectedPlaneObject& detectedFeatures
 
     if (shouldAddToMatches)
     {
-        matches.push_back(
-                std::make_shared<PlaneOptimizationFeature>(detectedFeatures[selectedIndex].get_parametrization(),
-                                                           get_parametrization(),
-                                                           get_covariance().diagonal().cwiseSqrt(),
-                                                           _id,
-                                                           selectedIndex));
+        matches.push_back(matches_containers::make_feature<PlaneOptimizationFeature>(
+                detectedFeatures[selectedIndex].get_parametrization(),
+                get_parametrization(),
+                get_covariance().diagonal().cwiseSqrt(),
+                _id,
+                selectedIndex));
     }
 
     matchIndexes.emplace(selectedIndex);
     return matchIndexes;
 }
 
+double MapPlane::get_match_score(const DetectedPlaneObject& detectedFeatures,
+                                 const WorldToCameraMatrix& worldToCamera,
+                                 const size_t matchIndex) const noexcept
+{
+    assert(matchIndex < detectedFeatures.size());
+
+    // same metric as the match search: the part of the detected plane covered by this plane
+    const CameraPolygon& detectedPolygon = detectedFeatures[matchIndex].get_boundary_polygon();
+    const double detectedArea = detectedPolygon.get_area();
+    if (detectedArea <= 0.0)
+        return 0.0;
+    const double interArea = detectedPolygon.inter_area(get_projected_boundary_polygon(worldToCamera));
+    return std::clamp(interArea / detectedArea, 0.0, 1.0);
+}
+
 bool MapPlane::add_to_tracked(const WorldToCameraMatrix& worldToCamera,
                               TrackedPlaneObject& trackedFeatures,
                               const uint dropChance) const noexcept
 {
-    // TODO: track primitives
-    // silence warning for unused parameters
-    (void)worldToCamera;
-    (void)trackedFeatures;
-    (void)dropChance;
-    return false;
+    // planes are not dropped: they are few, and are priors of the plane detection
+    std::ignore = dropChance;
+
+    const PlaneWorldToCameraMatrix& planeWorldToCamera = utils::compute_plane_world_to_camera_matrix(worldToCamera);
+    const PlaneCameraCoordinates& projectedPlane = get_parametrization().to_camera_coordinates(planeWorldToCamera);
+    if (projectedPlane.hasNaN())
+        return false;
+
+    trackedFeatures.push_back(projectedPlane);
+    return true;
 }
 
 void MapPlane::draw(const WorldToCameraMatrix& worldToCamMatrix,
@@ -180,19 +226,48 @@ void MapPlane::draw(const WorldToCameraMatrix& worldToCamMatrix,
         return;
 
     // display the boundary of the plane
-    _boundaryPolygon.display(worldToCamMatrix, color, debugImage);
+    get_projected_boundary_polygon(worldToCamMatrix).display(color, debugImage);
 }
 
 bool MapPlane::is_visible(const WorldToCameraMatrix& worldToCamMatrix) const noexcept
 {
-    return _boundaryPolygon.to_camera_space(worldToCamMatrix).is_visible_in_screen_space();
+    const CameraPolygon& projectedPolygon = get_projected_boundary_polygon(worldToCamMatrix);
+    // the projection cache is set by the call above
+    std::optional<bool>& isVisible = _projectedBoundary->isVisible;
+    if (not isVisible.has_value())
+        isVisible = projectedPolygon.is_visible_in_screen_space();
+    return isVisible.value();
+}
+
+void MapPlane::add_memory_usage(outputs::Frame_Metrics& metrics) const noexcept
+{
+    size_t polygonBytes = _boundaryPolygon.get_allocated_bytes();
+    if (_projectedBoundary.has_value())
+        polygonBytes += _projectedBoundary->polygon.get_allocated_bytes();
+    metrics.add_memory_usage(outputs::Memory_Consumer::Polygons, polygonBytes);
+}
+
+const CameraPolygon& MapPlane::get_projected_boundary_polygon(const WorldToCameraMatrix& worldToCamera) const noexcept
+{
+    if (not _projectedBoundary.has_value() or _projectedBoundary->worldToCamera != worldToCamera)
+    {
+        _projectedBoundary.emplace(worldToCamera, _boundaryPolygon.to_camera_space(worldToCamera), std::nullopt);
+    }
+    return _projectedBoundary->polygon;
+}
+
+bool MapPlane::get_spatial_position(vector3& position) const noexcept
+{
+    // planes can span many voxels, and are few: they are always visibility candidates
+    std::ignore = position;
+    return false;
 }
 
 void MapPlane::write_to_file(std::shared_ptr<outputs::IMap_Writer> mapWriter) const noexcept
 {
     if (mapWriter != nullptr)
     {
-        mapWriter->add_polygon(_boundaryPolygon.get_unprojected_boundary(), _boundaryPolygon.get_normal());
+        mapWriter->add_map_polygon(_id, _boundaryPolygon.get_unprojected_boundary(), _boundaryPolygon.get_normal());
     }
     else
     {
@@ -201,10 +276,62 @@ void MapPlane::write_to_file(std::shared_ptr<outputs::IMap_Writer> mapWriter) co
     }
 }
 
+void MapPlane::add_to_snapshot(Map_Snapshot& snapshot) const noexcept
+{
+    try
+    {
+        snapshot._planes.emplace_back(Map_Snapshot::Plane {_id,
+                                                           _parametrization.get_parametrization(),
+                                                           _covariance,
+                                                           _boundaryPolygon.get_unprojected_boundary()});
+    }
+    catch (const std::exception& ex)
+    {
+        outputs::log_error("Caught exeption while copying the plane to a snapshot: " + std::string(ex.what()));
+    }
+}
+
+bool MapPlane::apply_correction(const pose_optimization::Bundle_Adjustment_Corrections& corrections) noexcept
+{
+    const auto displacementIterator = corrections._planeDisplacements.find(_id);
+    if (displacementIterator == corrections._planeDisplacements.cend())
+        return false;
+
+    // the boundary polygon is kept as is: the displacement should be small
+    const vector4& displacement = displacementIterator->second;
+    _parametrization = PlaneWorldCoordinates(_parametrization.get_normal() + displacement.head<3>(),
+                                             _parametrization.get_d() + displacement(3));
+    invalidate_projected_boundary();
+    return true;
+}
+
+bool MapPlane::apply_correction(const pose_optimization::Pose_Graph_Corrections& corrections) noexcept
+{
+    try
+    {
+        const WorldPolygon& correctedBoundary(_boundaryPolygon.to_camera_space(corrections._mapCorrection));
+
+        const PlaneWorldToCameraMatrix& planeCorrection =
+                utils::compute_plane_world_to_camera_matrix(corrections._mapCorrection);
+        _parametrization = PlaneWorldCoordinates(
+                _parametrization.to_camera_coordinates(planeCorrection).get_parametrization());
+        _covariance = planeCorrection * _covariance * planeCorrection.transpose();
+        _boundaryPolygon = correctedBoundary;
+        invalidate_projected_boundary();
+        return true;
+    }
+    catch (const std::exception& ex)
+    {
+        outputs::log_error("Caught exeption while correcting the plane: " + std::string(ex.what()));
+        return false;
+    }
+}
+
 bool MapPlane::update_with_match(const DetectedPlaneType& matchedFeature,
-                                 const matrix33& poseCovariance,
-                                 const CameraToWorldMatrix& cameraToWorld) noexcept
+                                 const utils::Frame_Transform_Context& frameTransform) noexcept
 {
+    const CameraToWorldMatrix& cameraToWorld = frameTransform._cameraToWorld;
+
     if (_matchIndexes.empty())
     {
         outputs::log_error("Tries to call the function update_with_match with no associated match");
@@ -215,7 +342,7 @@ bool MapPlane::update_with_match(const DetectedPlaneType& matchedFeature,
     try
     {
         const PlaneCameraCoordinates& matchedFeatureParams = matchedFeature.get_parametrization();
-        const PlaneCameraToWorldMatrix& planeCameraToWorld = utils::compute_plane_camera_to_world_matrix(cameraToWorld);
+        const PlaneCameraToWorldMatrix& planeCameraToWorld = frameTransform._planeCameraToWorld;
         const matrix44& planeParameterCovariance =
                 utils::compute_plane_covariance(matchedFeatureParams, matchedFeature.get_point_cloud_covariance());
 
@@ -229,7 +356,11 @@ bool MapPlane::update_with_match(const DetectedPlaneType& matchedFeature,
 
         // project to world coordinates
         const matrix44 worldCovariance = utils::get_world_plane_covariance(
-                matchedFeatureParams, cameraToWorld, planeCameraToWorld, planeParameterCovariance, poseCovariance);
+                matchedFeatureParams,
+                cameraToWorld,
+                planeCameraToWorld,
+                planeParameterCovariance,
+                frameTransform._poseCovariance);
         if (not utils::is_covariance_valid(worldCovariance))
         {
             outputs::log_error(
@@ -241,6 +372,7 @@ bool MapPlane::update_with_match(const DetectedPlaneType& matchedFeature,
                 matchedFeatureParams.to_world_coordinates(planeCameraToWorld);
 
         // update this plane with the other one's parameters
+        invalidate_projected_boundary();
         track(cameraToWorld, matchedFeature, projectedPlaneCoordinates, worldCovariance);
         return true;
     }
@@ -318,4 +450,122 @@ bool LocalMapPlane::is_lost() const noexcept
     return _failedTrackingCount >= parameters::mapping::planeUnmatchedCountToLoose;
 }
 
+/**
+ * localPlaneMap
+ */
+
+void localPlaneMap::write_features(Map_State_Writer& writer) const noexcept
+{
+    const auto write_planes = [&writer](const auto& map, const Map_State_Section section) {
+        writer.begin_section(section);
+        for (const auto& [id, mapPlane]: map)
+        {
+            const WorldPolygon& polygon = mapPlane._boundaryPolygon;
+            const std::vector<utils::Polygon::point_2d>& boundaryPoints = polygon.get_boundary_points();
+
+            SavedPlane savedPlane;
+            savedPlane._id = mapPlane._id;
+            Eigen::Map<vector4>(savedPlane._parametrization.data()) = mapPlane._parametrization.get_parametrization();
+            Eigen::Map<matrix44>(savedPlane._covariance.data()) = mapPlane._covariance;
+            Eigen::Map<vector3>(savedPlane._polygonCenter.data()) = polygon.get_center();
+            Eigen::Map<vector3>(savedPlane._polygonXAxis.data()) = polygon.get_x_axis();
+            Eigen::Map<vector3>(savedPlane._polygonYAxis.data()) = polygon.get_y_axis();
+            savedPlane._successivMatchedCount = static_cast<int64_t>(mapPlane._successivMatchedCount);
+            savedPlane._failedTrackingCount = static_cast<uint64_t>(mapPlane._failedTrackingCount);
+            savedPlane._boundaryPointCount = boundaryPoints.size();
+
+            writer.append_record(savedPlane);
+            for (const utils::Polygon::point_2d& point: boundaryPoints)
+            {
+                writer.append(point.x());
+                writer.append(point.y());
+            }
+        }
+    };
+    write_planes(get_local_map(), Map_State_Section::LocalPlanes);
+    write_planes(get_staged_map(), Map_State_Section::StagedPlanes);
+}
+
+template<typename RestorePlane>
+size_t localPlaneMap::read_saved_planes(const Map_State_Reader& reader,
+                                        const Map_State_Section section,
+                                        RestorePlane&& restorePlane) noexcept
+{
+    Map_State_Reader::Section_Cursor cursor;
+    if (not reader.get_section(section, cursor))
+        return 0;
+
+    size_t restoredCount = 0;
+    std::vector<utils::Polygon::point_2d> boundaryPoints;
+    const uint32_t recordCount = cursor.get_record_count();
+    for (uint32_t i = 0; i < recordCount; ++i)
+    {
+        SavedPlane savedPlane;
+        if (not cursor.read(savedPlane))
+        {
+            outputs::log_error("The map state file is truncated: some map planes are not restored");
+            break;
+        }
+        boundaryPoints.clear();
+        for (uint64_t pointIndex = 0; pointIndex < savedPlane._boundaryPointCount; ++pointIndex)
+        {
+            std::array<double, 2> point;
+            if (not cursor.read(point))
+            {
+                outputs::log_error("The map state file is truncated: some map planes are not restored");
+                return restoredCount;
+            }
+            boundaryPoints.emplace_back(point[0], point[1]);
+        }
+
+        try
+        {
+            const WorldPolygon polygon(
+                    utils::Polygon(boundaryPoints,
+                                   Eigen::Map<const vector3>(savedPlane._polygonXAxis.data()),
+                                   Eigen::Map<const vector3>(savedPlane._polygonYAxis.data()),
+                                   Eigen::Map<const vector3>(savedPlane._polygonCenter.data())));
+            restorePlane(savedPlane, polygon);
+            ++restoredCount;
+        }
+        catch (const std::exception& ex)
+        {
+            outputs::log_error("Could not restore a saved map plane: " + std::string(ex.what()));
+        }
+    }
+    return restoredCount;
+}
+
+size_t localPlaneMap::read_features(const Map_State_Reader& reader) noexcept
+{
+    const auto set_plane = [](const SavedPlane& savedPlane, const WorldPolygon& polygon, MapPlane& mapPlane) {
+        mapPlane._parametrization =
+                PlaneWorldCoordinates(vector4(Eigen::Map<const vector4>(savedPlane._parametrization.data())));
+        mapPlane._covariance = Eigen::Map<const matrix44>(savedPlane._covariance.data());
+        mapPlane._boundaryPolygon = polygon;
+        mapPlane.invalidate_projected_boundary();
+        mapPlane._successivMatchedCount = static_cast<int>(savedPlane._successivMatchedCount);
+        mapPlane._failedTrackingCount = static_cast<size_t>(savedPlane._failedTrackingCount);
+
+        if (not utils::is_covariance_valid(mapPlane._covariance))
+            throw std::invalid_argument("the saved plane covariance is invalid");
+        if (not utils::double_equal(mapPlane._parametrization.get_normal().norm(), 1.0))
+            throw std::invalid_argument("the saved plane has an invalid normal vector");
+    };
+
+    size_t restoredCount = read_saved_planes(
+            reader, Map_State_Section::LocalPlanes, [&](const SavedPlane& savedPlane, const WorldPolygon& polygon) {
+                LocalMapPlane mapPlane(savedPlane._id);
+                set_plane(savedPlane, polygon, mapPlane);
+                add_to_local_map(mapPlane);
+            });
+    restoredCount += read_saved_planes(
+            reader, Map_State_Section::StagedPlanes, [&](const SavedPlane& savedPlane, const WorldPolygon& polygon) {
+                StagedMapPlane stagedPlane(savedPlane._id);
+                set_plane(savedPlane, polygon, stagedPlane);
+                add_to_staged_map(stagedPlane);
+            });
+    return restoredCount;
+}
+
 } // namespace rgbd_slam::map_management
\ No newline at end of file
@@ -5,6 +5,9 @@
 #include "features/primitives/shape_primitives.hpp"
 #include "tracking/plane_with_tracking.hpp"
 #include "matches_containers.hpp"
+#include <array>
+#include <cstdint>
+#include <optional>
 
 namespace rgbd_slam::map_management {
 
@@ -25,10 +28,16 @@ struct PlaneOptimizationFeature : public matches_containers::IOptimizationFeatur
 
     double get_score() const noexcept override;
 
+    double get_quality() const noexcept override;
+
     bool is_inlier(const WorldToCameraMatrix& worldToCamera) const noexcept override;
 
     vectorxd get_distance(const WorldToCameraMatrix& worldToCamera) const noexcept override;
 
+    void add_to_blocks(pose_optimization::Match_Blocks& blocks, const size_t matchIndex) const noexcept override;
+
+    void add_to_bundle_adjustment(pose_optimization::Bundle_Adjustment_Keyframe& keyframe) const noexcept override;
+
     double get_alpha_reduction() const noexcept override;
 
     matches_containers::feat_ptr compute_random_variation() const noexcept override;
@@ -44,8 +53,8 @@ struct PlaneOptimizationFeature : public matches_containers::IOptimizationFeatur
 };
 
 using DetectedPlaneType = features::primitives::Plane;
-using DetectedPlaneObject = features::primitives::plane_container;
-using TrackedPlaneObject = void*; // TODO implement
+using DetectedPlaneObject = features::primitives::Indexed_Plane_Container;
+using TrackedPlaneObject = features::primitives::tracked_plane_container;
 
 /**
  * \brief Classic plane feature in map, all map plane should inherit this.
@@ -71,6 +80,10 @@ class MapPlane : public tracking::Plane, public IMapFeature<DetectedPlaneObject,
                                              const bool shouldAddToMatches = true,
                                              const bool useAdvancedSearch = false) const noexcept override;
 
+    [[nodiscard]] double get_match_score(const DetectedPlaneObject& detectedFeatures,
+                                         const WorldToCameraMatrix& worldToCamera,
+                                         const size_t matchIndex) const noexcept override;
+
     [[nodiscard]] bool add_to_tracked(const WorldToCameraMatrix& worldToCamera,
                                       TrackedPlaneObject& trackedFeatures,
                                       const uint dropChance = 1000) const noexcept override;
@@ -81,10 +94,22 @@ class MapPlane : public tracking::Plane, public IMapFeature<DetectedPlaneObject,
 
     [[nodiscard]] bool is_visible(const WorldToCameraMatrix& worldToCamMatrix) const noexcept override;
 
+    [[nodiscard]] bool get_spatial_position(vector3& position) const noexcept override;
+
+    void add_memory_usage(outputs::Frame_Metrics& metrics) const noexcept override;
+
     void write_to_file(std::shared_ptr<outputs::IMap_Writer> mapWriter) const noexcept override;
 
+    void add_to_snapshot(Map_Snapshot& snapshot) const noexcept override;
+
+    [[nodiscard]] bool apply_correction(
+            const pose_optimization::Bundle_Adjustment_Corrections& corrections) noexcept override;
+
+    [[nodiscard]] bool apply_correction(
+            const pose_optimization::Pose_Graph_Corrections& corrections) noexcept override;
+
     [[nodiscard]] bool compute_upgraded(const CameraToWorldMatrix& cameraToWorld,
-                                        UpgradedFeature_ptr& upgradeFeature) const noexcept override
+                                        No_Upgrade& upgradeFeature) noexcept override
     {
         std::ignore = cameraToWorld;
         std::ignore = upgradeFeature;
@@ -98,11 +123,39 @@ class MapPlane : public tracking::Plane, public IMapFeature<DetectedPlaneObject,
     }
 
     [[nodiscard]] bool update_with_match(const DetectedPlaneType& matchedFeature,
-                                         const matrix33& poseCovariance,
-                                         const CameraToWorldMatrix& cameraToWorld) noexcept override;
+                                         const utils::Frame_Transform_Context& frameTransform) noexcept override;
+
+    /**
+     * \brief Drop the cached projection of the boundary polygon. Must be called when the plane parameters or the
+     * boundary polygon change
+     */
+    void invalidate_projected_boundary() noexcept { _projectedBoundary.reset(); }
 
   protected:
     void update_no_match() noexcept override;
+
+    /**
+     * \brief Get the boundary polygon projected in camera space. The projection is computed once per worldToCamera
+     * and shared by the visibility test, the matching and the debug display
+     * \param[in] worldToCamera A matrix to convert from world to camera space
+     * \return The boundary polygon in camera space
+     */
+    [[nodiscard]] const CameraPolygon& get_projected_boundary_polygon(
+            const WorldToCameraMatrix& worldToCamera) const noexcept;
+
+  private:
+    /**
+     * \brief The boundary polygon projected with a given worldToCamera matrix
+     */
+    struct ProjectedBoundary
+    {
+        WorldToCameraMatrix worldToCamera;
+        CameraPolygon polygon;
+        std::optional<bool> isVisible;
+    };
+
+    // invalidated when the boundary polygon changes
+    mutable std::optional<ProjectedBoundary> _projectedBoundary;
 };
 
 /**
@@ -115,6 +168,9 @@ class StagedMapPlane : public MapPlane, public IStagedMapFeature<DetectedPlaneTy
                    const CameraToWorldMatrix& cameraToWorld,
                    const DetectedPlaneType& detectedFeature);
 
+    // constructor for the planes restored from a map state file: the plane parameters are set by the caller
+    explicit StagedMapPlane(const size_t id) : MapPlane(id) {}
+
     [[nodiscard]] bool should_remove_from_staged() const noexcept override;
 
     [[nodiscard]] bool should_add_to_local_map() const noexcept override;
@@ -124,6 +180,11 @@ class StagedMapPlane : public MapPlane, public IStagedMapFeature<DetectedPlaneTy
         (void)detectedPlane;
         return true;
     }
+
+    [[nodiscard]] double get_retention_score() const noexcept override
+    {
+        return static_cast<double>(_successivMatchedCount);
+    }
 };
 
 /**
@@ -134,6 +195,9 @@ class LocalMapPlane : public MapPlane, public ILocalMapFeature<StagedMapPlane>
   public:
     explicit LocalMapPlane(const StagedMapPlane& stagedPlane);
 
+    // constructor for the planes restored from a map state file: the plane parameters are set by the caller
+    explicit LocalMapPlane(const size_t id) : MapPlane(id) { set_color(); }
+
     [[nodiscard]] bool is_lost() const noexcept override;
 };
 
@@ -145,6 +209,15 @@ class localPlaneMap :
 
     std::string get_display_name() const override { return "Planes"; }
 
+    outputs::Memory_Consumer get_local_memory_consumer() const override
+    {
+        return outputs::Memory_Consumer::LocalPlanes;
+    }
+    outputs::Memory_Consumer get_staged_memory_consumer() const override
+    {
+        return outputs::Memory_Consumer::StagedPlanes;
+    }
+
     DetectedPlaneObject get_detected_feature(const DetectedFeatureContainer& features) const override
     {
         return features.detectedPlanes;
@@ -153,25 +226,42 @@ class localPlaneMap :
     std::shared_ptr<TrackedPlaneObject> get_tracked_features_container(
             const TrackedFeaturesContainer& tracked) const override
     {
-        std::ignore = tracked;
-        // no tracking for planes
-        return nullptr;
+        return tracked.trackedPlanes;
     }
 
     size_t minimum_features_for_opti() const override { return parameters::optimization::minimumPlanesForOptimization; }
 
   protected:
-    void add_upgraded_to_local_map(const UpgradedFeature_ptr upgradedfeature) override
+    void write_features(Map_State_Writer& writer) const noexcept override;
+
+    size_t read_features(const Map_State_Reader& reader) noexcept override;
+
+  private:
+    // a plane in a map state file, followed by the boundary points of its polygon
+    struct SavedPlane
     {
-        if (upgradedfeature->get_type() == get_feature_type())
-        {
-            outputs::log_error("Upgraded planes is not supported");
-        }
-        else
-        {
-            outputs::log_error("Cannot add this feature to the plane map");
-        }
-    }
+        uint64_t _id;
+        std::array<double, 4> _parametrization;
+        std::array<double, 16> _covariance;
+        std::array<double, 3> _polygonCenter;
+        std::array<double, 3> _polygonXAxis;
+        std::array<double, 3> _polygonYAxis;
+        int64_t _successivMatchedCount;
+        uint64_t _failedTrackingCount;
+        uint64_t _boundaryPointCount; // number of (x, y) boundary points that follow, in the polygon space
+    };
+
+    /**
+     * \brief Read the saved planes of a section of a map state file, and restore them
+     * \param[in] reader The map state file
+     * \param[in] section The plane section to read
+     * \param[in] restorePlane Called with each read plane, and its boundary polygon
+     * \return The number of restored planes
+     */
+    template<typename RestorePlane>
+    static size_t read_saved_planes(const Map_State_Reader& reader,
+                                    const Map_State_Section section,
+                                    RestorePlane&& restorePlane) noexcept;
 };
 
 } // namespace rgbd_slam::map_management
@@ -0,0 +1,39 @@
+#ifndef RGBDSLAM_MAPMANAGEMENT_MAPSNAPSHOT_HPP
+#define RGBDSLAM_MAPMANAGEMENT_MAPSNAPSHOT_HPP
+
+#include "types.hpp"
+
+#include <vector>
+
+namespace rgbd_slam::map_management {
+
+/**
+ * \brief An immutable copy of the local map features, published after each map update. It is shared between the
+ * threads without locks: a snapshot is never modified once published, a new one replaces it
+ */
+struct Map_Snapshot
+{
+    struct Point
+    {
+        size_t _id;
+        vector3 _coordinates; // world coordinates
+        matrix33 _covariance; // world covariance
+        bool _isInverseDepth; // true if this point has no depth measure yet: its covariance is large along its ray
+    };
+
+    struct Plane
+    {
+        size_t _id;
+        vector4 _parametrization;       // world normal and distance to the origin
+        matrix44 _covariance;           // covariance of the parametrization
+        std::vector<vector3> _boundary; // boundary polygon, in world coordinates
+    };
+
+    size_t _detectedFeatureId = 0; // id of the detected features of the update that published this snapshot
+    std::vector<Point> _points;
+    std::vector<Plane> _planes;
+};
+
+} // namespace rgbd_slam::map_management
+
+#endif
@@ -0,0 +1,149 @@
+#include "map_state_file.hpp"
+#include "logger.hpp"
+#include <fcntl.h>
+#include <format>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rgbd_slam::map_management {
+
+/**
+ * Map_State_Writer
+ */
+
+Map_State_Writer::Map_State_Writer(const std::string& filePath) :
+    _file(filePath, std::ios_base::trunc | std::ios_base::out | std::ios_base::binary)
+{
+    if (not _file.is_open())
+    {
+        outputs::log_error("Could not open the map state file " + filePath);
+        return;
+    }
+    _file.write(magic, sizeof(magic));
+    _file.write(reinterpret_cast<const char*>(&formatVersion), sizeof(formatVersion));
+}
+
+void Map_State_Writer::begin_section(const Map_State_Section section) noexcept
+{
+    end_section();
+    _isSectionStarted = true;
+    _section = section;
+}
+
+bool Map_State_Writer::close() noexcept
+{
+    end_section();
+    _file.flush();
+    return _file.good();
+}
+
+void Map_State_Writer::end_section() noexcept
+{
+    if (not _isSectionStarted)
+        return;
+
+    const uint32_t sectionType = static_cast<uint32_t>(_section);
+    const uint64_t payloadSize = _payload.size();
+    _file.write(reinterpret_cast<const char*>(&sectionType), sizeof(sectionType));
+    _file.write(reinterpret_cast<const char*>(&_recordCount), sizeof(_recordCount));
+    _file.write(reinterpret_cast<const char*>(&payloadSize), sizeof(payloadSize));
+    _file.write(reinterpret_cast<const char*>(_payload.data()), static_cast<std::streamsize>(payloadSize));
+
+    _isSectionStarted = false;
+    _recordCount = 0;
+    _payload.clear();
+}
+
+/**
+ * Map_State_Reader
+ */
+
+Map_State_Reader::Map_State_Reader(const std::string& filePath)
+{
+    const int fileDescriptor = ::open(filePath.c_str(), O_RDONLY);
+    if (fileDescriptor < 0)
+    {
+        outputs::log_error("Could not open the map state file " + filePath);
+        return;
+    }
+
+    struct stat fileStatus;
+    if (::fstat(fileDescriptor, &fileStatus) == 0 and fileStatus.st_size > 0)
+    {
+        _mappingSize = static_cast<size_t>(fileStatus.st_size);
+        void* mapping = ::mmap(nullptr, _mappingSize, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+        if (mapping != MAP_FAILED)
+            _mapping = static_cast<std::byte*>(mapping);
+    }
+    // the mapping stays valid after the file is closed
+    ::close(fileDescriptor);
+
+    if (_mapping == nullptr)
+    {
+        outputs::log_error("Could not map the map state file " + filePath);
+        return;
+    }
+    _isValid = index_sections();
+    if (not _isValid)
+        outputs::log_error("The file " + filePath + " is not a valid map state file");
+}
+
+Map_State_Reader::~Map_State_Reader()
+{
+    if (_mapping != nullptr)
+        ::munmap(_mapping, _mappingSize);
+}
+
+bool Map_State_Reader::get_section(const Map_State_Section section, Section_Cursor& cursor) const noexcept
+{
+    const auto sectionIterator = _sections.find(static_cast<uint32_t>(section));
+    if (sectionIterator == _sections.cend())
+        return false;
+
+    const Section& foundSection = sectionIterator->second;
+    cursor = Section_Cursor(foundSection._payload, foundSection._payloadSize, foundSection._recordCount);
+    return true;
+}
+
+bool Map_State_Reader::index_sections() noexcept
+{
+    Section_Cursor fileCursor(_mapping, _mappingSize, 0);
+
+    char fileMagic[sizeof(Map_State_Writer::magic)];
+    uint32_t fileVersion = 0;
+    if (not fileCursor.read(fileMagic) or
+        std::memcmp(fileMagic, Map_State_Writer::magic, sizeof(Map_State_Writer::magic)) != 0 or
+        not fileCursor.read(fileVersion))
+        return false;
+    if (fileVersion != Map_State_Writer::formatVersion)
+    {
+        outputs::log_error(std::format("Map state file version {} is not supported (expected {})",
+                                       fileVersion,
+                                       Map_State_Writer::formatVersion));
+        return false;
+    }
+
+    size_t offset = sizeof(Map_State_Writer::magic) + sizeof(uint32_t);
+    while (offset < _mappingSize)
+    {
+        uint32_t sectionType = 0;
+        uint32_t recordCount = 0;
+        uint64_t payloadSize = 0;
+        Section_Cursor headerCursor(_mapping + offset, _mappingSize - offset, 0);
+        if (not headerCursor.read(sectionType) or not headerCursor.read(recordCount) or
+            not headerCursor.read(payloadSize))
+            return false;
+
+        offset += sizeof(sectionType) + sizeof(recordCount) + sizeof(payloadSize);
+        // truncated file
+        if (payloadSize > _mappingSize - offset)
+            return false;
+
+        _sections[sectionType] = Section {_mapping + offset, static_cast<size_t>(payloadSize), recordCount};
+        offset += static_cast<size_t>(payloadSize);
+    }
+    return true;
+}
+
+} // namespace rgbd_slam::map_management
@@ -0,0 +1,216 @@
+#ifndef RGBDSLAM_MAPMANAGEMENT_MAPSTATEFILE_HPP
+#define RGBDSLAM_MAPMANAGEMENT_MAPSTATEFILE_HPP
+
+#include "outputs/logger.hpp"
+#include "types.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace rgbd_slam::map_management {
+
+/**
+ * \brief The sections of a map state file
+ */
+enum class Map_State_Section : uint32_t
+{
+    Header = 1,         // uint64 last allocated map feature id
+    Pose = 2,           // pose of the camera and motion model state
+    LocalPoints = 3,    // map points, with descriptors and covariances
+    StagedPoints = 4,   // same, for the staged map points
+    StoredPoints = 5,   // same, for the lost map points of the tile store
+    LocalPoints2D = 6,  // inverse depth map points, with descriptors and covariances
+    StagedPoints2D = 7, // same, for the staged inverse depth points
+    LocalPlanes = 8,    // map planes, with covariances and boundary polygons
+    StagedPlanes = 9    // same, for the staged map planes
+};
+
+/**
+ * \brief Write the whole map state to a binary file, to restart a later session from this map.
+ * The file is the 8 bytes magic "RGBDSTAT" and a uint32 format version, followed by the sections.
+ * A section is a uint32 section type, a uint32 record count, a uint64 payload size in bytes, and the payload. The
+ * records are the raw bytes of trivially copyable structures, in the endianness of the writer.
+ * Readers skip the sections they do not know, so new sections keep the older readers working
+ */
+class Map_State_Writer
+{
+  public:
+    static constexpr char magic[8] = {'R', 'G', 'B', 'D', 'S', 'T', 'A', 'T'};
+    static constexpr uint32_t formatVersion = 1;
+
+    /**
+     * \param[in] filePath The path of the map state file, created or truncated
+     */
+    explicit Map_State_Writer(const std::string& filePath);
+
+    /**
+     * \brief Start a new section, and end the previous one
+     * \param[in] section The type of this section
+     */
+    void begin_section(const Map_State_Section section) noexcept;
+
+    /**
+     * \brief Append a value to the payload of the current section
+     */
+    template<typename T> void append(const T& value) noexcept
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        const std::byte* bytes = reinterpret_cast<const std::byte*>(&value);
+        _payload.insert(_payload.end(), bytes, bytes + sizeof(T));
+    }
+
+    /**
+     * \brief Append a record to the current section: counts it in the section record count
+     */
+    template<typename T> void append_record(const T& record) noexcept
+    {
+        append(record);
+        ++_recordCount;
+    }
+
+    /**
+     * \brief End the current section, and flush the file
+     * \return true if the whole file was written
+     */
+    [[nodiscard]] bool close() noexcept;
+
+    [[nodiscard]] bool is_valid() const noexcept { return _file.good(); }
+
+  private:
+    void end_section() noexcept;
+
+    std::ofstream _file;
+    bool _isSectionStarted = false;
+    Map_State_Section _section = Map_State_Section::Header;
+    uint32_t _recordCount = 0;
+    std::vector<std::byte> _payload;
+};
+
+/**
+ * \brief Read a map state file written by Map_State_Writer. The file is memory mapped: the records are copied from
+ * the mapping, with no intermediate buffer
+ */
+class Map_State_Reader
+{
+  public:
+    /**
+     * \brief Sequential reader of the payload of a section
+     */
+    class Section_Cursor
+    {
+      public:
+        Section_Cursor() = default;
+        Section_Cursor(const std::byte* payload, const size_t payloadSize, const uint32_t recordCount) :
+            _position(payload),
+            _end(payload + payloadSize),
+            _recordCount(recordCount)
+        {
+        }
+
+        /**
+         * \brief Read the next value of the payload
+         * \return false if the payload is too short: the value is not read
+         */
+        template<typename T> [[nodiscard]] bool read(T& value) noexcept
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            if (_position == nullptr or static_cast<size_t>(_end - _position) < sizeof(T))
+                return false;
+            std::memcpy(&value, _position, sizeof(T));
+            _position += sizeof(T);
+            return true;
+        }
+
+        [[nodiscard]] uint32_t get_record_count() const noexcept { return _recordCount; }
+
+      private:
+        const std::byte* _position = nullptr;
+        const std::byte* _end = nullptr;
+        uint32_t _recordCount = 0;
+    };
+
+    /**
+     * \param[in] filePath The path of the map state file
+     */
+    explicit Map_State_Reader(const std::string& filePath);
+    ~Map_State_Reader();
+
+    Map_State_Reader(const Map_State_Reader&) = delete;
+    Map_State_Reader& operator=(const Map_State_Reader&) = delete;
+
+    /**
+     * \brief Get a reader of a section
+     * \param[in] section The section to read
+     * \param[out] cursor The reader of the section payload
+     * \return false if the file has no such section
+     */
+    [[nodiscard]] bool get_section(const Map_State_Section section, Section_Cursor& cursor) const noexcept;
+
+    /**
+     * \brief Read the fixed size records of a section, and restore them one by one
+     * \param[in] section The section to read. Nothing is restored if the file has no such section
+     * \param[in] restoreRecord Called with each read record. Can throw to reject this record
+     * \return The number of restored records
+     */
+    template<typename Record, typename RestoreRecord>
+    size_t read_records(const Map_State_Section section, RestoreRecord&& restoreRecord) const noexcept
+    {
+        Section_Cursor cursor;
+        if (not get_section(section, cursor))
+            return 0;
+
+        size_t restoredCount = 0;
+        const uint32_t recordCount = cursor.get_record_count();
+        for (uint32_t i = 0; i < recordCount; ++i)
+        {
+            Record record;
+            if (not cursor.read(record))
+            {
+                outputs::log_error("The map state file is truncated: some map features are not restored");
+                break;
+            }
+            try
+            {
+                restoreRecord(record);
+                ++restoredCount;
+            }
+            catch (const std::exception& ex)
+            {
+                outputs::log_error("Could not restore a saved map feature: " + std::string(ex.what()));
+            }
+        }
+        return restoredCount;
+    }
+
+    [[nodiscard]] bool is_valid() const noexcept { return _isValid; }
+
+  private:
+    /**
+     * \brief Check the file header, and index the sections of the file
+     * \return false if the file is not a valid map state file
+     */
+    [[nodiscard]] bool index_sections() noexcept;
+
+    struct Section
+    {
+        const std::byte* _payload;
+        size_t _payloadSize;
+        uint32_t _recordCount;
+    };
+
+    std::byte* _mapping = nullptr;
+    size_t _mappingSize = 0;
+    bool _isValid = false;
+    std::unordered_map<uint32_t, Section> _sections;
+};
+
+} // namespace rgbd_slam::map_management
+
+#endif
@@ -0,0 +1,160 @@
+#include "map_tile_store.hpp"
+#include "logger.hpp"
+#include "parameters.hpp"
+#include "spatial_hash.hpp"
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace rgbd_slam::map_management {
+
+Map_Tile_Store::Map_Tile_Store(const std::string& filePathPrefix, const size_t recordSize, const double tileSize) :
+    _filePath(filePathPrefix + ".XXXXXX"),
+    _recordSize(recordSize > 0 ? recordSize : 1),
+    _tileSize(tileSize > 0.0 ? tileSize : 1.0)
+{
+    // mkstemp replaces the X by a unique suffix: two stores (or two processes) never share a file
+    _fileDescriptor = ::mkstemp(_filePath.data());
+    if (_fileDescriptor < 0)
+    {
+        outputs::log_error("Could not open the map tile store file " + _filePath +
+                           ": the evicted features will be dropped");
+        return;
+    }
+    if (not resize(parameters::mapping::globalMap::initialRecordCapacity))
+        outputs::log_error("Could not map the map tile store file " + _filePath +
+                           ": the evicted features will be dropped");
+}
+
+Map_Tile_Store::~Map_Tile_Store()
+{
+    if (_mapping != nullptr)
+        ::munmap(_mapping, _slotCapacity * _recordSize);
+    if (_fileDescriptor >= 0)
+    {
+        ::close(_fileDescriptor);
+        ::unlink(_filePath.c_str());
+    }
+}
+
+bool Map_Tile_Store::store(const vector3& position, const void* record) noexcept
+{
+    size_t slot;
+    if (not allocate_slot(slot))
+        return false;
+
+    std::memcpy(get_record(slot), record, _recordSize);
+
+    vector3 center;
+    const uint64_t key = Spatial_Hash::get_voxel_key(position, _tileSize, center);
+    Tile& tile = _tiles.try_emplace(key, Tile {center, {}}).first->second;
+    tile._slots.emplace_back(slot);
+    return true;
+}
+
+size_t Map_Tile_Store::load_visible_tiles(const WorldToCameraMatrix& worldToCamera,
+                                          const double maximumDistance,
+                                          std::vector<std::byte>& records) noexcept
+{
+    records.clear();
+    if (_tiles.empty())
+        return 0;
+
+    // radius of the sphere bounding a tile
+    const double tileRadius = _tileSize * std::sqrt(3.0) / 2.0;
+
+    size_t loadedCount = 0;
+    const matrix33& rotation = worldToCamera.rotation();
+    const vector3& translation = worldToCamera.translation();
+    for (auto tileIterator = _tiles.begin(); tileIterator != _tiles.end();)
+    {
+        const vector3& cameraCenter = rotation * tileIterator->second._center + translation;
+        if (cameraCenter.norm() > maximumDistance + tileRadius or
+            not Spatial_Hash::is_in_camera_frustum(cameraCenter, tileRadius))
+        {
+            ++tileIterator;
+            continue;
+        }
+
+        const std::vector<size_t>& slots = tileIterator->second._slots;
+        const size_t offset = records.size();
+        records.resize(offset + slots.size() * _recordSize);
+        for (size_t i = 0; i < slots.size(); ++i)
+        {
+            std::memcpy(&records[offset + i * _recordSize], get_record(slots[i]), _recordSize);
+            _freeSlots.emplace_back(slots[i]);
+        }
+        loadedCount += slots.size();
+        tileIterator = _tiles.erase(tileIterator);
+    }
+    return loadedCount;
+}
+
+size_t Map_Tile_Store::get_all_records(std::vector<std::byte>& records) const noexcept
+{
+    records.clear();
+    records.reserve(size() * _recordSize);
+    for (const auto& [key, tile]: _tiles)
+    {
+        for (const size_t slot: tile._slots)
+        {
+            const std::byte* record = get_record(slot);
+            records.insert(records.end(), record, record + _recordSize);
+        }
+    }
+    return records.size() / _recordSize;
+}
+
+void Map_Tile_Store::clear() noexcept
+{
+    _tiles.clear();
+    _freeSlots.clear();
+    _usedSlotCount = 0;
+}
+
+bool Map_Tile_Store::allocate_slot(size_t& slot) noexcept
+{
+    if (_mapping == nullptr)
+        return false;
+
+    if (not _freeSlots.empty())
+    {
+        slot = _freeSlots.back();
+        _freeSlots.pop_back();
+        return true;
+    }
+
+    if (_usedSlotCount >= _slotCapacity and not resize(_slotCapacity * 2))
+    {
+        outputs::log_error(std::format("Could not grow the map tile store to {} records", _slotCapacity * 2));
+        return false;
+    }
+    slot = _usedSlotCount++;
+    return true;
+}
+
+bool Map_Tile_Store::resize(const size_t slotCapacity) noexcept
+{
+    assert(_fileDescriptor >= 0);
+    assert(slotCapacity > _slotCapacity);
+
+    const size_t newSize = slotCapacity * _recordSize;
+    if (::ftruncate(_fileDescriptor, static_cast<off_t>(newSize)) != 0)
+        return false;
+
+    void* newMapping = (_mapping == nullptr)
+                               ? ::mmap(nullptr, newSize, PROT_READ | PROT_WRITE, MAP_SHARED, _fileDescriptor, 0)
+                               : ::mremap(_mapping, _slotCapacity * _recordSize, newSize, MREMAP_MAYMOVE);
+    if (newMapping == MAP_FAILED)
+        return false;
+
+    _mapping = static_cast<std::byte*>(newMapping);
+    _slotCapacity = slotCapacity;
+    return true;
+}
+
+} // namespace rgbd_slam::map_management
@@ -0,0 +1,107 @@
+#ifndef RGBDSLAM_MAPMANAGEMENT_MAPTILESTORE_HPP
+#define RGBDSLAM_MAPMANAGEMENT_MAPTILESTORE_HPP
+
+#include "types.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace rgbd_slam::map_management {
+
+/**
+ * \brief Out of core storage of the map features evicted from the local map.
+ * The features are stored as fixed size records, in a memory mapped file: the system pages them out of memory when
+ * they are not used. The records are grouped by cubic tiles of the world, and a tile is paged back in when it becomes
+ * visible again. Only the index (the record slots of each tile) stays in memory.
+ * The file is removed when the store is destroyed.
+ */
+class Map_Tile_Store
+{
+  public:
+    /**
+     * \param[in] filePathPrefix The path prefix of the backing file. A unique suffix is added, so that each store
+     * uses its own file
+     * \param[in] recordSize The size of a record, in bytes (> 0)
+     * \param[in] tileSize The side length of a tile, in millimeters (> 0)
+     */
+    Map_Tile_Store(const std::string& filePathPrefix, const size_t recordSize, const double tileSize);
+    ~Map_Tile_Store();
+
+    Map_Tile_Store(const Map_Tile_Store&) = delete;
+    Map_Tile_Store& operator=(const Map_Tile_Store&) = delete;
+
+    /**
+     * \brief Store a record in the tile containing a world position
+     * \param[in] position The world position of the stored feature
+     * \param[in] record The recordSize bytes to store
+     * \return false if the file could not grow: the record is not stored
+     */
+    [[nodiscard]] bool store(const vector3& position, const void* record) noexcept;
+
+    /**
+     * \brief Remove the records of the visible tiles from the store
+     * \param[in] worldToCamera A matrix to convert from world to camera space
+     * \param[in] maximumDistance The distance from the camera after which the tiles are not loaded
+     * \param[out] records The loaded records, packed one after the other
+     * \return The number of loaded records
+     */
+    size_t load_visible_tiles(const WorldToCameraMatrix& worldToCamera,
+                              const double maximumDistance,
+                              std::vector<std::byte>& records) noexcept;
+
+    /**
+     * \brief Copy all the records of the store, without removing them
+     * \param[out] records The stored records, packed one after the other
+     * \return The number of copied records
+     */
+    size_t get_all_records(std::vector<std::byte>& records) const noexcept;
+
+    /**
+     * \brief Remove all records from the store. The file keeps its size
+     */
+    void clear() noexcept;
+
+    [[nodiscard]] bool is_valid() const noexcept { return _mapping != nullptr; }
+    [[nodiscard]] size_t size() const noexcept { return _usedSlotCount - _freeSlots.size(); }
+    [[nodiscard]] size_t get_tile_count() const noexcept { return _tiles.size(); }
+    [[nodiscard]] size_t get_record_size() const noexcept { return _recordSize; }
+
+  private:
+    struct Tile
+    {
+        vector3 _center;
+        std::vector<size_t> _slots;
+    };
+
+    /**
+     * \brief Reserve a record slot, growing the file if needed
+     * \return false if the file could not grow
+     */
+    [[nodiscard]] bool allocate_slot(size_t& slot) noexcept;
+
+    /**
+     * \brief Resize the file and its mapping to a new slot capacity
+     */
+    [[nodiscard]] bool resize(const size_t slotCapacity) noexcept;
+
+    [[nodiscard]] std::byte* get_record(const size_t slot) const noexcept { return _mapping + slot * _recordSize; }
+
+    std::string _filePath;
+    const size_t _recordSize;
+    const double _tileSize;
+
+    int _fileDescriptor = -1;
+    std::byte* _mapping = nullptr;
+    size_t _slotCapacity = 0;
+
+    size_t _usedSlotCount = 0;      // slots used at least once: the next new slot
+    std::vector<size_t> _freeSlots; // slots released by the loaded records
+    std::unordered_map<uint64_t, Tile> _tiles;
+};
+
+} // namespace rgbd_slam::map_management
+
+#endif
@@ -0,0 +1,161 @@
+#include "relocalization_index.hpp"
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+#include <random>
+
+namespace rgbd_slam::map_management {
+
+Relocalization_Index::Relocalization_Index()
+{
+    static constexpr uint descriptorBitCount = tracking::Descriptor_Pool::descriptorSize * 8;
+    static_assert(wordBitCount <= descriptorBitCount);
+
+    // a fixed seed: the vocabulary is the same for all runs
+    std::mt19937 randomEngine(5489u);
+    std::array<uint16_t, descriptorBitCount> bits;
+    std::iota(bits.begin(), bits.end(), 0);
+    for (auto& fileSampledBits: _sampledBits)
+    {
+        std::shuffle(bits.begin(), bits.end(), randomEngine);
+        std::copy_n(bits.cbegin(), wordBitCount, fileSampledBits.begin());
+    }
+}
+
+void Relocalization_Index::insert_or_update(const size_t id, const cv::Mat& descriptor) noexcept
+{
+    if (descriptor.empty())
+    {
+        remove(id);
+        return;
+    }
+
+    const word_array& words = compute_words(descriptor);
+    const auto& [featureIterator, isInserted] = _features.try_emplace(id, IndexedFeature {words, true});
+    if (not isInserted)
+    {
+        IndexedFeature& feature = featureIterator->second;
+        feature._isUpdated = true;
+        if (feature._words == words)
+            return;
+        remove_from_files(id, feature._words);
+        feature._words = words;
+    }
+
+    for (uint i = 0; i < fileCount; ++i)
+        _invertedFiles[i][words[i]].emplace_back(id);
+}
+
+void Relocalization_Index::remove(const size_t id) noexcept
+{
+    const auto featureIterator = _features.find(id);
+    if (featureIterator == _features.end())
+        return;
+    remove_from_files(id, featureIterator->second._words);
+    _features.erase(featureIterator);
+}
+
+size_t Relocalization_Index::remove_stale_features() noexcept
+{
+    size_t removedCount = 0;
+    for (auto featureIterator = _features.begin(); featureIterator != _features.end();)
+    {
+        IndexedFeature& feature = featureIterator->second;
+        if (feature._isUpdated)
+        {
+            feature._isUpdated = false;
+            ++featureIterator;
+            continue;
+        }
+        remove_from_files(featureIterator->first, feature._words);
+        featureIterator = _features.erase(featureIterator);
+        ++removedCount;
+    }
+    return removedCount;
+}
+
+void Relocalization_Index::clear() noexcept
+{
+    for (auto& invertedFile: _invertedFiles)
+        invertedFile.clear();
+    _features.clear();
+}
+
+void Relocalization_Index::query(const cv::Mat& descriptor, std::vector<size_t>& candidates) noexcept
+{
+    candidates.clear();
+    if (descriptor.empty())
+        return;
+
+    // gather the features of the descriptor words, then count the files in which they share a word
+    const word_array& words = compute_words(descriptor);
+    for (uint i = 0; i < fileCount; ++i)
+    {
+        const auto& invertedFile = _invertedFiles[i];
+        if (const auto postingIterator = invertedFile.find(words[i]); postingIterator != invertedFile.cend())
+            candidates.insert(candidates.end(), postingIterator->second.cbegin(), postingIterator->second.cend());
+    }
+    std::ranges::sort(candidates);
+
+    _votes.clear();
+    for (auto candidateIterator = candidates.cbegin(); candidateIterator != candidates.cend();)
+    {
+        const auto nextIterator = std::upper_bound(candidateIterator, candidates.cend(), *candidateIterator);
+        _votes.emplace_back(static_cast<uint>(nextIterator - candidateIterator), *candidateIterator);
+        candidateIterator = nextIterator;
+    }
+
+    // most shared words first, then by id to stay deterministic
+    const size_t candidateCount =
+            std::min(_votes.size(), parameters::matching::relocalization::maximumCandidatesPerQuery);
+    std::partial_sort(_votes.begin(),
+                      _votes.begin() + static_cast<std::ptrdiff_t>(candidateCount),
+                      _votes.end(),
+                      [](const auto& a, const auto& b) {
+                          return a.first > b.first or (a.first == b.first and a.second < b.second);
+                      });
+
+    candidates.resize(candidateCount);
+    for (size_t i = 0; i < candidateCount; ++i)
+        candidates[i] = _votes[i].second;
+}
+
+Relocalization_Index::word_array Relocalization_Index::compute_words(const cv::Mat& descriptor) const noexcept
+{
+    assert(descriptor.total() * descriptor.elemSize() == tracking::Descriptor_Pool::descriptorSize);
+    const uchar* bytes = descriptor.ptr<uchar>(0);
+
+    word_array words;
+    for (uint i = 0; i < fileCount; ++i)
+    {
+        uint32_t word = 0;
+        for (const uint16_t bit: _sampledBits[i])
+            word = (word << 1) | ((bytes[bit >> 3] >> (bit & 7)) & 1u);
+        words[i] = word;
+    }
+    return words;
+}
+
+void Relocalization_Index::remove_from_files(const size_t id, const word_array& words) noexcept
+{
+    for (uint i = 0; i < fileCount; ++i)
+    {
+        auto& invertedFile = _invertedFiles[i];
+        const auto postingIterator = invertedFile.find(words[i]);
+        assert(postingIterator != invertedFile.end());
+        if (postingIterator == invertedFile.end())
+            continue;
+
+        // the order of the ids in a posting list is not relevant
+        std::vector<size_t>& ids = postingIterator->second;
+        if (const auto idIterator = std::ranges::find(ids, id); idIterator != ids.end())
+        {
+            *idIterator = ids.back();
+            ids.pop_back();
+        }
+        if (ids.empty())
+            invertedFile.erase(postingIterator);
+    }
+}
+
+} // namespace rgbd_slam::map_management
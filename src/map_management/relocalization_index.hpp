@@ -0,0 +1,92 @@
+#ifndef RGBDSLAM_MAPMANAGEMENT_RELOCALIZATIONINDEX_HPP
+#define RGBDSLAM_MAPMANAGEMENT_RELOCALIZATIONINDEX_HPP
+
+#include "parameters.hpp"
+#include "tracking/descriptor_pool.hpp"
+
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace rgbd_slam::map_management {
+
+/**
+ * \brief Inverted file index of the map features binary descriptors, to match features with no pose prior.
+ * Each inverted file has its own visual word per descriptor, made of a fixed sample of the descriptor bits: close
+ * descriptors share a word in at least one file with a high probability. The vocabulary needs no training and the
+ * index is updated incrementally, a query only visits the features sharing a word with the queried descriptor.
+ */
+class Relocalization_Index
+{
+  public:
+    static constexpr uint fileCount = parameters::matching::relocalization::invertedFileCount;
+    static constexpr uint wordBitCount = parameters::matching::relocalization::wordBitCount;
+
+    Relocalization_Index();
+
+    /**
+     * \brief Index a feature descriptor, or update it. Does nothing if the words of this feature did not change.
+     * \param[in] id The map id of this feature
+     * \param[in] descriptor A descriptor of Descriptor_Pool::descriptorSize bytes. Empty descriptors are not indexed
+     */
+    void insert_or_update(const size_t id, const cv::Mat& descriptor) noexcept;
+
+    /**
+     * \brief Remove a feature from the index. Does nothing if it is not indexed
+     * \param[in] id The map id of this feature
+     */
+    void remove(const size_t id) noexcept;
+
+    /**
+     * \brief Remove the features that were not inserted or updated since the last call
+     * \return The number of removed features
+     */
+    size_t remove_stale_features() noexcept;
+
+    /**
+     * \brief Remove all features from the index
+     */
+    void clear() noexcept;
+
+    /**
+     * \brief Find the features that can match a descriptor
+     * \param[in] descriptor A descriptor of Descriptor_Pool::descriptorSize bytes
+     * \param[out] candidates The ids of the features sharing a word with this descriptor, by decreasing shared word
+     * count. At most maximumCandidatesPerQuery ids
+     */
+    void query(const cv::Mat& descriptor, std::vector<size_t>& candidates) noexcept;
+
+    [[nodiscard]] size_t size() const noexcept { return _features.size(); }
+
+  private:
+    using word_array = std::array<uint32_t, fileCount>;
+
+    struct IndexedFeature
+    {
+        word_array _words;
+        bool _isUpdated;
+    };
+
+    /**
+     * \brief Compute the word of a descriptor in each inverted file
+     */
+    [[nodiscard]] word_array compute_words(const cv::Mat& descriptor) const noexcept;
+
+    /**
+     * \brief Remove a feature from the inverted files
+     */
+    void remove_from_files(const size_t id, const word_array& words) noexcept;
+
+    // the descriptor bits sampled by the words of each inverted file
+    std::array<std::array<uint16_t, wordBitCount>, fileCount> _sampledBits;
+    // ids of the features, by word, in each inverted file
+    std::array<std::unordered_map<uint32_t, std::vector<size_t>>, fileCount> _invertedFiles;
+    std::unordered_map<size_t, IndexedFeature> _features;
+    std::vector<std::pair<uint, size_t>> _votes; // buffer of the queries: shared word count and id
+};
+
+} // namespace rgbd_slam::map_management
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef RGBDSLAM_MAPMANAGEMENT_SLOTMAP_HPP
+#define RGBDSLAM_MAPMANAGEMENT_SLOTMAP_HPP
+
+#include "outputs/frame_metrics.hpp"
+#include <cstddef>
+#include <iterator>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace rgbd_slam::map_management {
+
+/**
+ * \brief An associative container of map features by id, with the features stored contiguously.
+ * The (id, feature) pairs are kept in a dense vector, and a small hash table stores the position of each id in it.
+ * Erasing moves the last element in the freed position: it is O(1), and the iterator returned by erase points to the
+ * next element to visit, so the erase while iterating loops visit each element once.
+ * The elements move when an element is erased or inserted: only the ids are stable, iterators and references are
+ * invalidated by insertions and erasures.
+ * \tparam T The stored type. Must be move constructible and move assignable
+ */
+template<class T> class Slot_Map
+{
+  public:
+    using value_type = std::pair<size_t, T>; // the id (must not be modified) and the stored element
+    using iterator = typename std::vector<value_type>::iterator;
+    using const_iterator = typename std::vector<value_type>::const_iterator;
+
+    [[nodiscard]] iterator begin() noexcept { return _values.begin(); }
+    [[nodiscard]] iterator end() noexcept { return _values.end(); }
+    [[nodiscard]] const_iterator begin() const noexcept { return _values.begin(); }
+    [[nodiscard]] const_iterator end() const noexcept { return _values.end(); }
+    [[nodiscard]] const_iterator cbegin() const noexcept { return _values.cbegin(); }
+    [[nodiscard]] const_iterator cend() const noexcept { return _values.cend(); }
+
+    [[nodiscard]] size_t size() const noexcept { return _values.size(); }
+    [[nodiscard]] bool empty() const noexcept { return _values.empty(); }
+
+    void clear() noexcept
+    {
+        _values.clear();
+        _indexes.clear();
+    }
+
+    void reserve(const size_t capacity)
+    {
+        _values.reserve(capacity);
+        _indexes.reserve(capacity);
+    }
+
+    /**
+     * \brief Estimate the bytes allocated by the storage and the id table. Does not include the memory allocated by
+     * the stored elements
+     */
+    [[nodiscard]] size_t get_allocated_bytes() const noexcept
+    {
+        return outputs::get_allocated_bytes(_values) + outputs::get_allocated_bytes(_indexes);
+    }
+
+    [[nodiscard]] bool contains(const size_t id) const noexcept { return _indexes.contains(id); }
+
+    [[nodiscard]] iterator find(const size_t id) noexcept
+    {
+        const auto indexIterator = _indexes.find(id);
+        return indexIterator == _indexes.cend() ? end() : begin() + static_cast<std::ptrdiff_t>(indexIterator->second);
+    }
+
+    [[nodiscard]] const_iterator find(const size_t id) const noexcept
+    {
+        const auto indexIterator = _indexes.find(id);
+        return indexIterator == _indexes.cend() ? end() : begin() + static_cast<std::ptrdiff_t>(indexIterator->second);
+    }
+
+    /**
+     * \brief Access the element with the given id
+     * \throw std::out_of_range if no element has this id
+     */
+    [[nodiscard]] T& at(const size_t id) { return _values[get_index(id)].second; }
+    [[nodiscard]] const T& at(const size_t id) const { return _values[get_index(id)].second; }
+
+    /**
+     * \brief Construct a new element at the end of the storage, if no element has this id
+     * \param[in] id The id of the new element
+     * \param[in] args The arguments of the element constructor
+     * \return The iterator to the element with this id, and true if it was inserted
+     */
+    template<class... Args> std::pair<iterator, bool> emplace(const size_t id, Args&&... args)
+    {
+        const auto& [indexIterator, isInserted] = _indexes.try_emplace(id, _values.size());
+        if (not isInserted)
+            return {begin() + static_cast<std::ptrdiff_t>(indexIterator->second), false};
+
+        try
+        {
+            _values.emplace_back(std::piecewise_construct,
+                                 std::forward_as_tuple(id),
+                                 std::forward_as_tuple(std::forward<Args>(args)...));
+        }
+        catch (...)
+        {
+            _indexes.erase(id);
+            throw;
+        }
+        return {std::prev(end()), true};
+    }
+
+    /**
+     * \brief Erase an element, by moving the last element at its position
+     * \param[in] position An iterator to the element to erase
+     * \return An iterator to the same position: the next element to visit, or end()
+     */
+    iterator erase(const_iterator position) noexcept
+    {
+        const auto index = position - cbegin();
+        const iterator erased = begin() + index;
+        _indexes.erase(erased->first);
+
+        if (std::next(erased) != end())
+        {
+            *erased = std::move(_values.back());
+            _indexes[erased->first] = static_cast<size_t>(index);
+        }
+        _values.pop_back();
+        return begin() + index;
+    }
+
+    /**
+     * \brief Erase the element with the given id, if it exists
+     * \return The number of erased elements (0 or 1)
+     */
+    size_t erase(const size_t id) noexcept
+    {
+        const const_iterator position = std::as_const(*this).find(id);
+        if (position == cend())
+            return 0;
+        erase(position);
+        return 1;
+    }
+
+  private:
+    [[nodiscard]] size_t get_index(const size_t id) const
+    {
+        const auto indexIterator = _indexes.find(id);
+        if (indexIterator == _indexes.cend())
+            throw std::out_of_range("Slot_Map::at: no element with this id");
+        return indexIterator->second;
+    }
+
+    std::vector<value_type> _values;
+    std::unordered_map<size_t, size_t> _indexes; // position of each id in _values
+};
+
+} // namespace rgbd_slam::map_management
+
+#endif
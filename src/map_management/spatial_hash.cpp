@@ -0,0 +1,153 @@
+#include "spatial_hash.hpp"
+#include "outputs/frame_metrics.hpp"
+#include "parameters.hpp"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+
+namespace rgbd_slam::map_management {
+
+Spatial_Hash::Spatial_Hash(const double voxelSize) : _voxelSize(voxelSize > 0.0 ? voxelSize : 1.0) {}
+
+void Spatial_Hash::insert_or_update(const size_t id, const vector3& position) noexcept
+{
+    vector3 center;
+    const uint64_t key = get_voxel_key(position, _voxelSize, center);
+
+    const auto featureIterator = _featureVoxels.find(id);
+    if (featureIterator != _featureVoxels.end())
+    {
+        // still in the same voxel
+        if (featureIterator->second == key)
+            return;
+        remove_from_voxel(id, featureIterator->second);
+        featureIterator->second = key;
+    }
+    else
+    {
+        _unboundedFeatures.erase(id);
+        _featureVoxels.emplace(id, key);
+    }
+
+    Voxel& voxel = _voxels.try_emplace(key, Voxel {center, {}}).first->second;
+    voxel._ids.emplace_back(id);
+}
+
+void Spatial_Hash::insert_unbounded(const size_t id) noexcept
+{
+    const auto featureIterator = _featureVoxels.find(id);
+    if (featureIterator != _featureVoxels.end())
+    {
+        remove_from_voxel(id, featureIterator->second);
+        _featureVoxels.erase(featureIterator);
+    }
+    _unboundedFeatures.emplace(id);
+}
+
+void Spatial_Hash::remove(const size_t id) noexcept
+{
+    const auto featureIterator = _featureVoxels.find(id);
+    if (featureIterator != _featureVoxels.end())
+    {
+        remove_from_voxel(id, featureIterator->second);
+        _featureVoxels.erase(featureIterator);
+        return;
+    }
+    _unboundedFeatures.erase(id);
+}
+
+void Spatial_Hash::clear() noexcept
+{
+    _voxels.clear();
+    _featureVoxels.clear();
+    _unboundedFeatures.clear();
+}
+
+size_t Spatial_Hash::get_allocated_bytes() const noexcept
+{
+    size_t allocatedBytes = outputs::get_allocated_bytes(_voxels) + outputs::get_allocated_bytes(_featureVoxels) +
+                            outputs::get_allocated_bytes(_unboundedFeatures);
+    for (const auto& [key, voxel]: _voxels)
+        allocatedBytes += outputs::get_allocated_bytes(voxel._ids);
+    return allocatedBytes;
+}
+
+void Spatial_Hash::get_visible_candidates(const WorldToCameraMatrix& worldToCamera,
+                                          std::vector<size_t>& candidates) const noexcept
+{
+    // radius of the sphere bounding a voxel
+    const double voxelRadius = _voxelSize * std::sqrt(3.0) / 2.0;
+
+    candidates.clear();
+    candidates.reserve(size());
+
+    const matrix33& rotation = worldToCamera.rotation();
+    const vector3& translation = worldToCamera.translation();
+    for (const auto& [key, voxel]: _voxels)
+    {
+        if (is_in_camera_frustum(rotation * voxel._center + translation, voxelRadius))
+            candidates.insert(candidates.end(), voxel._ids.cbegin(), voxel._ids.cend());
+    }
+
+    candidates.insert(candidates.end(), _unboundedFeatures.cbegin(), _unboundedFeatures.cend());
+}
+
+uint64_t Spatial_Hash::get_voxel_key(const vector3& position, const double voxelSize, vector3& center) noexcept
+{
+    // 21 bits per axis: about a million voxels in each direction
+    static constexpr int64_t axisMask = (1 << 21) - 1;
+
+    const Eigen::Vector3d& voxelCoordinates = (position / voxelSize).array().floor();
+    center = (voxelCoordinates.array() + 0.5) * voxelSize;
+
+    const Eigen::Matrix<int64_t, 3, 1>& indexes = voxelCoordinates.cast<int64_t>();
+    return (static_cast<uint64_t>(indexes.x() & axisMask) << 42) |
+           (static_cast<uint64_t>(indexes.y() & axisMask) << 21) | static_cast<uint64_t>(indexes.z() & axisMask);
+}
+
+bool Spatial_Hash::is_in_camera_frustum(const vector3& cameraCenter, const double radius) noexcept
+{
+    // the side planes of the camera frustum, in camera space, with normals pointing inside
+    const static std::array<vector3, 4> frustumNormals = []() {
+        const vector2& focal = Parameters::get_camera_1_focal();
+        const vector2& center = Parameters::get_camera_1_center();
+        const vector2& imageSize = Parameters::get_camera_1_image_size().cast<double>();
+        return std::array<vector3, 4> {vector3(focal.x(), 0.0, center.x()).normalized(),
+                                       vector3(-focal.x(), 0.0, imageSize.x() - center.x()).normalized(),
+                                       vector3(0.0, focal.y(), center.y()).normalized(),
+                                       vector3(0.0, -focal.y(), imageSize.y() - center.y()).normalized()};
+    }();
+
+    // behind the camera
+    if (cameraCenter.z() < -radius)
+        return false;
+
+    return std::ranges::all_of(frustumNormals, [&cameraCenter, radius](const vector3& normal) {
+        return normal.dot(cameraCenter) >= -radius;
+    });
+}
+
+void Spatial_Hash::remove_from_voxel(const size_t id, const uint64_t key) noexcept
+{
+    const auto voxelIterator = _voxels.find(key);
+    assert(voxelIterator != _voxels.end());
+    if (voxelIterator == _voxels.end())
+        return;
+
+    std::vector<size_t>& ids = voxelIterator->second._ids;
+    for (size_t i = 0; i < ids.size(); ++i)
+    {
+        if (ids[i] == id)
+        {
+            // the order of the ids in a voxel is not relevant
+            ids[i] = ids.back();
+            ids.pop_back();
+            break;
+        }
+    }
+    if (ids.empty())
+        _voxels.erase(voxelIterator);
+}
+
+} // namespace rgbd_slam::map_management
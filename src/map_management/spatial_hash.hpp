@@ -0,0 +1,106 @@
+#ifndef RGBDSLAM_MAPMANAGEMENT_SPATIALHASH_HPP
+#define RGBDSLAM_MAPMANAGEMENT_SPATIALHASH_HPP
+
+#include "types.hpp"
+
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace rgbd_slam::map_management {
+
+/**
+ * \brief Voxel hashed index of the map features positions, for visibility culling.
+ * The features are stored in the cubic voxel containing their position. A frustum query only tests the occupied
+ * voxels against the camera frustum, and returns the features of the voxels that intersect it: its cost scales with
+ * the occupied voxels, not with the feature count.
+ * The features without a bounded position (infinite planes, inverse depth points) are always returned
+ */
+class Spatial_Hash
+{
+  public:
+    /**
+     * \param[in] voxelSize The side length of a voxel, in millimeters (> 0)
+     */
+    explicit Spatial_Hash(const double voxelSize);
+
+    /**
+     * \brief Add a feature to the voxel containing its position, or move it there
+     * \param[in] id The map id of this feature
+     * \param[in] position The world position of this feature
+     */
+    void insert_or_update(const size_t id, const vector3& position) noexcept;
+
+    /**
+     * \brief Add a feature with no bounded position: it is a candidate of all the frustum queries
+     * \param[in] id The map id of this feature
+     */
+    void insert_unbounded(const size_t id) noexcept;
+
+    /**
+     * \brief Remove a feature from the index. Does nothing if it is not indexed
+     * \param[in] id The map id of this feature
+     */
+    void remove(const size_t id) noexcept;
+
+    /**
+     * \brief Remove all features from the index
+     */
+    void clear() noexcept;
+
+    /**
+     * \brief Find the features that can be visible from a camera pose
+     * \param[in] worldToCamera A matrix to convert from world to camera space
+     * \param[out] candidates The ids of the features in the voxels that intersect the camera frustum, then of the
+     * unbounded features
+     */
+    void get_visible_candidates(const WorldToCameraMatrix& worldToCamera,
+                                std::vector<size_t>& candidates) const noexcept;
+
+    [[nodiscard]] size_t size() const noexcept { return _featureVoxels.size() + _unboundedFeatures.size(); }
+    [[nodiscard]] size_t get_voxel_count() const noexcept { return _voxels.size(); }
+
+    /**
+     * \brief Estimate the bytes allocated by the voxels and the feature tables
+     */
+    [[nodiscard]] size_t get_allocated_bytes() const noexcept;
+
+    /**
+     * \brief Compute the hash key of the voxel containing a position
+     * \param[in] position A world position
+     * \param[in] voxelSize The side length of a voxel
+     * \param[out] center The center of the voxel containing this position
+     */
+    [[nodiscard]] static uint64_t get_voxel_key(const vector3& position,
+                                                const double voxelSize,
+                                                vector3& center) noexcept;
+
+    /**
+     * \brief Check if a sphere intersects the camera frustum
+     * \param[in] cameraCenter The center of the sphere, in camera space
+     * \param[in] radius The radius of the sphere
+     */
+    [[nodiscard]] static bool is_in_camera_frustum(const vector3& cameraCenter, const double radius) noexcept;
+
+  private:
+    struct Voxel
+    {
+        vector3 _center;
+        std::vector<size_t> _ids;
+    };
+
+    /**
+     * \brief Remove a feature from its voxel, and the voxel if it becomes empty
+     */
+    void remove_from_voxel(const size_t id, const uint64_t key) noexcept;
+
+    const double _voxelSize;
+    std::unordered_map<uint64_t, Voxel> _voxels;
+    std::unordered_map<size_t, uint64_t> _featureVoxels; // voxel key of each indexed feature
+    std::unordered_set<size_t> _unboundedFeatures;
+};
+
+} // namespace rgbd_slam::map_management
+
+#endif
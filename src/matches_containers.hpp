@@ -2,13 +2,16 @@
 #define RGBDSLAM_UTILS_MATCHESCONTAINERS_HPP
 
 #include "types.hpp"
+#include <atomic>
 #include <list>
 #include <memory>
-#include <unordered_set>
 
 #include "features/keypoints/keypoint_handler.hpp"
 #include "features/primitives/shape_primitives.hpp"
 #include "features/lines/line_detection.hpp"
+#include "tracking/descriptor_pool.hpp"
+#include "utils/index_set.hpp"
+#include "utils/object_pool.hpp"
 
 namespace rgbd_slam {
 
@@ -38,7 +41,7 @@ inline std::string to_string(const FeatureType feat)
 namespace map_management {
 
 // type for matched index
-typedef std::unordered_set<size_t> matchIndexSet;
+typedef utils::Index_Set matchIndexSet;
 
 /**
  * \brief Contains sets of detected features
@@ -47,21 +50,25 @@ struct DetectedFeatureContainer
 {
     DetectedFeatureContainer(const features::keypoints::Keypoint_Handler& newKeypointObject,
                              const features::lines::line_container& newdDetectedLines,
+                             const features::lines::segment_container& newDetectedSegments,
                              const features::primitives::plane_container& newDetectedPlanes) :
         keypointObject(newKeypointObject),
         detectedLines(newdDetectedLines),
+        detectedSegments(newDetectedSegments),
         detectedPlanes(newDetectedPlanes),
-        id(++idAllocator)
+        id(idAllocator.fetch_add(1) + 1)
     {
     }
 
     const features::keypoints::Keypoint_Handler keypointObject;
     const features::lines::line_container detectedLines;
-    const features::primitives::plane_container detectedPlanes;
+    const features::lines::segment_container detectedSegments; // detected lines with depth, in camera space
+    const features::primitives::Indexed_Plane_Container detectedPlanes; // indexed once for all the map planes
     const size_t id; // unique id to differenciate from other detections
 
   private:
-    inline static size_t idAllocator = 0;
+    // shared by the detections of all the SLAM instances, that can run on different threads
+    inline static std::atomic<size_t> idAllocator = 0;
 };
 
 /**
@@ -69,48 +76,59 @@ struct DetectedFeatureContainer
  */
 struct TrackedFeaturesContainer
 {
-    TrackedFeaturesContainer() : trackedPoints(std::make_shared<features::keypoints::KeypointsWithIdStruct>()) {}
+    TrackedFeaturesContainer() :
+        trackedPoints(std::make_shared<features::keypoints::KeypointsWithIdStruct>()),
+        trackedPlanes(std::make_shared<features::primitives::tracked_plane_container>())
+    {
+    }
+
+    /**
+     * \brief Empty the tracked features, but keep the memory of the containers
+     */
+    void clear() noexcept
+    {
+        trackedPoints->clear();
+        trackedPlanes->clear();
+    }
 
     std::shared_ptr<features::keypoints::KeypointsWithIdStruct> trackedPoints;
+    std::shared_ptr<features::primitives::tracked_plane_container> trackedPlanes;
 };
 
 /**
- * \brief Base class for upgraded features
+ * \brief Upgrade type of the map features that are never upgraded
  */
-struct IUpgradedFeature
+struct No_Upgrade
 {
-    IUpgradedFeature(const matchIndexSet& matchIndexes) : _matchIndexes(matchIndexes) {}
-    virtual ~IUpgradedFeature() = default;
-
-    virtual FeatureType get_type() const = 0;
-
-    const matchIndexSet _matchIndexes;
 };
 
-using UpgradedFeature_ptr = std::shared_ptr<IUpgradedFeature>;
-
-struct UpgradedPoint2D : IUpgradedFeature
+/**
+ * \brief An inverse depth point upgraded to a point. Move only: it is moved from the map that upgraded it to the
+ * storage of the point map
+ */
+struct UpgradedPoint2D
 {
-    UpgradedPoint2D(const WorldCoordinate& coordinates,
-                    const WorldCoordinateCovariance& covariance,
-                    const cv::Mat& descriptor,
-                    const matchIndexSet& matchIndexes) :
-        IUpgradedFeature(matchIndexes),
-        _coordinates(coordinates),
-        _covariance(covariance),
-        _descriptor(descriptor)
-    {
-    }
-
-    FeatureType get_type() const override { return FeatureType::Point; }
+    UpgradedPoint2D() = default;
+    UpgradedPoint2D(UpgradedPoint2D&& other) noexcept = default;
+    UpgradedPoint2D& operator=(UpgradedPoint2D&& other) noexcept = default;
+    UpgradedPoint2D(const UpgradedPoint2D& other) = delete;
+    UpgradedPoint2D& operator=(const UpgradedPoint2D& other) = delete;
 
+    size_t _sourceId = 0; // id of the map feature that was upgraded
     WorldCoordinate _coordinates;
     WorldCoordinateCovariance _covariance;
-    cv::Mat _descriptor;
+    tracking::Pooled_Descriptor _descriptor;
+    matchIndexSet _matchIndexes;
+    size_t _upgradedId = 0; // id of the new map feature, set by the map that adds it (0 is an invalid id)
 };
 
 } // namespace map_management
 
+namespace pose_optimization {
+class Match_Blocks;
+struct Bundle_Adjustment_Keyframe;
+} // namespace pose_optimization
+
 namespace matches_containers {
 
 /**
@@ -119,6 +137,14 @@ namespace matches_containers {
 struct IOptimizationFeature;
 using feat_ptr = std::shared_ptr<IOptimizationFeature>;
 
+/**
+ * \brief Create an optimization feature, and its reference count, in a single block of a fixed size pool
+ */
+template<typename Feature, typename... Args> [[nodiscard]] feat_ptr make_feature(Args&&... args)
+{
+    return std::allocate_shared<Feature>(utils::Pool_Allocator<Feature>(), std::forward<Args>(args)...);
+}
+
 struct IOptimizationFeature
 {
     IOptimizationFeature(const size_t idInMap, const size_t detectedFeatureId) :
@@ -140,6 +166,12 @@ struct IOptimizationFeature
      */
     virtual double get_score() const noexcept = 0;
 
+    /**
+     * \brief Return the confidence in this match, in range ]0.0; 1.0].
+     * The RANSAC progressive sampling draws the matches with the highest quality first
+     */
+    virtual double get_quality() const noexcept = 0;
+
     /**
      * \brief check if this feature can be considered an inlier for the given transformation
      */
@@ -151,6 +183,20 @@ struct IOptimizationFeature
      */
     virtual vectorxd get_distance(const WorldToCameraMatrix& worldToCamera) const noexcept = 0;
 
+    /**
+     * \brief Add this feature to the block of its type, for the type batched residual evaluations
+     * \param[in, out] blocks The typed blocks of the optimization
+     * \param[in] matchIndex The index of this feature in its match container
+     */
+    virtual void add_to_blocks(pose_optimization::Match_Blocks& blocks, const size_t matchIndex) const noexcept = 0;
+
+    /**
+     * \brief Add this feature observation to a keyframe of the local bundle adjustment. The features that are not
+     * refined by the bundle adjustment add nothing
+     * \param[in, out] keyframe The keyframe in which this feature was matched
+     */
+    virtual void add_to_bundle_adjustment(pose_optimization::Bundle_Adjustment_Keyframe& keyframe) const noexcept = 0;
+
     /**
      * \brief return this feature alpha reduction (optimization weight)
      */
@@ -200,7 +246,8 @@ template<class Container> struct match_sets_template
     }
 };
 
-using match_container = std::list<feat_ptr>;
+// the list nodes come from a pool: the match sets are rebuilt for each frame
+using match_container = std::list<feat_ptr, utils::Pool_Allocator<feat_ptr>>;
 
 // store a set of inliers and a set of outliers for all features
 using match_sets = match_sets_template<match_container>;
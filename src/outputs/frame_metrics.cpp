@@ -0,0 +1,207 @@
+#include "frame_metrics.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <cmath>
+#include <format>
+
+namespace rgbd_slam::outputs {
+
+std::string_view get_stage_name(const Frame_Stage stage) noexcept
+{
+    switch (stage)
+    {
+        case Frame_Stage::DepthTreatment:
+            return "depth treatment";
+        case Frame_Stage::ImagePreparation:
+            return "image preparation";
+        case Frame_Stage::KeypointDetection:
+            return "keypoint detection";
+        case Frame_Stage::PlaneDetection:
+            return "plane detection";
+        case Frame_Stage::FeatureMatching:
+            return "feature matching";
+        case Frame_Stage::PoseOptimization:
+            return "pose optimization";
+        case Frame_Stage::MapUpdate:
+            return "map update";
+        case Frame_Stage::Frame:
+            return "frame";
+        default:
+            return "unknown";
+    }
+}
+
+std::string_view get_counter_name(const Frame_Counter counter) noexcept
+{
+    switch (counter)
+    {
+        case Frame_Counter::DetectedKeypoints:
+            return "detected keypoints";
+        case Frame_Counter::DetectedPlanes:
+            return "detected planes";
+        case Frame_Counter::MatchedFeatures:
+            return "matched features";
+        case Frame_Counter::InlierFeatures:
+            return "inlier features";
+        case Frame_Counter::RansacIterations:
+            return "RANSAC iterations";
+        case Frame_Counter::LoadSheddingLevel:
+            return "load shedding level";
+        default:
+            return "unknown";
+    }
+}
+
+std::string_view get_memory_consumer_name(const Memory_Consumer consumer) noexcept
+{
+    switch (consumer)
+    {
+        case Memory_Consumer::LocalPoints:
+            return "local map points";
+        case Memory_Consumer::StagedPoints:
+            return "staged map points";
+        case Memory_Consumer::LocalPoints2D:
+            return "local inverse depth points";
+        case Memory_Consumer::StagedPoints2D:
+            return "staged inverse depth points";
+        case Memory_Consumer::LocalPlanes:
+            return "local map planes";
+        case Memory_Consumer::StagedPlanes:
+            return "staged map planes";
+        case Memory_Consumer::Descriptors:
+            return "descriptors";
+        case Memory_Consumer::Polygons:
+            return "plane polygons";
+        case Memory_Consumer::DepthBuffers:
+            return "depth and cloud buffers";
+        case Memory_Consumer::Pyramids:
+            return "optical flow pyramids";
+        case Memory_Consumer::MatchContainers:
+            return "match containers";
+        case Memory_Consumer::DenseReconstruction:
+            return "dense reconstruction";
+        default:
+            return "unknown";
+    }
+}
+
+void Latency_Histogram::add(const double duration) noexcept
+{
+    const double logDuration = std::log2(std::max(duration, minimumDuration) / minimumDuration);
+    const size_t bucketIndex =
+            std::min(bucketCount - 1, static_cast<size_t>(logDuration * static_cast<double>(bucketsPerOctave)));
+    ++_buckets[bucketIndex];
+
+    ++_count;
+    _sum += duration;
+    _max = std::max(_max, duration);
+}
+
+double Latency_Histogram::get_quantile(const double quantile) const noexcept
+{
+    if (_count == 0)
+        return 0.0;
+
+    // rank of the searched duration, in [1, _count]
+    const uint64_t rank = std::clamp<uint64_t>(
+            static_cast<uint64_t>(std::ceil(std::clamp(quantile, 0.0, 1.0) * static_cast<double>(_count))),
+            1,
+            _count);
+    uint64_t cumulatedCount = 0;
+    for (size_t bucketIndex = 0; bucketIndex < bucketCount; ++bucketIndex)
+    {
+        cumulatedCount += _buckets[bucketIndex];
+        if (cumulatedCount >= rank)
+        {
+            // geometric center of the bucket
+            const double bucketCenter =
+                    minimumDuration *
+                    std::exp2((static_cast<double>(bucketIndex) + 0.5) / static_cast<double>(bucketsPerOctave));
+            return std::min(bucketCenter, _max);
+        }
+    }
+    return _max;
+}
+
+void Metrics_Recorder::record(const Frame_Metrics& frameMetrics) noexcept
+{
+    std::scoped_lock lock(_mutex);
+    _lastFrameMetrics = frameMetrics;
+    for (size_t stageIndex = 0; stageIndex < frameStageCount; ++stageIndex)
+    {
+        _stageHistograms[stageIndex].add(frameMetrics._stageDurations[stageIndex]);
+    }
+    for (size_t consumerIndex = 0; consumerIndex < memoryConsumerCount; ++consumerIndex)
+    {
+        _peakMemoryUsage[consumerIndex] =
+                std::max(_peakMemoryUsage[consumerIndex], frameMetrics._memoryUsage[consumerIndex]);
+    }
+    _peakTotalMemoryUsage = std::max(_peakTotalMemoryUsage, frameMetrics.get_total_memory_usage());
+}
+
+Frame_Metrics Metrics_Recorder::get_last_frame_metrics() const noexcept
+{
+    std::scoped_lock lock(_mutex);
+    return _lastFrameMetrics;
+}
+
+Stage_Latency Metrics_Recorder::get_stage_latency(const Frame_Stage stage) const noexcept
+{
+    std::scoped_lock lock(_mutex);
+    const Latency_Histogram& histogram = _stageHistograms[static_cast<size_t>(stage)];
+    return Stage_Latency {histogram.get_count(),
+                          histogram.get_mean(),
+                          histogram.get_quantile(0.5),
+                          histogram.get_quantile(0.99),
+                          histogram.get_max()};
+}
+
+size_t Metrics_Recorder::get_peak_memory_usage(const Memory_Consumer consumer) const noexcept
+{
+    std::scoped_lock lock(_mutex);
+    return _peakMemoryUsage[static_cast<size_t>(consumer)];
+}
+
+size_t Metrics_Recorder::get_peak_total_memory_usage() const noexcept
+{
+    std::scoped_lock lock(_mutex);
+    return _peakTotalMemoryUsage;
+}
+
+void Metrics_Recorder::show_statistics() const noexcept
+{
+    for (size_t stageIndex = 0; stageIndex < frameStageCount; ++stageIndex)
+    {
+        const Frame_Stage stage = static_cast<Frame_Stage>(stageIndex);
+        const Stage_Latency& latency = get_stage_latency(stage);
+        if (latency._frameCount == 0)
+            continue;
+
+        log(std::format("Latency of the {} stage: mean {:.4f}s, p50 {:.4f}s, p99 {:.4f}s, max {:.4f}s",
+                        get_stage_name(stage),
+                        latency._mean,
+                        latency._p50,
+                        latency._p99,
+                        latency._max));
+    }
+
+    const Frame_Metrics& lastFrameMetrics = get_last_frame_metrics();
+    constexpr double bytesPerMegabyte = 1024.0 * 1024.0;
+    for (size_t consumerIndex = 0; consumerIndex < memoryConsumerCount; ++consumerIndex)
+    {
+        const Memory_Consumer consumer = static_cast<Memory_Consumer>(consumerIndex);
+        const size_t peakBytes = get_peak_memory_usage(consumer);
+        if (peakBytes == 0)
+            continue;
+
+        log(std::format("Memory of the {}: last {:.2f}MB, peak {:.2f}MB",
+                        get_memory_consumer_name(consumer),
+                        static_cast<double>(lastFrameMetrics.get_memory_usage(consumer)) / bytesPerMegabyte,
+                        static_cast<double>(peakBytes) / bytesPerMegabyte));
+    }
+    const size_t peakTotalBytes = get_peak_total_memory_usage();
+    if (peakTotalBytes > 0)
+        log(std::format("Peak memory footprint: {:.2f}MB", static_cast<double>(peakTotalBytes) / bytesPerMegabyte));
+}
+
+} // namespace rgbd_slam::outputs
@@ -0,0 +1,264 @@
+#ifndef RGBDSLAM_OUTPUTS_FRAME_METRICS_HPP
+#define RGBDSLAM_OUTPUTS_FRAME_METRICS_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace rgbd_slam::outputs {
+
+/**
+ * \brief The timed stages of the tracking of a frame
+ */
+enum class Frame_Stage : size_t
+{
+    DepthTreatment,    // depth rectification and organized cloud
+    ImagePreparation,  // gray conversion and optical flow pyramid, in parallel with the depth treatment
+    KeypointDetection, // optical flow, keypoint detection and description
+    PlaneDetection,    // primitive detection (and the line detection that follows it)
+    FeatureMatching,   // matches of the local map features
+    PoseOptimization,  // RANSAC, final refinement, and relocalization when the tracking is lost
+    MapUpdate,         // local map update with the tracked pose
+    Frame,             // whole frame treatment
+
+    Count
+};
+inline constexpr size_t frameStageCount = static_cast<size_t>(Frame_Stage::Count);
+
+/**
+ * \brief The counters of the tracking of a frame
+ */
+enum class Frame_Counter : size_t
+{
+    DetectedKeypoints,
+    DetectedPlanes,
+    MatchedFeatures,
+    InlierFeatures,
+    RansacIterations,
+    LoadSheddingLevel, // quality level of the frame, 0 for full quality
+
+    Count
+};
+inline constexpr size_t frameCounterCount = static_cast<size_t>(Frame_Counter::Count);
+
+/**
+ * \brief The memory consumers measured after each tracked frame
+ */
+enum class Memory_Consumer : size_t
+{
+    LocalPoints,         // map points storage, spatial index and buffers
+    StagedPoints,        // same, for the staged map points
+    LocalPoints2D,       // inverse depth map points storage, spatial index and buffers
+    StagedPoints2D,      // same, for the staged inverse depth points
+    LocalPlanes,         // map planes storage, spatial index and buffers, without the boundary polygons
+    StagedPlanes,        // same, for the staged map planes
+    Descriptors,         // descriptors of the map features, in the shared descriptor pool
+    Polygons,            // boundary polygons of the map planes, and their projections
+    DepthBuffers,        // depth image, organized cloud and depth transformation tables
+    Pyramids,            // optical flow pyramids
+    MatchContainers,     // slabs of the pooled objects: match containers and match features
+    DenseReconstruction, // blocks of the dense reconstruction, and its queued depth images
+
+    Count
+};
+inline constexpr size_t memoryConsumerCount = static_cast<size_t>(Memory_Consumer::Count);
+
+[[nodiscard]] std::string_view get_stage_name(const Frame_Stage stage) noexcept;
+[[nodiscard]] std::string_view get_counter_name(const Frame_Counter counter) noexcept;
+[[nodiscard]] std::string_view get_memory_consumer_name(const Memory_Consumer consumer) noexcept;
+
+/**
+ * \brief The bytes allocated by a vector: its capacity, not its size
+ */
+template<typename T, typename Allocator>
+[[nodiscard]] size_t get_allocated_bytes(const std::vector<T, Allocator>& container) noexcept
+{
+    return container.capacity() * sizeof(T);
+}
+
+/**
+ * \brief Estimate the bytes allocated by a hash table: its buckets, and a node (next pointer and value) by element
+ */
+template<typename Key, typename Value, typename... Args>
+[[nodiscard]] size_t get_allocated_bytes(const std::unordered_map<Key, Value, Args...>& container) noexcept
+{
+    return container.bucket_count() * sizeof(void*) +
+           container.size() * (sizeof(void*) + sizeof(typename std::unordered_map<Key, Value, Args...>::value_type));
+}
+
+template<typename Key, typename... Args>
+[[nodiscard]] size_t get_allocated_bytes(const std::unordered_set<Key, Args...>& container) noexcept
+{
+    return container.bucket_count() * sizeof(void*) + container.size() * (sizeof(void*) + sizeof(Key));
+}
+
+/**
+ * \brief The stage durations and counters of one tracked frame
+ */
+struct Frame_Metrics
+{
+    size_t _frameIndex = 0;
+    std::array<double, frameStageCount> _stageDurations {}; // in seconds
+    std::array<uint64_t, frameCounterCount> _counters {};
+    std::array<size_t, memoryConsumerCount> _memoryUsage {}; // in bytes, after the treatment of this frame
+
+    [[nodiscard]] double get_duration(const Frame_Stage stage) const noexcept
+    {
+        return _stageDurations[static_cast<size_t>(stage)];
+    }
+    void add_duration(const Frame_Stage stage, const double duration) noexcept
+    {
+        _stageDurations[static_cast<size_t>(stage)] += duration;
+    }
+
+    [[nodiscard]] uint64_t get_counter(const Frame_Counter counter) const noexcept
+    {
+        return _counters[static_cast<size_t>(counter)];
+    }
+    void set_counter(const Frame_Counter counter, const uint64_t value) noexcept
+    {
+        _counters[static_cast<size_t>(counter)] = value;
+    }
+
+    [[nodiscard]] size_t get_memory_usage(const Memory_Consumer consumer) const noexcept
+    {
+        return _memoryUsage[static_cast<size_t>(consumer)];
+    }
+    void add_memory_usage(const Memory_Consumer consumer, const size_t bytes) noexcept
+    {
+        _memoryUsage[static_cast<size_t>(consumer)] += bytes;
+    }
+    /**
+     * \brief Add the memory of all the consumers of other metrics
+     */
+    void add_memory_usage(const Frame_Metrics& other) noexcept
+    {
+        for (size_t consumerIndex = 0; consumerIndex < memoryConsumerCount; ++consumerIndex)
+            _memoryUsage[consumerIndex] += other._memoryUsage[consumerIndex];
+    }
+    [[nodiscard]] size_t get_total_memory_usage() const noexcept
+    {
+        size_t totalBytes = 0;
+        for (const size_t bytes: _memoryUsage)
+            totalBytes += bytes;
+        return totalBytes;
+    }
+};
+
+/**
+ * \brief Add the time spent in a scope to a stage of the frame metrics. Uses the steady clock, read from the TSC
+ * without a system call on the usual platforms
+ */
+class Scoped_Timer
+{
+  public:
+    Scoped_Timer(Frame_Metrics& metrics, const Frame_Stage stage) noexcept :
+        _metrics(metrics),
+        _stage(stage),
+        _startTime(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~Scoped_Timer() noexcept
+    {
+        const std::chrono::duration<double> elapsedTime = std::chrono::steady_clock::now() - _startTime;
+        _metrics.add_duration(_stage, elapsedTime.count());
+    }
+
+    Scoped_Timer(const Scoped_Timer&) = delete;
+    Scoped_Timer& operator=(const Scoped_Timer&) = delete;
+
+  private:
+    Frame_Metrics& _metrics;
+    const Frame_Stage _stage;
+    const std::chrono::steady_clock::time_point _startTime;
+};
+
+/**
+ * \brief Histogram of durations on logarithmic buckets, from 1 microsecond to about 2 minutes. Constant memory, and
+ * the quantiles have a relative error under 5%
+ */
+class Latency_Histogram
+{
+  public:
+    void add(const double duration) noexcept;
+
+    /**
+     * \param[in] quantile The quantile to compute, in [0, 1]
+     * \return The duration under which this proportion of the durations fall, in seconds (0 if empty)
+     */
+    [[nodiscard]] double get_quantile(const double quantile) const noexcept;
+
+    [[nodiscard]] uint64_t get_count() const noexcept { return _count; }
+    [[nodiscard]] double get_mean() const noexcept { return _count > 0 ? _sum / static_cast<double>(_count) : 0.0; }
+    [[nodiscard]] double get_max() const noexcept { return _max; }
+
+  private:
+    static constexpr double minimumDuration = 1e-6; // in seconds, the durations under it go to the first bucket
+    static constexpr size_t bucketsPerOctave = 8;   // bucket width ratio of 2^(1/8)
+    static constexpr size_t octaveCount = 27;
+    static constexpr size_t bucketCount = bucketsPerOctave * octaveCount;
+
+    std::array<uint64_t, bucketCount> _buckets {};
+    uint64_t _count = 0;
+    double _sum = 0.0;
+    double _max = 0.0;
+};
+
+/**
+ * \brief The latency statistics of a stage, over all the frames
+ */
+struct Stage_Latency
+{
+    uint64_t _frameCount = 0;
+    double _mean = 0.0; // in seconds
+    double _p50 = 0.0;
+    double _p99 = 0.0;
+    double _max = 0.0;
+};
+
+/**
+ * \brief Keeps the metrics of the last frame, the latency histograms of the stages and the peak memory of the consumers
+ * over all the frames. Thread safe: the frames are recorded by the tracking, and queried from any thread
+ */
+class Metrics_Recorder
+{
+  public:
+    void record(const Frame_Metrics& frameMetrics) noexcept;
+
+    [[nodiscard]] Frame_Metrics get_last_frame_metrics() const noexcept;
+    [[nodiscard]] Stage_Latency get_stage_latency(const Frame_Stage stage) const noexcept;
+
+    /**
+     * \return The highest memory of this consumer after a frame, in bytes
+     */
+    [[nodiscard]] size_t get_peak_memory_usage(const Memory_Consumer consumer) const noexcept;
+
+    /**
+     * \return The highest memory of all the consumers after a frame, in bytes. Can be under the sum of the peaks of
+     * the consumers, reached at different frames
+     */
+    [[nodiscard]] size_t get_peak_total_memory_usage() const noexcept;
+
+    /**
+     * \brief Log the latencies of the stages, and the last and peak memory of the consumers
+     */
+    void show_statistics() const noexcept;
+
+  private:
+    mutable std::mutex _mutex;
+    Frame_Metrics _lastFrameMetrics;
+    std::array<Latency_Histogram, frameStageCount> _stageHistograms;
+    std::array<size_t, memoryConsumerCount> _peakMemoryUsage {};
+    size_t _peakTotalMemoryUsage = 0;
+};
+
+} // namespace rgbd_slam::outputs
+
+#endif
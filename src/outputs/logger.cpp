@@ -1,67 +1,231 @@
 #include "logger.hpp"
+#include "../utils/bounded_queue.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
 #include <filesystem>
+#include <format>
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <mutex>
+#include <string>
+#include <thread>
 
 namespace rgbd_slam::outputs {
 
-enum class InfoLevel
-{
-    ALL = 0,  // display all logs
-    LOW = 1,  // show logs low and above
-    MED = 2,  // show logs medium and above
-    HIGH = 3, // show logs high and above
+// lines waiting for the logging thread, the next ones are dropped
+constexpr size_t logQueueCapacity = 4096;
+// lines written in a single console write
+constexpr size_t maximumLogBatchSize = 256;
 
-    NONE = 100, // deactivate all logs
-};
+// each call site can write this many lines per window, the next ones are suppressed until the window ends
+constexpr uint maximumLinesPerWindow = 20;
+constexpr int64_t rateLimitWindow_ms = 1000;
+// the call sites share the rate limits of their hash slot
+constexpr size_t rateLimitSlotCount = 256;
+
+namespace {
 
-// prevent too much logging
-constexpr InfoLevel INFO_LEVEL = InfoLevel::ALL;
+struct Log_Line
+{
+    Log_Level _level = Log_Level::Info;
+    std::string _message;
+    const char* _fileName = "";
+    uint _line = 0;
+    uint _column = 0;
+    uint _suppressedCount = 0; // lines of this call site suppressed before this one
+};
 
-void log(const std::string_view& message, const std::source_location& location) noexcept
+/**
+ * \brief Append a log line to the text of its stream, with the color of its level
+ */
+void append_line(const Log_Line& line, std::string& text)
 {
-    if (INFO_LEVEL <= InfoLevel::LOW)
+    const std::string& fileName = std::filesystem::path(line._fileName).filename().string();
+    switch (line._level)
     {
-        static std::mutex mut;
-        std::scoped_lock<std::mutex> lock(mut);
-
-        // display in blue
-        std::cout << "\x1B[34m[INF] " << std::filesystem::path(location.file_name()).filename().string() << "("
-                  << location.line() << ":" << location.column()
-                  << ") "
-                  //<< location.function_name() << " | "
-                  << message << "\033[0m\n";
+        case Log_Level::Info:
+            // display in blue
+            text += std::format("\x1B[34m[INF] {}({}:{}) {}", fileName, line._line, line._column, line._message);
+            break;
+        case Log_Level::Warning:
+            // display in yellow
+            text += std::format("\x1B[33m[WARN] {}({}:{}) {}", fileName, line._line, line._column, line._message);
+            break;
+        default:
+            // display in red
+            text += std::format("\x1B[31m[ERR] {}({}:{}) {}", fileName, line._line, line._column, line._message);
+            break;
     }
+    if (line._suppressedCount > 0)
+        text += std::format(" ({} lines of this call site were suppressed)", line._suppressedCount);
+    text += "\033[0m\n";
+}
+
+/**
+ * \brief Write some log lines to the console. The info lines go to the standard output, the others to the error output
+ */
+void write_lines(const std::string& outputText, const std::string& errorText)
+{
+    static std::mutex mut;
+    std::scoped_lock lock(mut);
+    if (not outputText.empty())
+        std::cout << outputText << std::flush;
+    if (not errorText.empty())
+        std::cerr << errorText << std::flush;
+}
+
+void write_line(const Log_Line& line)
+{
+    std::string text;
+    append_line(line, text);
+    if (line._level == Log_Level::Info)
+        write_lines(text, "");
+    else
+        write_lines("", text);
 }
-void log_warning(const std::string_view& message, const std::source_location& location) noexcept
+
+/**
+ * \brief Limit the number of lines written by each call site
+ */
+class Rate_Limiter
 {
-    if (INFO_LEVEL <= InfoLevel::MED)
+  public:
+    /**
+     * \param[in] location The call site of the line
+     * \param[out] suppressedCount The lines of this call site suppressed since its last written line
+     * \return true if the line should be written
+     */
+    [[nodiscard]] bool should_log(const std::source_location& location, uint& suppressedCount) noexcept
     {
-        static std::mutex mut;
-        std::scoped_lock<std::mutex> lock(mut);
-
-        // display in yellow
-        std::cerr << "\x1B[33m[WARN] " << std::filesystem::path(location.file_name()).filename().string() << "("
-                  << location.line() << ":" << location.column()
-                  << ") "
-                  //<< location.function_name() << " | "
-                  << message << "\033[0m\n";
+        const size_t hash = std::hash<const void*>()(location.file_name()) ^ (location.line() * 0x9E3779B97F4A7C15ull);
+        Slot& slot = _slots[hash % rateLimitSlotCount];
+
+        const int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                       std::chrono::steady_clock::now().time_since_epoch())
+                                       .count();
+        int64_t windowStart_ms = slot._windowStart_ms.load(std::memory_order_relaxed);
+        if (now_ms - windowStart_ms >= rateLimitWindow_ms and
+            slot._windowStart_ms.compare_exchange_strong(windowStart_ms, now_ms, std::memory_order_relaxed))
+        {
+            // new window
+            slot._lineCount.store(1, std::memory_order_relaxed);
+            suppressedCount = slot._suppressedCount.exchange(0, std::memory_order_relaxed);
+            return true;
+        }
+
+        suppressedCount = 0;
+        if (slot._lineCount.fetch_add(1, std::memory_order_relaxed) < maximumLinesPerWindow)
+            return true;
+        slot._suppressedCount.fetch_add(1, std::memory_order_relaxed);
+        return false;
     }
-}
-void log_error(const std::string_view& message, const std::source_location& location) noexcept
+
+  private:
+    struct Slot
+    {
+        std::atomic<int64_t> _windowStart_ms = std::numeric_limits<int64_t>::min() / 2; // no window yet
+        std::atomic<uint> _lineCount = 0;
+        std::atomic<uint> _suppressedCount = 0;
+    };
+    std::array<Slot, rateLimitSlotCount> _slots {};
+};
+
+// constant initialized and trivially destroyed: valid in the logs of the static destructors
+constinit Rate_Limiter rateLimiter;
+
+/**
+ * \brief The logging thread: writes the queued lines by batches, so the callers never wait for the console
+ */
+class Log_Writer
 {
-    if (INFO_LEVEL <= InfoLevel::HIGH)
+  public:
+    Log_Writer() : _lines(logQueueCapacity), _thread(&Log_Writer::run, this) {}
+
+    void push(Log_Line&& line) noexcept
+    {
+        // the line is only moved when it is queued
+        if (_lines.try_push(std::move(line)))
+            return;
+
+        if (_isRunning.load(std::memory_order_relaxed))
+            // the queue is full: warn about it with the next batch
+            _droppedCount.fetch_add(1, std::memory_order_relaxed);
+        else
+            // after the logging thread end
+            write_line(line);
+    }
+
+    /**
+     * \brief Write the remaining lines and stop the logging thread
+     */
+    void stop() noexcept
     {
-        static std::mutex mut;
-        std::scoped_lock<std::mutex> lock(mut);
-
-        // display in red
-        std::cerr << "\x1B[31m[ERR] " << std::filesystem::path(location.file_name()).filename().string() << "("
-                  << location.line() << ":" << location.column()
-                  << ") "
-                  //<< location.function_name() << " | "
-                  << message << "\033[0m\n";
+        if (not _isRunning.exchange(false))
+            return;
+        _lines.close();
+        if (_thread.joinable())
+            _thread.join();
     }
+
+  private:
+    void run() noexcept
+    {
+        Log_Line line;
+        while (_lines.pop(line))
+        {
+            std::string outputText;
+            std::string errorText;
+            size_t batchSize = 0;
+            do
+            {
+                append_line(line, line._level == Log_Level::Info ? outputText : errorText);
+            } while (++batchSize < maximumLogBatchSize and _lines.try_pop(line));
+
+            if (const uint64_t droppedCount = _droppedCount.exchange(0, std::memory_order_relaxed); droppedCount > 0)
+                errorText += std::format("\x1B[33m[WARN] {} log lines were dropped: the log queue was full\033[0m\n",
+                                         droppedCount);
+            write_lines(outputText, errorText);
+        }
+    }
+
+    std::atomic<bool> _isRunning = true;
+    std::atomic<uint64_t> _droppedCount = 0;
+    utils::Bounded_Queue<Log_Line> _lines;
+    std::thread _thread;
+};
+
+/**
+ * \brief The log writer is never destroyed, so the logs of the static destructors stay valid. It is stopped at exit
+ */
+Log_Writer& get_log_writer() noexcept
+{
+    static Log_Writer* const logWriter = []() {
+        Log_Writer* writer = new Log_Writer();
+        std::atexit(flush_logs);
+        return writer;
+    }();
+    return *logWriter;
 }
 
+} // namespace
+
+void push_log(const Log_Level level, const std::string_view& message, const std::source_location& location) noexcept
+{
+    uint suppressedCount = 0;
+    if (not rateLimiter.should_log(location, suppressedCount))
+        return;
+
+    get_log_writer().push(Log_Line {level,
+                                    std::string(message),
+                                    location.file_name(),
+                                    static_cast<uint>(location.line()),
+                                    static_cast<uint>(location.column()),
+                                    suppressedCount});
+}
+
+void flush_logs() noexcept { get_log_writer().stop(); }
+
 } // namespace rgbd_slam::outputs
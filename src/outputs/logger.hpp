@@ -4,17 +4,69 @@
 #include <source_location>
 #include <string_view>
 
+// minimum level of the compiled logs: 0 for all, 1 for warnings and errors, 2 for errors only, 3 for none
+#ifndef RGBDSLAM_LOG_LEVEL
+#define RGBDSLAM_LOG_LEVEL 0
+#endif
+
 namespace rgbd_slam::outputs {
 
+enum class Log_Level
+{
+    Info = 0,
+    Warning = 1,
+    Error = 2,
+
+    None = 3, // deactivate all logs
+};
+
+// the logs under this level are removed at compile time
+inline constexpr Log_Level compiledLogLevel = static_cast<Log_Level>(RGBDSLAM_LOG_LEVEL);
+
+/**
+ * \brief Queue a log line, to be written by the logging thread. Never waits for the console: the lines are dropped
+ * when the queue is full, and the lines of a call site logging too often are suppressed for a while
+ * \param[in] level The level of this log line
+ * \param[in] message The message to log (copied)
+ * \param[in] location The call site of the log
+ */
+void push_log(const Log_Level level, const std::string_view& message, const std::source_location& location) noexcept;
+
+/**
+ * \brief Write all the queued logs and stop the logging thread. Called at exit, the logs that follow are written
+ * synchronously
+ */
+void flush_logs() noexcept;
+
+/**
+ * Log an information line
+ */
+inline void log(const std::string_view& message,
+                const std::source_location& location = std::source_location::current()) noexcept
+{
+    if constexpr (compiledLogLevel <= Log_Level::Info)
+        push_log(Log_Level::Info, message, location);
+}
+
+/**
+ * Log a warning line
+ */
+inline void log_warning(const std::string_view& message,
+                        const std::source_location& location = std::source_location::current()) noexcept
+{
+    if constexpr (compiledLogLevel <= Log_Level::Warning)
+        push_log(Log_Level::Warning, message, location);
+}
+
 /**
  * Log an error line
  */
-void log(const std::string_view& message,
-         const std::source_location& location = std::source_location::current()) noexcept;
-void log_warning(const std::string_view& message,
-                 const std::source_location& location = std::source_location::current()) noexcept;
-void log_error(const std::string_view& message,
-               const std::source_location& location = std::source_location::current()) noexcept;
+inline void log_error(const std::string_view& message,
+                      const std::source_location& location = std::source_location::current()) noexcept
+{
+    if constexpr (compiledLogLevel <= Log_Level::Error)
+        push_log(Log_Level::Error, message, location);
+}
 
 } // namespace rgbd_slam::outputs
 
@@ -1,12 +1,13 @@
 #include "map_writer.hpp"
 #include "logger.hpp"
+#include <bit>
 #include <string>
 
 namespace rgbd_slam::outputs {
 
-IMap_Writer::IMap_Writer(const std::string& filename)
+IMap_Writer::IMap_Writer(const std::string& filename, const std::ios_base::openmode openMode)
 {
-    _file.open(filename, std::ios_base::trunc | std::ios_base::out);
+    _file.open(filename, openMode);
     if (not _file.is_open())
     {
         log_error("Could not open out file " + filename);
@@ -155,4 +156,194 @@ void OBJ_Map_Writer::add_polygon(const std::vector<vector3>& coordinates, const
     }
 }
 
+/**
+ *     Binary format
+ */
+
+// the binary map is written in the native byte order
+static_assert(std::endian::native == std::endian::little, "The binary map format is little endian");
+
+Binary_Map_Writer::Binary_Map_Writer(const std::string& filename) :
+    IMap_Writer(filename + ".rgbdmap", std::ios_base::trunc | std::ios_base::out | std::ios_base::binary),
+    _chunks(chunkQueueCapacity)
+{
+    static constexpr char magic[8] = {'R', 'G', 'B', 'D', 'M', 'A', 'P', '\0'};
+    _file.write(magic, sizeof(magic));
+    _file.write(reinterpret_cast<const char*>(&formatVersion), sizeof(formatVersion));
+
+    _currentChunk._payload.reserve(chunkCapacity);
+    _writerThread = std::thread(&Binary_Map_Writer::run, this);
+}
+
+Binary_Map_Writer::~Binary_Map_Writer()
+{
+    flush();
+    _chunks.close();
+    if (_writerThread.joinable())
+        _writerThread.join();
+}
+
+void Binary_Map_Writer::add_point(const vector3& pointCoordinates) noexcept
+{
+    append_point(noId, pointCoordinates, matrix33::Zero());
+}
+
+void Binary_Map_Writer::add_points(const std::span<const vector3> points) noexcept
+{
+    for (const vector3& point: points)
+        append_point(noId, point, matrix33::Zero());
+}
+
+void Binary_Map_Writer::add_map_point(const size_t id, const vector3& coordinates, const matrix33& covariance) noexcept
+{
+    append_point(id, coordinates, covariance);
+}
+
+void Binary_Map_Writer::add_line(const std::vector<vector3>& coordinates) noexcept
+{
+    start_record(RecordType::Line);
+    append(static_cast<uint32_t>(coordinates.size()));
+    for (const vector3& point: coordinates)
+        append(point);
+}
+
+void Binary_Map_Writer::add_polygon(const std::vector<vector3>& coordinates, const vector3& normal) noexcept
+{
+    add_map_polygon(noId, coordinates, normal);
+}
+
+void Binary_Map_Writer::add_map_polygon(const size_t id,
+                                        const std::vector<vector3>& coordinates,
+                                        const vector3& normal) noexcept
+{
+    start_record(RecordType::Polygon);
+    append(static_cast<uint64_t>(id));
+    append(normal);
+    append(static_cast<uint32_t>(coordinates.size()));
+    for (const vector3& point: coordinates)
+        append(point);
+}
+
+void Binary_Map_Writer::flush() noexcept
+{
+    if (_currentChunk._recordCount == 0)
+        return;
+
+    Chunk chunk;
+    chunk._payload.reserve(chunkCapacity);
+    std::swap(chunk, _currentChunk);
+    if (not _chunks.push(std::move(chunk)))
+        log_error("Could not write a map chunk: the writer is closed");
+}
+
+void Binary_Map_Writer::start_record(const RecordType type) noexcept
+{
+    if (_currentChunk._type != type or _currentChunk._payload.size() >= chunkCapacity)
+    {
+        flush();
+        _currentChunk._type = type;
+    }
+    ++_currentChunk._recordCount;
+}
+
+void Binary_Map_Writer::append(const vector3& vector) noexcept
+{
+    append(vector.x());
+    append(vector.y());
+    append(vector.z());
+}
+
+void Binary_Map_Writer::append_point(const uint64_t id, const vector3& coordinates, const matrix33& covariance) noexcept
+{
+    start_record(RecordType::Point);
+    append(id);
+    append(coordinates);
+    // upper triangle, by rows
+    for (Eigen::Index row = 0; row < 3; ++row)
+        for (Eigen::Index column = row; column < 3; ++column)
+            append(covariance(row, column));
+}
+
+void Binary_Map_Writer::run() noexcept
+{
+    bool hasFailed = false;
+    Chunk chunk;
+    while (_chunks.pop(chunk))
+    {
+        const uint32_t recordType = static_cast<uint32_t>(chunk._type);
+        const uint64_t payloadSize = chunk._payload.size();
+        _file.write(reinterpret_cast<const char*>(&recordType), sizeof(recordType));
+        _file.write(reinterpret_cast<const char*>(&chunk._recordCount), sizeof(chunk._recordCount));
+        _file.write(reinterpret_cast<const char*>(&payloadSize), sizeof(payloadSize));
+        _file.write(reinterpret_cast<const char*>(chunk._payload.data()), static_cast<std::streamsize>(payloadSize));
+
+        if (not hasFailed and not _file.good())
+        {
+            log_error("Could not write a map chunk to the binary map file");
+            hasFailed = true;
+        }
+    }
+    _file.flush();
+}
+
+/**
+ *     Buffered writer
+ */
+
+void Buffered_Map_Writer::add_point(const vector3& pointCoordinates) noexcept
+{
+    _features.emplace_back(RecordType::Point, std::vector<vector3> {pointCoordinates}, vector3::Zero());
+}
+
+void Buffered_Map_Writer::add_map_point(const size_t id,
+                                        const vector3& coordinates,
+                                        const matrix33& covariance) noexcept
+{
+    _features.emplace_back(
+            RecordType::MapPoint, std::vector<vector3> {coordinates}, vector3::Zero(), id, covariance);
+}
+
+void Buffered_Map_Writer::add_line(const std::vector<vector3>& coordinates) noexcept
+{
+    _features.emplace_back(RecordType::Line, coordinates, vector3::Zero());
+}
+
+void Buffered_Map_Writer::add_polygon(const std::vector<vector3>& coordinates, const vector3& normal) noexcept
+{
+    _features.emplace_back(RecordType::Polygon, coordinates, normal);
+}
+
+void Buffered_Map_Writer::add_map_polygon(const size_t id,
+                                          const std::vector<vector3>& coordinates,
+                                          const vector3& normal) noexcept
+{
+    _features.emplace_back(RecordType::MapPolygon, coordinates, normal, id);
+}
+
+void Buffered_Map_Writer::flush(IMap_Writer& mapWriter) noexcept
+{
+    for (const RecordedFeature& feature: _features)
+    {
+        switch (feature._type)
+        {
+            case RecordType::Point:
+                mapWriter.add_point(feature._coordinates.front());
+                break;
+            case RecordType::MapPoint:
+                mapWriter.add_map_point(feature._id, feature._coordinates.front(), feature._covariance);
+                break;
+            case RecordType::Line:
+                mapWriter.add_line(feature._coordinates);
+                break;
+            case RecordType::Polygon:
+                mapWriter.add_polygon(feature._coordinates, feature._normal);
+                break;
+            case RecordType::MapPolygon:
+                mapWriter.add_map_polygon(feature._id, feature._coordinates, feature._normal);
+                break;
+        }
+    }
+    _features.clear();
+}
+
 } // namespace rgbd_slam::outputs
@@ -2,7 +2,12 @@
 #define RGBDSLAM_OUTPUTS_MAP_WRITER_HPP
 
 #include "../types.hpp"
+#include "../utils/bounded_queue.hpp"
+#include <cstdint>
 #include <fstream>
+#include <span>
+#include <thread>
+#include <vector>
 
 namespace rgbd_slam::outputs {
 
@@ -12,16 +17,50 @@ namespace rgbd_slam::outputs {
 class IMap_Writer
 {
   public:
-    IMap_Writer(const std::string& filename);
+    IMap_Writer(const std::string& filename,
+                const std::ios_base::openmode openMode = std::ios_base::trunc | std::ios_base::out);
     virtual ~IMap_Writer();
 
     virtual void add_point(const vector3& pointCoordinates) noexcept = 0;
 
+    /**
+     * \brief Add a batch of points. Writes them one by one if the format has no batch write
+     */
+    virtual void add_points(const std::span<const vector3> points) noexcept
+    {
+        for (const vector3& point: points)
+            add_point(point);
+    }
+
+    /**
+     * \brief Add a map point, with its id and covariance. The formats that cannot store them only write the point
+     */
+    virtual void add_map_point(const size_t id, const vector3& coordinates, const matrix33& covariance) noexcept
+    {
+        std::ignore = id;
+        std::ignore = covariance;
+        add_point(coordinates);
+    }
+
     virtual void add_line(const std::vector<vector3>& coordinates) noexcept = 0;
 
     virtual void add_polygon(const std::vector<vector3>& coordinates, const vector3& normal) noexcept = 0;
 
+    /**
+     * \brief Add the polygon of a map feature, with its id. The formats that cannot store it only write the polygon
+     */
+    virtual void add_map_polygon(const size_t id,
+                                 const std::vector<vector3>& coordinates,
+                                 const vector3& normal) noexcept
+    {
+        std::ignore = id;
+        add_polygon(coordinates, normal);
+    }
+
   protected:
+    // writers that do not use a file
+    IMap_Writer() = default;
+
     std::ofstream _file;
 };
 
@@ -77,6 +116,139 @@ class OBJ_Map_Writer : public IMap_Writer
     size_t _vectorIndex = 1;
 };
 
+/**
+ * Writes a compact binary map (.rgbdmap) that keeps the ids and covariances of the map points.
+ * The features are serialized in chunks, written to the file by a background thread: adding a feature only copies it
+ * in the current chunk. The destructor waits for the last chunks to be written.
+ *
+ * Format, little endian: the magic "RGBDMAP" and a zero byte, the uint32 format version, then a sequence of chunks.
+ * A chunk is a uint32 record type, a uint32 record count, a uint64 payload size in bytes, and the payload:
+ * - points: per point, the uint64 id, the 3 doubles of the coordinates and the 6 doubles of the upper triangle of the
+ *   covariance, by rows. The points with no id have the maximum id and a null covariance
+ * - lines: per line, the uint32 vertex count, then 3 doubles per vertex
+ * - polygons: per polygon, the uint64 id (maximum if none), the 3 doubles of the normal, the uint32 vertex count, then
+ *   3 doubles per vertex
+ */
+class Binary_Map_Writer : public IMap_Writer
+{
+  public:
+    static constexpr uint32_t formatVersion = 1;
+    static constexpr uint64_t noId = UINT64_MAX;
+
+    Binary_Map_Writer(const std::string& filename);
+    ~Binary_Map_Writer() override;
+
+    void add_point(const vector3& pointCoordinates) noexcept override;
+
+    void add_points(const std::span<const vector3> points) noexcept override;
+
+    void add_map_point(const size_t id, const vector3& coordinates, const matrix33& covariance) noexcept override;
+
+    void add_line(const std::vector<vector3>& coordinates) noexcept override;
+
+    void add_polygon(const std::vector<vector3>& coordinates, const vector3& normal) noexcept override;
+
+    void add_map_polygon(const size_t id,
+                         const std::vector<vector3>& coordinates,
+                         const vector3& normal) noexcept override;
+
+    /**
+     * \brief Send the current chunk to the writing thread, without waiting for it to be written
+     */
+    void flush() noexcept;
+
+    enum class RecordType : uint32_t
+    {
+        Point = 1,
+        Line = 2,
+        Polygon = 3
+    };
+
+  private:
+    // payload size after which a chunk is sent to the writing thread
+    static constexpr size_t chunkCapacity = 1 << 22;
+    // chunks waiting to be written: the writer waits for the disk above this
+    static constexpr size_t chunkQueueCapacity = 8;
+
+    struct Chunk
+    {
+        RecordType _type = RecordType::Point;
+        uint32_t _recordCount = 0;
+        std::vector<std::byte> _payload;
+    };
+
+    /**
+     * \brief Start a new record in the current chunk, sending the chunk if it is full or of another type
+     */
+    void start_record(const RecordType type) noexcept;
+
+    template<typename T> void append(const T& value) noexcept
+    {
+        const std::byte* bytes = reinterpret_cast<const std::byte*>(&value);
+        _currentChunk._payload.insert(_currentChunk._payload.end(), bytes, bytes + sizeof(T));
+    }
+    void append(const vector3& vector) noexcept;
+    void append_point(const uint64_t id, const vector3& coordinates, const matrix33& covariance) noexcept;
+
+    /**
+     * \brief Thread function: writes the chunks to the file, in order
+     */
+    void run() noexcept;
+
+    Chunk _currentChunk;
+    utils::Bounded_Queue<Chunk> _chunks;
+    std::thread _writerThread;
+};
+
+/**
+ * Records the written features, to write them later in another writer.
+ * Lets concurrent tasks share a writer, in a deterministic order
+ */
+class Buffered_Map_Writer : public IMap_Writer
+{
+  public:
+    Buffered_Map_Writer() = default;
+
+    void add_point(const vector3& pointCoordinates) noexcept override;
+
+    void add_map_point(const size_t id, const vector3& coordinates, const matrix33& covariance) noexcept override;
+
+    void add_line(const std::vector<vector3>& coordinates) noexcept override;
+
+    void add_polygon(const std::vector<vector3>& coordinates, const vector3& normal) noexcept override;
+
+    void add_map_polygon(const size_t id,
+                         const std::vector<vector3>& coordinates,
+                         const vector3& normal) noexcept override;
+
+    /**
+     * \brief Write the recorded features to another writer, in order, and clear this buffer
+     * \param[in, out] mapWriter The writer that receives the features
+     */
+    void flush(IMap_Writer& mapWriter) noexcept;
+
+  private:
+    enum class RecordType
+    {
+        Point,
+        MapPoint,
+        Line,
+        Polygon,
+        MapPolygon
+    };
+
+    struct RecordedFeature
+    {
+        RecordType _type;
+        std::vector<vector3> _coordinates;
+        vector3 _normal;
+        size_t _id = 0;
+        matrix33 _covariance = matrix33::Zero();
+    };
+
+    std::vector<RecordedFeature> _features;
+};
+
 } // namespace rgbd_slam::outputs
 
 #endif
@@ -0,0 +1,98 @@
+#include "trace_recorder.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <format>
+#include <fstream>
+
+namespace rgbd_slam::outputs {
+
+void Trace_Recorder::start(const size_t eventCapacity) noexcept
+{
+    std::scoped_lock lock(_mutex);
+    _events.assign(std::max<size_t>(eventCapacity, 1), Trace_Event());
+    _recordedEventCount = 0;
+    _startTime = std::chrono::steady_clock::now();
+    _isRecording.store(true, std::memory_order_relaxed);
+}
+
+void Trace_Recorder::stop() noexcept { _isRecording.store(false, std::memory_order_relaxed); }
+
+uint32_t Trace_Recorder::get_thread_id() noexcept
+{
+    thread_local const uint32_t threadId = _threadCount.fetch_add(1, std::memory_order_relaxed);
+    return threadId;
+}
+
+void Trace_Recorder::add_event(const char* name,
+                               const std::string_view detail,
+                               const std::chrono::steady_clock::time_point startTime,
+                               const std::chrono::steady_clock::time_point endTime) noexcept
+{
+    if (not is_recording())
+        return;
+
+    Trace_Event event;
+    event._name = name;
+    const size_t detailSize = std::min(detail.size(), Trace_Event::detailCapacity - 1);
+    std::copy_n(detail.begin(), detailSize, event._detail.begin());
+    event._threadId = get_thread_id();
+    event._duration_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(endTime - startTime).count();
+
+    std::scoped_lock lock(_mutex);
+    if (_events.empty())
+        return;
+    event._start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(startTime - _startTime).count();
+    _events[_recordedEventCount % _events.size()] = event;
+    ++_recordedEventCount;
+}
+
+bool Trace_Recorder::write_chrome_trace(const std::string& filePath) noexcept
+{
+    // copy the ring buffer, to write the file without blocking the recording threads
+    std::vector<Trace_Event> events;
+    {
+        std::scoped_lock lock(_mutex);
+        const size_t eventCount = std::min(_recordedEventCount, _events.size());
+        events.reserve(eventCount);
+        // oldest event first
+        const size_t firstEvent = _recordedEventCount - eventCount;
+        for (size_t i = firstEvent; i < _recordedEventCount; ++i)
+            events.emplace_back(_events[i % _events.size()]);
+    }
+
+    std::ofstream file(filePath);
+    if (not file.is_open())
+    {
+        log_error("Could not open the trace file " + filePath);
+        return false;
+    }
+
+    // complete events ("X"), in microseconds. The names and details are identifiers, they do not need escaping
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool isFirstEvent = true;
+    for (const Trace_Event& event: events)
+    {
+        const std::string_view detail(event._detail.data());
+        file << (isFirstEvent ? "\n" : ",\n")
+             << std::format(R"({{"name":"{}{}{}{}","ph":"X","pid":0,"tid":{},"ts":{:.3f},"dur":{:.3f}}})",
+                            event._name,
+                            detail.empty() ? "" : " (",
+                            detail,
+                            detail.empty() ? "" : ")",
+                            event._threadId,
+                            static_cast<double>(event._start_ns) / 1e3,
+                            static_cast<double>(event._duration_ns) / 1e3);
+        isFirstEvent = false;
+    }
+    file << "\n]}\n";
+
+    if (not file.good())
+    {
+        log_error("Could not write the trace file " + filePath);
+        return false;
+    }
+    log(std::format("Wrote {} trace events to {}", events.size(), filePath));
+    return true;
+}
+
+} // namespace rgbd_slam::outputs
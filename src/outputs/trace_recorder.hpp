@@ -0,0 +1,122 @@
+#ifndef RGBDSLAM_OUTPUTS_TRACE_RECORDER_HPP
+#define RGBDSLAM_OUTPUTS_TRACE_RECORDER_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace rgbd_slam::outputs {
+
+/**
+ * \brief A timed span of a thread, recorded by the trace recorder
+ */
+struct Trace_Event
+{
+    static constexpr size_t detailCapacity = 24;
+
+    const char* _name = nullptr;                 // static string, not copied
+    std::array<char, detailCapacity> _detail {}; // optional precision on the span, truncated
+    uint32_t _threadId = 0;                      // sequential id of the recording thread
+    int64_t _start_ns = 0;                       // since the start of the recording
+    int64_t _duration_ns = 0;
+};
+
+/**
+ * \brief Records the spans of the tracking stages of all the threads in a ring buffer, to be written on demand as a
+ * Chrome trace (readable by chrome://tracing and ui.perfetto.dev). When the buffer is full, the oldest spans are
+ * overwritten. Recording costs nothing but an atomic load while it is not started
+ */
+class Trace_Recorder
+{
+  public:
+    static constexpr size_t defaultEventCapacity = 1 << 16;
+
+    /**
+     * \brief Start a new recording, dropping the previous one
+     * \param[in] eventCapacity Number of spans kept in the ring buffer
+     */
+    static void start(const size_t eventCapacity = defaultEventCapacity) noexcept;
+
+    /**
+     * \brief Stop the recording. The recorded spans are kept until the next start
+     */
+    static void stop() noexcept;
+
+    [[nodiscard]] static bool is_recording() noexcept { return _isRecording.load(std::memory_order_relaxed); }
+
+    /**
+     * \brief Record a span of the calling thread. Ignored if the recording is not started
+     * \param[in] name Name of the span. Must be a static string
+     * \param[in] detail Optional precision on the span (copied)
+     * \param[in] startTime Start of the span
+     * \param[in] endTime End of the span
+     */
+    static void add_event(const char* name,
+                          const std::string_view detail,
+                          const std::chrono::steady_clock::time_point startTime,
+                          const std::chrono::steady_clock::time_point endTime) noexcept;
+
+    /**
+     * \brief Write the spans in the ring buffer to a Chrome trace file (JSON). Can be called during the recording
+     * \param[in] filePath The path of the file to write
+     * \return false if the file could not be written
+     */
+    [[nodiscard]] static bool write_chrome_trace(const std::string& filePath) noexcept;
+
+  private:
+    [[nodiscard]] static uint32_t get_thread_id() noexcept;
+
+    inline static std::atomic<bool> _isRecording = false;
+    inline static std::atomic<uint32_t> _threadCount = 0;
+
+    inline static std::mutex _mutex; // protects the ring buffer
+    inline static std::vector<Trace_Event> _events;
+    inline static size_t _recordedEventCount = 0; // total spans recorded since the start, the buffer keeps the last
+    inline static std::chrono::steady_clock::time_point _startTime;
+};
+
+/**
+ * \brief Record the time spent in a scope as a span of the trace recorder. Does not read the clock when the
+ * recording is not started
+ */
+class Scoped_Trace
+{
+  public:
+    /**
+     * \param[in] name Name of the span. Must be a static string
+     * \param[in] detail Optional precision on the span, like the map of a matching (copied)
+     */
+    explicit Scoped_Trace(const char* name, const std::string_view detail = {}) noexcept :
+        _name(Trace_Recorder::is_recording() ? name : nullptr)
+    {
+        if (_name != nullptr)
+        {
+            _detail = detail;
+            _startTime = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~Scoped_Trace() noexcept
+    {
+        if (_name != nullptr)
+            Trace_Recorder::add_event(_name, _detail, _startTime, std::chrono::steady_clock::now());
+    }
+
+    Scoped_Trace(const Scoped_Trace&) = delete;
+    Scoped_Trace& operator=(const Scoped_Trace&) = delete;
+
+  private:
+    const char* _name;
+    std::string _detail;
+    std::chrono::steady_clock::time_point _startTime;
+};
+
+} // namespace rgbd_slam::outputs
+
+#endif
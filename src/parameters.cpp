@@ -1,8 +1,13 @@
 #include "parameters.hpp"
 #include "angle_utils.hpp"
 #include "camera_transformation.hpp"
+#include "distance_utils.hpp"
 #include "outputs/logger.hpp"
 #include "types.hpp"
+#include <cmath>
+#include <format>
+#include <limits>
+#include <type_traits>
 #include <opencv2/core/core.hpp>
 
 namespace rgbd_slam {
@@ -18,6 +23,9 @@ bool Parameters::parse_file(const std::string& fileName) noexcept
         return false;
     }
 
+    // the tunable parameters missing from the file keep their default value
+    reset_tunable_parameters();
+
     // Load camera 1 parameters
     _camera1ImageSize.x() = int(configFile["camera_1_size_x"]);
     _camera1ImageSize.y() = int(configFile["camera_1_size_y"]);
@@ -48,9 +56,32 @@ bool Parameters::parse_file(const std::string& fileName) noexcept
 
     _camera2toCamera1transformation = utils::get_transformation_matrix(cam2tocam1Rotation, cam2tocam1Translation);
 
+    // Load the tunable performance parameters
+    bool areTunableParametersValid = true;
+    for (const auto& [name, tunableParameter]: get_tunable_registry())
+    {
+        const cv::FileNode& parameterNode = configFile[std::string(name)];
+        if (parameterNode.empty())
+            continue;
+
+        if (not set_tunable_value(tunableParameter, static_cast<double>(parameterNode)))
+        {
+            outputs::log_error(std::format("Invalid value for the tunable parameter {}", name));
+            areTunableParametersValid = false;
+        }
+    }
+    // the constraints between parameters are checked once all of them are read: the key order does not matter
+    if (not are_tunable_parameters_consistent())
+    {
+        outputs::log_error("The tunable parameters are inconsistent: minimum_point_per_frame should be <= "
+                           "maximum_point_per_frame");
+        areTunableParametersValid = false;
+    }
+
     // -------
 
     check_parameters_validity();
+    _isValid = _isValid and areTunableParametersValid;
 
     configFile.release();
     return _isValid;
@@ -71,6 +102,86 @@ void Parameters::load_defaut() noexcept
 
     // Camera 2 position & rotation
     _camera2toCamera1transformation = utils::get_transformation_matrix(quaternion::Identity(), vector3::Zero());
+
+    reset_tunable_parameters();
+}
+
+bool Parameters::set_tunable_parameter(const std::string_view name, const double value) noexcept
+{
+    for (const auto& [parameterName, tunableParameter]: get_tunable_registry())
+    {
+        if (parameterName != name)
+            continue;
+
+        return std::visit(
+                [value](auto* parameter) {
+                    const auto oldValue = parameter->get();
+                    if (not set_tunable_value(parameter, value))
+                        return false;
+
+                    // keep the old value if the new one is inconsistent with the other parameters
+                    if (not are_tunable_parameters_consistent())
+                    {
+                        std::ignore = parameter->set(oldValue);
+                        return false;
+                    }
+                    return true;
+                },
+                tunableParameter);
+    }
+    return false;
+}
+
+bool Parameters::set_tunable_value(const tunable_registry::value_type::second_type& tunableParameter,
+                                   const double value) noexcept
+{
+    return std::visit(
+            [value](auto* parameter) {
+                using value_type = decltype(parameter->get());
+                // integer parameters only take integer values, in the range of their type
+                if constexpr (std::is_integral_v<value_type>)
+                {
+                    if (not utils::double_equal(value, std::floor(value)) or value < 0.0 or
+                        value > static_cast<double>(std::numeric_limits<value_type>::max()))
+                        return false;
+                }
+                return parameter->set(static_cast<value_type>(value));
+            },
+            tunableParameter);
+}
+
+void Parameters::reset_tunable_parameters() noexcept
+{
+    for (const auto& [name, tunableParameter]: get_tunable_registry())
+    {
+        std::visit(
+                [](auto* parameter) {
+                    parameter->reset();
+                },
+                tunableParameter);
+    }
+}
+
+const Parameters::tunable_registry& Parameters::get_tunable_registry() noexcept
+{
+    static const tunable_registry registry {{
+            {"core_number", &_coreNumber},
+            {"maximum_point_per_frame", &_maximumPointPerFrame},
+            {"minimum_point_per_frame", &_minimumPointPerFrame},
+            {"keypoint_refresh_frequency", &_keypointRefreshFrequency},
+            {"target_frame_duration_s", &_targetFrameDuration_s},
+            {"frame_deadline_s", &_frameDeadline_s},
+            {"ransac_probability_of_success", &_ransacProbabilityOfSuccess},
+            {"ransac_inlier_proportion", &_ransacInlierProportion},
+            {"ransac_feature_trust_count", &_ransacFeatureTrustCount},
+            {"ransac_early_stop_inlier_proportion", &_ransacEarlyStopInlierProportion},
+    }};
+    return registry;
+}
+
+bool Parameters::are_tunable_parameters_consistent() noexcept
+{
+    return _minimumPointPerFrame.get() <= _maximumPointPerFrame.get();
 }
 
 void Parameters::check_parameters_validity() noexcept
@@ -118,6 +229,12 @@ void Parameters::check_parameters_validity() noexcept
         _isValid = false;
     }
 
+    if (not are_tunable_parameters_consistent())
+    {
+        outputs::log_error("The minimum point count per frame must be <= to the maximum point count per frame");
+        _isValid = false;
+    }
+
     // static asserts
     static_assert(parameters::coreNumber >= 1, "Number of available computer cores should be >= 1");
     static_assert(parameters::depthSigmaError > 0, "Depth sigma error must be > 0");
@@ -141,6 +258,54 @@ void Parameters::check_parameters_validity() noexcept
                   "The RANSAC expected proportion of inliers must be between 0 and 1");
     static_assert(parameters::optimization::ransac::featureTrustCount > 0,
                   "The RANSAC expected feature trust count should be greater than zero");
+    static_assert(parameters::optimization::ransac::maximumIterationCount > 0,
+                  "The RANSAC maximum iteration count should be greater than zero");
+    static_assert(parameters::optimization::ransac::progressiveSamplingGrowth > 0 and
+                          parameters::optimization::ransac::progressiveSamplingGrowth <= 1,
+                  "The RANSAC progressive sampling growth should be in ]0, 1]");
+    static_assert(parameters::optimization::ransac::matchQualityUncertainty_mm > 0,
+                  "The RANSAC match quality uncertainty should be greater than zero");
+    static_assert(parameters::optimization::ransac::preemptiveScoringBlockSize > 0,
+                  "The RANSAC preemptive scoring block size should be greater than zero");
+    static_assert(parameters::optimization::ransac::minimumPlaneNormalsConditioning > 0 and
+                          parameters::optimization::ransac::minimumPlaneNormalsConditioning < 1,
+                  "The RANSAC minimum plane normals conditioning should be in ]0, 1[");
+
+    static_assert(parameters::optimization::motionPriorWeight >= 0,
+                  "The motion prior weight should be positive");
+    static_assert(parameters::optimization::robustKernelScale > 0,
+                  "The robust kernel scale should be greater than zero");
+
+    static_assert(parameters::optimization::bundleAdjustment::windowSize >= 2,
+                  "The bundle adjustment window should contain at least 2 keyframes");
+    static_assert(parameters::optimization::bundleAdjustment::minimumObservations >= 2 and
+                          parameters::optimization::bundleAdjustment::minimumObservations <=
+                                  parameters::optimization::bundleAdjustment::windowSize,
+                  "The bundle adjustment minimum observations should be in [2, windowSize]");
+    static_assert(parameters::optimization::bundleAdjustment::maximumIterations > 0,
+                  "The bundle adjustment iteration count should be greater than zero");
+    static_assert(parameters::optimization::bundleAdjustment::planeObservationStandardDev_mm > 0,
+                  "The bundle adjustment plane observation standard deviation should be greater than zero");
+
+    static_assert(parameters::optimization::poseGraph::keyframeQueueCapacity > 0,
+                  "Pose graph keyframe queue capacity must be > 0");
+    static_assert(parameters::optimization::poseGraph::maximumPointsPerKeyframe > 0,
+                  "Pose graph keyframe point count must be > 0");
+    static_assert(parameters::optimization::poseGraph::minimumLoopKeyframeGap > 0, "Loop keyframe gap must be > 0");
+    static_assert(parameters::optimization::poseGraph::minimumLoopInliers >= 3, "Loop inlier count must be >= 3");
+    static_assert(parameters::optimization::poseGraph::minimumLoopMatches >=
+                          parameters::optimization::poseGraph::minimumLoopInliers,
+                  "Loop match count must be >= the loop inlier count");
+    static_assert(parameters::optimization::poseGraph::loopRansacIterations > 0, "Loop RANSAC iterations must be > 0");
+    static_assert(parameters::optimization::poseGraph::loopInlierDistance_mm > 0, "Loop inlier distance must be > 0");
+    static_assert(parameters::optimization::poseGraph::odometryTranslationStandardDev_mm > 0 and
+                          parameters::optimization::poseGraph::odometryRotationStandardDev_d > 0,
+                  "Odometry edge standard deviations must be > 0");
+    static_assert(parameters::optimization::poseGraph::loopTranslationStandardDev_mm > 0 and
+                          parameters::optimization::poseGraph::loopRotationStandardDev_d > 0,
+                  "Loop edge standard deviations must be > 0");
+    static_assert(parameters::optimization::poseGraph::maximumIterations > 0,
+                  "Pose graph optimization iterations must be > 0");
 
     static_assert(parameters::optimization::minimumPointForOptimization >= 3,
                   "A pose cannot be computed with less than 3 points");
@@ -156,14 +321,50 @@ void Parameters::check_parameters_validity() noexcept
                   "Keypoint detection width cell size must be > 0");
     static_assert(parameters::detection::keypointRefreshFrequency > 0, "Keypoint refresh frequency must be > 0");
     static_assert(parameters::detection::maximumPointPerFrame > 0, "max keypoint per frames must be > 0");
+    static_assert(parameters::detection::minimumPointPerFrame > 0 and
+                          parameters::detection::minimumPointPerFrame <= parameters::detection::maximumPointPerFrame,
+                  "min keypoint per frames must be in ]0, maximumPointPerFrame]");
+    static_assert(parameters::detection::targetFrameDuration_s > 0, "Target frame duration must be > 0");
+    static_assert(parameters::loadShedding::frameDeadline_s > 0, "Frame deadline must be > 0");
+    static_assert(parameters::loadShedding::recoveryDurationRatio > 0 and
+                          parameters::loadShedding::recoveryDurationRatio < 1,
+                  "Load shedding recovery duration ratio must be in ]0, 1[");
+    static_assert(parameters::loadShedding::recoveryFrameCount > 0, "Load shedding recovery frame count must be > 0");
+    static_assert(parameters::loadShedding::reducedVarianceIterations > 1,
+                  "Reduced pose variance iterations must be > 1");
+    static_assert(parameters::loadShedding::maximumRansacMatches > 0, "Maximum RANSAC match count must be > 0");
+    static_assert(parameters::loadShedding::ransacDurationRatio > 0 and
+                          parameters::loadShedding::ransacDurationRatio <= 1,
+                  "RANSAC duration ratio must be in ]0, 1]");
+    static_assert(parameters::detection::minimumTrackingInlierRatio >= 0 and
+                          parameters::detection::minimumTrackingInlierRatio <= 1,
+                  "Minimum tracking inlier ratio must be in [0, 1]");
     static_assert(parameters::detection::opticalFlowPyramidDepth > 0, "Pyramid depth must be > 0");
     static_assert(parameters::detection::opticalFlowPyramidWindowSizeHeightCount > 0,
                   "Pyramid window count vertical size must be > 0");
     static_assert(parameters::detection::opticalFlowPyramidWindowSizeWidthCount > 0,
                   "Pyramid window count horizontal size must be > 0");
+    static_assert(parameters::detection::opticalFlowGuidedWindowSize_px >= 3,
+                  "Guided optical flow window size must be >= 3");
 
     static_assert(parameters::detection::inverseDepthBaseline > 0, "inverseDepthBaseline should be > 0");
     static_assert(parameters::detection::inverseDepthAngleBaseline > 0, "inverseDepthAngleBaseline should be > 0");
+    static_assert(parameters::detection::inverseDepthUpgradeLinearity > 0,
+                  "inverseDepthUpgradeLinearity should be > 0");
+
+    static_assert(parameters::detection::lineCellDetectionHeightCount > 0,
+                  "Line detection height cell count must be > 0");
+    static_assert(parameters::detection::lineCellDetectionWidthCount > 0,
+                  "Line detection width cell count must be > 0");
+    static_assert(parameters::detection::maximumPlaneCoverageForLineDetection >= 0 and
+                          parameters::detection::maximumPlaneCoverageForLineDetection <= 1,
+                  "Maximum plane coverage for line detection must be in [0, 1]");
+    static_assert(parameters::detection::lineDepthSampleStep_px > 0, "Line depth sample step must be > 0");
+    static_assert(parameters::detection::minimumLineDepthProportion > 0 and
+                          parameters::detection::minimumLineDepthProportion <= 1,
+                  "Minimum line depth proportion must be in ]0, 1]");
+    static_assert(parameters::detection::maximumLineDepthRelativeError > 0,
+                  "Maximum line depth relative error must be > 0");
 
     static_assert(parameters::detection::minimumPlaneSeedProportion >= 0 and
                           parameters::detection::minimumPlaneSeedProportion <= 100,
@@ -180,6 +381,11 @@ void Parameters::check_parameters_validity() noexcept
     static_assert(parameters::detection::minimumCellActivatedProportion >= 0 and
                           parameters::detection::minimumCellActivatedProportion <= 100,
                   "Minimum cell activated proportion must be in [0, 100]");
+    static_assert(parameters::detection::depthMapCoarsePatchFactor > 0, "Coarse patch factor must be > 0");
+    static_assert(parameters::detection::farRangeCellDepth_mm > 0, "Far range cell depth must be > 0");
+    static_assert(parameters::detection::farRangeCellSampleStep_px > 0, "Far range cell sample step must be > 0");
+    static_assert(parameters::detection::farRangeCellSampleStep_px <= parameters::detection::depthMapPatchSize_px,
+                  "Far range cell sample step must be less than the depth map patch size");
 
     static_assert(parameters::detection::cylinderRansacSqrtMaxDistance > 0, "Cylinder RANSAC max distance must be > 0");
     static_assert(parameters::detection::cylinderRansacMinimumScore > 0, "Cylinder RANSAC minimum score must be > 0");
@@ -198,13 +404,73 @@ void Parameters::check_parameters_validity() noexcept
                   "Maximum plane match distance must be greater than zero");
 
     static_assert(parameters::matching::matchSearchRadius_px > 0, "Match search radius must be > 0");
+    static_assert(parameters::matching::minimumMatchSearchRadius_px > 0, "Minimum match search radius must be > 0");
+    static_assert(parameters::matching::minimumMatchSearchRadius_px <= parameters::matching::matchSearchRadius_px,
+                  "Minimum match search radius must be <= matchSearchRadius_px");
+    static_assert(parameters::matching::matchSearchRadiusSigmaFactor > 0, "matchSearchRadiusSigmaFactor must be > 0");
+    static_assert(parameters::matching::matchSearchReferenceDepth_mm > 0, "matchSearchReferenceDepth_mm must be > 0");
     static_assert(parameters::matching::maximumMatchDistance > 0, "Minimum match distance must be > 0");
 
+    static_assert(parameters::matching::relocalization::invertedFileCount > 0,
+                  "Relocalization inverted file count must be > 0");
+    static_assert(parameters::matching::relocalization::wordBitCount > 0 and
+                          parameters::matching::relocalization::wordBitCount <= 32,
+                  "Relocalization word bit count must be in [1, 32]");
+    static_assert(parameters::matching::relocalization::maximumCandidatesPerQuery > 0,
+                  "Relocalization candidate count must be > 0");
+    static_assert(parameters::matching::relocalization::minimumDescriptorSimilarity >= 0 and
+                          parameters::matching::relocalization::minimumDescriptorSimilarity <= 1,
+                  "Relocalization descriptor similarity must be in [0, 1]");
+    static_assert(parameters::matching::relocalization::maximumDistanceRatio > 0 and
+                          parameters::matching::relocalization::maximumDistanceRatio <= 1,
+                  "Relocalization distance ratio must be in ]0, 1]");
+
+    static_assert(parameters::imu::gyroscopeNoiseDensity >= 0, "gyroscopeNoiseDensity must be >= 0");
+    static_assert(parameters::imu::gyroscopeBiasStandardDev >= 0, "gyroscopeBiasStandardDev must be >= 0");
+    static_assert(parameters::imu::predictionTranslationStandardDev_mm >= 0,
+                  "predictionTranslationStandardDev_mm must be >= 0");
+
     static_assert(parameters::mapping::pointUnmatchedCountToLoose > 0,
                   "Unmatched points to loose tracking must be > 0");
     static_assert(parameters::mapping::pointStagedAgeConfidence > 0, "Staged point confidence must be > 0");
     static_assert(parameters::mapping::pointMinimumConfidenceForMap > 0,
                   "Minimum confidence to add staged point to map  must be > 0");
+    static_assert(parameters::mapping::spatialIndexVoxelSize_mm > 0, "Spatial index voxel size must be > 0");
+    static_assert(parameters::mapping::maximumStagedPointCount == 0 or
+                          parameters::mapping::maximumStagedPointCount >=
+                                  parameters::mapping::stagedPointAdmissionBudget,
+                  "The staged point capacity must hold the points staged by a frame");
+    static_assert(parameters::mapping::admissionCoverageCellCount > 0, "Admission coverage cell count must be > 0");
+
+    static_assert(parameters::mapping::keyframe::maximumFrameGap > 0, "Maximum frames between keyframes must be > 0");
+    static_assert(parameters::mapping::keyframe::minimumTranslation_mm >= 0,
+                  "Keyframe minimum translation must be positive");
+    static_assert(parameters::mapping::keyframe::minimumRotation_d >= 0, "Keyframe minimum rotation must be positive");
+    static_assert(parameters::mapping::keyframe::minimumMatchOverlap >= 0 and
+                          parameters::mapping::keyframe::minimumMatchOverlap <= 1,
+                  "Keyframe minimum match overlap must be in [0, 1]");
+    static_assert(parameters::mapping::keyframe::translationUncertaintyFactor >= 0,
+                  "Keyframe translation uncertainty factor must be positive");
+    static_assert(parameters::mapping::globalMap::tileSize_mm > 0, "Map tile size must be > 0");
+    static_assert(parameters::mapping::globalMap::pageInDistance_mm >= 0, "Map page in distance must be positive");
+    static_assert(parameters::mapping::denseReconstruction::voxelSize_mm > 0, "Dense voxel size must be > 0");
+    static_assert(parameters::mapping::denseReconstruction::truncationDistance_mm >=
+                          parameters::mapping::denseReconstruction::voxelSize_mm,
+                  "Dense truncation distance must be at least a voxel size");
+    static_assert(parameters::mapping::denseReconstruction::maximumDepth_mm > 0, "Dense maximum depth must be > 0");
+    static_assert(parameters::mapping::denseReconstruction::pixelStride > 0, "Dense pixel stride must be > 0");
+    static_assert(parameters::mapping::denseReconstruction::maximumVoxelWeight >= 1.0f,
+                  "Dense maximum voxel weight must be >= 1");
+    static_assert(parameters::mapping::denseReconstruction::maximumBlockCount > 0,
+                  "Dense maximum block count must be > 0");
+    static_assert(parameters::mapping::denseReconstruction::finishedBlockFrameCount > 0,
+                  "Dense finished block frame count must be > 0");
+    static_assert(parameters::mapping::denseReconstruction::frameQueueCapacity > 0,
+                  "Dense frame queue capacity must be > 0");
+    static_assert(parameters::mapping::globalMap::initialRecordCapacity > 0,
+                  "Map tile store initial capacity must be > 0");
+
+    static_assert(parameters::display::debugOverlayRefreshRate_Hz > 0, "Debug overlay refresh rate must be > 0");
 }
 
 }; // namespace rgbd_slam
@@ -3,12 +3,20 @@
 
 #include "types.hpp"
 #include <Eigen/src/Core/Matrix.h>
+#include <array>
+#include <atomic>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
 
 namespace rgbd_slam {
 
 namespace parameters {
 constexpr uint coreNumber = 8; // number of available cores on the computer (1 for no threads)
+constexpr uint maximumThreadsPerCore =
+        0; // threads of the task scheduler per core: 1 keeps them off the hyperthreads (0 for no limit, needs the
+           // TBB_PREVIEW_TASK_ARENA_CONSTRAINTS_EXTENSION definition on the oneTBB versions where it is a preview)
 
 // Parameters taken from "2012 - 3D with Kinect""
 // parameters of equation z_diff = sigmaA + sigmaM * z + sigmaE * z^2, that represent the minimum depth
@@ -35,8 +43,68 @@ constexpr double minimumInliersProportionForEarlyStop =
 constexpr float probabilityOfSuccess = 0.8f; // probability of having at least one correct transformation
 constexpr float inlierProportion = 0.65f;    // number of inliers in data / number of matched features
 constexpr float featureTrustCount = 10.0;    // number of expected features expected to pass the test
+constexpr uint maximumIterationCount =
+        2000; // cap of the iteration count computed from the parameters above (they can be tuned at runtime)
+
+// progressive sampling (PROSAC) and preemptive scoring
+constexpr bool useProgressiveSampling = true; // draw the subsets from the best quality matches first, uniformly if false
+constexpr double progressiveSamplingGrowth =
+        0.5; // proportion of the maximum iterations after which the progressive sampling draws from all the matches
+constexpr double matchQualityUncertainty_mm =
+        10.0; // map feature standard deviation (millimeters) at which the quality of a match is halved
+constexpr uint preemptiveScoringBlockSize =
+        16; // matches scored by each hypothesis of a batch before the worst half of them is dropped
+
+// minimal solvers
+constexpr bool useMinimalSolvers =
+        true; // compute the hypotheses of point only or plane only subsets in closed form, with LM if false
+constexpr double minimumPlaneNormalsConditioning =
+        0.2; // smallest singular value of the normals of a plane subset, under which it cannot constrain a pose
 } // namespace ransac
 
+// robust refinement of the final pose (iteratively reweighted least squares)
+constexpr uint robustRefinementIterations =
+        3; // reweighting passes of the pose optimization on the final inliers, 0 for plain least squares
+constexpr bool useCauchyKernel = false; // robust kernel of the reweighting passes: Cauchy if true, Huber if false
+constexpr double robustKernelScale =
+        1.345; // residual, in standard deviations, over which the robust kernel reduces the residual weight
+
+constexpr double motionPriorWeight =
+        1.0; // weight of the predicted pose prior in the final pose refinement, relative to the features (0 to disable)
+
+constexpr bool useAnalyticPoseCovariance =
+        true; // first order pose covariance from the optimization jacobian, Monte Carlo sampling of the matches if false
+
+// sliding window bundle adjustment of the keyframes and of the map features, on a background thread
+namespace bundleAdjustment {
+constexpr bool isEnabled = true; // refine the last keyframes and the map points and planes they observe
+constexpr uint windowSize = 6;   // keyframes refined together, the oldest one having a fixed pose
+constexpr uint minimumObservations =
+        2; // keyframes of the window that must observe a map feature before it is refined
+constexpr uint maximumIterations = 10; // Levenberg-Marquardt iterations of a window refinement
+constexpr double planeObservationStandardDev_mm =
+        10.0; // standard deviation of the observed planes reduced parameters (d.n), in millimeters
+} // namespace bundleAdjustment
+
+// loop closing backend: pose graph of the keyframes, optimized on a background thread when a loop is detected
+namespace poseGraph {
+constexpr bool isEnabled = true;            // detect the loops and correct the drift of the trajectory
+constexpr uint keyframeQueueCapacity = 8;   // keyframes waiting for the pose graph thread before they are dropped
+constexpr uint maximumPointsPerKeyframe = 300; // keypoints of a keyframe used for the loop detection, at most
+constexpr uint minimumLoopKeyframeGap = 30; // keyframes between two keyframes before they can close a loop
+constexpr uint minimumLoopMatches = 30;     // descriptor matches with an old keyframe before testing a loop
+constexpr uint minimumLoopInliers = 20;     // 3D matches consistent with the loop relative pose to close a loop
+constexpr uint loopRansacIterations = 200;  // RANSAC iterations of the loop relative pose
+constexpr double loopInlierDistance_mm = 50.0; // distance of a matched 3D point to the loop to be an inlier
+constexpr double odometryTranslationStandardDev_mm =
+        10.0; // standard deviation of the tracked translation between two keyframes
+constexpr double odometryRotationStandardDev_d =
+        1.0; // standard deviation of the tracked rotation between two keyframes (degrees)
+constexpr double loopTranslationStandardDev_mm = 20.0; // standard deviation of a loop relative translation
+constexpr double loopRotationStandardDev_d = 2.0; // standard deviation of a loop relative rotation (degrees)
+constexpr uint maximumIterations = 10;            // Gauss-Newton iterations of a pose graph optimization
+} // namespace poseGraph
+
 constexpr uint minimumPointForOptimization = 5; // Should be >= 3, the minimum point count for a 3D pose estimation
 constexpr uint minimumPoint2dForOptimization =
         5; // 2d points can be insufficiant for pose optimization, for now we ignore this
@@ -52,6 +120,11 @@ constexpr uint keypointCellDetectionHeightCount = 3; // the number of the keypoi
 constexpr uint keypointCellDetectionWidthCount = 3;  // the number of the keypoint detection windows in width
 constexpr uint maximumPointPerFrame = 100; // maximum points per frame, over which we do not want to detect more points
 constexpr uint keypointRefreshFrequency = 5; // force update the keypoint list every N calls (opti)
+constexpr uint minimumPointPerFrame = 40;    // the adaptive keypoint budget never goes below this point count
+constexpr double targetFrameDuration_s =
+        1.0 / 30.0; // frame treatment duration that the adaptive keypoint budget tries to hold, in seconds
+constexpr double minimumTrackingInlierRatio =
+        0.6; // under this inlier ratio, the keypoint budget grows whatever the frame treatment duration
 
 // point tracking
 constexpr uint opticalFlowPyramidDepth =
@@ -59,10 +132,14 @@ constexpr uint opticalFlowPyramidDepth =
 constexpr uint opticalFlowPyramidWindowSizeHeightCount = 9; // search size window count (vertical) at each pyramid level
 constexpr uint opticalFlowPyramidWindowSizeWidthCount =
         12; // search size window count (horizontal) at each pyramid level
+constexpr uint opticalFlowGuidedWindowSize_px =
+        15; // search window size of the optical flow started from the positions predicted with the map, in pixels
 
 // inverse depth
 constexpr double inverseDepthBaseline = 1.0 / 1000.0; // baseline of the inverse depth, in 1/millimeters
 constexpr double inverseDepthAngleBaseline = 0.5;     // baseline of the inverse depth measurment angles, in degrees
+constexpr double inverseDepthUpgradeLinearity =
+        0.1; // inverse depth points are upgraded to 3D points under this linearity index (proportion)
 
 // plane detection
 constexpr double minimumPlaneSeedProportion =
@@ -78,12 +155,29 @@ constexpr float maximumPlaneDistanceForMerge_mm =
         50.0; // plane patched can be merged if their distances is below this distance (millimeters)
 constexpr uint depthMapPatchSize_px =
         20; // Divide the depth image in patches of this size (pixels) to detect primitives
+constexpr uint depthMapCoarsePatchFactor =
+        2; // Fit planes on coarse patches of this many patches per side first, and only fit the patches themselves
+           // near the coarse plane boundaries (1 to disable)
+constexpr float farRangeCellDepth_mm =
+        4000.0f; // cells farther than this mean depth are mostly quantization noise: fit them on a subsample
+constexpr uint farRangeCellSampleStep_px = 2; // sample one pixel every this many rows and columns in far range cells
 
 // Cylinder ransac fitting
 constexpr float cylinderRansacSqrtMaxDistance = 0.04f;
 constexpr float cylinderRansacMinimumScore = 75;
 constexpr float cylinderRansacInlierProportions = 0.33f;
 constexpr float cylinderRansacProbabilityOfSuccess = 0.8f;
+
+// line detection
+constexpr uint lineCellDetectionHeightCount = 4; // the number of the line detection windows in height
+constexpr uint lineCellDetectionWidthCount = 4;  // the number of the line detection windows in width
+constexpr double maximumPlaneCoverageForLineDetection =
+        0.9; // line detection windows covered by detected planes above this proportion are not searched
+constexpr double lineDepthSampleStep_px = 2.0; // distance between two depth samples along a detected line, in pixels
+constexpr double minimumLineDepthProportion =
+        0.5; // lines with less than this proportion of samples with a valid depth are not lifted to 3D
+constexpr double maximumLineDepthRelativeError =
+        0.05; // depth samples further than this proportion of their depth from the fitted 3D line are outliers
 } // namespace detection
 
 namespace matching {
@@ -95,10 +189,48 @@ constexpr double maximumDistanceForPlaneMatch_mm =
         100; // Maximum distance between two plane d component to consider a match (millimeters)
 
 constexpr double matchSearchRadius_px = 30;  // Radius of the space around a point to search match points in pixels
+constexpr double minimumMatchSearchRadius_px =
+        10.0; // search radius of the matches when the motion is predicted by the gyroscope, at least (pixels)
+constexpr double matchSearchRadiusSigmaFactor =
+        3.0; // the search radius of a predicted motion covers this many standard deviations of its reprojection
+constexpr double matchSearchReferenceDepth_mm =
+        2000.0; // depth at which the predicted translation uncertainty is converted to a search radius
 constexpr double maximumMatchDistance = 0.7; // Maximum distance between a point and his mach before refusing the
                                              // match (closer to zero = more discriminating)
+
+// descriptor only matching of the map points, to relocalize when the tracking is lost
+namespace relocalization {
+constexpr uint invertedFileCount = 6; // inverted files of the index, each with its own words (more finds more matches)
+constexpr uint wordBitCount = 12;     // descriptor bits sampled by a word (4096 words per inverted file)
+constexpr size_t maximumCandidatesPerQuery = 32; // map points compared to each detected keypoint, at most
+constexpr double minimumDescriptorSimilarity = 0.8; // fraction of identical descriptor bits to accept a match
+constexpr double maximumDistanceRatio =
+        0.8; // the best match descriptor distance must be under this ratio of the second best one
+} // namespace relocalization
 } // namespace matching
 
+// gyroscope samples, used to predict the rotation between two frames
+namespace imu {
+constexpr double gyroscopeNoiseDensity = 1.7e-4;  // white noise of the angular velocity (radians/s/sqrt(Hz))
+constexpr double gyroscopeBiasStandardDev = 5e-3; // unmodeled bias of the angular velocity (radians/s)
+constexpr double predictionTranslationStandardDev_mm =
+        10.0; // translation uncertainty added to a pose predicted with the gyroscope (not measured)
+} // namespace imu
+
+// overload controller: degrades the frame quality in steps to hold a frame deadline
+namespace loadShedding {
+constexpr bool isEnabled = true; // skip or reduce tracking stages when the frames are slower than the deadline
+constexpr double frameDeadline_s =
+        1.5 / 30.0; // frame treatment duration over which the next frames are degraded, in seconds
+constexpr double recoveryDurationRatio =
+        0.7; // proportion of the deadline under which the frames count toward going back to a better quality
+constexpr uint recoveryFrameCount = 30; // consecutive fast frames before going back one quality level
+constexpr uint reducedVarianceIterations = 20; // Monte Carlo pose variance iterations of the degraded frames
+constexpr uint maximumRansacMatches = 150;     // best matches fed to the RANSAC of the degraded frames
+constexpr double ransacDurationRatio =
+        0.3; // proportion of the deadline after which the RANSAC stops drawing hypotheses, for all the frames
+} // namespace loadShedding
+
 namespace mapping {
 // local map management
 constexpr uint pointUnmatchedCountToLoose =
@@ -107,10 +239,95 @@ constexpr uint planeUnmatchedCountToLoose =
         10; // consecutive unmatched frames before removing from local map (high is good, but consumes more perfs);
 constexpr uint pointStagedAgeConfidence = 3;         // Minimum age of a point in staged map to consider it good
 constexpr double pointMinimumConfidenceForMap = 0.9; // Minimum confidence of a staged point to add it to local map
+constexpr double spatialIndexVoxelSize_mm =
+        500.0; // side of the voxels of the map spatial index: only the voxels in the camera frustum are matched
+// staged map admission: a frame stages its best unmatched points, spread over the image, in a bounded staged map
+constexpr size_t stagedPointAdmissionBudget =
+        100; // points (and 2D points) staged by a tracked frame, 0 for all of them. Not applied when the map restarts
+constexpr size_t maximumStagedPointCount =
+        1000; // staged points (and 2D points) over which the least confident unmatched ones are evicted, 0 for no limit
+constexpr uint admissionCoverageCellCount = 8; // admission coverage cells in each image direction
+constexpr uint memoryMeasurementPeriod =
+        30; // frames between two measures of the map memory, the frames in between report the last measure
+
+// keyframe selection: only the keyframes update the map, the other frames are only tracked
+namespace keyframe {
+constexpr uint maximumFrameGap = 30; // tracked frames after which a keyframe is forced, even if the camera is idle
+constexpr double minimumTranslation_mm = 50.0; // translation from the last keyframe that triggers a new keyframe
+constexpr double minimumRotation_d = 5.0;      // rotation from the last keyframe that triggers a new keyframe (degrees)
+constexpr double minimumMatchOverlap =
+        0.7; // proportion of the map features matched by the last keyframe that must still be matched
+constexpr double translationUncertaintyFactor =
+        3.0; // translations under this many standard deviations of the pose position are considered tracking noise
+} // namespace keyframe
+
+// out of core storage of the map points lost by the local map, paged back in when their area is visible again
+namespace globalMap {
+constexpr double tileSize_mm = 2000.0;         // side of the tiles of the stored points
+constexpr double pageInDistance_mm = 6000.0;   // visible tiles closer than this to the camera are loaded back
+constexpr size_t initialRecordCapacity = 4096; // records of the tile store file at creation (doubles when full)
+} // namespace globalMap
+
+// optional dense reconstruction of the tracked depth frames in a truncated signed distance field, on its own thread
+namespace denseReconstruction {
+constexpr double voxelSize_mm = 20.0; // side of the voxels of the distance field
+constexpr double truncationDistance_mm =
+        80.0; // distance to the observed surface over which the signed distance is truncated
+constexpr double maximumDepth_mm = 4000.0; // depth measures further than this are not integrated
+constexpr uint pixelStride = 2; // integrate one depth pixel out of pixelStride, in each image direction
+constexpr float maximumVoxelWeight = 64.0f; // observation weight of a voxel, over which the old measures fade out
+constexpr size_t maximumBlockCount =
+        20000; // allocated blocks of 8^3 voxels (8 bytes each), over which the farthest blocks are finished
+constexpr uint finishedBlockFrameCount =
+        60; // integrated frames that do not observe a block, after which its mesh is extracted and it is freed
+constexpr size_t frameQueueCapacity = 4; // tracked frames waiting for their integration, the next ones are dropped
+} // namespace denseReconstruction
 } // namespace mapping
 
+namespace display {
+constexpr double debugOverlayRefreshRate_Hz =
+        10.0; // renders per second of the debug feature overlay, when it is drawn by the rendering thread
+} // namespace display
+
 } // namespace parameters
 
+/**
+ * \brief A performance parameter that can be changed while the program runs, in a range of valid values.
+ * It can be read from any thread: read it once per treatment, another thread can change it in the meantime
+ */
+template<typename T> class Tunable_Parameter
+{
+  public:
+    constexpr Tunable_Parameter(const T defaultValue, const T minimum, const T maximum) noexcept :
+        _value(defaultValue),
+        _defaultValue(defaultValue),
+        _minimum(minimum),
+        _maximum(maximum)
+    {
+    }
+
+    [[nodiscard]] T get() const noexcept { return _value.load(std::memory_order_relaxed); }
+
+    /**
+     * \return false if the value is out of the valid range, the parameter is not modified
+     */
+    [[nodiscard]] bool set(const T value) noexcept
+    {
+        if (not(value >= _minimum and value <= _maximum))
+            return false;
+        _value.store(value, std::memory_order_relaxed);
+        return true;
+    }
+
+    void reset() noexcept { _value.store(_defaultValue, std::memory_order_relaxed); }
+
+  private:
+    std::atomic<T> _value;
+    const T _defaultValue;
+    const T _minimum;
+    const T _maximum;
+};
+
 /**
  * \brief Store all parameters of this SLAM program.
  * It should be used as a static class everywhere in the program.
@@ -127,7 +344,7 @@ class Parameters
     [[nodiscard]] static bool parse_file(const std::string& fileName) noexcept;
 
     /**
-     * \brief Set the default camera parameters
+     * \brief Set the default camera and tunable parameters
      */
     static void load_defaut() noexcept;
 
@@ -168,6 +385,40 @@ class Parameters
         return _camera2toCamera1transformation;
     }
 
+    // Performance parameters, tunable per device: loaded from the configuration file (with the names of the
+    // registry), and adjustable at runtime. Their default values are the constants of the parameters namespace
+    [[nodiscard]] static uint get_core_number() noexcept { return _coreNumber.get(); }
+    [[nodiscard]] static uint get_maximum_point_per_frame() noexcept { return _maximumPointPerFrame.get(); }
+    [[nodiscard]] static uint get_minimum_point_per_frame() noexcept { return _minimumPointPerFrame.get(); }
+    [[nodiscard]] static uint get_keypoint_refresh_frequency() noexcept { return _keypointRefreshFrequency.get(); }
+    [[nodiscard]] static double get_target_frame_duration() noexcept { return _targetFrameDuration_s.get(); }
+    [[nodiscard]] static double get_frame_deadline() noexcept { return _frameDeadline_s.get(); }
+    [[nodiscard]] static double get_ransac_probability_of_success() noexcept
+    {
+        return _ransacProbabilityOfSuccess.get();
+    }
+    [[nodiscard]] static double get_ransac_inlier_proportion() noexcept { return _ransacInlierProportion.get(); }
+    [[nodiscard]] static double get_ransac_feature_trust_count() noexcept { return _ransacFeatureTrustCount.get(); }
+    [[nodiscard]] static double get_ransac_early_stop_inlier_proportion() noexcept
+    {
+        return _ransacEarlyStopInlierProportion.get();
+    }
+
+    /**
+     * \brief Change a tunable parameter while the program runs
+     * \param[in] name The name of the parameter in the registry, as in the configuration file
+     * \param[in] value The new value. Must be an integer for the integer parameters
+     * \return false if there is no parameter of this name, or if the value is invalid: the parameter is not modified.
+     * Should be called by a single thread at a time. The parameters are process wide: this changes the parameter of
+     * all the SLAM instances
+     */
+    [[nodiscard]] static bool set_tunable_parameter(const std::string_view name, const double value) noexcept;
+
+    /**
+     * \brief Set the default value of all the tunable parameters
+     */
+    static void reset_tunable_parameters() noexcept;
+
   private:
     // Is this set of parameters valid
     inline static bool _isValid = false;
@@ -184,6 +435,47 @@ class Parameters
     // Camera 2 position and rotation to go to camera 1
     inline static matrix44 _camera2toCamera1transformation;
 
+    // Tunable performance parameters
+    inline static Tunable_Parameter<uint> _coreNumber {parameters::coreNumber, 1, 1024};
+    inline static Tunable_Parameter<uint> _maximumPointPerFrame {parameters::detection::maximumPointPerFrame, 1, 10000};
+    inline static Tunable_Parameter<uint> _minimumPointPerFrame {parameters::detection::minimumPointPerFrame, 1, 10000};
+    inline static Tunable_Parameter<uint> _keypointRefreshFrequency {
+            parameters::detection::keypointRefreshFrequency, 1, 1000};
+    inline static Tunable_Parameter<double> _targetFrameDuration_s {
+            parameters::detection::targetFrameDuration_s, 1e-3, 10.0};
+    inline static Tunable_Parameter<double> _frameDeadline_s {parameters::loadShedding::frameDeadline_s, 1e-3, 10.0};
+    inline static Tunable_Parameter<double> _ransacProbabilityOfSuccess {
+            parameters::optimization::ransac::probabilityOfSuccess, 0.01, 0.9999};
+    inline static Tunable_Parameter<double> _ransacInlierProportion {
+            parameters::optimization::ransac::inlierProportion, 0.01, 0.99};
+    inline static Tunable_Parameter<double> _ransacFeatureTrustCount {
+            parameters::optimization::ransac::featureTrustCount, 1.0, 100.0};
+    inline static Tunable_Parameter<double> _ransacEarlyStopInlierProportion {
+            parameters::optimization::ransac::minimumInliersProportionForEarlyStop, 0.0, 1.0};
+
+    using tunable_registry = std::array<
+            std::pair<std::string_view, std::variant<Tunable_Parameter<uint>*, Tunable_Parameter<double>*>>,
+            10>;
+
+    /**
+     * \brief The tunable parameters, by name
+     */
+    [[nodiscard]] static const tunable_registry& get_tunable_registry() noexcept;
+
+    /**
+     * \return true if the tunable parameters are consistent with each other
+     */
+    [[nodiscard]] static bool are_tunable_parameters_consistent() noexcept;
+
+    /**
+     * \brief Change a tunable parameter, without checking its consistency with the other parameters
+     * \param[in] tunableParameter The parameter to change, from the registry
+     * \param[in] value The new value. Must be an integer for the integer parameters
+     * \return false if the value is invalid: the parameter is not modified
+     */
+    [[nodiscard]] static bool set_tunable_value(const tunable_registry::value_type::second_type& tunableParameter,
+                                                const double value) noexcept;
+
     /**
      * \brief Update the _isValid attribute
      */
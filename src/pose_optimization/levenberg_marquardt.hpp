@@ -0,0 +1,165 @@
+#ifndef RGBDSLAM_POSEOPTIMIZATION_LEVENBERGMARQUARDT_HPP
+#define RGBDSLAM_POSEOPTIMIZATION_LEVENBERGMARQUARDT_HPP
+
+#include "types.hpp"
+
+#include <Eigen/Cholesky>
+#include <cmath>
+#include <limits>
+#include <unsupported/Eigen/NonLinearOptimization>
+
+namespace rgbd_slam::pose_optimization {
+
+/**
+ * \brief A Levenberg-Marquardt solver with a compile time parameter count.
+ * The normal equations are solved in fixed size matrices, and the residuals and jacobian are written in thread local
+ * buffers that only grow: after the first solves, a minimization makes no heap allocations.
+ * The functor must provide values(), operator()(x, Eigen::Ref<vectorxd>) and df(x, Eigen::Ref<matrixd>).
+ * \tparam Functor The functor that computes the residuals and their jacobian
+ * \tparam NX The number of optimized parameters
+ */
+template<typename Functor, int NX> class Levenberg_Marquardt
+{
+  public:
+    using InputType = Eigen::Vector<double, NX>;
+    using Status = Eigen::LevenbergMarquardtSpace::Status;
+
+    // the tolerances of the Eigen Levenberg-Marquardt implementation
+    struct Parameters
+    {
+        double ftol = std::sqrt(std::numeric_limits<double>::epsilon());
+        double xtol = std::sqrt(std::numeric_limits<double>::epsilon());
+        double gtol = 0.0;
+        double initialDamping = 1e-3;
+        uint maxfev = 400;
+    };
+
+    /**
+     * \param[in] functor The functor to minimize. Must outlive this object
+     */
+    explicit Levenberg_Marquardt(Functor& functor) : _functor(functor) {}
+
+    Parameters parameters;
+
+    /**
+     * \brief The number of residual evaluations of the last minimization
+     */
+    [[nodiscard]] uint get_function_evaluation_count() const noexcept { return _functionEvaluations; }
+
+    /**
+     * \brief The damping factor at the end of the last minimization, to warm start the next one
+     */
+    [[nodiscard]] double get_damping() const noexcept { return _damping; }
+
+    /**
+     * \brief Minimize the sum of squared residuals of the functor
+     * \param[in, out] x The initial parameters, and the optimized parameters on success
+     * \return The end status of the minimization, with the same meaning as the Eigen Levenberg-Marquardt status
+     */
+    [[nodiscard]] Status minimize(InputType& x) noexcept
+    {
+        const Eigen::Index valueCount = static_cast<Eigen::Index>(_functor.values());
+        _functionEvaluations = 0;
+        if (valueCount < NX)
+            return Status::ImproperInputParameters;
+
+        Workspace& workspace = get_workspace(valueCount);
+        auto residuals = workspace._residuals.head(valueCount);
+        auto candidateResiduals = workspace._candidateResiduals.head(valueCount);
+        auto jacobian = workspace._jacobian.topRows(valueCount);
+
+        if (_functor(x, residuals) < 0)
+            return Status::UserAsked;
+        ++_functionEvaluations;
+        double cost = residuals.squaredNorm();
+
+        Eigen::Matrix<double, NX, NX> hessian;
+        InputType gradient;
+        const auto linearize = [&]() {
+            jacobian.setZero();
+            _functor.df(x, jacobian);
+            hessian.noalias() = jacobian.transpose() * jacobian;
+            gradient.noalias() = jacobian.transpose() * residuals;
+        };
+        linearize();
+
+        // Marquardt scaling of the damping by the diagonal of the hessian
+        _damping = parameters.initialDamping;
+        double dampingGrowth = 2.0;
+        while (_functionEvaluations < parameters.maxfev)
+        {
+            if (gradient.template lpNorm<Eigen::Infinity>() <= parameters.gtol)
+                return Status::CosinusTooSmall;
+
+            Eigen::Matrix<double, NX, NX> dampedHessian = hessian;
+            dampedHessian.diagonal() +=
+                    _damping * hessian.diagonal().cwiseMax(std::numeric_limits<double>::epsilon());
+            const InputType& step = dampedHessian.ldlt().solve(-gradient);
+            if (not step.allFinite())
+                return Status::ImproperInputParameters;
+
+            if (step.norm() <= parameters.xtol * (x.norm() + parameters.xtol))
+                return Status::RelativeErrorTooSmall;
+
+            const InputType& candidate = x + step;
+            if (_functor(candidate, candidateResiduals) < 0)
+                return Status::UserAsked;
+            ++_functionEvaluations;
+            const double candidateCost = candidateResiduals.squaredNorm();
+
+            // ratio of the actual cost reduction over the reduction predicted by the linear model
+            const double predictedReduction = -step.dot(2.0 * gradient + hessian * step);
+            const double gainRatio = predictedReduction > 0.0 ? (cost - candidateCost) / predictedReduction : -1.0;
+            if (gainRatio > 0.0 and std::isfinite(candidateCost))
+            {
+                const double relativeReduction = (cost - candidateCost) / std::max(cost, parameters.ftol);
+                x = candidate;
+                residuals.swap(candidateResiduals);
+                cost = candidateCost;
+                if (relativeReduction <= parameters.ftol)
+                    return Status::RelativeReductionTooSmall;
+
+                linearize();
+                _damping *= std::max(1.0 / 3.0, 1.0 - std::pow(2.0 * gainRatio - 1.0, 3));
+                dampingGrowth = 2.0;
+            }
+            else
+            {
+                _damping *= dampingGrowth;
+                dampingGrowth *= 2.0;
+            }
+        }
+        return Status::TooManyFunctionEvaluation;
+    }
+
+  private:
+    struct Workspace
+    {
+        vectorxd _residuals;
+        vectorxd _candidateResiduals;
+        Eigen::Matrix<double, Eigen::Dynamic, NX> _jacobian;
+    };
+
+    /**
+     * \brief Get the buffers of this thread, grown to hold at least the given residual count
+     */
+    [[nodiscard]] static Workspace& get_workspace(const Eigen::Index valueCount) noexcept
+    {
+        thread_local Workspace workspace;
+        if (workspace._residuals.size() < valueCount)
+        {
+            workspace._residuals.resize(valueCount);
+            workspace._candidateResiduals.resize(valueCount);
+            workspace._jacobian.resize(valueCount, NX);
+        }
+        return workspace;
+    }
+
+    Functor& _functor;
+    uint _functionEvaluations = 0;
+    double _damping = 0.0;
+};
+
+} // namespace rgbd_slam::pose_optimization
+
+#endif
@@ -1,6 +1,7 @@
 #include "levenberg_marquardt_functors.hpp"
 #include "logger.hpp"
 #include "matches_containers.hpp"
+#include "parameters.hpp"
 #include "pose.hpp"
 #include "types.hpp"
 #include "utils/camera_transformation.hpp"
@@ -51,17 +52,17 @@ Eigen::Matrix<double, 4, 3> get_quaternion_from_optimization_coefficients_jacobi
 
     const double multiplierDiag = -4.0 / SQR(theta5);
 
-    jacobian(0, 0) = 2.0 / theta5 - SQR(optCoeff.x()) * multiplierDiag;
+    jacobian(0, 0) = 2.0 / theta5 + SQR(optCoeff.x()) * multiplierDiag;
     jacobian(0, 1) = theta4;
     jacobian(0, 2) = theta3;
 
     jacobian(1, 0) = theta4;
-    jacobian(1, 1) = 2.0 / theta5 - SQR(optCoeff.y()) * multiplierDiag;
+    jacobian(1, 1) = 2.0 / theta5 + SQR(optCoeff.y()) * multiplierDiag;
     jacobian(1, 2) = theta2;
 
     jacobian(2, 0) = theta3;
     jacobian(2, 1) = theta2;
-    jacobian(2, 2) = 2.0 / theta5 - SQR(optCoeff.z()) * multiplierDiag;
+    jacobian(2, 2) = 2.0 / theta5 + SQR(optCoeff.z()) * multiplierDiag;
 
     const double multiA = 2.0 * theta1 / SQR(theta5);
     const double multiB = -2.0 / theta5;
@@ -104,7 +105,8 @@ Global_Pose_Estimator::Global_Pose_Estimator(const size_t optimizationParts,
                                              const matches_containers::match_container& features) :
     Levenberg_Marquardt_Functor<double>(6, optimizationParts),
     _optimizationParts(optimizationParts),
-    _features(features)
+    _features(features),
+    _featureBlocks(features)
 {
     // parameter checks
     if (_features.empty() or _optimizationParts == 0)
@@ -113,23 +115,19 @@ Global_Pose_Estimator::Global_Pose_Estimator(const size_t optimizationParts,
     }
 
     // sanity check
-    size_t featureParts = 0;
-    for (const auto& feature: _features)
-    {
-        featureParts += feature->get_feature_part_count();
-    }
-    if (featureParts != optimizationParts)
+    if (_featureBlocks.get_part_count() != optimizationParts)
     {
         throw std::logic_error("optimization vector do not match the given vector size");
     }
 }
 
 // Implementation of the objective function
-int Global_Pose_Estimator::operator()(const Eigen::Vector<double, 6>& optimizedParameters, vectorxd& outputScores) const
+int Global_Pose_Estimator::operator()(const Eigen::Vector<double, 6>& optimizedParameters,
+                                      Eigen::Ref<vectorxd> outputScores) const
 {
     // sanity checks
     assert(not _features.empty());
-    assert(static_cast<size_t>(outputScores.size()) == _optimizationParts);
+    assert(static_cast<size_t>(outputScores.size()) == values());
 
     if (optimizedParameters.hasNaN())
     {
@@ -150,24 +148,100 @@ int Global_Pose_Estimator::operator()(const Eigen::Vector<double, 6>& optimizedP
             utils::compute_world_to_camera_transform(pose.get_orientation_quaternion(), pose.get_position());
 
     // Compute projection distances
-    int featureScoreIndex = 0; // index of the match being treated
-    for (const auto& feature: _features)
-    {
-        const auto& distance = feature->get_distance(transformationMatrix);
-        const auto partCount = feature->get_feature_part_count();
+    auto featureScores = outputScores.head(_optimizationParts);
+    _featureBlocks.compute_residuals(transformationMatrix, featureScores);
+    if (_robustWeights.size() > 0)
+        featureScores.array() *= _robustWeights.array();
+
+    // distance to the prior pose
+    if (_hasPrior)
+        outputScores.tail<6>() = _priorSqrtInformation * (optimizedParameters - _priorCoefficients);
+    return 0;
+}
+
+int Global_Pose_Estimator::df(const Eigen::Vector<double, 6>& optimizedParameters, Eigen::Ref<matrixd> jacobian) const
+{
+    // sanity checks
+    assert(not _features.empty());
+    assert(static_cast<size_t>(jacobian.rows()) == values());
+    assert(jacobian.cols() == 6);
 
-        if (not distance.hasNaN())
-        {
-            assert(static_cast<int>(partCount) == distance.size());
+    if (optimizedParameters.hasNaN())
+    {
+        outputs::log_error("pose coefficients in optimization space have nan");
+        return 0;
+    }
 
-            outputScores.segment(featureScoreIndex, partCount) =
-                    distance * feature->get_alpha_reduction() / static_cast<double>(partCount);
-        }
-        featureScoreIndex += static_cast<int>(partCount);
+    // Get the new estimated pose, and the jacobian of the optimization space to pose
+    Eigen::Matrix<double, 7, 6> poseJacobian;
+    const utils::PoseBase& pose = get_pose_from_optimization_coefficients(optimizedParameters, poseJacobian);
+    if (pose.get_vector().hasNaN())
+    {
+        outputs::log_error("pose after transformation from optimization space have nan");
+        return 0;
     }
+
+    // convert to optimization matrix, shared by all the features
+    Eigen::Matrix<double, 12, 7> transformationJacobian;
+    const WorldToCameraMatrix& transformationMatrix = utils::compute_world_to_camera_transform(
+            pose.get_orientation_quaternion(), pose.get_position(), transformationJacobian);
+    const Eigen::Matrix<double, 12, 6>& coefficientsJacobian = transformationJacobian * poseJacobian;
+
+    // Compute projection distances jacobians
+    auto featureJacobian = jacobian.topRows(_optimizationParts);
+    _featureBlocks.compute_jacobian(transformationMatrix, coefficientsJacobian, featureJacobian);
+    if (_robustWeights.size() > 0)
+        featureJacobian.array().colwise() *= _robustWeights.array();
+
+    if (_hasPrior)
+        jacobian.bottomRows<6>() = _priorSqrtInformation;
     return 0;
 }
 
+void Global_Pose_Estimator::set_prior(const Eigen::Vector<double, 6>& priorCoefficients,
+                                      const matrix66& priorSqrtInformation) noexcept
+{
+    _priorCoefficients = priorCoefficients;
+    _priorSqrtInformation = priorSqrtInformation;
+    if (not _hasPrior)
+    {
+        _hasPrior = true;
+        _outputCount += 6;
+    }
+}
+
+void Global_Pose_Estimator::update_robust_weights(const Eigen::Vector<double, 6>& optimizedParameters) noexcept
+{
+    const utils::PoseBase& pose = get_pose_from_optimization_coefficients(optimizedParameters);
+    const WorldToCameraMatrix& transformationMatrix =
+            utils::compute_world_to_camera_transform(pose.get_orientation_quaternion(), pose.get_position());
+
+    vectorxd residuals(_optimizationParts);
+    vectorxd variances(_optimizationParts);
+    _featureBlocks.compute_residuals(transformationMatrix, residuals);
+    _featureBlocks.compute_residual_variances(transformationMatrix, variances);
+
+    // the residuals without a variance keep their full weight
+    const vectorxd& normalizedResiduals =
+            (variances.array() > 0.0).select(residuals.array().abs() / variances.array().sqrt(), 0.0).matrix();
+
+    static constexpr double scale = parameters::optimization::robustKernelScale;
+    vectorxd weights;
+    if constexpr (parameters::optimization::useCauchyKernel)
+    {
+        // w(u) = 1 / (1 + (u/c)^2)
+        weights = (1.0 + (normalizedResiduals.array() / scale).square()).inverse().matrix();
+    }
+    else
+    {
+        // w(u) = 1 if u <= k, k / u otherwise
+        weights = (normalizedResiduals.array() <= scale)
+                          .select(1.0, scale / normalizedResiduals.array().max(scale))
+                          .matrix();
+    }
+    _robustWeights = weights.cwiseSqrt();
+}
+
 /**
  * \brief Return a string corresponding to the end status of the optimization
  */
@@ -4,6 +4,7 @@
 #include "pose.hpp"
 #include "types.hpp"
 #include "matches_containers.hpp"
+#include "match_blocks.hpp"
 
 // types
 #include <unsupported/Eigen/NonLinearOptimization>
@@ -76,18 +77,58 @@ struct Global_Pose_Estimator : Levenberg_Marquardt_Functor<double>
      * \brief Implementation of the objective function
      *
      * \param[in] optimizedParameters The vector of parameters to optimize (Size M)
-     * \param[out] outputScores The vector of errors, of size N (N is optimizationParts)
+     * \param[out] outputScores The vector of errors, of size N (N is optimizationParts, plus 6 with a prior)
      */
-    int operator()(const Eigen::Vector<double, 6>& optimizedParameters, vectorxd& outputScores) const;
+    int operator()(const Eigen::Vector<double, 6>& optimizedParameters, Eigen::Ref<vectorxd> outputScores) const;
+
+    /**
+     * \brief Implementation of the analytic jacobian of the objective function
+     *
+     * \param[in] optimizedParameters The vector of parameters to optimize (Size M)
+     * \param[out] jacobian The jacobian of the errors with respect to the parameters, of size N x M (N is values())
+     */
+    int df(const Eigen::Vector<double, 6>& optimizedParameters, Eigen::Ref<matrixd> jacobian) const;
+
+    /**
+     * \brief Reweight the residuals with a robust kernel (Huber or Cauchy) of their normalized values at the given
+     * parameters, for an iteratively reweighted least square refinement
+     *
+     * \param[in] optimizedParameters The parameters at which the residuals are reweighted (Size M)
+     */
+    void update_robust_weights(const Eigen::Vector<double, 6>& optimizedParameters) noexcept;
+
+    /**
+     * \brief Add a prior on the optimized parameters, as 6 more residuals U.(x - x0), with U^T.U the prior information
+     *
+     * \param[in] priorCoefficients The prior parameters x0 (Size M)
+     * \param[in] priorSqrtInformation The upper triangular square root U of the prior information matrix
+     */
+    void set_prior(const Eigen::Vector<double, 6>& priorCoefficients, const matrix66& priorSqrtInformation) noexcept;
+
+    /**
+     * \brief The optimized features, sorted by type
+     */
+    [[nodiscard]] const Match_Blocks& get_feature_blocks() const noexcept { return _featureBlocks; };
 
   private:
     // use pointers to prevent useless copy
     const size_t _optimizationParts;
     // const reference to the feature object, that MUST NEVER be updated during the optimization
     const matches_containers::match_container& _features;
+    // the features sorted by type, to evaluate the residuals without virtual calls
+    const Match_Blocks _featureBlocks;
+    // square root of the robust weight of each residual, empty when the residuals are not reweighted
+    vectorxd _robustWeights;
+    // prior on the optimized parameters, as the 6 last residuals
+    bool _hasPrior = false;
+    Eigen::Vector<double, 6> _priorCoefficients;
+    matrix66 _priorSqrtInformation;
 };
 
-struct Global_Pose_Functor : Eigen::NumericalDiff<Global_Pose_Estimator>
+/**
+ * \brief The functor given to the Levenberg-Marquardt algorithm, using the analytic jacobian of Global_Pose_Estimator
+ */
+struct Global_Pose_Functor : Global_Pose_Estimator
 {
 };
 
@@ -0,0 +1,701 @@
+#include "local_bundle_adjustment.hpp"
+
+#include "levenberg_marquardt_functors.hpp"
+#include "logger.hpp"
+#include "parameters.hpp"
+#include "utils/camera_transformation.hpp"
+
+#include <Eigen/Cholesky>
+#include <cmath>
+#include <format>
+#include <limits>
+#include <opencv2/core.hpp>
+
+namespace rgbd_slam::pose_optimization {
+
+/**
+ * Bundle_Adjustment_Corrections
+ */
+
+void Bundle_Adjustment_Corrections::correct_pose(utils::PoseBase& pose) const noexcept
+{
+    // the pose keeps its transformation relative to the last keyframe: T = T_refined . T_tracked^-1 . T
+    const quaternion& rotationCorrection =
+            _refinedPose.get_orientation_quaternion() * _trackedPose.get_orientation_quaternion().conjugate();
+    const vector3& position =
+            _refinedPose.get_position() + rotationCorrection * (pose.get_position() - _trackedPose.get_position());
+    pose.set_parameters(position, (rotationCorrection * pose.get_orientation_quaternion()).normalized());
+}
+
+void Bundle_Adjustment_Corrections::merge_older(const Bundle_Adjustment_Corrections& olderCorrections) noexcept
+{
+    // older corrections computed before a correction was applied are stale
+    if (olderCorrections._correctionGeneration != _correctionGeneration)
+        return;
+
+    // the last keyframe pose correction already accounts for the older ones, as the window poses stay refined
+    for (const auto& [mapId, displacement]: olderCorrections._pointDisplacements)
+        _pointDisplacements.try_emplace(mapId, displacement);
+    for (const auto& [mapId, displacement]: olderCorrections._planeDisplacements)
+        _planeDisplacements.try_emplace(mapId, displacement);
+}
+
+/**
+ * Window optimization
+ */
+
+/**
+ * \brief The observations of a map feature by the keyframes of the window
+ * \tparam N The parameter count of this map feature
+ */
+template<int N> struct Window_Feature
+{
+    size_t _mapId = 0;
+    Eigen::Vector<double, N> _initial;              // estimate stored by the newest keyframe observing this feature
+    Eigen::Vector<double, N> _priorSqrtInformation; // inverse of the standard deviations of the initial estimate
+    size_t _initialGeneration = 0; // correction generation of the keyframe that stored the initial estimate
+    std::vector<std::pair<size_t, size_t>> _observations; // keyframe index, observation index in this keyframe
+};
+
+/**
+ * \brief The normal equations of a map feature, and its cross terms with the free keyframe poses
+ * \tparam N The parameter count of this map feature
+ */
+template<int N> struct Feature_System
+{
+    Eigen::Matrix<double, N, N> _hessian;
+    Eigen::Vector<double, N> _gradient;
+    Eigen::Matrix<double, Eigen::Dynamic, N> _poseHessian;
+    Eigen::LDLT<Eigen::Matrix<double, N, N>> _dampedHessianSolver;
+};
+
+/**
+ * \brief The optimized parameters of a window
+ */
+struct Window_State
+{
+    std::vector<vector6> _poses; // optimization coefficients of the keyframe poses
+    std::vector<vector3> _points;
+    std::vector<vector4> _planes;
+};
+
+/**
+ * \brief The Huber weight of a normalized residual
+ */
+[[nodiscard]] double get_robust_weight(const double normalizedResidual) noexcept
+{
+    static constexpr double scale = parameters::optimization::robustKernelScale;
+    return normalizedResidual <= scale ? 1.0 : scale / normalizedResidual;
+}
+
+/**
+ * \brief The Huber cost of a normalized residual
+ */
+[[nodiscard]] double get_robust_cost(const double normalizedResidual) noexcept
+{
+    static constexpr double scale = parameters::optimization::robustKernelScale;
+    return normalizedResidual <= scale ? SQR(normalizedResidual) : 2.0 * scale * normalizedResidual - SQR(scale);
+}
+
+/**
+ * \brief Compute the retroprojection residual of a map point in a keyframe, normalized by the screen standard
+ * deviation, and its jacobians
+ * \param[in] worldToCamera The world to camera matrix of the keyframe
+ * \param[in] mapPoint The map point estimate, in world coordinates
+ * \param[in] screenPoint The point observed by the keyframe
+ * \param[out] residual The normalized residual
+ * \param[out] poseJacobian The jacobian of the residual with respect to the 12 coefficients of the upper 3x4 block of
+ * worldToCamera (column major)
+ * \param[out] pointJacobian The jacobian of the residual with respect to the map point
+ * \return false if the map point cannot be projected in this keyframe
+ */
+[[nodiscard]] bool compute_point_residual(const WorldToCameraMatrix& worldToCamera,
+                                          const vector3& mapPoint,
+                                          const ScreenCoordinate2D& screenPoint,
+                                          vector2& residual,
+                                          Eigen::Matrix<double, 2, 12>& poseJacobian,
+                                          Eigen::Matrix<double, 2, 3>& pointJacobian) noexcept
+{
+    const static matrix33 cameraIntrinsics = Parameters::get_camera_1_intrinsics();
+    const static double screenStandardDev = std::sqrt(ScreenCoordinate2D().get_covariance()(0, 0));
+
+    const matrix33& rotation = worldToCamera.rotation();
+    const vector3& cameraPoint = rotation * mapPoint + worldToCamera.translation();
+    if (cameraPoint.z() <= 0.0)
+        return false;
+
+    residual = (screenPoint - (cameraIntrinsics.topRows<2>() * cameraPoint) / cameraPoint.z()) / screenStandardDev;
+
+    // jacobian of the residual with respect to the camera point
+    Eigen::Matrix<double, 2, 3> projectionJacobian;
+    projectionJacobian << -cameraIntrinsics(0, 0) / cameraPoint.z(), 0.0,
+            cameraIntrinsics(0, 0) * cameraPoint.x() / SQR(cameraPoint.z()), 0.0,
+            -cameraIntrinsics(1, 1) / cameraPoint.z(), cameraIntrinsics(1, 1) * cameraPoint.y() / SQR(cameraPoint.z());
+    projectionJacobian /= screenStandardDev;
+
+    // the camera point is the sum of the matrix columns, weighted by the homogeneous map point
+    for (Eigen::Index column = 0; column < 3; ++column)
+    {
+        poseJacobian.block<2, 3>(0, 3 * column) = projectionJacobian * mapPoint(column);
+    }
+    poseJacobian.block<2, 3>(0, 9) = projectionJacobian;
+    pointJacobian = projectionJacobian * rotation;
+    return residual.allFinite() and poseJacobian.allFinite();
+}
+
+/**
+ * \brief Compute the reduced plane residual of a map plane in a keyframe, normalized by the plane observation standard
+ * deviation, and its jacobians
+ * \param[in] worldToCamera The world to camera matrix of the keyframe
+ * \param[in] mapPlane The map plane estimate (normal and d), in world coordinates
+ * \param[in] cameraPlane The plane observed by the keyframe
+ * \param[out] residual The normalized residual
+ * \param[out] poseJacobian The jacobian of the residual with respect to the 12 coefficients of the upper 3x4 block of
+ * worldToCamera (column major)
+ * \param[out] planeJacobian The jacobian of the residual with respect to the map plane
+ * \return false if the residual is invalid
+ */
+[[nodiscard]] bool compute_plane_residual(const WorldToCameraMatrix& worldToCamera,
+                                          const vector4& mapPlane,
+                                          const PlaneCameraCoordinates& cameraPlane,
+                                          vector3& residual,
+                                          Eigen::Matrix<double, 3, 12>& poseJacobian,
+                                          Eigen::Matrix<double, 3, 4>& planeJacobian) noexcept
+{
+    static constexpr double planeStandardDev =
+            parameters::optimization::bundleAdjustment::planeObservationStandardDev_mm;
+
+    // the plane transformation is n' = R.n and d' = d - t.n'
+    const matrix33& rotation = worldToCamera.rotation();
+    const vector3& translation = worldToCamera.translation();
+    const vector3& worldNormal = mapPlane.head<3>();
+    const vector3& projectedNormal = rotation * worldNormal;
+    const double projectedD = mapPlane(3) - translation.dot(projectedNormal);
+
+    residual = (cameraPlane.get_d() * cameraPlane.get_normal() - projectedD * projectedNormal) / planeStandardDev;
+
+    for (Eigen::Index column = 0; column < 3; ++column)
+    {
+        poseJacobian.block<3, 3>(0, 3 * column) =
+                worldNormal(column) * (projectedNormal * translation.transpose() - projectedD * matrix33::Identity());
+    }
+    poseJacobian.block<3, 3>(0, 9) = projectedNormal * projectedNormal.transpose();
+    poseJacobian /= planeStandardDev;
+
+    planeJacobian.leftCols<3>() =
+            -(projectedD * matrix33::Identity() - projectedNormal * translation.transpose()) * rotation;
+    planeJacobian.col(3) = -projectedNormal;
+    planeJacobian /= planeStandardDev;
+    return residual.allFinite() and poseJacobian.allFinite();
+}
+
+/**
+ * \brief Select the map features observed by enough keyframes of the window
+ * \param[in] features The map features observed in the window, by map id
+ * \return The map features to refine
+ */
+template<int N>
+[[nodiscard]] std::vector<Window_Feature<N>> select_refined_features(
+        std::unordered_map<size_t, Window_Feature<N>>& features) noexcept
+{
+    static constexpr uint minimumObservations = parameters::optimization::bundleAdjustment::minimumObservations;
+
+    std::vector<Window_Feature<N>> refinedFeatures;
+    refinedFeatures.reserve(features.size());
+    for (auto& [mapId, feature]: features)
+    {
+        if (feature._observations.size() < minimumObservations)
+            continue;
+        feature._mapId = mapId;
+        refinedFeatures.emplace_back(std::move(feature));
+    }
+    return refinedFeatures;
+}
+
+/**
+ * \brief Gather the map points observed by the keyframes of the window
+ */
+[[nodiscard]] std::vector<Window_Feature<3>> get_window_points(
+        const std::deque<Bundle_Adjustment_Keyframe>& window) noexcept
+{
+    std::unordered_map<size_t, Window_Feature<3>> features;
+    for (size_t keyframeIndex = 0; keyframeIndex < window.size(); ++keyframeIndex)
+    {
+        const auto& observations = window[keyframeIndex]._points;
+        for (size_t observationIndex = 0; observationIndex < observations.size(); ++observationIndex)
+        {
+            const auto& observation = observations[observationIndex];
+            Window_Feature<3>& feature = features[observation._mapId];
+            // the newest keyframes store the most recent estimates
+            feature._initial = observation._mapPoint;
+            feature._initialGeneration = window[keyframeIndex]._correctionGeneration;
+            feature._priorSqrtInformation =
+                    observation._mapPointStandardDev.cwiseMax(std::numeric_limits<double>::epsilon()).cwiseInverse();
+            feature._observations.emplace_back(keyframeIndex, observationIndex);
+        }
+    }
+    return select_refined_features(features);
+}
+
+/**
+ * \brief Gather the map planes observed by the keyframes of the window
+ */
+[[nodiscard]] std::vector<Window_Feature<4>> get_window_planes(
+        const std::deque<Bundle_Adjustment_Keyframe>& window) noexcept
+{
+    std::unordered_map<size_t, Window_Feature<4>> features;
+    for (size_t keyframeIndex = 0; keyframeIndex < window.size(); ++keyframeIndex)
+    {
+        const auto& observations = window[keyframeIndex]._planes;
+        for (size_t observationIndex = 0; observationIndex < observations.size(); ++observationIndex)
+        {
+            const auto& observation = observations[observationIndex];
+            Window_Feature<4>& feature = features[observation._mapId];
+            // the newest keyframes store the most recent estimates
+            feature._initial << observation._mapPlane.get_normal(), observation._mapPlane.get_d();
+            feature._initialGeneration = window[keyframeIndex]._correctionGeneration;
+            feature._priorSqrtInformation =
+                    observation._mapPlaneStandardDev.cwiseMax(std::numeric_limits<double>::epsilon()).cwiseInverse();
+            feature._observations.emplace_back(keyframeIndex, observationIndex);
+        }
+    }
+    return select_refined_features(features);
+}
+
+/**
+ * \brief Compute the world to camera matrices of the keyframes, and their jacobians with respect to the optimization
+ * coefficients
+ */
+void compute_transformations(const std::vector<vector6>& poses,
+                             std::vector<WorldToCameraMatrix>& transformations,
+                             std::vector<Eigen::Matrix<double, 12, 6>>& transformationJacobians) noexcept
+{
+    transformations.resize(poses.size());
+    transformationJacobians.resize(poses.size());
+    for (size_t i = 0; i < poses.size(); ++i)
+    {
+        Eigen::Matrix<double, 7, 6> poseJacobian;
+        const utils::PoseBase& pose = get_pose_from_optimization_coefficients(poses[i], poseJacobian);
+
+        Eigen::Matrix<double, 12, 7> transformationJacobian;
+        transformations[i] = utils::compute_world_to_camera_transform(
+                pose.get_orientation_quaternion(), pose.get_position(), transformationJacobian);
+        transformationJacobians[i] = transformationJacobian * poseJacobian;
+    }
+}
+
+/**
+ * \brief Compute the cost of a type of map features: robust cost of the observations, and distance to the priors
+ * \param[in] features The map features of this type
+ * \param[in] estimates The parameters of those map features
+ * \param[in] transformations The world to camera matrices of the keyframes
+ * \param[in] compute_residual Computes the residual of an observation and its jacobians, from the keyframe index, the
+ * observation index in this keyframe, the keyframe matrix and the map feature parameters
+ */
+template<int N, int M, typename ResidualFunction>
+[[nodiscard]] double compute_features_cost(const std::vector<Window_Feature<N>>& features,
+                                           const std::vector<Eigen::Vector<double, N>>& estimates,
+                                           const std::vector<WorldToCameraMatrix>& transformations,
+                                           ResidualFunction&& compute_residual) noexcept
+{
+    double cost = 0.0;
+    for (size_t featureIndex = 0; featureIndex < features.size(); ++featureIndex)
+    {
+        const Window_Feature<N>& feature = features[featureIndex];
+        const Eigen::Vector<double, N>& estimate = estimates[featureIndex];
+        cost += feature._priorSqrtInformation.cwiseProduct(estimate - feature._initial).squaredNorm();
+
+        for (const auto& [keyframeIndex, observationIndex]: feature._observations)
+        {
+            Eigen::Vector<double, M> residual;
+            Eigen::Matrix<double, M, 12> poseJacobian;
+            Eigen::Matrix<double, M, N> featureJacobian;
+            if (compute_residual(keyframeIndex,
+                                 observationIndex,
+                                 transformations[keyframeIndex],
+                                 estimate,
+                                 residual,
+                                 poseJacobian,
+                                 featureJacobian))
+                cost += get_robust_cost(residual.norm());
+        }
+    }
+    return cost;
+}
+
+/**
+ * \brief Compute the normal equations of a type of map features, with the observation residuals reweighted by the
+ * robust kernel. The first keyframe pose is fixed, the other ones are the free poses of the system
+ * \param[in] features The map features of this type
+ * \param[in] estimates The parameters of those map features
+ * \param[in] transformations The world to camera matrices of the keyframes
+ * \param[in] transformationJacobians The jacobians of the keyframe matrices with respect to the pose coefficients
+ * \param[in] compute_residual Computes the residual of an observation and its jacobians (see compute_features_cost)
+ * \param[in, out] poseHessian The hessian of the free poses, to accumulate
+ * \param[in, out] poseGradient The gradient of the free poses, to accumulate
+ * \param[out] systems The normal equations of each map feature
+ */
+template<int N, int M, typename ResidualFunction>
+void linearize_features(const std::vector<Window_Feature<N>>& features,
+                        const std::vector<Eigen::Vector<double, N>>& estimates,
+                        const std::vector<WorldToCameraMatrix>& transformations,
+                        const std::vector<Eigen::Matrix<double, 12, 6>>& transformationJacobians,
+                        ResidualFunction&& compute_residual,
+                        matrixd& poseHessian,
+                        vectorxd& poseGradient,
+                        std::vector<Feature_System<N>>& systems) noexcept
+{
+    systems.resize(features.size());
+    for (size_t featureIndex = 0; featureIndex < features.size(); ++featureIndex)
+    {
+        const Window_Feature<N>& feature = features[featureIndex];
+        const Eigen::Vector<double, N>& estimate = estimates[featureIndex];
+        Feature_System<N>& system = systems[featureIndex];
+
+        // prior on the map feature, from its tracking covariance
+        system._hessian = feature._priorSqrtInformation.cwiseAbs2().asDiagonal();
+        system._gradient = feature._priorSqrtInformation.cwiseAbs2().cwiseProduct(estimate - feature._initial);
+        system._poseHessian.setZero(poseHessian.rows(), N);
+
+        for (const auto& [keyframeIndex, observationIndex]: feature._observations)
+        {
+            Eigen::Vector<double, M> residual;
+            Eigen::Matrix<double, M, 12> poseJacobian;
+            Eigen::Matrix<double, M, N> featureJacobian;
+            if (not compute_residual(keyframeIndex,
+                                     observationIndex,
+                                     transformations[keyframeIndex],
+                                     estimate,
+                                     residual,
+                                     poseJacobian,
+                                     featureJacobian))
+                continue;
+
+            const double weight = get_robust_weight(residual.norm());
+            system._hessian.noalias() += weight * featureJacobian.transpose() * featureJacobian;
+            system._gradient.noalias() += weight * featureJacobian.transpose() * residual;
+
+            // the first keyframe pose is fixed
+            if (keyframeIndex == 0)
+                continue;
+            const Eigen::Index poseIndex = static_cast<Eigen::Index>(6 * (keyframeIndex - 1));
+            const Eigen::Matrix<double, M, 6>& coefficientsJacobian =
+                    poseJacobian * transformationJacobians[keyframeIndex];
+            poseHessian.block<6, 6>(poseIndex, poseIndex).noalias() +=
+                    weight * coefficientsJacobian.transpose() * coefficientsJacobian;
+            poseGradient.segment<6>(poseIndex).noalias() += weight * coefficientsJacobian.transpose() * residual;
+            system._poseHessian.template middleRows<6>(poseIndex).noalias() +=
+                    weight * coefficientsJacobian.transpose() * featureJacobian;
+        }
+    }
+}
+
+/**
+ * \brief Eliminate the map features of the damped normal equations (Schur complement): the map features are only
+ * coupled through the keyframe poses
+ * \param[in] damping The Levenberg-Marquardt damping, scaled by the hessian diagonal
+ * \param[in, out] systems The normal equations of the map features. Stores the damped hessian decompositions
+ * \param[in, out] reducedHessian The reduced hessian of the free poses
+ * \param[in, out] reducedGradient The reduced gradient of the free poses
+ */
+template<int N>
+void eliminate_features(const double damping,
+                        std::vector<Feature_System<N>>& systems,
+                        matrixd& reducedHessian,
+                        vectorxd& reducedGradient) noexcept
+{
+    for (Feature_System<N>& system: systems)
+    {
+        Eigen::Matrix<double, N, N> dampedHessian = system._hessian;
+        dampedHessian.diagonal() += damping * system._hessian.diagonal();
+        system._dampedHessianSolver.compute(dampedHessian);
+
+        const Eigen::Matrix<double, Eigen::Dynamic, N>& solvedCrossHessian =
+                system._dampedHessianSolver.solve(system._poseHessian.transpose()).transpose();
+        reducedHessian.noalias() -= solvedCrossHessian * system._poseHessian.transpose();
+        reducedGradient.noalias() -= solvedCrossHessian * system._gradient;
+    }
+}
+
+/**
+ * \brief Compute the map feature steps from the free pose step (back substitution of the Schur complement)
+ * \param[in] systems The normal equations of the map features, with their damped hessian decompositions
+ * \param[in] poseStep The step of the free poses
+ * \param[in, out] estimates The parameters of the map features, moved by their steps
+ */
+template<int N>
+void apply_feature_steps(const std::vector<Feature_System<N>>& systems,
+                         const vectorxd& poseStep,
+                         std::vector<Eigen::Vector<double, N>>& estimates) noexcept
+{
+    for (size_t i = 0; i < systems.size(); ++i)
+    {
+        const Feature_System<N>& system = systems[i];
+        estimates[i] += system._dampedHessianSolver.solve(
+                -(system._gradient + system._poseHessian.transpose() * poseStep));
+    }
+}
+
+bool Local_Bundle_Adjustment::compute_corrections(const std::deque<Bundle_Adjustment_Keyframe>& window,
+                                                  std::vector<utils::PoseBase>& refinedPoses,
+                                                  Bundle_Adjustment_Corrections& corrections) noexcept
+{
+    static constexpr uint maximumIterations = parameters::optimization::bundleAdjustment::maximumIterations;
+
+    refinedPoses.clear();
+    for (const Bundle_Adjustment_Keyframe& keyframe: window)
+        refinedPoses.emplace_back(keyframe._pose);
+    if (window.size() < 2)
+        return false;
+
+    const std::vector<Window_Feature<3>>& points = get_window_points(window);
+    const std::vector<Window_Feature<4>>& planes = get_window_planes(window);
+    if (points.empty() and planes.empty())
+        return false;
+
+    // residuals of the observations of each feature type
+    const auto compute_point_observation_residual = [&window](const size_t keyframeIndex,
+                                                              const size_t observationIndex,
+                                                              const WorldToCameraMatrix& worldToCamera,
+                                                              const vector3& mapPoint,
+                                                              vector2& residual,
+                                                              Eigen::Matrix<double, 2, 12>& poseJacobian,
+                                                              Eigen::Matrix<double, 2, 3>& pointJacobian) {
+        return compute_point_residual(worldToCamera,
+                                      mapPoint,
+                                      window[keyframeIndex]._points[observationIndex]._screenPoint,
+                                      residual,
+                                      poseJacobian,
+                                      pointJacobian);
+    };
+    const auto compute_plane_observation_residual = [&window](const size_t keyframeIndex,
+                                                              const size_t observationIndex,
+                                                              const WorldToCameraMatrix& worldToCamera,
+                                                              const vector4& mapPlane,
+                                                              vector3& residual,
+                                                              Eigen::Matrix<double, 3, 12>& poseJacobian,
+                                                              Eigen::Matrix<double, 3, 4>& planeJacobian) {
+        return compute_plane_residual(worldToCamera,
+                                      mapPlane,
+                                      window[keyframeIndex]._planes[observationIndex]._cameraPlane,
+                                      residual,
+                                      poseJacobian,
+                                      planeJacobian);
+    };
+
+    // initial state
+    Window_State state;
+    for (const Bundle_Adjustment_Keyframe& keyframe: window)
+        state._poses.emplace_back(get_optimization_coefficient_from_pose(keyframe._pose));
+    for (const Window_Feature<3>& point: points)
+        state._points.emplace_back(point._initial);
+    for (const Window_Feature<4>& plane: planes)
+        state._planes.emplace_back(plane._initial);
+
+    std::vector<WorldToCameraMatrix> transformations;
+    std::vector<Eigen::Matrix<double, 12, 6>> transformationJacobians;
+    const auto compute_cost = [&](const Window_State& evaluatedState) {
+        compute_transformations(evaluatedState._poses, transformations, transformationJacobians);
+        return compute_features_cost<3, 2>(
+                       points, evaluatedState._points, transformations, compute_point_observation_residual) +
+               compute_features_cost<4, 3>(
+                       planes, evaluatedState._planes, transformations, compute_plane_observation_residual);
+    };
+
+    const Eigen::Index posesParameterCount = static_cast<Eigen::Index>(6 * (window.size() - 1));
+    std::vector<Feature_System<3>> pointSystems;
+    std::vector<Feature_System<4>> planeSystems;
+    matrixd poseHessian(posesParameterCount, posesParameterCount);
+    vectorxd poseGradient(posesParameterCount);
+
+    double cost = compute_cost(state);
+    double damping = 1e-3;
+    for (uint iteration = 0; iteration < maximumIterations; ++iteration)
+    {
+        // linearize at the current state
+        compute_transformations(state._poses, transformations, transformationJacobians);
+        poseHessian.setZero();
+        poseGradient.setZero();
+        linearize_features<3, 2>(points,
+                                 state._points,
+                                 transformations,
+                                 transformationJacobians,
+                                 compute_point_observation_residual,
+                                 poseHessian,
+                                 poseGradient,
+                                 pointSystems);
+        linearize_features<4, 3>(planes,
+                                 state._planes,
+                                 transformations,
+                                 transformationJacobians,
+                                 compute_plane_observation_residual,
+                                 poseHessian,
+                                 poseGradient,
+                                 planeSystems);
+
+        // search a damping that reduces the cost
+        bool isStepAccepted = false;
+        double relativeReduction = 0.0;
+        while (not isStepAccepted and damping < 1e8)
+        {
+            matrixd reducedHessian = poseHessian;
+            // the free poses that observe no refined feature keep a regular system
+            reducedHessian.diagonal() += damping * poseHessian.diagonal().cwiseMax(1e-6);
+            vectorxd reducedGradient = poseGradient;
+            eliminate_features(damping, pointSystems, reducedHessian, reducedGradient);
+            eliminate_features(damping, planeSystems, reducedHessian, reducedGradient);
+
+            const vectorxd& poseStep = reducedHessian.ldlt().solve(-reducedGradient);
+            Window_State candidate = state;
+            for (size_t i = 1; i < candidate._poses.size(); ++i)
+                candidate._poses[i] += poseStep.segment<6>(static_cast<Eigen::Index>(6 * (i - 1)));
+            apply_feature_steps(pointSystems, poseStep, candidate._points);
+            apply_feature_steps(planeSystems, poseStep, candidate._planes);
+
+            const double candidateCost = poseStep.allFinite() ? compute_cost(candidate) : cost;
+            if (std::isfinite(candidateCost) and candidateCost < cost)
+            {
+                relativeReduction = (cost - candidateCost) / std::max(cost, std::numeric_limits<double>::epsilon());
+                state = std::move(candidate);
+                cost = candidateCost;
+                damping = std::max(damping / 3.0, 1e-9);
+                isStepAccepted = true;
+            }
+            else
+            {
+                damping *= 4.0;
+            }
+        }
+        if (not isStepAccepted or relativeReduction < 1e-6)
+            break;
+    }
+
+    // outputs
+    for (size_t i = 1; i < window.size(); ++i)
+        refinedPoses[i] = get_pose_from_optimization_coefficients(state._poses[i]);
+
+    corrections._correctionGeneration = window.back()._correctionGeneration;
+    corrections._trackedPose = window.back()._pose;
+    corrections._refinedPose = refinedPoses.back();
+    corrections._pointDisplacements.clear();
+    corrections._planeDisplacements.clear();
+    // the estimates stored before the last applied correction do not include it: a displacement from them would move
+    // the map feature by this correction a second time
+    for (size_t i = 0; i < points.size(); ++i)
+    {
+        if (points[i]._initialGeneration != corrections._correctionGeneration)
+            continue;
+        corrections._pointDisplacements.emplace(points[i]._mapId, state._points[i] - points[i]._initial);
+    }
+    for (size_t i = 0; i < planes.size(); ++i)
+    {
+        if (planes[i]._initialGeneration != corrections._correctionGeneration)
+            continue;
+        // the normal is not constrained to a unit norm during the optimization
+        const vector4& refinedPlane = state._planes[i] / state._planes[i].head<3>().norm();
+        if (refinedPlane.allFinite())
+            corrections._planeDisplacements.emplace(planes[i]._mapId, refinedPlane - planes[i]._initial);
+    }
+    return true;
+}
+
+/**
+ * Local_Bundle_Adjustment
+ */
+
+Local_Bundle_Adjustment::~Local_Bundle_Adjustment() { stop(); }
+
+void Local_Bundle_Adjustment::start() noexcept
+{
+    if (_thread.joinable())
+    {
+        outputs::log_error("The local bundle adjustment is already running");
+        return;
+    }
+
+    _window.clear();
+    _corrections.store(nullptr);
+    // only one keyframe can wait: the tracking never waits for the bundle adjustment
+    _keyframes = std::make_unique<utils::Bounded_Queue<Bundle_Adjustment_Keyframe>>(1);
+    _thread = std::thread(&Local_Bundle_Adjustment::run, this);
+}
+
+void Local_Bundle_Adjustment::stop() noexcept
+{
+    if (not _thread.joinable())
+        return;
+
+    _keyframes->close();
+    _thread.join();
+    _keyframes.reset();
+}
+
+bool Local_Bundle_Adjustment::add_keyframe(Bundle_Adjustment_Keyframe&& keyframe) noexcept
+{
+    if (_keyframes == nullptr)
+        return false;
+
+    if (not _keyframes->try_push(std::move(keyframe)))
+    {
+        ++_droppedKeyframeCount;
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<const Bundle_Adjustment_Corrections> Local_Bundle_Adjustment::get_corrections() noexcept
+{
+    return _corrections.exchange(nullptr);
+}
+
+void Local_Bundle_Adjustment::run() noexcept
+{
+    static constexpr uint windowSize = parameters::optimization::bundleAdjustment::windowSize;
+
+    Bundle_Adjustment_Keyframe keyframe;
+    while (_keyframes->pop(keyframe))
+    {
+        if (keyframe._shouldResetWindow)
+            _window.clear();
+        _window.emplace_back(std::move(keyframe));
+        while (_window.size() > windowSize)
+            _window.pop_front();
+
+        const double refinementStartTime = static_cast<double>(cv::getTickCount());
+
+        std::vector<utils::PoseBase> refinedPoses;
+        auto corrections = std::make_shared<Bundle_Adjustment_Corrections>();
+        if (compute_corrections(_window, refinedPoses, *corrections))
+        {
+            // the next windows start from the refined poses
+            for (size_t i = 0; i < _window.size(); ++i)
+                _window[i]._pose = refinedPoses[i];
+
+            // keep the corrections that the tracking did not take yet
+            const std::shared_ptr<const Bundle_Adjustment_Corrections>& pendingCorrections =
+                    _corrections.exchange(nullptr);
+            if (pendingCorrections != nullptr)
+                corrections->merge_older(*pendingCorrections);
+            _corrections.store(std::move(corrections));
+
+            _refinementDuration.fetch_add((static_cast<double>(cv::getTickCount()) - refinementStartTime) /
+                                          cv::getTickFrequency());
+            ++_refinedWindowCount;
+        }
+    }
+}
+
+void Local_Bundle_Adjustment::show_statistics() const noexcept
+{
+    const uint refinedWindowCount = _refinedWindowCount;
+    if (refinedWindowCount > 0)
+    {
+        outputs::log(std::format("\tMean local bundle adjustment time is {:.4f} seconds, in the background ({} windows "
+                                 "refined, {} keyframes dropped)",
+                                 _refinementDuration / static_cast<double>(refinedWindowCount),
+                                 refinedWindowCount,
+                                 _droppedKeyframeCount.load()));
+    }
+}
+
+} // namespace rgbd_slam::pose_optimization
@@ -0,0 +1,152 @@
+#ifndef RGBDSLAM_POSEOPTIMIZATION_LOCALBUNDLEADJUSTMENT_HPP
+#define RGBDSLAM_POSEOPTIMIZATION_LOCALBUNDLEADJUSTMENT_HPP
+
+#include "coordinates/plane_coordinates.hpp"
+#include "coordinates/point_coordinates.hpp"
+#include "types.hpp"
+#include "utils/bounded_queue.hpp"
+#include "utils/pose.hpp"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace rgbd_slam::pose_optimization {
+
+/**
+ * \brief The inlier matches of a tracked keyframe, with the map feature estimates used by the tracking
+ */
+struct Bundle_Adjustment_Keyframe
+{
+    struct Point_Observation
+    {
+        size_t _mapId;
+        ScreenCoordinate2D _screenPoint;
+        WorldCoordinate _mapPoint;
+        vector3 _mapPointStandardDev;
+    };
+
+    struct Plane_Observation
+    {
+        size_t _mapId;
+        PlaneCameraCoordinates _cameraPlane;
+        PlaneWorldCoordinates _mapPlane;
+        vector4 _mapPlaneStandardDev;
+    };
+
+    utils::PoseBase _pose;
+    // number of corrections applied by the tracking when this keyframe was tracked
+    size_t _correctionGeneration = 0;
+    // the map was moved by a loop closure before this keyframe: the older keyframes of the window are obsolete
+    bool _shouldResetWindow = false;
+    std::vector<Point_Observation> _points;
+    std::vector<Plane_Observation> _planes;
+};
+
+/**
+ * \brief The displacements of the map features, and the correction of the last keyframe pose, computed by a bundle
+ * adjustment. The displacements are relative to the map feature estimates stored in the keyframes, and only given for
+ * the map features last observed by a keyframe of the current correction generation
+ */
+struct Bundle_Adjustment_Corrections
+{
+    // generation of the last keyframe: the displacements are stale if the tracking applied corrections since
+    size_t _correctionGeneration = 0;
+    std::unordered_map<size_t, vector3> _pointDisplacements; // position displacements, by map id
+    std::unordered_map<size_t, vector4> _planeDisplacements; // normal and d displacements, by map id
+    utils::PoseBase _trackedPose;                            // last keyframe pose, as tracked
+    utils::PoseBase _refinedPose;                            // last keyframe pose, after the bundle adjustment
+
+    /**
+     * \brief Move a pose tracked after the last keyframe with the correction of this keyframe
+     * \param[in, out] pose The pose to correct
+     */
+    void correct_pose(utils::PoseBase& pose) const noexcept;
+
+    /**
+     * \brief Add the displacements of older corrections that were not applied yet. The displacements of this object
+     * are kept for the map features in both
+     * \param[in] olderCorrections The corrections computed before this one
+     */
+    void merge_older(const Bundle_Adjustment_Corrections& olderCorrections) noexcept;
+};
+
+/**
+ * \brief Sliding window bundle adjustment: jointly refines the poses of the last keyframes and the map points and
+ * planes they observe, on a background thread.
+ * The tracking thread pushes keyframes without waiting, and collects the corrections between two frames. The
+ * corrections are published with an atomic pointer swap, the two threads never wait for each other
+ */
+class Local_Bundle_Adjustment
+{
+  public:
+    Local_Bundle_Adjustment() = default;
+    ~Local_Bundle_Adjustment();
+
+    /**
+     * \brief Start the bundle adjustment thread
+     */
+    void start() noexcept;
+
+    /**
+     * \brief Stop the bundle adjustment thread, dropping the keyframes waiting for a treatment
+     */
+    void stop() noexcept;
+
+    /**
+     * \brief Submit a new keyframe to the window, without waiting
+     * \param[in] keyframe The keyframe to add. Dropped if the last keyframe is still waiting for a treatment
+     * \return false if the keyframe was dropped
+     */
+    [[nodiscard]] bool add_keyframe(Bundle_Adjustment_Keyframe&& keyframe) noexcept;
+
+    /**
+     * \brief Take the corrections computed since the last call
+     * \return The corrections, or nullptr if none were computed
+     */
+    [[nodiscard]] std::shared_ptr<const Bundle_Adjustment_Corrections> get_corrections() noexcept;
+
+    /**
+     * \brief Jointly refine the poses of the keyframes and the map features observed by at least
+     * parameters::optimization::bundleAdjustment::minimumObservations of them. The first keyframe pose is fixed.
+     * \param[in] window The keyframes, from the oldest to the newest
+     * \param[out] refinedPoses The refined poses of the keyframes
+     * \param[out] corrections The displacements of the refined map features, and the correction of the last keyframe
+     * \return false if no map feature could be refined
+     */
+    [[nodiscard]] static bool compute_corrections(const std::deque<Bundle_Adjustment_Keyframe>& window,
+                                                  std::vector<utils::PoseBase>& refinedPoses,
+                                                  Bundle_Adjustment_Corrections& corrections) noexcept;
+
+    /**
+     * \brief Show the statistics of the bundle adjustment thread
+     */
+    void show_statistics() const noexcept;
+
+  private:
+    /**
+     * \brief Thread function: refines the window each time a keyframe is added
+     */
+    void run() noexcept;
+
+    std::deque<Bundle_Adjustment_Keyframe> _window;
+    std::unique_ptr<utils::Bounded_Queue<Bundle_Adjustment_Keyframe>> _keyframes = nullptr;
+    std::atomic<std::shared_ptr<const Bundle_Adjustment_Corrections>> _corrections;
+    std::thread _thread;
+
+    // perf measurments
+    std::atomic<uint> _refinedWindowCount = 0;
+    std::atomic<uint> _droppedKeyframeCount = 0;
+    std::atomic<double> _refinementDuration = 0.0;
+
+    // Remove copy operators
+    Local_Bundle_Adjustment(const Local_Bundle_Adjustment& other) = delete;
+    void operator=(const Local_Bundle_Adjustment& other) = delete;
+};
+
+} // namespace rgbd_slam::pose_optimization
+
+#endif
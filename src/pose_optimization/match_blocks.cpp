@@ -0,0 +1,375 @@
+#include "match_blocks.hpp"
+
+#include "distance_utils.hpp"
+#include "minimal_solvers.hpp"
+#include "parameters.hpp"
+#include "utils/camera_transformation.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace rgbd_slam::pose_optimization {
+
+Match_Blocks::Match_Blocks(const matches_containers::match_container& matches) noexcept
+{
+    for (const auto& match: matches)
+    {
+        match->add_to_blocks(*this, _matchCount);
+        ++_matchCount;
+    }
+}
+
+void Match_Blocks::add_point(const size_t matchIndex,
+                             const WorldCoordinate& mapPoint,
+                             const vector3& mapPointStandardDev,
+                             const ScreenCoordinate2D& matchedPoint,
+                             const double score,
+                             const double alphaReduction) noexcept
+{
+    _points._matchIndexes.emplace_back(matchIndex);
+    _points._mapPoints.emplace_back(mapPoint);
+    _points._mapPointVariances.emplace_back(mapPointStandardDev.cwiseAbs2());
+    _points._matchedPoints.emplace_back(matchedPoint);
+    _points._scores.emplace_back(score);
+    _points._weights.emplace_back(alphaReduction / 2.0);
+    _totalScore += score;
+}
+
+void Match_Blocks::add_point2d(const size_t matchIndex,
+                               const InverseDepthWorldPoint& mapPoint,
+                               const double inverseDepthStandardDev,
+                               const ScreenCoordinate2D& matchedPoint,
+                               const double score,
+                               const double alphaReduction) noexcept
+{
+    _points2d._matchIndexes.emplace_back(matchIndex);
+    _points2d._mapPoints.emplace_back(mapPoint);
+    _points2d._inverseDepthStandardDevs.emplace_back(inverseDepthStandardDev);
+    _points2d._matchedPoints.emplace_back(matchedPoint);
+    _points2d._scores.emplace_back(score);
+    _points2d._weights.emplace_back(alphaReduction / 2.0);
+    _totalScore += score;
+}
+
+void Match_Blocks::add_plane(const size_t matchIndex,
+                             const PlaneWorldCoordinates& mapPlane,
+                             const vector4& mapPlaneStandardDev,
+                             const PlaneCameraCoordinates& matchedPlane,
+                             const double score,
+                             const double alphaReduction) noexcept
+{
+    _planes._matchIndexes.emplace_back(matchIndex);
+    _planes._mapNormals.emplace_back(mapPlane.get_normal());
+    _planes._mapDs.emplace_back(mapPlane.get_d());
+    _planes._mapPlanes.emplace_back(mapPlane);
+    _planes._mapPlaneVariances.emplace_back(mapPlaneStandardDev.cwiseAbs2());
+    _planes._matchedPlanes.emplace_back(matchedPlane);
+    _planes._matchedReducedPlanes.emplace_back(matchedPlane.get_d() * matchedPlane.get_normal());
+    _planes._scores.emplace_back(score);
+    _planes._weights.emplace_back(alphaReduction / 3.0);
+    _totalScore += score;
+}
+
+size_t Match_Blocks::get_part_count() const noexcept
+{
+    return 2 * _points._matchIndexes.size() + 2 * _points2d._matchIndexes.size() + 3 * _planes._matchIndexes.size();
+}
+
+/**
+ * \brief Project a block of world points to screen space
+ * \param[in] mapPoints The world points, as a 3xN matrix
+ * \param[in] worldToCamera The transformation to evaluate
+ * \return The screen points, as a 2xN matrix
+ */
+[[nodiscard]] Eigen::Matrix<double, 2, Eigen::Dynamic> project_points(
+        const Eigen::Ref<const Eigen::Matrix<double, 3, Eigen::Dynamic>>& mapPoints,
+        const WorldToCameraMatrix& worldToCamera) noexcept
+{
+    const static matrix33 cameraIntrinsics = Parameters::get_camera_1_intrinsics();
+
+    const Eigen::Matrix<double, 3, Eigen::Dynamic>& cameraPoints =
+            (worldToCamera.block<3, 3>(0, 0) * mapPoints).colwise() + worldToCamera.block<3, 1>(0, 3);
+    return ((cameraIntrinsics.topRows<2>() * cameraPoints).array().rowwise() / cameraPoints.row(2).array()).matrix();
+}
+
+void Match_Blocks::compute_residuals(const WorldToCameraMatrix& worldToCamera,
+                                     Eigen::Ref<vectorxd> residuals) const noexcept
+{
+    assert(static_cast<size_t>(residuals.size()) == get_part_count());
+
+    // fixed size operations only: this is called at each optimization step, and should not allocate
+    const static matrix33 cameraIntrinsics = Parameters::get_camera_1_intrinsics();
+    const matrix33& rotation = worldToCamera.rotation();
+    const vector3& translation = worldToCamera.translation();
+
+    Eigen::Index residualIndex = 0;
+
+    // points: retroprojection distance
+    for (size_t i = 0; i < _points._matchIndexes.size(); ++i, residualIndex += 2)
+    {
+        const vector3& cameraPoint = rotation * _points._mapPoints[i] + translation;
+        const vector2& distance =
+                (_points._matchedPoints[i] - (cameraIntrinsics.topRows<2>() * cameraPoint) / cameraPoint.z()) *
+                _points._weights[i];
+        residuals.segment<2>(residualIndex) = distance.allFinite() ? distance : vector2::Zero();
+    }
+
+    // 2D points: distance to the projected depth segment
+    for (size_t i = 0; i < _points2d._matchIndexes.size(); ++i, residualIndex += 2)
+    {
+        const vector2& distance = _points2d._mapPoints[i].compute_signed_screen_distance(
+                _points2d._matchedPoints[i], _points2d._inverseDepthStandardDevs[i], worldToCamera);
+        residuals.segment<2>(residualIndex) =
+                distance.allFinite() ? vector2(distance * _points2d._weights[i]) : vector2::Zero();
+    }
+
+    // planes: reduced plane distance, with n' = R.n and d' = d - t.n'
+    for (size_t i = 0; i < _planes._matchIndexes.size(); ++i, residualIndex += 3)
+    {
+        const vector3& projectedNormal = rotation * _planes._mapNormals[i];
+        const double projectedD = _planes._mapDs[i] - translation.dot(projectedNormal);
+        const vector3& distance =
+                (_planes._matchedReducedPlanes[i] - projectedD * projectedNormal) * _planes._weights[i];
+        residuals.segment<3>(residualIndex) = distance.allFinite() ? distance : vector3::Zero();
+    }
+    assert(static_cast<size_t>(residualIndex) == get_part_count());
+}
+
+void Match_Blocks::compute_jacobian(const WorldToCameraMatrix& worldToCamera,
+                                    const Eigen::Matrix<double, 12, 6>& transformationJacobian,
+                                    Eigen::Ref<matrixd> jacobian) const noexcept
+{
+    assert(static_cast<size_t>(jacobian.rows()) == get_part_count());
+    assert(jacobian.cols() == 6);
+
+    Eigen::Index residualIndex = 0;
+    for (size_t i = 0; i < _points._matchIndexes.size(); ++i, residualIndex += 2)
+    {
+        Eigen::Matrix<double, 2, 12> distanceJacobian;
+        const vector2& distance = WorldCoordinate(_points._mapPoints[i])
+                                          .get_signed_distance_2D_px(
+                                                  _points._matchedPoints[i], worldToCamera, distanceJacobian);
+        if (distance.allFinite() and distanceJacobian.allFinite())
+            jacobian.middleRows<2>(residualIndex) =
+                    distanceJacobian * transformationJacobian * _points._weights[i];
+        else
+            jacobian.middleRows<2>(residualIndex).setZero();
+    }
+
+    for (size_t i = 0; i < _points2d._matchIndexes.size(); ++i, residualIndex += 2)
+    {
+        Eigen::Matrix<double, 2, 12> distanceJacobian;
+        const vector2& distance =
+                _points2d._mapPoints[i].compute_signed_screen_distance(_points2d._matchedPoints[i],
+                                                                        _points2d._inverseDepthStandardDevs[i],
+                                                                        worldToCamera,
+                                                                        distanceJacobian);
+        if (distance.allFinite() and distanceJacobian.allFinite())
+            jacobian.middleRows<2>(residualIndex) =
+                    distanceJacobian * transformationJacobian * _points2d._weights[i];
+        else
+            jacobian.middleRows<2>(residualIndex).setZero();
+    }
+
+    for (size_t i = 0; i < _planes._matchIndexes.size(); ++i, residualIndex += 3)
+    {
+        Eigen::Matrix<double, 3, 12> distanceJacobian;
+        const vector3& distance = _planes._mapPlanes[i].get_reduced_signed_distance(
+                _planes._matchedPlanes[i], worldToCamera, distanceJacobian);
+        if (distance.allFinite() and distanceJacobian.allFinite())
+            jacobian.middleRows<3>(residualIndex) = distanceJacobian * transformationJacobian * _planes._weights[i];
+        else
+            jacobian.middleRows<3>(residualIndex).setZero();
+    }
+    assert(static_cast<size_t>(residualIndex) == get_part_count());
+}
+
+void Match_Blocks::compute_residual_variances(const WorldToCameraMatrix& worldToCamera,
+                                              vectorxd& variances) const noexcept
+{
+    assert(static_cast<size_t>(variances.size()) == get_part_count());
+
+    const static matrix33 cameraIntrinsics = Parameters::get_camera_1_intrinsics();
+    const matrix33& rotation = worldToCamera.rotation();
+    // the detected points have the same screen variance
+    const vector2& screenVariance = ScreenCoordinate2D().get_covariance().diagonal();
+
+    Eigen::Index residualIndex = 0;
+    for (size_t i = 0; i < _points._matchIndexes.size(); ++i, residualIndex += 2)
+    {
+        const vector3& cameraPoint = rotation * _points._mapPoints[i] + worldToCamera.translation();
+        // jacobian of the projection with respect to the world point
+        Eigen::Matrix<double, 2, 3> projectionJacobian;
+        projectionJacobian << cameraIntrinsics(0, 0) / cameraPoint.z(), 0.0,
+                -cameraIntrinsics(0, 0) * cameraPoint.x() / SQR(cameraPoint.z()), 0.0,
+                cameraIntrinsics(1, 1) / cameraPoint.z(),
+                -cameraIntrinsics(1, 1) * cameraPoint.y() / SQR(cameraPoint.z());
+        projectionJacobian *= rotation;
+
+        const vector2& variance =
+                (projectionJacobian.array().square().matrix() * _points._mapPointVariances[i] + screenVariance) *
+                SQR(_points._weights[i]);
+        variances.segment<2>(residualIndex) =
+                (cameraPoint.z() > 0.0 and variance.allFinite()) ? variance : vector2::Zero();
+    }
+
+    // the distance to the projected depth segment already accounts for the depth uncertainty
+    for (size_t i = 0; i < _points2d._matchIndexes.size(); ++i, residualIndex += 2)
+    {
+        variances.segment<2>(residualIndex) = screenVariance * SQR(_points2d._weights[i]);
+    }
+
+    // planes: the reduced plane is d'.n', with n' = R.n and d' = d - t.n'
+    for (size_t i = 0; i < _planes._matchIndexes.size(); ++i, residualIndex += 3)
+    {
+        const vector3& projectedNormal = rotation * _planes._mapNormals[i];
+        const double projectedD = _planes._mapDs[i] - worldToCamera.translation().dot(projectedNormal);
+        const vector4& planeVariance = _planes._mapPlaneVariances[i];
+
+        // jacobian of the reduced plane with respect to the world normal
+        const matrix33& normalJacobian =
+                (projectedD * matrix33::Identity() - projectedNormal * worldToCamera.translation().transpose()) *
+                rotation;
+
+        const vector3& variance = (normalJacobian.array().square().matrix() * planeVariance.head<3>() +
+                                   projectedNormal.cwiseAbs2() * planeVariance(3)) *
+                                  SQR(_planes._weights[i]);
+        variances.segment<3>(residualIndex) = variance.allFinite() ? variance : vector3::Zero();
+    }
+    assert(static_cast<size_t>(residualIndex) == get_part_count());
+}
+
+double Match_Blocks::compute_inliers(const WorldToCameraMatrix& worldToCamera,
+                                     std::vector<bool>& isInlier,
+                                     const double minimumScore) const noexcept
+{
+    isInlier.assign(_matchCount, false);
+    double score = 0.0;
+    // score of the matches not tested yet. The margin covers the rounding of the subtractions
+    double remainingScore = _totalScore;
+    const double stopScore = minimumScore - 1e-9;
+
+    // points: manhattan retroprojection distance, projected by chunks to test the early stop between them
+    static constexpr Eigen::Index pointChunkSize = 64;
+    const Eigen::Index pointCount = static_cast<Eigen::Index>(_points._matchIndexes.size());
+    for (Eigen::Index chunkStart = 0; chunkStart < pointCount; chunkStart += pointChunkSize)
+    {
+        const Eigen::Index chunkSize = std::min(pointChunkSize, pointCount - chunkStart);
+        const Eigen::Map<const Eigen::Matrix<double, 3, Eigen::Dynamic>> mapPoints(
+                _points._mapPoints[static_cast<size_t>(chunkStart)].data(), 3, chunkSize);
+        const Eigen::Map<const Eigen::Matrix<double, 2, Eigen::Dynamic>> matchedPoints(
+                _points._matchedPoints[static_cast<size_t>(chunkStart)].data(), 2, chunkSize);
+
+        const Eigen::RowVectorXd& distances =
+                (matchedPoints - project_points(mapPoints, worldToCamera)).cwiseAbs().colwise().sum();
+        for (Eigen::Index i = 0; i < chunkSize; ++i)
+        {
+            const size_t pointIndex = static_cast<size_t>(chunkStart + i);
+            remainingScore -= _points._scores[pointIndex];
+            // NaN distances are never inliers
+            if (distances(i) <= parameters::optimization::ransac::maximumRetroprojectionErrorForPointInliers_px)
+            {
+                isInlier[_points._matchIndexes[pointIndex]] = true;
+                score += _points._scores[pointIndex];
+            }
+        }
+        if (score + remainingScore < stopScore)
+            return score;
+    }
+
+    for (size_t i = 0; i < _points2d._matchIndexes.size(); ++i)
+    {
+        remainingScore -= _points2d._scores[i];
+        const vector2& distance = _points2d._mapPoints[i].compute_signed_screen_distance(
+                _points2d._matchedPoints[i], _points2d._inverseDepthStandardDevs[i], worldToCamera);
+        if ((distance.array() <= parameters::optimization::ransac::maximumRetroprojectionErrorForPoint2DInliers_px)
+                    .all())
+        {
+            isInlier[_points2d._matchIndexes[i]] = true;
+            score += _points2d._scores[i];
+        }
+        else if (score + remainingScore < stopScore)
+            return score;
+    }
+
+    // planes: normal angles and d distance
+    const Eigen::Index planeCount = static_cast<Eigen::Index>(_planes._matchIndexes.size());
+    if (planeCount > 0)
+    {
+        const Eigen::Map<const Eigen::Matrix<double, 3, Eigen::Dynamic>> mapNormals(
+                _planes._mapNormals.front().data(), 3, planeCount);
+        const Eigen::Map<const Eigen::RowVectorXd> mapDs(_planes._mapDs.data(), planeCount);
+
+        const Eigen::Matrix<double, 3, Eigen::Dynamic>& projectedNormals =
+                worldToCamera.block<3, 3>(0, 0) * mapNormals;
+        const Eigen::RowVectorXd& projectedDs =
+                mapDs - worldToCamera.block<3, 1>(0, 3).transpose() * projectedNormals;
+        for (Eigen::Index i = 0; i < planeCount; ++i)
+        {
+            remainingScore -= _planes._scores[i];
+            const PlaneCameraCoordinates& matchedPlane = _planes._matchedPlanes[i];
+            const vector3& matchedNormal = matchedPlane.get_normal();
+
+            bool isPlaneInlier =
+                    std::abs(matchedPlane.get_d() - projectedDs(i)) <=
+                    parameters::optimization::ransac::maximumRetroprojectionErrorForPlaneInliers_mm;
+            for (Eigen::Index axis = 0; axis < 3 and isPlaneInlier; ++axis)
+            {
+                isPlaneInlier = std::abs(utils::angle_distance(matchedNormal(axis), projectedNormals(axis, i))) <=
+                                parameters::optimization::ransac::maximumRetroprojectionErrorForPlaneInliersNormal;
+            }
+
+            if (isPlaneInlier)
+            {
+                isInlier[_planes._matchIndexes[i]] = true;
+                score += _planes._scores[i];
+            }
+            else if (score + remainingScore < stopScore)
+                return score;
+        }
+    }
+    return score;
+}
+
+bool Match_Blocks::compute_minimal_transformations(std::vector<WorldToCameraMatrix>& transformations) const noexcept
+{
+    transformations.clear();
+    const size_t pointCount = _points._matchIndexes.size() + _points2d._matchIndexes.size();
+
+    // points and 2D points: perspective from three points
+    if (_planes._matchIndexes.empty() and pointCount >= 3)
+    {
+        std::array<vector3, 3> worldPoints;
+        std::array<ScreenCoordinate2D, 3> screenPoints;
+        for (size_t i = 0; i < 3; ++i)
+        {
+            if (i < _points._matchIndexes.size())
+            {
+                worldPoints[i] = _points._mapPoints[i];
+                screenPoints[i] = ScreenCoordinate2D(_points._matchedPoints[i]);
+            }
+            else
+            {
+                const size_t point2dIndex = i - _points._matchIndexes.size();
+                worldPoints[i] = _points2d._mapPoints[point2dIndex].to_world_coordinates();
+                screenPoints[i] = _points2d._matchedPoints[point2dIndex];
+            }
+        }
+        return minimal_solvers::compute_p3p_transformations(worldPoints, screenPoints, transformations);
+    }
+
+    // planes: normals and offsets alignment
+    if (pointCount == 0 and _planes._matchIndexes.size() >= 3)
+    {
+        WorldToCameraMatrix transformation;
+        if (not minimal_solvers::compute_planes_transformation(
+                    _planes._mapPlanes, _planes._matchedPlanes, transformation))
+            return false;
+        transformations.emplace_back(transformation);
+        return true;
+    }
+    return false;
+}
+
+} // namespace rgbd_slam::pose_optimization
@@ -0,0 +1,175 @@
+#ifndef RGBDSLAM_POSEOPTIMIZATION_MATCHBLOCKS_HPP
+#define RGBDSLAM_POSEOPTIMIZATION_MATCHBLOCKS_HPP
+
+#include "coordinates/inverse_depth_coordinates.hpp"
+#include "coordinates/plane_coordinates.hpp"
+#include "coordinates/point_coordinates.hpp"
+#include "matches_containers.hpp"
+#include "types.hpp"
+
+#include <limits>
+#include <vector>
+
+namespace rgbd_slam::pose_optimization {
+
+/**
+ * \brief The matched features of an optimization, sorted by feature type in contiguous arrays.
+ * The residuals, jacobians and inliers of a transformation are evaluated block by block, without virtual calls.
+ * The residuals are ordered by block (points, 2D points, then planes), the inliers by index in the original container
+ */
+class Match_Blocks
+{
+  public:
+    /**
+     * \param[in] matches The matched features to sort in blocks. Each feature adds itself to the right block
+     */
+    explicit Match_Blocks(const matches_containers::match_container& matches) noexcept;
+
+    /**
+     * \brief Add a point match to the points block
+     * \param[in] matchIndex The index of this match in the original container
+     * \param[in] mapPoint The map point, in world coordinates
+     * \param[in] mapPointStandardDev The standard deviation of the map point, in world coordinates
+     * \param[in] matchedPoint The detected point, in screen coordinates
+     * \param[in] score The optimization score of this match
+     * \param[in] alphaReduction The optimization weight of this match
+     */
+    void add_point(const size_t matchIndex,
+                   const WorldCoordinate& mapPoint,
+                   const vector3& mapPointStandardDev,
+                   const ScreenCoordinate2D& matchedPoint,
+                   const double score,
+                   const double alphaReduction) noexcept;
+
+    /**
+     * \brief Add a 2D point match to the 2D points block
+     * \param[in] matchIndex The index of this match in the original container
+     * \param[in] mapPoint The map point, in inverse depth coordinates
+     * \param[in] inverseDepthStandardDev The standard deviation of the map point inverse depth
+     * \param[in] matchedPoint The detected point, in screen coordinates
+     * \param[in] score The optimization score of this match
+     * \param[in] alphaReduction The optimization weight of this match
+     */
+    void add_point2d(const size_t matchIndex,
+                     const InverseDepthWorldPoint& mapPoint,
+                     const double inverseDepthStandardDev,
+                     const ScreenCoordinate2D& matchedPoint,
+                     const double score,
+                     const double alphaReduction) noexcept;
+
+    /**
+     * \brief Add a plane match to the planes block
+     * \param[in] matchIndex The index of this match in the original container
+     * \param[in] mapPlane The map plane, in world coordinates
+     * \param[in] mapPlaneStandardDev The standard deviation of the map plane normal and d parameters
+     * \param[in] matchedPlane The detected plane, in camera coordinates
+     * \param[in] score The optimization score of this match
+     * \param[in] alphaReduction The optimization weight of this match
+     */
+    void add_plane(const size_t matchIndex,
+                   const PlaneWorldCoordinates& mapPlane,
+                   const vector4& mapPlaneStandardDev,
+                   const PlaneCameraCoordinates& matchedPlane,
+                   const double score,
+                   const double alphaReduction) noexcept;
+
+    /**
+     * \brief The number of matches in all the blocks
+     */
+    [[nodiscard]] size_t size() const noexcept { return _matchCount; };
+
+    /**
+     * \brief The number of residuals of all the blocks (sum of the feature part counts)
+     */
+    [[nodiscard]] size_t get_part_count() const noexcept;
+
+    /**
+     * \brief Compute the weighted residuals of all the blocks for a transformation, without allocations.
+     * The features that cannot be projected do not contribute.
+     * \param[in] worldToCamera The transformation to evaluate
+     * \param[out] residuals The residuals, of size get_part_count()
+     */
+    void compute_residuals(const WorldToCameraMatrix& worldToCamera, Eigen::Ref<vectorxd> residuals) const noexcept;
+
+    /**
+     * \brief Compute the jacobian of the weighted residuals of all the blocks
+     * \param[in] worldToCamera The transformation to evaluate
+     * \param[in] transformationJacobian The jacobian of the 12 coefficients of the upper 3x4 block of worldToCamera
+     * (column major) with respect to the optimized parameters
+     * \param[out] jacobian The jacobian of the residuals, of size get_part_count() x 6
+     */
+    void compute_jacobian(const WorldToCameraMatrix& worldToCamera,
+                          const Eigen::Matrix<double, 12, 6>& transformationJacobian,
+                          Eigen::Ref<matrixd> jacobian) const noexcept;
+
+    /**
+     * \brief Compute the first order variances of the weighted residuals of all the blocks, from the map feature and
+     * detected feature uncertainties. The residuals are considered independent
+     * \param[in] worldToCamera The transformation to evaluate
+     * \param[out] variances The variance of each residual, of size get_part_count(). Null for the residuals of the
+     * features that cannot be projected
+     */
+    void compute_residual_variances(const WorldToCameraMatrix& worldToCamera, vectorxd& variances) const noexcept;
+
+    /**
+     * \brief Compute the inliers of all the blocks for a transformation
+     * \param[in] worldToCamera The transformation to evaluate
+     * \param[out] isInlier For each match of the original container, true if it is an inlier. Incomplete if the
+     * scoring stopped early
+     * \param[in] minimumScore The scoring stops as soon as the inliers cannot reach this score, even if all the
+     * remaining matches are inliers. The default never stops
+     * \return The summed score of the inliers, or a score lower than minimumScore if the scoring stopped early
+     */
+    double compute_inliers(const WorldToCameraMatrix& worldToCamera,
+                           std::vector<bool>& isInlier,
+                           const double minimumScore = -std::numeric_limits<double>::infinity()) const noexcept;
+
+    /**
+     * \brief Compute the candidate transformations of these matches with a closed form minimal solver: P3P for the
+     * points and 2D points (using the first three of them), plane alignment for the planes
+     * \param[out] transformations The candidate transformations
+     * \return false if the matches mix points and planes, or cannot be solved in closed form
+     */
+    [[nodiscard]] bool compute_minimal_transformations(std::vector<WorldToCameraMatrix>& transformations) const noexcept;
+
+  private:
+    size_t _matchCount = 0;
+    double _totalScore = 0.0; // summed score of all the matches
+
+    struct Point_Block
+    {
+        std::vector<size_t> _matchIndexes;
+        std::vector<vector3> _mapPoints;
+        std::vector<vector3> _mapPointVariances;
+        std::vector<vector2> _matchedPoints;
+        std::vector<double> _scores;
+        std::vector<double> _weights; // alpha reduction divided by the part count
+    } _points;
+
+    struct Point2D_Block
+    {
+        std::vector<size_t> _matchIndexes;
+        std::vector<InverseDepthWorldPoint> _mapPoints;
+        std::vector<double> _inverseDepthStandardDevs;
+        std::vector<ScreenCoordinate2D> _matchedPoints;
+        std::vector<double> _scores;
+        std::vector<double> _weights;
+    } _points2d;
+
+    struct Plane_Block
+    {
+        std::vector<size_t> _matchIndexes;
+        std::vector<vector3> _mapNormals;
+        std::vector<double> _mapDs;
+        std::vector<PlaneWorldCoordinates> _mapPlanes;
+        std::vector<vector4> _mapPlaneVariances;
+        std::vector<PlaneCameraCoordinates> _matchedPlanes;
+        std::vector<vector3> _matchedReducedPlanes; // d.n of the matched planes
+        std::vector<double> _scores;
+        std::vector<double> _weights;
+    } _planes;
+};
+
+} // namespace rgbd_slam::pose_optimization
+
+#endif
@@ -0,0 +1,79 @@
+#include "minimal_solvers.hpp"
+
+#include "../../third_party/p3p.hpp"
+#include "parameters.hpp"
+#include "utils/camera_transformation.hpp"
+
+#include <Eigen/SVD>
+#include <cassert>
+
+namespace rgbd_slam::pose_optimization::minimal_solvers {
+
+bool compute_p3p_transformations(const std::array<vector3, 3>& worldPoints,
+                                 const std::array<ScreenCoordinate2D, 3>& screenPoints,
+                                 std::vector<WorldToCameraMatrix>& transformations) noexcept
+{
+    transformations.clear();
+
+    std::vector<Eigen::Vector3d> bearings;
+    std::vector<Eigen::Vector3d> points;
+    bearings.reserve(3);
+    points.reserve(3);
+    for (size_t i = 0; i < 3; ++i)
+    {
+        // bearing vector of the screen point, in camera space
+        bearings.emplace_back(screenPoints[i].to_camera_coordinates().homogeneous().normalized());
+        points.emplace_back(worldPoints[i]);
+    }
+
+    // solves lambda.x = R.X + t: (R, t) is the world to camera transformation
+    for (const lambdatwist::CameraPose& solution: lambdatwist::p3p(bearings, points))
+    {
+        if (not solution.R.allFinite() or not solution.t.allFinite())
+            continue;
+        transformations.emplace_back(WorldToCameraMatrix(utils::get_transformation_matrix(solution.R, solution.t)));
+    }
+    return not transformations.empty();
+}
+
+bool compute_planes_transformation(const std::vector<PlaneWorldCoordinates>& worldPlanes,
+                                   const std::vector<PlaneCameraCoordinates>& cameraPlanes,
+                                   WorldToCameraMatrix& transformation) noexcept
+{
+    assert(worldPlanes.size() == cameraPlanes.size());
+    if (worldPlanes.size() < 3)
+        return false;
+
+    // the normals are rotated by the transformation: n' = R.n
+    matrix33 crossCovariance = matrix33::Zero();
+    for (size_t i = 0; i < worldPlanes.size(); ++i)
+    {
+        crossCovariance += cameraPlanes[i].get_normal() * worldPlanes[i].get_normal().transpose();
+    }
+    const Eigen::JacobiSVD<matrix33> svd(crossCovariance, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    // normals close to a plane or a line leave a free rotation
+    if (svd.singularValues()(2) < parameters::optimization::ransac::minimumPlaneNormalsConditioning)
+        return false;
+
+    matrix33 reflectionCorrection = matrix33::Identity();
+    reflectionCorrection(2, 2) = (svd.matrixU() * svd.matrixV().transpose()).determinant() < 0.0 ? -1.0 : 1.0;
+    const matrix33& rotation = svd.matrixU() * reflectionCorrection * svd.matrixV().transpose();
+
+    // the offsets are translated by the transformation: d' = d - n'.t, solve n'.t = d - d' in the least square sense
+    Eigen::Matrix<double, Eigen::Dynamic, 3> projectedNormals(worldPlanes.size(), 3);
+    vectorxd offsetDifferences(worldPlanes.size());
+    for (size_t i = 0; i < worldPlanes.size(); ++i)
+    {
+        const Eigen::Index row = static_cast<Eigen::Index>(i);
+        projectedNormals.row(row) = (rotation * worldPlanes[i].get_normal()).transpose();
+        offsetDifferences(row) = worldPlanes[i].get_d() - cameraPlanes[i].get_d();
+    }
+    const vector3& translation = projectedNormals.colPivHouseholderQr().solve(offsetDifferences);
+    if (not translation.allFinite())
+        return false;
+
+    transformation = WorldToCameraMatrix(utils::get_transformation_matrix(rotation, translation));
+    return true;
+}
+
+} // namespace rgbd_slam::pose_optimization::minimal_solvers
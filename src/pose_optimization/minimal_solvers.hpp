@@ -0,0 +1,38 @@
+#ifndef RGBDSLAM_POSEOPTIMIZATION_MINIMALSOLVERS_HPP
+#define RGBDSLAM_POSEOPTIMIZATION_MINIMALSOLVERS_HPP
+
+#include "coordinates/plane_coordinates.hpp"
+#include "coordinates/point_coordinates.hpp"
+#include "types.hpp"
+
+#include <array>
+#include <vector>
+
+namespace rgbd_slam::pose_optimization::minimal_solvers {
+
+/**
+ * \brief Compute the world to camera transformations that project three world points on three screen points (P3P)
+ * \param[in] worldPoints The map points, in world coordinates
+ * \param[in] screenPoints The matched points, in screen coordinates
+ * \param[out] transformations The candidate transformations (0 to 4), with the points in front of the camera
+ * \return true if at least one transformation was found
+ */
+[[nodiscard]] bool compute_p3p_transformations(const std::array<vector3, 3>& worldPoints,
+                                               const std::array<ScreenCoordinate2D, 3>& screenPoints,
+                                               std::vector<WorldToCameraMatrix>& transformations) noexcept;
+
+/**
+ * \brief Compute the world to camera transformation that aligns world planes with camera planes, in closed form.
+ * The rotation aligns the normals (Kabsch), the translation is the intersection of the plane offsets
+ * \param[in] worldPlanes The map planes, in world coordinates (at least 3)
+ * \param[in] cameraPlanes The matched planes, in camera coordinates
+ * \param[out] transformation The transformation
+ * \return false if the planes normals do not constrain all the axis (parallel planes)
+ */
+[[nodiscard]] bool compute_planes_transformation(const std::vector<PlaneWorldCoordinates>& worldPlanes,
+                                                 const std::vector<PlaneCameraCoordinates>& cameraPlanes,
+                                                 WorldToCameraMatrix& transformation) noexcept;
+
+} // namespace rgbd_slam::pose_optimization::minimal_solvers
+
+#endif
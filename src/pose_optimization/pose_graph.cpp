@@ -0,0 +1,509 @@
+#include "pose_graph.hpp"
+
+#include "logger.hpp"
+#include "parameters.hpp"
+#include "utils/camera_transformation.hpp"
+
+#include <Eigen/Geometry>
+#include <Eigen/SparseCholesky>
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <format>
+#include <random>
+
+namespace rgbd_slam::pose_optimization {
+
+/**
+ * Pose_Graph_Corrections
+ */
+
+void Pose_Graph_Corrections::correct_pose(utils::PoseBase& pose) const noexcept
+{
+    // the corrected pose sees the corrected world as the tracked pose saw the tracked world
+    const matrix44& correctedWorldToCamera =
+            utils::compute_world_to_camera_transform(pose.get_orientation_quaternion(), pose.get_position()) *
+            _mapCorrection.inverse();
+
+    quaternion rotation;
+    vector3 position;
+    utils::compute_pose_from_world_to_camera_transform(WorldToCameraMatrix(correctedWorldToCamera), rotation, position);
+    pose.set_parameters(position, rotation);
+}
+
+/**
+ * Graph optimization
+ */
+
+// the keypoint ids of the index are the node index, followed by the keypoint index in the node
+static constexpr uint keypointIdBitCount = 20;
+static_assert(parameters::optimization::poseGraph::maximumPointsPerKeyframe <= (1u << keypointIdBitCount));
+
+/**
+ * \brief Move a transformation by a small displacement, in its own coordinates
+ * \param[in] transformation A rigid transformation
+ * \param[in] displacement The translation, followed by the rotation vector of the displacement
+ */
+[[nodiscard]] matrix44 apply_displacement(const matrix44& transformation, const vector6& displacement) noexcept
+{
+    matrix44 displacementTransformation = matrix44::Identity();
+    const double angle = displacement.tail<3>().norm();
+    if (angle > 0.0)
+        displacementTransformation.block<3, 3>(0, 0) =
+                Eigen::AngleAxisd(angle, displacement.tail<3>() / angle).toRotationMatrix();
+    displacementTransformation.block<3, 1>(0, 3) = displacement.head<3>();
+    return transformation * displacementTransformation;
+}
+
+/**
+ * \brief Compute the residual of an edge: the translation and rotation vector of the transformation between its
+ * measure and the relative pose of its keyframes
+ */
+[[nodiscard]] vector6 get_edge_residual(const matrix44& measure,
+                                        const matrix44& fromCameraToWorld,
+                                        const matrix44& toCameraToWorld) noexcept
+{
+    const matrix44& error = measure.inverse() * fromCameraToWorld.inverse() * toCameraToWorld;
+    const Eigen::AngleAxisd rotationError(matrix33(error.block<3, 3>(0, 0)));
+
+    vector6 residual;
+    residual << error.block<3, 1>(0, 3), rotationError.angle() * rotationError.axis();
+    return residual;
+}
+
+bool Pose_Graph::optimize(const std::vector<Edge>& edges, std::vector<matrix44>& cameraToWorlds) noexcept
+{
+    static constexpr uint maximumIterations = parameters::optimization::poseGraph::maximumIterations;
+    static constexpr double stepSize = 1e-6; // numerical derivatives
+    static constexpr double damping = 1e-9;  // keeps the system positive definite
+
+    if (cameraToWorlds.size() < 2 or edges.empty())
+        return false;
+
+    // the first pose is fixed
+    const Eigen::Index freePoseCount = static_cast<Eigen::Index>(cameraToWorlds.size()) - 1;
+    std::vector<matrix44> optimizedPoses = cameraToWorlds;
+
+    for (uint iteration = 0; iteration < maximumIterations; ++iteration)
+    {
+        std::vector<Eigen::Triplet<double>> hessianCoefficients;
+        hessianCoefficients.reserve(edges.size() * 4 * 36 + static_cast<size_t>(freePoseCount) * 6);
+        vectorxd gradient = vectorxd::Zero(freePoseCount * 6);
+
+        for (const Edge& edge: edges)
+        {
+            const std::array<size_t, 2> nodes = {edge._from, edge._to};
+            const vector6& residual =
+                    edge._sqrtInformation.cwiseProduct(get_edge_residual(edge._measure,
+                                                                         optimizedPoses[edge._from],
+                                                                         optimizedPoses[edge._to]));
+
+            std::array<matrix66, 2> jacobians;
+            for (uint n = 0; n < 2; ++n)
+            {
+                for (Eigen::Index parameter = 0; parameter < 6; ++parameter)
+                {
+                    std::array<matrix44, 2> variatedPoses = {optimizedPoses[edge._from], optimizedPoses[edge._to]};
+                    variatedPoses[n] = apply_displacement(variatedPoses[n], vector6::Unit(parameter) * stepSize);
+                    jacobians[n].col(parameter) =
+                            (edge._sqrtInformation.cwiseProduct(
+                                     get_edge_residual(edge._measure, variatedPoses[0], variatedPoses[1])) -
+                             residual) /
+                            stepSize;
+                }
+            }
+
+            for (uint a = 0; a < 2; ++a)
+            {
+                if (nodes[a] == 0)
+                    continue;
+                const Eigen::Index rowOffset = static_cast<Eigen::Index>(nodes[a] - 1) * 6;
+                gradient.segment<6>(rowOffset) += jacobians[a].transpose() * residual;
+
+                for (uint b = 0; b < 2; ++b)
+                {
+                    if (nodes[b] == 0)
+                        continue;
+                    const Eigen::Index columnOffset = static_cast<Eigen::Index>(nodes[b] - 1) * 6;
+                    const matrix66& block = jacobians[a].transpose() * jacobians[b];
+                    for (Eigen::Index row = 0; row < 6; ++row)
+                        for (Eigen::Index column = 0; column < 6; ++column)
+                            hessianCoefficients.emplace_back(
+                                    rowOffset + row, columnOffset + column, block(row, column));
+                }
+            }
+        }
+        for (Eigen::Index i = 0; i < freePoseCount * 6; ++i)
+            hessianCoefficients.emplace_back(i, i, damping);
+
+        Eigen::SparseMatrix<double> hessian(freePoseCount * 6, freePoseCount * 6);
+        hessian.setFromTriplets(hessianCoefficients.cbegin(), hessianCoefficients.cend());
+
+        const Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> solver(hessian);
+        if (solver.info() != Eigen::Success)
+        {
+            outputs::log_error("The pose graph system could not be factorized");
+            return false;
+        }
+        const vectorxd& step = solver.solve(-gradient);
+        if (solver.info() != Eigen::Success or not step.allFinite())
+        {
+            outputs::log_error("The pose graph system could not be solved");
+            return false;
+        }
+
+        for (Eigen::Index i = 0; i < freePoseCount; ++i)
+        {
+            matrix44& pose = optimizedPoses[static_cast<size_t>(i + 1)];
+            pose = apply_displacement(pose, step.segment<6>(i * 6));
+        }
+
+        if (step.lpNorm<Eigen::Infinity>() < stepSize)
+            break;
+    }
+
+    cameraToWorlds.swap(optimizedPoses);
+    return true;
+}
+
+/**
+ * Loop detection
+ */
+
+/**
+ * \brief Compute the Hamming distance of two descriptor rows of Descriptor_Pool::descriptorSize bytes
+ */
+[[nodiscard]] int get_descriptor_distance(const uchar* descriptorA, const uchar* descriptorB) noexcept
+{
+    static constexpr size_t wordCount = tracking::Descriptor_Pool::descriptorSize / sizeof(uint64_t);
+    static_assert(wordCount * sizeof(uint64_t) == tracking::Descriptor_Pool::descriptorSize);
+
+    int distance = 0;
+    for (size_t i = 0; i < wordCount; ++i)
+    {
+        uint64_t wordA;
+        uint64_t wordB;
+        std::memcpy(&wordA, descriptorA + i * sizeof(uint64_t), sizeof(uint64_t));
+        std::memcpy(&wordB, descriptorB + i * sizeof(uint64_t), sizeof(uint64_t));
+        distance += std::popcount(wordA ^ wordB);
+    }
+    return distance;
+}
+
+/**
+ * \brief Compute the rigid transformation that moves a set of points to another one
+ * \param[in] sourcePoints The points to move, by column
+ * \param[in] targetPoints The corresponding points, by column
+ * \return The transformation from the source to the target points
+ */
+[[nodiscard]] matrix44 compute_rigid_transformation(const Eigen::Matrix3Xd& sourcePoints,
+                                                    const Eigen::Matrix3Xd& targetPoints) noexcept
+{
+    return Eigen::umeyama(sourcePoints, targetPoints, false);
+}
+
+bool Pose_Graph::detect_loop(const size_t nodeIndex, Edge& loopEdge) noexcept
+{
+    static constexpr int maximumDescriptorDistance = static_cast<int>(
+            (1.0 - parameters::matching::relocalization::minimumDescriptorSimilarity) *
+            tracking::Descriptor_Pool::descriptorSize * 8);
+    static constexpr double inlierDistance = parameters::optimization::poseGraph::loopInlierDistance_mm;
+
+    if (_keypointIndex.size() == 0)
+        return false;
+
+    const Node& node = _nodes[nodeIndex];
+
+    // match each keypoint to its closest indexed keypoint, and count the matches of each old node
+    struct Correspondence
+    {
+        size_t _point;
+        size_t _oldNode;
+        size_t _oldPoint;
+    };
+    std::vector<Correspondence> correspondences;
+    std::unordered_map<size_t, uint> nodeVotes;
+    std::vector<size_t> candidates;
+    for (int point = 0; point < node._descriptors.rows; ++point)
+    {
+        const cv::Mat& descriptor = node._descriptors.row(point);
+        _keypointIndex.query(descriptor, candidates);
+
+        int bestDistance = maximumDescriptorDistance + 1;
+        size_t bestCandidate = 0;
+        for (const size_t candidate: candidates)
+        {
+            const Node& oldNode = _nodes[candidate >> keypointIdBitCount];
+            const int oldPoint = static_cast<int>(candidate & ((1u << keypointIdBitCount) - 1));
+            const int distance =
+                    get_descriptor_distance(descriptor.ptr<uchar>(0), oldNode._descriptors.ptr<uchar>(oldPoint));
+            if (distance < bestDistance)
+            {
+                bestDistance = distance;
+                bestCandidate = candidate;
+            }
+        }
+        if (bestDistance > maximumDescriptorDistance)
+            continue;
+
+        const size_t oldNode = bestCandidate >> keypointIdBitCount;
+        correspondences.emplace_back(
+                static_cast<size_t>(point), oldNode, bestCandidate & ((1u << keypointIdBitCount) - 1));
+        ++nodeVotes[oldNode];
+    }
+
+    // the old node with the most matches, the oldest one on ties
+    size_t loopNode = 0;
+    uint loopVotes = 0;
+    for (const auto& [oldNode, votes]: nodeVotes)
+    {
+        if (votes > loopVotes or (votes == loopVotes and oldNode < loopNode))
+        {
+            loopNode = oldNode;
+            loopVotes = votes;
+        }
+    }
+    if (loopVotes < parameters::optimization::poseGraph::minimumLoopMatches)
+        return false;
+
+    Eigen::Matrix3Xd points(3, loopVotes);
+    Eigen::Matrix3Xd oldPoints(3, loopVotes);
+    Eigen::Index matchCount = 0;
+    for (const Correspondence& correspondence: correspondences)
+    {
+        if (correspondence._oldNode != loopNode)
+            continue;
+        points.col(matchCount) = node._cameraPoints[correspondence._point];
+        oldPoints.col(matchCount) = _nodes[loopNode]._cameraPoints[correspondence._oldPoint];
+        ++matchCount;
+    }
+
+    // RANSAC on the 3D point matches, with a fixed seed to stay deterministic
+    std::mt19937 randomEngine(static_cast<uint>(nodeIndex));
+    std::uniform_int_distribution<Eigen::Index> matchDistribution(0, matchCount - 1);
+    const auto get_inliers = [&points, &oldPoints, matchCount](const matrix44& transformation) {
+        const Eigen::Matrix3Xd& transformedPoints =
+                (transformation.block<3, 3>(0, 0) * points).colwise() + transformation.block<3, 1>(0, 3);
+        std::vector<Eigen::Index> inliers;
+        for (Eigen::Index i = 0; i < matchCount; ++i)
+        {
+            if ((transformedPoints.col(i) - oldPoints.col(i)).norm() <= inlierDistance)
+                inliers.emplace_back(i);
+        }
+        return inliers;
+    };
+
+    std::vector<Eigen::Index> bestInliers;
+    for (uint iteration = 0; iteration < parameters::optimization::poseGraph::loopRansacIterations; ++iteration)
+    {
+        std::array<Eigen::Index, 3> sample;
+        for (Eigen::Index& index: sample)
+            index = matchDistribution(randomEngine);
+        if (sample[0] == sample[1] or sample[0] == sample[2] or sample[1] == sample[2])
+            continue;
+
+        Eigen::Matrix3d samplePoints;
+        Eigen::Matrix3d sampleOldPoints;
+        for (Eigen::Index i = 0; i < 3; ++i)
+        {
+            samplePoints.col(i) = points.col(sample[i]);
+            sampleOldPoints.col(i) = oldPoints.col(sample[i]);
+        }
+        const matrix44& transformation = compute_rigid_transformation(samplePoints, sampleOldPoints);
+        if (not transformation.allFinite())
+            continue;
+
+        std::vector<Eigen::Index> inliers = get_inliers(transformation);
+        if (inliers.size() > bestInliers.size())
+            bestInliers.swap(inliers);
+    }
+    if (bestInliers.size() < parameters::optimization::poseGraph::minimumLoopInliers)
+        return false;
+
+    // refine on all inliers
+    loopEdge._measure = compute_rigid_transformation(points(Eigen::all, bestInliers), oldPoints(Eigen::all, bestInliers));
+    if (not loopEdge._measure.allFinite() or
+        get_inliers(loopEdge._measure).size() < parameters::optimization::poseGraph::minimumLoopInliers)
+        return false;
+
+    static const vector6 loopSqrtInformation =
+            (vector6() << vector3::Constant(1.0 / parameters::optimization::poseGraph::loopTranslationStandardDev_mm),
+             vector3::Constant(1.0 / (parameters::optimization::poseGraph::loopRotationStandardDev_d * EulerToRadian)))
+                    .finished();
+    loopEdge._from = loopNode;
+    loopEdge._to = nodeIndex;
+    loopEdge._sqrtInformation = loopSqrtInformation;
+    return true;
+}
+
+/**
+ * Pose_Graph
+ */
+
+Pose_Graph::~Pose_Graph() { stop(); }
+
+void Pose_Graph::start() noexcept
+{
+    if (_thread.joinable())
+    {
+        outputs::log_error("The pose graph is already running");
+        return;
+    }
+
+    _nodes.clear();
+    _cameraToWorlds.clear();
+    _edges.clear();
+    _keypointIndex.clear();
+    _indexedNodeCount = 0;
+    _lastLoopNodeIndex = 0;
+    _baseCorrectionId = 0;
+    _lastCorrectionId = 0;
+    _publishedCorrections.clear();
+    _corrections.store(nullptr);
+    _keyframes = std::make_unique<utils::Bounded_Queue<Pose_Graph_Keyframe>>(
+            parameters::optimization::poseGraph::keyframeQueueCapacity);
+    _thread = std::thread(&Pose_Graph::run, this);
+}
+
+void Pose_Graph::stop() noexcept
+{
+    if (not _thread.joinable())
+        return;
+
+    _keyframes->close();
+    _thread.join();
+    _keyframes.reset();
+}
+
+bool Pose_Graph::add_keyframe(Pose_Graph_Keyframe&& keyframe) noexcept
+{
+    if (_keyframes == nullptr)
+        return false;
+
+    if (not _keyframes->try_push(std::move(keyframe)))
+    {
+        ++_droppedKeyframeCount;
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<const Pose_Graph_Corrections> Pose_Graph::get_corrections() noexcept
+{
+    return _corrections.exchange(nullptr);
+}
+
+size_t Pose_Graph::add_node(Pose_Graph_Keyframe&& keyframe) noexcept
+{
+    // the tracking applied corrections since the last keyframe: move the last tracked pose in its new world
+    if (keyframe._appliedCorrectionId != _baseCorrectionId)
+    {
+        const auto correctionIterator = _publishedCorrections.find(keyframe._appliedCorrectionId);
+        if (correctionIterator != _publishedCorrections.cend())
+            _lastTrackedCameraToWorld = correctionIterator->second * _lastTrackedCameraToWorld;
+        else
+            outputs::log_error("The tracking applied unknown pose graph corrections");
+
+        // the other published corrections are relative to the previous world, they will be dropped by the tracking
+        _publishedCorrections.clear();
+        _baseCorrectionId = keyframe._appliedCorrectionId;
+    }
+
+    const matrix44& trackedCameraToWorld = utils::compute_camera_to_world_transform(
+            keyframe._pose.get_orientation_quaternion(), keyframe._pose.get_position());
+
+    const size_t nodeIndex = _nodes.size();
+    if (nodeIndex == 0)
+        _cameraToWorlds.emplace_back(trackedCameraToWorld);
+    else
+    {
+        static const vector6 odometrySqrtInformation =
+                (vector6() << vector3::Constant(
+                         1.0 / parameters::optimization::poseGraph::odometryTranslationStandardDev_mm),
+                 vector3::Constant(
+                         1.0 / (parameters::optimization::poseGraph::odometryRotationStandardDev_d * EulerToRadian)))
+                        .finished();
+
+        // odometry edge: the tracked motion since the last keyframe
+        const matrix44& motion = _lastTrackedCameraToWorld.inverse() * trackedCameraToWorld;
+        _edges.emplace_back(nodeIndex - 1, nodeIndex, motion, odometrySqrtInformation);
+        _cameraToWorlds.emplace_back(_cameraToWorlds.back() * motion);
+    }
+    _lastTrackedCameraToWorld = trackedCameraToWorld;
+
+    _nodes.emplace_back(std::move(keyframe._cameraPoints), std::move(keyframe._descriptors));
+    return nodeIndex;
+}
+
+void Pose_Graph::publish_corrections() noexcept
+{
+    auto corrections = std::make_shared<Pose_Graph_Corrections>();
+    corrections->_id = ++_lastCorrectionId;
+    corrections->_baseId = _baseCorrectionId;
+    corrections->_mapCorrection << _cameraToWorlds.back() * _lastTrackedCameraToWorld.inverse();
+
+    _publishedCorrections.emplace(corrections->_id, corrections->_mapCorrection);
+    // the corrections that the tracking did not take yet are replaced: this one starts from the same world
+    _corrections.store(std::move(corrections));
+}
+
+void Pose_Graph::run() noexcept
+{
+    static constexpr uint loopKeyframeGap = parameters::optimization::poseGraph::minimumLoopKeyframeGap;
+
+    Pose_Graph_Keyframe keyframe;
+    while (_keyframes->pop(keyframe))
+    {
+        const size_t nodeIndex = add_node(std::move(keyframe));
+
+        // the keyframes following a closed loop see the same place: they would close the same loop again
+        Edge loopEdge;
+        if ((_closedLoopCount == 0 or nodeIndex >= _lastLoopNodeIndex + loopKeyframeGap) and
+            detect_loop(nodeIndex, loopEdge))
+        {
+            const double optimizationStartTime = static_cast<double>(cv::getTickCount());
+
+            _edges.emplace_back(loopEdge);
+            if (optimize(_edges, _cameraToWorlds))
+            {
+                publish_corrections();
+                _lastLoopNodeIndex = nodeIndex;
+                ++_closedLoopCount;
+            }
+            else
+            {
+                // the poses are unchanged: the rejected loop edge is not kept, it could be detected again
+                _edges.pop_back();
+            }
+
+            _optimizationDuration.fetch_add((static_cast<double>(cv::getTickCount()) - optimizationStartTime) /
+                                            cv::getTickFrequency());
+        }
+
+        // index the nodes that became old enough to close a loop with the new ones
+        for (; _indexedNodeCount + loopKeyframeGap <= nodeIndex; ++_indexedNodeCount)
+        {
+            const cv::Mat& descriptors = _nodes[_indexedNodeCount]._descriptors;
+            for (int point = 0; point < descriptors.rows; ++point)
+            {
+                _keypointIndex.insert_or_update((_indexedNodeCount << keypointIdBitCount) | static_cast<size_t>(point),
+                                                descriptors.row(point));
+            }
+        }
+    }
+}
+
+void Pose_Graph::show_statistics() const noexcept
+{
+    const uint closedLoopCount = _closedLoopCount;
+    if (closedLoopCount > 0)
+    {
+        outputs::log(std::format("\tMean pose graph optimization time is {:.4f} seconds, in the background ({} loops "
+                                 "closed, {} keyframes dropped)",
+                                 _optimizationDuration / static_cast<double>(closedLoopCount),
+                                 closedLoopCount,
+                                 _droppedKeyframeCount.load()));
+    }
+}
+
+} // namespace rgbd_slam::pose_optimization
@@ -0,0 +1,170 @@
+#ifndef RGBDSLAM_POSEOPTIMIZATION_POSEGRAPH_HPP
+#define RGBDSLAM_POSEOPTIMIZATION_POSEGRAPH_HPP
+
+#include "map_management/relocalization_index.hpp"
+#include "types.hpp"
+#include "utils/bounded_queue.hpp"
+#include "utils/pose.hpp"
+
+#include <atomic>
+#include <memory>
+#include <opencv2/core.hpp>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace rgbd_slam::pose_optimization {
+
+/**
+ * \brief A keyframe submitted to the pose graph: its tracked pose, and the keypoints with a depth and a descriptor
+ */
+struct Pose_Graph_Keyframe
+{
+    utils::PoseBase _pose;
+    // id of the last pose graph corrections applied by the tracking when this keyframe was tracked (0 for none)
+    size_t _appliedCorrectionId = 0;
+    std::vector<vector3> _cameraPoints; // keypoints in camera coordinates
+    cv::Mat _descriptors;               // descriptor of each keypoint, by row
+};
+
+/**
+ * \brief The rigid correction of the map computed by a pose graph optimization: it moves the tracked world to the
+ * optimized world, at the last keyframe
+ */
+struct Pose_Graph_Corrections
+{
+    size_t _id = 0;     // corrections are numbered from 1, in publication order
+    size_t _baseId = 0; // id of the corrections that the tracked poses must have applied for this one to be valid
+    // world to corrected world transformation, in the form of a world to camera matrix
+    WorldToCameraMatrix _mapCorrection;
+
+    /**
+     * \brief Move a pose tracked in the uncorrected world to the corrected world
+     * \param[in, out] pose The pose to correct
+     */
+    void correct_pose(utils::PoseBase& pose) const noexcept;
+};
+
+/**
+ * \brief Loop closing backend, on a background thread: keeps a pose graph of the keyframes, detects loops by matching
+ * the keyframe descriptors to the old keyframes through a relocalization index, and optimizes the graph when a loop
+ * is found.
+ * The tracking thread pushes keyframes without waiting, and collects the corrections between two frames. The
+ * corrections are published with an atomic pointer swap, the two threads never wait for each other
+ */
+class Pose_Graph
+{
+  public:
+    Pose_Graph() = default;
+    ~Pose_Graph();
+
+    /**
+     * \brief Start the pose graph thread
+     */
+    void start() noexcept;
+
+    /**
+     * \brief Stop the pose graph thread, dropping the keyframes waiting for a treatment
+     */
+    void stop() noexcept;
+
+    /**
+     * \brief Submit a new keyframe, without waiting
+     * \param[in] keyframe The keyframe to add. Dropped if too many keyframes are waiting for a treatment
+     * \return false if the keyframe was dropped
+     */
+    [[nodiscard]] bool add_keyframe(Pose_Graph_Keyframe&& keyframe) noexcept;
+
+    /**
+     * \brief Take the corrections computed since the last call
+     * \return The corrections, or nullptr if none were computed
+     */
+    [[nodiscard]] std::shared_ptr<const Pose_Graph_Corrections> get_corrections() noexcept;
+
+    /**
+     * \brief A relative pose measure between two keyframes of the graph
+     */
+    struct Edge
+    {
+        size_t _from;
+        size_t _to;
+        matrix44 _measure;        // transformation from the _to to the _from camera coordinates
+        vector6 _sqrtInformation; // inverse of the standard deviations of the translation and rotation residuals
+    };
+
+    /**
+     * \brief Optimize the keyframe poses of a graph with a sparse Gauss-Newton. The first pose is fixed.
+     * \param[in] edges The relative pose measures
+     * \param[in, out] cameraToWorlds The camera to world matrices of the keyframes
+     * \return false if the optimization failed, the poses are not modified
+     */
+    [[nodiscard]] static bool optimize(const std::vector<Edge>& edges, std::vector<matrix44>& cameraToWorlds) noexcept;
+
+    /**
+     * \brief Show the statistics of the pose graph thread
+     */
+    void show_statistics() const noexcept;
+
+  private:
+    /**
+     * \brief A keyframe node of the graph, with its keypoints kept for the loop detection
+     */
+    struct Node
+    {
+        std::vector<vector3> _cameraPoints;
+        cv::Mat _descriptors;
+    };
+
+    /**
+     * \brief Thread function: adds the keyframes to the graph, and optimizes it when a loop is found
+     */
+    void run() noexcept;
+
+    /**
+     * \brief Add a keyframe to the graph, with the odometry edge from the last keyframe
+     * \return The index of the new node
+     */
+    size_t add_node(Pose_Graph_Keyframe&& keyframe) noexcept;
+
+    /**
+     * \brief Search an old keyframe observing the same place as a node, and measure their relative pose
+     * \param[in] nodeIndex The index of the new node
+     * \param[out] loopEdge The loop edge, from the old keyframe to this node
+     * \return true if a loop was found
+     */
+    [[nodiscard]] bool detect_loop(const size_t nodeIndex, Edge& loopEdge) noexcept;
+
+    /**
+     * \brief Publish the map correction of the last keyframe, after an optimization
+     */
+    void publish_corrections() noexcept;
+
+    std::vector<Node> _nodes;
+    std::vector<matrix44> _cameraToWorlds; // optimized camera to world matrix of each node
+    std::vector<Edge> _edges;
+    map_management::Relocalization_Index _keypointIndex; // keypoints of the nodes old enough to close a loop
+    size_t _indexedNodeCount = 0;
+    size_t _lastLoopNodeIndex = 0; // node of the last closed loop
+
+    matrix44 _lastTrackedCameraToWorld = matrix44::Identity(); // tracked pose of the last node, in the base world
+    size_t _baseCorrectionId = 0;                               // corrections applied to the tracked poses
+    size_t _lastCorrectionId = 0;
+    std::unordered_map<size_t, WorldToCameraMatrix> _publishedCorrections; // not yet applied, by id
+
+    std::unique_ptr<utils::Bounded_Queue<Pose_Graph_Keyframe>> _keyframes = nullptr;
+    std::atomic<std::shared_ptr<const Pose_Graph_Corrections>> _corrections;
+    std::thread _thread;
+
+    // perf measurments
+    std::atomic<uint> _closedLoopCount = 0;
+    std::atomic<uint> _droppedKeyframeCount = 0;
+    std::atomic<double> _optimizationDuration = 0.0;
+
+    // Remove copy operators
+    Pose_Graph(const Pose_Graph& other) = delete;
+    void operator=(const Pose_Graph& other) = delete;
+};
+
+} // namespace rgbd_slam::pose_optimization
+
+#endif
@@ -3,20 +3,30 @@
 #include "covariances.hpp"
 #include "distance_utils.hpp"
 #include "outputs/logger.hpp"
+#include "outputs/trace_recorder.hpp"
 #include "parameters.hpp"
+#include "levenberg_marquardt.hpp"
 #include "levenberg_marquardt_functors.hpp"
+#include "match_blocks.hpp"
 #include "matches_containers.hpp"
 #include "ransac.hpp"
 #include "types.hpp"
 
+#include "utils/angle_utils.hpp"
 #include "utils/camera_transformation.hpp"
+#include "utils/random.hpp"
 
 #include <Eigen/StdVector>
+#include <algorithm>
+#include <array>
 #include <cmath>
-#include <exception>
+#include <cstddef>
+#include <functional>
 #include <opencv2/core/utility.hpp>
+#include <optional>
 #include <stdexcept>
 #include <string>
+#include <vector>
 #include <format>
 
 #include <tbb/parallel_for.h>
@@ -24,51 +34,33 @@
 namespace rgbd_slam::pose_optimization {
 
 /**
- * \brief Compute a score for a transformation, and compute an inlier and outlier set
- * \param[in] featuresToEvaluate The set of features to evaluate the transformation on
- * \param[in] transformationPose The transformation that needs to be evaluated
- * \param[out] matchSets The set of inliers/outliers of this transformation
- * \return The feature score
+ * \brief Split a set of features in inliers and outliers
+ * \param[in] featuresToEvaluate The set of features to split
+ * \param[in] isInlier The inlier flag of each feature, in the same order
+ * \param[out] matchSets The set of inliers/outliers
  */
-[[nodiscard]] double get_features_inliers_outliers(const matches_containers::match_container& featuresToEvaluate,
-                                                   const utils::PoseBase& transformationPose,
-                                                   matches_containers::match_sets& matchSets) noexcept
+void split_inliers_outliers(const matches_containers::match_container& featuresToEvaluate,
+                            const std::vector<bool>& isInlier,
+                            matches_containers::match_sets& matchSets) noexcept
 {
+    assert(featuresToEvaluate.size() == isInlier.size());
     matchSets.clear();
 
-    // get a world to camera transform to evaluate the retroprojection score
-    const WorldToCameraMatrix& worldToCamera = utils::compute_world_to_camera_transform(
-            transformationPose.get_orientation_quaternion(), transformationPose.get_position());
-
-    double featureScore = 0.0;
+    size_t matchIndex = 0;
     for (const auto& match: featuresToEvaluate)
     {
-        bool isInlier = false;
-        // Retroproject world feature to screen, and compute screen distance
-        try
-        {
-            // this may throw on rare occasions
-            isInlier = match->is_inlier(worldToCamera);
-        }
-        catch (const std::exception& ex)
-        {
-            outputs::log_error("get_features_inliers_outliers: caught exeption while computing distance: " +
-                               std::string(ex.what()));
-        }
-
         // inlier
-        if (isInlier)
+        if (isInlier[matchIndex])
         {
             matchSets._inliers.insert(matchSets._inliers.end(), match);
-            featureScore += match->get_score();
         }
         // not an inlier, add to ouliers
         else
         {
             matchSets._outliers.insert(matchSets._outliers.end(), match);
         }
+        ++matchIndex;
     }
-    return featureScore;
 }
 
 /**
@@ -104,11 +96,57 @@ double get_feature_set_optimization_score(const matches_containers::match_contai
     return matchSubset;
 }
 
-bool Pose_Optimization::compute_pose_with_ransac(const utils::PoseBase& currentPose,
+/**
+ * \brief Compute a candidate pose from a minimal subset of matches, with a closed form solver
+ * \param[in] selectedMatches The subset of matches to compute a pose from
+ * \param[out] pose The candidate pose that best fits the subset
+ * \return false if this subset cannot be solved in closed form
+ */
+[[nodiscard]] bool compute_minimal_pose(const matches_containers::match_container& selectedMatches,
+                                        utils::PoseBase& pose) noexcept
+{
+    const Match_Blocks subsetBlocks(selectedMatches);
+    std::vector<WorldToCameraMatrix> transformations;
+    if (not subsetBlocks.compute_minimal_transformations(transformations))
+        return false;
+
+    // the solvers can return multiple solutions: keep the one that explains the most of the subset
+    double bestScore = -1.0;
+    double bestResidual = 0.0;
+    const WorldToCameraMatrix* bestTransformation = nullptr;
+    std::vector<bool> isInlier;
+    vectorxd residuals(subsetBlocks.get_part_count());
+    for (const WorldToCameraMatrix& transformation: transformations)
+    {
+        const double score = subsetBlocks.compute_inliers(transformation, isInlier);
+        subsetBlocks.compute_residuals(transformation, residuals);
+        const double residual = residuals.squaredNorm();
+        if (score > bestScore or (utils::double_equal(score, bestScore) and residual < bestResidual))
+        {
+            bestScore = score;
+            bestResidual = residual;
+            bestTransformation = &transformation;
+        }
+    }
+    if (bestTransformation == nullptr)
+        return false;
+
+    quaternion orientation;
+    vector3 position;
+    utils::compute_pose_from_world_to_camera_transform(*bestTransformation, orientation, position);
+    if (not orientation.coeffs().allFinite() or not position.allFinite())
+        return false;
+    pose.set_parameters(position, orientation);
+    return true;
+}
+
+bool Pose_Optimization::compute_pose_with_ransac(const utils::Pose& currentPose,
                                                  const matches_containers::match_container& matchedFeatures,
                                                  utils::PoseBase& finalPose,
-                                                 matches_containers::match_sets& featureSets) noexcept
+                                                 matches_containers::match_sets& featureSets,
+                                                 const double maximumDuration_s) noexcept
 {
+    const outputs::Scoped_Trace trace("ransac");
     const double computePoseRansacStartTime = static_cast<double>(cv::getTickCount());
 
     featureSets.clear();
@@ -125,11 +163,16 @@ bool Pose_Optimization::compute_pose_with_ransac(const utils::PoseBase& currentP
         return false;
     }
 
-    // Compute maximum iteration with the original RANSAC formula
-    static constexpr uint maximumIterations =
-            (std::ceil(std::log(1.0f - parameters::optimization::ransac::probabilityOfSuccess) /
-                       std::log(1.0f - std::pow(parameters::optimization::ransac::inlierProportion,
-                                                parameters::optimization::ransac::featureTrustCount))));
+    // Compute maximum iteration with the original RANSAC formula, from the expected inlier proportion. It is reduced
+    // by the inlier proportion of the best hypothesis, as they come
+    const double probabilityOfSuccess = Parameters::get_ransac_probability_of_success();
+    const double sampleSize = Parameters::get_ransac_feature_trust_count();
+    const uint initialIterations =
+            ransac::compute_ransac_iteration_count(probabilityOfSuccess,
+                                                   Parameters::get_ransac_inlier_proportion(),
+                                                   sampleSize,
+                                                   parameters::optimization::ransac::maximumIterationCount);
+    uint maximumIterations = initialIterations;
     if (maximumIterations <= 0)
     {
         outputs::log_error("maximumIterations should be > 0, no pose optimization will be made");
@@ -139,92 +182,236 @@ bool Pose_Optimization::compute_pose_with_ransac(const utils::PoseBase& currentP
     }
 
     const size_t inliersToStop = (size_t)std::ceil(
-            matchedFeatures.size() * parameters::optimization::ransac::minimumInliersProportionForEarlyStop);
+            matchedFeatures.size() * Parameters::get_ransac_early_stop_inlier_proportion());
 
     double maxScore = 1.0; // 1.0 is the minimum score we can have for a set of matches to optimize a pose
     utils::PoseBase bestPose = currentPose;
-    matches_containers::match_sets finalFeatureSets;
+    // the hypotheses only keep inlier flags: the match sets are built once, for the best hypothesis
+    std::vector<bool> bestIsInlier;
+    size_t bestInlierCount = 0;
+
+    // The subsets are drawn serially (the random engine is not shared between threads), then the hypotheses are
+    // optimized and scored in parallel, and reduced in draw order: the result does not depend on the scheduling
+    static constexpr uint hypothesisBatchSize = 8;
+    struct Hypothesis
+    {
+        matches_containers::match_container selectedMatches;
+        utils::PoseBase pose;
+        std::vector<bool> isInlier;
+        size_t inlierCount = 0;
+        double score = 0.0;
+        bool isValid = false;
+        double optimizationDuration = 0.0;
+        double getInliersDuration = 0.0;
+    };
+    std::array<Hypothesis, hypothesisBatchSize> hypotheses;
 
-    std::atomic_bool canQuit = false;
-    std::mutex mut;
+    const auto optimize_hypothesis = [this, &currentPose, &hypotheses](const size_t hypothesisIndex) {
+        Hypothesis& hypothesis = hypotheses[hypothesisIndex];
 
-#ifndef MAKE_DETERMINISTIC
-    // parallel loop to speed up the process
-    // USING THIS PARALLEL LOOP BREAKS THE RANDOM SEEDING
-    tbb::parallel_for(
-            uint(0),
-            maximumIterations,
-            [&](uint iteration) {
-                if (canQuit.load())
-                    return;
-#else
-    for (uint iteration = 0; iteration < maximumIterations; ++iteration)
-    {
-        if (canQuit.load())
-            break;
-#endif
+        // compute a new candidate pose to evaluate: in closed form when the subset allows it, the final pose is
+        // optimized on all the inliers anyway
+        const double computeOptimisedPoseTime = static_cast<double>(cv::getTickCount());
+        hypothesis.isValid = parameters::optimization::ransac::useMinimalSolvers and
+                             compute_minimal_pose(hypothesis.selectedMatches, hypothesis.pose);
+        if (not hypothesis.isValid)
+        {
+            hypothesis.isValid = Pose_Optimization::compute_optimized_global_pose(
+                    currentPose, hypothesis.selectedMatches, hypothesis.pose);
+        }
+        hypothesis.optimizationDuration =
+                (static_cast<double>(cv::getTickCount()) - computeOptimisedPoseTime) / cv::getTickFrequency();
+    };
+    // sort the features by type once, every hypothesis is scored on all of them
+    const Match_Blocks featureBlocks(matchedFeatures);
+    // two scores closer than this are equal: the hypothesis with more inliers wins
+    static constexpr double scoreTieTolerance = 0.1;
+    // the lowest score that can beat the best hypothesis of the previous batches. Fixed during a batch: the result
+    // does not depend on the scoring order
+    double scoreToBeat = 1.0;
+    const auto score_hypothesis = [&featureBlocks, &hypotheses, &scoreToBeat](const size_t hypothesisIndex) {
+        Hypothesis& hypothesis = hypotheses[hypothesisIndex];
+        if (not hypothesis.isValid)
+            return;
+
+        // get inliers and outliers for this transformation. The scoring stops as soon as it cannot win
+        const double getRANSACInliersTime = static_cast<double>(cv::getTickCount());
+        const WorldToCameraMatrix& worldToCamera = utils::compute_world_to_camera_transform(
+                hypothesis.pose.get_orientation_quaternion(), hypothesis.pose.get_position());
+        hypothesis.score = featureBlocks.compute_inliers(worldToCamera, hypothesis.isInlier, scoreToBeat);
+
+        // optimization failed or lost, not enough inliers
+        hypothesis.isValid = hypothesis.score >= scoreToBeat;
+        if (hypothesis.isValid)
+            hypothesis.inlierCount = static_cast<size_t>(std::ranges::count(hypothesis.isInlier, true));
+        hypothesis.getInliersDuration +=
+                (static_cast<double>(cv::getTickCount()) - getRANSACInliersTime) / cv::getTickFrequency();
+    };
 
-                // TODO: refuse a random subset if it is illformed, or uses the same map/detected feature id
-                const double getRandomSubsetStartTime = static_cast<double>(cv::getTickCount());
-                // get a random subset for this iteration
-                const matches_containers::match_container& selectedMatches = get_random_subset(matchedFeatures);
-                _meanGetRandomSubsetDuration +=
-                        (static_cast<double>(cv::getTickCount()) - getRandomSubsetStartTime) / cv::getTickFrequency();
-
-                // compute a new candidate pose to evaluate
-                const double computeOptimisedPoseTime = static_cast<double>(cv::getTickCount());
-                utils::PoseBase candidatePose;
-                if (not Pose_Optimization::compute_optimized_global_pose(currentPose, selectedMatches, candidatePose))
-#ifndef MAKE_DETERMINISTIC
-                    return;
-#else
-            continue;
-#endif
-                _meanRANSACPoseOptimizationDuration +=
-                        (static_cast<double>(cv::getTickCount()) - computeOptimisedPoseTime) / cv::getTickFrequency();
-
-                // get inliers and outliers for this transformation
-                const double getRANSACInliersTime = static_cast<double>(cv::getTickCount());
-                matches_containers::match_sets potentialInliersOutliers;
-                const double featureInlierScore =
-                        get_features_inliers_outliers(matchedFeatures, candidatePose, potentialInliersOutliers);
-                _meanRANSACGetInliersDuration +=
-                        (static_cast<double>(cv::getTickCount()) - getRANSACInliersTime) / cv::getTickFrequency();
-
-                // optimization failed, not enough inliers
-                if (featureInlierScore < 1.0)
-                {
-#ifndef MAKE_DETERMINISTIC
-                    return;
-#else
-            continue;
-#endif
-                }
+    // PROSAC: the matches are sorted by decreasing quality, and the sampling pool grows from the smallest set of best
+    // matches that can optimize a pose, to all the matches
+    std::vector<matches_containers::feat_ptr> sortedMatches(matchedFeatures.cbegin(), matchedFeatures.cend());
+    size_t initialPoolSize = 0;
+    // preemptive scoring: the hypotheses of a batch are scored on the same random order of matches
+    std::vector<matches_containers::feat_ptr> scoringOrder;
+    if constexpr (parameters::optimization::ransac::useProgressiveSampling)
+    {
+        std::ranges::stable_sort(sortedMatches, std::ranges::greater(), [](const matches_containers::feat_ptr& match) {
+            return match->get_quality();
+        });
+        for (double poolScore = 0.0; poolScore < 1.0 and initialPoolSize < sortedMatches.size(); ++initialPoolSize)
+        {
+            poolScore += sortedMatches[initialPoolSize]->get_score();
+        }
 
-                // Better score, or same score but more inliers
-                const bool canOverload = (featureInlierScore > maxScore) or
-                                         (utils::double_equal(featureInlierScore, maxScore, 0.1) and
-                                          finalFeatureSets._inliers.size() < potentialInliersOutliers._inliers.size());
-                if (canOverload)
-                {
-                    std::scoped_lock<std::mutex> lock(mut);
-                    maxScore = featureInlierScore;
-                    bestPose = candidatePose;
-                    // save features inliers and outliers
-                    finalFeatureSets.swap(potentialInliersOutliers);
-                }
+        scoringOrder = sortedMatches;
+        std::ranges::shuffle(scoringOrder, utils::Random::get_random_engine());
+    }
+    // the pool grows with the initial iteration count: it does not depend on the hypotheses
+    const uint fullPoolIteration = std::max(
+            1u, static_cast<uint>(initialIterations * parameters::optimization::ransac::progressiveSamplingGrowth));
+    const auto get_pool_size = [&sortedMatches, initialPoolSize, fullPoolIteration](const uint iteration) {
+        if (iteration >= fullPoolIteration)
+            return sortedMatches.size();
+        return initialPoolSize + (sortedMatches.size() - initialPoolSize) * iteration / fullPoolIteration;
+    };
+
+    bool canQuit = false;
+    for (uint batchStart = 0; batchStart < maximumIterations and not canQuit; batchStart += hypothesisBatchSize)
+    {
+        const uint batchSize = std::min(hypothesisBatchSize, maximumIterations - batchStart);
+        _ransacIterationCount += batchSize;
+
+        // TODO: refuse a random subset if it is illformed, or uses the same map/detected feature id
+        const double getRandomSubsetStartTime = static_cast<double>(cv::getTickCount());
+        for (uint i = 0; i < batchSize; ++i)
+        {
+            // get a random subset for this iteration
+            Hypothesis& hypothesis = hypotheses[i];
+            if constexpr (parameters::optimization::ransac::useProgressiveSampling)
+            {
+                hypothesis.selectedMatches =
+                        ransac::get_progressive_subset_with_score<matches_containers::match_container>(
+                                sortedMatches, get_pool_size(batchStart + i), 1.0);
+            }
+            else
+            {
+                hypothesis.selectedMatches = get_random_subset(matchedFeatures);
+            }
+            hypothesis.inlierCount = 0;
+            hypothesis.score = 0.0;
+            hypothesis.isValid = false;
+            hypothesis.getInliersDuration = 0.0;
+        }
+        _meanGetRandomSubsetDuration +=
+                (static_cast<double>(cv::getTickCount()) - getRandomSubsetStartTime) / cv::getTickFrequency();
+
+        tbb::parallel_for(size_t(0), static_cast<size_t>(batchSize), optimize_hypothesis);
+
+        if constexpr (parameters::optimization::ransac::useProgressiveSampling)
+        {
+            // preemptive scoring: score the hypotheses on growing blocks of matches, and drop the worst half of them
+            // after each block. Only the remaining hypotheses are scored on all the matches
+            const double preemptiveScoringStartTime = static_cast<double>(cv::getTickCount());
+            std::array<double, hypothesisBatchSize> partialScores {};
+            std::array<WorldToCameraMatrix, hypothesisBatchSize> worldToCameras;
+            std::vector<size_t> remainingHypotheses;
+            remainingHypotheses.reserve(batchSize);
+            for (size_t i = 0; i < batchSize; ++i)
+            {
+                if (not hypotheses[i].isValid)
+                    continue;
+                remainingHypotheses.emplace_back(i);
+                worldToCameras[i] = utils::compute_world_to_camera_transform(
+                        hypotheses[i].pose.get_orientation_quaternion(), hypotheses[i].pose.get_position());
+            }
 
-                // we have enough features, quit the loop
-                // The first guess forces the program to try at least some iterations
-                static constexpr size_t minIterations = 3;
-                if (iteration >= minIterations and finalFeatureSets._inliers.size() > inliersToStop)
+            for (size_t blockStart = 0; remainingHypotheses.size() > 1 and blockStart < scoringOrder.size();
+                 blockStart += parameters::optimization::ransac::preemptiveScoringBlockSize)
+            {
+                const size_t blockEnd = std::min(
+                        scoringOrder.size(), blockStart + parameters::optimization::ransac::preemptiveScoringBlockSize);
+                for (const size_t hypothesisIndex: remainingHypotheses)
                 {
-                    canQuit.store(true);
+                    for (size_t matchIndex = blockStart; matchIndex < blockEnd; ++matchIndex)
+                    {
+                        const matches_containers::feat_ptr& match = scoringOrder[matchIndex];
+                        if (match->is_inlier(worldToCameras[hypothesisIndex]))
+                            partialScores[hypothesisIndex] += match->get_score();
+                    }
                 }
+
+                // keep the best half, the draw order decides between equal scores
+                std::ranges::stable_sort(remainingHypotheses, std::ranges::greater(), [&partialScores](const size_t i) {
+                    return partialScores[i];
+                });
+                remainingHypotheses.resize((remainingHypotheses.size() + 1) / 2);
+            }
+
+            std::array<bool, hypothesisBatchSize> isRemaining {};
+            for (const size_t hypothesisIndex: remainingHypotheses)
+                isRemaining[hypothesisIndex] = true;
+            for (size_t i = 0; i < batchSize; ++i)
+                hypotheses[i].isValid = isRemaining[i];
+            _meanRANSACGetInliersDuration +=
+                    (static_cast<double>(cv::getTickCount()) - preemptiveScoringStartTime) / cv::getTickFrequency();
+        }
+
+        // 1.0 is the minimum score to optimize a pose
+        scoreToBeat = std::max(1.0, maxScore - scoreTieTolerance);
+        tbb::parallel_for(size_t(0), static_cast<size_t>(batchSize), score_hypothesis);
+
+        for (uint i = 0; i < batchSize; ++i)
+        {
+            Hypothesis& hypothesis = hypotheses[i];
+            _meanRANSACPoseOptimizationDuration += hypothesis.optimizationDuration;
+            _meanRANSACGetInliersDuration += hypothesis.getInliersDuration;
+            if (not hypothesis.isValid)
+                continue;
+
+            // Better score, or same score but more inliers
+            const bool canOverload =
+                    (hypothesis.score > maxScore) or
+                    (utils::double_equal(hypothesis.score, maxScore, scoreTieTolerance) and
+                     bestInlierCount < hypothesis.inlierCount);
+            if (canOverload)
+            {
+                maxScore = hypothesis.score;
+                bestPose = hypothesis.pose;
+                // save features inliers and outliers
+                bestIsInlier.swap(hypothesis.isInlier);
+                bestInlierCount = hypothesis.inlierCount;
             }
+        }
+
+        // adaptive bound: the subset inlier probability of the best hypothesis so far
+        const double bestInlierProportion =
+                static_cast<double>(bestInlierCount) / static_cast<double>(matchedFeatures.size());
+        maximumIterations = std::min(maximumIterations,
+                                     ransac::compute_ransac_iteration_count(probabilityOfSuccess,
+                                                                            bestInlierProportion,
+                                                                            sampleSize,
+                                                                            initialIterations));
+
+        // we have enough features, quit the loop
+        // The first guess forces the program to try at least some iterations
+        static constexpr size_t minIterations = 3;
+        canQuit = (batchStart + batchSize > minIterations) and bestInlierCount > inliersToStop;
+
 #ifndef MAKE_DETERMINISTIC
-    );
+        // latency budget of this frame: a time cap would make the result depend on the machine load
+        if (maximumDuration_s > 0.0 and bestInlierCount > 0 and
+            (static_cast<double>(cv::getTickCount()) - computePoseRansacStartTime) / cv::getTickFrequency() >
+                    maximumDuration_s)
+        {
+            canQuit = true;
+        }
 #endif
+    }
+
+    matches_containers::match_sets finalFeatureSets;
+    if (bestInlierCount > 0)
+        split_inliers_outliers(matchedFeatures, bestIsInlier, finalFeatureSets);
 
     // We do not have enough inliers to consider this optimization as valid
     const double inlierScore = get_feature_set_optimization_score(finalFeatureSets._inliers);
@@ -242,8 +429,8 @@ bool Pose_Optimization::compute_pose_with_ransac(const utils::PoseBase& currentP
     }
 
     // optimize on all inliers, starting pose is the best pose we found with RANSAC
-    const bool isPoseValid =
-            Pose_Optimization::compute_optimized_global_pose(bestPose, finalFeatureSets._inliers, finalPose);
+    const bool isPoseValid = Pose_Optimization::compute_optimized_global_pose(
+            bestPose, finalFeatureSets._inliers, finalPose, &currentPose);
     if (isPoseValid)
     {
         // store the result
@@ -261,10 +448,11 @@ bool Pose_Optimization::compute_pose_with_ransac(const utils::PoseBase& currentP
     return false;
 }
 
-bool Pose_Optimization::compute_optimized_pose(const utils::PoseBase& currentPose,
+bool Pose_Optimization::compute_optimized_pose(const utils::Pose& currentPose,
                                                const matches_containers::match_container& matchedFeatures,
                                                utils::Pose& optimizedPose,
-                                               matches_containers::match_sets& featureSets) noexcept
+                                               matches_containers::match_sets& featureSets,
+                                               const Optimization_Budget& budget) noexcept
 {
     // check every feature for validity
     bool success = true;
@@ -281,12 +469,38 @@ bool Pose_Optimization::compute_optimized_pose(const utils::PoseBase& currentPos
         return false;
     }
 
+    // keep the best matches only: the RANSAC cost grows with the scored match count
+    matches_containers::match_container cappedFeatures;
+    const bool shouldCapMatches = budget.maximumMatchCount > 0 and matchedFeatures.size() > budget.maximumMatchCount;
+    if (shouldCapMatches)
+    {
+        std::vector<matches_containers::feat_ptr> sortedMatches(matchedFeatures.cbegin(), matchedFeatures.cend());
+        const auto lastKeptMatch = sortedMatches.begin() + static_cast<std::ptrdiff_t>(budget.maximumMatchCount);
+        std::ranges::nth_element(sortedMatches,
+                                 lastKeptMatch,
+                                 std::ranges::greater(),
+                                 [](const matches_containers::feat_ptr& match) {
+                                     return match->get_quality();
+                                 });
+        cappedFeatures.insert(cappedFeatures.end(), sortedMatches.begin(), lastKeptMatch);
+    }
+
     // compute an optimized pose with a random sample consensus of the feature matches
-    if (compute_pose_with_ransac(currentPose, matchedFeatures, optimizedPose, featureSets))
+    if (compute_pose_with_ransac(currentPose,
+                                 shouldCapMatches ? cappedFeatures : matchedFeatures,
+                                 optimizedPose,
+                                 featureSets,
+                                 budget.maximumRansacDuration_s))
     {
         // Compute pose variance
-        if (matrix66 estimatedPoseCovariance;
-            compute_pose_variance(optimizedPose, featureSets._inliers, estimatedPoseCovariance))
+        matrix66 estimatedPoseCovariance;
+        bool isCovarianceValid = false;
+        if constexpr (parameters::optimization::useAnalyticPoseCovariance)
+            isCovarianceValid = compute_pose_covariance(optimizedPose, featureSets._inliers, estimatedPoseCovariance);
+        else
+            isCovarianceValid = compute_pose_variance(
+                    optimizedPose, featureSets._inliers, estimatedPoseCovariance, budget.varianceIterations);
+        if (isCovarianceValid)
         {
             optimizedPose.set_position_variance(estimatedPoseCovariance);
             return true;
@@ -299,12 +513,127 @@ bool Pose_Optimization::compute_optimized_pose(const utils::PoseBase& currentPos
     return false;
 }
 
+/**
+ * \brief Compute the rotation vector of a rotation, in the tangent space of the identity
+ */
+[[nodiscard]] vector3 get_rotation_vector(const quaternion& rotation) noexcept
+{
+    // q and -q are the same rotation: use the one of smallest angle, so small rotations give small vectors
+    const Eigen::AngleAxisd angleAxis(rotation.w() < 0.0 ? quaternion(-rotation.coeffs()) : rotation);
+    return angleAxis.angle() * angleAxis.axis();
+}
+
+/**
+ * \brief Compute the jacobians of a small rotation in the tangent space at the pose rotation (the rotation vector of
+ * R0^-1.R), with central differences. The differences are taken between small rotations, so they never wrap like the
+ * euler angles do
+ * \param[in] coefficients The pose, in optimization space
+ * \param[out] coefficientJacobian The jacobian of the tangent rotation with respect to the rotation coefficients
+ * \param[out] eulerJacobian The jacobian of the tangent rotation with respect to the euler angles of the pose vector
+ */
+void get_rotation_tangent_jacobians(const vector6& coefficients,
+                                    matrix33& coefficientJacobian,
+                                    matrix33& eulerJacobian) noexcept
+{
+    static constexpr double step = 1e-6;
+    const quaternion& inverseRotation =
+            get_pose_from_optimization_coefficients(coefficients).get_orientation_quaternion().conjugate();
+
+    // the pose vector holds the angles around x, y then z
+    const EulerAngles& eulerAngles = utils::get_euler_angles_from_quaternion(inverseRotation.conjugate());
+    const vector3 angles(eulerAngles.roll, eulerAngles.pitch, eulerAngles.yaw);
+    const auto get_tangent_from_angles = [&inverseRotation](const vector3& rotationAngles) {
+        const EulerAngles perturbedAngles(rotationAngles.z(), rotationAngles.y(), rotationAngles.x());
+        return get_rotation_vector(inverseRotation * utils::get_quaternion_from_euler_angles(perturbedAngles));
+    };
+    const auto get_tangent_from_coefficients = [&inverseRotation](const vector6& perturbedCoefficients) {
+        const utils::PoseBase& perturbedPose = get_pose_from_optimization_coefficients(perturbedCoefficients);
+        return get_rotation_vector(inverseRotation * perturbedPose.get_orientation_quaternion());
+    };
+
+    for (Eigen::Index i = 0; i < 3; ++i)
+    {
+        vector6 upperCoefficients = coefficients;
+        vector6 lowerCoefficients = coefficients;
+        upperCoefficients(3 + i) += step;
+        lowerCoefficients(3 + i) -= step;
+        coefficientJacobian.col(i) = (get_tangent_from_coefficients(upperCoefficients) -
+                                      get_tangent_from_coefficients(lowerCoefficients)) /
+                                     (2.0 * step);
+
+        vector3 upperAngles = angles;
+        vector3 lowerAngles = angles;
+        upperAngles(i) += step;
+        lowerAngles(i) -= step;
+        eulerJacobian.col(i) =
+                (get_tangent_from_angles(upperAngles) - get_tangent_from_angles(lowerAngles)) / (2.0 * step);
+    }
+}
+
+/**
+ * \brief Compute the jacobian of the pose vector (position, euler angles) with respect to the optimization
+ * coefficients. The rotation part is chained through the tangent space of the rotation: dEuler/dCoefficients =
+ * E^-1.G, with E and G the jacobians of the tangent rotation with respect to the euler angles and the coefficients
+ */
+[[nodiscard]] matrix66 get_pose_vector_jacobian(const vector6& coefficients) noexcept
+{
+    matrix33 coefficientJacobian;
+    matrix33 eulerJacobian;
+    get_rotation_tangent_jacobians(coefficients, coefficientJacobian, eulerJacobian);
+
+    matrix66 poseJacobian = matrix66::Zero();
+    poseJacobian.block<3, 3>(0, 0) = matrix33::Identity();
+    // E is singular at the gimbal lock of the euler angles: the resulting covariance is rejected as ill formed
+    poseJacobian.block<3, 3>(3, 3) = eulerJacobian.partialPivLu().solve(coefficientJacobian);
+    return poseJacobian;
+}
+
+/**
+ * \brief Compute the square root of the information of a pose prior, in optimization space
+ * \param[in] priorPose The prior pose, with its covariance
+ * \param[in] priorCoefficients The prior pose, in optimization space
+ * \param[out] priorSqrtInformation The upper triangular square root of the weighted prior information
+ * \return false if the prior covariance cannot be used
+ */
+[[nodiscard]] bool get_prior_sqrt_information(const utils::Pose& priorPose,
+                                              const vector6& priorCoefficients,
+                                              matrix66& priorSqrtInformation) noexcept
+{
+    const matrix66& poseCovariance = priorPose.get_pose_variance();
+    if (not utils::is_covariance_valid(poseCovariance))
+        return false;
+
+    // express the prior in the tangent space of its rotation: S_t = E.S.E^T, and I = G^T.S_t^-1.G, with E and G the
+    // jacobians of the tangent pose with respect to the pose vector and to the optimization coefficients
+    matrix33 coefficientJacobian;
+    matrix33 eulerJacobian;
+    get_rotation_tangent_jacobians(priorCoefficients, coefficientJacobian, eulerJacobian);
+    matrix66 tangentFromPose = matrix66::Identity();
+    tangentFromPose.block<3, 3>(3, 3) = eulerJacobian;
+    matrix66 tangentFromCoefficients = matrix66::Identity();
+    tangentFromCoefficients.block<3, 3>(3, 3) = coefficientJacobian;
+
+    const matrix66& tangentCovariance = tangentFromPose * poseCovariance * tangentFromPose.transpose();
+    const Eigen::LLT<matrix66> covarianceDecomposition(tangentCovariance);
+    if (covarianceDecomposition.info() != Eigen::Success)
+        return false;
+    const matrix66& information = tangentFromCoefficients.transpose() *
+                                  covarianceDecomposition.solve(tangentFromCoefficients) *
+                                  parameters::optimization::motionPriorWeight;
+    const Eigen::LLT<matrix66> informationDecomposition(information);
+    if (informationDecomposition.info() != Eigen::Success)
+        return false;
+    priorSqrtInformation = informationDecomposition.matrixU();
+    return priorSqrtInformation.allFinite();
+}
+
 bool Pose_Optimization::compute_optimized_global_pose(const utils::PoseBase& currentPose,
                                                       const matches_containers::match_container& matchedFeatures,
-                                                      utils::PoseBase& optimizedPose) noexcept
+                                                      utils::PoseBase& optimizedPose,
+                                                      const utils::Pose* const refinementPrior) noexcept
 {
     // set the input of the optimization function
-    vectorxd input = get_optimization_coefficient_from_pose(currentPose);
+    vector6 input = get_optimization_coefficient_from_pose(currentPose);
     if (input.hasNaN() or not input.allFinite())
     {
         outputs::log_error("position as invalid values after transformation in optimization space");
@@ -332,8 +661,21 @@ bool Pose_Optimization::compute_optimized_global_pose(const utils::PoseBase& cur
 
     // Optimization function
     Global_Pose_Functor pose_optimisation_functor {Global_Pose_Estimator {optiParts, matchedFeatures}};
-    // Optimization algorithm
-    Eigen::LevenbergMarquardt poseOptimizator(pose_optimisation_functor);
+    // Optimization algorithm, with fixed size normal equations and reused buffers
+    Levenberg_Marquardt<Global_Pose_Functor, 6> poseOptimizator(pose_optimisation_functor);
+
+    if (refinementPrior != nullptr)
+    {
+        // the motion model prediction constrains the refinement, and consecutive frames have similar problems
+        const vector6& priorCoefficients = get_optimization_coefficient_from_pose(*refinementPrior);
+        if (matrix66 priorSqrtInformation; parameters::optimization::motionPriorWeight > 0.0 and
+                                           get_prior_sqrt_information(
+                                                   *refinementPrior, priorCoefficients, priorSqrtInformation))
+        {
+            pose_optimisation_functor.set_prior(priorCoefficients, priorSqrtInformation);
+        }
+        poseOptimizator.parameters.initialDamping = _lastRefinementDamping;
+    }
 
     // Start optimization (always use it just after the constructor, to ensure feature object reference validity)
     const Eigen::LevenbergMarquardtSpace::Status endStatus = poseOptimizator.minimize(input);
@@ -346,6 +688,27 @@ bool Pose_Optimization::compute_optimized_global_pose(const utils::PoseBase& cur
         return false;
     }
 
+    // iteratively reweighted least squares: the large residuals of the remaining outliers get a lower weight
+    if (refinementPrior != nullptr)
+    {
+        _refinementEvaluationCount += poseOptimizator.get_function_evaluation_count();
+        // keep the damping in a sane range, a diverging frame should not slow down the next ones
+        _lastRefinementDamping = std::clamp(poseOptimizator.get_damping(), 1e-9, 1e-3);
+
+        for (uint i = 0; i < parameters::optimization::robustRefinementIterations; ++i)
+        {
+            vector6 refinedInput = input;
+            pose_optimisation_functor.update_robust_weights(refinedInput);
+            if (poseOptimizator.minimize(refinedInput) <= 0)
+            {
+                // keep the last converged pose
+                break;
+            }
+            _refinementEvaluationCount += poseOptimizator.get_function_evaluation_count();
+            input = refinedInput;
+        }
+    }
+
     const auto& outputPose = get_pose_from_optimization_coefficients(input);
     if (outputPose.get_vector().hasNaN())
     {
@@ -363,6 +726,7 @@ bool Pose_Optimization::compute_pose_variance(const utils::PoseBase& optimizedPo
                                               matrix66& poseCovariance,
                                               const uint iterations) noexcept
 {
+    const outputs::Scoped_Trace trace("pose_variance");
     const double computePoseVarianceStartTime = static_cast<double>(cv::getTickCount());
 
     if (iterations == 0)
@@ -373,37 +737,28 @@ bool Pose_Optimization::compute_pose_variance(const utils::PoseBase& optimizedPo
     poseCovariance.setZero();
     vector6 medium = vector6::Zero();
 
+    // each iteration draws its variations from its own random stream, and the poses are reduced in iteration order:
+    // the variance does not depend on the scheduling
+    const uint64_t randomStreamKey = _poseVarianceCount++;
+    std::vector<std::optional<vector6>> iterationPoses(iterations);
+    tbb::parallel_for(uint(0), iterations, [&](const uint i) {
+        const utils::Random::Scoped_Stream randomStream(randomStreamKey, i);
+        utils::PoseBase newPose;
+        if (compute_random_variation_of_pose(optimizedPose, matchedFeatures, newPose))
+            iterationPoses[i] = newPose.get_vector();
+        else
+            outputs::log_warning(std::format("fail iteration {}: rejected pose optimization", i));
+    });
+
     std::vector<vector6> poses;
     poses.reserve(iterations);
-
-#ifndef MAKE_DETERMINISTIC
-    std::mutex mut;
-    tbb::parallel_for(uint(0),
-                      iterations,
-                      [&](uint i)
-#else
-    for (uint i = 0; i < iterations; ++i)
-#endif
-                      {
-                          std::ignore = i;
-                          utils::PoseBase newPose;
-                          if (compute_random_variation_of_pose(optimizedPose, matchedFeatures, newPose))
-                          {
-                              const vector6& pose6dof = newPose.get_vector();
-#ifndef MAKE_DETERMINISTIC
-                              std::scoped_lock<std::mutex> lock(mut);
-#endif
-                              medium += pose6dof;
-                              poses.emplace_back(pose6dof);
-                          }
-                          else
-                          {
-                              outputs::log_warning(std::format("fail iteration {}: rejected pose optimization", i));
-                          }
-                      }
-#ifndef MAKE_DETERMINISTIC
-    );
-#endif
+    for (const std::optional<vector6>& pose6dof: iterationPoses)
+    {
+        if (not pose6dof.has_value())
+            continue;
+        medium += *pose6dof;
+        poses.emplace_back(*pose6dof);
+    }
 
     if (poses.size() < iterations / 2)
     {
@@ -436,9 +791,77 @@ bool Pose_Optimization::compute_pose_variance(const utils::PoseBase& optimizedPo
     return true;
 }
 
+bool Pose_Optimization::compute_pose_covariance(const utils::PoseBase& optimizedPose,
+                                                const matches_containers::match_container& matchedFeatures,
+                                                matrix66& poseCovariance) noexcept
+{
+    const outputs::Scoped_Trace trace("pose_variance");
+    const double computePoseVarianceStartTime = static_cast<double>(cv::getTickCount());
+    const auto register_duration = [this, computePoseVarianceStartTime]() {
+        _meanComputePoseVarianceDuration +=
+                (static_cast<double>(cv::getTickCount()) - computePoseVarianceStartTime) / cv::getTickFrequency();
+    };
+
+    if (matchedFeatures.empty())
+    {
+        outputs::log_error("Cannot compute pose covariance without features");
+        register_duration();
+        return false;
+    }
+
+    // jacobian of the residuals at the optimized pose, in optimization space
+    size_t optiParts = 0;
+    for (const auto& feat: matchedFeatures)
+    {
+        optiParts += feat->get_feature_part_count();
+    }
+    const vector6& coefficients = get_optimization_coefficient_from_pose(optimizedPose);
+    const Global_Pose_Estimator estimator(optiParts, matchedFeatures);
+    const Match_Blocks& featureBlocks = estimator.get_feature_blocks();
+    matrixd residualJacobian(featureBlocks.get_part_count(), 6);
+    std::ignore = estimator.df(coefficients, residualJacobian);
+
+    vectorxd residualVariances(featureBlocks.get_part_count());
+    featureBlocks.compute_residual_variances(
+            utils::compute_world_to_camera_transform(optimizedPose.get_orientation_quaternion(),
+                                                     optimizedPose.get_position()),
+            residualVariances);
+    // the residuals without variance do not constrain the pose
+    const vectorxd& informationWeights =
+            (residualVariances.array() > 0.0).select(residualVariances.array().inverse(), 0.0).matrix();
+
+    const matrix66& information =
+            residualJacobian.transpose() * informationWeights.asDiagonal() * residualJacobian;
+    const Eigen::FullPivLU<matrix66> informationDecomposition(information);
+    if (not informationDecomposition.isInvertible())
+    {
+        outputs::log_error("Could not compute covariance: the features do not constrain the pose");
+        register_duration();
+        return false;
+    }
+    const matrix66& coefficientCovariance = informationDecomposition.inverse();
+
+    // propagate to the pose vector (position, euler angles)
+    const matrix66& poseJacobian = get_pose_vector_jacobian(coefficients);
+
+    poseCovariance = poseJacobian * coefficientCovariance * poseJacobian.transpose();
+    poseCovariance.diagonal() += vector6::Constant(
+            0.001); // add small variance on diagonal in case of perfect covariance (rare but existing case)
+
+    std::string errorMsg;
+    if (not utils::is_covariance_valid(poseCovariance, errorMsg))
+    {
+        outputs::log_error("Could not compute covariance: final covariance is ill formed: " + errorMsg);
+        register_duration();
+        return false;
+    }
+    register_duration();
+    return true;
+}
+
 void Pose_Optimization::show_statistics(const double meanFrameTreatmentDuration,
                                         const uint frameCount,
-                                        const bool shouldDisplayDetails) noexcept
+                                        const bool shouldDisplayDetails) const noexcept
 {
     static auto get_percent_of_elapsed_time = [](double treatmentTime, double totalTimeElapsed) {
         if (totalTimeElapsed <= 0)
@@ -470,6 +893,9 @@ void Pose_Optimization::show_statistics(const double meanFrameTreatmentDuration,
                     std::format("\t\tMean pose RANSAC get inliers time is {:.4f} seconds ({:.2f}%)",
                                 meanRANSACgetInliersDuration,
                                 get_percent_of_elapsed_time(meanRANSACgetInliersDuration, meanPoseRANSACDuration)));
+
+            outputs::log(std::format("\t\tMean final pose refinement residual evaluations: {:.2f}",
+                                     _refinementEvaluationCount / static_cast<double>(frameCount)));
         }
 
         const double meanPoseVarianceDuration = _meanComputePoseVarianceDuration / static_cast<double>(frameCount);
@@ -7,7 +7,18 @@
 namespace rgbd_slam::pose_optimization {
 
 /**
- * \brief Find the transformation between a matches feature sets, using a custom Levenberg Marquardt method
+ * \brief Reductions of the pose optimization cost, for the frames that must hold a deadline
+ */
+struct Optimization_Budget
+{
+    size_t maximumMatchCount = 0;  // matches fed to the RANSAC, the best ones by quality (0 for all of them)
+    uint varianceIterations = 100; // iterations of the Monte Carlo pose variance (unused by the analytic covariance)
+    double maximumRansacDuration_s = 0.0; // RANSAC duration after which no hypothesis is drawn (0 for no cap)
+};
+
+/**
+ * \brief Find the transformation between a matches feature sets, using a custom Levenberg Marquardt method.
+ * Holds the warm start and statistics of the optimizations: each tracking instance owns its own optimizer
  */
 class Pose_Optimization
 {
@@ -15,19 +26,22 @@ class Pose_Optimization
     /**
      * \brief Compute a new observer global pose, to replace the current estimated pose
      *
-     * \param[in] currentPose Last observer optimized pose
+     * \param[in] currentPose Predicted observer pose. Its covariance, if valid, is used as a prior of the optimization
      * \param[in] matchedFeatures Object containing the match between observed screen features and reliable map features
      * \param[out] optimizedPose The estimated world translation & rotation of the camera pose, if the function returned
      * true
      * \param[out] featureSets The inliers/outliers matched features for the finalPose. Valid if the function returned
      * true
+     * \param[in] budget The reductions of the optimization cost. The matches left out by a match cap are in neither of
+     * the feature sets
      *
      * \return True if a valid pose was computed
      */
-    [[nodiscard]] static bool compute_optimized_pose(const utils::PoseBase& currentPose,
-                                                     const matches_containers::match_container& matchedFeatures,
-                                                     utils::Pose& optimizedPose,
-                                                     matches_containers::match_sets& featureSets) noexcept;
+    [[nodiscard]] bool compute_optimized_pose(const utils::Pose& currentPose,
+                                              const matches_containers::match_container& matchedFeatures,
+                                              utils::Pose& optimizedPose,
+                                              matches_containers::match_sets& featureSets,
+                                              const Optimization_Budget& budget = {}) noexcept;
 
     /**
      * \brief Compute the variance of a given pose, using multiple iterations of the optimization process
@@ -40,14 +54,33 @@ class Pose_Optimization
      *
      * \return True if the process succeded, or False
      */
-    [[nodiscard]] static bool compute_pose_variance(const utils::PoseBase& optimizedPose,
-                                                    const matches_containers::match_container& matchedFeatures,
-                                                    matrix66& poseCovariance,
-                                                    const uint iterations = 100) noexcept;
+    [[nodiscard]] bool compute_pose_variance(const utils::PoseBase& optimizedPose,
+                                             const matches_containers::match_container& matchedFeatures,
+                                             matrix66& poseCovariance,
+                                             const uint iterations = 100) noexcept;
 
-    static void show_statistics(const double meanFrameTreatmentDuration,
-                                const uint frameCount,
-                                const bool shouldDisplayDetails = false) noexcept;
+    /**
+     * \brief Compute the first order covariance of a given pose, (J^T.S^-1.J)^-1, from the jacobian of the optimization
+     * residuals J and the residual covariances S of the matched features
+     *
+     * \param[in] optimizedPose The pose to compute the variance of
+     * \param[in] matchedFeatures The features used to compute this pose
+     * \param[out] poseCovariance The computed covariance, only valid if this function returns true
+     *
+     * \return True if the process succeded, or False
+     */
+    [[nodiscard]] bool compute_pose_covariance(const utils::PoseBase& optimizedPose,
+                                               const matches_containers::match_container& matchedFeatures,
+                                               matrix66& poseCovariance) noexcept;
+
+    void show_statistics(const double meanFrameTreatmentDuration,
+                         const uint frameCount,
+                         const bool shouldDisplayDetails = false) const noexcept;
+
+    /**
+     * \return The number of RANSAC iterations of this optimizer
+     */
+    [[nodiscard]] uint64_t get_ransac_iteration_count() const noexcept { return _ransacIterationCount; }
 
   private:
     /**
@@ -57,12 +90,16 @@ class Pose_Optimization
      * \param[in] matchedFeatures Object containing the match between observed screen features and reliable map features
      * \param[out] optimizedPose The estimated world translation & rotation of the camera pose, if the function returned
      * true
+     * \param[in] refinementPrior If set, this optimization is the final refinement of a frame pose: it uses this
+     * predicted pose as a prior, starts from the damping of the last refinement, and is refined with reweighted passes
+     * to reduce the influence of the remaining outliers
      *
      * \return True if a valid pose was computed
      */
-    [[nodiscard]] static bool compute_optimized_global_pose(const utils::PoseBase& currentPose,
-                                                            const matches_containers::match_container& matchedFeatures,
-                                                            utils::PoseBase& optimizedPose) noexcept;
+    [[nodiscard]] bool compute_optimized_global_pose(const utils::PoseBase& currentPose,
+                                                     const matches_containers::match_container& matchedFeatures,
+                                                     utils::PoseBase& optimizedPose,
+                                                     const utils::Pose* const refinementPrior = nullptr) noexcept;
 
     /**
      * \brief Compute an optimized pose, using a RANSAC methodology
@@ -71,13 +108,16 @@ class Pose_Optimization
      * \param[in] matchedFeatures Object container the match between observed screen features and local map features
      * \param[out] finalPose The optimized pose, valid if the function returned true
      * \param[out] featureSets The matched features detected as inlier and outliers. Valid if the function returned true
+     * \param[in] maximumDuration_s The duration after which no new hypothesis is drawn, 0 for no cap. The iteration
+     * count is also recomputed from the inlier proportion of the best hypothesis
      *
      * \return True if a valid pose and inliers were found
      */
-    [[nodiscard]] static bool compute_pose_with_ransac(const utils::PoseBase& currentPose,
-                                                       const matches_containers::match_container& matchedFeatures,
-                                                       utils::PoseBase& finalPose,
-                                                       matches_containers::match_sets& featureSets) noexcept;
+    [[nodiscard]] bool compute_pose_with_ransac(const utils::Pose& currentPose,
+                                                const matches_containers::match_container& matchedFeatures,
+                                                utils::PoseBase& finalPose,
+                                                matches_containers::match_sets& featureSets,
+                                                const double maximumDuration_s = 0.0) noexcept;
 
     /**
      * \brief
@@ -88,18 +128,23 @@ class Pose_Optimization
      *
      * \return True if the new pose optimization is succesful, or False
      */
-    [[nodiscard]] static bool compute_random_variation_of_pose(
-            const utils::PoseBase& currentPose,
-            const matches_containers::match_container& matchedFeatures,
-            utils::PoseBase& optimizedPose) noexcept;
+    [[nodiscard]] bool compute_random_variation_of_pose(const utils::PoseBase& currentPose,
+                                                        const matches_containers::match_container& matchedFeatures,
+                                                        utils::PoseBase& optimizedPose) noexcept;
 
     // perf monitoring
-    inline static double _meanPoseRANSACDuration = 0.0;
-    inline static double _meanComputePoseVarianceDuration = 0.0;
+    double _meanPoseRANSACDuration = 0.0;
+    double _meanComputePoseVarianceDuration = 0.0;
+
+    double _meanGetRandomSubsetDuration = 0.0;
+    double _meanRANSACPoseOptimizationDuration = 0.0;
+    double _meanRANSACGetInliersDuration = 0.0;
+    uint64_t _ransacIterationCount = 0;
+    uint64_t _poseVarianceCount = 0; // keys the random streams of the pose variance iterations
 
-    inline static double _meanGetRandomSubsetDuration = 0.0;
-    inline static double _meanRANSACPoseOptimizationDuration = 0.0;
-    inline static double _meanRANSACGetInliersDuration = 0.0;
+    // damping of the last final refinement, to warm start the next one
+    double _lastRefinementDamping = 1e-3;
+    uint _refinementEvaluationCount = 0;
 };
 
 } // namespace rgbd_slam::pose_optimization
@@ -4,11 +4,40 @@
 #include "utils/random.hpp"
 
 #include <algorithm>
+#include <cmath>
 #include <stdexcept>
 #include <vector>
 
 namespace rgbd_slam::pose_optimization::ransac {
 
+/**
+ * \brief Compute the RANSAC iteration count N = log(1 - p) / log(1 - w^s), that draws at least one subset of inliers
+ * with a probability p.
+ * \param[in] probabilityOfSuccess The probability p of drawing at least one subset of inliers, in ]0, 1[
+ * \param[in] inlierProportion The proportion w of inliers in the matches. Recomputed from the best hypothesis while
+ * the RANSAC runs, this is the adaptive bound
+ * \param[in] sampleSize The size s of a subset
+ * \param[in] maximumIterationCount The cap of the iteration count
+ * \return The iteration count, in [1, maximumIterationCount]
+ */
+[[nodiscard]] inline uint compute_ransac_iteration_count(const double probabilityOfSuccess,
+                                                         const double inlierProportion,
+                                                         const double sampleSize,
+                                                         const uint maximumIterationCount) noexcept
+{
+    if (inlierProportion >= 1.0)
+        return std::min(1u, maximumIterationCount);
+    const double subsetInlierProbability = std::pow(inlierProportion, sampleSize);
+    if (inlierProportion <= 0.0 or subsetInlierProbability <= 0.0)
+        return maximumIterationCount;
+
+    const double iterationCount =
+            std::ceil(std::log(1.0 - probabilityOfSuccess) / std::log1p(-subsetInlierProbability));
+    if (not std::isfinite(iterationCount))
+        return maximumIterationCount;
+    return static_cast<uint>(std::clamp(iterationCount, 1.0, static_cast<double>(maximumIterationCount)));
+}
+
 /**
  * \brief Return a random subset of unique elements, of size n. It is inefficient if n is very inferior to
  * inContainer.size
@@ -130,6 +159,52 @@ template<template<typename> class Container, typename T>
     return outContainer;
 }
 
+/**
+ * \brief Return a progressive (PROSAC) subset of unique elements: the last element of the sampling pool is always
+ * picked, the others are drawn randomly in the rest of the pool.
+ * \param[in] sortedContainer A container sorted by decreasing quality, in which this function will pick elements
+ * \param[in] poolSize The number of best elements of sortedContainer to draw from, in [1, sortedContainer.size]
+ * \param[in] targetScore The total score to pick
+ * \return A container of unknown size, with no duplicated elements.
+ */
+template<class OutContainer, typename T>
+[[nodiscard]] OutContainer get_progressive_subset_with_score(const std::vector<T>& sortedContainer,
+                                                             const size_t poolSize,
+                                                             const double targetScore)
+{
+    if (poolSize == 0 or poolSize > sortedContainer.size())
+    {
+        throw std::invalid_argument("get_progressive_subset_with_score: poolSize should be in [1, container size]");
+    }
+
+    // the newest element of the pool is part of every subset drawn at this pool size
+    const T& newestElement = sortedContainer[poolSize - 1];
+    double cumulatedScore = newestElement->get_score();
+    OutContainer outContainer;
+    outContainer.insert(outContainer.begin(), newestElement);
+    if (cumulatedScore >= targetScore)
+    {
+        return outContainer;
+    }
+
+    // get a vector of references to the rest of the pool and shuffle it
+    std::vector<std::reference_wrapper<const T>> copyVector(sortedContainer.cbegin(),
+                                                            sortedContainer.cbegin() + (poolSize - 1));
+    std::ranges::shuffle(copyVector, utils::Random::get_random_engine());
+    for (const T& picked: copyVector)
+    {
+        cumulatedScore += picked->get_score();
+        outContainer.insert(outContainer.begin(), picked);
+        if (cumulatedScore >= targetScore)
+        {
+            return outContainer;
+        }
+    }
+
+    throw std::invalid_argument("get_progressive_subset_with_score: failed to pick enough feature to respect score");
+    return outContainer;
+}
+
 } // namespace rgbd_slam::pose_optimization::ransac
 
 #endif
@@ -2,15 +2,26 @@
 #include "camera_transformation.hpp"
 #include "covariances.hpp"
 #include "outputs/logger.hpp"
+#include "outputs/trace_recorder.hpp"
 #include "parameters.hpp"
 #include "pose_optimization/pose_optimization.hpp"
 #include "matches_containers.hpp"
+#include "tracking/descriptor_pool.hpp"
+#include "utils/object_pool.hpp"
 #include "utils/random.hpp"
-#include <future>
+#include "utils/task_scheduler.hpp"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <limits>
 #include <memory>
+#include <optional>
 #include <opencv2/core.hpp>
 #include <opencv2/core/types.hpp>
 #include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
+#include <tbb/parallel_for.h>
+#include <thread>
 
 namespace rgbd_slam {
 
@@ -39,10 +50,11 @@ RGBD_SLAM::RGBD_SLAM(const utils::Pose& startPose, const uint imageWidth, const
         outputs::log("Invalid parameters. Switching to default parameters");
     }
 
-    // set threads
-    const int availableCores = static_cast<int>(parameters::coreNumber);
-    cv::setNumThreads(availableCores);
-    Eigen::setNbThreads(availableCores);
+    // set threads: all the parallel stages run in the shared scheduler. The OpenCV and Eigen pools would compete
+    // with it for the cores, they are disabled (their functions run in the scheduler threads)
+    utils::Task_Scheduler::initialize(Parameters::get_core_number());
+    cv::setNumThreads(0);
+    Eigen::setNbThreads(1);
 
     // primitive connected graph creator
     _depthOps = std::make_unique<features::primitives::Depth_Map_Transformation>(
@@ -80,12 +92,78 @@ RGBD_SLAM::RGBD_SLAM(const utils::Pose& startPose, const uint imageWidth, const
 
     _computeKeypointCount = 0;
     _currentPose = startPose;
+
+    if constexpr (parameters::optimization::bundleAdjustment::isEnabled)
+    {
+        _bundleAdjustment = std::make_unique<pose_optimization::Local_Bundle_Adjustment>();
+        _bundleAdjustment->start();
+    }
+    if constexpr (parameters::optimization::poseGraph::isEnabled)
+    {
+        _poseGraph = std::make_unique<pose_optimization::Pose_Graph>();
+        _poseGraph->start();
+    }
+}
+
+bool RGBD_SLAM::warm_up() noexcept
+{
+    if (_totalFrameTreated > 0 or _isPipelineRunning)
+    {
+        outputs::log_warning("The warm up must be called before the first tracked frame");
+        return false;
+    }
+    const double warmUpStartTime = static_cast<double>(cv::getTickCount());
+
+    // a textured image and a tilted plane: the detectors find keypoints and planar cells in it, and allocate their
+    // buffers for the real frames. Drawn from a local generator, so the random state of the tracking is not modified
+    const int width = static_cast<int>(_width);
+    const int height = static_cast<int>(_height);
+    cv::RNG syntheticRng(_width * _height);
+    cv::Mat rgbImage(height, width, CV_8UC3);
+    syntheticRng.fill(rgbImage, cv::RNG::UNIFORM, cv::Scalar::all(0), cv::Scalar::all(256));
+    cv::Mat_<float> syntheticDepth(height, width);
+    for (int row = 0; row < height; ++row)
+        syntheticDepth.row(row).setTo(1500.0f + static_cast<float>(row));
+    cv::Mat_<uint16_t> rawDepthImage;
+    syntheticDepth.convertTo(rawDepthImage, CV_16U);
+
+    utils::Task_Scheduler::execute([this, &rgbImage, &syntheticDepth, &rawDepthImage]() {
+        // start the threads of the scheduler, that are otherwise created by the first parallel stage
+        const int threadCount = utils::Task_Scheduler::get_thread_count();
+        tbb::parallel_for(0, threadCount, [](const int) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        });
+
+        // the depth buffers of each input type: the first track call can use any of them
+        matrixf cloudArrayOrganized;
+        cv::Mat_<float> depthImage;
+        std::ignore = _depthOps->rectify_and_organize(rawDepthImage, 1.0f, depthImage, cloudArrayOrganized);
+        std::ignore = _depthOps->get_organized_cloud_array(rawDepthImage, 1.0f, depthImage, cloudArrayOrganized);
+        std::ignore = _depthOps->rectify_and_organize(syntheticDepth, depthImage, cloudArrayOrganized);
+        std::ignore = _depthOps->get_organized_cloud_array(syntheticDepth, cloudArrayOrganized);
+
+        _pointDetector->warm_up(rgbImage, syntheticDepth);
+
+        // a stream of its own: the first frames draw the same numbers with or without a warm up
+        const utils::Random::Scoped_Stream randomStream(std::numeric_limits<uint64_t>::max(), 0);
+        _primitiveDetector->warm_up(cloudArrayOrganized, syntheticDepth);
+    });
+
+    // the descriptor rows of the map points created by the first frame
+    tracking::Descriptor_Pool::get_shared_pool().reserve(Parameters::get_maximum_point_per_frame());
+
+    outputs::log(std::format("Warm up done in {:.4f} seconds",
+                             (static_cast<double>(cv::getTickCount()) - warmUpStartTime) / cv::getTickFrequency()));
+    return true;
 }
 
 void RGBD_SLAM::rectify_depth(cv::Mat_<float>& depthImage) noexcept
 {
     cv::Mat_<float> rectifiedDepth;
-    if (_depthOps->rectify_depth(depthImage, rectifiedDepth))
+    const bool isRectified = utils::Task_Scheduler::execute([this, &depthImage, &rectifiedDepth]() {
+        return _depthOps->rectify_depth(depthImage, rectifiedDepth);
+    });
+    if (isRectified)
     {
         assert(depthImage.size == rectifiedDepth.size);
         depthImage = rectifiedDepth;
@@ -96,32 +174,325 @@ void RGBD_SLAM::rectify_depth(cv::Mat_<float>& depthImage) noexcept
     }
 }
 
-utils::Pose RGBD_SLAM::track(const cv::Mat& inputRgbImage, const cv::Mat_<float>& inputDepthImage) noexcept
+RGBD_SLAM::~RGBD_SLAM()
+{
+    stop_pipelined_tracking();
+    stop_debug_rendering();
+    stop_dense_reconstruction();
+    if (_bundleAdjustment != nullptr)
+        _bundleAdjustment->stop();
+    if (_poseGraph != nullptr)
+        _poseGraph->stop();
+}
+
+utils::Pose RGBD_SLAM::track(const cv::Mat& inputRgbImage,
+                             const cv::Mat_<float>& inputDepthImage,
+                             const bool shouldRectifyDepth) noexcept
+{
+    return track_frame(inputRgbImage, inputDepthImage, 1.0f, shouldRectifyDepth);
+}
+
+utils::Pose RGBD_SLAM::track(const cv::Mat& inputRgbImage,
+                             const cv::Mat_<uint16_t>& rawDepthImage,
+                             const float depthScale,
+                             const bool shouldRectifyDepth) noexcept
+{
+    return track_frame(inputRgbImage, rawDepthImage, depthScale, shouldRectifyDepth);
+}
+
+utils::Pose RGBD_SLAM::track_frame(const cv::Mat& inputRgbImage,
+                                   const cv::Mat& inputDepthImage,
+                                   const float depthScale,
+                                   const bool shouldRectifyDepth) noexcept
+{
+    if (_isPipelineRunning)
+    {
+        outputs::log_warning("Called track while the pipelined tracking is running, waiting for the pipeline to end");
+        stop_pipelined_tracking();
+    }
+
+    // take the rotation measured since the last frame
+    tracking::Imu_Preintegration imuPreintegration;
+    {
+        std::scoped_lock lock(_imuMutex);
+        imuPreintegration = _imuPreintegration;
+        _imuPreintegration.restart();
+    }
+
+    const utils::Pose& refinedPose = utils::Task_Scheduler::execute([&]() {
+        const auto& detectedFrame = detect_frame_features(
+                inputRgbImage, inputDepthImage, depthScale, shouldRectifyDepth, imuPreintegration);
+
+        // this frame points and  assoc
+        return this->compute_new_pose(*detectedFrame);
+    });
+
+    _totalFrameTreated += 1;
+    return refinedPose;
+}
+
+void RGBD_SLAM::add_imu_sample(const tracking::Imu_Sample& sample) noexcept
+{
+    std::scoped_lock lock(_imuMutex);
+    _imuPreintegration.add_sample(sample);
+}
+
+bool RGBD_SLAM::start_pipelined_tracking(const tracking_callback& onFrameTracked, const size_t queueCapacity) noexcept
+{
+    if (_isPipelineRunning)
+    {
+        outputs::log_error("The pipelined tracking is already running");
+        return false;
+    }
+
+    _onFrameTracked = onFrameTracked;
+    _inputFrames = std::make_unique<utils::Bounded_Queue<InputFrame>>(queueCapacity);
+    // only one frame can wait between the stages: detection can be at most one frame ahead of the pose optimization
+    _detectedFrames = std::make_unique<utils::Bounded_Queue<PendingFrame>>(1);
+
+    _isPipelineRunning = true;
+    _detectionThread = std::thread(&RGBD_SLAM::run_detection_stage, this);
+    _poseThread = std::thread(&RGBD_SLAM::run_pose_stage, this);
+    return true;
+}
+
+bool RGBD_SLAM::push_frame(const cv::Mat& inputRgbImage,
+                           const cv::Mat_<float>& inputDepthImage,
+                           size_t& frameId,
+                           const bool shouldRectifyDepth) noexcept
+{
+    return push_input_frame(InputFrame {0, inputRgbImage, inputDepthImage, 1.0f, shouldRectifyDepth}, frameId);
+}
+
+bool RGBD_SLAM::push_frame(const cv::Mat& inputRgbImage,
+                           const cv::Mat_<uint16_t>& rawDepthImage,
+                           const float depthScale,
+                           size_t& frameId,
+                           const bool shouldRectifyDepth) noexcept
+{
+    return push_input_frame(InputFrame {0, inputRgbImage, rawDepthImage, depthScale, shouldRectifyDepth}, frameId);
+}
+
+bool RGBD_SLAM::push_input_frame(InputFrame&& frame, size_t& frameId) noexcept
+{
+    if (not _isPipelineRunning)
+    {
+        outputs::log_error("Cannot push a frame: the pipelined tracking is not running");
+        return false;
+    }
+    assert(static_cast<size_t>(frame.depthImage.rows) == _height);
+    assert(static_cast<size_t>(frame.depthImage.cols) == _width);
+    assert(static_cast<size_t>(frame.rgbImage.rows) == _height);
+    assert(static_cast<size_t>(frame.rgbImage.cols) == _width);
+
+    // the pipelined detection predicts from the pose of two frames before: the rotation of the last frame would not
+    // be enough to shrink the search windows
+    {
+        std::scoped_lock lock(_imuMutex);
+        _imuPreintegration.restart();
+    }
+
+    frameId = _nextFrameId++;
+    frame.id = frameId;
+    return _inputFrames->push(std::move(frame));
+}
+
+void RGBD_SLAM::stop_pipelined_tracking() noexcept
+{
+    if (not _isPipelineRunning)
+        return;
+
+    // the detection stage will treat the remaining frames, then close the detected frame queue
+    _inputFrames->close();
+    if (_detectionThread.joinable())
+        _detectionThread.join();
+    if (_poseThread.joinable())
+        _poseThread.join();
+
+    _isPipelineRunning = false;
+    _inputFrames.reset();
+    _detectedFrames.reset();
+    _onFrameTracked = nullptr;
+}
+
+void RGBD_SLAM::run_detection_stage() noexcept
+{
+    InputFrame frame;
+    while (_inputFrames->pop(frame))
+    {
+        PendingFrame pendingFrame {frame.id, utils::Task_Scheduler::execute([this, &frame]() {
+                                       return detect_frame_features(frame.rgbImage,
+                                                                    frame.depthImage,
+                                                                    frame.depthScale,
+                                                                    frame.shouldRectifyDepth,
+                                                                    tracking::Imu_Preintegration());
+                                   })};
+        if (not _detectedFrames->push(std::move(pendingFrame)))
+            break;
+    }
+    // no more frames to detect
+    _detectedFrames->close();
+}
+
+void RGBD_SLAM::run_pose_stage() noexcept
+{
+    PendingFrame pendingFrame;
+    while (_detectedFrames->pop(pendingFrame))
+    {
+        const utils::Pose& refinedPose = utils::Task_Scheduler::execute([this, &pendingFrame]() {
+            return compute_new_pose(*pendingFrame.detectedFrame);
+        });
+        _totalFrameTreated += 1;
+
+        if (_onFrameTracked)
+            _onFrameTracked(pendingFrame.id, refinedPose);
+    }
+}
+
+std::unique_ptr<RGBD_SLAM::DetectedFrame> RGBD_SLAM::detect_frame_features(
+        const cv::Mat& inputRgbImage,
+        const cv::Mat& inputDepthImage,
+        const float depthScale,
+        const bool shouldRectifyDepth,
+        const tracking::Imu_Preintegration& imuPreintegration) noexcept
 {
     assert(static_cast<size_t>(inputDepthImage.rows) == _height);
     assert(static_cast<size_t>(inputDepthImage.cols) == _width);
     assert(static_cast<size_t>(inputRgbImage.rows) == _height);
     assert(static_cast<size_t>(inputRgbImage.cols) == _width);
 
+    const outputs::Scoped_Trace trace("detect_frame_features");
+    outputs::Frame_Metrics metrics;
+
+    // the gray image and its pyramid do not depend on the depth: prepared in parallel with the depth treatment
+    cv::Mat grayImage;
+    tbb::task_group imagePreparationTask;
+    imagePreparationTask.run([this, &inputRgbImage, &grayImage, &metrics]() {
+        outputs::Scoped_Timer preparationTimer(metrics, outputs::Frame_Stage::ImagePreparation);
+        const outputs::Scoped_Trace preparationTrace("image_preparation");
+        grayImage = _pointDetector->prepare_image(inputRgbImage);
+    });
+
     // project depth image in an organized cloud
     const double depthImageTreatmentStartTime = static_cast<double>(cv::getTickCount());
     // organized 3D depth image
     matrixf cloudArrayOrganized;
-    const bool didOrganizedCloudArraySucceded =
-            _depthOps->get_organized_cloud_array(inputDepthImage, cloudArrayOrganized);
-    assert(didOrganizedCloudArraySucceded);
-    _meanDepthMapTreatmentDuration +=
+    cv::Mat_<float> depthImage;
+    if (inputDepthImage.type() == CV_16UC1)
+    {
+        // raw sensor depth: the scale is applied in the same pass as the cloud creation
+        const cv::Mat_<uint16_t> rawDepthImage = inputDepthImage;
+        if (shouldRectifyDepth)
+        {
+            if (not _depthOps->rectify_and_organize(rawDepthImage, depthScale, depthImage, cloudArrayOrganized))
+            {
+                outputs::log_error("Could not rectify the depth image to rgb space");
+            }
+        }
+        else
+        {
+            const bool didOrganizedCloudArraySucceded =
+                    _depthOps->get_organized_cloud_array(rawDepthImage, depthScale, depthImage, cloudArrayOrganized);
+            assert(didOrganizedCloudArraySucceded);
+        }
+    }
+    else if (shouldRectifyDepth)
+    {
+        assert(inputDepthImage.type() == CV_32FC1);
+        // rectify and organize in a single pass over the depth image
+        if (not _depthOps->rectify_and_organize(inputDepthImage, depthImage, cloudArrayOrganized))
+        {
+            outputs::log_error("Could not rectify the depth image to rgb space");
+        }
+    }
+    else
+    {
+        assert(inputDepthImage.type() == CV_32FC1);
+        depthImage = inputDepthImage;
+        const bool didOrganizedCloudArraySucceded =
+                _depthOps->get_organized_cloud_array(depthImage, cloudArrayOrganized);
+        assert(didOrganizedCloudArraySucceded);
+    }
+    const double depthImageTreatmentDuration =
             (static_cast<double>(cv::getTickCount()) - depthImageTreatmentStartTime) / cv::getTickFrequency();
+    _meanDepthMapTreatmentDuration += depthImageTreatmentDuration;
+    metrics.add_duration(outputs::Frame_Stage::DepthTreatment, depthImageTreatmentDuration);
 
-    // Compute a gray image for feature extractions
-    cv::Mat grayImage;
-    cv::cvtColor(inputRgbImage, grayImage, cv::COLOR_BGR2GRAY);
+    // the quality of this frame: an overloaded system skips or reduces some stages
+    const tracking::Load_Shedding_Level sheddingLevel = _loadController.get_level();
+    _pointDetector->set_point_budget_limit(sheddingLevel >= tracking::Load_Shedding_Level::ReducedKeypoints
+                                                   ? Parameters::get_minimum_point_per_frame()
+                                                   : 0);
+    const bool shouldDetectPlanes = sheddingLevel < tracking::Load_Shedding_Level::NoPlaneDetection;
 
-    // this frame points and  assoc
-    const utils::Pose& refinedPose = this->compute_new_pose(grayImage, inputDepthImage, cloudArrayOrganized);
+    // the gray image for feature extractions
+    imagePreparationTask.wait();
 
-    _totalFrameTreated += 1;
-    return refinedPose;
+    // every now and then, restart the search of points even if we have enough features
+    _computeKeypointCount = (_computeKeypointCount % _pointDetector->get_refresh_frequency()) + 1;
+
+    // copy the tracking state: in pipelined mode, the pose stage can modify it during the detection
+    utils::Pose predictedPose;
+    double matchSearchRadius = parameters::matching::matchSearchRadius_px;
+    bool shouldRecomputeKeypoints = true;
+    bool isPosePredicted = false;
+    map_management::TrackedFeaturesContainer trackedFeaturesContainer;
+    {
+        std::scoped_lock lock(_trackingStateMutex);
+
+        if (imuPreintegration.has_measurements() and not _isTrackingLost)
+        {
+            // the measured rotation gives a tighter prediction, with smaller search windows
+            predictedPose = _motionModel.predict_next_pose(_currentPose, imuPreintegration);
+            matchSearchRadius = _motionModel.get_match_search_radius();
+            isPosePredicted = true;
+        }
+        else
+        {
+// get a pose with the decaying motion model (do not add uncertainty if it's the first call)
+#if 0 // TODO : put back when the motion model as been debugged
+            predictedPose = _motionModel.predict_next_pose(_currentPose, not _isFirstTrackingCall);
+#else
+            predictedPose = _currentPose;
+#endif
+        }
+        shouldRecomputeKeypoints = _isTrackingLost or _computeKeypointCount == 1;
+
+        // Get map points that were tracked last call, and retroproject them to screen space using
+        // last pose (used for optical flow). A predicted pose also gives the positions where the optical flow starts
+        trackedFeaturesContainer = isPosePredicted ? _localMap.get_tracked_features(_currentPose, predictedPose)
+                                                   : _localMap.get_tracked_features(_currentPose);
+    }
+
+    // detect the features from the inputs
+    map_management::DetectedFeatureContainer detectedFeatures = detect_features(shouldRecomputeKeypoints,
+                                                                                trackedFeaturesContainer,
+                                                                                grayImage,
+                                                                                depthImage,
+                                                                                cloudArrayOrganized,
+                                                                                matchSearchRadius,
+                                                                                shouldDetectPlanes,
+                                                                                metrics);
+    // the detection buffers are measured by the thread that owns them
+    metrics.add_memory_usage(outputs::Memory_Consumer::DepthBuffers,
+                             depthImage.total() * depthImage.elemSize() +
+                                     static_cast<size_t>(cloudArrayOrganized.size()) * sizeof(float) +
+                                     _depthOps->get_allocated_bytes());
+    metrics.add_memory_usage(outputs::Memory_Consumer::Pyramids, _pointDetector->get_pyramid_allocated_bytes());
+
+    const double detectionDuration =
+            (static_cast<double>(cv::getTickCount()) - depthImageTreatmentStartTime) / cv::getTickFrequency();
+    metrics.add_duration(outputs::Frame_Stage::Frame, detectionDuration);
+
+    // the dense reconstruction integrates a subsampled copy: the depth image can be the buffer of the caller
+    cv::Mat_<float> denseDepthImage;
+    if (_denseReconstruction != nullptr and _denseReconstruction->is_running() and not depthImage.empty())
+    {
+        constexpr double denseScale = 1.0 / parameters::mapping::denseReconstruction::pixelStride;
+        cv::resize(depthImage, denseDepthImage, cv::Size(), denseScale, denseScale, cv::INTER_NEAREST);
+    }
+    return std::make_unique<DetectedFrame>(
+            predictedPose, std::move(detectedFeatures), detectionDuration, metrics, sheddingLevel, denseDepthImage);
 }
 
 cv::Mat RGBD_SLAM::get_debug_image(const utils::Pose& camPose,
@@ -129,7 +500,20 @@ cv::Mat RGBD_SLAM::get_debug_image(const utils::Pose& camPose,
                                    const double elapsedTime,
                                    const bool shouldDisplayStagedFeatures) const noexcept
 {
-    cv::Mat debugImage = originalRGB.clone();
+    cv::Mat debugImage;
+    draw_debug_image(camPose, originalRGB, elapsedTime, debugImage, shouldDisplayStagedFeatures);
+    return debugImage;
+}
+
+void RGBD_SLAM::draw_debug_image(const utils::Pose& camPose,
+                                 const cv::Mat& originalRGB,
+                                 const double elapsedTime,
+                                 cv::Mat& debugImage,
+                                 const bool shouldDisplayStagedFeatures) const noexcept
+{
+    // no copy when drawing over the input image, no allocation when the buffer has the right size
+    if (debugImage.data != originalRGB.data)
+        originalRGB.copyTo(debugImage);
 
     const uint bandSize =
             static_cast<uint>(std::floor(_height / 25.0)); // 1/25 of the total image should be for the top black band
@@ -148,43 +532,79 @@ cv::Mat RGBD_SLAM::get_debug_image(const utils::Pose& camPose,
                 debugImage, fps.str(), cv::Point(15, 15), cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(255, 255, 255, 1));
     }
 
-    _localMap.get_debug_image(camPose, shouldDisplayStagedFeatures, debugImage);
+    if (_debugRenderer != nullptr and _debugRenderer->is_running())
+    {
+        // the rendering thread draws the features of the next overlays for this pose
+        _debugRenderer->set_pose(camPose);
+        std::ignore = _debugRenderer->compose(debugImage);
+    }
+    else
+        _localMap.get_debug_image(camPose, shouldDisplayStagedFeatures, debugImage);
 
-    // display a red overlay if tracking is lost
+    // display a red overlay if tracking is lost: blend in place, without a full frame red image
     if (_isTrackingLost)
     {
-        const cv::Size& debugImageSize = debugImage.size();
-        cv::addWeighted(debugImage, 0.8, cv::Mat(debugImageSize, CV_8UC3, cv::Scalar(0, 0, 255)), 0.2, 1, debugImage);
+        // 0.8 * image + 0.2 * red, both passes write in the image buffer
+        debugImage.convertTo(debugImage, -1, 0.8);
+        cv::add(debugImage, cv::Scalar(1, 1, 52), debugImage);
     }
+}
 
-    return debugImage;
+void RGBD_SLAM::start_debug_rendering(const double refreshRate_Hz) noexcept
+{
+    if (_debugRenderer == nullptr)
+    {
+        _debugRenderer = std::make_unique<map_management::Debug_Renderer>(_width, _height, [this]() {
+            return _localMap.get_snapshot();
+        });
+    }
+    _debugRenderer->start(refreshRate_Hz);
+}
+
+void RGBD_SLAM::stop_debug_rendering() noexcept
+{
+    if (_debugRenderer != nullptr)
+        _debugRenderer->stop();
+}
+
+void RGBD_SLAM::start_dense_reconstruction(const std::string& meshPath) noexcept
+{
+    stop_dense_reconstruction();
+    _denseReconstruction = std::make_unique<map_management::Dense_Reconstruction>(meshPath);
+}
+
+void RGBD_SLAM::stop_dense_reconstruction() noexcept
+{
+    if (_denseReconstruction != nullptr)
+        _denseReconstruction->stop();
 }
 
-utils::Pose RGBD_SLAM::compute_new_pose(const cv::Mat& grayImage,
-                                        const cv::Mat_<float>& depthImage,
-                                        const matrixf& cloudArrayOrganized) noexcept
+utils::Pose RGBD_SLAM::compute_new_pose(const DetectedFrame& detectedFrame) noexcept
 {
     if (not utils::is_covariance_valid(_currentPose.get_pose_variance()))
     {
         outputs::log_error("The current stored pose has an invalid covariance, system is broken");
         exit(-1);
     }
-    // every now and then, restart the search of points even if we have enough features
-    _computeKeypointCount = (_computeKeypointCount % parameters::detection::keypointRefreshFrequency) + 1;
 
-// get a pose with the decaying motion model (do not add uncertainty if it's the first call)
-#if 0 // TODO : put back when the motion model as been debugged
-    const utils::Pose& predictedPose = _motionModel.predict_next_pose(_currentPose, not _isFirstTrackingCall);
-#else
-    const utils::Pose& predictedPose = _currentPose;
-#endif
+    const outputs::Scoped_Trace trace("compute_new_pose");
+    const double poseStartTime = static_cast<double>(cv::getTickCount());
+    utils::Pose predictedPose = detectedFrame.predictedPose;
+    const auto& detectedFeatures = detectedFrame.detectedFeatures;
 
-    // detect the features from the inputs
-    const auto& detectedFeatures = detect_features(predictedPose, grayImage, depthImage, cloudArrayOrganized);
+    outputs::Frame_Metrics metrics = detectedFrame.detectionMetrics;
+    metrics._frameIndex = _totalFrameTreated;
 
     // Find matches by the pose predicted by motion model
-    const matches_containers::match_container& matchedFeatures =
-            _localMap.find_feature_matches(predictedPose, detectedFeatures);
+    matches_containers::match_container matchedFeatures;
+    {
+        outputs::Scoped_Timer matchingTimer(metrics, outputs::Frame_Stage::FeatureMatching);
+        std::scoped_lock lock(_trackingStateMutex);
+        // the matches and the optimization use the map refined by the bundle adjustment
+        apply_pose_graph_corrections(predictedPose);
+        apply_bundle_adjustment_corrections(predictedPose);
+        matchedFeatures = _localMap.find_feature_matches(predictedPose, detectedFeatures);
+    }
 
     // The new pose, after optimization
     utils::Pose newPose = predictedPose;
@@ -193,11 +613,54 @@ utils::Pose RGBD_SLAM::compute_new_pose(const cv::Mat& grayImage,
     utils::Pose optimizedPose;
     matches_containers::match_sets matchSets;
 
-    // optimize the pose, but not if it is the first call (no pose to compute)
-    const bool isPoseValid =
-            (not _isFirstTrackingCall) and pose_optimization::Pose_Optimization::compute_optimized_pose(
-                                                   predictedPose, matchedFeatures, optimizedPose, matchSets);
+    // the degraded frames reduce the cost of the pose optimization
+    pose_optimization::Optimization_Budget optimizationBudget;
+    if constexpr (parameters::loadShedding::isEnabled)
+        optimizationBudget.maximumRansacDuration_s =
+                parameters::loadShedding::ransacDurationRatio * Parameters::get_frame_deadline();
+    if (detectedFrame.sheddingLevel >= tracking::Load_Shedding_Level::ReducedCovariance)
+        optimizationBudget.varianceIterations = parameters::loadShedding::reducedVarianceIterations;
+    if (detectedFrame.sheddingLevel >= tracking::Load_Shedding_Level::CappedMatches)
+        optimizationBudget.maximumMatchCount = parameters::loadShedding::maximumRansacMatches;
 
+    bool isPoseValid = false;
+    {
+        outputs::Scoped_Timer optimizationTimer(metrics, outputs::Frame_Stage::PoseOptimization);
+        const uint64_t ransacIterationCount = _poseOptimization.get_ransac_iteration_count();
+
+        // optimize the pose, but not if it is the first call (no pose to compute)
+        isPoseValid = (not _isFirstTrackingCall) and
+                      _poseOptimization.compute_optimized_pose(
+                              predictedPose, matchedFeatures, optimizedPose, matchSets, optimizationBudget);
+
+        // the predicted pose cannot be trusted anymore: try to find the pose from the map features descriptors
+        if (not isPoseValid and _isTrackingLost and not _isFirstTrackingCall)
+            isPoseValid = relocalize(predictedPose, detectedFeatures, optimizedPose, matchSets);
+
+        metrics.set_counter(outputs::Frame_Counter::RansacIterations,
+                            _poseOptimization.get_ransac_iteration_count() -
+                                    ransacIterationCount);
+    }
+    metrics.set_counter(outputs::Frame_Counter::MatchedFeatures, matchedFeatures.size());
+    metrics.set_counter(outputs::Frame_Counter::InlierFeatures, isPoseValid ? matchSets._inliers.size() : 0);
+    metrics.set_counter(outputs::Frame_Counter::LoadSheddingLevel, static_cast<uint64_t>(detectedFrame.sheddingLevel));
+
+    // adapt the detection budget to this frame cost and tracking quality
+    if (not _isFirstTrackingCall)
+    {
+        const size_t matchedCount = matchSets._inliers.size() + matchSets._outliers.size();
+        const double inlierRatio =
+                (isPoseValid and matchedCount > 0)
+                        ? static_cast<double>(matchSets._inliers.size()) / static_cast<double>(matchedCount)
+                        : 0.0;
+        const double poseDuration =
+                (static_cast<double>(cv::getTickCount()) - poseStartTime) / cv::getTickFrequency();
+        _pointDetector->update_detection_budget(detectedFrame.detectionDuration + poseDuration, inlierRatio);
+    }
+
+    // the map and tracking state are shared with the detection stage
+    std::unique_lock lock(_trackingStateMutex);
+    const double mapUpdateStartTime = static_cast<double>(cv::getTickCount());
     if (isPoseValid)
     {
         // Update current pose if tracking is ongoing
@@ -207,7 +670,17 @@ utils::Pose RGBD_SLAM::compute_new_pose(const cv::Mat& grayImage,
         // Update local map if a valid transformation was found
         try
         {
-            _localMap.update(optimizedPose, detectedFeatures, matchSets._outliers);
+            // only the keyframes update the map, the other frames are only tracked in it
+            if (_keyframeSelector.is_keyframe(optimizedPose, matchSets._inliers))
+            {
+                _localMap.update(optimizedPose, detectedFeatures, matchSets._outliers);
+                add_bundle_adjustment_keyframe(optimizedPose, matchSets._inliers);
+                add_pose_graph_keyframe(optimizedPose, detectedFeatures);
+            }
+            else
+            {
+                _localMap.update_tracking_only(matchSets._outliers);
+            }
             _isTrackingLost = false;
             _failedTrackingCount = 0;
         }
@@ -217,6 +690,7 @@ utils::Pose RGBD_SLAM::compute_new_pose(const cv::Mat& grayImage,
 
             // no valid transformation
             _localMap.update_no_pose();
+            _keyframeSelector.reset();
 
             _isTrackingLost = (++_failedTrackingCount) > 3;
             _motionModel.reset();
@@ -227,6 +701,8 @@ utils::Pose RGBD_SLAM::compute_new_pose(const cv::Mat& grayImage,
     {
         // no valid transformation
         _localMap.update_no_pose();
+        // the next tracked frame will update the map
+        _keyframeSelector.reset();
 
         // add unmatched features if not tracking could be done last call
         const matrix33& poseCovariance = predictedPose.get_position_variance();
@@ -255,64 +731,379 @@ utils::Pose RGBD_SLAM::compute_new_pose(const cv::Mat& grayImage,
     // set firstCall to false after the first iteration
     _isFirstTrackingCall = false;
 
+    // memory of the map after its update. Measuring it reads all the map features: it is only measured every few
+    // frames, the frames in between report the last measure
+    if (metrics._frameIndex % parameters::mapping::memoryMeasurementPeriod == 0)
+    {
+        _mapMemoryMetrics = outputs::Frame_Metrics();
+        _localMap.add_memory_usage(_mapMemoryMetrics);
+    }
+    metrics.add_memory_usage(_mapMemoryMetrics);
+    if (_denseReconstruction != nullptr)
+        metrics.add_memory_usage(outputs::Memory_Consumer::DenseReconstruction,
+                                 _denseReconstruction->get_allocated_bytes());
+    metrics.add_memory_usage(outputs::Memory_Consumer::MatchContainers,
+                             utils::get_pool_slab_bytes().load(std::memory_order_relaxed));
+
+    lock.unlock();
+
+    // integrated on the reconstruction thread: never waits
+    if (isPoseValid and _denseReconstruction != nullptr and not detectedFrame.denseDepthImage.empty())
+    {
+        std::ignore = _denseReconstruction->add_frame(
+                utils::compute_camera_to_world_transform(newPose.get_orientation_quaternion(), newPose.get_position()),
+                detectedFrame.denseDepthImage);
+    }
+
+    const double endTime = static_cast<double>(cv::getTickCount());
+    metrics.add_duration(outputs::Frame_Stage::MapUpdate, (endTime - mapUpdateStartTime) / cv::getTickFrequency());
+    metrics.add_duration(outputs::Frame_Stage::Frame, (endTime - poseStartTime) / cv::getTickFrequency());
+    _metricsRecorder.record(metrics);
+
+    // the quality of the next frames, from the whole duration of this one
+    _loadController.update(metrics.get_duration(outputs::Frame_Stage::Frame), detectedFrame.sheddingLevel);
+
     return newPose;
 }
 
-map_management::DetectedFeatureContainer RGBD_SLAM::detect_features(const utils::Pose& predictedPose,
-                                                                    const cv::Mat& grayImage,
-                                                                    const cv::Mat_<float>& depthImage,
-                                                                    const matrixf& cloudArrayOrganized) noexcept
+bool RGBD_SLAM::relocalize(const utils::Pose& predictedPose,
+                           const map_management::DetectedFeatureContainer& detectedFeatures,
+                           utils::Pose& optimizedPose,
+                           matches_containers::match_sets& matchSets) noexcept
+{
+    matches_containers::match_container relocalizationMatches;
+    {
+        std::scoped_lock lock(_trackingStateMutex);
+        relocalizationMatches = _localMap.find_relocalization_matches(detectedFeatures);
+    }
+
+    // the RANSAC hypotheses come from the minimal solvers, they do not depend on the predicted pose
+    utils::Pose relocalizedPose;
+    if (not _poseOptimization.compute_optimized_pose(predictedPose, relocalizationMatches, relocalizedPose, matchSets))
+        return false;
+
+    // match again around the relocalized pose: this flags the matched features for the map update
+    matches_containers::match_container matchedFeatures;
+    {
+        std::scoped_lock lock(_trackingStateMutex);
+        matchedFeatures = _localMap.find_feature_matches(relocalizedPose, detectedFeatures);
+    }
+    if (not _poseOptimization.compute_optimized_pose(relocalizedPose, matchedFeatures, optimizedPose, matchSets))
+        return false;
+
+    outputs::log(std::format("Relocalized with {} descriptor matches", relocalizationMatches.size()));
+    return true;
+}
+
+void RGBD_SLAM::apply_bundle_adjustment_corrections(utils::PoseBase& pose) noexcept
+{
+    if (_bundleAdjustment == nullptr)
+        return;
+
+    const auto& corrections = _bundleAdjustment->get_corrections();
+    if (corrections == nullptr)
+        return;
+    // the displacements are relative to map estimates that were already corrected since: the next ones will not be
+    if (corrections->_correctionGeneration != _appliedCorrectionCount)
+        return;
+
+    _localMap.apply_corrections(*corrections);
+    corrections->correct_pose(pose);
+    corrections->correct_pose(_currentPose);
+    ++_appliedCorrectionCount;
+}
+
+void RGBD_SLAM::add_bundle_adjustment_keyframe(const utils::PoseBase& pose,
+                                               const matches_containers::match_container& inliers) noexcept
+{
+    if (_bundleAdjustment == nullptr)
+        return;
+
+    pose_optimization::Bundle_Adjustment_Keyframe keyframe;
+    keyframe._pose = pose;
+    keyframe._correctionGeneration = _appliedCorrectionCount;
+    keyframe._shouldResetWindow = _shouldResetBundleAdjustmentWindow;
+    for (const auto& match: inliers)
+    {
+        match->add_to_bundle_adjustment(keyframe);
+    }
+    // dropped if the bundle adjustment is late: the tracking never waits for it
+    if (_bundleAdjustment->add_keyframe(std::move(keyframe)))
+        _shouldResetBundleAdjustmentWindow = false;
+}
+
+void RGBD_SLAM::apply_pose_graph_corrections(utils::PoseBase& pose) noexcept
 {
+    if (_poseGraph == nullptr)
+        return;
+
+    const auto& corrections = _poseGraph->get_corrections();
+    if (corrections == nullptr)
+        return;
+    // computed for a map that was corrected since: the pose graph will publish new ones
+    if (corrections->_baseId != _appliedPoseGraphCorrectionId)
+        return;
+
+    _localMap.apply_corrections(*corrections);
+    corrections->correct_pose(pose);
+    corrections->correct_pose(_currentPose);
+    _appliedPoseGraphCorrectionId = corrections->_id;
+
+    // the pending bundle adjustment corrections and its window are relative to the uncorrected map
+    ++_appliedCorrectionCount;
+    _shouldResetBundleAdjustmentWindow = true;
+    _motionModel.reset();
+    _keyframeSelector.reset();
+}
+
+void RGBD_SLAM::add_pose_graph_keyframe(const utils::PoseBase& pose,
+                                        const map_management::DetectedFeatureContainer& detectedFeatures) noexcept
+{
+    if (_poseGraph == nullptr)
+        return;
+
+    static constexpr size_t maximumPointsPerKeyframe = parameters::optimization::poseGraph::maximumPointsPerKeyframe;
+
+    pose_optimization::Pose_Graph_Keyframe keyframe;
+    keyframe._pose = pose;
+    keyframe._appliedCorrectionId = _appliedPoseGraphCorrectionId;
+
+    const features::keypoints::Keypoint_Handler& keypointObject = detectedFeatures.keypointObject;
+    const uint keypointCount = static_cast<uint>(keypointObject.size());
+    keyframe._cameraPoints.reserve(std::min<size_t>(keypointCount, maximumPointsPerKeyframe));
+    for (uint i = 0; i < keypointCount and keyframe._cameraPoints.size() < maximumPointsPerKeyframe; ++i)
+    {
+        const ScreenCoordinate& keypoint = keypointObject.get_keypoint(i);
+        if (not keypointObject.has_descriptor(i) or not is_depth_valid(keypoint.z()))
+            continue;
+
+        keyframe._cameraPoints.emplace_back(keypoint.to_camera_coordinates());
+        // the descriptor rows are copied: the keyframe outlives the keypoint handler
+        keyframe._descriptors.push_back(keypointObject.get_descriptor(i));
+    }
+    // dropped if the pose graph is late: the tracking never waits for it
+    std::ignore = _poseGraph->add_keyframe(std::move(keyframe));
+}
+
+map_management::DetectedFeatureContainer RGBD_SLAM::detect_features(
+        const bool shouldRecomputeKeypoints,
+        const map_management::TrackedFeaturesContainer& trackedFeatures,
+        const cv::Mat& grayImage,
+        const cv::Mat_<float>& depthImage,
+        const matrixf& cloudArrayOrganized,
+        const double matchSearchRadius,
+        const bool shouldDetectPlanes,
+        outputs::Frame_Metrics& metrics) noexcept
+{
+    // the detections run as tasks of the shared scheduler: no thread is created for each frame
+    const uint64_t frameRandomKey = _detectedFrameCount++;
+    std::optional<features::keypoints::Keypoint_Handler> keypointObject;
+    features::primitives::plane_container detectedPlanes;
+    features::lines::line_container detectedLines;
+    features::lines::segment_container detectedSegments;
+    tbb::task_group detectionTasks;
+
 #define USE_KEYPOINTS_DETECTION
 #ifdef USE_KEYPOINTS_DETECTION
     // keypoint detection
-    auto kpHandler = std::async(std::launch::async, [this, &predictedPose, &grayImage, &depthImage]() {
-        const bool shouldRecomputeKeypoints = _isTrackingLost or _computeKeypointCount == 1;
-        // Get map points that were tracked last call, and retroproject them to screen space using
-        // last pose (used for optical flow)
-        const auto& trackedFeaturesContainer = _localMap.get_tracked_features(predictedPose);
-
+    detectionTasks.run([this,
+                        shouldRecomputeKeypoints,
+                        matchSearchRadius,
+                        &trackedFeatures,
+                        &grayImage,
+                        &depthImage,
+                        &keypointObject,
+                        &metrics]() {
+        // each task times its own stage of the metrics
+        outputs::Scoped_Timer keypointTimer(metrics, outputs::Frame_Stage::KeypointDetection);
+        const outputs::Scoped_Trace trace("keypoint_detection");
         // TODO: handle the other tracked features here
 
         // Detect keypoints, and match the one detected by optical flow
-        return _pointDetector->compute_keypoints(
-                grayImage, depthImage, *(trackedFeaturesContainer.trackedPoints), shouldRecomputeKeypoints);
+        keypointObject = _pointDetector->compute_keypoints(grayImage,
+                                                           depthImage,
+                                                           *(trackedFeatures.trackedPoints),
+                                                           shouldRecomputeKeypoints,
+                                                           matchSearchRadius);
     });
 #else
-    auto kpHandler = std::async(std::launch::async, [&depthImage]() {
-        static features::keypoints::Keypoint_Handler keypointHandler(depthImage.cols, depthImage.rows, 1.0);
-        return keypointHandler;
-    });
+    keypointObject.emplace(depthImage.cols, depthImage.rows, 1.0);
 #endif
 
+    // plane detection, then line detection outside of the detected planes: runs in parallel with the keypoints
+    if (shouldDetectPlanes)
+    {
+        detectionTasks.run([this,
+                            frameRandomKey,
+                            &cloudArrayOrganized,
+                            &grayImage,
+                            &depthImage,
+                            &trackedFeatures,
+                            &detectedPlanes,
+                            &detectedLines,
+                            &detectedSegments,
+                            &metrics]() {
+            outputs::Scoped_Timer planeTimer(metrics, outputs::Frame_Stage::PlaneDetection);
+            const outputs::Scoped_Trace trace("plane_detection");
+            // the cylinder RANSAC draws from a stream of this frame, whatever the thread that runs this task
+            const utils::Random::Scoped_Stream randomStream(frameRandomKey, 0);
 #define USE_PLANE_DETECTION
 #ifdef USE_PLANE_DETECTION
-    // plane detection
-    auto planeHandler = std::async(std::launch::async, [this, &cloudArrayOrganized, &depthImage]() {
-        // Run primitive detection
-        features::primitives::plane_container detectedPlanes;
-        features::primitives::cylinder_container detectedCylinders; // TODO: handle detected cylinders in local map
-        _primitiveDetector->find_primitives(cloudArrayOrganized, depthImage, detectedPlanes, detectedCylinders);
-        return detectedPlanes;
-    });
-#else
-    auto planeHandler = std::async(std::launch::async, []() {
-        return features::primitives::plane_container();
-    });
+            // Run primitive detection
+            // TODO: handle detected cylinders in local map
+            features::primitives::cylinder_container detectedCylinders;
+            _primitiveDetector->find_primitives(cloudArrayOrganized,
+                                                depthImage,
+                                                *(trackedFeatures.trackedPlanes),
+                                                detectedPlanes,
+                                                detectedCylinders);
 #endif
 
 #ifdef USE_LINE_DETECTION
-    // line detection
-    auto lineHandler = std::async([this, &grayImage, &depthImage]() {
-        return _lineDetector->detect_lines(grayImage, depthImage);
-    });
+            const outputs::Scoped_Trace lineTrace("line_detection");
+            const double lineDetectionStartTime = static_cast<double>(cv::getTickCount());
+            detectedLines = _lineDetector->detect_lines(grayImage, depthImage, detectedPlanes);
+            detectedSegments = _lineDetector->lift_lines(detectedLines, depthImage);
+            _lineDetector->_meanLineTreatmentDuration +=
+                    (static_cast<double>(cv::getTickCount()) - lineDetectionStartTime) / cv::getTickFrequency();
 #else
-    auto lineHandler = std::async([]() {
-        return features::lines::line_container();
-    });
+            std::ignore = grayImage;
 #endif
+        });
+    }
+    detectionTasks.wait();
+
+    assert(keypointObject.has_value());
+    keypointObject->set_search_radius(matchSearchRadius);
+    metrics.set_counter(outputs::Frame_Counter::DetectedKeypoints, keypointObject->size());
+    metrics.set_counter(outputs::Frame_Counter::DetectedPlanes, detectedPlanes.size());
+
+    return map_management::DetectedFeatureContainer(*keypointObject, detectedLines, detectedSegments, detectedPlanes);
+}
+
+namespace {
+
+/**
+ * \brief The camera pose and motion model state, as saved in a map state file
+ */
+struct SavedPose
+{
+    std::array<double, 3> _position;
+    std::array<double, 4> _orientation; // x, y, z, w
+    std::array<double, 36> _poseVariance;
+    std::array<double, 4> _lastRotation;
+    std::array<double, 4> _angularVelocity;
+    std::array<double, 3> _lastPosition;
+    std::array<double, 3> _linearVelocity;
+    uint8_t _isLastPositionSet;
+    double _matchSearchRadius;
+};
+
+std::array<double, 4> to_array(const quaternion& q) noexcept { return {q.x(), q.y(), q.z(), q.w()}; }
+quaternion to_quaternion(const std::array<double, 4>& q) noexcept { return quaternion(q[3], q[0], q[1], q[2]); }
+std::array<double, 3> to_array(const vector3& v) noexcept { return {v.x(), v.y(), v.z()}; }
+vector3 to_vector(const std::array<double, 3>& v) noexcept { return vector3(v[0], v[1], v[2]); }
 
-    return map_management::DetectedFeatureContainer(kpHandler.get(), lineHandler.get(), planeHandler.get());
+} // namespace
+
+bool RGBD_SLAM::save_map(const std::string& filePath) const noexcept
+{
+    // the map and tracking state are shared with the tracking stages
+    std::scoped_lock lock(_trackingStateMutex);
+
+    map_management::Map_State_Writer writer(filePath);
+    if (not writer.is_valid())
+        return false;
+
+    writer.begin_section(map_management::Map_State_Section::Header);
+    writer.append(static_cast<uint64_t>(_localMap.get_id_allocator().get_last_id()));
+
+    const tracking::Motion_Model::State motionState = _motionModel.get_state();
+    SavedPose savedPose;
+    savedPose._position = to_array(_currentPose.get_position());
+    savedPose._orientation = to_array(_currentPose.get_orientation_quaternion());
+    Eigen::Map<matrix66>(savedPose._poseVariance.data()) = _currentPose.get_pose_variance();
+    savedPose._lastRotation = to_array(motionState.lastRotation);
+    savedPose._angularVelocity = to_array(motionState.angularVelocity);
+    savedPose._lastPosition = to_array(motionState.lastPosition);
+    savedPose._linearVelocity = to_array(motionState.linearVelocity);
+    savedPose._isLastPositionSet = motionState.isLastPositionSet ? 1 : 0;
+    savedPose._matchSearchRadius = motionState.matchSearchRadius;
+    writer.begin_section(map_management::Map_State_Section::Pose);
+    writer.append_record(savedPose);
+
+    _localMap.write_state(writer);
+    if (not writer.close())
+    {
+        outputs::log_error("Could not write the map state file " + filePath);
+        return false;
+    }
+    return true;
+}
+
+bool RGBD_SLAM::load_map(const std::string& filePath) noexcept
+{
+    if (_isPipelineRunning)
+    {
+        outputs::log_error("Cannot load a map while the pipelined tracking is running");
+        return false;
+    }
+
+    const map_management::Map_State_Reader reader(filePath);
+    if (not reader.is_valid())
+        return false;
+
+    map_management::Map_State_Reader::Section_Cursor cursor;
+    uint64_t lastId = 0;
+    SavedPose savedPose;
+    if (not reader.get_section(map_management::Map_State_Section::Header, cursor) or not cursor.read(lastId) or
+        not reader.get_section(map_management::Map_State_Section::Pose, cursor) or not cursor.read(savedPose))
+    {
+        outputs::log_error("The map state file " + filePath + " has no header or pose");
+        return false;
+    }
+
+    std::scoped_lock lock(_trackingStateMutex);
+    // the keyframes of the pose graph and its pending loop closures belong to the replaced map
+    if (_poseGraph != nullptr)
+    {
+        _poseGraph->stop();
+        _poseGraph->start();
+    }
+    _appliedPoseGraphCorrectionId = 0;
+    // same for the pending bundle adjustment corrections: the ones computed later are stale too
+    if (_bundleAdjustment != nullptr)
+        std::ignore = _bundleAdjustment->get_corrections();
+    ++_appliedCorrectionCount;
+
+    // the new map features must not reuse the restored ids
+    _localMap.get_id_allocator().skip_ids_until(static_cast<size_t>(lastId));
+
+    const matrix66 poseVariance = Eigen::Map<const matrix66>(savedPose._poseVariance.data());
+    _currentPose = utils::Pose(to_vector(savedPose._position), to_quaternion(savedPose._orientation), poseVariance);
+
+    tracking::Motion_Model::State motionState;
+    motionState.lastRotation = to_quaternion(savedPose._lastRotation);
+    motionState.angularVelocity = to_quaternion(savedPose._angularVelocity);
+    motionState.lastPosition = to_vector(savedPose._lastPosition);
+    motionState.linearVelocity = to_vector(savedPose._linearVelocity);
+    motionState.isLastPositionSet = savedPose._isLastPositionSet != 0;
+    motionState.matchSearchRadius = savedPose._matchSearchRadius;
+    _motionModel.set_state(motionState);
+
+    // replaces the local and staged maps, and the lost points of the tile store
+    const size_t restoredCount = _localMap.read_state(reader);
+
+    // the next frame starts a new tracking from the restored map
+    _keyframeSelector.reset();
+    _shouldResetBundleAdjustmentWindow = true;
+    // the first frame is tracked in the restored map, and relocalized in it if the saved pose is too far
+    _isFirstTrackingCall = restoredCount == 0;
+    _isTrackingLost = restoredCount > 0;
+    _failedTrackingCount = 0;
+
+    outputs::log(std::format("Restored {} map features from {}", restoredCount, filePath));
+    return true;
 }
 
 double get_percent_of_elapsed_time(const double treatmentTime, const double totalTimeElapsed) noexcept
@@ -341,8 +1132,29 @@ void RGBD_SLAM::show_statistics(const double meanFrameTreatmentDuration) const n
         // display local map update statistics (find matches, map update)
         _localMap.show_statistics(meanFrameTreatmentDuration, _totalFrameTreated);
 
+        // display the proportion of frames that updated the map
+        _keyframeSelector.show_statistics();
+
+        // display the proportion of degraded frames
+        _loadController.show_statistics();
+
         // display pose optimization from features statistics
-        pose_optimization::Pose_Optimization::show_statistics(meanFrameTreatmentDuration, _totalFrameTreated, false);
+        _poseOptimization.show_statistics(meanFrameTreatmentDuration, _totalFrameTreated, false);
+
+        // display the background bundle adjustment statistics
+        if (_bundleAdjustment != nullptr)
+            _bundleAdjustment->show_statistics();
+
+        // display the background loop closure statistics
+        if (_poseGraph != nullptr)
+            _poseGraph->show_statistics();
+
+        // display the integrated frames of the dense reconstruction
+        if (_denseReconstruction != nullptr)
+            _denseReconstruction->show_statistics();
+
+        // display the latency distribution of the tracking stages
+        _metricsRecorder.show_statistics();
     }
 }
 
@@ -6,16 +6,29 @@
 #include "features/primitives/depth_map_transformation.hpp"
 #include "features/primitives/primitive_detection.hpp"
 
+#include "map_management/debug_renderer.hpp"
+#include "map_management/dense_reconstruction.hpp"
 #include "map_management/local_map.hpp"
 // local maps
 #include "map_features/map_point2d.hpp"
 #include "map_features/map_point.hpp"
 #include "map_features/map_primitive.hpp"
+#include "outputs/frame_metrics.hpp"
 
+#include "pose_optimization/local_bundle_adjustment.hpp"
+#include "pose_optimization/pose_graph.hpp"
+#include "pose_optimization/pose_optimization.hpp"
+#include "tracking/imu_preintegration.hpp"
+#include "tracking/keyframe_selector.hpp"
+#include "tracking/load_controller.hpp"
 #include "tracking/motion_model.hpp"
+#include "utils/bounded_queue.hpp"
 #include "utils/pose.hpp"
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <opencv2/line_descriptor.hpp>
+#include <thread>
 
 namespace rgbd_slam {
 
@@ -26,6 +39,13 @@ namespace rgbd_slam {
 class RGBD_SLAM
 {
   public:
+    /**
+     * \brief Called by the pipelined tracking for each treated frame, in submission order
+     * \param[in] frameId The index of the frame, as returned by push_frame
+     * \param[in] pose The estimated pose for this frame
+     */
+    using tracking_callback = std::function<void(const size_t frameId, const utils::Pose& pose)>;
+
     /**
      * \param[in] startPose the initial pose
      * \param[in] imageWidth The width of the depth images (fixed)
@@ -33,6 +53,16 @@ class RGBD_SLAM
      */
     RGBD_SLAM(const utils::Pose& startPose, const uint imageWidth = 640, const uint imageHeight = 480);
 
+    ~RGBD_SLAM();
+
+    /**
+     * \brief Run a synthetic frame through the depth transformations and the feature detections, so their buffers,
+     * the detectors and the scheduler threads are allocated before the first real frame. The pose and the map are not
+     * modified. Must be called before the first tracked frame, and before starting the pipelined tracking
+     * \return false if a frame was already tracked: nothing was done
+     */
+    [[nodiscard]] bool warm_up() noexcept;
+
     /**
      * \brief Convert the given depth image to the rectified version. IE: align it with the RGB image
      * \param[in, out] depthImage the distorded depth image
@@ -44,10 +74,90 @@ class RGBD_SLAM
      *
      * \param[in] inputRgbImage Raw RGB image
      * \param[in] inputDepthImage Raw depth Image, in millimeters
+     * \param[in] shouldRectifyDepth If true, align the depth image with the rgb image before using it. This is faster
+     * than calling rectify_depth before tracking
      *
      * \return The new estimated pose
      */
-    [[nodiscard]] utils::Pose track(const cv::Mat& inputRgbImage, const cv::Mat_<float>& inputDepthImage) noexcept;
+    [[nodiscard]] utils::Pose track(const cv::Mat& inputRgbImage,
+                                    const cv::Mat_<float>& inputDepthImage,
+                                    const bool shouldRectifyDepth = false) noexcept;
+
+    /**
+     * \brief Estimates a new pose from the given images, with the raw 16 bits depth of the sensor. The depth scale is
+     * applied by the cloud creation, there is no conversion pass over the depth image
+     *
+     * \param[in] inputRgbImage Raw RGB image
+     * \param[in] rawDepthImage Raw depth Image, in sensor units
+     * \param[in] depthScale Millimeters by sensor unit
+     * \param[in] shouldRectifyDepth If true, align the depth image with the rgb image before using it
+     *
+     * \return The new estimated pose
+     */
+    [[nodiscard]] utils::Pose track(const cv::Mat& inputRgbImage,
+                                    const cv::Mat_<uint16_t>& rawDepthImage,
+                                    const float depthScale,
+                                    const bool shouldRectifyDepth = false) noexcept;
+
+    /**
+     * \brief Add a gyroscope sample, used to predict the rotation of the next tracked frame. A predicted rotation
+     * shrinks the search windows of the point matches. Can be called from any thread, in timestamp order.
+     * The pipelined tracking does not use the samples: its predictions are two frames behind
+     * \param[in] sample The angular velocity of the camera, in the camera coordinates
+     */
+    void add_imu_sample(const tracking::Imu_Sample& sample) noexcept;
+
+    /**
+     * \brief Start the pipelined tracking mode: the feature detection of a frame runs while the pose of the previous
+     * frame is optimized and the local map updated. The feature tracking of a frame is thus based on the map state
+     * of two frames before, which is the price of the throughput gain.
+     * \param[in] onFrameTracked Called from the tracking thread for each treated frame, in submission order
+     * \param[in] queueCapacity Maximum number of frames waiting for a treatment stage before push_frame blocks
+     * \return false if the pipeline was already running
+     */
+    [[nodiscard]] bool start_pipelined_tracking(const tracking_callback& onFrameTracked,
+                                                const size_t queueCapacity = 2) noexcept;
+
+    /**
+     * \brief Submit a frame to the pipelined tracking. Blocks while the frame queue is full.
+     * The images are shared with the pipeline, they should not be modified by the caller after this call.
+     * \param[in] inputRgbImage Raw RGB image
+     * \param[in] inputDepthImage Raw depth Image, in millimeters
+     * \param[out] frameId The index of this frame, passed to the tracking callback
+     * \param[in] shouldRectifyDepth If true, align the depth image with the rgb image before using it
+     * \return false if the pipeline is not running
+     */
+    [[nodiscard]] bool push_frame(const cv::Mat& inputRgbImage,
+                                  const cv::Mat_<float>& inputDepthImage,
+                                  size_t& frameId,
+                                  const bool shouldRectifyDepth = false) noexcept;
+
+    /**
+     * \brief Submit a frame with the raw 16 bits depth of the sensor to the pipelined tracking. Blocks while the frame
+     * queue is full. The images are shared with the pipeline, they should not be modified by the caller after this
+     * call.
+     * \param[in] inputRgbImage Raw RGB image
+     * \param[in] rawDepthImage Raw depth Image, in sensor units
+     * \param[in] depthScale Millimeters by sensor unit
+     * \param[out] frameId The index of this frame, passed to the tracking callback
+     * \param[in] shouldRectifyDepth If true, align the depth image with the rgb image before using it
+     * \return false if the pipeline is not running
+     */
+    [[nodiscard]] bool push_frame(const cv::Mat& inputRgbImage,
+                                  const cv::Mat_<uint16_t>& rawDepthImage,
+                                  const float depthScale,
+                                  size_t& frameId,
+                                  const bool shouldRectifyDepth = false) noexcept;
+
+    /**
+     * \brief Treat all the submitted frames, then stop the pipelined tracking threads
+     */
+    void stop_pipelined_tracking() noexcept;
+
+    /**
+     * \return true if the pipelined tracking mode is running
+     */
+    [[nodiscard]] bool is_pipelined_tracking_running() const noexcept { return _isPipelineRunning; }
 
     /**
      * \brief Compute a debug image
@@ -62,32 +172,304 @@ class RGBD_SLAM
                                           const double elapsedTime,
                                           const bool shouldDisplayStagedFeatures = false) const noexcept;
 
+    /**
+     * \brief Draw a debug image in a buffer of the caller. When the debug rendering thread runs, the features are
+     * copied from its last overlay instead of being drawn
+     *
+     * \param[in] camPose Current pose of the observer
+     * \param[in] originalRGB Raw rgb image. Will be used as a base for the final image
+     * \param[in] elapsedTime Time since the last call (used for FPS count)
+     * \param[in, out] debugImage The output image. Reused if it has the size of originalRGB, and can be originalRGB
+     * itself to draw over it without a copy
+     * \param[in] shouldDisplayStagedFeatures Display the features that are not map features yet (not used by the
+     * rendering thread)
+     */
+    void draw_debug_image(const utils::Pose& camPose,
+                          const cv::Mat& originalRGB,
+                          const double elapsedTime,
+                          cv::Mat& debugImage,
+                          const bool shouldDisplayStagedFeatures = false) const noexcept;
+
+    /**
+     * \brief Start drawing the debug feature overlay on a background thread, from the map snapshots. The overlay is
+     * refreshed at its own rate, independent of the tracking
+     * \param[in] refreshRate_Hz Number of overlay renders per second
+     */
+    void start_debug_rendering(
+            const double refreshRate_Hz = parameters::display::debugOverlayRefreshRate_Hz) noexcept;
+
+    /**
+     * \brief Stop the debug rendering thread: the next debug images draw the features themselves
+     */
+    void stop_debug_rendering() noexcept;
+
+    /**
+     * \brief Start the dense reconstruction of the tracked depth frames on a background thread. The surface meshes
+     * are streamed to an OBJ file while the tracking runs. The tracking never waits for the reconstruction: the
+     * frames it cannot integrate in time are dropped. Restarts a running reconstruction in a new file. Cannot be
+     * called while the pipelined tracking runs
+     * \param[in] meshPath The OBJ file of the dense meshes, created or truncated
+     */
+    void start_dense_reconstruction(const std::string& meshPath = "out_dense.obj") noexcept;
+
+    /**
+     * \brief Integrate the queued frames, write the meshes of the whole reconstruction and stop it. Cannot be called
+     * while the pipelined tracking runs
+     */
+    void stop_dense_reconstruction() noexcept;
+
+    /**
+     * \brief Get a copy of the local map, published after each map update. Can be called from any thread while the
+     * tracking runs: it never waits for the tracking. The snapshot is immutable, and stays valid while it is held
+     * \return The last published map snapshot, or nullptr if the map was never updated
+     */
+    [[nodiscard]] std::shared_ptr<const map_management::Map_Snapshot> get_map_snapshot() const noexcept
+    {
+        return _localMap.get_snapshot();
+    }
+
+    /**
+     * \brief Receive the changes of the local map (features added, updated, upgraded and removed) after each map
+     * update. The first delta received is the whole map. Can be called from any thread
+     * \param[in] callback Called on the map update thread with each delta: should only queue it. See
+     * map_management::encode_map_delta to send the deltas out of the process
+     * \return The id of this subscription, to unsubscribe
+     */
+    [[nodiscard]] size_t subscribe_map_deltas(map_management::Map_Delta_Publisher::subscriber callback) noexcept
+    {
+        return _localMap.get_delta_publisher().subscribe(std::move(callback));
+    }
+
+    /**
+     * \brief Stop receiving the changes of the local map
+     * \param[in] subscriptionId The id returned by subscribe_map_deltas
+     */
+    void unsubscribe_map_deltas(const size_t subscriptionId) noexcept
+    {
+        _localMap.get_delta_publisher().unsubscribe(subscriptionId);
+    }
+
+    /**
+     * \brief Save the whole map state (map features, lost map points, camera pose and motion model) to a binary file
+     * \param[in] filePath The path of the map state file, created or truncated
+     * \return true if the whole file was written
+     */
+    [[nodiscard]] bool save_map(const std::string& filePath) const noexcept;
+
+    /**
+     * \brief Restore a map state saved by save_map, to start this session from the saved map. Replaces the current
+     * map. Cannot be called while the pipelined tracking runs
+     * \param[in] filePath The path of the map state file
+     * \return true if the map state was restored
+     */
+    [[nodiscard]] bool load_map(const std::string& filePath) noexcept;
+
+    /**
+     * \brief Get the stage durations and counters of the last tracked frame. Can be called from any thread
+     */
+    [[nodiscard]] outputs::Frame_Metrics get_frame_metrics() const noexcept
+    {
+        return _metricsRecorder.get_last_frame_metrics();
+    }
+
+    /**
+     * \brief Get the latency statistics of a tracking stage, over all the tracked frames. Can be called from any
+     * thread
+     */
+    [[nodiscard]] outputs::Stage_Latency get_stage_latency(const outputs::Frame_Stage stage) const noexcept
+    {
+        return _metricsRecorder.get_stage_latency(stage);
+    }
+
+    /**
+     * \brief Get the highest memory of a consumer after a tracked frame, in bytes. The memory of the last frame is in
+     * get_frame_metrics. Can be called from any thread
+     */
+    [[nodiscard]] size_t get_peak_memory_usage(const outputs::Memory_Consumer consumer) const noexcept
+    {
+        return _metricsRecorder.get_peak_memory_usage(consumer);
+    }
+
+    /**
+     * \brief Get the highest memory of all the consumers after a tracked frame, in bytes. Can be called from any thread
+     */
+    [[nodiscard]] size_t get_peak_total_memory_usage() const noexcept
+    {
+        return _metricsRecorder.get_peak_total_memory_usage();
+    }
+
     /**
      * \brief Show the time statistics for certain parts of the program. Kind of a basic profiler
      */
     void show_statistics(double meanFrameTreatmentDuration) const noexcept;
 
   protected:
-    [[nodiscard]] map_management::DetectedFeatureContainer detect_features(const utils::Pose& predictedPose,
-                                                                           const cv::Mat& grayImage,
-                                                                           const cv::Mat_<float>& depthImage,
-                                                                           const matrixf& cloudArrayOrganized) noexcept;
+    /**
+     * \brief Result of the detection stage of a frame
+     */
+    struct DetectedFrame
+    {
+        DetectedFrame(const utils::Pose& pose,
+                      map_management::DetectedFeatureContainer&& features,
+                      const double duration,
+                      const outputs::Frame_Metrics& metrics,
+                      const tracking::Load_Shedding_Level level,
+                      const cv::Mat_<float>& denseDepth) :
+            predictedPose(pose),
+            detectedFeatures(std::move(features)),
+            detectionDuration(duration),
+            detectionMetrics(metrics),
+            sheddingLevel(level),
+            denseDepthImage(denseDepth)
+        {
+        }
+
+        const utils::Pose predictedPose;
+        const map_management::DetectedFeatureContainer detectedFeatures;
+        const double detectionDuration;                    // in seconds
+        const outputs::Frame_Metrics detectionMetrics;     // durations and counters of the detection stages
+        const tracking::Load_Shedding_Level sheddingLevel; // quality level of this frame, kept by the pose stage
+        // subsampled depth of this frame, integrated with its pose. Empty if the dense reconstruction is not running
+        const cv::Mat_<float> denseDepthImage;
+    };
+
+    /**
+     * \brief A raw frame waiting in the pipelined tracking queue
+     */
+    struct InputFrame
+    {
+        size_t id = 0;
+        cv::Mat rgbImage;
+        cv::Mat depthImage; // in millimeters (CV_32F), or raw sensor units (CV_16U) scaled by depthScale
+        float depthScale = 1.0f;
+        bool shouldRectifyDepth = false;
+    };
+
+    /**
+     * \brief A frame waiting for the pose optimization stage of the pipelined tracking
+     */
+    struct PendingFrame
+    {
+        size_t id = 0;
+        std::unique_ptr<DetectedFrame> detectedFrame;
+    };
+
+    /**
+     * \brief Track a frame, for the two depth formats of track
+     * \param[in] inputRgbImage Raw RGB image
+     * \param[in] inputDepthImage Raw depth Image, in millimeters (CV_32F) or in sensor units (CV_16U)
+     * \param[in] depthScale Millimeters by sensor unit of a CV_16U depth image
+     * \param[in] shouldRectifyDepth If true, align the depth image with the rgb image before using it
+     * \return The new estimated pose
+     */
+    [[nodiscard]] utils::Pose track_frame(const cv::Mat& inputRgbImage,
+                                          const cv::Mat& inputDepthImage,
+                                          const float depthScale,
+                                          const bool shouldRectifyDepth) noexcept;
+
+    /**
+     * \brief Submit a frame to the pipelined tracking, for the two depth formats of push_frame
+     * \param[in] frame The frame to submit, without its id
+     * \param[out] frameId The index of this frame, passed to the tracking callback
+     * \return false if the pipeline is not running
+     */
+    [[nodiscard]] bool push_input_frame(InputFrame&& frame, size_t& frameId) noexcept;
+
+    /**
+     * \brief First stage of the tracking: transform the depth image and detect the features of this frame
+     * \param[in] inputRgbImage Raw RGB image
+     * \param[in] inputDepthImage Raw depth Image, in millimeters (CV_32F) or in sensor units (CV_16U)
+     * \param[in] depthScale Millimeters by sensor unit of a CV_16U depth image
+     * \param[in] shouldRectifyDepth If true, align the depth image with the rgb image before using it
+     * \param[in] imuPreintegration The gyroscope samples integrated since the last frame, to predict its rotation
+     * \return The features detected in those images, with the pose used to detect them
+     */
+    [[nodiscard]] std::unique_ptr<DetectedFrame> detect_frame_features(
+            const cv::Mat& inputRgbImage,
+            const cv::Mat& inputDepthImage,
+            const float depthScale,
+            const bool shouldRectifyDepth,
+            const tracking::Imu_Preintegration& imuPreintegration) noexcept;
+
+    /**
+     * \param[in] matchSearchRadius The radius of the search space of the point matches, from the pose prediction
+     * \param[in] shouldDetectPlanes If false, the plane and line detections are skipped for this frame
+     * \param[in, out] metrics Receives the durations and counters of the detections
+     */
+    [[nodiscard]] map_management::DetectedFeatureContainer detect_features(
+            const bool shouldRecomputeKeypoints,
+            const map_management::TrackedFeaturesContainer& trackedFeatures,
+            const cv::Mat& grayImage,
+            const cv::Mat_<float>& depthImage,
+            const matrixf& cloudArrayOrganized,
+            const double matchSearchRadius,
+            const bool shouldDetectPlanes,
+            outputs::Frame_Metrics& metrics) noexcept;
 
     /**
-     * \brief Compute a new pose from the keypoints points between two following images. It uses only the keypoints with
-     * an associated depth
+     * \brief Second stage of the tracking: compute a new pose from the features detected in a frame, and update the
+     * local map with it
      *
-     * \param[in] grayImage The input image from the camera, as a gray image
-     * \param[in] depthImage The associated depth image, already corrected with camera parameters
-     * \param[in] cloudArrayOrganized Organized depth image as a connected cloud
+     * \param[in] detectedFrame The features detected by detect_frame_features
      *
-     * \return The new estimated pose from points positions
+     * \return The new estimated pose from features positions
+     */
+    [[nodiscard]] utils::Pose compute_new_pose(const DetectedFrame& detectedFrame) noexcept;
+
+    /**
+     * \brief Find the pose of a frame when the tracking is lost: the detected keypoints are matched to the local map
+     * points by descriptor only, and the pose is computed from those matches with the RANSAC. The matches are then
+     * searched again around this pose
+     * \param[in] predictedPose The pose predicted for this frame (not trusted)
+     * \param[in] detectedFeatures The features detected in this frame
+     * \param[out] optimizedPose The relocalized pose
+     * \param[out] matchSets The inliers and outliers of the relocalized pose
+     * \return true if a pose was found
+     */
+    [[nodiscard]] bool relocalize(const utils::Pose& predictedPose,
+                                  const map_management::DetectedFeatureContainer& detectedFeatures,
+                                  utils::Pose& optimizedPose,
+                                  matches_containers::match_sets& matchSets) noexcept;
+
+    /**
+     * \brief Move the local map, the current pose and the given pose with the last corrections of the bundle
+     * adjustment, if any
+     * \param[in, out] pose A pose tracked in the map before the corrections
+     */
+    void apply_bundle_adjustment_corrections(utils::PoseBase& pose) noexcept;
+
+    /**
+     * \brief Submit a keyframe to the bundle adjustment
+     * \param[in] pose The optimized pose of this keyframe
+     * \param[in] inliers The inlier matches of the pose optimization
+     */
+    void add_bundle_adjustment_keyframe(const utils::PoseBase& pose,
+                                        const matches_containers::match_container& inliers) noexcept;
+
+    /**
+     * \brief Move the local map, the current pose and the given pose with the last loop closure corrections of the
+     * pose graph, if any
+     * \param[in, out] pose A pose tracked in the map before the corrections
+     */
+    void apply_pose_graph_corrections(utils::PoseBase& pose) noexcept;
+
+    /**
+     * \brief Submit a keyframe to the pose graph, with its keypoints that have a depth and a descriptor
+     * \param[in] pose The optimized pose of this keyframe
+     * \param[in] detectedFeatures The features detected in this keyframe
+     */
+    void add_pose_graph_keyframe(const utils::PoseBase& pose,
+                                 const map_management::DetectedFeatureContainer& detectedFeatures) noexcept;
+
+    /**
+     * \brief Thread function of the pipelined mode: runs detect_frame_features on the submitted frames
      */
-    [[nodiscard]] utils::Pose compute_new_pose(const cv::Mat& grayImage,
-                                               const cv::Mat_<float>& depthImage,
-                                               const matrixf& cloudArrayOrganized) noexcept;
+    void run_detection_stage() noexcept;
 
-    void compute_lines(const cv::Mat& grayImage, const cv::Mat_<float>& depthImage, cv::Mat& outImage) noexcept;
+    /**
+     * \brief Thread function of the pipelined mode: runs compute_new_pose on the detected frames
+     */
+    void run_pose_stage() noexcept;
 
     void set_color_vector() noexcept;
 
@@ -110,15 +492,48 @@ class RGBD_SLAM
 
     utils::Pose _currentPose;
     tracking::Motion_Model _motionModel;
+    pose_optimization::Pose_Optimization _poseOptimization; // warm start and statistics of this instance
+    uint64_t _detectedFrameCount = 0; // keys the random streams of the detection tasks
+    // gyroscope samples received since the last tracked frame
+    std::mutex _imuMutex;
+    tracking::Imu_Preintegration _imuPreintegration;
+    tracking::Keyframe_Selector _keyframeSelector; // selects the tracked frames that update the map
+    tracking::Load_Controller _loadController;     // degrades the next frames when a frame misses the deadline
 
     bool _isTrackingLost;      // True is the tracking of last frame failed
     uint _failedTrackingCount; // number of consecutive lost tracking
 
     bool _isFirstTrackingCall = true; // first call to the tracking function (prevent erroneous error messages)
 
+    // Protects the local map and the tracking state, shared by the detection and pose stages
+    mutable std::mutex _trackingStateMutex;
+
+    // sliding window bundle adjustment, running on its own thread
+    std::unique_ptr<pose_optimization::Local_Bundle_Adjustment> _bundleAdjustment = nullptr;
+    size_t _appliedCorrectionCount = 0; // bundle adjustment corrections applied to the local map
+    bool _shouldResetBundleAdjustmentWindow = false; // the map was moved by a loop closure
+
+    // loop closure with a pose graph of the keyframes, running on its own thread
+    std::unique_ptr<pose_optimization::Pose_Graph> _poseGraph = nullptr;
+    size_t _appliedPoseGraphCorrectionId = 0; // id of the last loop closure corrections applied to the local map
+
+    // pipelined tracking
+    bool _isPipelineRunning = false;
+    size_t _nextFrameId = 0;
+    tracking_callback _onFrameTracked;
+    std::unique_ptr<utils::Bounded_Queue<InputFrame>> _inputFrames = nullptr;
+    std::unique_ptr<utils::Bounded_Queue<PendingFrame>> _detectedFrames = nullptr;
+    std::thread _detectionThread;
+    std::thread _poseThread;
+
     // debug
+    std::unique_ptr<map_management::Debug_Renderer> _debugRenderer = nullptr;
+    // dense reconstruction of the tracked frames, running on its own thread
+    std::unique_ptr<map_management::Dense_Reconstruction> _denseReconstruction = nullptr;
     uint _totalFrameTreated = 0;
     double _meanDepthMapTreatmentDuration = 0;
+    outputs::Metrics_Recorder _metricsRecorder; // per frame metrics, queried from any thread
+    outputs::Frame_Metrics _mapMemoryMetrics;   // last measured memory of the map, reported until the next measure
 
     // remove copy constructors as we have dynamically instantiated members
     RGBD_SLAM(const RGBD_SLAM& rgbdSlam) = delete;
@@ -0,0 +1,198 @@
+#include "descriptor_pool.hpp"
+
+#include "logger.hpp"
+#include <cassert>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+
+namespace rgbd_slam::tracking {
+
+/**
+ * Descriptor_Pool
+ */
+
+Descriptor_Pool& Descriptor_Pool::get_shared_pool() noexcept
+{
+    static Descriptor_Pool sharedPool;
+    return sharedPool;
+}
+
+Descriptor_Pool::Thread_Cache::Thread_Cache() noexcept
+{
+    // construct the shared pool first, so it is destroyed after the cache of the main thread
+    (void)get_shared_pool();
+    _rows.reserve(cacheBatchSize * 2);
+}
+
+Descriptor_Pool::Thread_Cache::~Thread_Cache() { get_shared_pool().drain(_rows, 0); }
+
+Descriptor_Pool::Thread_Cache& Descriptor_Pool::get_thread_cache() noexcept
+{
+    thread_local Thread_Cache threadCache;
+    return threadCache;
+}
+
+uchar* Descriptor_Pool::allocate() noexcept
+{
+    std::vector<uchar*>& cachedRows = get_thread_cache()._rows;
+    if (cachedRows.empty())
+        refill(cachedRows);
+
+    uchar* row = cachedRows.back();
+    cachedRows.pop_back();
+    _usedRowCount.fetch_add(1, std::memory_order_relaxed);
+    return row;
+}
+
+void Descriptor_Pool::refill(std::vector<uchar*>& cachedRows) noexcept
+{
+    std::scoped_lock lock(_mutex);
+    if (_freeRows.size() < cacheBatchSize)
+        add_block();
+
+    // keep the increasing row order of a new block
+    const auto batchStart = _freeRows.end() - static_cast<std::ptrdiff_t>(cacheBatchSize);
+    cachedRows.insert(cachedRows.end(), batchStart, _freeRows.end());
+    _freeRows.erase(batchStart, _freeRows.end());
+}
+
+void Descriptor_Pool::drain(std::vector<uchar*>& cachedRows, const size_t keptCount) noexcept
+{
+    if (cachedRows.size() <= keptCount)
+        return;
+
+    const auto drainStart = cachedRows.begin() + static_cast<std::ptrdiff_t>(keptCount);
+    std::scoped_lock lock(_mutex);
+    _freeRows.insert(_freeRows.end(), drainStart, cachedRows.end());
+    cachedRows.erase(drainStart, cachedRows.end());
+}
+
+void Descriptor_Pool::reserve(const size_t rowCount) noexcept
+{
+    std::scoped_lock lock(_mutex);
+    while (_blocks.size() * rowsPerBlock < rowCount)
+        add_block();
+}
+
+void Descriptor_Pool::add_block() noexcept
+{
+    // new block: all its rows are free, use them in increasing order. It is zero filled: its pages are mapped here,
+    // not at the first descriptor copies
+    auto& block = _blocks.emplace_back(std::make_unique<uchar[]>(rowsPerBlock * descriptorSize));
+    _freeRows.reserve(_freeRows.size() + rowsPerBlock);
+    for (size_t i = rowsPerBlock; i > 0; --i)
+    {
+        _freeRows.push_back(block.get() + (i - 1) * descriptorSize);
+    }
+}
+
+void Descriptor_Pool::release(uchar* row) noexcept
+{
+    assert(row != nullptr);
+    _usedRowCount.fetch_sub(1, std::memory_order_relaxed);
+
+    std::vector<uchar*>& cachedRows = get_thread_cache()._rows;
+    cachedRows.push_back(row);
+    // a thread that only releases (map cleaning) gives its rows back by batches
+    if (cachedRows.size() >= cacheBatchSize * 2)
+        drain(cachedRows, cacheBatchSize);
+}
+
+size_t Descriptor_Pool::get_used_row_count() const noexcept { return _usedRowCount.load(std::memory_order_relaxed); }
+
+size_t Descriptor_Pool::get_capacity() const noexcept
+{
+    std::scoped_lock lock(_mutex);
+    return _blocks.size() * rowsPerBlock;
+}
+
+size_t Descriptor_Pool::get_allocated_bytes() const noexcept
+{
+    std::scoped_lock lock(_mutex);
+    return _blocks.size() * rowsPerBlock * descriptorSize + _blocks.capacity() * sizeof(std::unique_ptr<uchar[]>) +
+           _freeRows.capacity() * sizeof(uchar*);
+}
+
+/**
+ * Pooled_Descriptor
+ */
+
+Pooled_Descriptor::Pooled_Descriptor(const cv::Mat& descriptor)
+{
+    if (descriptor.empty())
+        return;
+    if (descriptor.type() != CV_8U or descriptor.total() != Descriptor_Pool::descriptorSize)
+        throw std::invalid_argument(std::format("Pooled_Descriptor constructor: descriptor should be {} bytes",
+                                                Descriptor_Pool::descriptorSize));
+    copy_row(descriptor.ptr<uchar>(0));
+}
+
+Pooled_Descriptor::Pooled_Descriptor(const Pooled_Descriptor& other)
+{
+    if (not other.empty())
+        copy_row(other._row);
+}
+
+Pooled_Descriptor::Pooled_Descriptor(Pooled_Descriptor&& other) noexcept : _row(other._row) { other._row = nullptr; }
+
+Pooled_Descriptor& Pooled_Descriptor::operator=(const Pooled_Descriptor& other) noexcept
+{
+    if (this == &other)
+        return *this;
+
+    if (other.empty())
+        release();
+    else
+        copy_row(other._row);
+    return *this;
+}
+
+Pooled_Descriptor& Pooled_Descriptor::operator=(Pooled_Descriptor&& other) noexcept
+{
+    if (this == &other)
+        return *this;
+
+    release();
+    _row = other._row;
+    other._row = nullptr;
+    return *this;
+}
+
+Pooled_Descriptor::~Pooled_Descriptor() { release(); }
+
+void Pooled_Descriptor::set(const cv::Mat& descriptor) noexcept
+{
+    if (descriptor.empty())
+        return;
+    if (descriptor.type() != CV_8U or descriptor.total() != Descriptor_Pool::descriptorSize)
+    {
+        outputs::log_error(std::format("The descriptor should be {} bytes", Descriptor_Pool::descriptorSize));
+        return;
+    }
+    copy_row(descriptor.ptr<uchar>(0));
+}
+
+cv::Mat Pooled_Descriptor::get() const noexcept
+{
+    if (empty())
+        return cv::Mat();
+    return cv::Mat(1, Descriptor_Pool::descriptorSize, CV_8U, _row);
+}
+
+void Pooled_Descriptor::copy_row(const uchar* source) noexcept
+{
+    if (_row == nullptr)
+        _row = Descriptor_Pool::get_shared_pool().allocate();
+    std::memmove(_row, source, Descriptor_Pool::descriptorSize);
+}
+
+void Pooled_Descriptor::release() noexcept
+{
+    if (_row == nullptr)
+        return;
+    Descriptor_Pool::get_shared_pool().release(_row);
+    _row = nullptr;
+}
+
+} // namespace rgbd_slam::tracking
@@ -0,0 +1,132 @@
+#ifndef RGBDSLAM_TRACKING_DESCRIPTOR_POOL_HPP
+#define RGBDSLAM_TRACKING_DESCRIPTOR_POOL_HPP
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <opencv2/core.hpp>
+#include <vector>
+
+namespace rgbd_slam::tracking {
+
+/**
+ * \brief Storage of the map feature descriptors, packed in fixed size rows.
+ * Rows are allocated by blocks that are never moved, and released rows are reused before allocating new blocks.
+ * Each thread allocates and releases rows in its own cache, and only takes the pool lock to exchange a batch of rows
+ */
+class Descriptor_Pool
+{
+  public:
+    // BRIEF and ORB descriptors are 32 bytes long
+    static constexpr int descriptorSize = 32;
+    static constexpr size_t rowsPerBlock = 1024;
+    // rows moved at once between the pool and a thread cache
+    static constexpr size_t cacheBatchSize = 64;
+
+    /**
+     * \brief The pool shared by all map features
+     */
+    [[nodiscard]] static Descriptor_Pool& get_shared_pool() noexcept;
+
+    /**
+     * \brief Reserve a descriptor row
+     * \return A pointer to descriptorSize bytes, valid until released
+     */
+    [[nodiscard]] uchar* allocate() noexcept;
+
+    /**
+     * \brief Give back a row returned by allocate, to be reused
+     */
+    void release(uchar* row) noexcept;
+
+    /**
+     * \brief Allocate the blocks of at least rowCount rows, so the first allocations do not wait for a new block
+     */
+    void reserve(const size_t rowCount) noexcept;
+
+    [[nodiscard]] size_t get_used_row_count() const noexcept;
+    [[nodiscard]] size_t get_capacity() const noexcept;
+
+    /**
+     * \brief The bytes allocated by the descriptor blocks and the free row list
+     */
+    [[nodiscard]] size_t get_allocated_bytes() const noexcept;
+
+  private:
+    /**
+     * \brief The free rows kept by a thread. They go back to the pool when the thread exits
+     */
+    struct Thread_Cache
+    {
+        Thread_Cache() noexcept;
+        ~Thread_Cache();
+
+        std::vector<uchar*> _rows;
+    };
+
+    [[nodiscard]] static Thread_Cache& get_thread_cache() noexcept;
+
+    /**
+     * \brief Move a batch of free rows to a thread cache, allocating a new block if needed
+     */
+    void refill(std::vector<uchar*>& cachedRows) noexcept;
+
+    /**
+     * \brief Move the cached rows past keptCount back to the free rows
+     */
+    void drain(std::vector<uchar*>& cachedRows, const size_t keptCount) noexcept;
+
+    /**
+     * \brief Allocate a new block and add its rows to the free rows. Must be called under the lock
+     */
+    void add_block() noexcept;
+
+    std::vector<std::unique_ptr<uchar[]>> _blocks;
+    std::vector<uchar*> _freeRows;
+    // rows given by allocate and not released yet, wherever the free rows are cached
+    std::atomic<size_t> _usedRowCount = 0;
+
+    mutable std::mutex _mutex;
+};
+
+/**
+ * \brief A descriptor stored in a row of the shared descriptor pool.
+ * Copies use their own row, moves transfer it
+ */
+class Pooled_Descriptor
+{
+  public:
+    Pooled_Descriptor() = default;
+    /**
+     * \param[in] descriptor A descriptor of Descriptor_Pool::descriptorSize bytes, or an empty matrix
+     */
+    explicit Pooled_Descriptor(const cv::Mat& descriptor);
+    Pooled_Descriptor(const Pooled_Descriptor& other);
+    Pooled_Descriptor(Pooled_Descriptor&& other) noexcept;
+    Pooled_Descriptor& operator=(const Pooled_Descriptor& other) noexcept;
+    Pooled_Descriptor& operator=(Pooled_Descriptor&& other) noexcept;
+    ~Pooled_Descriptor();
+
+    /**
+     * \brief Copy a new descriptor in this row. Empty or wrongly sized descriptors are ignored
+     */
+    void set(const cv::Mat& descriptor) noexcept;
+
+    /**
+     * \brief Get a matrix header over the stored row, without copy.
+     * It stays valid until this object is modified or destroyed
+     */
+    [[nodiscard]] cv::Mat get() const noexcept;
+
+    [[nodiscard]] bool empty() const noexcept { return _row == nullptr; }
+
+  private:
+    void copy_row(const uchar* source) noexcept;
+    void release() noexcept;
+
+    uchar* _row = nullptr;
+};
+
+} // namespace rgbd_slam::tracking
+
+#endif
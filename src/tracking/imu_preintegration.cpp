@@ -0,0 +1,56 @@
+#include "imu_preintegration.hpp"
+#include "parameters.hpp"
+
+namespace rgbd_slam::tracking {
+
+void Imu_Preintegration::reset() noexcept
+{
+    _hasLastSample = false;
+    _lastSample = {0.0, vector3::Zero()};
+    restart();
+}
+
+void Imu_Preintegration::restart() noexcept
+{
+    _deltaRotation.setIdentity();
+    _deltaRotationCovariance.setZero();
+    _integratedDuration_s = 0.0;
+}
+
+void Imu_Preintegration::add_sample(const Imu_Sample& sample) noexcept
+{
+    if (not _hasLastSample)
+    {
+        _lastSample = sample;
+        _hasLastSample = true;
+        return;
+    }
+
+    const double deltaTime = sample._timestamp_s - _lastSample._timestamp_s;
+    if (deltaTime < 0.0)
+        return;
+
+    // rotation of the camera during this interval, with the angular velocity of the last sample
+    const vector3& rotationVector = _lastSample._angularVelocity * deltaTime;
+    const double angle = rotationVector.norm();
+    const quaternion incrementRotation =
+            angle > 0.0 ? quaternion(Eigen::AngleAxisd(angle, rotationVector / angle)) : quaternion::Identity();
+
+    _deltaRotation = (_deltaRotation * incrementRotation).normalized();
+
+    // move the covariance to the new camera coordinates, and add the random walk of the measured angle during this
+    // interval. The unmodeled bias is constant over the integration: its error grows with the integrated duration
+    // (isotropic, so not changed by the rotations)
+    constexpr double noiseDensity = parameters::imu::gyroscopeNoiseDensity;
+    constexpr double biasStandardDev = parameters::imu::gyroscopeBiasStandardDev;
+    const double newDuration = _integratedDuration_s + deltaTime;
+    const matrix33& incrementTranspose = incrementRotation.toRotationMatrix().transpose();
+    _deltaRotationCovariance = incrementTranspose * _deltaRotationCovariance * incrementTranspose.transpose();
+    _deltaRotationCovariance.diagonal().array() +=
+            SQR(noiseDensity) * deltaTime + SQR(biasStandardDev) * (SQR(newDuration) - SQR(_integratedDuration_s));
+
+    _integratedDuration_s = newDuration;
+    _lastSample = sample;
+}
+
+} // namespace rgbd_slam::tracking
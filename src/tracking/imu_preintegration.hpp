@@ -0,0 +1,71 @@
+#ifndef RGBDSLAM_TRACKING_IMUPREINTEGRATION_HPP
+#define RGBDSLAM_TRACKING_IMUPREINTEGRATION_HPP
+
+#include "types.hpp"
+
+namespace rgbd_slam::tracking {
+
+/**
+ * \brief A gyroscope measure, in the camera coordinates
+ */
+struct Imu_Sample
+{
+    double _timestamp_s;       // time of the measure, in seconds
+    vector3 _angularVelocity;  // rotation speed of the camera, in radians per second
+};
+
+/**
+ * \brief Integrates the gyroscope samples received between two frames, in a rotation of the camera and its
+ * uncertainty. The rotation is relative to the camera at the start of the integration
+ */
+class Imu_Preintegration
+{
+  public:
+    Imu_Preintegration() { reset(); }
+
+    /**
+     * \brief Forget all the samples
+     */
+    void reset() noexcept;
+
+    /**
+     * \brief Start a new integration from the last added sample: the time between this sample and the next one is
+     * integrated in the new integration
+     */
+    void restart() noexcept;
+
+    /**
+     * \brief Integrate a new sample. The angular velocity of the last sample is held until this one
+     * \param[in] sample The new gyroscope measure. Ignored if it is older than the last sample
+     */
+    void add_sample(const Imu_Sample& sample) noexcept;
+
+    /**
+     * \return true if some rotation was integrated since the last restart
+     */
+    [[nodiscard]] bool has_measurements() const noexcept { return _integratedDuration_s > 0.0; }
+
+    /**
+     * \return The rotation of the camera since the last restart: new camera to start camera
+     */
+    [[nodiscard]] const quaternion& get_delta_rotation() const noexcept { return _deltaRotation; }
+
+    /**
+     * \return The covariance of the rotation since the last restart, in radians², in the new camera coordinates
+     */
+    [[nodiscard]] const matrix33& get_delta_rotation_covariance() const noexcept { return _deltaRotationCovariance; }
+
+    [[nodiscard]] double get_integrated_duration() const noexcept { return _integratedDuration_s; }
+
+  private:
+    quaternion _deltaRotation;
+    matrix33 _deltaRotationCovariance;
+    double _integratedDuration_s;
+
+    bool _hasLastSample;
+    Imu_Sample _lastSample;
+};
+
+} // namespace rgbd_slam::tracking
+
+#endif
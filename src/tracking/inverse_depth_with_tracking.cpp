@@ -5,6 +5,7 @@
 #include "parameters.hpp"
 #include "types.hpp"
 #include "utils/covariances.hpp"
+#include <mutex>
 #include <stdexcept>
 
 namespace rgbd_slam::tracking {
@@ -32,29 +33,36 @@ PointInverseDepth::PointInverseDepth(const ScreenCoordinate2D& observation,
         throw std::invalid_argument("Inverse depth stateCovariance is invalid in constructor");
     }
 
-    _covariance.setZero();
-
     // new mesurment always as the same uncertainty in depth (and another one in position)
-    _covariance.block<3, 3>(firstPoseIndex, firstPoseIndex) = stateCovariance;
-
-    _covariance(inverseDepthIndex, inverseDepthIndex) =
-            SQR(parameters::detection::inverseDepthBaseline / 4.0); // inverse depth covariance
+    _covariance._firstPoseCovariance = stateCovariance;
 
+    constexpr double inverseDepthVariance = SQR(parameters::detection::inverseDepthBaseline / 4.0);
     constexpr double anglevariance =
             SQR(parameters::detection::inverseDepthAngleBaseline * EulerToRadian); // angle uncertainty
-    _covariance(thetaIndex, thetaIndex) = anglevariance;                           // theta angle covariance
-    _covariance(phiIndex, phiIndex) = anglevariance;                               // phi angle covariance
+    // inverse depth, theta and phi angles covariance
+    _covariance._sphericalCovariance = vector3(inverseDepthVariance, anglevariance, anglevariance).asDiagonal();
 
-    if (not utils::is_covariance_valid(_covariance))
+    if (not _covariance.is_valid())
         throw std::invalid_argument("PointInverseDepth constructor: the builded covariance is invalid");
 }
 
+PointInverseDepth::PointInverseDepth(const InverseDepthWorldPoint& coordinates,
+                                     const Covariance& covariance,
+                                     const cv::Mat& descriptor) :
+    _coordinates(coordinates),
+    _covariance(covariance),
+    _descriptor(descriptor)
+{
+    if (not _covariance.is_valid())
+        throw std::invalid_argument("PointInverseDepth constructor: the given covariance is invalid");
+}
+
 PointInverseDepth::PointInverseDepth(const PointInverseDepth& other) :
     _coordinates(other._coordinates),
     _covariance(other._covariance),
     _descriptor(other._descriptor)
 {
-    if (not utils::is_covariance_valid(_covariance))
+    if (not _covariance.is_valid())
         throw std::invalid_argument("PointInverseDepth constructor: the given covariance is invalid");
 }
 
@@ -66,7 +74,7 @@ bool PointInverseDepth::track(const ScreenCoordinate2D& screenObservation,
     try
     {
         // get observation in world space
-        const PointInverseDepth newObservation(screenObservation, c2w, stateCovariance, descriptor);
+        const PointInverseDepth newObservation(screenObservation, c2w, stateCovariance);
         // project to cartesian
         const WorldCoordinate& cartesianProj = newObservation._coordinates.to_world_coordinates();
         const WorldCoordinateCovariance& covarianceProj =
@@ -118,7 +126,7 @@ bool PointInverseDepth::update_with_cartesian(const WorldCoordinate& point,
         outputs::log_error("covariance: covariance is invalid");
         return false;
     }
-    if (not utils::is_covariance_valid(_covariance))
+    if (not _covariance.is_valid())
     {
         outputs::log_error("_covariance: covariance is invalid");
         exit(-1);
@@ -151,11 +159,11 @@ bool PointInverseDepth::update_with_cartesian(const WorldCoordinate& point,
                                                        _covariance.get_first_pose_covariance(),
                                                        fromCartesianJacobian);
 
-        if (not utils::is_covariance_valid(_covariance))
+        if (not _covariance.is_valid())
             throw std::invalid_argument("Inverse depth point covariance is invalid after merge");
 
         if (not descriptor.empty())
-            _descriptor = descriptor;
+            _descriptor.set(descriptor);
 
         return true;
     }
@@ -183,9 +191,9 @@ ScreenCoordinateCovariance PointInverseDepth::get_screen_coordinate_variance(con
 }
 
 WorldCoordinateCovariance PointInverseDepth::compute_cartesian_covariance(const InverseDepthWorldPoint& coordinates,
-                                                                          const matrix66& covariance)
+                                                                          const Covariance& covariance)
 {
-    if (not utils::is_covariance_valid(covariance))
+    if (not covariance.is_valid())
         throw std::invalid_argument("compute_cartesian_covariance cannot use incorrect covariance in covariance");
 
     Eigen::Matrix<double, 3, 6> jacobian;
@@ -194,13 +202,18 @@ WorldCoordinateCovariance PointInverseDepth::compute_cartesian_covariance(const
     return PointInverseDepth::compute_cartesian_covariance(covariance, jacobian);
 }
 
-WorldCoordinateCovariance PointInverseDepth::compute_cartesian_covariance(const matrix66& covariance,
+WorldCoordinateCovariance PointInverseDepth::compute_cartesian_covariance(const Covariance& covariance,
                                                                           const Eigen::Matrix<double, 3, 6>& jacobian)
 {
-    if (not utils::is_covariance_valid(covariance))
+    if (not covariance.is_valid())
         throw std::invalid_argument("compute_cartesian_covariance cannot use incorrect covariance in covariance");
 
-    WorldCoordinateCovariance worldCovariance(utils::propagate_covariance(covariance, jacobian));
+    // block diagonal covariance: the propagation is the sum of the propagations of the two blocks
+    WorldCoordinateCovariance worldCovariance;
+    worldCovariance << utils::propagate_covariance<3, 3>(covariance._firstPoseCovariance,
+                                                         jacobian.block<3, 3>(0, firstPoseIndex)) +
+                               utils::propagate_covariance<3, 3>(covariance._sphericalCovariance,
+                                                                 jacobian.block<3, 3>(0, Covariance::sphericalIndex));
     if (not utils::is_covariance_valid(worldCovariance))
         throw std::logic_error("compute_cartesian_covariance produced an invalid covariance");
     return worldCovariance;
@@ -218,9 +231,12 @@ PointInverseDepth::Covariance PointInverseDepth::compute_inverse_depth_covarianc
         throw std::invalid_argument(
                 "compute_inverse_depth_covariance cannot use incorrect covariance in firstPoseCovariance");
 
-    Covariance resCovariance = utils::propagate_covariance(pointCovariance, jacobian);
-    resCovariance.block<3, 3>(0, 0) = firstPoseCovariance;
-    if (not utils::is_covariance_valid(resCovariance))
+    // the first pose rows of the jacobian are zero: only the spherical block is propagated
+    Covariance resCovariance;
+    resCovariance._firstPoseCovariance = firstPoseCovariance;
+    resCovariance._sphericalCovariance =
+            utils::propagate_covariance<3, 3>(pointCovariance, jacobian.block<3, 3>(Covariance::sphericalIndex, 0));
+    if (not resCovariance.is_valid())
     {
         throw std::logic_error("compute_inverse_depth_covariance produced an invalid covariance");
     }
@@ -235,7 +251,7 @@ double PointInverseDepth::compute_linearity_score(const CameraToWorldMatrix& cam
 
     const vector3 hc(cartesian - cameraToWorld.translation());
     const double cosAlpha = static_cast<double>(_coordinates.get_bearing_vector().transpose() * hc) / hc.norm();
-    const double thetad_meters = (sqrt(_covariance.diagonal()(PointInverseDepth::inverseDepthIndex)) /
+    const double thetad_meters = (sqrt(_covariance.get_inverse_depth_variance()) /
                                   SQR(_coordinates.get_inverse_depth())) /
                                  1000.0;
     const double d1_meters = hc.norm() / 1000.0;
@@ -245,8 +261,9 @@ double PointInverseDepth::compute_linearity_score(const CameraToWorldMatrix& cam
 
 void PointInverseDepth::build_kalman_filter() noexcept
 {
-    if (_kalmanFilter == nullptr)
-    {
+    // the map updates run concurrently: build the shared filter once
+    static std::once_flag isBuilt;
+    std::call_once(isBuilt, []() {
         const matrix33 systemDynamics = matrix33::Identity(); // points are not supposed to move, so no dynamics
         const matrix33 outputMatrix = matrix33::Identity();   // we need all positions
 
@@ -256,7 +273,7 @@ void PointInverseDepth::build_kalman_filter() noexcept
 
         _kalmanFilter = std::make_unique<tracking::SharedKalmanFilter<3, 3>>(
                 systemDynamics, outputMatrix, processNoiseCovariance);
-    }
+    });
 }
 
 bool PointInverseDepth::to_screen_coordinates(const WorldToCameraMatrix& w2c,
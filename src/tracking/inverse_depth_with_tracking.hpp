@@ -21,18 +21,59 @@ struct PointInverseDepth
     static constexpr uint thetaIndex = InverseDepthWorldPoint::thetaIndex;
     static constexpr uint phiIndex = InverseDepthWorldPoint::phiIndex;
 
-    struct Covariance : public matrix66
+    /**
+     * \brief Covariance of the inverse depth state. The first observation pose is never correlated with the spherical
+     * coordinates (the cartesian to inverse depth Jacobian is zero for the pose), so the 6x6 covariance is block
+     * diagonal: only its two 3x3 blocks are stored, and the propagations work on the blocks
+     */
+    struct Covariance
     {
-        using matrix66::matrix66;
-        matrix33 get_first_pose_covariance() const { return block<3, 3>(firstPoseIndex, firstPoseIndex); }
-        double get_inverse_depth_variance() const { return diagonal()(inverseDepthIndex); };
-        double get_theta_variance() const { return diagonal()(thetaIndex); };
-        double get_phi_variance() const { return diagonal()(phiIndex); };
+        static constexpr uint sphericalIndex = inverseDepthIndex; // first index of the spherical coordinates
+
+        matrix33 _firstPoseCovariance;
+        matrix33 _sphericalCovariance; // inverse depth, theta and phi covariance
+
+        matrix33 get_first_pose_covariance() const { return _firstPoseCovariance; }
+        double get_inverse_depth_variance() const { return _sphericalCovariance(0, 0); };
+        double get_theta_variance() const { return _sphericalCovariance(1, 1); };
+        double get_phi_variance() const { return _sphericalCovariance(2, 2); };
+
+        /**
+         * \return The diagonal of the full covariance
+         */
+        [[nodiscard]] vector6 diagonal() const noexcept
+        {
+            vector6 diagonal;
+            diagonal << _firstPoseCovariance.diagonal(), _sphericalCovariance.diagonal();
+            return diagonal;
+        }
+
+        /**
+         * \return The full 6x6 covariance
+         */
+        [[nodiscard]] matrix66 to_matrix() const noexcept
+        {
+            matrix66 covariance = matrix66::Zero();
+            covariance.block<3, 3>(firstPoseIndex, firstPoseIndex) = _firstPoseCovariance;
+            covariance.block<3, 3>(sphericalIndex, sphericalIndex) = _sphericalCovariance;
+            return covariance;
+        }
+
+        /**
+         * \return True if the two blocks are valid covariances: so is the full covariance
+         */
+        [[nodiscard]] bool is_valid() const noexcept
+        {
+            return utils::is_covariance_valid(_firstPoseCovariance) and
+                   utils::is_covariance_valid(_sphericalCovariance);
+        }
     };
+    // the spherical block stores the inverse depth, theta and phi in this order
+    static_assert(firstPoseIndex == 0 and inverseDepthIndex == 3 and thetaIndex == 4 and phiIndex == 5);
 
     InverseDepthWorldPoint _coordinates;
     Covariance _covariance;
-    cv::Mat _descriptor;
+    Pooled_Descriptor _descriptor;
 
     PointInverseDepth(const ScreenCoordinate2D& observation,
                       const CameraToWorldMatrix& c2w,
@@ -42,9 +83,22 @@ struct PointInverseDepth
                       const matrix33& stateCovariance,
                       const cv::Mat& descriptor);
 
+    /**
+     * \brief Build a point from a saved state, restored from a map state file
+     * \param[in] coordinates The inverse depth coordinates of this point
+     * \param[in] covariance The covariance of those coordinates
+     * \param[in] descriptor The descriptor of this point
+     */
+    PointInverseDepth(const InverseDepthWorldPoint& coordinates,
+                      const Covariance& covariance,
+                      const cv::Mat& descriptor);
+
     PointInverseDepth(const PointInverseDepth& other);
 
-    [[nodiscard]] matrix33 get_covariance_of_observed_pose() const noexcept { return _covariance.block<3, 3>(0, 0); }
+    [[nodiscard]] matrix33 get_covariance_of_observed_pose() const noexcept
+    {
+        return _covariance.get_first_pose_covariance();
+    }
 
     /**
      * \brief Add an new measurment to the tracking
@@ -87,10 +141,10 @@ struct PointInverseDepth
      * \brief Compute th covariance of the cartesian projection of this inverse depth
      */
     [[nodiscard]] static WorldCoordinateCovariance compute_cartesian_covariance(
-            const InverseDepthWorldPoint& coordinates, const matrix66& covariance);
+            const InverseDepthWorldPoint& coordinates, const Covariance& covariance);
 
     [[nodiscard]] static WorldCoordinateCovariance compute_cartesian_covariance(
-            const matrix66& covariance, const Eigen::Matrix<double, 3, 6>& jacobian);
+            const Covariance& covariance, const Eigen::Matrix<double, 3, 6>& jacobian);
 
     /**
      * \brief Get the inverse depth covariance from the world point covariance
@@ -4,6 +4,7 @@
 #include "covariances.hpp"
 #include "distance_utils.hpp"
 #include "types.hpp"
+#include <Eigen/Cholesky>
 #include <Eigen/src/Core/Matrix.h>
 #include <stdexcept>
 
@@ -30,12 +31,15 @@ template<int N, int M> class SharedKalmanFilter
         _systemDynamics(systemDynamics),
         _outputMatrix(outputMatrix),
         _processNoiseCovariance(processNoiseCovariance),
-        _identity(Eigen::Matrix<double, N, N>::Identity())
+        _identity(Eigen::Matrix<double, N, N>::Identity()),
+        _isSystemDynamicsIdentity(systemDynamics == _identity),
+        _isOutputMatrixIdentity(is_identity(outputMatrix))
     {
     }
 
     /**
      * \brief Update the estimated state based on measured values. The time step is assumed to remain constant.
+     * Does not modify the filter: it can be shared by concurrent updates
      * \param[in] currentState The current system state
      * \param[in] stateNoiseCovariance The current state covariance
      * \param[in] newMeasurement new measurement
@@ -47,7 +51,7 @@ template<int N, int M> class SharedKalmanFilter
             const Eigen::Vector<double, N>& currentState,
             const Eigen::Matrix<double, N, N>& stateNoiseCovariance,
             const Eigen::Vector<double, M>& newMeasurement,
-            const Eigen::Matrix<double, M, M>& measurementNoiseCovariance)
+            const Eigen::Matrix<double, M, M>& measurementNoiseCovariance) const
     {
         // check parameters
         if (not utils::is_covariance_valid(stateNoiseCovariance))
@@ -61,32 +65,43 @@ template<int N, int M> class SharedKalmanFilter
                     "SharedKalmanFilter::get_new_state: measurementNoiseCovariance is an invalid covariance matrix");
         }
 
-        // Get new raw estimate
-        const Eigen::Vector<double, N>& newStateEstimate = _systemDynamics * currentState;
-        const Eigen::Matrix<double, N, N>& estimateErrorCovariance =
-                utils::propagate_covariance(stateNoiseCovariance, _systemDynamics) + _processNoiseCovariance;
+        // Get new raw estimate (the map features have no dynamics: skip the identity products)
+        Eigen::Vector<double, N> newStateEstimate = currentState;
+        Eigen::Matrix<double, N, N> estimateErrorCovariance = stateNoiseCovariance + _processNoiseCovariance;
+        if (not _isSystemDynamicsIdentity)
+        {
+            newStateEstimate = _systemDynamics * currentState;
+            estimateErrorCovariance =
+                    utils::propagate_covariance(stateNoiseCovariance, _systemDynamics) + _processNoiseCovariance;
+        }
 
-        // compute inovation covariance
-        const Eigen::Matrix<double, M, M>& inovation =
-                utils::propagate_covariance(estimateErrorCovariance, _outputMatrix) + measurementNoiseCovariance;
-        // cannot inverse the inovation covariance matrix: use pseudoinverse.
-        // it is slower but mathematicaly stable
-        Eigen::Matrix<double, M, M> inovationInverted;
-        if (utils::double_equal(inovation.determinant(), 0))
-            inovationInverted = inovation.completeOrthogonalDecomposition().pseudoInverse();
-        else
-            inovationInverted = inovation.inverse();
+        // compute inovation covariance, and the output of the estimated covariance (H * P)
+        Eigen::Matrix<double, M, M> inovation = measurementNoiseCovariance;
+        Eigen::Matrix<double, M, N> outputCovariance = Eigen::Matrix<double, M, N>::Zero();
+        Eigen::Vector<double, M> residual = newMeasurement;
+        if constexpr (N == M)
+        {
+            if (_isOutputMatrixIdentity)
+            {
+                inovation += estimateErrorCovariance;
+                outputCovariance = estimateErrorCovariance;
+                residual -= newStateEstimate;
+            }
+        }
+        if (not _isOutputMatrixIdentity)
+        {
+            inovation += utils::propagate_covariance(estimateErrorCovariance, _outputMatrix);
+            outputCovariance = _outputMatrix * estimateErrorCovariance.template selfadjointView<Eigen::Lower>();
+            residual -= _outputMatrix * newStateEstimate;
+        }
 
-        // compute Kalman gain
-        const Eigen::Matrix<double, N, M>& kalmanGain =
-                (estimateErrorCovariance.template selfadjointView<Eigen::Lower>()) * _outputMatrix.transpose() *
-                inovationInverted;
+        // compute Kalman gain: P * H^t * S^-1, with P symmetric so (H * P)^t = P * H^t
+        const Eigen::Matrix<double, N, M>& kalmanGain = get_kalman_gain(inovation, outputCovariance);
 
-        const Eigen::Vector<double, N>& newState =
-                newStateEstimate + kalmanGain * (newMeasurement - _outputMatrix * newStateEstimate);
+        const Eigen::Vector<double, N>& newState = newStateEstimate + kalmanGain * residual;
 
-        Eigen::Matrix<double, N, N> newCovariance = (_identity - kalmanGain * _outputMatrix) *
-                                                    (estimateErrorCovariance.template selfadjointView<Eigen::Lower>());
+        // (I - K * H) * P = P - K * (H * P)
+        Eigen::Matrix<double, N, N> newCovariance = estimateErrorCovariance - kalmanGain * outputCovariance;
         // force symetrie for covariance
         newCovariance = newCovariance.template selfadjointView<Eigen::Lower>();
 
@@ -105,6 +120,68 @@ template<int N, int M> class SharedKalmanFilter
         return std::make_pair(newState, newCovariance);
     }
 
+  protected:
+    /**
+     * \return True if this output matrix is an identity: only possible when there are as many states as outputs
+     */
+    [[nodiscard]] static bool is_identity([[maybe_unused]] const Eigen::Matrix<double, M, N>& outputMatrix) noexcept
+    {
+        if constexpr (N == M)
+            return outputMatrix == Eigen::Matrix<double, N, N>::Identity();
+        else
+            return false;
+    }
+
+    /**
+     * \brief Compute the Kalman gain S^-1 applied to (H * P)^t. The inovation covariance S is symmetric positive
+     * definite when the measurement covariance is: its inverse is closed form for 1 and 3 outputs, a Cholesky
+     * solve else. The singular inovations fall back to the pseudo inverse
+     * \param[in] inovation The inovation covariance S
+     * \param[in] outputCovariance The output of the estimated covariance H * P
+     * \return The Kalman gain
+     */
+    [[nodiscard]] static Eigen::Matrix<double, N, M> get_kalman_gain(
+            const Eigen::Matrix<double, M, M>& inovation, const Eigen::Matrix<double, M, N>& outputCovariance)
+    {
+        if constexpr (M == 1)
+        {
+            if (not utils::double_equal(inovation(0, 0), 0))
+                return outputCovariance.transpose() / inovation(0, 0);
+        }
+        else if constexpr (M == 3)
+        {
+            // cofactors of the symmetric inovation: the inverse is symmetric too
+            const double c00 = inovation(1, 1) * inovation(2, 2) - inovation(2, 1) * inovation(2, 1);
+            const double c10 = inovation(2, 0) * inovation(2, 1) - inovation(1, 0) * inovation(2, 2);
+            const double c20 = inovation(1, 0) * inovation(2, 1) - inovation(2, 0) * inovation(1, 1);
+            const double determinant = inovation(0, 0) * c00 + inovation(1, 0) * c10 + inovation(2, 0) * c20;
+            if (not utils::double_equal(determinant, 0))
+            {
+                const double c11 = inovation(0, 0) * inovation(2, 2) - inovation(2, 0) * inovation(2, 0);
+                const double c21 = inovation(1, 0) * inovation(2, 0) - inovation(0, 0) * inovation(2, 1);
+                const double c22 = inovation(0, 0) * inovation(1, 1) - inovation(1, 0) * inovation(1, 0);
+                Eigen::Matrix<double, 3, 3> inovationInverted;
+                inovationInverted << c00, c10, c20, c10, c11, c21, c20, c21, c22;
+                return outputCovariance.transpose() * (inovationInverted / determinant);
+            }
+        }
+        else
+        {
+            const Eigen::LLT<Eigen::Matrix<double, M, M>> cholesky(inovation);
+            // determinant of S is the squared product of the diagonal of its Cholesky factor
+            if (cholesky.info() == Eigen::Success and
+                not utils::double_equal(cholesky.matrixLLT().diagonal().prod(), 0))
+            {
+                return cholesky.solve(outputCovariance).transpose();
+            }
+        }
+
+        // cannot inverse the inovation covariance matrix: use pseudoinverse.
+        // it is slower but mathematicaly stable
+        return outputCovariance.transpose() * inovation.completeOrthogonalDecomposition().pseudoInverse();
+    }
+
+  public:
     // Matrices for computation
     Eigen::Matrix<double, N, N> _systemDynamics;
     const Eigen::Matrix<double, M, N> _outputMatrix;
@@ -112,6 +189,10 @@ template<int N, int M> class SharedKalmanFilter
 
     // stateDimension-size identity
     const Eigen::Matrix<double, N, N> _identity;
+
+    // the products with identity matrices are skipped
+    bool _isSystemDynamicsIdentity;
+    const bool _isOutputMatrixIdentity;
 };
 
 /**
@@ -179,6 +260,7 @@ template<int N, int M> class KalmanFilter : public SharedKalmanFilter<N, M>
                 const Eigen::Matrix<double, N, N>& systemDynamics)
     {
         this->_systemDynamics = systemDynamics;
+        this->_isSystemDynamicsIdentity = systemDynamics == this->_identity;
         this->update(newMeasurement, measurementNoiseCovariance);
     }
 
@@ -0,0 +1,96 @@
+#include "keyframe_selector.hpp"
+#include "logger.hpp"
+#include "parameters.hpp"
+#include <Eigen/Cholesky>
+#include <format>
+
+namespace rgbd_slam::tracking {
+
+bool Keyframe_Selector::is_keyframe(const utils::Pose& pose,
+                                    const matches_containers::match_container& inliers) noexcept
+{
+    static constexpr uint maximumFrameGap = parameters::mapping::keyframe::maximumFrameGap;
+    static constexpr double minimumTranslation = parameters::mapping::keyframe::minimumTranslation_mm;
+    static constexpr double minimumRotation = parameters::mapping::keyframe::minimumRotation_d;
+    static constexpr double minimumMatchOverlap = parameters::mapping::keyframe::minimumMatchOverlap;
+    static constexpr double translationUncertaintyFactor =
+            parameters::mapping::keyframe::translationUncertaintyFactor;
+
+    ++_frameCount;
+    bool isKeyframe = not _hasKeyframe or (++_framesSinceKeyframe >= maximumFrameGap);
+    if (not isKeyframe)
+    {
+        // rotations change the observed area, even if the camera does not move
+        isKeyframe = pose.get_rotation_error(_keyframePose) >= minimumRotation;
+    }
+    if (not isKeyframe)
+    {
+        // a translation under the pose uncertainty is tracking noise: an idle camera creates no keyframes
+        const vector3& translation = pose.get_position() - _keyframePose.get_position();
+        if (translation.norm() >= minimumTranslation)
+        {
+            const Eigen::LDLT<matrix33> positionVariance(pose.get_position_variance());
+            const double squaredMahalanobisDistance = translation.dot(positionVariance.solve(translation));
+            isKeyframe = positionVariance.info() != Eigen::Success or not std::isfinite(squaredMahalanobisDistance) or
+                         squaredMahalanobisDistance >= SQR(translationUncertaintyFactor);
+        }
+    }
+    if (not isKeyframe)
+    {
+        // the map features of the last keyframe are leaving the view: the map needs new features
+        isKeyframe = get_match_overlap(inliers) < minimumMatchOverlap;
+    }
+
+    if (isKeyframe)
+        set_keyframe(pose, inliers);
+    return isKeyframe;
+}
+
+void Keyframe_Selector::reset() noexcept
+{
+    _hasKeyframe = false;
+    _keyframeMapIds.clear();
+    _framesSinceKeyframe = 0;
+}
+
+void Keyframe_Selector::show_statistics() const noexcept
+{
+    if (_frameCount > 0)
+    {
+        outputs::log(std::format("Keyframes: {} of {} tracked frames ({:.2f}%) updated the map",
+                                 _keyframeCount,
+                                 _frameCount,
+                                 static_cast<double>(_keyframeCount) / static_cast<double>(_frameCount) * 100.0));
+    }
+}
+
+double Keyframe_Selector::get_match_overlap(const matches_containers::match_container& inliers) const noexcept
+{
+    if (_keyframeMapIds.empty())
+        return 1.0;
+
+    size_t stillMatchedCount = 0;
+    for (const auto& match: inliers)
+    {
+        if (_keyframeMapIds.contains(match->_idInMap))
+            ++stillMatchedCount;
+    }
+    return static_cast<double>(stillMatchedCount) / static_cast<double>(_keyframeMapIds.size());
+}
+
+void Keyframe_Selector::set_keyframe(const utils::Pose& pose,
+                                     const matches_containers::match_container& inliers) noexcept
+{
+    _hasKeyframe = true;
+    _keyframePose = pose;
+    _framesSinceKeyframe = 0;
+    ++_keyframeCount;
+
+    _keyframeMapIds.clear();
+    for (const auto& match: inliers)
+    {
+        _keyframeMapIds.emplace(match->_idInMap);
+    }
+}
+
+} // namespace rgbd_slam::tracking
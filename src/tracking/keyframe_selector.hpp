@@ -0,0 +1,63 @@
+#ifndef RGBDSLAM_TRACKING_KEYFRAMESELECTOR_HPP
+#define RGBDSLAM_TRACKING_KEYFRAMESELECTOR_HPP
+
+#include "matches_containers.hpp"
+#include "types.hpp"
+#include "utils/pose.hpp"
+
+#include <unordered_set>
+
+namespace rgbd_slam::tracking {
+
+/**
+ * \brief Keyframe policy: decides which tracked frames update the map.
+ * A frame is a keyframe when the camera moved away from the last keyframe by more than the pose uncertainty, when
+ * the map features matched by the last keyframe are no longer matched, or when too many frames were tracked since the
+ * last keyframe. The other frames are only used for the tracking
+ */
+class Keyframe_Selector
+{
+  public:
+    /**
+     * \brief Decide if a tracked frame is a keyframe. The next decisions are relative to the last keyframe
+     * \param[in] pose The optimized pose of this frame
+     * \param[in] inliers The inlier matches of the pose optimization of this frame
+     * \return true if this frame should update the map
+     */
+    [[nodiscard]] bool is_keyframe(const utils::Pose& pose, const matches_containers::match_container& inliers) noexcept;
+
+    /**
+     * \brief Forget the last keyframe: the next tracked frame will be a keyframe
+     */
+    void reset() noexcept;
+
+    /**
+     * \brief Show the proportion of tracked frames selected as keyframes
+     */
+    void show_statistics() const noexcept;
+
+  private:
+    /**
+     * \brief Compute the proportion of the map features matched by the last keyframe that are still matched
+     * \param[in] inliers The inlier matches of the current frame
+     */
+    [[nodiscard]] double get_match_overlap(const matches_containers::match_container& inliers) const noexcept;
+
+    /**
+     * \brief Set the given frame as the last keyframe
+     */
+    void set_keyframe(const utils::Pose& pose, const matches_containers::match_container& inliers) noexcept;
+
+    bool _hasKeyframe = false;
+    utils::PoseBase _keyframePose;
+    std::unordered_set<size_t> _keyframeMapIds; // ids of the map features matched by the last keyframe
+    uint _framesSinceKeyframe = 0;
+
+    // perf measurments
+    uint _frameCount = 0;
+    uint _keyframeCount = 0;
+};
+
+} // namespace rgbd_slam::tracking
+
+#endif
@@ -0,0 +1,84 @@
+#include "load_controller.hpp"
+#include "logger.hpp"
+#include "parameters.hpp"
+#include <format>
+#include <numeric>
+
+namespace rgbd_slam::tracking {
+
+std::string_view get_level_name(const Load_Shedding_Level level) noexcept
+{
+    switch (level)
+    {
+        case Load_Shedding_Level::Full:
+            return "full quality";
+        case Load_Shedding_Level::NoPlaneDetection:
+            return "no plane detection";
+        case Load_Shedding_Level::ReducedCovariance:
+            return "reduced pose covariance";
+        case Load_Shedding_Level::CappedMatches:
+            return "capped RANSAC matches";
+        case Load_Shedding_Level::ReducedKeypoints:
+            return "reduced keypoint budget";
+        default:
+            return "unknown";
+    }
+}
+
+void Load_Controller::update(const double frameDuration, const Load_Shedding_Level usedLevel) noexcept
+{
+    static constexpr double recoveryDurationRatio = parameters::loadShedding::recoveryDurationRatio;
+    static constexpr uint recoveryFrameCount = parameters::loadShedding::recoveryFrameCount;
+    static constexpr auto maximumLevel = static_cast<uint8_t>(loadSheddingLevelCount - 1);
+
+    ++_levelFrameCount[static_cast<size_t>(usedLevel)];
+    if (not parameters::loadShedding::isEnabled or frameDuration <= 0)
+        return;
+
+    // tunable at runtime: read it once for this update
+    const double frameDeadline = Parameters::get_frame_deadline();
+    const auto level = static_cast<uint8_t>(_level.load());
+    if (frameDuration > frameDeadline)
+    {
+        // react to a single slow frame: the deadline is a bound, not a mean
+        _framesUnderDeadline = 0;
+        if (level < maximumLevel)
+            _level.store(static_cast<Load_Shedding_Level>(level + 1));
+    }
+    else if (frameDuration < frameDeadline * recoveryDurationRatio)
+    {
+        // only go back to a better quality when the frames are consistently fast, to not oscillate
+        if (level > 0 and ++_framesUnderDeadline >= recoveryFrameCount)
+        {
+            _framesUnderDeadline = 0;
+            _level.store(static_cast<Load_Shedding_Level>(level - 1));
+        }
+    }
+    else
+        _framesUnderDeadline = 0;
+}
+
+void Load_Controller::reset() noexcept
+{
+    _level.store(Load_Shedding_Level::Full);
+    _framesUnderDeadline = 0;
+}
+
+void Load_Controller::show_statistics() const noexcept
+{
+    const uint frameCount = std::accumulate(_levelFrameCount.cbegin(), _levelFrameCount.cend(), 0u);
+    if (frameCount == 0 or _levelFrameCount[static_cast<size_t>(Load_Shedding_Level::Full)] == frameCount)
+        return;
+
+    for (size_t levelIndex = 1; levelIndex < loadSheddingLevelCount; ++levelIndex)
+    {
+        if (_levelFrameCount[levelIndex] == 0)
+            continue;
+        outputs::log(std::format("Load shedding: {} frames ({:.2f}%) tracked with {}",
+                                 _levelFrameCount[levelIndex],
+                                 static_cast<double>(_levelFrameCount[levelIndex]) / frameCount * 100.0,
+                                 get_level_name(static_cast<Load_Shedding_Level>(levelIndex))));
+    }
+}
+
+} // namespace rgbd_slam::tracking
@@ -0,0 +1,70 @@
+#ifndef RGBDSLAM_TRACKING_LOADCONTROLLER_HPP
+#define RGBDSLAM_TRACKING_LOADCONTROLLER_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace rgbd_slam::tracking {
+
+/**
+ * \brief The quality steps of the tracking of an overloaded system. Each level also applies the reductions of the
+ * levels before it
+ */
+enum class Load_Shedding_Level : uint8_t
+{
+    Full,              // every stage at full quality
+    NoPlaneDetection,  // skip the plane (and line) detection
+    ReducedCovariance, // fewer iterations of the Monte Carlo pose variance
+    CappedMatches,     // only the best matches feed the RANSAC
+    ReducedKeypoints,  // keypoint budget at its minimum
+
+    Count
+};
+inline constexpr size_t loadSheddingLevelCount = static_cast<size_t>(Load_Shedding_Level::Count);
+
+[[nodiscard]] std::string_view get_level_name(const Load_Shedding_Level level) noexcept;
+
+/**
+ * \brief Overload controller of the tracking: degrades the frame quality in steps to hold a frame deadline.
+ * A frame slower than the deadline raises the level by one step, and the level goes down one step after a number of
+ * consecutive frames well under the deadline. The level can be read from any thread
+ */
+class Load_Controller
+{
+  public:
+    /**
+     * \return The level to use for the next frame
+     */
+    [[nodiscard]] Load_Shedding_Level get_level() const noexcept { return _level.load(); }
+
+    /**
+     * \brief Decide the level of the next frames from the duration of a tracked frame
+     * \param[in] frameDuration The treatment duration of this frame, in seconds
+     * \param[in] usedLevel The level this frame was tracked with
+     */
+    void update(const double frameDuration, const Load_Shedding_Level usedLevel) noexcept;
+
+    /**
+     * \brief Go back to the full quality
+     */
+    void reset() noexcept;
+
+    /**
+     * \brief Show the proportion of frames tracked at each level
+     */
+    void show_statistics() const noexcept;
+
+  private:
+    std::atomic<Load_Shedding_Level> _level = Load_Shedding_Level::Full;
+    uint _framesUnderDeadline = 0; // consecutive frames fast enough to go down one level
+
+    // perf measurments
+    std::array<uint, loadSheddingLevelCount> _levelFrameCount {};
+};
+
+} // namespace rgbd_slam::tracking
+
+#endif
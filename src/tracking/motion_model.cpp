@@ -1,4 +1,7 @@
 #include "motion_model.hpp"
+#include "parameters.hpp"
+#include <algorithm>
+#include <cmath>
 
 namespace rgbd_slam::tracking {
 
@@ -13,6 +16,7 @@ void Motion_Model::reset() noexcept
     _linearVelocity.setZero();
 
     _isLastPositionSet = false;
+    _matchSearchRadius = parameters::matching::matchSearchRadius_px;
 }
 
 void Motion_Model::reset(const vector3& lastPosition, const quaternion& lastRotation) noexcept
@@ -24,6 +28,19 @@ void Motion_Model::reset(const vector3& lastPosition, const quaternion& lastRota
     _linearVelocity.setZero();
 
     _isLastPositionSet = true;
+    _matchSearchRadius = parameters::matching::matchSearchRadius_px;
+}
+
+void Motion_Model::set_state(const State& state) noexcept
+{
+    _lastQ = state.lastRotation.normalized();
+    _angularVelocity = state.angularVelocity.normalized();
+
+    _lastPosition = state.lastPosition;
+    _linearVelocity = state.linearVelocity;
+
+    _isLastPositionSet = state.isLastPositionSet;
+    _matchSearchRadius = state.matchSearchRadius;
 }
 
 utils::Pose Motion_Model::predict_next_pose(const utils::Pose& currentPose, const bool shouldIncreaseVariance) noexcept
@@ -31,6 +48,9 @@ utils::Pose Motion_Model::predict_next_pose(const utils::Pose& currentPose, cons
     const vector3& currentPosition = currentPose.get_position();
     const quaternion& currentRotation = currentPose.get_orientation_quaternion();
 
+    // the constant velocity is not known well enough to shrink the search windows
+    _matchSearchRadius = parameters::matching::matchSearchRadius_px;
+
     // last not set
     if (!_isLastPositionSet)
     {
@@ -70,4 +90,42 @@ utils::Pose Motion_Model::predict_next_pose(const utils::Pose& currentPose, cons
     return utils::Pose(integralPos, integralQ, currentPose.get_pose_variance() + poseError);
 }
 
+utils::Pose Motion_Model::predict_next_pose(const utils::Pose& currentPose,
+                                            const Imu_Preintegration& imuPreintegration) noexcept
+{
+    const vector3& currentPosition = currentPose.get_position();
+    const quaternion& currentRotation = currentPose.get_orientation_quaternion();
+
+    // the constant velocity model restarts from this pose if the gyroscope samples stop
+    reset(currentPosition, currentRotation);
+
+    // the measured rotation is in the camera coordinates
+    const quaternion& predictedRotation = (currentRotation * imuPreintegration.get_delta_rotation()).normalized();
+    const matrix33& predictedRotationMatrix = predictedRotation.toRotationMatrix();
+
+    // add the uncertainty of the prediction (mm, radians), the rotation one in world coordinates
+    constexpr double translationStandardDev = parameters::imu::predictionTranslationStandardDev_mm;
+    const matrix33& rotationCovariance = imuPreintegration.get_delta_rotation_covariance();
+    matrix66 poseError = matrix66::Zero();
+    poseError.diagonal().head<3>().setConstant(SQR(translationStandardDev));
+    poseError.block<3, 3>(3, 3) = predictedRotationMatrix * rotationCovariance * predictedRotationMatrix.transpose();
+
+    _matchSearchRadius = compute_match_search_radius(translationStandardDev, rotationCovariance);
+    return utils::Pose(currentPosition, predictedRotation, currentPose.get_pose_variance() + poseError);
+}
+
+double Motion_Model::compute_match_search_radius(const double translationStandardDev,
+                                                 const matrix33& rotationCovariance) noexcept
+{
+    // a small rotation moves the projections by about focal * angle, a translation by focal * translation / depth
+    const double focal = Parameters::get_camera_1_focal().maxCoeff();
+    const double rotationStandardDev = std::sqrt(rotationCovariance.diagonal().maxCoeff());
+    const double reprojectionStandardDev =
+            focal * (rotationStandardDev + translationStandardDev / parameters::matching::matchSearchReferenceDepth_mm);
+
+    return std::clamp(parameters::matching::matchSearchRadiusSigmaFactor * reprojectionStandardDev,
+                      parameters::matching::minimumMatchSearchRadius_px,
+                      parameters::matching::matchSearchRadius_px);
+}
+
 } // namespace rgbd_slam::tracking
@@ -1,6 +1,7 @@
 #ifndef RGBDSLAM_UTILS_MOTIONMODEL_HPP
 #define RGBDSLAM_UTILS_MOTIONMODEL_HPP
 
+#include "imu_preintegration.hpp"
 #include "types.hpp"
 #include "utils/pose.hpp"
 
@@ -12,6 +13,19 @@ namespace rgbd_slam::tracking {
 class Motion_Model
 {
   public:
+    /**
+     * \brief The internal state of the motion model, to save it and restore it in another session
+     */
+    struct State
+    {
+        quaternion lastRotation;
+        quaternion angularVelocity;
+        vector3 lastPosition;
+        vector3 linearVelocity;
+        bool isLastPositionSet;
+        double matchSearchRadius;
+    };
+
     Motion_Model();
     void reset() noexcept;
     void reset(const vector3& lastPosition, const quaternion& lastRotation) noexcept;
@@ -24,9 +38,30 @@ class Motion_Model
     [[nodiscard]] utils::Pose predict_next_pose(const utils::Pose& currentPose,
                                                 const bool shouldIncreaseVariance = true) noexcept;
 
+    /**
+     * \brief Predicts next pose with the rotation measured by a gyroscope since the last frame. The position is not
+     * measured: it stays the same, with an added uncertainty
+     * \param[in] currentPose Last frame pose
+     * \param[in] imuPreintegration The gyroscope samples integrated since the last frame, in camera coordinates
+     */
+    [[nodiscard]] utils::Pose predict_next_pose(const utils::Pose& currentPose,
+                                                const Imu_Preintegration& imuPreintegration) noexcept;
+
+    /**
+     * \brief Radius of the search window of the point matches around their projection with the last predicted pose.
+     * Small when the prediction was measured, parameters::matching::matchSearchRadius_px otherwise
+     */
+    [[nodiscard]] double get_match_search_radius() const noexcept { return _matchSearchRadius; };
+
     vector3 get_position_velocity() const noexcept { return _linearVelocity; };
     quaternion get_angular_velocity() const noexcept { return _angularVelocity; };
 
+    [[nodiscard]] State get_state() const noexcept
+    {
+        return {_lastQ, _angularVelocity, _lastPosition, _linearVelocity, _isLastPositionSet, _matchSearchRadius};
+    }
+    void set_state(const State& state) noexcept;
+
   protected:
     [[nodiscard]] quaternion get_rotational_velocity(const quaternion& lastRotation,
                                                      const quaternion& lastVelocity,
@@ -35,6 +70,14 @@ class Motion_Model
                                                 const vector3& lastVelocity,
                                                 const vector3& currentPosition) const noexcept;
 
+    /**
+     * \brief Compute the radius of the search window that covers the reprojection uncertainty of a predicted pose
+     * \param[in] translationStandardDev The standard deviation of the predicted camera position, in millimeters
+     * \param[in] rotationCovariance The covariance of the predicted camera rotation, in radians²
+     */
+    [[nodiscard]] static double compute_match_search_radius(const double translationStandardDev,
+                                                            const matrix33& rotationCovariance) noexcept;
+
   private:
     // Last known rotation quaternion estimated by the motion model (set by update_model)
     quaternion _lastQ;
@@ -46,6 +89,8 @@ class Motion_Model
     vector3 _linearVelocity;
 
     bool _isLastPositionSet = false;
+    // search radius of the matches with the last prediction
+    double _matchSearchRadius;
 };
 
 } // namespace rgbd_slam::tracking
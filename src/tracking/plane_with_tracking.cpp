@@ -1,4 +1,5 @@
 #include "plane_with_tracking.hpp"
+#include <mutex>
 
 namespace rgbd_slam::tracking {
 
@@ -80,8 +81,9 @@ bool Plane::update_boundary_polygon(const CameraToWorldMatrix& cameraToWorld,
 
 void Plane::build_kalman_filter() noexcept
 {
-    if (_kalmanFilter == nullptr)
-    {
+    // the map updates run concurrently: build the shared filter once
+    static std::once_flag isBuilt;
+    std::call_once(isBuilt, []() {
         const matrix44 systemDynamics = matrix44::Identity(); // planes are not supposed to move, so no dynamics
         const matrix44 outputMatrix = matrix44::Identity();   // we need all positions
 
@@ -91,7 +93,7 @@ void Plane::build_kalman_filter() noexcept
 
         _kalmanFilter = std::make_unique<tracking::SharedKalmanFilter<4, 4>>(
                 systemDynamics, outputMatrix, processNoiseCovariance);
-    }
+    });
 }
 
 } // namespace rgbd_slam::tracking
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "logger.hpp"
 #include "types.hpp"
 #include "utils/covariances.hpp"
+#include <mutex>
 #include <stdexcept>
 
 namespace rgbd_slam::tracking {
@@ -18,16 +19,31 @@ Point::Point(const WorldCoordinate& coordinates,
     _coordinates(coordinates),
     _descriptor(descriptor),
     _covariance(covariance)
+{
+    check_construction();
+};
+
+Point::Point(const WorldCoordinate& coordinates,
+             const WorldCoordinateCovariance& covariance,
+             Pooled_Descriptor&& descriptor) :
+    _coordinates(coordinates),
+    _descriptor(std::move(descriptor)),
+    _covariance(covariance)
+{
+    check_construction();
+};
+
+void Point::check_construction() const
 {
     build_kalman_filter();
 
-    if (_descriptor.empty() or _descriptor.cols <= 0)
+    if (_descriptor.empty())
         throw std::invalid_argument("Point constructor: descriptor is empty");
     if (_coordinates.hasNaN())
         throw std::invalid_argument("Point constructor: point coordinates contains NaN");
     if (not utils::is_covariance_valid(_covariance))
         throw std::invalid_argument("Point constructor: covariance in invalid");
-};
+}
 
 double Point::track(const WorldCoordinate& newDetectionCoordinates, const matrix33& newDetectionCovariance) noexcept
 {
@@ -68,8 +84,9 @@ double Point::track(const WorldCoordinate& newDetectionCoordinates, const matrix
 
 void Point::build_kalman_filter() noexcept
 {
-    if (_kalmanFilter == nullptr)
-    {
+    // the map updates run concurrently: build the shared filter once
+    static std::once_flag isBuilt;
+    std::call_once(isBuilt, []() {
         const matrix33 systemDynamics = matrix33::Identity(); // points are not supposed to move, so no dynamics
         const matrix33 outputMatrix = matrix33::Identity();   // we need all positions
 
@@ -79,7 +96,7 @@ void Point::build_kalman_filter() noexcept
 
         _kalmanFilter = std::make_unique<tracking::SharedKalmanFilter<3, 3>>(
                 systemDynamics, outputMatrix, processNoiseCovariance);
-    }
+    });
 }
 
 } // namespace rgbd_slam::tracking
\ No newline at end of file
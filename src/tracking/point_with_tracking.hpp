@@ -3,6 +3,7 @@
 
 #include "types.hpp"
 #include "coordinates/point_coordinates.hpp"
+#include "descriptor_pool.hpp"
 #include "kalman_filter.hpp"
 
 #include <opencv2/opencv.hpp>
@@ -16,12 +17,16 @@ struct Point
 {
     // world coordinates
     WorldCoordinate _coordinates;
-    // 3D descriptor (ORB)
-    cv::Mat _descriptor;
+    // 3D descriptor (ORB), stored in the shared descriptor pool
+    Pooled_Descriptor _descriptor;
     // position covariance
     WorldCoordinateCovariance _covariance;
 
     Point(const WorldCoordinate& coordinates, const WorldCoordinateCovariance& covariance, const cv::Mat& descriptor);
+    // takes the pooled descriptor row of another feature, without copy
+    Point(const WorldCoordinate& coordinates,
+          const WorldCoordinateCovariance& covariance,
+          Pooled_Descriptor&& descriptor);
 
     /**
      * \brief update this point coordinates using a new detection
@@ -34,6 +39,12 @@ struct Point
     [[nodiscard]] bool is_moving() const noexcept { return _isMoving; }
 
   private:
+    /**
+     * \brief Check the values of a new point
+     * \throw std::invalid_argument if the point is not valid
+     */
+    void check_construction() const;
+
     /**
      * \brief Build the caracteristics of the kalman filter
      */
@@ -27,6 +27,7 @@ using matrix33 = Eigen::Matrix3d;
 using matrix34 = Eigen::Matrix<double, 3, 4>;
 using matrix43 = Eigen::Matrix<double, 4, 3>;
 using matrix44 = Eigen::Matrix4d;
+using matrix3X = Eigen::Matrix<double, 3, Eigen::Dynamic>;
 using quaternion = Eigen::Quaternion<double>;
 
 using vector6 = Eigen::Matrix<double, 6, 1>;
@@ -35,6 +36,15 @@ using vector7 = Eigen::Matrix<double, 7, 1>;
 using matrix66 = Eigen::Matrix<double, 6, 6>;
 using matrix77 = Eigen::Matrix<double, 7, 7>;
 
+// scalar of the hot paths that do not need a double precision (batch projections of the map to screen space). The
+// poses, the covariances and the optimization normal equations always stay in double
+#ifdef USE_FLOAT_HOT_PATHS
+using hotScalar = float;
+#else
+using hotScalar = double;
+#endif
+using arrayxh = Eigen::Array<hotScalar, Eigen::Dynamic, 1>;
+
 struct ScreenCoordinate2DCovariance : public matrix22
 {
 };
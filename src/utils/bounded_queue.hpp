@@ -0,0 +1,170 @@
+#ifndef RGBDSLAM_UTILS_BOUNDED_QUEUE_HPP
+#define RGBDSLAM_UTILS_BOUNDED_QUEUE_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+namespace rgbd_slam::utils {
+
+/**
+ * \brief A thread safe FIFO queue with a fixed capacity.
+ * Producers block when the queue is full, consumers block when it is empty.
+ * Closing the queue wakes every waiting thread.
+ */
+template<typename T> class Bounded_Queue
+{
+  public:
+    /**
+     * \param[in] capacity Maximum number of elements stored at the same time (> 0)
+     */
+    explicit Bounded_Queue(const size_t capacity) : _capacity(capacity > 0 ? capacity : 1) {}
+
+    /**
+     * \brief Push a new element, waiting for space if the queue is full
+     * \param[in] value The element to push
+     * \return false if the queue was closed and the element was discarded
+     */
+    [[nodiscard]] bool push(T&& value) noexcept
+    {
+        std::unique_lock lock(_mutex);
+        _notFull.wait(lock, [this]() {
+            return _isClosed or _queue.size() < _capacity;
+        });
+        if (_isClosed)
+            return false;
+
+        _queue.emplace_back(std::move(value));
+        lock.unlock();
+        _notEmpty.notify_one();
+        return true;
+    }
+
+    /**
+     * \brief Push a new element if there is space for it, without waiting
+     * \param[in] value The element to push
+     * \return false if the queue was full or closed, and the element was discarded
+     */
+    [[nodiscard]] bool try_push(T&& value) noexcept
+    {
+        std::unique_lock lock(_mutex);
+        if (_isClosed or _queue.size() >= _capacity)
+            return false;
+
+        _queue.emplace_back(std::move(value));
+        lock.unlock();
+        _notEmpty.notify_one();
+        return true;
+    }
+
+    /**
+     * \brief Push a new element without waiting. If the queue is full, its oldest element is dropped to make space, in
+     * the same critical section: a consumer cannot take the freed slot from this element
+     * \param[in] value The element to push
+     * \return false if the oldest element was dropped, or if the queue was closed and the element was discarded
+     */
+    [[nodiscard]] bool push_dropping_oldest(T&& value) noexcept
+    {
+        // destroyed after the lock is released
+        std::optional<T> droppedValue;
+        std::unique_lock lock(_mutex);
+        if (_isClosed)
+            return false;
+
+        const bool isFull = _queue.size() >= _capacity;
+        if (isFull)
+        {
+            droppedValue.emplace(std::move(_queue.front()));
+            _queue.pop_front();
+        }
+        _queue.emplace_back(std::move(value));
+        lock.unlock();
+        _notEmpty.notify_one();
+        return not isFull;
+    }
+
+    /**
+     * \brief Pop the oldest element, waiting for one if the queue is empty
+     * \param[out] value The popped element
+     * \return false if the queue is closed and empty: no more elements will come
+     */
+    [[nodiscard]] bool pop(T& value) noexcept
+    {
+        std::unique_lock lock(_mutex);
+        _notEmpty.wait(lock, [this]() {
+            return _isClosed or not _queue.empty();
+        });
+        if (_queue.empty())
+            return false;
+
+        value = std::move(_queue.front());
+        _queue.pop_front();
+        lock.unlock();
+        _notFull.notify_one();
+        return true;
+    }
+
+    /**
+     * \brief Pop the oldest element if there is one, without waiting
+     * \param[out] value The popped element
+     * \return false if the queue was empty
+     */
+    [[nodiscard]] bool try_pop(T& value) noexcept
+    {
+        std::unique_lock lock(_mutex);
+        if (_queue.empty())
+            return false;
+
+        value = std::move(_queue.front());
+        _queue.pop_front();
+        lock.unlock();
+        _notFull.notify_one();
+        return true;
+    }
+
+    /**
+     * \brief Refuse any new element. The elements already in the queue can still be popped
+     */
+    void close() noexcept
+    {
+        {
+            std::scoped_lock lock(_mutex);
+            _isClosed = true;
+        }
+        _notEmpty.notify_all();
+        _notFull.notify_all();
+    }
+
+    /**
+     * \brief Reopen a closed queue, dropping the remaining elements
+     */
+    void reset() noexcept
+    {
+        std::scoped_lock lock(_mutex);
+        _queue.clear();
+        _isClosed = false;
+    }
+
+    [[nodiscard]] size_t size() const noexcept
+    {
+        std::scoped_lock lock(_mutex);
+        return _queue.size();
+    }
+
+    [[nodiscard]] size_t capacity() const noexcept { return _capacity; }
+
+  private:
+    const size_t _capacity;
+    std::deque<T> _queue;
+    bool _isClosed = false;
+
+    mutable std::mutex _mutex;
+    std::condition_variable _notEmpty;
+    std::condition_variable _notFull;
+};
+
+} // namespace rgbd_slam::utils
+
+#endif
@@ -2,6 +2,8 @@
 #include "angle_utils.hpp"
 #include "logger.hpp"
 
+#include <array>
+
 namespace rgbd_slam::utils {
 
 /**
@@ -43,6 +45,38 @@ WorldToCameraMatrix compute_world_to_camera_transform(const CameraToWorldMatrix&
     return worldToCamera;
 }
 
+WorldToCameraMatrix compute_world_to_camera_transform(const quaternion& rotation,
+                                                     const vector3& position,
+                                                     Eigen::Matrix<double, 12, 7>& jacobian) noexcept
+{
+    // the transformation is [R^T.C^T | -R^T.p], with C the camera to world correction rotation
+    const matrix33& correctionTransposed = CameraToWorld.block<3, 3>(0, 0).transpose();
+    const matrix33& rotationTransposed = rotation.toRotationMatrix().transpose();
+
+    jacobian.setZero();
+    jacobian.block<3, 3>(9, 0) = -rotationTransposed;
+
+    // derivatives of the rotation matrix of a unit quaternion, with respect to w, x, y and z
+    const double w = rotation.w();
+    const double x = rotation.x();
+    const double y = rotation.y();
+    const double z = rotation.z();
+    const std::array<matrix33, 4> rotationDerivatives = {
+            matrix33({{0.0, -2.0 * z, 2.0 * y}, {2.0 * z, 0.0, -2.0 * x}, {-2.0 * y, 2.0 * x, 0.0}}),
+            matrix33({{0.0, 2.0 * y, 2.0 * z}, {2.0 * y, -4.0 * x, -2.0 * w}, {2.0 * z, 2.0 * w, -4.0 * x}}),
+            matrix33({{-4.0 * y, 2.0 * x, 2.0 * w}, {2.0 * x, 0.0, 2.0 * z}, {-2.0 * w, 2.0 * z, -4.0 * y}}),
+            matrix33({{-4.0 * z, -2.0 * w, 2.0 * x}, {2.0 * w, -4.0 * z, 2.0 * y}, {2.0 * x, 2.0 * y, 0.0}})};
+    for (uint i = 0; i < rotationDerivatives.size(); ++i)
+    {
+        const matrix33& derivativeTransposed = rotationDerivatives[i].transpose();
+        matrix34 transformationDerivative;
+        transformationDerivative << derivativeTransposed * correctionTransposed, -derivativeTransposed * position;
+        jacobian.col(3 + i) = transformationDerivative.reshaped();
+    }
+
+    return compute_world_to_camera_transform(rotation, position);
+}
+
 WorldToCameraMatrix compute_world_to_camera_transform_no_correction(const quaternion& rotation,
                                                                     const vector3& position) noexcept
 {
@@ -50,6 +84,16 @@ WorldToCameraMatrix compute_world_to_camera_transform_no_correction(const quater
     return compute_world_to_camera_transform(compute_camera_to_world_transform_no_correction(rotation, position));
 }
 
+void compute_pose_from_world_to_camera_transform(const WorldToCameraMatrix& worldToCamera,
+                                                 quaternion& rotation,
+                                                 vector3& position) noexcept
+{
+    // remove the camera to world correction from the camera to world transformation
+    const matrix44& transformation = CameraToWorld.inverse() * worldToCamera.inverse();
+    rotation = quaternion(transformation.block<3, 3>(0, 0)).normalized();
+    position = transformation.block<3, 1>(0, 3);
+}
+
 PlaneCameraToWorldMatrix compute_plane_camera_to_world_matrix(const CameraToWorldMatrix& cameraToWorld) noexcept
 {
     const matrix33& rotationMatrix = cameraToWorld.rotation();
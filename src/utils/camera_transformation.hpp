@@ -26,6 +26,18 @@ namespace rgbd_slam::utils {
 
 [[nodiscard]] WorldToCameraMatrix compute_world_to_camera_transform(const CameraToWorldMatrix& cameraToWorld) noexcept;
 
+/**
+ * \brief Given a camera pose, returns a transformation matrix to convert a world point (xyz) to camera point (uvd),
+ * and the jacobian of this transformation
+ * \param[in] rotation The camera orientation, as a unit quaternion
+ * \param[in] position The camera position
+ * \param[out] jacobian The jacobian of the 12 coefficients of the upper 3x4 block of the transformation (column major),
+ * with respect to the position (x, y, z) and the quaternion coefficients (w, x, y, z)
+ */
+[[nodiscard]] WorldToCameraMatrix compute_world_to_camera_transform(const quaternion& rotation,
+                                                                    const vector3& position,
+                                                                    Eigen::Matrix<double, 12, 7>& jacobian) noexcept;
+
 /**
  * \brief DO NOT USE EXPECT FOR TESTING.
  * This returns the transformation matrix UNRECTIFIED.
@@ -48,6 +60,17 @@ namespace rgbd_slam::utils {
 [[nodiscard]] CameraToWorldMatrix compute_camera_to_world_transform_no_correction(const quaternion& rotation,
                                                                                   const vector3& position) noexcept;
 
+/**
+ * \brief Given a transformation matrix from world to camera, compute the camera pose. Inverse of
+ * compute_world_to_camera_transform
+ * \param[in] worldToCamera The transformation to convert a world point to a camera point
+ * \param[out] rotation The camera orientation, as a unit quaternion
+ * \param[out] position The camera position
+ */
+void compute_pose_from_world_to_camera_transform(const WorldToCameraMatrix& worldToCamera,
+                                                 quaternion& rotation,
+                                                 vector3& position) noexcept;
+
 /**
  * \brief Transform a CameraToWorldMatrix to a special plane cameraToWorld matrix
  */
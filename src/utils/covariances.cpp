@@ -1,6 +1,7 @@
 #include "covariances.hpp"
 
 #include "../parameters.hpp"
+#include "camera_transformation.hpp"
 #include "distance_utils.hpp"
 #include "types.hpp"
 #include <Eigen/src/Core/util/Constants.h>
@@ -93,6 +94,61 @@ CameraCoordinateCovariance get_camera_point_covariance(const ScreenCoordinate& s
     return cameraPointCovariance;
 }
 
+/**
+ * Frame_Transform_Context
+ */
+
+Frame_Transform_Context::Frame_Transform_Context(const CameraToWorldMatrix& cameraToWorld,
+                                                 const matrix33& poseCovariance) noexcept :
+    _cameraToWorld(cameraToWorld),
+    _worldToCamera(compute_world_to_camera_transform(cameraToWorld)),
+    _planeCameraToWorld(compute_plane_camera_to_world_matrix(cameraToWorld)),
+    _poseCovariance(poseCovariance),
+    _cameraToWorldRotation(cameraToWorld.rotation()),
+    _worldToCameraRotation(_cameraToWorldRotation.transpose()),
+    _cameraFocal(Parameters::get_camera_1_focal()),
+    _cameraCenter(Parameters::get_camera_1_center())
+{
+}
+
+WorldCoordinateCovariance Frame_Transform_Context::get_world_point_covariance(
+        const ScreenCoordinate& screenPoint) const
+{
+    // rotation * screen to camera Jacobian (see get_camera_point_covariance), computed by columns
+    matrix33 jacobian;
+    jacobian.col(0) = _cameraToWorldRotation.col(0) * (screenPoint.z() / _cameraFocal.x());
+    jacobian.col(1) = _cameraToWorldRotation.col(1) * (screenPoint.z() / _cameraFocal.y());
+    jacobian.col(2) = _cameraToWorldRotation.col(0) * (abs(screenPoint.x() - _cameraCenter.x()) / _cameraFocal.x()) +
+                      _cameraToWorldRotation.col(1) * (abs(screenPoint.y() - _cameraCenter.y()) / _cameraFocal.y()) +
+                      _cameraToWorldRotation.col(2);
+
+    WorldCoordinateCovariance cov;
+    cov << propagate_covariance<3, 3>(screenPoint.get_covariance(), jacobian) + _poseCovariance;
+    return cov;
+}
+
+CameraCoordinateCovariance Frame_Transform_Context::get_camera_point_covariance(
+        const WorldCoordinateCovariance& worldPointCovariance) const noexcept
+{
+    CameraCoordinateCovariance cov;
+    cov << propagate_covariance<3, 3>(worldPointCovariance, _worldToCameraRotation) + _poseCovariance;
+    return cov;
+}
+
+ScreenCoordinateCovariance Frame_Transform_Context::get_screen_point_covariance(
+        const CameraCoordinate& point, const CameraCoordinateCovariance& pointCovariance) const noexcept
+{
+    // Jacobian of the camera to screen function
+    const double inverseDepth = 1.0 / point.z();
+    const matrix33 jacobian {
+            {_cameraFocal.x() * inverseDepth, 0.0, -_cameraFocal.x() * point.x() * SQR(inverseDepth)},
+            {0.0, _cameraFocal.y() * inverseDepth, -_cameraFocal.y() * point.y() * SQR(inverseDepth)},
+            {0.0, 0.0, 1.0}};
+    ScreenCoordinateCovariance screenPointCovariance;
+    screenPointCovariance << propagate_covariance<3, 3>(pointCovariance, jacobian);
+    return screenPointCovariance;
+}
+
 matrix44 compute_plane_covariance(const PlaneCoordinates& planeParameters, const matrix33& pointCloudCovariance)
 {
     if (not is_covariance_valid(pointCloudCovariance))
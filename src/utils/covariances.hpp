@@ -5,16 +5,33 @@
 #include "coordinates/point_coordinates.hpp"
 #include "logger.hpp"
 #include "types.hpp"
+#include "validation.hpp"
 #include <Eigen/src/Core/Matrix.h>
 #include <bits/ranges_algo.h>
+#include <tuple>
 
 namespace rgbd_slam::utils {
 
+/**
+ * \brief Check that a matrix is a valid covariance, at the compiled validation level (RGBDSLAM_VALIDATION_LEVEL):
+ * the cheap level checks the values, the symmetry and the diagonal, the paranoid level also checks that the matrix is
+ * positive semi definite (LDLT decomposition)
+ * \param[in] covariance The matrix to check
+ * \param[out] reason The failed check, if any
+ * \return false if a compiled check failed. Always true if the validation is off
+ */
 template<int N>
 [[nodiscard]] bool is_covariance_valid(const Eigen::Matrix<double, N, N>& covariance, std::string& reason) noexcept
 {
+    if constexpr (not is_validation_enabled(Validation_Level::Cheap))
+    {
+        std::ignore = covariance;
+        std::ignore = reason;
+        return true;
+    }
+
     // no invalid values
-    if (covariance.hasNaN() or not covariance.allFinite())
+    if (not covariance.allFinite())
     {
         reason = "invalid values";
         return false;
@@ -33,13 +50,23 @@ template<int N>
         return false;
     }
 
-    // check that this covariance is positive semi definite
-    const auto ldlt = covariance.template selfadjointView<Eigen::Upper>().ldlt();
-    if (ldlt.info() == Eigen::NumericalIssue || !ldlt.isPositive())
+    // the variances are positive
+    if ((covariance.diagonal().array() < 0.0).any())
     {
-        reason = "not positive semi definite";
+        reason = "negative variances";
         return false;
     }
+
+    if constexpr (is_validation_enabled(Validation_Level::Paranoid))
+    {
+        // check that this covariance is positive semi definite
+        const auto ldlt = covariance.template selfadjointView<Eigen::Upper>().ldlt();
+        if (ldlt.info() == Eigen::NumericalIssue || !ldlt.isPositive())
+        {
+            reason = "not positive semi definite";
+            return false;
+        }
+    }
     return true;
 }
 
@@ -130,6 +157,51 @@ CameraCoordinateCovariance get_camera_point_covariance(const WorldCoordinateCova
 [[nodiscard]] CameraCoordinateCovariance get_camera_point_covariance(
         const ScreenCoordinate& screenPoint, const ScreenCoordinateCovariance& screenPointCovariance) noexcept;
 
+/**
+ * \brief The transformations of a frame pose and the camera intrinsics, with the parts of the covariance propagation
+ * Jacobians that only depend on them. Built once per frame, and shared by the covariance propagations of all the
+ * features observed in this frame, instead of recomputing the rotations and intrinsics for each point
+ */
+struct Frame_Transform_Context
+{
+    /**
+     * \param[in] cameraToWorld The pose of the frame
+     * \param[in] poseCovariance The covariance of the pose position
+     */
+    Frame_Transform_Context(const CameraToWorldMatrix& cameraToWorld, const matrix33& poseCovariance) noexcept;
+
+    /**
+     * \brief Compute the covariance of a screen point transformed to world coordinates. Same result as
+     * utils::get_world_point_covariance, with the screen to camera Jacobian and the rotation in a single propagation
+     * \param[in] screenPoint The screen point observed in this frame
+     */
+    [[nodiscard]] WorldCoordinateCovariance get_world_point_covariance(const ScreenCoordinate& screenPoint) const;
+
+    /**
+     * \brief Compute the covariance of a world point in the camera coordinates of this frame
+     * \param[in] worldPointCovariance The covariance of the world point
+     */
+    [[nodiscard]] CameraCoordinateCovariance get_camera_point_covariance(
+            const WorldCoordinateCovariance& worldPointCovariance) const noexcept;
+
+    /**
+     * \brief Compute a screen point covariance from a point in the camera coordinates of this frame
+     * \param[in] point The coordinates of this 3D point (camera space)
+     * \param[in] pointCovariance The covariance associated with this point (camera space)
+     */
+    [[nodiscard]] ScreenCoordinateCovariance get_screen_point_covariance(
+            const CameraCoordinate& point, const CameraCoordinateCovariance& pointCovariance) const noexcept;
+
+    CameraToWorldMatrix _cameraToWorld;
+    WorldToCameraMatrix _worldToCamera;
+    PlaneCameraToWorldMatrix _planeCameraToWorld;
+    matrix33 _poseCovariance;
+    matrix33 _cameraToWorldRotation;
+    matrix33 _worldToCameraRotation;
+    vector2 _cameraFocal;
+    vector2 _cameraCenter;
+};
+
 /**
  * \brief Compute the covariance of a plane using it's point cloud covariance matrix
  * \param[in] planeParameters The plane parameters to compute covariance for
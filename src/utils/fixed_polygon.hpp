@@ -0,0 +1,203 @@
+#ifndef RGBDSLAM_UTILS_FIXED_POLYGON_HPP
+#define RGBDSLAM_UTILS_FIXED_POLYGON_HPP
+
+#include "../types.hpp"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+namespace rgbd_slam::utils {
+
+/**
+ * \brief A 2D polygon with an inline vertex buffer, for the operations on small polygons that must not allocate.
+ * The boundary is an open ring (the first vertex is not repeated at the end), in any orientation
+ */
+template<size_t Capacity> class Fixed_Polygon
+{
+  public:
+    static constexpr size_t capacity = Capacity;
+
+    /**
+     * \brief Add a vertex at the end of the ring
+     * \return false if the buffer is full: the vertex is not added
+     */
+    [[nodiscard]] bool push_back(const vector2& vertex) noexcept
+    {
+        if (_size >= Capacity)
+            return false;
+        _vertices[_size++] = vertex;
+        return true;
+    }
+
+    void clear() noexcept { _size = 0; }
+
+    [[nodiscard]] size_t size() const noexcept { return _size; }
+    [[nodiscard]] bool empty() const noexcept { return _size == 0; }
+    [[nodiscard]] const vector2& operator[](const size_t index) const noexcept
+    {
+        assert(index < _size);
+        return _vertices[index];
+    }
+
+    /**
+     * \brief Compute the signed area of the ring (shoelace formula)
+     * \return The area, positive for a counter clockwise ring
+     */
+    [[nodiscard]] double signed_area() const noexcept
+    {
+        if (_size < 3)
+            return 0.0;
+        double doubleArea = 0.0;
+        for (size_t i = 0, previous = _size - 1; i < _size; previous = i++)
+            doubleArea += cross(_vertices[previous], _vertices[i]);
+        return doubleArea / 2.0;
+    }
+
+    [[nodiscard]] double area() const noexcept { return std::abs(signed_area()); }
+
+    /**
+     * \brief Check that all the turns of the ring go in the same direction, and that the ring winds only once around
+     * its interior (a star ring turns in one direction but is not convex). Collinear vertices are accepted
+     */
+    [[nodiscard]] bool is_convex() const noexcept
+    {
+        if (_size < 3)
+            return false;
+        bool hasLeftTurn = false;
+        bool hasRightTurn = false;
+        // sum of the signed exterior angles: 2 pi times the winding number of the ring
+        double totalTurn_rad = 0.0;
+        for (size_t i = 0; i < _size; ++i)
+        {
+            const vector2& previous = _vertices[(i + _size - 1) % _size];
+            const vector2& next = _vertices[(i + 1) % _size];
+            const vector2& incomingEdge = _vertices[i] - previous;
+            const vector2& outgoingEdge = next - _vertices[i];
+            const double turn = cross(incomingEdge, outgoingEdge);
+            hasLeftTurn |= turn > 0.0;
+            hasRightTurn |= turn < 0.0;
+            totalTurn_rad += std::atan2(turn, incomingEdge.dot(outgoingEdge));
+        }
+        // the total turn is a multiple of 2 pi: the tolerance only absorbs the rounding errors
+        return not(hasLeftTurn and hasRightTurn) and std::abs(totalTurn_rad) < 3.0 * M_PI;
+    }
+
+    /**
+     * \brief Clip this polygon by a convex polygon (Sutherland-Hodgman). This polygon can be concave: the result can
+     * then have degenerated edges on the clip boundary, but its area is the area of the intersection
+     * \param[in] convexClip A convex polygon, in any orientation
+     * \param[out] clipped The part of this polygon inside convexClip. Can be empty
+     * \return false if a clipping step did not fit in the buffer: clipped is not valid
+     */
+    [[nodiscard]] bool clip(const Fixed_Polygon& convexClip, Fixed_Polygon& clipped) const noexcept
+    {
+        clipped.clear();
+        if (convexClip._size < 3 or _size < 3)
+            return true;
+        // the inside of the clip edges is on their left for a counter clockwise clip polygon
+        const double orientation = convexClip.signed_area() >= 0.0 ? 1.0 : -1.0;
+
+        // each edge clips the result of the last one, alternating between the two buffers
+        Fixed_Polygon buffer;
+        const Fixed_Polygon* input = this;
+        Fixed_Polygon* output = &clipped;
+        for (size_t edgeIndex = 0, previous = convexClip._size - 1; edgeIndex < convexClip._size;
+             previous = edgeIndex++)
+        {
+            output->clear();
+            const vector2& edgeStart = convexClip._vertices[previous];
+            const vector2 edge = convexClip._vertices[edgeIndex] - edgeStart;
+            for (size_t i = 0, last = input->_size - 1; i < input->_size; last = i++)
+            {
+                const vector2& from = input->_vertices[last];
+                const vector2& to = input->_vertices[i];
+                const double fromSide = orientation * cross(edge, from - edgeStart);
+                const double toSide = orientation * cross(edge, to - edgeStart);
+
+                // crossing of the edge line
+                if ((fromSide >= 0.0) != (toSide >= 0.0) and
+                    not output->push_back(from + (to - from) * (fromSide / (fromSide - toSide))))
+                    return false;
+                if (toSide >= 0.0 and not output->push_back(to))
+                    return false;
+            }
+            // no intersection
+            if (output->_size == 0)
+            {
+                clipped.clear();
+                return true;
+            }
+            input = output;
+            output = (output == &clipped) ? &buffer : &clipped;
+        }
+        if (input == &buffer)
+            clipped = buffer;
+        return true;
+    }
+
+  private:
+    [[nodiscard]] static double cross(const vector2& a, const vector2& b) noexcept
+    {
+        return a.x() * b.y() - a.y() * b.x();
+    }
+
+    std::array<vector2, Capacity> _vertices;
+    size_t _size = 0;
+};
+
+/**
+ * \brief Compute the convex hull of a set of points (Andrew's monotone chain)
+ * \param[in] points The points to compute a convex hull for
+ * \param[out] hull The vertices of the hull, as an open counter clockwise ring, with no collinear vertices. Has less
+ * than 3 vertices if all the points are collinear
+ */
+inline void compute_monotone_chain_hull(std::span<const vector2> points, std::vector<vector2>& hull) noexcept
+{
+    hull.clear();
+    std::vector<vector2> sortedPoints(points.begin(), points.end());
+    std::ranges::sort(sortedPoints, [](const vector2& a, const vector2& b) {
+        return a.x() < b.x() or (not(b.x() < a.x()) and a.y() < b.y());
+    });
+    const auto [duplicateStart, duplicateEnd] =
+            std::ranges::unique(sortedPoints, [](const vector2& a, const vector2& b) {
+                return (a - b).isZero(0.0);
+            });
+    sortedPoints.erase(duplicateStart, duplicateEnd);
+    if (sortedPoints.size() < 3)
+    {
+        hull = sortedPoints;
+        return;
+    }
+
+    const auto turn = [](const vector2& origin, const vector2& a, const vector2& b) {
+        return (a.x() - origin.x()) * (b.y() - origin.y()) - (a.y() - origin.y()) * (b.x() - origin.x());
+    };
+
+    hull.resize(2 * sortedPoints.size());
+    size_t hullSize = 0;
+    // lower chain
+    for (const vector2& point: sortedPoints)
+    {
+        while (hullSize >= 2 and turn(hull[hullSize - 2], hull[hullSize - 1], point) <= 0.0)
+            --hullSize;
+        hull[hullSize++] = point;
+    }
+    // upper chain, the last point of the lower chain is its first point
+    const size_t lowerChainSize = hullSize + 1;
+    for (auto pointIterator = sortedPoints.rbegin() + 1; pointIterator != sortedPoints.rend(); ++pointIterator)
+    {
+        while (hullSize >= lowerChainSize and turn(hull[hullSize - 2], hull[hullSize - 1], *pointIterator) <= 0.0)
+            --hullSize;
+        hull[hullSize++] = *pointIterator;
+    }
+    // the last point is the first one
+    hull.resize(hullSize - 1);
+}
+
+} // namespace rgbd_slam::utils
+
+#endif
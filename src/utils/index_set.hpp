@@ -0,0 +1,207 @@
+#ifndef RGBDSLAM_UTILS_INDEX_SET_HPP
+#define RGBDSLAM_UTILS_INDEX_SET_HPP
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+namespace rgbd_slam::utils {
+
+/**
+ * \brief A set of small integer indexes, like the indexes of the detected features.
+ * Up to inlineCapacity indexes are stored inline, without allocation: most map features match 0 or 1 detected
+ * feature. Larger sets switch to a bitset over the index values, with constant time insertions and lookups.
+ * The iteration order is not specified
+ */
+class Index_Set
+{
+  public:
+    static constexpr size_t inlineCapacity = 2;
+
+    class const_iterator
+    {
+      public:
+        using iterator_concept = std::forward_iterator_tag;
+        using iterator_category = std::input_iterator_tag;
+        using value_type = size_t;
+        using difference_type = std::ptrdiff_t;
+        using reference = size_t;
+
+        const_iterator() = default;
+        const_iterator(const Index_Set* set, const size_t position) noexcept : _set(set), _position(position)
+        {
+            if (_set != nullptr and _set->is_bitset())
+                _position = _set->find_next_bit(_position);
+        }
+
+        [[nodiscard]] size_t operator*() const noexcept
+        {
+            return _set->is_bitset() ? _position : _set->_inlineIndexes[_position];
+        }
+
+        const_iterator& operator++() noexcept
+        {
+            _position = _set->is_bitset() ? _set->find_next_bit(_position + 1) : _position + 1;
+            return *this;
+        }
+
+        const_iterator operator++(int) noexcept
+        {
+            const_iterator previous = *this;
+            ++(*this);
+            return previous;
+        }
+
+        [[nodiscard]] bool operator==(const const_iterator& other) const noexcept
+        {
+            return _position == other._position;
+        }
+
+      private:
+        const Index_Set* _set = nullptr;
+        // slot in the inline storage, or index value in the bitset
+        size_t _position = 0;
+    };
+    using iterator = const_iterator;
+
+    [[nodiscard]] bool empty() const noexcept { return _size == 0; }
+    [[nodiscard]] size_t size() const noexcept { return _size; }
+
+    [[nodiscard]] bool contains(const size_t index) const noexcept
+    {
+        if (is_bitset())
+            return index < _bits.size() * bitsPerWord and (_bits[index / bitsPerWord] >> (index % bitsPerWord)) & 1u;
+
+        for (size_t i = 0; i < _size; ++i)
+        {
+            if (_inlineIndexes[i] == index)
+                return true;
+        }
+        return false;
+    }
+
+    /**
+     * \brief Add an index to this set
+     * \return false if it was already in the set
+     */
+    bool emplace(const size_t index)
+    {
+        if (contains(index))
+            return false;
+
+        if (not is_bitset())
+        {
+            if (_size < inlineCapacity)
+            {
+                _inlineIndexes[_size++] = index;
+                return true;
+            }
+
+            // switch to the bitset storage
+            for (size_t i = 0; i < _size; ++i)
+                set_bit(_inlineIndexes[i]);
+        }
+        set_bit(index);
+        ++_size;
+        return true;
+    }
+
+    bool insert(const size_t index) { return emplace(index); }
+
+    template<typename InputIterator> void insert(InputIterator first, const InputIterator last)
+    {
+        for (; first != last; ++first)
+            emplace(*first);
+    }
+
+    /**
+     * \brief Add all the indexes of another set to this one
+     */
+    void merge(const Index_Set& other)
+    {
+        for (const size_t index: other)
+            emplace(index);
+    }
+
+    /**
+     * \brief Remove an index from this set. Does nothing if it is not in the set
+     */
+    void erase(const size_t index) noexcept
+    {
+        if (not contains(index))
+            return;
+
+        --_size;
+        if (is_bitset())
+        {
+            _bits[index / bitsPerWord] &= ~(uint64_t(1) << (index % bitsPerWord));
+            return;
+        }
+        for (size_t i = 0; i <= _size; ++i)
+        {
+            if (_inlineIndexes[i] == index)
+            {
+                _inlineIndexes[i] = _inlineIndexes[_size];
+                return;
+            }
+        }
+    }
+
+    void clear() noexcept
+    {
+        _size = 0;
+        _bits.clear();
+    }
+
+    [[nodiscard]] const_iterator begin() const noexcept { return const_iterator(this, 0); }
+    [[nodiscard]] const_iterator end() const noexcept
+    {
+        return const_iterator(nullptr, is_bitset() ? _bits.size() * bitsPerWord : _size);
+    }
+    [[nodiscard]] const_iterator cbegin() const noexcept { return begin(); }
+    [[nodiscard]] const_iterator cend() const noexcept { return end(); }
+
+  private:
+    static constexpr size_t bitsPerWord = 64;
+
+    [[nodiscard]] bool is_bitset() const noexcept { return not _bits.empty(); }
+
+    void set_bit(const size_t index)
+    {
+        const size_t wordIndex = index / bitsPerWord;
+        if (wordIndex >= _bits.size())
+            _bits.resize(wordIndex + 1, 0);
+        _bits[wordIndex] |= uint64_t(1) << (index % bitsPerWord);
+    }
+
+    /**
+     * \brief Find the first index of the bitset that is >= start
+     * \return The index, or the bitset size if there is none
+     */
+    [[nodiscard]] size_t find_next_bit(const size_t start) const noexcept
+    {
+        size_t wordIndex = start / bitsPerWord;
+        if (wordIndex >= _bits.size())
+            return _bits.size() * bitsPerWord;
+
+        uint64_t word = _bits[wordIndex] & (~uint64_t(0) << (start % bitsPerWord));
+        while (word == 0)
+        {
+            if (++wordIndex >= _bits.size())
+                return _bits.size() * bitsPerWord;
+            word = _bits[wordIndex];
+        }
+        return wordIndex * bitsPerWord + static_cast<size_t>(std::countr_zero(word));
+    }
+
+    std::array<size_t, inlineCapacity> _inlineIndexes {};
+    std::vector<uint64_t> _bits; // empty while the indexes fit in the inline storage
+    size_t _size = 0;
+};
+
+} // namespace rgbd_slam::utils
+
+#endif
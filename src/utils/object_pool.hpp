@@ -0,0 +1,180 @@
+#ifndef RGBDSLAM_UTILS_OBJECT_POOL_HPP
+#define RGBDSLAM_UTILS_OBJECT_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace rgbd_slam::utils {
+
+/**
+ * \brief The bytes of the slabs allocated by all the fixed size pools
+ */
+[[nodiscard]] inline std::atomic<size_t>& get_pool_slab_bytes() noexcept
+{
+    static std::atomic<size_t> slabBytes = 0;
+    return slabBytes;
+}
+
+/**
+ * \brief A pool of fixed size memory blocks, shared by all the objects of the same size and alignment.
+ * Each thread takes and gives back its blocks from its own free list, without locks. The free lists exchange batches
+ * of blocks with a shared list, so the blocks released by a thread are reused by the others. The blocks are allocated
+ * by slabs that are never moved nor freed before the end of the program (the blocks left in the free list of an ended
+ * thread are not reused)
+ */
+template<size_t blockSize, size_t blockAlignment> class Fixed_Size_Pool
+{
+  public:
+    static constexpr size_t blocksPerSlab = 256;
+    // blocks kept in the free list of a thread, before moving them to the shared list
+    static constexpr size_t batchSize = blocksPerSlab;
+
+    /**
+     * \brief Take a block of blockSize bytes, aligned on blockAlignment
+     */
+    [[nodiscard]] static void* allocate()
+    {
+        Thread_Free_List& freeList = get_thread_free_list();
+        if (freeList._head == nullptr)
+            refill(freeList);
+
+        Free_Block* block = freeList._head;
+        freeList._head = block->_next;
+        --freeList._size;
+        return block;
+    }
+
+    /**
+     * \brief Give back a block returned by allocate, from any thread
+     */
+    static void release(void* block) noexcept
+    {
+        Thread_Free_List& freeList = get_thread_free_list();
+        Free_Block* freeBlock = ::new (block) Free_Block {freeList._head};
+        freeList._head = freeBlock;
+        if (++freeList._size >= 2 * batchSize)
+            give_back_batch(freeList);
+    }
+
+  private:
+    struct Free_Block
+    {
+        Free_Block* _next;
+    };
+
+    struct Thread_Free_List
+    {
+        Free_Block* _head = nullptr;
+        size_t _size = 0;
+    };
+
+    static constexpr size_t slotAlignment = std::max(blockAlignment, alignof(Free_Block));
+    static constexpr size_t slotSize =
+            (std::max(blockSize, sizeof(Free_Block)) + slotAlignment - 1) / slotAlignment * slotAlignment;
+
+    struct Slab_Deleter
+    {
+        void operator()(std::byte* slab) const noexcept { ::operator delete[](slab, std::align_val_t(slotAlignment)); }
+    };
+
+    struct Shared_State
+    {
+        std::mutex _mutex;
+        std::vector<Free_Block*> _batches; // each one is the head of a list of batchSize blocks
+        std::vector<std::unique_ptr<std::byte[], Slab_Deleter>> _slabs;
+    };
+
+    [[nodiscard]] static Shared_State& get_shared_state() noexcept
+    {
+        static Shared_State sharedState;
+        return sharedState;
+    }
+
+    [[nodiscard]] static Thread_Free_List& get_thread_free_list() noexcept
+    {
+        thread_local Thread_Free_List freeList;
+        return freeList;
+    }
+
+    /**
+     * \brief Fill an empty free list with a batch from the shared list, or with a new slab
+     */
+    static void refill(Thread_Free_List& freeList)
+    {
+        Shared_State& sharedState = get_shared_state();
+        std::scoped_lock lock(sharedState._mutex);
+        if (not sharedState._batches.empty())
+        {
+            freeList._head = sharedState._batches.back();
+            freeList._size = batchSize;
+            sharedState._batches.pop_back();
+            return;
+        }
+
+        std::byte* slab = static_cast<std::byte*>(
+                ::operator new[](slotSize * blocksPerSlab, std::align_val_t(slotAlignment)));
+        sharedState._slabs.emplace_back(slab);
+        get_pool_slab_bytes().fetch_add(slotSize * blocksPerSlab, std::memory_order_relaxed);
+        for (size_t i = blocksPerSlab; i > 0; --i)
+        {
+            freeList._head = ::new (slab + (i - 1) * slotSize) Free_Block {freeList._head};
+        }
+        freeList._size = blocksPerSlab;
+    }
+
+    /**
+     * \brief Move a batch of blocks from a full free list to the shared list
+     */
+    static void give_back_batch(Thread_Free_List& freeList) noexcept
+    {
+        Free_Block* batchHead = freeList._head;
+        Free_Block* batchTail = batchHead;
+        for (size_t i = 1; i < batchSize; ++i)
+            batchTail = batchTail->_next;
+        freeList._head = batchTail->_next;
+        freeList._size -= batchSize;
+        batchTail->_next = nullptr;
+
+        Shared_State& sharedState = get_shared_state();
+        std::scoped_lock lock(sharedState._mutex);
+        sharedState._batches.emplace_back(batchHead);
+    }
+};
+
+/**
+ * \brief Stateless allocator of single objects from the fixed size pool of their size.
+ * Meant for std::allocate_shared and node based containers: the arrays are allocated with new
+ */
+template<typename T> struct Pool_Allocator
+{
+    using value_type = T;
+
+    Pool_Allocator() noexcept = default;
+    template<typename U> Pool_Allocator(const Pool_Allocator<U>&) noexcept {}
+
+    [[nodiscard]] T* allocate(const size_t n)
+    {
+        if (n == 1)
+            return static_cast<T*>(Fixed_Size_Pool<sizeof(T), alignof(T)>::allocate());
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* pointer, const size_t n) noexcept
+    {
+        if (n == 1)
+            Fixed_Size_Pool<sizeof(T), alignof(T)>::release(pointer);
+        else
+            std::allocator<T>().deallocate(pointer, n);
+    }
+
+    template<typename U> bool operator==(const Pool_Allocator<U>&) const noexcept { return true; }
+};
+
+} // namespace rgbd_slam::utils
+
+#endif
@@ -12,6 +12,7 @@
 #include <opencv2/core/types.hpp>
 #include <opencv2/imgproc.hpp>
 #include <stdexcept>
+#include <tuple>
 #include "logger.hpp"
 #include "concave_fitting.hpp"
 #include "correct_boost_polygon.hpp"
@@ -21,6 +22,29 @@
 
 namespace rgbd_slam::utils {
 
+namespace {
+
+/**
+ * \brief Copy the outer ring of a polygon to a fixed size polygon, without the point that closes the ring
+ * \return false if the ring does not fit in the fixed polygon
+ */
+bool to_fixed_polygon(const Polygon::polygon& pol, Polygon::fixed_polygon& fixedPolygon) noexcept
+{
+    fixedPolygon.clear();
+    const auto& ring = pol.outer();
+    size_t pointCount = ring.size();
+    if (pointCount > 1 and boost::geometry::equals(ring.front(), ring.back()))
+        --pointCount;
+    for (size_t i = 0; i < pointCount; ++i)
+    {
+        if (not fixedPolygon.push_back(vector2(ring[i].x(), ring[i].y())))
+            return false;
+    }
+    return true;
+}
+
+} // namespace
+
 Polygon::polygon get_static_screen_boundary_polygon() noexcept
 {
     // prevent floatting number problems
@@ -36,12 +60,13 @@ Polygon::polygon get_static_screen_boundary_polygon() noexcept
              Polygon::point_2d(boundarySize, static_cast<int>(round(screenSizeY))),
              Polygon::point_2d(boundarySize, boundarySize)});
 
-    static Polygon::polygon boundary;
-    if (boundary.outer().size() <= 0)
-    {
-        boost::geometry::assign_points(boundary, screenBoundaryPoints);
-        boost::geometry::correct(boundary);
-    }
+    // built in the static initialization, that is thread safe: the first calls can come from different threads
+    static const Polygon::polygon boundary = []() {
+        Polygon::polygon screenBoundary;
+        boost::geometry::assign_points(screenBoundary, screenBoundaryPoints);
+        boost::geometry::correct(screenBoundary);
+        return screenBoundary;
+    }();
     return boundary;
 }
 
@@ -165,7 +190,7 @@ vector3 get_point_from_plane_coordinates(const vector2& pointToProject,
     return planeCenter + pointToProject.x() * xAxis + pointToProject.y() * yAxis;
 }
 
-Polygon::Polygon(const std::vector<vector3>& points, const vector3& normal, const vector3& center) : _center(center)
+Polygon::Polygon(std::span<const vector3> points, const vector3& normal, const vector3& center) : _center(center)
 {
     if (not double_equal(normal.norm(), 1.0))
     {
@@ -258,6 +283,7 @@ Polygon::Polygon(const std::vector<point_2d>& boundaryPoints,
     boost::geometry::assign_points(_polygon, boundaryPoints);
     boost::geometry::correct(_polygon);
     _area = area();
+    update_boundary_properties();
 
     if (_polygon.outer().size() <= 3)
     {
@@ -267,6 +293,20 @@ Polygon::Polygon(const std::vector<point_2d>& boundaryPoints,
 
 Polygon::polygon Polygon::compute_convex_hull(const std::vector<vector2>& pointsIn) noexcept
 {
+#ifndef USE_BOOST_POLYGON_OPERATIONS
+    std::vector<vector2> hull;
+    compute_monotone_chain_hull(pointsIn, hull);
+
+    // closed clockwise ring, as the boost polygons
+    polygon pol;
+    if (hull.size() < 3)
+        return pol;
+    pol.outer().reserve(hull.size() + 1);
+    for (auto pointIterator = hull.crbegin(); pointIterator != hull.crend(); ++pointIterator)
+        pol.outer().emplace_back(pointIterator->x(), pointIterator->y());
+    pol.outer().push_back(pol.outer().front());
+    return pol;
+#else
     boost::geometry::model::multi_point<point_2d> hull;
     boost::geometry::model::multi_point<point_2d> input;
 
@@ -278,6 +318,7 @@ Polygon::polygon Polygon::compute_convex_hull(const std::vector<vector2>& points
     polygon pol;
     boost::geometry::convex_hull(input, pol);
     return pol;
+#endif
 }
 
 Polygon::polygon Polygon::compute_concave_hull(const std::vector<vector2>& pointsIn) noexcept
@@ -324,7 +365,13 @@ bool Polygon::contains(const vector2& point) const noexcept
 
 void Polygon::merge_union(const Polygon& other)
 {
-    const polygon& res = union_one(other.project(_xAxis, _yAxis, _center));
+    const Polygon& projectedOther = other.project(_xAxis, _yAxis, _center);
+    // an observation inside the current boundary adds nothing to it: keep the boundary, without union and
+    // simplification. This is the common case for long lived planes
+    if (is_covering(projectedOther))
+        return;
+
+    const polygon& res = union_one_projected(projectedOther._polygon);
     if (res.outer().empty())
     {
         outputs::log_warning("Merge of two polygons produces no overlaps, returning without merge operation");
@@ -460,10 +507,41 @@ double Polygon::area() const noexcept
     return boost::geometry::area(_polygon);
 }
 
+bool Polygon::is_covering(const Polygon& other) const noexcept
+{
+    if (_polygon.outer().empty() or other._polygon.outer().empty())
+        return false;
+
+    // cheap bounding box rejection before the exact test
+    if (not boost::geometry::covered_by(other._bounds, _bounds))
+        return false;
+    return boost::geometry::covered_by(other._polygon, _polygon);
+}
+
+double Polygon::get_inter_area_upper_bound(const Polygon& other) const noexcept
+{
+    if (_polygon.outer().empty() or other._polygon.outer().empty())
+        return 0.0;
+
+    const double interWidth = std::min(_bounds.max_corner().x(), other._bounds.max_corner().x()) -
+                              std::max(_bounds.min_corner().x(), other._bounds.min_corner().x());
+    const double interHeight = std::min(_bounds.max_corner().y(), other._bounds.max_corner().y()) -
+                               std::max(_bounds.min_corner().y(), other._bounds.min_corner().y());
+    if (interWidth <= 0 or interHeight <= 0)
+        return 0.0;
+    // the intersection is inside both polygons and both bounding boxes
+    return std::min({interWidth * interHeight, _area, other._area});
+}
+
 Polygon::polygon Polygon::union_one(const Polygon& other) const
+{
+    return union_one_projected(other.project(_xAxis, _yAxis, _center)._polygon);
+}
+
+Polygon::polygon Polygon::union_one_projected(const polygon& other) const
 {
     multi_polygon res;
-    boost::geometry::union_(_polygon, other.project(_xAxis, _yAxis, _center)._polygon, res);
+    boost::geometry::union_(_polygon, other, res);
     if (res.empty())
         return polygon(); // empty polygon
 
@@ -493,9 +571,14 @@ Polygon::polygon Polygon::union_one(const Polygon& other) const
 }
 
 Polygon::polygon Polygon::inter_one(const Polygon& other) const
+{
+    return inter_one_projected(other.project(_xAxis, _yAxis, _center)._polygon);
+}
+
+Polygon::polygon Polygon::inter_one_projected(const polygon& other) const
 {
     multi_polygon res;
-    boost::geometry::intersection(_polygon, other.project(_xAxis, _yAxis, _center)._polygon, res);
+    boost::geometry::intersection(_polygon, other, res);
     if (res.empty())
         return polygon(); // empty polygon, no intersection
 
@@ -522,10 +605,27 @@ Polygon::polygon Polygon::inter_one(const Polygon& other) const
     return biggestPol;
 }
 
-double Polygon::inter_over_union(const Polygon& other) const
+double Polygon::inter_over_union(const Polygon& other, const double minimumInterOverUnion) const
 {
     const Polygon& projectedOther = other.project(_xAxis, _yAxis, _center);
-    const polygon& un = union_one(projectedOther);
+    // the union is at least as big as the biggest polygon
+    const double maximumArea = std::max(_area, projectedOther._area);
+    if (maximumArea <= 0)
+        return 0.0;
+    const double interUpperBound = get_inter_area_upper_bound(projectedOther);
+    if (interUpperBound <= 0 or interUpperBound / maximumArea < minimumInterOverUnion)
+        return 0.0;
+
+    // the intersection and union of two convex polygons are single polygons
+    if (double interArea; _isConvex and projectedOther._isConvex and get_clipped_inter_area(projectedOther, interArea))
+    {
+        const double unionArea = _area + projectedOther._area - interArea;
+        if (interArea <= 0 or unionArea <= 0)
+            return 0.0;
+        return interArea / unionArea;
+    }
+
+    const polygon& un = union_one_projected(projectedOther._polygon);
     if (un.outer().size() < 3)
         return 0.0;
 
@@ -533,17 +633,24 @@ double Polygon::inter_over_union(const Polygon& other) const
     if (finalUnion <= 0)
         return 0.0;
 
-    const double finalInter = boost::geometry::area(inter_one(projectedOther));
+    const double finalInter = boost::geometry::area(inter_one_projected(projectedOther._polygon));
     if (finalInter <= 0)
         return 0.0;
     return finalInter / finalUnion;
 }
 
-double Polygon::inter_area(const Polygon& other) const
+double Polygon::inter_area(const Polygon& other, const double minimumInterArea) const
 {
+    const Polygon& projectedOther = other.project(_xAxis, _yAxis, _center);
+    const double interUpperBound = get_inter_area_upper_bound(projectedOther);
+    if (interUpperBound <= 0 or interUpperBound < minimumInterArea)
+        return 0;
+
+    if (double interArea; get_clipped_inter_area(projectedOther, interArea))
+        return interArea;
+
     multi_polygon res;
-    const bool processSuccess =
-            boost::geometry::intersection(_polygon, other.project(_xAxis, _yAxis, _center)._polygon, res);
+    const bool processSuccess = boost::geometry::intersection(_polygon, projectedOther._polygon, res);
     if (!processSuccess)
     {
         outputs::log_error("Polygon intersection returned error");
@@ -562,8 +669,16 @@ double Polygon::inter_area(const Polygon& other) const
 
 double Polygon::union_area(const Polygon& other) const
 {
+    const Polygon& projectedOther = other.project(_xAxis, _yAxis, _center);
+    // no overlap: the union is the two polygons
+    if (get_inter_area_upper_bound(projectedOther) <= 0)
+        return _area + projectedOther._area;
+
+    if (double interArea; get_clipped_inter_area(projectedOther, interArea))
+        return _area + projectedOther._area - interArea;
+
     multi_polygon res;
-    boost::geometry::union_(_polygon, other.project(_xAxis, _yAxis, _center)._polygon, res);
+    boost::geometry::union_(_polygon, projectedOther._polygon, res);
 
     // compute the sum of area of the union
     double areaSum = 0;
@@ -599,6 +714,39 @@ void Polygon::simplify(const double distanceThreshold) noexcept
     }
     // else: Could not optimize polygon boundary cause it would have been reduced to a non shape
     // dont change the polygon
+    update_boundary_properties();
+}
+
+void Polygon::update_boundary_properties() noexcept
+{
+    _bounds = boost::geometry::return_envelope<box_2d>(_polygon);
+
+    fixed_polygon boundary;
+    _isConvex = to_fixed_polygon(_polygon, boundary) and boundary.is_convex();
+}
+
+bool Polygon::get_clipped_inter_area(const Polygon& other, double& interArea) const noexcept
+{
+#ifdef USE_BOOST_POLYGON_OPERATIONS
+    std::ignore = other;
+    std::ignore = interArea;
+    return false;
+#else
+    if (not _isConvex and not other._isConvex)
+        return false;
+
+    // clip the other polygon by the convex one
+    const Polygon& convexPolygon = _isConvex ? *this : other;
+    const Polygon& clippedPolygon = _isConvex ? other : *this;
+    fixed_polygon clip;
+    fixed_polygon subject;
+    fixed_polygon intersection;
+    if (not to_fixed_polygon(convexPolygon._polygon, clip) or not to_fixed_polygon(clippedPolygon._polygon, subject) or
+        not subject.clip(clip, intersection))
+        return false;
+    interArea = intersection.area();
+    return true;
+#endif
 }
 
 std::vector<vector3> Polygon::get_unprojected_boundary() const
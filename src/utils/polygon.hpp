@@ -2,8 +2,10 @@
 #define RGBDSLAM_UTILS_POLYGON_UTILS_HPP
 
 #include "../types.hpp"
+#include "fixed_polygon.hpp"
 #include <boost/geometry/geometry.hpp>
 #include <opencv2/core/mat.hpp>
+#include <span>
 
 namespace rgbd_slam::utils {
 
@@ -21,7 +23,10 @@ vector3 get_point_from_plane_coordinates(const vector2& pointToProject,
                                          const vector3& yAxis);
 
 /**
- * \brief Describe a polygon by it's points in the polygon space
+ * \brief Describe a polygon by it's points in the polygon space.
+ * The intersections with a convex polygon (the common case of the plane boundaries) are computed by clipping, in fixed
+ * size buffers, and the convex hulls with a monotone chain. The other operations use boost geometry. Define
+ * USE_BOOST_POLYGON_OPERATIONS to use boost geometry for all operations
  */
 class Polygon
 {
@@ -30,15 +35,18 @@ class Polygon
     using polygon = boost::geometry::model::polygon<point_2d>;
     using multi_polygon = boost::geometry::model::multi_polygon<polygon>;
     using box_2d = boost::geometry::model::box<point_2d>;
+    // polygons with more vertices use the boost geometry operations
+    using fixed_polygon = Fixed_Polygon<64>;
 
     Polygon() = default;
     /**
      * \brief Build constructor
-     * \param[in] points The points to put in the polygon. They will be projected to the polygon space
+     * \param[in] points The points to put in the polygon. They will be projected to the polygon space. Only viewed,
+     * so a reused buffer can be passed
      * \param[in] normal The normal of the plane that contains those points
      * \param[in] center The center of the plane that contains those points
      */
-    Polygon(const std::vector<vector3>& points, const vector3& normal, const vector3& center);
+    Polygon(std::span<const vector3> points, const vector3& normal, const vector3& center);
 
     /**
      * \brief transform constructor
@@ -107,7 +115,8 @@ class Polygon
     [[nodiscard]] double get_area() const noexcept { return _area; };
 
     /**
-     * \brief merge the other polygon into this one using the union of both polygons
+     * \brief merge the other polygon into this one using the union of both polygons.
+     * If the other polygon is already covered by this one, the boundary is kept as is
      */
     void merge_union(const Polygon& other);
 
@@ -151,15 +160,21 @@ class Polygon
 
     /**
      * \brief Compute the inter/over of the two polygons
+     * \param[in] other The other polygon
+     * \param[in] minimumInterOverUnion If the bounding boxes show that the result is below this value, skip the exact
+     * computation and return 0
      * \return Inter of Union of the two polygons, or 0 if they do not overlap
      */
-    [[nodiscard]] double inter_over_union(const Polygon& other) const;
+    [[nodiscard]] double inter_over_union(const Polygon& other, const double minimumInterOverUnion = 0.0) const;
 
     /**
      * \brief compute the area of the intersection of two polygons
+     * \param[in] other The other polygon
+     * \param[in] minimumInterArea If the bounding boxes show that the result is below this value, skip the exact
+     * computation and return 0
      * \return the inter polygon area, or 0 if they do not overlap
      */
-    [[nodiscard]] double inter_area(const Polygon& other) const;
+    [[nodiscard]] double inter_area(const Polygon& other, const double minimumInterArea = 0.0) const;
 
     /**
      * \brief compute the area of the union of two polygons
@@ -190,6 +205,22 @@ class Polygon
      */
     [[nodiscard]] std::vector<vector3> get_unprojected_boundary() const;
 
+    /**
+     * \brief Get the boundary points, in the polygon space. The last point closes the boundary
+     */
+    [[nodiscard]] const std::vector<point_2d>& get_boundary_points() const noexcept { return _polygon.outer(); };
+
+    /**
+     * \brief The bytes allocated by the boundary of this polygon
+     */
+    [[nodiscard]] size_t get_allocated_bytes() const noexcept
+    {
+        size_t allocatedBytes = _polygon.outer().capacity() * sizeof(point_2d);
+        for (const auto& innerRing: _polygon.inners())
+            allocatedBytes += innerRing.capacity() * sizeof(point_2d);
+        return allocatedBytes + _polygon.inners().capacity() * sizeof(typename polygon::ring_type);
+    }
+
     [[nodiscard]] vector3 get_center() const noexcept { return _center; };
     [[nodiscard]] vector3 get_x_axis() const noexcept { return _xAxis; };
     [[nodiscard]] vector3 get_y_axis() const noexcept { return _yAxis; };
@@ -202,7 +233,51 @@ class Polygon
     vector3 _xAxis;
     vector3 _yAxis;
 
-    double _area; // this polygon area: computation savings
+    double _area;           // this polygon area: computation savings
+    box_2d _bounds;         // this polygon axis aligned bounds, in polygon space: cheap overlap rejections
+    bool _isConvex = false; // this polygon boundary is convex: its intersections can be computed by clipping
+
+    /**
+     * \brief Update the bounds and convexity flag, after a change of the boundary
+     */
+    void update_boundary_properties() noexcept;
+
+    /**
+     * \brief Compute the intersection area by clipping, when one of the polygons is convex and both fit in the fixed
+     * polygon buffers
+     * \param[in] other A polygon, already in this polygon space
+     * \param[out] interArea The area of the intersection of both polygons
+     * \return false if the clipping cannot be used: interArea is not set
+     */
+    [[nodiscard]] bool get_clipped_inter_area(const Polygon& other, double& interArea) const noexcept;
+
+    /**
+     * \brief Check that another polygon is inside this one
+     * \param[in] other A polygon, already in this polygon space
+     * \return True if other is covered by this polygon
+     */
+    [[nodiscard]] bool is_covering(const Polygon& other) const noexcept;
+
+    /**
+     * \brief Compute an upper bound of the intersection area, from the bounding boxes and areas
+     * \param[in] other A polygon, already in this polygon space
+     * \return An area greater or equal to the intersection area. 0 if the polygons cannot overlap
+     */
+    [[nodiscard]] double get_inter_area_upper_bound(const Polygon& other) const noexcept;
+
+    /**
+     * \brief Compute the union of this polygon and another one
+     * \param[in] other A polygon, already in this polygon space
+     * \return The union if it exists, or an empty polygon
+     */
+    [[nodiscard]] polygon union_one_projected(const polygon& other) const;
+
+    /**
+     * \brief Compute the inter of this polygon and another one
+     * \param[in] other A polygon, already in this polygon space
+     * \return The inter if it exists, or an empty polygon
+     */
+    [[nodiscard]] polygon inter_one_projected(const polygon& other) const;
 
     /**
      * \brief Transform boundary points to the new space
@@ -1,62 +1,231 @@
 #ifndef RGBDSLAM_UTILS_RANDOM_HPP
 #define RGBDSLAM_UTILS_RANDOM_HPP
 
-#include <Eigen/src/Core/Matrix.h>
+#include <Eigen/Core>
+#include <array>
 #include <cassert>
+#include <cmath>
+#include <cstdint>
 #include <ctime>
-#include <random>
+#include <numbers>
+#include <tuple>
 
 namespace rgbd_slam::utils {
 
 /**
- * \brief static class, to handle the random generation
+ * \brief Counter based random generator (PCG32, O'Neill 2014). A generator is a position in one of 2^63 streams: a
+ * task seeded with its own stream draws the same numbers, whatever the thread that runs it and the other tasks
+ */
+class Pcg32
+{
+  public:
+    using result_type = uint32_t;
+
+    constexpr Pcg32(const uint64_t seed, const uint64_t stream) noexcept : _state(0), _increment((stream << 1u) | 1u)
+    {
+        std::ignore = (*this)();
+        _state += seed;
+        std::ignore = (*this)();
+    }
+
+    [[nodiscard]] static constexpr result_type min() noexcept { return 0; }
+    [[nodiscard]] static constexpr result_type max() noexcept { return UINT32_MAX; }
+
+    constexpr result_type operator()() noexcept
+    {
+        const uint64_t oldState = _state;
+        _state = oldState * 6364136223846793005ULL + _increment;
+        const uint32_t xorShifted = static_cast<uint32_t>(((oldState >> 18u) ^ oldState) >> 27u);
+        const uint32_t rotation = static_cast<uint32_t>(oldState >> 59u);
+        return (xorShifted >> rotation) | (xorShifted << ((-rotation) & 31u));
+    }
+
+    /**
+     * \brief Jump ahead in the stream, in O(log(steps)) (Brown 1994): same state as drawing steps numbers
+     * \param[in] steps Number of draws to skip
+     */
+    constexpr void discard(uint64_t steps) noexcept
+    {
+        uint64_t multiplier = 6364136223846793005ULL;
+        uint64_t increment = _increment;
+        uint64_t accumulatedMultiplier = 1;
+        uint64_t accumulatedIncrement = 0;
+        while (steps > 0)
+        {
+            if ((steps & 1u) != 0)
+            {
+                accumulatedMultiplier *= multiplier;
+                accumulatedIncrement = accumulatedIncrement * multiplier + increment;
+            }
+            increment = (multiplier + 1) * increment;
+            multiplier *= multiplier;
+            steps >>= 1u;
+        }
+        _state = accumulatedMultiplier * _state + accumulatedIncrement;
+    }
+
+  private:
+    uint64_t _state;
+    uint64_t _increment;
+};
+
+/**
+ * \brief static class, to handle the random generation.
+ * Each thread draws from its own generator. The parallel tasks that draw random numbers use a Scoped_Stream keyed by
+ * their inputs (frame, task index, ...): the results do not depend on the scheduling, even in parallel
  */
 class Random
 {
   public:
-    [[nodiscard]] static std::mt19937& get_random_engine()
+    using Engine = Pcg32;
+
+  private:
+    /**
+     * \brief The generator of a thread. The normal draws come by pairs: the second one is cached
+     */
+    struct Thread_State
+    {
+        explicit Thread_State(const uint64_t stream) : _engine(_seed, stream) {}
+
+        Engine _engine;
+        double _cachedNormal = 0.0;
+        bool _hasCachedNormal = false;
+    };
+
+    [[nodiscard]] static Thread_State& get_thread_state()
     {
-        static thread_local std::mt19937 randomEngine(_seed);
-        return randomEngine;
+        static thread_local Thread_State state(0);
+        return state;
     }
 
     /**
-     * \brief Return a seeded random double between 0 and 1, around a uniform distribution
+     * \brief Mix a task key and index to a stream id (splitmix64 finalizer): close keys give unrelated streams
      */
-    [[nodiscard]] static double get_random_double()
+    [[nodiscard]] static constexpr uint64_t get_stream_id(const uint64_t key, const uint64_t taskId) noexcept
     {
-        thread_local std::uniform_real_distribution distribution(0.0, 1.0);
-        return distribution(get_random_engine());
+        uint64_t z = key * 0x9E3779B97F4A7C15ULL + taskId + 1;
+        z = (z ^ (z >> 30u)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27u)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31u);
     }
 
+    [[nodiscard]] static double get_uniform_double(Engine& engine) noexcept
+    {
+        const uint64_t high = engine() >> 5u; // 27 bits
+        const uint64_t low = engine() >> 6u;  // 26 bits
+        return static_cast<double>((high << 26u) | low) * 0x1.0p-53;
+    }
+
+    /**
+     * \brief Compute two independent normal doubles from two uniform numbers (Box-Muller)
+     */
+    [[nodiscard]] static std::array<double, 2> get_normal_pair(Engine& engine) noexcept
+    {
+        const double radius = std::sqrt(-2.0 * std::log(1.0 - get_uniform_double(engine)));
+        const double angle = 2.0 * std::numbers::pi * get_uniform_double(engine);
+        return {radius * std::cos(angle), radius * std::sin(angle)};
+    }
+
+  public:
+    [[nodiscard]] static Engine& get_random_engine() { return get_thread_state()._engine; }
+
+    /**
+     * \brief Return a seeded random double in [0, 1[, around a uniform distribution. Uses all the 53 bits of the
+     * mantissa. Does not depend on the standard library distributions: same numbers with all compilers
+     */
+    [[nodiscard]] static double get_random_double() { return get_uniform_double(get_random_engine()); }
+
     /**
-     * \brief Return a seeded random double between -1 and 1, around a normal distribution
+     * \brief Return a seeded random double around a normal distribution (mean 0, standard deviation 1)
      */
     [[nodiscard]] static double get_normal_double()
     {
-        thread_local std::normal_distribution distribution(0.0, 1.0);
-        return distribution(get_random_engine());
+        Thread_State& state = get_thread_state();
+        if (state._hasCachedNormal)
+        {
+            state._hasCachedNormal = false;
+            return state._cachedNormal;
+        }
+        const auto [first, second] = get_normal_pair(state._engine);
+        state._cachedNormal = second;
+        state._hasCachedNormal = true;
+        return first;
     }
 
+    /**
+     * \brief Return a vector of normal doubles (mean 0, standard deviation 1). The uniform numbers are drawn first,
+     * then transformed by pairs in one pass (Box-Muller), that the compiler can vectorize
+     */
     template<int Size> [[nodiscard]] static Eigen::Vector<double, Size> get_normal_doubles()
     {
-        Eigen::Vector<double, Size> vec;
-        for (uint i = 0; i < Size; ++i)
-            vec(i) = get_normal_double();
-        return vec;
+        static_assert(Size > 0);
+        constexpr int pairCount = (Size + 1) / 2;
+        Engine& engine = get_random_engine();
+
+        Eigen::Array<double, pairCount, 1> radius;
+        Eigen::Array<double, pairCount, 1> angle;
+        for (int i = 0; i < pairCount; ++i)
+        {
+            // in ]0, 1]: the log is finite
+            radius(i) = 1.0 - get_uniform_double(engine);
+            angle(i) = get_uniform_double(engine);
+        }
+        radius = (-2.0 * radius.log()).sqrt();
+        angle *= 2.0 * std::numbers::pi;
+
+        Eigen::Vector<double, 2 * pairCount> pairs;
+        pairs.template head<pairCount>() = radius * angle.cos();
+        pairs.template tail<pairCount>() = radius * angle.sin();
+        return pairs.template head<Size>();
     }
 
     /**
-     * \brief Return a random int in the [minValue, maxValue[ interval
+     * \brief Return a random int in the [minValue, maxValue[ interval, with no bias (Lemire 2019)
      */
     [[nodiscard]] static uint get_random_uint(const uint minValue, const uint maxValue)
     {
         assert(minValue < maxValue);
-        return minValue + static_cast<uint>(std::floor(get_random_double() * (maxValue - minValue)));
+        const uint32_t range = maxValue - minValue;
+        Engine& engine = get_random_engine();
+
+        // the high bits of engine() * range are uniform in [0, range[ once the low bits under the threshold are
+        // rejected, which is rare
+        uint64_t product = static_cast<uint64_t>(engine()) * range;
+        if (static_cast<uint32_t>(product) < range)
+        {
+            const uint32_t threshold = (0u - range) % range;
+            while (static_cast<uint32_t>(product) < threshold)
+                product = static_cast<uint64_t>(engine()) * range;
+        }
+        return minValue + static_cast<uint>(product >> 32u);
     }
 
     [[nodiscard]] static uint get_random_uint(const uint maxValue) { return get_random_uint(0, maxValue); }
 
+    /**
+     * \brief While in scope, the random numbers of this thread are drawn from the stream of a task, derived from the
+     * seed and the task key. The previous stream of the thread is restored at the end of the scope
+     */
+    class Scoped_Stream
+    {
+      public:
+        /**
+         * \param[in] key Identifies the parallel stage and its input (a frame id, a call count, ...)
+         * \param[in] taskId The index of the task in the stage
+         */
+        Scoped_Stream(const uint64_t key, const uint64_t taskId) : _previousState(get_thread_state())
+        {
+            get_thread_state() = Thread_State(get_stream_id(key, taskId));
+        }
+        ~Scoped_Stream() { get_thread_state() = _previousState; }
+
+        Scoped_Stream(const Scoped_Stream&) = delete;
+        Scoped_Stream& operator=(const Scoped_Stream&) = delete;
+
+      private:
+        const Thread_State _previousState;
+    };
+
 #ifndef MAKE_DETERMINISTIC
     inline static const uint _seed = std::time(0);
 #else
@@ -67,4 +236,4 @@ class Random
 
 } // namespace rgbd_slam::utils
 
-#endif
\ No newline at end of file
+#endif
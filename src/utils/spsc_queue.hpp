@@ -0,0 +1,116 @@
+#ifndef RGBDSLAM_UTILS_SPSC_QUEUE_HPP
+#define RGBDSLAM_UTILS_SPSC_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace rgbd_slam::utils {
+
+/**
+ * \brief A lock free FIFO ring with a fixed capacity, for one producer thread and one consumer thread.
+ * The producer never waits: a push on a full queue fails. The consumer can wait for new elements
+ */
+template<typename T> class Spsc_Queue
+{
+  public:
+    /**
+     * \param[in] capacity Maximum number of elements stored at the same time (> 0)
+     */
+    explicit Spsc_Queue(const size_t capacity) : _slots((capacity > 0 ? capacity : 1) + 1) {}
+
+    /**
+     * \brief Push a new element if there is space for it, without waiting. Producer thread only
+     * \param[in] value The element to push
+     * \return false if the queue was full or closed, and the element was discarded
+     */
+    [[nodiscard]] bool try_push(T&& value) noexcept
+    {
+        if (_isClosed.load(std::memory_order_acquire))
+            return false;
+
+        const size_t head = _head.load(std::memory_order_relaxed);
+        const size_t nextHead = (head + 1) % _slots.size();
+        if (nextHead == _tail.load(std::memory_order_acquire))
+            return false;
+
+        _slots[head] = std::move(value);
+        _head.store(nextHead, std::memory_order_release);
+        notify();
+        return true;
+    }
+
+    /**
+     * \brief Pop the oldest element if there is one, without waiting. Consumer thread only
+     * \param[out] value The popped element
+     * \return false if the queue was empty
+     */
+    [[nodiscard]] bool try_pop(T& value) noexcept
+    {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail == _head.load(std::memory_order_acquire))
+            return false;
+
+        // leave a moved from element in the slot: its resources are released now, not when the slot is reused
+        value = std::move(_slots[tail]);
+        _tail.store((tail + 1) % _slots.size(), std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * \brief Pop the oldest element, waiting for one if the queue is empty. Consumer thread only
+     * \param[out] value The popped element
+     * \return false if the queue is closed and empty: no more elements will come
+     */
+    [[nodiscard]] bool pop(T& value) noexcept
+    {
+        while (true)
+        {
+            // read the signal before testing the queue: a push after the test changes it, and the wait returns
+            const uint32_t signal = _signal.load(std::memory_order_acquire);
+            if (try_pop(value))
+                return true;
+            if (_isClosed.load(std::memory_order_acquire))
+                return try_pop(value);
+            _signal.wait(signal, std::memory_order_acquire);
+        }
+    }
+
+    /**
+     * \brief Refuse any new element, and wake the consumer. The elements already in the queue can still be popped
+     */
+    void close() noexcept
+    {
+        _isClosed.store(true, std::memory_order_release);
+        notify();
+    }
+
+    [[nodiscard]] size_t size() const noexcept
+    {
+        const size_t head = _head.load(std::memory_order_acquire);
+        const size_t tail = _tail.load(std::memory_order_acquire);
+        return (head + _slots.size() - tail) % _slots.size();
+    }
+
+    [[nodiscard]] size_t capacity() const noexcept { return _slots.size() - 1; }
+
+  private:
+    void notify() noexcept
+    {
+        _signal.fetch_add(1, std::memory_order_release);
+        _signal.notify_one();
+    }
+
+    // one more slot than the capacity: the ring is full when the head is just behind the tail
+    std::vector<T> _slots;
+    // on separate cache lines: the producer writes the head, the consumer writes the tail
+    alignas(64) std::atomic<size_t> _head = 0;
+    alignas(64) std::atomic<size_t> _tail = 0;
+    std::atomic<uint32_t> _signal = 0; // incremented by each push, waited on by the consumer
+    std::atomic<bool> _isClosed = false;
+};
+
+} // namespace rgbd_slam::utils
+
+#endif
@@ -0,0 +1,58 @@
+#include "task_scheduler.hpp"
+#include "../outputs/logger.hpp"
+#include "../parameters.hpp"
+#include <algorithm>
+#include <format>
+
+namespace rgbd_slam::utils {
+
+void Task_Scheduler::initialize(const uint threadCount) noexcept
+{
+    bool isCreated = false;
+    std::call_once(_initializationFlag, [threadCount, &isCreated]() {
+        create_arena(threadCount);
+        isCreated = true;
+    });
+    if (not isCreated and _arena->max_concurrency() != std::max(1, static_cast<int>(threadCount)))
+    {
+        outputs::log_warning(std::format("The task scheduler is already running with {} threads, {} were requested",
+                                         _arena->max_concurrency(),
+                                         threadCount));
+    }
+}
+
+void Task_Scheduler::create_arena(const uint threadCount) noexcept
+{
+    const int concurrency = std::max(1, static_cast<int>(threadCount));
+
+    // cap the TBB pool, for the parallel loops started outside of the arena (background threads)
+    _threadLimit = std::make_unique<tbb::global_control>(tbb::global_control::max_allowed_parallelism,
+                                                         static_cast<size_t>(concurrency));
+
+    tbb::task_arena::constraints arenaConstraints(tbb::task_arena::automatic, concurrency);
+#if __TBB_PREVIEW_TASK_ARENA_CONSTRAINTS_EXTENSION_PRESENT
+    if (parameters::maximumThreadsPerCore > 0)
+    {
+        // keep the threads on distinct cores (needs the TBB hwloc binding, ignored otherwise)
+        arenaConstraints.set_max_threads_per_core(static_cast<int>(parameters::maximumThreadsPerCore));
+    }
+#else
+    if (parameters::maximumThreadsPerCore > 0)
+        outputs::log_warning("This TBB version cannot limit the threads per core, the limit is ignored");
+#endif
+    _arena = std::make_unique<tbb::task_arena>(arenaConstraints);
+    _arena->initialize();
+
+    outputs::log(std::format("Task scheduler started with {} threads", _arena->max_concurrency()));
+}
+
+tbb::task_arena& Task_Scheduler::get_arena() noexcept
+{
+    // not initialized: use the configured core count
+    std::call_once(_initializationFlag, []() {
+        create_arena(Parameters::get_core_number());
+    });
+    return *_arena;
+}
+
+} // namespace rgbd_slam::utils
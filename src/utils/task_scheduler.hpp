@@ -0,0 +1,60 @@
+#ifndef RGBDSLAM_UTILS_TASKSCHEDULER_HPP
+#define RGBDSLAM_UTILS_TASKSCHEDULER_HPP
+
+#include <memory>
+#include <mutex>
+#include <tbb/global_control.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_group.h>
+#include <utility>
+
+namespace rgbd_slam::utils {
+
+/**
+ * \brief The work stealing scheduler shared by all the parallel stages of the program: a TBB arena of a fixed size.
+ * The tasks and parallel loops started inside execute run in this arena, and the size of the TBB thread pool is
+ * capped to it, so the stages do not compete for the cores with their own threads.
+ * It should be used as a static class everywhere in the program
+ */
+class Task_Scheduler
+{
+  public:
+    /**
+     * \brief Set the size of the scheduler. Only the first call creates it, before any task is submitted: the later
+     * calls (by other SLAM instances) keep the running scheduler
+     * \param[in] threadCount The number of threads running the tasks, including the threads calling execute
+     */
+    static void initialize(const uint threadCount) noexcept;
+
+    /**
+     * \brief Run a function in the scheduler: its tasks and parallel loops are run by the threads of the scheduler.
+     * Blocks until the function returns
+     * \param[in] function The function to run
+     * \return The result of the function
+     */
+    template<typename Function> static decltype(auto) execute(Function&& function)
+    {
+        return get_arena().execute(std::forward<Function>(function));
+    }
+
+    /**
+     * \return The number of threads of the scheduler
+     */
+    [[nodiscard]] static int get_thread_count() noexcept { return get_arena().max_concurrency(); }
+
+  private:
+    [[nodiscard]] static tbb::task_arena& get_arena() noexcept;
+
+    /**
+     * \brief Create the arena and the thread limit. Called once, under _initializationFlag
+     */
+    static void create_arena(const uint threadCount) noexcept;
+
+    inline static std::once_flag _initializationFlag;
+    inline static std::unique_ptr<tbb::task_arena> _arena = nullptr;
+    inline static std::unique_ptr<tbb::global_control> _threadLimit = nullptr;
+};
+
+} // namespace rgbd_slam::utils
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef RGBDSLAM_UTILS_UNION_FIND_HPP
+#define RGBDSLAM_UTILS_UNION_FIND_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace rgbd_slam::utils {
+
+/**
+ * \brief Merge the groups of adjacent elements with a union-find forest. The root of a group is always its lowest
+ * element index, so the groups always absorb the groups of higher index
+ * \param[in] elementCount The number of elements, each one starts in its own group
+ * \param[in] adjacencies The pairs of adjacent elements (lower index first), tested in this order
+ * \param[in] try_merge Called as try_merge(rootIndex, mergedIndex) with the roots of two adjacent groups, rootIndex
+ * being the lowest. Merges the second group in the first one if it returns true
+ * \return The root of the group of each element
+ */
+template<typename Index, typename MergeFunction>
+[[nodiscard]] std::vector<Index> merge_adjacent_groups(const Index elementCount,
+                                                       const std::vector<std::pair<Index, Index>>& adjacencies,
+                                                       MergeFunction&& try_merge)
+{
+    std::vector<Index> roots;
+    roots.reserve(elementCount);
+    for (Index elementIndex = 0; elementIndex < elementCount; ++elementIndex)
+        roots.emplace_back(elementIndex);
+
+    const auto find_root = [&roots](Index elementIndex) {
+        while (roots[elementIndex] != elementIndex)
+        {
+            // path halving
+            roots[elementIndex] = roots[roots[elementIndex]];
+            elementIndex = roots[elementIndex];
+        }
+        return elementIndex;
+    };
+
+    for (const auto& [elementIndex, neighbourIndex]: adjacencies)
+    {
+        assert(elementIndex < neighbourIndex);
+        assert(neighbourIndex < elementCount);
+
+        const Index elementRoot = find_root(elementIndex);
+        const Index neighbourRoot = find_root(neighbourIndex);
+        if (elementRoot == neighbourRoot)
+            continue;
+
+        const Index rootIndex = std::min(elementRoot, neighbourRoot);
+        const Index mergedIndex = std::max(elementRoot, neighbourRoot);
+        if (try_merge(rootIndex, mergedIndex))
+            roots[mergedIndex] = rootIndex;
+    }
+
+    // flatten the forest: each element is labelled with the index of its group root
+    for (Index elementIndex = 0; elementIndex < elementCount; ++elementIndex)
+        roots[elementIndex] = find_root(elementIndex);
+    return roots;
+}
+
+} // namespace rgbd_slam::utils
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef RGBDSLAM_UTILS_VALIDATION_HPP
+#define RGBDSLAM_UTILS_VALIDATION_HPP
+
+// level of the invariant checks compiled in the hot paths: 0 for none, 1 for the cheap checks only, 2 for all the
+// checks (matrix decompositions). Defaults to 1 in release builds (NDEBUG), 2 otherwise
+#ifndef RGBDSLAM_VALIDATION_LEVEL
+#ifdef NDEBUG
+#define RGBDSLAM_VALIDATION_LEVEL 1
+#else
+#define RGBDSLAM_VALIDATION_LEVEL 2
+#endif
+#endif
+
+namespace rgbd_slam::utils {
+
+enum class Validation_Level
+{
+    Off = 0,      // no checks: the invalid values propagate
+    Cheap = 1,    // linear time checks (finite values, symmetry, signs)
+    Paranoid = 2, // all the checks, including the decompositions
+};
+
+// the checks over this level are removed at compile time
+inline constexpr Validation_Level compiledValidationLevel = static_cast<Validation_Level>(RGBDSLAM_VALIDATION_LEVEL);
+
+/**
+ * \return true if the checks of this level are compiled
+ */
+[[nodiscard]] consteval bool is_validation_enabled(const Validation_Level level) noexcept
+{
+    return static_cast<int>(compiledValidationLevel) >= static_cast<int>(level);
+}
+
+} // namespace rgbd_slam::utils
+
+#endif
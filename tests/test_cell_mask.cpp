@@ -0,0 +1,207 @@
+#include <gtest/gtest.h>
+#include "features/primitives/cell_mask.hpp"
+
+#include <algorithm>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace rgbd_slam::features::primitives {
+
+/**
+ * \brief Naive reference of a cell mask: one boolean per cell
+ */
+struct Naive_Mask
+{
+    Naive_Mask(const uint width, const uint height) : _width(width), _height(height), _cells(width * height, false) {}
+
+    [[nodiscard]] bool is_set(const int x, const int y, const bool isOutsideSet = false) const
+    {
+        if (x < 0 or y < 0 or x >= static_cast<int>(_width) or y >= static_cast<int>(_height))
+            return isOutsideSet;
+        return _cells[static_cast<size_t>(y) * _width + static_cast<size_t>(x)];
+    }
+
+    /**
+     * \brief Set the cells when a function of their coordinates is true
+     */
+    template<typename Function> [[nodiscard]] Naive_Mask transform(Function&& function) const
+    {
+        Naive_Mask result(_width, _height);
+        for (uint y = 0; y < _height; ++y)
+            for (uint x = 0; x < _width; ++x)
+                result._cells[y * _width + x] = function(static_cast<int>(x), static_cast<int>(y));
+        return result;
+    }
+
+    uint _width;
+    uint _height;
+    std::vector<bool> _cells;
+};
+
+/**
+ * \brief A random mask and its reference, with a proportion of set cells
+ */
+std::pair<Cell_Mask, Naive_Mask> get_random_masks(const uint width,
+                                                  const uint height,
+                                                  const double setProportion,
+                                                  std::mt19937& randomEngine)
+{
+    std::bernoulli_distribution setDistribution(setProportion);
+    Cell_Mask mask(width, height);
+    Naive_Mask reference(width, height);
+    for (uint y = 0; y < height; ++y)
+        for (uint x = 0; x < width; ++x)
+            if (setDistribution(randomEngine))
+            {
+                mask.set(x, y);
+                reference._cells[y * width + x] = true;
+            }
+    return {mask, reference};
+}
+
+void expect_same_cells(const Cell_Mask& mask, const Naive_Mask& reference)
+{
+    ASSERT_EQ(mask.get_width(), reference._width);
+    ASSERT_EQ(mask.get_height(), reference._height);
+    uint setCellCount = 0;
+    for (uint y = 0; y < reference._height; ++y)
+        for (uint x = 0; x < reference._width; ++x)
+        {
+            const bool isSet = reference.is_set(static_cast<int>(x), static_cast<int>(y));
+            EXPECT_EQ(mask.is_set(x, y), isSet) << "cell " << x << ", " << y;
+            setCellCount += isSet ? 1 : 0;
+        }
+    EXPECT_EQ(mask.count(), setCellCount);
+    EXPECT_EQ(mask.empty(), setCellCount == 0);
+    EXPECT_EQ(mask.is_full(), setCellCount == reference._width * reference._height);
+
+    // the iteration visits the set cells in row order
+    std::vector<std::pair<uint, uint>> visitedCells;
+    mask.for_each_set_cell([&visitedCells](const uint x, const uint y) {
+        visitedCells.emplace_back(y, x);
+    });
+    EXPECT_TRUE(std::ranges::is_sorted(visitedCells));
+    EXPECT_EQ(visitedCells.size(), setCellCount);
+}
+
+// sizes around the word boundaries
+const std::vector<std::pair<uint, uint>> testSizes {{1, 1}, {5, 3}, {32, 24}, {63, 4}, {64, 5}, {65, 7}, {130, 3}};
+
+TEST(CellMaskTests, SetAndClear)
+{
+    Cell_Mask mask(70, 3);
+    EXPECT_TRUE(mask.empty());
+    mask.set(0, 0);
+    mask.set(63, 1);
+    mask.set(64, 1);
+    mask.set(69, 2);
+    EXPECT_EQ(mask.count(), 4u);
+    EXPECT_TRUE(mask.is_set(64, 1));
+    EXPECT_FALSE(mask.is_set(65, 1));
+
+    mask.clear();
+    EXPECT_TRUE(mask.empty());
+    EXPECT_EQ(mask.get_width(), 70u);
+
+    for (uint y = 0; y < 3; ++y)
+        for (uint x = 0; x < 70; ++x)
+            mask.set(x, y);
+    EXPECT_TRUE(mask.is_full());
+}
+
+TEST(CellMaskTests, RectangleCount)
+{
+    std::mt19937 randomEngine(1000);
+    for (const auto& [width, height]: testSizes)
+    {
+        const auto& [mask, reference] = get_random_masks(width, height, 0.5, randomEngine);
+        std::uniform_int_distribution<int> xDistribution(-3, static_cast<int>(width) + 3);
+        std::uniform_int_distribution<int> yDistribution(-3, static_cast<int>(height) + 3);
+        for (uint test = 0; test < 200; ++test)
+        {
+            // rectangles clipped by the mask, and empty rectangles
+            const int x = xDistribution(randomEngine);
+            const int y = yDistribution(randomEngine);
+            const cv::Rect cells(x, y, std::max(0, xDistribution(randomEngine) - x), yDistribution(randomEngine) / 2);
+
+            uint setCellCount = 0;
+            for (int cellY = cells.y; cellY < cells.y + cells.height; ++cellY)
+                for (int cellX = cells.x; cellX < cells.x + cells.width; ++cellX)
+                    setCellCount += reference.is_set(cellX, cellY) ? 1 : 0;
+            EXPECT_EQ(mask.count(cells), setCellCount);
+        }
+        EXPECT_EQ(mask.count(cv::Rect(0, 0, static_cast<int>(width), static_cast<int>(height))), mask.count());
+    }
+}
+
+TEST(CellMaskTests, SetOperations)
+{
+    std::mt19937 randomEngine(1000);
+    for (const auto& [width, height]: testSizes)
+    {
+        const auto& [first, firstReference] = get_random_masks(width, height, 0.5, randomEngine);
+        const auto& [second, secondReference] = get_random_masks(width, height, 0.5, randomEngine);
+
+        Cell_Mask unionMask = first;
+        unionMask |= second;
+        expect_same_cells(unionMask, firstReference.transform([&](const int x, const int y) {
+            return firstReference.is_set(x, y) or secondReference.is_set(x, y);
+        }));
+
+        Cell_Mask intersectionMask = first;
+        intersectionMask &= second;
+        expect_same_cells(intersectionMask, firstReference.transform([&](const int x, const int y) {
+            return firstReference.is_set(x, y) and secondReference.is_set(x, y);
+        }));
+
+        Cell_Mask differenceMask = first;
+        differenceMask -= second;
+        expect_same_cells(differenceMask, firstReference.transform([&](const int x, const int y) {
+            return firstReference.is_set(x, y) and not secondReference.is_set(x, y);
+        }));
+    }
+}
+
+TEST(CellMaskTests, Morphology)
+{
+    std::mt19937 randomEngine(1000);
+    for (const auto& [width, height]: testSizes)
+    {
+        // dense masks for the erosions, sparse masks for the dilations
+        for (const double setProportion: {0.1, 0.5, 0.9, 1.0})
+        {
+            const auto& [mask, reference] = get_random_masks(width, height, setProportion, randomEngine);
+            // the output buffers are reused, with another size
+            Cell_Mask result(3, 2);
+            result.set(1, 1);
+
+            for (const bool isOutsideSet: {false, true})
+            {
+                mask.erode_cross(result, isOutsideSet);
+                expect_same_cells(result, reference.transform([&](const int x, const int y) {
+                    return reference.is_set(x, y) and reference.is_set(x - 1, y, isOutsideSet) and
+                           reference.is_set(x + 1, y, isOutsideSet) and reference.is_set(x, y - 1, isOutsideSet) and
+                           reference.is_set(x, y + 1, isOutsideSet);
+                }));
+            }
+
+            mask.dilate_cross(result);
+            expect_same_cells(result, reference.transform([&](const int x, const int y) {
+                return reference.is_set(x, y) or reference.is_set(x - 1, y) or reference.is_set(x + 1, y) or
+                       reference.is_set(x, y - 1) or reference.is_set(x, y + 1);
+            }));
+
+            mask.dilate_square(result);
+            expect_same_cells(result, reference.transform([&](const int x, const int y) {
+                for (int dy = -1; dy <= 1; ++dy)
+                    for (int dx = -1; dx <= 1; ++dx)
+                        if (reference.is_set(x + dx, y + dy))
+                            return true;
+                return false;
+            }));
+        }
+    }
+}
+
+} // namespace rgbd_slam::features::primitives
@@ -657,7 +657,7 @@ TEST(InverseDepthPointFusion, centerPointParallelFusion)
     const tracking::PointInverseDepth::Covariance& beforeMergeInverseCov = inverseDepth._covariance;
     const WorldCoordinateCovariance& beforeMergeCovariance =
             tracking::PointInverseDepth::compute_cartesian_covariance(beforeMergeInverseCov, toCartesianJacobian);
-    EXPECT_TRUE(utils::is_covariance_valid(beforeMergeInverseCov));
+    EXPECT_TRUE(beforeMergeInverseCov.is_valid());
     EXPECT_TRUE(utils::is_covariance_valid(beforeMergeCovariance));
 
     EXPECT_GT(beforeMergeCovariance(0, 0),
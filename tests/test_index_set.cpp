@@ -0,0 +1,128 @@
+#include <gtest/gtest.h>
+#include "utils/index_set.hpp"
+
+#include <algorithm>
+#include <random>
+#include <set>
+#include <vector>
+
+namespace rgbd_slam::utils {
+
+/**
+ * \brief Check that an index set contains exactly the indexes of a reference set
+ */
+void expect_same_indexes(const Index_Set& indexSet, const std::set<size_t>& reference)
+{
+    EXPECT_EQ(indexSet.size(), reference.size());
+    EXPECT_EQ(indexSet.empty(), reference.empty());
+
+    // the iteration order is not specified
+    std::vector<size_t> iteratedIndexes(indexSet.begin(), indexSet.end());
+    std::ranges::sort(iteratedIndexes);
+    EXPECT_TRUE(std::ranges::equal(iteratedIndexes, reference));
+
+    for (const size_t index: reference)
+        EXPECT_TRUE(indexSet.contains(index));
+}
+
+TEST(IndexSetTests, InlineStorage)
+{
+    Index_Set indexSet;
+    EXPECT_TRUE(indexSet.empty());
+    EXPECT_EQ(indexSet.begin(), indexSet.end());
+
+    EXPECT_TRUE(indexSet.emplace(12));
+    EXPECT_FALSE(indexSet.emplace(12));
+    EXPECT_TRUE(indexSet.insert(3));
+    expect_same_indexes(indexSet, {3, 12});
+    EXPECT_FALSE(indexSet.contains(4));
+
+    indexSet.erase(12);
+    expect_same_indexes(indexSet, {3});
+    // erasing an absent index does nothing
+    indexSet.erase(12);
+    expect_same_indexes(indexSet, {3});
+
+    indexSet.clear();
+    expect_same_indexes(indexSet, {});
+}
+
+TEST(IndexSetTests, SwitchToBitset)
+{
+    Index_Set indexSet;
+    std::set<size_t> reference;
+    // more indexes than the inline storage, on several bitset words
+    for (const size_t index: {5u, 700u, 64u, 63u, 0u, 128u})
+    {
+        EXPECT_TRUE(indexSet.emplace(index));
+        reference.insert(index);
+        expect_same_indexes(indexSet, reference);
+    }
+    EXPECT_FALSE(indexSet.emplace(700));
+    EXPECT_FALSE(indexSet.contains(701));
+    EXPECT_FALSE(indexSet.contains(100000));
+
+    indexSet.erase(700);
+    indexSet.erase(0);
+    reference.erase(700);
+    reference.erase(0);
+    expect_same_indexes(indexSet, reference);
+
+    // a cleared set goes back to the inline storage
+    indexSet.clear();
+    expect_same_indexes(indexSet, {});
+    EXPECT_TRUE(indexSet.emplace(700));
+    expect_same_indexes(indexSet, {700});
+}
+
+TEST(IndexSetTests, InsertAndMerge)
+{
+    const std::vector<size_t> indexes {4, 1, 4, 90};
+    Index_Set indexSet;
+    indexSet.insert(indexes.cbegin(), indexes.cend());
+    expect_same_indexes(indexSet, {1, 4, 90});
+
+    Index_Set otherSet;
+    otherSet.emplace(90);
+    otherSet.emplace(2);
+    indexSet.merge(otherSet);
+    expect_same_indexes(indexSet, {1, 2, 4, 90});
+    expect_same_indexes(otherSet, {2, 90});
+}
+
+TEST(IndexSetTests, RandomOperations)
+{
+    std::mt19937 randomEngine(1000);
+    std::uniform_int_distribution<size_t> operationDistribution(0, 9);
+
+    for (const size_t maximumIndex: {3u, 20u, 300u})
+    {
+        std::uniform_int_distribution<size_t> indexDistribution(0, maximumIndex);
+        Index_Set indexSet;
+        std::set<size_t> reference;
+        for (uint i = 0; i < 2000; ++i)
+        {
+            const size_t index = indexDistribution(randomEngine);
+            const size_t operation = operationDistribution(randomEngine);
+            if (operation < 6)
+            {
+                EXPECT_EQ(indexSet.emplace(index), reference.insert(index).second);
+            }
+            else if (operation < 9)
+            {
+                indexSet.erase(index);
+                reference.erase(index);
+            }
+            else if (indexDistribution(randomEngine) == 0)
+            {
+                indexSet.clear();
+                reference.clear();
+            }
+            EXPECT_EQ(indexSet.contains(index), reference.contains(index));
+            EXPECT_EQ(indexSet.size(), reference.size());
+        }
+        expect_same_indexes(indexSet, reference);
+    }
+}
+
+} // namespace rgbd_slam::utils
@@ -679,4 +679,34 @@ TEST(KalmanFilteringTests, 1DProjectileParabolaWithNoise)
     // estimate end state position
     EXPECT_NEAR(measurements.back(), kf.get_state().x(), 0.15);
 }
+
+/**
+ * \brief Fuse a measurement of a static state measured directly: the map feature filters. The result is the
+ * information weighted mean of the state and the measurement
+ */
+template<int N> void check_static_state_fusion()
+{
+    const Eigen::Matrix<double, N, N>& identity = Eigen::Matrix<double, N, N>::Identity();
+    const SharedKalmanFilter<N, N> kf(identity, identity, Eigen::Matrix<double, N, N>::Zero());
+
+    const Eigen::Matrix<double, N, N> base = Eigen::Matrix<double, N, N>::Random();
+    const Eigen::Matrix<double, N, N> stateCovariance = base * base.transpose() + identity;
+    const Eigen::Matrix<double, N, N> measurementCovariance = base.transpose() * base + identity * 0.5;
+    const Eigen::Vector<double, N> state = Eigen::Vector<double, N>::Random();
+    const Eigen::Vector<double, N> measurement = Eigen::Vector<double, N>::Random();
+
+    const auto& [newState, newCovariance] =
+            kf.get_new_state(state, stateCovariance, measurement, measurementCovariance);
+
+    const Eigen::Matrix<double, N, N> expectedCovariance =
+            (stateCovariance.inverse() + measurementCovariance.inverse()).inverse();
+    const Eigen::Vector<double, N> expectedState =
+            expectedCovariance * (stateCovariance.inverse() * state + measurementCovariance.inverse() * measurement);
+    EXPECT_TRUE(newCovariance.isApprox(expectedCovariance, 1e-9));
+    EXPECT_TRUE(newState.isApprox(expectedState, 1e-9));
+}
+
+TEST(KalmanFilteringTests, StaticPointFusion) { check_static_state_fusion<3>(); }
+
+TEST(KalmanFilteringTests, StaticPlaneFusion) { check_static_state_fusion<4>(); }
 } // namespace rgbd_slam::tracking
\ No newline at end of file
@@ -0,0 +1,180 @@
+#include <gtest/gtest.h>
+#include "map_management/map_delta.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+namespace rgbd_slam::map_management {
+
+/**
+ * \brief A point with values that are exact in float, so that they survive the encoding
+ */
+Map_Snapshot::Point get_test_point(const size_t id, const bool isInverseDepth = false)
+{
+    const double value = static_cast<double>(id);
+    matrix33 covariance;
+    covariance << value, 0.5, 0.25, 0.5, value + 1.0, -0.75, 0.25, -0.75, value + 2.0;
+    return Map_Snapshot::Point {id, vector3(value, -value * 2.0, 1000.0 + value), covariance, isInverseDepth};
+}
+
+Map_Snapshot::Plane get_test_plane(const size_t id, const size_t boundarySize)
+{
+    const double value = static_cast<double>(id);
+    matrix44 covariance = matrix44::Identity() * value;
+    covariance(0, 3) = covariance(3, 0) = 0.125;
+    std::vector<vector3> boundary;
+    for (size_t i = 0; i < boundarySize; ++i)
+        boundary.emplace_back(static_cast<double>(i), value, -static_cast<double>(i) * 0.5);
+    return Map_Snapshot::Plane {id, vector4(0.0, 0.0, 1.0, -value), covariance, boundary};
+}
+
+void expect_same_points(const std::vector<Map_Snapshot::Point>& points,
+                        const std::vector<Map_Snapshot::Point>& expectedPoints)
+{
+    ASSERT_EQ(points.size(), expectedPoints.size());
+    for (size_t i = 0; i < points.size(); ++i)
+    {
+        EXPECT_EQ(points[i]._id, expectedPoints[i]._id);
+        EXPECT_EQ(points[i]._coordinates, expectedPoints[i]._coordinates);
+        EXPECT_EQ(points[i]._covariance, expectedPoints[i]._covariance);
+        EXPECT_EQ(points[i]._isInverseDepth, expectedPoints[i]._isInverseDepth);
+    }
+}
+
+void expect_same_planes(const std::vector<Map_Snapshot::Plane>& planes,
+                        const std::vector<Map_Snapshot::Plane>& expectedPlanes)
+{
+    ASSERT_EQ(planes.size(), expectedPlanes.size());
+    for (size_t i = 0; i < planes.size(); ++i)
+    {
+        EXPECT_EQ(planes[i]._id, expectedPlanes[i]._id);
+        EXPECT_EQ(planes[i]._parametrization, expectedPlanes[i]._parametrization);
+        EXPECT_EQ(planes[i]._covariance, expectedPlanes[i]._covariance);
+        EXPECT_EQ(planes[i]._boundary, expectedPlanes[i]._boundary);
+    }
+}
+
+void expect_same_delta(const Map_Delta& delta, const Map_Delta& expectedDelta)
+{
+    EXPECT_EQ(delta._sequenceIndex, expectedDelta._sequenceIndex);
+    EXPECT_EQ(delta._detectedFeatureId, expectedDelta._detectedFeatureId);
+    EXPECT_EQ(delta._isFullState, expectedDelta._isFullState);
+    expect_same_points(delta._addedPoints, expectedDelta._addedPoints);
+    expect_same_points(delta._updatedPoints, expectedDelta._updatedPoints);
+    expect_same_planes(delta._addedPlanes, expectedDelta._addedPlanes);
+    expect_same_planes(delta._updatedPlanes, expectedDelta._updatedPlanes);
+    EXPECT_EQ(delta._removedIds, expectedDelta._removedIds);
+    ASSERT_EQ(delta._upgrades.size(), expectedDelta._upgrades.size());
+    for (size_t i = 0; i < delta._upgrades.size(); ++i)
+    {
+        EXPECT_EQ(delta._upgrades[i]._sourceId, expectedDelta._upgrades[i]._sourceId);
+        EXPECT_EQ(delta._upgrades[i]._upgradedId, expectedDelta._upgrades[i]._upgradedId);
+    }
+}
+
+Map_Delta get_test_delta()
+{
+    Map_Delta delta;
+    delta._sequenceIndex = 12;
+    delta._detectedFeatureId = 345;
+    delta._isFullState = true;
+    delta._addedPoints = {get_test_point(1), get_test_point(2, true), get_test_point(3)};
+    delta._updatedPoints = {get_test_point(4)};
+    // an empty boundary, and a large one
+    delta._addedPlanes = {get_test_plane(5, 0), get_test_plane(6, 40)};
+    delta._updatedPlanes = {get_test_plane(7, 4)};
+    delta._removedIds = {8, 9, 10};
+    delta._upgrades = {{9, 11}};
+    return delta;
+}
+
+TEST(MapDeltaTests, RoundTrip)
+{
+    const Map_Delta& delta = get_test_delta();
+    std::vector<std::byte> message;
+    encode_map_delta(delta, message);
+
+    // decode in a delta that already has records: they are replaced
+    Map_Delta decodedDelta;
+    decodedDelta._addedPoints.emplace_back(get_test_point(100));
+    decodedDelta._removedIds.emplace_back(100);
+    ASSERT_TRUE(decode_map_delta(message, decodedDelta));
+    expect_same_delta(decodedDelta, delta);
+
+    // the message buffer is reused
+    const Map_Delta emptyDelta;
+    encode_map_delta(emptyDelta, message);
+    ASSERT_TRUE(decode_map_delta(message, decodedDelta));
+    expect_same_delta(decodedDelta, emptyDelta);
+    EXPECT_TRUE(decodedDelta.empty());
+}
+
+TEST(MapDeltaTests, ComputedDeltaRoundTrip)
+{
+    Map_Snapshot previous;
+    previous._points = {get_test_point(1), get_test_point(2), get_test_point(3)};
+    previous._planes = {get_test_plane(4, 3)};
+
+    Map_Snapshot current;
+    current._detectedFeatureId = 20;
+    current._points = {get_test_point(1), get_test_point(3), get_test_point(5)};
+    current._points[1]._coordinates.x() += 8.0;
+    current._planes = {get_test_plane(4, 3), get_test_plane(6, 5)};
+
+    Map_Delta delta;
+    compute_map_delta(&previous, current, delta);
+    EXPECT_EQ(delta._addedPoints.size(), 1u);
+    EXPECT_EQ(delta._updatedPoints.size(), 1u);
+    EXPECT_EQ(delta._addedPlanes.size(), 1u);
+    EXPECT_TRUE(delta._updatedPlanes.empty());
+    EXPECT_EQ(delta._removedIds, std::vector<size_t>({2}));
+    std::vector<std::byte> message;
+    encode_map_delta(delta, message);
+    Map_Delta decodedDelta;
+    ASSERT_TRUE(decode_map_delta(message, decodedDelta));
+    expect_same_delta(decodedDelta, delta);
+
+    // from an empty map
+    compute_map_delta(nullptr, current, delta);
+    encode_map_delta(delta, message);
+    ASSERT_TRUE(decode_map_delta(message, decodedDelta));
+    expect_same_delta(decodedDelta, delta);
+}
+
+TEST(MapDeltaTests, InvalidMessages)
+{
+    std::vector<std::byte> message;
+    encode_map_delta(get_test_delta(), message);
+    Map_Delta decodedDelta;
+
+    // all the truncated messages are rejected
+    for (size_t size = 0; size < message.size(); ++size)
+        EXPECT_FALSE(decode_map_delta(std::span<const std::byte>(message.data(), size), decodedDelta));
+
+    // as a message with trailing bytes
+    std::vector<std::byte> longerMessage = message;
+    longerMessage.emplace_back(std::byte {0});
+    EXPECT_FALSE(decode_map_delta(longerMessage, decodedDelta));
+
+    // and a message of another format version
+    std::vector<std::byte> otherVersionMessage = message;
+    const uint32_t otherVersion = mapDeltaFormatVersion + 1;
+    std::memcpy(otherVersionMessage.data(), &otherVersion, sizeof(otherVersion));
+    EXPECT_FALSE(decode_map_delta(otherVersionMessage, decodedDelta));
+
+    // a boundary size larger than the message does not allocate it
+    std::vector<std::byte> largeBoundaryMessage;
+    Map_Delta planeDelta;
+    planeDelta._addedPlanes = {get_test_plane(1, 2)};
+    encode_map_delta(planeDelta, largeBoundaryMessage);
+    const uint32_t largeBoundarySize = 0xFFFFFFFF;
+    const size_t boundarySizeOffset = largeBoundaryMessage.size() - 2 * 3 * sizeof(float) - sizeof(uint32_t);
+    std::memcpy(largeBoundaryMessage.data() + boundarySizeOffset, &largeBoundarySize, sizeof(largeBoundarySize));
+    EXPECT_FALSE(decode_map_delta(largeBoundaryMessage, decodedDelta));
+
+    // the original message is still valid
+    EXPECT_TRUE(decode_map_delta(message, decodedDelta));
+}
+
+} // namespace rgbd_slam::map_management
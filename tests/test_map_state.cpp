@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+#include "map_management/map_features/map_point.hpp"
+#include "map_management/map_state_file.hpp"
+#include "parameters.hpp"
+
+#include <filesystem>
+#include <map>
+#include <vector>
+
+namespace rgbd_slam::map_management {
+
+/**
+ * \brief A point map that exposes its storage to the tests
+ */
+class Test_Point_Map : public localPointMap
+{
+  public:
+    using localPointMap::add_to_local_map;
+    using localPointMap::add_to_staged_map;
+    using localPointMap::get_local_map;
+    using localPointMap::get_staged_map;
+    using localPointMap::store_lost_feature;
+};
+
+/**
+ * \brief A descriptor specific to a map point id
+ */
+cv::Mat get_test_descriptor(const size_t id)
+{
+    cv::Mat descriptor(1, tracking::Descriptor_Pool::descriptorSize, CV_8U);
+    for (int i = 0; i < descriptor.cols; ++i)
+        descriptor.at<uchar>(0, i) = static_cast<uchar>(id * 7 + static_cast<size_t>(i));
+    return descriptor;
+}
+
+WorldCoordinate get_test_coordinates(const size_t id)
+{
+    return WorldCoordinate(static_cast<double>(id) * 10.0, -5.0, 1000.0 + static_cast<double>(id));
+}
+
+WorldCoordinateCovariance get_test_covariance(const size_t id)
+{
+    WorldCoordinateCovariance covariance;
+    covariance.setIdentity();
+    covariance.diagonal() *= static_cast<double>(id);
+    return covariance;
+}
+
+/**
+ * \brief The coordinates of the features of a map, by id
+ */
+template<typename Map> std::map<size_t, vector3> get_coordinates_by_id(const Map& map)
+{
+    std::map<size_t, vector3> coordinatesById;
+    for (const auto& [id, feature]: map)
+        coordinatesById.emplace(id, feature._coordinates);
+    return coordinatesById;
+}
+
+/**
+ * \brief Write the points of a map to a map state file, and read them back in another map
+ */
+size_t save_and_restore(const Test_Point_Map& savedMap, Test_Point_Map& restoredMap)
+{
+    const std::filesystem::path filePath = std::filesystem::temp_directory_path() / "test_map_state.rgbdstate";
+    {
+        Map_State_Writer writer(filePath.string());
+        EXPECT_TRUE(writer.is_valid());
+        savedMap.write_state(writer);
+        EXPECT_TRUE(writer.close());
+    }
+
+    const Map_State_Reader reader(filePath.string());
+    EXPECT_TRUE(reader.is_valid());
+    // the map is replaced, as in Local_Map::read_state
+    restoredMap.reset();
+    const size_t restoredCount = restoredMap.read_state(reader);
+    std::filesystem::remove(filePath);
+    return restoredCount;
+}
+
+TEST(MapStateTests, PointMapRoundTrip)
+{
+    if (not Parameters::is_valid())
+    {
+        Parameters::load_defaut();
+    }
+
+    Test_Point_Map savedMap;
+    for (size_t id = 1; id <= 20; ++id)
+        savedMap.add_to_local_map(
+                LocalMapPoint(get_test_coordinates(id), get_test_covariance(id), get_test_descriptor(id), id));
+    for (size_t id = 21; id <= 25; ++id)
+        savedMap.add_to_staged_map(
+                StagedMapPoint(get_test_coordinates(id), get_test_covariance(id), get_test_descriptor(id), id));
+    // lost points, in the tile store
+    for (size_t id = 26; id <= 30; ++id)
+        savedMap.store_lost_feature(
+                LocalMapPoint(get_test_coordinates(id), get_test_covariance(id), get_test_descriptor(id), id));
+
+    // restore in a map that already has features: they are replaced
+    Test_Point_Map restoredMap;
+    restoredMap.add_to_local_map(
+            LocalMapPoint(get_test_coordinates(100), get_test_covariance(100), get_test_descriptor(100), 100));
+
+    EXPECT_EQ(save_and_restore(savedMap, restoredMap), 30u);
+    EXPECT_EQ(restoredMap.get_local_map_size(), savedMap.get_local_map_size());
+    EXPECT_EQ(restoredMap.get_staged_map_size(), savedMap.get_staged_map_size());
+
+    // same ids, same coordinates
+    EXPECT_EQ(get_coordinates_by_id(restoredMap.get_local_map()), get_coordinates_by_id(savedMap.get_local_map()));
+    EXPECT_EQ(get_coordinates_by_id(restoredMap.get_staged_map()), get_coordinates_by_id(savedMap.get_staged_map()));
+
+    for (const auto& [id, mapPoint]: restoredMap.get_local_map())
+    {
+        EXPECT_EQ(cv::norm(mapPoint._descriptor.get(), get_test_descriptor(id), cv::NORM_HAMMING), 0.0);
+        EXPECT_TRUE(mapPoint._covariance.isApprox(get_test_covariance(id)));
+    }
+
+    // a second round trip gives the same map, with the restored lost points
+    Test_Point_Map secondMap;
+    EXPECT_EQ(save_and_restore(restoredMap, secondMap), 30u);
+    EXPECT_EQ(get_coordinates_by_id(secondMap.get_local_map()), get_coordinates_by_id(savedMap.get_local_map()));
+    EXPECT_EQ(get_coordinates_by_id(secondMap.get_staged_map()), get_coordinates_by_id(savedMap.get_staged_map()));
+}
+
+TEST(MapStateTests, EmptyMapRoundTrip)
+{
+    if (not Parameters::is_valid())
+    {
+        Parameters::load_defaut();
+    }
+
+    const Test_Point_Map savedMap;
+    Test_Point_Map restoredMap;
+    restoredMap.add_to_local_map(
+            LocalMapPoint(get_test_coordinates(1), get_test_covariance(1), get_test_descriptor(1), 1));
+
+    EXPECT_EQ(save_and_restore(savedMap, restoredMap), 0u);
+    EXPECT_EQ(restoredMap.size(), 0u);
+}
+
+} // namespace rgbd_slam::map_management
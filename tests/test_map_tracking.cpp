@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+#include "map_management/map_features/map_point.hpp"
+#include "parameters.hpp"
+#include "tracking/descriptor_pool.hpp"
+
+#include <vector>
+
+namespace rgbd_slam::map_management {
+
+/**
+ * \brief A point map that exposes its matching steps to the tests
+ */
+class Test_Point_Map : public localPointMap
+{
+  public:
+    using localPointMap::add_to_local_map;
+    using localPointMap::get_local_map;
+    using localPointMap::get_matches;
+};
+
+/**
+ * \brief Some detected keypoints, never described by the tests
+ */
+features::keypoints::Keypoint_Handler get_test_keypoints(const size_t keypointCount)
+{
+    constexpr uint imageCols = 640;
+    constexpr uint imageRows = 480;
+    std::vector<cv::Point2f> keypoints;
+    for (size_t i = 0; i < keypointCount; ++i)
+        keypoints.emplace_back(10.0f + static_cast<float>(i) * 20.0f, 100.0f);
+
+    features::keypoints::Keypoint_Handler detectedKeypoints(imageCols, imageRows);
+    detectedKeypoints.set(keypoints,
+                          features::keypoints::KeypointsWithIdStruct(),
+                          cv::Mat_<float>(imageRows, imageCols, 1000.0f),
+                          [](std::vector<cv::KeyPoint>&, cv::Mat&) {
+                          },
+                          tracking::Descriptor_Pool::descriptorSize);
+    return detectedKeypoints;
+}
+
+/**
+ * \brief A local map point matched to a detected keypoint
+ */
+LocalMapPoint get_matched_point(const size_t id, const size_t detectedKeypointIndex)
+{
+    cv::Mat descriptor(1, tracking::Descriptor_Pool::descriptorSize, CV_8U, cv::Scalar(static_cast<uchar>(id)));
+    WorldCoordinateCovariance covariance;
+    covariance.setIdentity();
+    LocalMapPoint mapPoint(WorldCoordinate(static_cast<double>(id) * 10.0, -5.0, 1000.0), covariance, descriptor, id);
+
+    matchIndexSet matchIndexes;
+    matchIndexes.insert(detectedKeypointIndex);
+    mapPoint.mark_matched(matchIndexes);
+    return mapPoint;
+}
+
+TEST(MapTrackingTests, NonKeyframeOutliersAreNotTracked)
+{
+    if (not Parameters::is_valid())
+    {
+        Parameters::load_defaut();
+    }
+
+    constexpr size_t pointCount = 3;
+    const features::keypoints::Keypoint_Handler& detectedKeypoints = get_test_keypoints(pointCount);
+
+    // match the detected keypoints of a frame to the points of an empty map, then add the matched points
+    Test_Point_Map map;
+    matches_containers::match_container matches;
+    WorldToCameraMatrix worldToCamera;
+    worldToCamera.setIdentity();
+    map.get_matches(detectedKeypoints, worldToCamera, false, 1, matches);
+    EXPECT_TRUE(matches.empty());
+    for (size_t id = 1; id <= pointCount; ++id)
+        map.add_to_local_map(get_matched_point(id, id - 1));
+    EXPECT_EQ(map.get_tracked_count(), pointCount);
+
+    // the pose optimization of a non keyframe rejects the match of the second point
+    const LocalMapPoint& outlierPoint = map.get_local_map().at(2);
+    matches_containers::match_container outliers;
+    outliers.push_back(matches_containers::make_feature<PointOptimizationFeature>(
+            detectedKeypoints.get_keypoint(1).get_2D(), outlierPoint._coordinates, vector3::Ones(), 2, 1));
+    map.update_tracking_only(outliers);
+
+    EXPECT_FALSE(map.get_local_map().at(2).is_matched());
+    EXPECT_TRUE(map.get_local_map().at(1).is_matched());
+    EXPECT_TRUE(map.get_local_map().at(3).is_matched());
+    EXPECT_EQ(map.get_tracked_count(), pointCount - 1);
+
+    // the next non keyframe without outliers still does not track it
+    map.update_tracking_only(matches_containers::match_container());
+    EXPECT_EQ(map.get_tracked_count(), pointCount - 1);
+}
+
+} // namespace rgbd_slam::map_management
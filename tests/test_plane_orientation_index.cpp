@@ -0,0 +1,144 @@
+#include <gtest/gtest.h>
+#include "features/primitives/shape_primitives.hpp"
+#include "parameters.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace rgbd_slam::features::primitives {
+
+/**
+ * \brief Same conditions as Plane::is_normal_similar and Plane::is_distance_similar
+ */
+bool is_plane_similar(const PlaneCameraCoordinates& plane, const PlaneCameraCoordinates& other)
+{
+    static const double minimumNormalDotDiff =
+            abs(cos(parameters::matching::maximumAngleForPlaneMatch_d * M_PI / 180.0));
+    return abs(plane.get_cos_angle(other)) > minimumNormalDotDiff and
+           abs(plane.get_d() - other.get_d()) < parameters::matching::maximumDistanceForPlaneMatch_mm;
+}
+
+/**
+ * \brief Exhaustive reference: the indexes of all the planes similar to a plane, in increasing order
+ */
+std::vector<size_t> get_similar_planes(const tracked_plane_container& planes, const PlaneCameraCoordinates& plane)
+{
+    std::vector<size_t> similarPlanes;
+    for (size_t planeIndex = 0; planeIndex < planes.size(); ++planeIndex)
+    {
+        if (is_plane_similar(planes[planeIndex], plane))
+            similarPlanes.push_back(planeIndex);
+    }
+    return similarPlanes;
+}
+
+/**
+ * \brief A plane of random normal (around a direction if spread is low) and random offset
+ */
+PlaneCameraCoordinates get_random_plane(const vector3& direction,
+                                        const double spread,
+                                        const double maximumOffset,
+                                        std::mt19937& randomEngine)
+{
+    std::normal_distribution<double> normalDistribution(0.0, spread);
+    std::uniform_real_distribution<double> offsetDistribution(-maximumOffset, maximumOffset);
+    const vector3 normal(direction.x() + normalDistribution(randomEngine),
+                         direction.y() + normalDistribution(randomEngine),
+                         direction.z() + normalDistribution(randomEngine));
+    return PlaneCameraCoordinates(normal, offsetDistribution(randomEngine));
+}
+
+/**
+ * \brief Check the index candidates of some query planes against the exhaustive search
+ */
+void expect_same_as_exhaustive_search(const tracked_plane_container& planes, const tracked_plane_container& queries)
+{
+    const Plane_Orientation_Index index(planes);
+    std::vector<size_t> candidates;
+    for (const PlaneCameraCoordinates& query: queries)
+    {
+        index.get_candidates(query, candidates);
+        EXPECT_TRUE(std::ranges::is_sorted(candidates));
+        EXPECT_EQ(std::ranges::adjacent_find(candidates), candidates.end());
+
+        // the candidates are a superset of the similar planes: filtering them gives the exhaustive search result
+        std::vector<size_t> similarCandidates;
+        std::ranges::copy_if(candidates, std::back_inserter(similarCandidates), [&](const size_t planeIndex) {
+            return is_plane_similar(planes[planeIndex], query);
+        });
+        EXPECT_EQ(similarCandidates, get_similar_planes(planes, query));
+    }
+}
+
+TEST(PlaneOrientationIndexTests, Empty)
+{
+    const Plane_Orientation_Index index;
+    std::vector<size_t> candidates {1, 2};
+    index.get_candidates(PlaneCameraCoordinates(vector3::UnitZ(), 500.0), candidates);
+    EXPECT_TRUE(candidates.empty());
+}
+
+TEST(PlaneOrientationIndexTests, AxisBins)
+{
+    EXPECT_EQ(Plane_Orientation_Index::get_axis_bin(vector3(0.9, 0.1, -0.4)), 0u);
+    EXPECT_EQ(Plane_Orientation_Index::get_axis_bin(vector3(0.1, -0.9, 0.4)), 1u);
+    // opposite normals are in the same bin
+    EXPECT_EQ(Plane_Orientation_Index::get_axis_bin(vector3(0.1, 0.4, -0.9)), 2u);
+    EXPECT_EQ(Plane_Orientation_Index::get_axis_bin(vector3(-0.1, -0.4, 0.9)), 2u);
+}
+
+TEST(PlaneOrientationIndexTests, OffsetRange)
+{
+    // same normals, offsets every half match distance
+    constexpr double offsetStep = parameters::matching::maximumDistanceForPlaneMatch_mm / 2.0;
+    tracked_plane_container planes;
+    for (uint i = 0; i < 20; ++i)
+        planes.emplace_back(vector3::UnitZ(), offsetStep * i);
+
+    const Plane_Orientation_Index index(planes);
+    std::vector<size_t> candidates;
+    index.get_candidates(PlaneCameraCoordinates(vector3::UnitZ(), offsetStep * 10.0), candidates);
+    // the far planes are not read
+    EXPECT_EQ(candidates, std::vector<size_t>({8, 9, 10, 11, 12}));
+
+    expect_same_as_exhaustive_search(planes, planes);
+}
+
+TEST(PlaneOrientationIndexTests, RandomPlanes)
+{
+    std::mt19937 randomEngine(1000);
+    for (uint test = 0; test < 20; ++test)
+    {
+        tracked_plane_container planes;
+        tracked_plane_container queries;
+        for (uint i = 0; i < 200; ++i)
+        {
+            planes.emplace_back(get_random_plane(vector3::Zero(), 1.0, 1000.0, randomEngine));
+            queries.emplace_back(get_random_plane(vector3::Zero(), 1.0, 1000.0, randomEngine));
+        }
+        expect_same_as_exhaustive_search(planes, queries);
+    }
+}
+
+TEST(PlaneOrientationIndexTests, BinBoundaries)
+{
+    // normals close to the bin boundaries: the similar planes are spread on several axis bins
+    std::mt19937 randomEngine(1000);
+    const std::vector<vector3> boundaryDirections {
+            vector3(1.0, 1.0, 1.0), vector3(1.0, -1.0, 0.0), vector3(0.0, 1.0, 1.0), vector3(-1.0, 0.0, 1.0)};
+    for (const vector3& direction: boundaryDirections)
+    {
+        tracked_plane_container planes;
+        tracked_plane_container queries;
+        for (uint i = 0; i < 200; ++i)
+        {
+            planes.emplace_back(get_random_plane(direction.normalized(), 0.15, 300.0, randomEngine));
+            queries.emplace_back(get_random_plane(-direction.normalized(), 0.15, 300.0, randomEngine));
+        }
+        expect_same_as_exhaustive_search(planes, queries);
+    }
+}
+
+} // namespace rgbd_slam::features::primitives
@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 #include "coordinates/polygon_coordinates.hpp"
+#include "utils/fixed_polygon.hpp"
 
 namespace rgbd_slam::utils {
 
@@ -151,4 +152,134 @@ TEST(SquareTests, Unions)
     EXPECT_EQ(rectangle.area(), 4e6 + 4e6);
 }
 
+TEST(SquareTests, CoveredUnion)
+{
+    const std::vector<vector3> pointsSquare({vector3(-1000.0, 1000.0, 0.0),
+                                             vector3(1000.0, 1000.0, 0.0),
+                                             vector3(-1000.0, -1000.0, 0.0),
+                                             vector3(1000.0, -1000.0, 0.0)});
+    const vector3 normal = vector3(0.0, 0.0, 1.0);
+    const vector3 center = vector3::Zero();
+
+    Polygon rectangle(pointsSquare, normal, center);
+
+    // grow the rectangle to the right
+    Polygon shiftedRectangle = rectangle.transform(normal, vector3(1000.0, 0.0, 0.0));
+    rectangle.merge_union(shiftedRectangle);
+    EXPECT_EQ(rectangle.area(), 6e6);
+    const std::vector<vector3>& mergedBoundary = rectangle.get_unprojected_boundary();
+
+    // merging a covered polygon, even with its own boundary points, should not change the boundary
+    const std::vector<vector3> pointsSmallSquare({vector3(-500.0, 500.0, 0.0),
+                                                  vector3(2000.0, 500.0, 0.0),
+                                                  vector3(-500.0, -500.0, 0.0),
+                                                  vector3(2000.0, -500.0, 0.0)});
+    rectangle.merge_union(Polygon(pointsSmallSquare, normal, center));
+    rectangle.merge_union(shiftedRectangle);
+
+    EXPECT_EQ(rectangle.area(), 6e6);
+    EXPECT_EQ(rectangle.get_unprojected_boundary(), mergedBoundary);
+}
+
+TEST(SquareTests, BoundsRejection)
+{
+    const std::vector<vector3> pointsSquare({vector3(-1000.0, 1000.0, 0.0),
+                                             vector3(1000.0, 1000.0, 0.0),
+                                             vector3(-1000.0, -1000.0, 0.0),
+                                             vector3(1000.0, -1000.0, 0.0)});
+    const vector3 normal = vector3(0.0, 0.0, 1.0);
+    const vector3 center = vector3::Zero();
+
+    const Polygon square(pointsSquare, normal, center);
+
+    // disjoint squares
+    const Polygon farSquare = square.transform(normal, vector3(5000.0, 0.0, 0.0));
+    EXPECT_EQ(square.inter_area(farSquare), 0.0);
+    EXPECT_EQ(square.inter_over_union(farSquare), 0.0);
+    EXPECT_NEAR(square.union_area(farSquare), 8e6, 0.1);
+
+    // overlap of a quarter of the square
+    const Polygon shiftedSquare = square.transform(normal, vector3(1000.0, 1000.0, 0.0));
+    EXPECT_NEAR(square.inter_area(shiftedSquare), 1e6, 0.1);
+    EXPECT_NEAR(square.inter_over_union(shiftedSquare), 1.0 / 7.0, 1e-6);
+    // thresholds that cannot be reached are rejected without computing the intersection
+    EXPECT_EQ(square.inter_area(shiftedSquare, 2e6), 0.0);
+    EXPECT_EQ(square.inter_over_union(shiftedSquare, 0.5), 0.0);
+    // reachable thresholds give the exact result
+    EXPECT_NEAR(square.inter_area(shiftedSquare, 0.5e6), 1e6, 0.1);
+    EXPECT_NEAR(square.inter_over_union(shiftedSquare, 0.1), 1.0 / 7.0, 1e-6);
+}
+
+TEST(SquareTests, ConcaveInter)
+{
+    const vector3 xAxis = vector3::UnitX();
+    const vector3 yAxis = vector3::UnitY();
+    const vector3 center = vector3::Zero();
+
+    // L shape of area 3e6, and a square of area 1e6 that covers its inner corner
+    const Polygon lShape({Polygon::point_2d(0.0, 0.0),
+                          Polygon::point_2d(2000.0, 0.0),
+                          Polygon::point_2d(2000.0, 1000.0),
+                          Polygon::point_2d(1000.0, 1000.0),
+                          Polygon::point_2d(1000.0, 2000.0),
+                          Polygon::point_2d(0.0, 2000.0)},
+                         xAxis,
+                         yAxis,
+                         center);
+    const Polygon square({Polygon::point_2d(500.0, 500.0),
+                          Polygon::point_2d(1500.0, 500.0),
+                          Polygon::point_2d(1500.0, 1500.0),
+                          Polygon::point_2d(500.0, 1500.0)},
+                         xAxis,
+                         yAxis,
+                         center);
+    EXPECT_NEAR(lShape.get_area(), 3e6, 0.1);
+
+    // the square without the quarter outside of the L
+    EXPECT_NEAR(lShape.inter_area(square), 0.75e6, 0.1);
+    EXPECT_NEAR(square.inter_area(lShape), 0.75e6, 0.1);
+    EXPECT_NEAR(lShape.union_area(square), 3.25e6, 0.1);
+    EXPECT_NEAR(square.union_area(lShape), 3.25e6, 0.1);
+    EXPECT_NEAR(lShape.inter_over_union(square), 0.75 / 3.25, 1e-6);
+
+    // convex hull of the L: the square of its bounds, without the triangle of the inner corner
+    const Polygon::polygon& hull = Polygon::compute_convex_hull({vector2(0.0, 0.0),
+                                                                 vector2(2000.0, 0.0),
+                                                                 vector2(2000.0, 1000.0),
+                                                                 vector2(1000.0, 1000.0),
+                                                                 vector2(1000.0, 2000.0),
+                                                                 vector2(0.0, 2000.0)});
+    EXPECT_EQ(hull.outer().size(), 6);
+    EXPECT_NEAR(boost::geometry::area(hull), 3.5e6, 0.1);
+}
+
+TEST(FixedPolygonTests, Convexity)
+{
+    const auto make_polygon = [](const std::vector<vector2>& vertices) {
+        Fixed_Polygon<8> polygon;
+        for (const vector2& vertex: vertices)
+            EXPECT_TRUE(polygon.push_back(vertex));
+        return polygon;
+    };
+
+    // both orientations, with a collinear vertex
+    EXPECT_TRUE(make_polygon({vector2(0.0, 0.0), vector2(1.0, 0.0), vector2(1.0, 1.0), vector2(0.0, 1.0)}).is_convex());
+    EXPECT_TRUE(make_polygon({vector2(0.0, 0.0), vector2(0.0, 1.0), vector2(1.0, 1.0), vector2(1.0, 0.0)}).is_convex());
+    EXPECT_TRUE(make_polygon({vector2(0.0, 0.0), vector2(1.0, 0.0), vector2(2.0, 0.0), vector2(1.0, 1.0)}).is_convex());
+
+    // too small, and concave
+    EXPECT_FALSE(make_polygon({vector2(0.0, 0.0), vector2(1.0, 0.0)}).is_convex());
+    EXPECT_FALSE(
+            make_polygon({vector2(0.0, 0.0), vector2(2.0, 0.0), vector2(1.0, 0.5), vector2(1.0, 2.0)}).is_convex());
+
+    // a pentagram turns in only one direction, but winds twice around its center
+    std::vector<vector2> pentagram;
+    for (uint i = 0; i < 5; ++i)
+    {
+        const double angle = static_cast<double>(i) * 4.0 * M_PI / 5.0;
+        pentagram.emplace_back(cos(angle), sin(angle));
+    }
+    EXPECT_FALSE(make_polygon(pentagram).is_convex());
+}
+
 } // namespace rgbd_slam::utils
\ No newline at end of file
@@ -1,6 +1,8 @@
 #include "matches_containers.hpp"
 #include "outputs/logger.hpp"
 #include "parameters.hpp"
+#include "pose_optimization/levenberg_marquardt_functors.hpp"
+#include "pose_optimization/local_bundle_adjustment.hpp"
 #include "pose_optimization/pose_optimization.hpp"
 #include "types.hpp"
 
@@ -16,6 +18,7 @@
 #include "map_management/map_features/map_primitive.hpp"
 
 #include <gtest/gtest.h>
+#include <unsupported/Eigen/NumericalDiff>
 #include <memory>
 #include <random>
 
@@ -149,6 +152,36 @@ matches_containers::match_container get_matched_points(const utils::Pose& endPos
     return matchedPoints;
 }
 
+matches_containers::match_container get_matched_points2d(const utils::Pose& endPose)
+{
+    const WorldToCameraMatrix& worldToCamera =
+            utils::compute_world_to_camera_transform(endPose.get_orientation_quaternion(), endPose.get_position());
+    // the inverse depth points are first seen from the origin
+    const CameraToWorldMatrix& firstCameraToWorld =
+            utils::compute_camera_to_world_transform(quaternion::Identity(), vector3::Zero());
+    const WorldToCameraMatrix& firstWorldToCamera = utils::compute_world_to_camera_transform(firstCameraToWorld);
+
+    vector6 standardDev(vector6::Ones());
+    standardDev(InverseDepthWorldPoint::inverseDepthIndex) = 1e-3;
+
+    size_t mapId = 1;
+    matches_containers::match_container matchedPoints;
+    for (const auto& point: get_cube_points(NUMBER_OF_POINTS_IN_CUBE, 0.0))
+    {
+        const WorldCoordinate worldPoint(point.x, point.y, point.z);
+        ScreenCoordinate2D transformedPoint;
+        if (not worldPoint.to_screen_coordinates(worldToCamera, transformedPoint))
+            continue;
+
+        const InverseDepthWorldPoint mapPoint(worldPoint.to_camera_coordinates(firstWorldToCamera),
+                                              firstCameraToWorld);
+        matchedPoints.push_back(std::make_shared<map_management::Point2dOptimizationFeature>(
+                transformedPoint, mapPoint, standardDev, mapId, 0));
+        mapId++;
+    }
+    return matchedPoints;
+}
+
 matches_containers::match_container get_matched_planes(const utils::Pose& endPose,
                                                        const double error = 0.0,
                                                        const double outlierProp = 0.0)
@@ -221,8 +254,9 @@ void run_test_optimization(const matches_containers::match_container& matchedFea
     utils::Pose endPose;
 
     matches_containers::match_sets inliersOutliers;
-    const bool isPoseValid = pose_optimization::Pose_Optimization::compute_optimized_pose(
-            initialPoseGuess, matchedFeatures, endPose, inliersOutliers);
+    pose_optimization::Pose_Optimization poseOptimization;
+    const bool isPoseValid =
+            poseOptimization.compute_optimized_pose(initialPoseGuess, matchedFeatures, endPose, inliersOutliers);
 
     if (not isPoseValid)
         FAIL();
@@ -999,6 +1033,49 @@ TEST(MultiFeatureTests, BadFirstGuess)
     run_test_optimization(matchedFeatures, trueEndPose, initialPoseGuess);
 }
 
+/**
+ *          Jacobian TESTS
+ */
+
+TEST(JacobianTests, AnalyticMatchesNumerical)
+{
+    if (not Parameters::is_valid())
+    {
+        Parameters::load_defaut();
+    }
+
+    // True End pose
+    const vector3 truePosition(END_POSITION, END_POSITION, END_POSITION);
+    const EulerAngles trueEulerAngles(END_ROTATION_YAW, END_ROTATION_PITCH, END_ROTATION_ROLL);
+    const quaternion trueQuaternion(utils::get_quaternion_from_euler_angles(trueEulerAngles));
+    const utils::Pose trueEndPose(truePosition, trueQuaternion);
+
+    matches_containers::match_container matchedFeatures = get_matched_planes(trueEndPose, PLANE_ERROR);
+    matchedFeatures.merge(get_matched_points(trueEndPose, POINTS_ERROR));
+    matchedFeatures.merge(get_matched_points2d(trueEndPose));
+
+    size_t optimizationParts = 0;
+    for (const auto& feature: matchedFeatures)
+        optimizationParts += feature->get_feature_part_count();
+
+    // evaluate the jacobians away from the solution
+    const vector3 positionGuess(END_POSITION * MEDIUM_GUESS, END_POSITION * MEDIUM_GUESS, END_POSITION * MEDIUM_GUESS);
+    const EulerAngles eulerAnglesGuess(
+            END_ROTATION_YAW * MEDIUM_GUESS, END_ROTATION_PITCH * MEDIUM_GUESS, END_ROTATION_ROLL * MEDIUM_GUESS);
+    const vector6& coefficients = pose_optimization::get_optimization_coefficient_from_pose(
+            utils::PoseBase(positionGuess, utils::get_quaternion_from_euler_angles(eulerAnglesGuess)));
+
+    const pose_optimization::Global_Pose_Estimator estimator(optimizationParts, matchedFeatures);
+    matrixd analyticJacobian(optimizationParts, 6);
+    estimator.df(coefficients, analyticJacobian);
+
+    const Eigen::NumericalDiff<pose_optimization::Global_Pose_Estimator, Eigen::Central> numericalEstimator(estimator);
+    matrixd numericalJacobian(optimizationParts, 6);
+    numericalEstimator.df(coefficients, numericalJacobian);
+
+    EXPECT_LT((analyticJacobian - numericalJacobian).norm(), 1e-4 * numericalJacobian.norm());
+}
+
 /**
  *          Planes with outliers TESTS
  */
@@ -1295,6 +1372,92 @@ TEST(MultiFeatureOutliersTests, BadFirstGuess_100PercentOutliers)
     run_test_optimization(matchedFeatures, trueEndPose, initialPoseGuess);
 }
 
+TEST(LocalBundleAdjustmentTests, noisyKeyframesAndMapPoints)
+{
+    if (not Parameters::is_valid())
+    {
+        Parameters::load_defaut();
+    }
+
+    static constexpr size_t keyframeCount = 5;
+    static constexpr double mapPointError = 20.0; // mm
+    static constexpr double trackingError = 10.0; // mm
+
+    std::mt19937 randomEngine(42);
+    std::normal_distribution<double> noise(0.0, 1.0);
+    // the camera looks along the world x axis
+    std::uniform_real_distribution<double> depth(2000.0, 4000.0);
+    std::uniform_real_distribution<double> width(-1000.0, 1000.0);
+    std::uniform_real_distribution<double> height(-800.0, 800.0);
+
+    std::vector<vector3> truePoints;
+    for (size_t i = 0; i < 60; ++i)
+    {
+        truePoints.emplace_back(depth(randomEngine), width(randomEngine), height(randomEngine));
+    }
+
+    std::deque<pose_optimization::Bundle_Adjustment_Keyframe> window;
+    std::vector<utils::PoseBase> truePoses;
+    for (size_t k = 0; k < keyframeCount; ++k)
+    {
+        const double step = static_cast<double>(k);
+        const utils::PoseBase truePose(vector3(100.0, 20.0, 30.0) * step,
+                                       quaternion(Eigen::AngleAxisd(0.03 * step, vector3::UnitY())));
+        truePoses.emplace_back(truePose);
+        const WorldToCameraMatrix& worldToCamera = utils::compute_world_to_camera_transform(
+                truePose.get_orientation_quaternion(), truePose.get_position());
+
+        // the first keyframe pose is fixed by the bundle adjustment
+        pose_optimization::Bundle_Adjustment_Keyframe keyframe;
+        keyframe._pose = truePose;
+        if (k > 0)
+        {
+            const vector3& positionNoise = vector3(noise(randomEngine), noise(randomEngine), noise(randomEngine));
+            keyframe._pose.set_parameters(
+                    truePose.get_position() + trackingError * positionNoise,
+                    truePose.get_orientation_quaternion() * quaternion(Eigen::AngleAxisd(0.01, vector3::UnitX())));
+        }
+        for (size_t i = 0; i < truePoints.size(); ++i)
+        {
+            ScreenCoordinate2D screenPoint;
+            if (not WorldCoordinate(truePoints[i]).to_screen_coordinates(worldToCamera, screenPoint))
+                continue;
+            const vector3& mapPoint =
+                    truePoints[i] +
+                    mapPointError * vector3(noise(randomEngine), noise(randomEngine), noise(randomEngine));
+            keyframe._points.push_back(
+                    {i, screenPoint, WorldCoordinate(mapPoint), vector3::Constant(mapPointError)});
+        }
+        window.emplace_back(keyframe);
+    }
+
+    std::vector<utils::PoseBase> refinedPoses;
+    pose_optimization::Bundle_Adjustment_Corrections corrections;
+    ASSERT_TRUE(pose_optimization::Local_Bundle_Adjustment::compute_corrections(window, refinedPoses, corrections));
+    ASSERT_EQ(refinedPoses.size(), keyframeCount);
+
+    for (size_t k = 1; k < keyframeCount; ++k)
+    {
+        const double positionError = (refinedPoses[k].get_position() - truePoses[k].get_position()).norm();
+        EXPECT_LT(positionError, trackingError / 2.0);
+        EXPECT_LT(refinedPoses[k].get_rotation_error(truePoses[k]),
+                  window[k]._pose.get_rotation_error(truePoses[k]) / 2.0);
+    }
+
+    // the displacements move the last estimates toward the true map points
+    double initialError = 0.0;
+    double refinedError = 0.0;
+    for (const auto& observation: window.back()._points)
+    {
+        ASSERT_TRUE(corrections._pointDisplacements.contains(observation._mapId));
+        const vector3& truePoint = truePoints[observation._mapId];
+        initialError += (observation._mapPoint - truePoint).norm();
+        refinedError +=
+                (observation._mapPoint + corrections._pointDisplacements.at(observation._mapId) - truePoint).norm();
+    }
+    EXPECT_LT(refinedError, initialError / 2.0);
+}
+
 // TODO: run tests with 2D points
 
 } // namespace rgbd_slam
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include <gtest/gtest.h>
+#include "utils/spsc_queue.hpp"
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace rgbd_slam::utils {
+
+TEST(SpscQueueTests, FullAndEmpty)
+{
+    Spsc_Queue<int> queue(3);
+    EXPECT_EQ(queue.capacity(), 3u);
+    EXPECT_EQ(queue.size(), 0u);
+
+    int value = -1;
+    EXPECT_FALSE(queue.try_pop(value));
+    EXPECT_EQ(value, -1);
+
+    EXPECT_TRUE(queue.try_push(1));
+    EXPECT_TRUE(queue.try_push(2));
+    EXPECT_TRUE(queue.try_push(3));
+    EXPECT_EQ(queue.size(), 3u);
+    // a full queue discards the new elements
+    EXPECT_FALSE(queue.try_push(4));
+    EXPECT_EQ(queue.size(), 3u);
+
+    EXPECT_TRUE(queue.try_pop(value));
+    EXPECT_EQ(value, 1);
+    EXPECT_TRUE(queue.try_push(5));
+    for (const int expectedValue: {2, 3, 5})
+    {
+        EXPECT_TRUE(queue.try_pop(value));
+        EXPECT_EQ(value, expectedValue);
+    }
+    EXPECT_FALSE(queue.try_pop(value));
+    EXPECT_EQ(queue.size(), 0u);
+}
+
+TEST(SpscQueueTests, NullCapacity)
+{
+    // the capacity is at least one
+    Spsc_Queue<int> queue(0);
+    EXPECT_EQ(queue.capacity(), 1u);
+    EXPECT_TRUE(queue.try_push(1));
+    EXPECT_FALSE(queue.try_push(2));
+}
+
+TEST(SpscQueueTests, WrapAround)
+{
+    // push and pop more elements than the ring slots, with every possible fill level
+    constexpr size_t capacity = 4;
+    Spsc_Queue<size_t> queue(capacity);
+    size_t nextPushed = 0;
+    size_t nextPopped = 0;
+    for (size_t round = 0; round < 10 * capacity; ++round)
+    {
+        const size_t pushCount = round % (capacity + 1);
+        for (size_t i = 0; i < pushCount; ++i)
+        {
+            if (queue.size() == capacity)
+                EXPECT_FALSE(queue.try_push(size_t(nextPushed)));
+            else
+                EXPECT_TRUE(queue.try_push(size_t(nextPushed++)));
+        }
+        EXPECT_EQ(queue.size(), nextPushed - nextPopped);
+
+        const size_t popCount = (round * 3) % (capacity + 1);
+        for (size_t i = 0; i < popCount; ++i)
+        {
+            size_t value = 0;
+            if (nextPopped == nextPushed)
+            {
+                EXPECT_FALSE(queue.try_pop(value));
+                continue;
+            }
+            EXPECT_TRUE(queue.try_pop(value));
+            EXPECT_EQ(value, nextPopped++);
+        }
+        EXPECT_EQ(queue.size(), nextPushed - nextPopped);
+    }
+    EXPECT_GT(nextPopped, 2 * capacity);
+}
+
+TEST(SpscQueueTests, PoppedElementsReleaseTheirResources)
+{
+    Spsc_Queue<std::shared_ptr<int>> queue(2);
+    const std::shared_ptr<int> resource = std::make_shared<int>(1);
+    EXPECT_TRUE(queue.try_push(std::shared_ptr<int>(resource)));
+    EXPECT_EQ(resource.use_count(), 2);
+
+    std::shared_ptr<int> popped;
+    EXPECT_TRUE(queue.try_pop(popped));
+    popped.reset();
+    // the slot does not keep a copy
+    EXPECT_EQ(resource.use_count(), 1);
+}
+
+TEST(SpscQueueTests, Close)
+{
+    Spsc_Queue<int> queue(2);
+    EXPECT_TRUE(queue.try_push(1));
+    queue.close();
+    EXPECT_FALSE(queue.try_push(2));
+
+    // the elements pushed before the close are still popped, then pop stops waiting
+    int value = 0;
+    EXPECT_TRUE(queue.pop(value));
+    EXPECT_EQ(value, 1);
+    EXPECT_FALSE(queue.pop(value));
+}
+
+TEST(SpscQueueTests, ProducerAndConsumerThreads)
+{
+    constexpr int elementCount = 100000;
+    Spsc_Queue<int> queue(16);
+
+    std::vector<int> poppedValues;
+    poppedValues.reserve(elementCount);
+    std::thread consumer([&queue, &poppedValues]() {
+        int value = 0;
+        while (queue.pop(value))
+            poppedValues.push_back(value);
+    });
+
+    for (int i = 0; i < elementCount; ++i)
+    {
+        // the producer never waits: retry the pushes on a full queue
+        while (not queue.try_push(int(i)))
+            std::this_thread::yield();
+    }
+    queue.close();
+    consumer.join();
+
+    // all the elements, in the push order
+    ASSERT_EQ(poppedValues.size(), static_cast<size_t>(elementCount));
+    for (int i = 0; i < elementCount; ++i)
+        EXPECT_EQ(poppedValues[static_cast<size_t>(i)], i);
+}
+
+} // namespace rgbd_slam::utils
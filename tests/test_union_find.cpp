@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+#include "utils/union_find.hpp"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace rgbd_slam::utils {
+
+using index_pairs = std::vector<std::pair<uint, uint>>;
+
+/**
+ * \brief Naive reference of merge_adjacent_groups: every merge relabels all the elements of the merged group
+ */
+template<typename MergeFunction>
+std::vector<uint> merge_groups_naively(const uint elementCount,
+                                       const index_pairs& adjacencies,
+                                       MergeFunction&& try_merge)
+{
+    std::vector<uint> labels(elementCount);
+    for (uint i = 0; i < elementCount; ++i)
+        labels[i] = i;
+
+    for (const auto& [elementIndex, neighbourIndex]: adjacencies)
+    {
+        const uint elementLabel = labels[elementIndex];
+        const uint neighbourLabel = labels[neighbourIndex];
+        if (elementLabel == neighbourLabel)
+            continue;
+
+        const uint rootLabel = std::min(elementLabel, neighbourLabel);
+        const uint mergedLabel = std::max(elementLabel, neighbourLabel);
+        if (not try_merge(rootLabel, mergedLabel))
+            continue;
+        std::ranges::replace(labels, mergedLabel, rootLabel);
+    }
+    return labels;
+}
+
+/**
+ * \brief Random sorted and unique adjacent pairs, lower index first
+ */
+index_pairs get_random_adjacencies(const uint elementCount, const uint pairCount, std::mt19937& randomEngine)
+{
+    std::uniform_int_distribution<uint> indexDistribution(0, elementCount - 1);
+    index_pairs adjacencies;
+    for (uint i = 0; i < pairCount; ++i)
+    {
+        const uint first = indexDistribution(randomEngine);
+        const uint second = indexDistribution(randomEngine);
+        if (first != second)
+            adjacencies.emplace_back(std::min(first, second), std::max(first, second));
+    }
+    std::ranges::sort(adjacencies);
+    adjacencies.erase(std::unique(adjacencies.begin(), adjacencies.end()), adjacencies.end());
+    return adjacencies;
+}
+
+TEST(UnionFindTests, NoAdjacency)
+{
+    const std::vector<uint>& roots = merge_adjacent_groups(4u, index_pairs {}, [](uint, uint) {
+        return true;
+    });
+    EXPECT_EQ(roots, std::vector<uint>({0, 1, 2, 3}));
+}
+
+TEST(UnionFindTests, LowestIndexIsRoot)
+{
+    // two chains: 0 - 3 - 5 and 1 - 4, 2 stays alone
+    const index_pairs adjacencies {{0, 3}, {1, 4}, {3, 5}};
+    const std::vector<uint>& roots = merge_adjacent_groups(6u, adjacencies, [](uint, uint) {
+        return true;
+    });
+    EXPECT_EQ(roots, std::vector<uint>({0, 1, 2, 0, 1, 0}));
+}
+
+TEST(UnionFindTests, RefusedMerges)
+{
+    // the merge of the groups of 0 and 2 is refused: 2 and 3 stay in their own group
+    const index_pairs adjacencies {{0, 1}, {1, 2}, {2, 3}};
+    std::vector<std::pair<uint, uint>> testedRoots;
+    const std::vector<uint>& roots = merge_adjacent_groups(4u, adjacencies, [&testedRoots](uint root, uint merged) {
+        testedRoots.emplace_back(root, merged);
+        return merged != 2;
+    });
+    EXPECT_EQ(roots, std::vector<uint>({0, 0, 2, 2}));
+    // the function is called with the group roots, lowest first
+    EXPECT_EQ(testedRoots, index_pairs({{0, 1}, {0, 2}, {2, 3}}));
+}
+
+TEST(UnionFindTests, AllMergedMatchesNaive)
+{
+    std::mt19937 randomEngine(1000);
+    for (uint test = 0; test < 50; ++test)
+    {
+        const uint elementCount = 2 + test * 4;
+        const index_pairs& adjacencies = get_random_adjacencies(elementCount, elementCount, randomEngine);
+        const auto always_merge = [](uint, uint) {
+            return true;
+        };
+        EXPECT_EQ(merge_adjacent_groups(elementCount, adjacencies, always_merge),
+                  merge_groups_naively(elementCount, adjacencies, always_merge));
+    }
+}
+
+TEST(UnionFindTests, BoundedGroupsMatchNaive)
+{
+    std::mt19937 randomEngine(1000);
+    for (uint test = 0; test < 50; ++test)
+    {
+        const uint elementCount = 2 + test * 4;
+        const index_pairs& adjacencies = get_random_adjacencies(elementCount, elementCount * 2, randomEngine);
+
+        // like the planes, the merge depends on the groups: refuse the groups above a size
+        const auto get_bounded_merge = [elementCount](std::vector<uint>& groupSizes) {
+            groupSizes.assign(elementCount, 1);
+            return [&groupSizes](uint root, uint merged) {
+                if (groupSizes[root] + groupSizes[merged] > 4)
+                    return false;
+                groupSizes[root] += groupSizes[merged];
+                return true;
+            };
+        };
+        std::vector<uint> groupSizes;
+        std::vector<uint> naiveGroupSizes;
+        EXPECT_EQ(merge_adjacent_groups(elementCount, adjacencies, get_bounded_merge(groupSizes)),
+                  merge_groups_naively(elementCount, adjacencies, get_bounded_merge(naiveGroupSizes)));
+        EXPECT_EQ(groupSizes, naiveGroupSizes);
+    }
+}
+
+} // namespace rgbd_slam::utils
@@ -319,7 +319,6 @@ namespace cv {
 
         if(SCALE != 1)
         {
-            Mat gaussian_img;
             const double sigma = (SCALE < 1)?(SIGMA_SCALE / SCALE):(SIGMA_SCALE);
             const double sprec = 3;
             const unsigned int h =  (unsigned int)(ceil(sigma * sqrt(2 * sprec * log(10.0))));
@@ -340,8 +339,9 @@ namespace cv {
 
         // // Initialize region only when needed
         // Mat region = Mat::zeros(scaled_image.size(), CV_8UC1);
-        used = Mat_<uchar>::zeros(scaled_image.size()); // zeros = NOTUSED
-        std::vector<RegionPoint> reg;
+        used.create(scaled_image.size());
+        used.setTo(NOTUSED);
+        std::vector<RegionPoint>& reg = region_points;
 
         // Search for line segments
         for(size_t i = 0, points_size = ordered_points.size(); i < points_size; ++i)
@@ -396,9 +396,9 @@ namespace cv {
     }
 
     void LSD::ll_angle(const double& threshold, const unsigned int& n_bins) {
-        //Initialize data
-        angles = Mat_<double>(scaled_image.size());
-        modgrad = Mat_<double>(scaled_image.size());
+        // Initialize data: the workspace is only reallocated when the image size changes
+        angles.create(scaled_image.size());
+        modgrad.create(scaled_image.size());
 
         img_width = scaled_image.cols;
         img_height = scaled_image.rows;
@@ -406,23 +406,42 @@ namespace cv {
         // Undefined the down and right boundaries
         angles.row(img_height - 1).setTo(NOTDEF);
         angles.col(img_width - 1).setTo(NOTDEF);
+        modgrad.row(img_height - 1).setTo(0);
+        modgrad.col(img_width - 1).setTo(0);
+
+        // Computing gradient for remaining pixels, one row at a time: the integer gradients are written in float
+        // rows, and the norms and angles are computed by the vectorized magnitude and phase functions
+        const int gradient_width = img_width - 1;
+        gradient_x_row.create(1, gradient_width);
+        minus_gradient_y_row.create(1, gradient_width);
+        norm_row.create(1, gradient_width);
+        angle_row.create(1, gradient_width);
+        float* gx_row = gradient_x_row.ptr<float>(0);
+        float* minus_gy_row = minus_gradient_y_row.ptr<float>(0);
+        const float* norms = norm_row.ptr<float>(0);
+        const float* row_angles = angle_row.ptr<float>(0);
 
-        // Computing gradient for remaining pixels
         double max_grad = -1;
         for(int y = 0; y < img_height - 1; ++y)
         {
             const uchar* scaled_image_row = scaled_image.ptr<uchar>(y);
             const uchar* next_scaled_image_row = scaled_image.ptr<uchar>(y+1);
+            for(int x = 0; x < gradient_width; ++x)
+            {
+                const int DA = next_scaled_image_row[x + 1] - scaled_image_row[x];
+                const int BC = scaled_image_row[x + 1] - next_scaled_image_row[x];
+                gx_row[x] = float(DA + BC);    // gradient x component
+                minus_gy_row[x] = float(BC - DA);    // opposite of the gradient y component
+            }
+            // norm = sqrt((gx * gx + gy * gy) / 4), angle = atan2(gx, -gy)
+            magnitude(minus_gradient_y_row, gradient_x_row, norm_row);
+            phase(minus_gradient_y_row, gradient_x_row, angle_row);
+
             double* angles_row = angles.ptr<double>(y);
             double* modgrad_row = modgrad.ptr<double>(y);
-            for(int x = 0; x < img_width-1; ++x)
+            for(int x = 0; x < gradient_width; ++x)
             {
-                int DA = next_scaled_image_row[x + 1] - scaled_image_row[x];
-                int BC = scaled_image_row[x + 1] - next_scaled_image_row[x];
-                int gx = DA + BC;    // gradient x component
-                int gy = DA - BC;    // gradient y component
-                double norm = std::sqrt((gx * gx + gy * gy) / 4.0); // gradient norm
-
+                const double norm = 0.5 * norms[x]; // gradient norm
                 modgrad_row[x] = norm;    // store gradient
 
                 if (norm <= threshold)  // norm too small, gradient no defined
@@ -431,30 +450,48 @@ namespace cv {
                 }
                 else
                 {
-                    angles_row[x] = fastAtan2(float(gx), float(-gy)) * DEG_TO_RADS;  // gradient angle computation
+                    angles_row[x] = row_angles[x];  // gradient angle, in radians
                     if (norm > max_grad) { max_grad = norm; }
                 }
+            }
+        }
 
+        // Pseudo order the points by gradient norm, with a bucket sort on n_bins bins (in decreasing norm order).
+        // The points with an undefined angle are never used as seeds: they are not ordered
+        const double bin_coef = (max_grad > 0) ? double(n_bins - 1) / max_grad : 0; // If all image is smooth, max_grad <= 0
+        bin_counts.assign(n_bins + 1, 0);
+        for(int y = 0; y < img_height - 1; ++y)
+        {
+            const double* modgrad_row = modgrad.ptr<double>(y);
+            const double* angles_row = angles.ptr<double>(y);
+            for(int x = 0; x < gradient_width; ++x)
+            {
+                if (angles_row[x] == NOTDEF)
+                    continue;
+                ++bin_counts[n_bins - 1 - unsigned(modgrad_row[x] * bin_coef) + 1];
             }
         }
+        // bin_counts[i] is now the start of the bin i in the ordered points
+        for(unsigned int i = 1; i <= n_bins; ++i)
+        {
+            bin_counts[i] += bin_counts[i - 1];
+        }
 
-        // Compute histogram of gradient values
-        double bin_coef = (max_grad > 0) ? double(n_bins - 1) / max_grad : 0; // If all image is smooth, max_grad <= 0
+        ordered_points.resize(bin_counts[n_bins]);
         for(int y = 0; y < img_height - 1; ++y)
         {
             const double* modgrad_row = modgrad.ptr<double>(y);
-            for(int x = 0; x < img_width - 1; ++x)
+            const double* angles_row = angles.ptr<double>(y);
+            for(int x = 0; x < gradient_width; ++x)
             {
-                normPoint _point;
-                int i = int(modgrad_row[x] * bin_coef);
+                if (angles_row[x] == NOTDEF)
+                    continue;
+                const int i = int(modgrad_row[x] * bin_coef);
+                normPoint& _point = ordered_points[bin_counts[n_bins - 1 - unsigned(i)]++];
                 _point.p = Point(x, y);
                 _point.norm = i;
-                ordered_points.push_back(_point);
             }
         }
-
-        // Sort
-        std::sort(ordered_points.begin(), ordered_points.end(), compare_norm);
     }
 
     void LSD::region_grow(const Point2i& s, std::vector<RegionPoint>& reg, double& reg_angle, const double& prec) {
@@ -124,6 +124,15 @@ namespace cv {
             };
 
             std::vector<normPoint> ordered_points;
+
+            // workspace, kept between calls
+            Mat gaussian_img;
+            Mat_<float> gradient_x_row;
+            Mat_<float> minus_gradient_y_row;
+            Mat_<float> norm_row;
+            Mat_<float> angle_row;
+            std::vector<unsigned int> bin_counts;
+            std::vector<RegionPoint> region_points;
             std::vector<Mat> gaussianPyrs;
 
             struct rect